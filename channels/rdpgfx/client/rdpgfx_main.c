@@ -141,6 +141,220 @@ static UINT rdpgfx_send_caps_advertise_pdu(RDPGFX_CHANNEL_CALLBACK* callback)
 	return error;
 }
 
+/**
+ * The graphics pipeline tiles are kept next to the persistent bitmap cache
+ * file, both caches use the same on-disk format.
+ */
+static char* rdpgfx_get_persistent_cache_file(RDPGFX_PLUGIN* gfx)
+{
+	size_t length;
+	char* filename;
+	rdpSettings* settings = gfx->settings;
+
+	if (!settings->BitmapCachePersistEnabled || !settings->BitmapCachePersistFile)
+		return NULL;
+
+	length = strlen(settings->BitmapCachePersistFile) + 5;
+	filename = (char*) malloc(length);
+
+	if (filename)
+		sprintf_s(filename, length, "%s.gfx", settings->BitmapCachePersistFile);
+
+	return filename;
+}
+
+static void rdpgfx_release_cache_import_offer(RDPGFX_PLUGIN* gfx)
+{
+	persistent_cache_free(gfx->persistent);
+	gfx->persistent = NULL;
+	gfx->CacheImportCount = 0;
+}
+
+/**
+ * Function description
+ * Offers the tiles of the persistent cache to the server. The cache file
+ * stays mapped until the cache import reply tells which entries to restore.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_send_cache_import_offer_pdu(RDPGFX_CHANNEL_CALLBACK* callback)
+{
+	UINT error;
+	wStream* s;
+	UINT16 index;
+	UINT64 cacheSize = 0;
+	UINT64 maxCacheSize;
+	char* filename;
+	RDPGFX_HEADER header;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU pdu;
+	PERSISTENT_CACHE_ENTRY* entry;
+	RDPGFX_PLUGIN* gfx = (RDPGFX_PLUGIN*) callback->plugin;
+	rdpgfx_release_cache_import_offer(gfx);
+
+	if (!(filename = rdpgfx_get_persistent_cache_file(gfx)))
+		return CHANNEL_RC_OK;
+
+	if (!(gfx->persistent = persistent_cache_new()))
+	{
+		free(filename);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!persistent_cache_open(gfx->persistent, filename, FALSE))
+	{
+		free(filename);
+		rdpgfx_release_cache_import_offer(gfx);
+		return CHANNEL_RC_OK;
+	}
+
+	free(filename);
+	maxCacheSize = (gfx->SmallCache ? 16 : 100) * 1024 * 1024;
+
+	while (gfx->CacheImportCount < RDPGFX_CACHE_ENTRY_MAX_COUNT)
+	{
+		entry = &gfx->CacheImportEntries[gfx->CacheImportCount];
+
+		if (!persistent_cache_read_entry(gfx->persistent, entry))
+			break;
+
+		cacheSize += entry->width * entry->height * 4;
+
+		if (cacheSize > maxCacheSize)
+			break;
+
+		gfx->CacheImportCount++;
+	}
+
+	if (gfx->CacheImportCount == 0)
+	{
+		rdpgfx_release_cache_import_offer(gfx);
+		return CHANNEL_RC_OK;
+	}
+
+	pdu.cacheEntriesCount = gfx->CacheImportCount;
+	pdu.cacheEntries = (RDPGFX_CACHE_ENTRY_METADATA*) calloc(pdu.cacheEntriesCount,
+	                   sizeof(RDPGFX_CACHE_ENTRY_METADATA));
+
+	if (!pdu.cacheEntries)
+	{
+		WLog_ERR(TAG, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	for (index = 0; index < gfx->CacheImportCount; index++)
+	{
+		entry = &gfx->CacheImportEntries[index];
+		pdu.cacheEntries[index].cacheKey = entry->key64;
+		pdu.cacheEntries[index].bitmapLength = entry->width * entry->height * 4;
+	}
+
+	header.flags = 0;
+	header.cmdId = RDPGFX_CMDID_CACHEIMPORTOFFER;
+	header.pduLength = RDPGFX_HEADER_SIZE + 2 + (gfx->CacheImportCount * 12);
+	WLog_DBG(TAG, "SendCacheImportOfferPdu: cacheEntriesCount: %d",
+	         gfx->CacheImportCount);
+	s = Stream_New(NULL, header.pduLength);
+
+	if (!s)
+	{
+		WLog_ERR(TAG, "Stream_New failed!");
+		free(pdu.cacheEntries);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if ((error = rdpgfx_write_header(s, &header)) ||
+	    (error = rdpgfx_write_cache_import_offer(s, &pdu)))
+	{
+		WLog_ERR(TAG, "failed to write the cache import offer with error %u!", error);
+		free(pdu.cacheEntries);
+		Stream_Free(s, TRUE);
+		return error;
+	}
+
+	free(pdu.cacheEntries);
+	Stream_SealLength(s);
+	error = callback->channel->Write(callback->channel, (UINT32) Stream_Length(s),
+	                                 Stream_Buffer(s), NULL);
+	Stream_Free(s, TRUE);
+	return error;
+}
+
+/**
+ * Function description
+ * Writes the cache slots in use to the persistent cache before they are
+ * evicted on channel close.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_save_persistent_cache(RDPGFX_PLUGIN* gfx)
+{
+	UINT error = CHANNEL_RC_OK;
+	UINT16 index;
+	UINT32 count = 0;
+	char* filename;
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent;
+	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
+	/* the file must not be mapped while it is rewritten */
+	rdpgfx_release_cache_import_offer(gfx);
+
+	if (!context || !context->ExportCacheEntry)
+		return CHANNEL_RC_OK;
+
+	for (index = 0; index < gfx->MaxCacheSlot; index++)
+	{
+		if (gfx->CacheSlots[index])
+			break;
+	}
+
+	/* keep the previous cache if this session never cached anything */
+	if (index == gfx->MaxCacheSlot)
+		return CHANNEL_RC_OK;
+
+	if (!(filename = rdpgfx_get_persistent_cache_file(gfx)))
+		return CHANNEL_RC_OK;
+
+	if (!(persistent = persistent_cache_new()))
+	{
+		free(filename);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!persistent_cache_open(persistent, filename, TRUE))
+	{
+		WLog_ERR(TAG, "failed to open persistent cache %s", filename);
+		goto out;
+	}
+
+	for (index = 0; (index < gfx->MaxCacheSlot) &&
+	     (count < RDPGFX_CACHE_ENTRY_MAX_COUNT); index++)
+	{
+		if (!gfx->CacheSlots[index])
+			continue;
+
+		ZeroMemory(&entry, sizeof(entry));
+
+		if (context->ExportCacheEntry(context, index, &entry) != CHANNEL_RC_OK)
+			continue;
+
+		if (!persistent_cache_write_entry(persistent, &entry))
+		{
+			WLog_ERR(TAG, "failed to write persistent cache %s", filename);
+			free(entry.data);
+			error = ERROR_WRITE_FAULT;
+			break;
+		}
+
+		free(entry.data);
+		count++;
+	}
+
+out:
+	persistent_cache_free(persistent);
+	free(filename);
+	return error;
+}
+
 /**
  * Function description
  *
@@ -331,37 +545,35 @@ static UINT rdpgfx_recv_cache_import_reply_pdu(RDPGFX_CHANNEL_CALLBACK* callback
 	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
 	UINT error = CHANNEL_RC_OK;
 
-	if (Stream_GetRemainingLength(s) < 2)
+	if ((error = rdpgfx_read_cache_import_reply(s, &pdu)))
 	{
-		WLog_ERR(TAG, "not enough data!");
-		return ERROR_INVALID_DATA;
+		WLog_ERR(TAG, "rdpgfx_read_cache_import_reply failed with error %u!", error);
+		return error;
 	}
 
-	Stream_Read_UINT16(s, pdu.importedEntriesCount); /* cacheSlot (2 bytes) */
+	WLog_DBG(TAG, "RecvCacheImportReplyPdu: importedEntriesCount: %d",
+	         pdu.importedEntriesCount);
 
-	if (Stream_GetRemainingLength(s) < (size_t)(pdu.importedEntriesCount * 2))
+	/* cacheSlots[index] is the slot of the index-th offered entry, 0 if rejected */
+	for (index = 0; context && context->ImportCacheEntry &&
+	     (index < pdu.importedEntriesCount) && (index < gfx->CacheImportCount); index++)
 	{
-		WLog_ERR(TAG, "not enough data!");
-		return ERROR_INVALID_DATA;
-	}
+		UINT16 cacheSlot = pdu.cacheSlots[index];
 
-	pdu.cacheSlots = (UINT16*) calloc(pdu.importedEntriesCount, sizeof(UINT16));
+		if ((cacheSlot == 0) || (cacheSlot >= gfx->MaxCacheSlot))
+			continue;
 
-	if (!pdu.cacheSlots)
-	{
-		WLog_ERR(TAG, "calloc failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
-
-	for (index = 0; index < pdu.importedEntriesCount; index++)
-	{
-		Stream_Read_UINT16(s, pdu.cacheSlots[index]); /* cacheSlot (2 bytes) */
+		if ((error = context->ImportCacheEntry(context, cacheSlot,
+		                                       &gfx->CacheImportEntries[index])))
+		{
+			WLog_ERR(TAG, "context->ImportCacheEntry failed with error %u", error);
+			break;
+		}
 	}
 
-	WLog_DBG(TAG, "RecvCacheImportReplyPdu: importedEntriesCount: %d",
-	         pdu.importedEntriesCount);
+	rdpgfx_release_cache_import_offer(gfx);
 
-	if (context)
+	if (context && !error)
 	{
 		IFCALLRET(context->CacheImportReply, error, context, &pdu);
 
@@ -1260,9 +1472,14 @@ static UINT rdpgfx_on_data_received(IWTSVirtualChannelCallback*
  */
 static UINT rdpgfx_on_open(IWTSVirtualChannelCallback* pChannelCallback)
 {
+	UINT error;
 	RDPGFX_CHANNEL_CALLBACK* callback = (RDPGFX_CHANNEL_CALLBACK*) pChannelCallback;
 	WLog_DBG(TAG, "OnOpen");
-	return rdpgfx_send_caps_advertise_pdu(callback);
+
+	if ((error = rdpgfx_send_caps_advertise_pdu(callback)))
+		return error;
+
+	return rdpgfx_send_cache_import_offer_pdu(callback);
 }
 
 /**
@@ -1306,6 +1523,7 @@ static UINT rdpgfx_on_close(IWTSVirtualChannelCallback* pChannelCallback)
 	}
 
 	free(pKeys);
+	rdpgfx_save_persistent_cache(gfx);
 
 	for (index = 0; index < gfx->MaxCacheSlot; index++)
 	{
@@ -1440,6 +1658,7 @@ static UINT rdpgfx_plugin_terminated(IWTSPlugin* pPlugin)
 
 	free(pKeys);
 	HashTable_Free(gfx->SurfaceTable);
+	rdpgfx_save_persistent_cache(gfx);
 
 	for (index = 0; index < gfx->MaxCacheSlot; index++)
 	{
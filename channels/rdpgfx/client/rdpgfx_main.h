@@ -78,6 +78,10 @@ struct _RDPGFX_PLUGIN
 	UINT16 MaxCacheSlot;
 	void* CacheSlots[25600];
 	rdpContext* rdpcontext;
+
+	rdpPersistentCache* persistent;
+	UINT16 CacheImportCount;
+	PERSISTENT_CACHE_ENTRY CacheImportEntries[RDPGFX_CACHE_ENTRY_MAX_COUNT];
 };
 typedef struct _RDPGFX_PLUGIN RDPGFX_PLUGIN;
 
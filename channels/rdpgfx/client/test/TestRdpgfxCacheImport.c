@@ -0,0 +1,367 @@
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/stream.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/addin.h>
+#include <freerdp/dvc.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/client/channels.h>
+#include <freerdp/client/rdpgfx.h>
+
+#include "rdpgfx_common.h"
+
+/**
+ * Drives the graphics pipeline client through a cache import: the offer
+ * built from the persistent cache, the reply restoring the accepted slots
+ * and the cache written back on close.
+ */
+
+#define TEST_GFX_ENTRIES 3
+
+static const UINT16 test_gfx_widths[TEST_GFX_ENTRIES] = { 64, 16, 32 };
+static const UINT16 test_gfx_heights[TEST_GFX_ENTRIES] = { 64, 8, 4 };
+
+static IWTSPlugin* test_gfx_plugin = NULL;
+static IWTSListenerCallback* test_gfx_listener_callback = NULL;
+static IWTSListener test_gfx_listener;
+static wStream* test_gfx_written = NULL;
+static rdpSettings* test_gfx_settings = NULL;
+
+static UINT64 test_gfx_key(UINT32 index)
+{
+	return 0xC0FFEE0000000000ULL | index;
+}
+
+static UINT test_gfx_register_plugin(IDRDYNVC_ENTRY_POINTS* pEntryPoints, const char* name,
+                                     IWTSPlugin* pPlugin)
+{
+	test_gfx_plugin = pPlugin;
+	return CHANNEL_RC_OK;
+}
+
+static IWTSPlugin* test_gfx_get_plugin(IDRDYNVC_ENTRY_POINTS* pEntryPoints, const char* name)
+{
+	return test_gfx_plugin;
+}
+
+static void* test_gfx_get_rdp_settings(IDRDYNVC_ENTRY_POINTS* pEntryPoints)
+{
+	return test_gfx_settings;
+}
+
+static UINT test_gfx_create_listener(IWTSVirtualChannelManager* pChannelMgr,
+                                     const char* pszChannelName, ULONG ulFlags,
+                                     IWTSListenerCallback* pListenerCallback,
+                                     IWTSListener** ppListener)
+{
+	test_gfx_listener_callback = pListenerCallback;
+	*ppListener = &test_gfx_listener;
+	return CHANNEL_RC_OK;
+}
+
+/* collects everything the client sends, one PDU per write */
+static UINT test_gfx_write(IWTSVirtualChannel* pChannel, ULONG cbSize, const BYTE* pBuffer,
+                           void* pReserved)
+{
+	if (!Stream_EnsureRemainingCapacity(test_gfx_written, cbSize))
+		return CHANNEL_RC_NO_MEMORY;
+
+	Stream_Write(test_gfx_written, pBuffer, cbSize);
+	return CHANNEL_RC_OK;
+}
+
+static UINT test_gfx_close(IWTSVirtualChannel* pChannel)
+{
+	return CHANNEL_RC_OK;
+}
+
+static BOOL test_gfx_create_cache(const char* filename)
+{
+	UINT32 i;
+	BOOL rc = TRUE;
+	BYTE* pixels = (BYTE*) malloc(64 * 64 * 4);
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent = persistent_cache_new();
+
+	if (!pixels || !persistent || !persistent_cache_open(persistent, filename, TRUE))
+		rc = FALSE;
+
+	for (i = 0; rc && (i < TEST_GFX_ENTRIES); i++)
+	{
+		memset(pixels, (int)(0x10 * (i + 1)), 64 * 64 * 4);
+		entry.key64 = test_gfx_key(i);
+		entry.width = test_gfx_widths[i];
+		entry.height = test_gfx_heights[i];
+		entry.cacheId = 0;
+		entry.data = pixels;
+		rc = persistent_cache_write_entry(persistent, &entry);
+	}
+
+	persistent_cache_free(persistent);
+	free(pixels);
+	return rc;
+}
+
+/* The offer lists every entry of the persistent cache in file order */
+static BOOL test_gfx_check_offer(wStream* s)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	RDPGFX_HEADER header;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU pdu;
+	pdu.cacheEntries = NULL;
+
+	/* the caps advertise comes first */
+	if ((rdpgfx_read_header(s, &header) != CHANNEL_RC_OK) ||
+	    (header.cmdId != RDPGFX_CMDID_CAPSADVERTISE) || (header.pduLength < RDPGFX_HEADER_SIZE) ||
+	    !Stream_SafeSeek(s, header.pduLength - RDPGFX_HEADER_SIZE))
+		return FALSE;
+
+	if ((rdpgfx_read_header(s, &header) != CHANNEL_RC_OK) ||
+	    (header.cmdId != RDPGFX_CMDID_CACHEIMPORTOFFER) ||
+	    (header.pduLength != RDPGFX_HEADER_SIZE + 2 + TEST_GFX_ENTRIES * 12))
+		return FALSE;
+
+	if ((rdpgfx_read_cache_import_offer(s, &pdu) != CHANNEL_RC_OK) ||
+	    (pdu.cacheEntriesCount != TEST_GFX_ENTRIES))
+		goto fail;
+
+	for (i = 0; i < TEST_GFX_ENTRIES; i++)
+	{
+		if ((pdu.cacheEntries[i].cacheKey != test_gfx_key(i)) ||
+		    (pdu.cacheEntries[i].bitmapLength != test_gfx_widths[i] * test_gfx_heights[i] * 4U))
+		{
+			printf("cache import offer entry %u differs\n", (unsigned) i);
+			goto fail;
+		}
+	}
+
+	rc = Stream_GetRemainingLength(s) == 0;
+fail:
+	free(pdu.cacheEntries);
+	return rc;
+}
+
+/* Sends the reply the way a server does, through the bulk compressor */
+static UINT test_gfx_send_reply(IWTSVirtualChannelCallback* callback, UINT16* cacheSlots,
+                                UINT16 count)
+{
+	UINT error;
+	UINT32 flags = 0;
+	RDPGFX_HEADER header;
+	RDPGFX_CACHE_IMPORT_REPLY_PDU pdu;
+	ZGFX_CONTEXT* zgfx = zgfx_context_new(TRUE);
+	wStream* s = Stream_New(NULL, 64);
+	wStream* data = Stream_New(NULL, 64);
+	pdu.importedEntriesCount = count;
+	pdu.cacheSlots = cacheSlots;
+	header.cmdId = RDPGFX_CMDID_CACHEIMPORTREPLY;
+	header.flags = 0;
+	header.pduLength = RDPGFX_HEADER_SIZE + 2 + count * 2;
+	error = CHANNEL_RC_NO_MEMORY;
+
+	if (!zgfx || !s || !data)
+		goto fail;
+
+	if ((error = rdpgfx_write_header(s, &header)) ||
+	    (error = rdpgfx_write_cache_import_reply(s, &pdu)))
+		goto fail;
+
+	if (zgfx_compress_to_stream(zgfx, data, Stream_Buffer(s), Stream_GetPosition(s),
+	                            &flags) < 0)
+	{
+		error = ERROR_INTERNAL_ERROR;
+		goto fail;
+	}
+
+	Stream_SealLength(data);
+	Stream_SetPosition(data, 0);
+	error = callback->OnDataReceived(callback, data);
+fail:
+	Stream_Free(s, TRUE);
+	Stream_Free(data, TRUE);
+	zgfx_context_free(zgfx);
+	return error;
+}
+
+static BOOL test_gfx_check_slot(RdpgfxClientContext* context, UINT16 cacheSlot, UINT32 index)
+{
+	UINT32 y;
+	BYTE pixels[64 * 4];
+	gdiGfxCacheEntry* cacheEntry;
+	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context, cacheSlot);
+
+	if (!cacheEntry || (cacheEntry->cacheKey != test_gfx_key(index)) ||
+	    (cacheEntry->width != test_gfx_widths[index]) ||
+	    (cacheEntry->height != test_gfx_heights[index]))
+	{
+		printf("cache slot %u does not hold entry %u\n", (unsigned) cacheSlot, (unsigned) index);
+		return FALSE;
+	}
+
+	memset(pixels, (int)(0x10 * (index + 1)), sizeof(pixels));
+
+	for (y = 0; y < cacheEntry->height; y++)
+	{
+		if (memcmp(&cacheEntry->data[y * cacheEntry->scanline], pixels,
+		           cacheEntry->width * 4) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* On close the restored slots are written back, keyed by their cacheKey */
+static BOOL test_gfx_check_saved(const char* filename)
+{
+	UINT32 count = 0;
+	BOOL found[TEST_GFX_ENTRIES] = { FALSE };
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent = persistent_cache_new();
+
+	if (!persistent || !persistent_cache_open(persistent, filename, FALSE))
+	{
+		persistent_cache_free(persistent);
+		return FALSE;
+	}
+
+	while (persistent_cache_read_entry(persistent, &entry))
+	{
+		UINT32 index = (UINT32)(entry.key64 & 0xFF);
+
+		if ((index < TEST_GFX_ENTRIES) && (entry.key64 == test_gfx_key(index)) &&
+		    (entry.width == test_gfx_widths[index]) && (entry.height == test_gfx_heights[index]))
+			found[index] = TRUE;
+
+		count++;
+	}
+
+	persistent_cache_free(persistent);
+	return (count == 2) && found[0] && !found[1] && found[2];
+}
+
+static BOOL test_gfx_cache_import(void)
+{
+	UINT32 slot;
+	BOOL rc = FALSE;
+	BOOL accept = TRUE;
+	rdpGdi gdi;
+	IWTSVirtualChannel channel;
+	IWTSVirtualChannelManager channelMgr;
+	IDRDYNVC_ENTRY_POINTS entryPoints;
+	IWTSVirtualChannelCallback* callback = NULL;
+	RdpgfxClientContext* context = NULL;
+	PDVC_PLUGIN_ENTRY entry;
+	/* the second entry is rejected, the first and third restored */
+	UINT16 cacheSlots[TEST_GFX_ENTRIES] = { 5, 0, 7 };
+	ZeroMemory(&gdi, sizeof(gdi));
+	ZeroMemory(&channel, sizeof(channel));
+	ZeroMemory(&channelMgr, sizeof(channelMgr));
+	ZeroMemory(&entryPoints, sizeof(entryPoints));
+	channel.Write = test_gfx_write;
+	channel.Close = test_gfx_close;
+	channelMgr.CreateListener = test_gfx_create_listener;
+	entryPoints.RegisterPlugin = test_gfx_register_plugin;
+	entryPoints.GetPlugin = test_gfx_get_plugin;
+	entryPoints.GetRdpSettings = test_gfx_get_rdp_settings;
+	region16_init(&gdi.invalidRegion);
+	entry = (PDVC_PLUGIN_ENTRY) freerdp_load_channel_addin_entry("rdpgfx", NULL, NULL,
+	        FREERDP_ADDIN_CHANNEL_DYNAMIC);
+
+	if (!entry || (entry(&entryPoints) != CHANNEL_RC_OK) || !test_gfx_plugin)
+		return FALSE;
+
+	if (test_gfx_plugin->Initialize(test_gfx_plugin, &channelMgr) != CHANNEL_RC_OK)
+		goto fail;
+
+	context = (RdpgfxClientContext*) test_gfx_plugin->pInterface;
+	gdi_graphics_pipeline_init(&gdi, context);
+
+	if (test_gfx_listener_callback->OnNewChannelConnection(test_gfx_listener_callback, &channel,
+	        NULL, &accept, &callback) != CHANNEL_RC_OK)
+		goto fail;
+
+	if (callback->OnOpen(callback) != CHANNEL_RC_OK)
+		goto fail;
+
+	Stream_SealLength(test_gfx_written);
+	Stream_SetPosition(test_gfx_written, 0);
+
+	if (!test_gfx_check_offer(test_gfx_written))
+	{
+		printf("unexpected cache import offer\n");
+		goto fail;
+	}
+
+	if (test_gfx_send_reply(callback, cacheSlots, TEST_GFX_ENTRIES) != CHANNEL_RC_OK)
+		goto fail;
+
+	if (!test_gfx_check_slot(context, 5, 0) || !test_gfx_check_slot(context, 7, 2))
+		goto fail;
+
+	for (slot = 0; slot < 25600; slot++)
+	{
+		if ((slot != 5) && (slot != 7) && context->GetCacheSlotData(context, slot))
+		{
+			printf("unexpected cache slot %u\n", (unsigned) slot);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+
+	if (callback)
+		callback->OnClose(callback);
+
+	if (test_gfx_plugin->Terminated)
+		test_gfx_plugin->Terminated(test_gfx_plugin);
+
+	test_gfx_plugin = NULL;
+	region16_uninit(&gdi.invalidRegion);
+	return rc;
+}
+
+int TestRdpgfxCacheImport(int argc, char* argv[])
+{
+	int rc = -1;
+	char* filename = NULL;
+	char* gfxFilename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestRdpgfxCacheImport.bin.gfx");
+	freerdp_register_addin_provider(freerdp_channels_load_static_addin_entry, 0);
+	test_gfx_settings = freerdp_settings_new(0);
+	test_gfx_written = Stream_New(NULL, 1024);
+	filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestRdpgfxCacheImport.bin");
+
+	if (!test_gfx_settings || !test_gfx_written || !filename || !gfxFilename)
+		goto fail;
+
+	test_gfx_settings->BitmapCachePersistEnabled = TRUE;
+	test_gfx_settings->BitmapCachePersistFile = _strdup(filename);
+
+	if (!test_gfx_settings->BitmapCachePersistFile || !test_gfx_create_cache(gfxFilename))
+		goto fail;
+
+	if (!test_gfx_cache_import())
+		goto fail;
+
+	if (!test_gfx_check_saved(gfxFilename))
+	{
+		printf("restored cache slots were not saved\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	if (gfxFilename)
+		DeleteFileA(gfxFilename);
+
+	free(filename);
+	free(gfxFilename);
+	Stream_Free(test_gfx_written, TRUE);
+	freerdp_settings_free(test_gfx_settings);
+	return rc;
+}
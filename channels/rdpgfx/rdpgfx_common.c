@@ -230,3 +230,155 @@ UINT rdpgfx_write_color32(wStream* s, RDPGFX_COLOR32* color32)
 	Stream_Write_UINT8(s, color32->XA); /* XA (1 byte) */
 	return CHANNEL_RC_OK;
 }
+
+/**
+ * Function description
+ * Reads an RDPGFX_CACHE_IMPORT_OFFER_PDU, the entries are released by the
+ * caller with free().
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT rdpgfx_read_cache_import_offer(wStream* s, RDPGFX_CACHE_IMPORT_OFFER_PDU* pdu)
+{
+	UINT16 index;
+	RDPGFX_CACHE_ENTRY_METADATA* cacheEntry;
+
+	if (Stream_GetRemainingLength(s) < 2)
+	{
+		WLog_ERR(TAG, "not enough data!");
+		return ERROR_INVALID_DATA;
+	}
+
+	Stream_Read_UINT16(s, pdu->cacheEntriesCount); /* cacheEntriesCount (2 bytes) */
+
+	if ((pdu->cacheEntriesCount == 0) ||
+	    (pdu->cacheEntriesCount > RDPGFX_CACHE_ENTRY_MAX_COUNT))
+	{
+		WLog_ERR(TAG, "Invalid cacheEntriesCount: %u", pdu->cacheEntriesCount);
+		return ERROR_INVALID_DATA;
+	}
+
+	if (Stream_GetRemainingLength(s) < (pdu->cacheEntriesCount * 12))
+	{
+		WLog_ERR(TAG, "not enough data!");
+		return ERROR_INVALID_DATA;
+	}
+
+	pdu->cacheEntries = (RDPGFX_CACHE_ENTRY_METADATA*) calloc(pdu->cacheEntriesCount,
+	                    sizeof(RDPGFX_CACHE_ENTRY_METADATA));
+
+	if (!pdu->cacheEntries)
+	{
+		WLog_ERR(TAG, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	for (index = 0; index < pdu->cacheEntriesCount; index++)
+	{
+		cacheEntry = &(pdu->cacheEntries[index]);
+		Stream_Read_UINT64(s, cacheEntry->cacheKey); /* cacheKey (8 bytes) */
+		Stream_Read_UINT32(s, cacheEntry->bitmapLength); /* bitmapLength (4 bytes) */
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT rdpgfx_write_cache_import_offer(wStream* s, const RDPGFX_CACHE_IMPORT_OFFER_PDU* pdu)
+{
+	UINT16 index;
+	const RDPGFX_CACHE_ENTRY_METADATA* cacheEntry;
+
+	if (!Stream_EnsureRemainingCapacity(s, 2 + (pdu->cacheEntriesCount * 12)))
+	{
+		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	Stream_Write_UINT16(s, pdu->cacheEntriesCount); /* cacheEntriesCount (2 bytes) */
+
+	for (index = 0; index < pdu->cacheEntriesCount; index++)
+	{
+		cacheEntry = &(pdu->cacheEntries[index]);
+		Stream_Write_UINT64(s, cacheEntry->cacheKey); /* cacheKey (8 bytes) */
+		Stream_Write_UINT32(s, cacheEntry->bitmapLength); /* bitmapLength (4 bytes) */
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ * Reads an RDPGFX_CACHE_IMPORT_REPLY_PDU, the cache slots are released by
+ * the caller with free().
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT rdpgfx_read_cache_import_reply(wStream* s, RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
+{
+	UINT16 index;
+
+	if (Stream_GetRemainingLength(s) < 2)
+	{
+		WLog_ERR(TAG, "not enough data!");
+		return ERROR_INVALID_DATA;
+	}
+
+	Stream_Read_UINT16(s, pdu->importedEntriesCount); /* importedEntriesCount (2 bytes) */
+
+	if (pdu->importedEntriesCount > RDPGFX_CACHE_ENTRY_MAX_COUNT)
+	{
+		WLog_ERR(TAG, "Invalid importedEntriesCount: %u", pdu->importedEntriesCount);
+		return ERROR_INVALID_DATA;
+	}
+
+	if (Stream_GetRemainingLength(s) < (size_t)(pdu->importedEntriesCount * 2))
+	{
+		WLog_ERR(TAG, "not enough data!");
+		return ERROR_INVALID_DATA;
+	}
+
+	pdu->cacheSlots = (UINT16*) calloc(pdu->importedEntriesCount, sizeof(UINT16));
+
+	if (!pdu->cacheSlots)
+	{
+		WLog_ERR(TAG, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	for (index = 0; index < pdu->importedEntriesCount; index++)
+	{
+		Stream_Read_UINT16(s, pdu->cacheSlots[index]); /* cacheSlot (2 bytes) */
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT rdpgfx_write_cache_import_reply(wStream* s, const RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
+{
+	UINT16 index;
+
+	if (!Stream_EnsureRemainingCapacity(s, 2 + (pdu->importedEntriesCount * 2)))
+	{
+		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	Stream_Write_UINT16(s, pdu->importedEntriesCount); /* importedEntriesCount (2 bytes) */
+
+	for (index = 0; index < pdu->importedEntriesCount; index++)
+	{
+		Stream_Write_UINT16(s, pdu->cacheSlots[index]); /* cacheSlot (2 bytes) */
+	}
+
+	return CHANNEL_RC_OK;
+}
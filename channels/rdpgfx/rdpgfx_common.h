@@ -43,5 +43,15 @@ FREERDP_LOCAL UINT rdpgfx_write_rect16(wStream* s, RECTANGLE_16* rect16);
 FREERDP_LOCAL UINT rdpgfx_read_color32(wStream* s, RDPGFX_COLOR32* color32);
 FREERDP_LOCAL UINT rdpgfx_write_color32(wStream* s, RDPGFX_COLOR32* color32);
 
+FREERDP_LOCAL UINT rdpgfx_read_cache_import_offer(wStream* s,
+        RDPGFX_CACHE_IMPORT_OFFER_PDU* pdu);
+FREERDP_LOCAL UINT rdpgfx_write_cache_import_offer(wStream* s,
+        const RDPGFX_CACHE_IMPORT_OFFER_PDU* pdu);
+
+FREERDP_LOCAL UINT rdpgfx_read_cache_import_reply(wStream* s,
+        RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu);
+FREERDP_LOCAL UINT rdpgfx_write_cache_import_reply(wStream* s,
+        const RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu);
+
 #endif /* FREERDP_CHANNEL_RDPGFX_CLIENT_COMMON_H */
 
@@ -295,7 +295,7 @@ static UINT rdpgfx_send_evict_cache_entry_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
         RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
 {
-	UINT16 index;
+	UINT error;
 	wStream* s = rdpgfx_server_single_packet_new(
 	                 RDPGFX_CMDID_CACHEIMPORTREPLY,
 	                 2 + 2 * pdu->importedEntriesCount);
@@ -306,12 +306,11 @@ static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
 		return CHANNEL_RC_NO_MEMORY;
 	}
 
-	/* importedEntriesCount (2 bytes) */
-	Stream_Write_UINT16(s, pdu->importedEntriesCount);
-
-	for (index = 0; index < pdu->importedEntriesCount; index++)
+	if ((error = rdpgfx_write_cache_import_reply(s, pdu)))
 	{
-		Stream_Write_UINT16(s, pdu->cacheSlots[index]); /* cacheSlot (2 bytes) */
+		WLog_ERR(TAG, "rdpgfx_write_cache_import_reply failed with error %u!", error);
+		Stream_Free(s, TRUE);
+		return error;
 	}
 
 	return rdpgfx_server_single_packet_send(context, s);
@@ -627,8 +626,9 @@ static UINT rdpgfx_write_surface_command(wStream* s,
 		{
 			havc444 = (RDPGFX_AVC444_BITMAP_STREAM*)cmd->extra;
 			havc420 = &(havc444->bitstream[0]);
-			/* avc420EncodedBitstreamInfo (4 bytes) */
-			Stream_Write_UINT32(s, havc420->length | (havc444->LC << 30UL));
+			/* avc420EncodedBitstreamInfo (4 bytes), size includes the metablock */
+			Stream_Write_UINT32(s, rdpgfx_estimate_h264_avc420(havc420) |
+			                    (havc444->LC << 30UL));
 			/* avc420EncodedBitstream1 */
 			error = rdpgfx_write_h264_avc420(s, havc420);
 
@@ -641,7 +641,7 @@ static UINT rdpgfx_write_surface_command(wStream* s,
 			/* avc420EncodedBitstream2 */
 			if (havc444->LC == 0)
 			{
-				havc420 = &(havc444->bitstream[0]);
+				havc420 = &(havc444->bitstream[1]);
 				error = rdpgfx_write_h264_avc420(s, havc420);
 
 				if (error != CHANNEL_RC_OK)
@@ -1090,49 +1090,13 @@ static UINT rdpgfx_recv_frame_acknowledge_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_recv_cache_import_offer_pdu(RdpgfxServerContext* context,
         wStream* s)
 {
-	UINT16 index;
 	RDPGFX_CACHE_IMPORT_OFFER_PDU pdu;
-	RDPGFX_CACHE_ENTRY_METADATA* cacheEntries;
-	UINT error = CHANNEL_RC_OK;
-
-	if (Stream_GetRemainingLength(s) < 2)
-	{
-		WLog_ERR(TAG, "not enough data!");
-		return ERROR_INVALID_DATA;
-	}
-
-	/* cacheEntriesCount (2 bytes) */
-	Stream_Read_UINT16(s, pdu.cacheEntriesCount);
-
-	if (pdu.cacheEntriesCount <= 0)
-	{
-		/* According to the latest spec, capsSetCount <= 3 */
-		WLog_ERR(TAG, "Invalid cacheEntriesCount: %u", pdu.cacheEntriesCount);
-		return ERROR_INVALID_DATA;
-	}
-
-	if (Stream_GetRemainingLength(s) < (pdu.cacheEntriesCount * 12))
-	{
-		WLog_ERR(TAG, "not enough data!");
-		return ERROR_INVALID_DATA;
-	}
-
-	pdu.cacheEntries = (RDPGFX_CACHE_ENTRY_METADATA*)
-	                   calloc(pdu.cacheEntriesCount,
-	                          sizeof(RDPGFX_CACHE_ENTRY_METADATA));
-
-	if (!pdu.cacheEntries)
-	{
-		WLog_ERR(TAG, "calloc failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
+	UINT error;
 
-	for (index = 0; index < pdu.cacheEntriesCount; index++)
+	if ((error = rdpgfx_read_cache_import_offer(s, &pdu)))
 	{
-		cacheEntries = &(pdu.cacheEntries[index]);
-		Stream_Read_UINT64(s, cacheEntries->cacheKey); /* cacheKey (8 bytes) */
-		/* bitmapLength (4 bytes) */
-		Stream_Read_UINT32(s, cacheEntries->bitmapLength);
+		WLog_ERR(TAG, "rdpgfx_read_cache_import_offer failed with error %u!", error);
+		return error;
 	}
 
 	if (context)
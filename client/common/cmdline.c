@@ -28,6 +28,7 @@
 #include <winpr/crt.h>
 #include <winpr/wlog.h>
 #include <winpr/cmdline.h>
+#include <winpr/path.h>
 
 #include <freerdp/addin.h>
 #include <freerdp/settings.h>
@@ -152,6 +153,8 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "mouse-motion", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "mouse-motion" },
 	{ "parent-window", COMMAND_LINE_VALUE_REQUIRED, "<window id>", NULL, NULL, -1, NULL, "Parent window id" },
 	{ "bitmap-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Enable bitmap cache" },
+	{ "persist-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Enable persistent bitmap cache" },
+	{ "persist-cache-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Persistent bitmap cache file (default: per host in the config path)" },
 	{ "offscreen-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Enable offscreen bitmap cache" },
 	{ "glyph-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Glyph cache (EXPERIMENTAL)" },
 	{ "codec-cache", COMMAND_LINE_VALUE_REQUIRED, "<rfx|nsc|jpeg>", NULL, NULL, -1, NULL, "bitmap codec cache" },
@@ -1402,6 +1405,31 @@ int freerdp_client_settings_command_line_status_print(rdpSettings* settings,
 	return 0;
 }
 
+/**
+ * Marks the bitmap cache cells persistent and picks a cache file per
+ * server in the configuration directory unless one was given.
+ */
+static BOOL freerdp_client_settings_persist_cache(rdpSettings* settings)
+{
+	UINT32 index;
+
+	if (!settings->BitmapCachePersistFile && settings->ServerHostname &&
+	    settings->ConfigPath)
+	{
+		char name[256];
+		sprintf_s(name, sizeof(name), "bitmapcache-%s-%u.bmc",
+		          settings->ServerHostname, settings->ServerPort);
+
+		if (!(settings->BitmapCachePersistFile = GetCombinedPath(settings->ConfigPath, name)))
+			return FALSE;
+	}
+
+	for (index = 0; index < settings->BitmapCacheV2NumCells; index++)
+		settings->BitmapCacheV2CellInfo[index].persistent = TRUE;
+
+	return TRUE;
+}
+
 int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
         int argc, char** argv, BOOL allowUnknown)
 {
@@ -2268,6 +2296,19 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 		{
 			settings->BitmapCacheEnabled = arg->Value ? TRUE : FALSE;
 		}
+		CommandLineSwitchCase(arg, "persist-cache")
+		{
+			settings->BitmapCachePersistEnabled = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "persist-cache-file")
+		{
+			free(settings->BitmapCachePersistFile);
+
+			if (!(settings->BitmapCachePersistFile = _strdup(arg->Value)))
+				return COMMAND_LINE_ERROR_MEMORY;
+
+			settings->BitmapCachePersistEnabled = TRUE;
+		}
 		CommandLineSwitchCase(arg, "offscreen-cache")
 		{
 			settings->OffscreenSupportLevel = arg->Value ? TRUE : FALSE;
@@ -2485,6 +2526,9 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 
 	freerdp_performance_flags_make(settings);
 
+	if (settings->BitmapCachePersistEnabled && !freerdp_client_settings_persist_cache(settings))
+		return COMMAND_LINE_ERROR_MEMORY;
+
 	if (settings->RemoteFxCodec || settings->NSCodec
 	    || settings->SupportGraphicsPipeline)
 	{
@@ -23,6 +23,12 @@ else()
 	option(WITH_SSE2 "Enable SSE2 optimization." OFF)
 endif()
 
+if((TARGET_ARCH MATCHES "x86|x64") AND (NOT DEFINED WITH_AVX2))
+	option(WITH_AVX2 "Enable AVX2 optimization (selected at runtime)." ON)
+else()
+	option(WITH_AVX2 "Enable AVX2 optimization (selected at runtime)." OFF)
+endif()
+
 if(TARGET_ARCH MATCHES "ARM")
 	if (NOT DEFINED WITH_NEON)
 		option(WITH_NEON "Enable NEON optimization." ON)
@@ -36,6 +36,7 @@ struct _BITMAP_V2_CELL
 {
 	UINT32 number;
 	rdpBitmap** entries;
+	UINT64* keys;
 };
 
 struct rdp_bitmap_cache
@@ -56,6 +57,7 @@ struct rdp_bitmap_cache
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
+	BOOL persistLoaded;
 };
 
 #ifdef __cplusplus
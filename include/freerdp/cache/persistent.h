@@ -0,0 +1,70 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_PERSISTENT_CACHE_H
+#define FREERDP_PERSISTENT_CACHE_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/settings.h>
+
+/* the Persistent Key List PDU describes at most five cells */
+#define PERSISTENT_CACHE_MAX_CELLS 5
+
+typedef struct rdp_persistent_cache rdpPersistentCache;
+
+/**
+ * A bitmap stored in the persistent cache file. The pixel data is
+ * PIXEL_FORMAT_BGRA32 with a stride of width * 4 bytes. Entries returned
+ * by persistent_cache_read_entry point into the read-only mapped file and
+ * are only valid until the cache is closed.
+ */
+struct _PERSISTENT_CACHE_ENTRY
+{
+	UINT64 key64;
+	UINT16 width;
+	UINT16 height;
+	UINT32 cacheId;
+	BYTE* data;
+};
+typedef struct _PERSISTENT_CACHE_ENTRY PERSISTENT_CACHE_ENTRY;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API BOOL persistent_cache_open(rdpPersistentCache* persistent,
+                                       const char* filename, BOOL write);
+FREERDP_API void persistent_cache_close(rdpPersistentCache* persistent);
+
+FREERDP_API UINT32 persistent_cache_get_count(rdpPersistentCache* persistent);
+FREERDP_API BOOL persistent_cache_read_entry(rdpPersistentCache* persistent,
+        PERSISTENT_CACHE_ENTRY* entry);
+FREERDP_API BOOL persistent_cache_write_entry(rdpPersistentCache* persistent,
+        const PERSISTENT_CACHE_ENTRY* entry);
+
+FREERDP_API int persistent_cache_assign_index(rdpSettings* settings,
+        const PERSISTENT_CACHE_ENTRY* entry, UINT32* counts);
+
+FREERDP_API rdpPersistentCache* persistent_cache_new(void);
+FREERDP_API void persistent_cache_free(rdpPersistentCache* persistent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_PERSISTENT_CACHE_H */
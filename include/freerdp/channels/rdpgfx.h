@@ -97,6 +97,8 @@ typedef struct _RDPGFX_HEADER RDPGFX_HEADER;
 #define RDPGFX_NUMBER_CAPSETS			4
 #define RDPGFX_CAPSET_SIZE			12
 
+#define RDPGFX_CACHE_ENTRY_MAX_COUNT		5462
+
 struct _RDPGFX_CAPSET
 {
 	UINT32 version;
@@ -22,6 +22,8 @@
 
 typedef struct _CLEAR_CONTEXT CLEAR_CONTEXT;
 
+#include <winpr/stream.h>
+
 #include <freerdp/api.h>
 #include <freerdp/types.h>
 
@@ -34,6 +36,7 @@ typedef struct _CLEAR_CONTEXT CLEAR_CONTEXT;
 
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
+#define CLEARCODEC_GLYPH_SIZE 4000
 
 struct _CLEAR_GLYPH_ENTRY
 {
@@ -61,19 +64,32 @@ struct _CLEAR_CONTEXT
 	UINT32 nTempStep;
 	UINT32 TempFormat;
 	UINT32 format;
-	CLEAR_GLYPH_ENTRY GlyphCache[4000];
+	CLEAR_GLYPH_ENTRY GlyphCache[CLEARCODEC_GLYPH_SIZE];
 	UINT32 VBarStorageCursor;
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* Encoder only: output buffers and cache lookup tables */
+	wStream* buffer;
+	wStream* bands;
+	wStream* subcodecs;
+	BYTE* CoverageMap;
+	UINT32 CoverageSize;
+	UINT32 GlyphCacheCursor;
+	UINT32* GlyphHashTable;
+	UINT32* VBarHashTable;
+	UINT32* ShortVBarHashTable;
 };
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-FREERDP_API int clear_compress(CLEAR_CONTEXT* clear, BYTE* pSrcData,
-                               UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize);
+FREERDP_API int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
+                               UINT32 SrcFormat, UINT32 nSrcStep,
+                               UINT32 nWidth, UINT32 nHeight,
+                               BYTE** ppDstData, UINT32* pDstSize);
 
 FREERDP_API INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
                                    UINT32 SrcSize, UINT32 nWidth, UINT32 nHeight,
@@ -71,6 +71,13 @@ struct _H264_CONTEXT
 	UINT32 iYUV444Stride[3];
 	BYTE* pYUV444Data[3];
 
+	/* AVC444 encoder: last encoded main [0] and auxiliary [1] views */
+	UINT32 iOldYUVSize[2][3];
+	BYTE* pOldYUVData[2][3];
+
+	/* AVC444 encoder: views of the current frame, kept between frames */
+	BYTE* pViewYUVData[2][3];
+
 	UINT32 numSystemData;
 	void* pSystemData;
 	H264_CONTEXT_SUBSYSTEM* subsystem;
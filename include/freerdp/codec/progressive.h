@@ -26,10 +26,12 @@ typedef struct _PROGRESSIVE_CONTEXT PROGRESSIVE_CONTEXT;
 #include <freerdp/types.h>
 
 #include <winpr/wlog.h>
+#include <winpr/pool.h>
 #include <winpr/collections.h>
 
 #include <freerdp/codec/rfx.h>
 #include <freerdp/codec/color.h>
+#include <freerdp/codec/region.h>
 
 #define RFX_SUBBAND_DIFFING				0x01
 
@@ -152,6 +154,8 @@ struct _RFX_PROGRESSIVE_TILE
 	RFX_COMPONENT_CODEC_QUANT yProgQuant;
 	RFX_COMPONENT_CODEC_QUANT cbProgQuant;
 	RFX_COMPONENT_CODEC_QUANT crProgQuant;
+
+	UINT32 pendingRegion;
 };
 typedef struct _RFX_PROGRESSIVE_TILE RFX_PROGRESSIVE_TILE;
 
@@ -201,6 +205,8 @@ struct _PROGRESSIVE_SURFACE_CONTEXT
 	UINT32 gridHeight;
 	UINT32 gridSize;
 	RFX_PROGRESSIVE_TILE* tiles;
+
+	UINT32 frameIndex;
 };
 typedef struct _PROGRESSIVE_SURFACE_CONTEXT PROGRESSIVE_SURFACE_CONTEXT;
 
@@ -225,9 +231,17 @@ struct _PROGRESSIVE_CONTEXT
 	RFX_PROGRESSIVE_CODEC_QUANT* quantProgVals;
 
 	PROGRESSIVE_BLOCK_REGION region;
+	UINT32 regionIndex;
 	RFX_PROGRESSIVE_CODEC_QUANT quantProgValFull;
 
 	wHashTable* SurfaceContexts;
+
+	wStream* buffer;
+
+	BOOL UseThreads;
+	DWORD ThreadCount;
+	PTP_POOL ThreadPool;
+	TP_CALLBACK_ENVIRON ThreadPoolEnv;
 };
 
 #ifdef __cplusplus
@@ -235,7 +249,9 @@ extern "C" {
 #endif
 
 FREERDP_API int progressive_compress(PROGRESSIVE_CONTEXT* progressive,
-                                     BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize);
+                                     const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+                                     UINT32 nWidth, UINT32 nHeight, const REGION16* invalidRegion,
+                                     BYTE** ppDstData, UINT32* pDstSize, UINT16 surfaceId);
 
 FREERDP_API INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
         const BYTE* pSrcData, UINT32 SrcSize,
@@ -25,6 +25,10 @@
 
 #include <freerdp/codec/mppc.h>
 
+/* chunks are kept in a hash table of XCRUSH_CHUNK_WAYS most recent entries per bucket */
+#define XCRUSH_CHUNK_BUCKETS	16384
+#define XCRUSH_CHUNK_WAYS	4
+
 #pragma pack(push, 1)
 
 struct _XCRUSH_MATCH_INFO
@@ -37,14 +41,14 @@ typedef struct _XCRUSH_MATCH_INFO XCRUSH_MATCH_INFO;
 
 struct _XCRUSH_CHUNK
 {
+	UINT32 seed;
 	UINT32 offset;
-	UINT32 next;
 };
 typedef struct _XCRUSH_CHUNK XCRUSH_CHUNK;
 
 struct _XCRUSH_SIGNATURE
 {
-	UINT16 seed;
+	UINT32 seed;
 	UINT16 size;
 };
 typedef struct _XCRUSH_SIGNATURE XCRUSH_SIGNATURE;
@@ -84,10 +88,7 @@ struct _XCRUSH_CONTEXT
 	UINT32 SignatureCount;
 	XCRUSH_SIGNATURE Signatures[1000];
 
-	UINT32 ChunkHead;
-	UINT32 ChunkTail;
-	XCRUSH_CHUNK Chunks[65534];
-	UINT16 NextChunks[65536];
+	XCRUSH_CHUNK Chunks[XCRUSH_CHUNK_BUCKETS][XCRUSH_CHUNK_WAYS];
 
 	UINT32 OriginalMatchCount;
 	UINT32 OptimizedMatchCount;
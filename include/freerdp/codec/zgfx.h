@@ -32,17 +32,17 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE			65535
 
+#define ZGFX_COMPRESSION_LEVEL_NONE		0
+#define ZGFX_COMPRESSION_LEVEL_FAST		1
+#define ZGFX_COMPRESSION_LEVEL_DEFAULT		2
+#define ZGFX_COMPRESSION_LEVEL_BEST		3
+
 struct _ZGFX_CONTEXT
 {
 	BOOL Compressor;
 
-	const BYTE* pbInputCurrent;
-	const BYTE* pbInputEnd;
-
-	UINT32 bits;
-	UINT32 cBitsRemaining;
-	UINT32 BitsCurrent;
-	UINT32 cBitsCurrent;
+	/* Decoder: token for every 9 bit prefix, see zgfx_init_decode_table */
+	UINT16 DecodeTable[512];
 
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
@@ -50,6 +50,13 @@ struct _ZGFX_CONTEXT
 	BYTE HistoryBuffer[2500000];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	/* Encoder only */
+	UINT32 CompressionLevel;
+	UINT32* HashHead;
+	UINT32* HashChain;
+	UINT16 LiteralCodes[256];
+	BYTE LiteralLengths[256];
 };
 typedef struct _ZGFX_CONTEXT ZGFX_CONTEXT;
 
@@ -62,6 +69,7 @@ FREERDP_API int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 S
 FREERDP_API int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUncompressed, UINT32 uncompressedSize, UINT32* pFlags);
 
 FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
+FREERDP_API BOOL zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx, UINT32 level);
 
 FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
 FREERDP_API void zgfx_context_free(ZGFX_CONTEXT* zgfx);
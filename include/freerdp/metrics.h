@@ -21,6 +21,38 @@
 #define FREERDP_METRICS_H
 
 #include <freerdp/api.h>
+#include <freerdp/types.h>
+
+/**
+ * Session metrics. All counters are updated with atomic operations and can
+ * be read at any time from any thread, times are in microseconds.
+ */
+
+#define METRICS_MAX_CHANNELS			32
+#define METRICS_CODEC_COUNT			9
+#define METRICS_PENDING_FRAMES			64
+
+/* Bucket i holds samples up to (METRICS_HISTOGRAM_BASE << i) us, the last one the rest */
+#define METRICS_HISTOGRAM_BUCKETS		16
+#define METRICS_HISTOGRAM_BASE			100
+
+typedef struct rdp_metrics_histogram rdpMetricsHistogram;
+typedef struct rdp_metrics_channel rdpMetricsChannel;
+
+struct rdp_metrics_histogram
+{
+	volatile LONGLONG Buckets[METRICS_HISTOGRAM_BUCKETS];
+	volatile LONGLONG Count;
+	volatile LONGLONG Sum;
+};
+
+struct rdp_metrics_channel
+{
+	volatile LONGLONG BytesSent;
+	volatile LONGLONG BytesReceived;
+	volatile LONGLONG PdusSent;
+	volatile LONGLONG PdusReceived;
+};
 
 struct rdp_metrics
 {
@@ -29,6 +61,21 @@ struct rdp_metrics
 	UINT64 TotalCompressedBytes;
 	UINT64 TotalUncompressedBytes;
 	double TotalCompressionRatio;
+
+	/* indexed by channel id - MCS_GLOBAL_CHANNEL_ID, the last slot takes the others */
+	rdpMetricsChannel Channels[METRICS_MAX_CHANNELS];
+
+	/* indexed by the bit number of the FREERDP_CODEC_* flag */
+	rdpMetricsHistogram EncodeTime[METRICS_CODEC_COUNT];
+	rdpMetricsHistogram DecodeTime[METRICS_CODEC_COUNT];
+
+	rdpMetricsHistogram FrameLatency;
+	rdpMetricsHistogram InputLatency;
+	rdpMetricsHistogram TransportWriteBlocked;
+
+	volatile LONGLONG FrameStart[METRICS_PENDING_FRAMES];
+	volatile LONG FrameIds[METRICS_PENDING_FRAMES];
+	volatile LONGLONG InputPending;
 };
 
 #ifdef __cplusplus
@@ -37,6 +84,26 @@ struct rdp_metrics
 
 FREERDP_API double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32 CompressedBytes);
 
+FREERDP_API UINT64 metrics_get_time(void);
+
+FREERDP_API void metrics_channel_sent(rdpMetrics* metrics, UINT16 channelId, UINT32 bytes);
+FREERDP_API void metrics_channel_received(rdpMetrics* metrics, UINT16 channelId, UINT32 bytes);
+FREERDP_API void metrics_codec_time(rdpMetrics* metrics, UINT32 codecId, BOOL encode, UINT64 usec);
+FREERDP_API void metrics_frame_begin(rdpMetrics* metrics, UINT32 frameId);
+FREERDP_API void metrics_frame_acknowledge(rdpMetrics* metrics, UINT32 frameId);
+FREERDP_API void metrics_input_event(rdpMetrics* metrics);
+FREERDP_API void metrics_paint(rdpMetrics* metrics);
+FREERDP_API void metrics_transport_blocked(rdpMetrics* metrics, UINT64 usec);
+
+FREERDP_API BOOL metrics_get_channel(rdpMetrics* metrics, UINT16 channelId,
+                                     rdpMetricsChannel* channel);
+FREERDP_API rdpMetricsHistogram* metrics_get_codec_histogram(rdpMetrics* metrics, UINT32 codecId,
+        BOOL encode);
+FREERDP_API UINT64 metrics_histogram_quantile(const rdpMetricsHistogram* histogram,
+        double quantile);
+FREERDP_API const char* metrics_codec_name(UINT32 codecId);
+FREERDP_API char* metrics_dump_prometheus(rdpMetrics* metrics, const char* labels);
+
 FREERDP_API rdpMetrics* metrics_new(rdpContext* context);
 FREERDP_API void metrics_free(rdpMetrics* metrics);
 
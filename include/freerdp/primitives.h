@@ -205,6 +205,27 @@ typedef pstatus_t (*__orC_32u_t)(
     UINT32* pDst,
     INT32 len);
 
+/* Planar codec: planes are packed (width bytes per row) and ordered R, G, B, A */
+typedef pstatus_t (*__planarSplit_8u_AC4P4_t)(
+    const BYTE* pSrc, UINT32 SrcFormat, UINT32 srcStep,
+    BYTE* pDst[4], UINT32 width, UINT32 height);
+typedef pstatus_t (*__planarCombine_8u_P4AC4R_t)(
+    const BYTE* pSrc[4],
+    BYTE* pDst, UINT32 DstFormat, UINT32 dstStep,
+    UINT32 width, UINT32 height, BOOL alpha, BOOL vFlip);
+typedef pstatus_t (*__planarDeltaEncode_8u_t)(
+    const BYTE* pSrc, BYTE* pDst,
+    UINT32 width, UINT32 height);
+typedef pstatus_t (*__planarDeltaDecode_8u_t)(
+    BYTE* pSrcDst,
+    UINT32 width, UINT32 height);
+
+/* Conversion between direct color formats, steps may be negative */
+typedef pstatus_t (*__convertPixels_8u_t)(
+    const BYTE* pSrc, UINT32 SrcFormat, INT32 srcStep,
+    BYTE* pDst, UINT32 DstFormat, INT32 dstStep,
+    UINT32 width, UINT32 height);
+
 typedef struct
 {
 	/* Memory-to-memory copy routines */
@@ -245,6 +266,13 @@ typedef struct
 	__YUV420CombineToYUV444_t YUV420CombineToYUV444;
 	__YUV444SplitToYUV420_t YUV444SplitToYUV420;
 	__YUV444ToRGB_8u_P3AC4R_t YUV444ToRGB_8u_P3AC4R;
+	/* Planar codec plane (de)interleaving and delta coding */
+	__planarSplit_8u_AC4P4_t planarSplit_8u_AC4P4;
+	__planarCombine_8u_P4AC4R_t planarCombine_8u_P4AC4R;
+	__planarDeltaEncode_8u_t planarDeltaEncode_8u;
+	__planarDeltaDecode_8u_t planarDeltaDecode_8u;
+	/* Pixel format conversion */
+	__convertPixels_8u_t convertPixels_8u;
 } primitives_t;
 
 #ifdef __cplusplus
@@ -0,0 +1,67 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Server Event Loop (Reactor)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_REACTOR_H
+#define FREERDP_REACTOR_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/peer.h>
+#include <freerdp/listener.h>
+
+/**
+ * A reactor serves many listeners and peers from a small number of event
+ * loop threads instead of one thread per peer. A peer runs its connection
+ * sequence on a handshake thread of its own and is pinned to one loop
+ * thread once it is active. The callbacks of a peer never run concurrently.
+ */
+
+typedef struct rdp_reactor rdpReactor;
+
+/**
+ * Called after the peer transport was serviced or one of the extra handles
+ * of the peer got signaled. Returning FALSE closes the peer.
+ */
+typedef BOOL (*pReactorPeerCheck)(freerdp_peer* peer, void* context);
+
+/**
+ * Called from the loop thread of the peer once it was removed from the
+ * reactor, the callback owns the peer from then on. Without a close
+ * callback the peer is disconnected and freed by the reactor.
+ */
+typedef void (*pReactorPeerClosed)(freerdp_peer* peer, void* context);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API BOOL freerdp_reactor_add_listener(rdpReactor* reactor, freerdp_listener* listener);
+
+FREERDP_API BOOL freerdp_reactor_add_peer(rdpReactor* reactor, freerdp_peer* peer,
+        const HANDLE* handles, DWORD count, pReactorPeerCheck check,
+        pReactorPeerClosed closed, void* context);
+
+FREERDP_API DWORD freerdp_reactor_get_peer_count(rdpReactor* reactor);
+
+FREERDP_API rdpReactor* freerdp_reactor_new(DWORD threads);
+FREERDP_API void freerdp_reactor_free(rdpReactor* reactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_REACTOR_H */
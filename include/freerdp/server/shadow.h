@@ -47,6 +47,7 @@ typedef struct rdp_shadow_server rdpShadowServer;
 typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
+typedef struct rdp_shadow_shared_encoder rdpShadowSharedEncoder;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
@@ -145,8 +146,13 @@ struct rdp_shadow_server
 	UINT32 h264BitRate;
 	FLOAT h264FrameRate;
 	UINT32 h264QP;
+	BOOL gfxClearCodec;
+	BOOL shareEncoder;
+	rdpShadowSharedEncoder* sharedEncoder;
+	BOOL compressionPipeline;
 
 	char* ipcSocket;
+	char* metricsDir;
 	char* ConfigPath;
 	char* CertificateFile;
 	char* PrivateKeyFile;
@@ -318,8 +324,12 @@ FREERDP_API void shadow_server_free(rdpShadowServer* server);
 
 FREERDP_API int shadow_capture_align_clip_rect(RECTANGLE_16* rect,
         RECTANGLE_16* clip);
-FREERDP_API int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth,
-                                       int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect);
+FREERDP_API int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth,
+                                       UINT32 nHeight, BYTE* pData2, UINT32 nStep2, REGION16* region);
+FREERDP_API BOOL shadow_capture_damage_region(const REGION16* damage,
+        const rdpShadowSurface* surface, REGION16* grabRegion);
+FREERDP_API int shadow_capture_compare_rect(rdpShadowSurface* surface,
+        const RECTANGLE_16* rect, const BYTE* pSrcData, UINT32 nSrcStep);
 
 FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
@@ -560,6 +560,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_ForceEncryptedCsPdu				719
 #define FreeRDP_HiDefRemoteApp					720
 #define FreeRDP_CompressionLevel				721
+#define FreeRDP_CompressionPipelined				722
 #define FreeRDP_IPv6Enabled					768
 #define FreeRDP_ClientAddress					769
 #define FreeRDP_ClientDir					770
@@ -723,6 +724,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_BitmapCachePersistEnabled			2500
 #define FreeRDP_BitmapCacheV2NumCells				2501
 #define FreeRDP_BitmapCacheV2CellInfo				2502
+#define FreeRDP_BitmapCachePersistFile				2503
 #define FreeRDP_ColorPointerFlag				2560
 #define FreeRDP_PointerCacheSize				2561
 #define FreeRDP_KeyboardLayout					2624
@@ -942,7 +944,8 @@ struct rdp_settings
 	ALIGN64 BOOL ForceEncryptedCsPdu; /* 719 */
 	ALIGN64 BOOL HiDefRemoteApp; /* 720 */
 	ALIGN64 UINT32 CompressionLevel; /* 721 */
-	UINT64 padding0768[768 - 722]; /* 722 */
+	ALIGN64 BOOL CompressionPipelined; /* 722 */
+	UINT64 padding0768[768 - 723]; /* 723 */
 
 	/* Client Info (Extra) */
 	ALIGN64 BOOL IPv6Enabled; /* 768 */
@@ -1207,7 +1210,8 @@ struct rdp_settings
 	ALIGN64 BOOL BitmapCachePersistEnabled; /* 2500 */
 	ALIGN64 UINT32 BitmapCacheV2NumCells; /* 2501 */
 	ALIGN64 BITMAP_CACHE_V2_CELL_INFO* BitmapCacheV2CellInfo; /* 2502 */
-	UINT64 padding2560[2560 - 2503]; /* 2503 */
+	ALIGN64 char* BitmapCachePersistFile; /* 2503 */
+	UINT64 padding2560[2560 - 2504]; /* 2504 */
 
 	/* Pointer Capabilities */
 	ALIGN64 BOOL ColorPointerFlag; /* 2560 */
@@ -30,6 +30,11 @@ struct _PROFILER
 };
 typedef struct _PROFILER PROFILER;
 
+/* events kept per thread, older ones are overwritten */
+#define PROFILER_TRACE_EVENTS		16384
+/* nesting depth of scopes tracked per thread */
+#define PROFILER_TRACE_DEPTH		32
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -44,6 +49,19 @@ FREERDP_API void profiler_print_header(void);
 FREERDP_API void profiler_print(PROFILER* profiler);
 FREERDP_API void profiler_print_footer(void);
 
+/**
+ * Runtime scope tracing. Disabled by default, it is enabled either with
+ * profiler_trace_enable() or by setting FREERDP_PROFILER_TRACE to a file
+ * name the trace is written to when the process exits.
+ * Scope names must be static strings, they are stored by reference.
+ */
+FREERDP_API void profiler_trace_enable(BOOL enable);
+FREERDP_API BOOL profiler_trace_enabled(void);
+FREERDP_API void profiler_trace_begin(const char* name);
+FREERDP_API void profiler_trace_end(const char* name);
+FREERDP_API void profiler_trace_reset(void);
+FREERDP_API BOOL profiler_trace_write(const char* filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -70,4 +88,8 @@ FREERDP_API void profiler_print_footer(void);
 #define PROFILER_PRINT_FOOTER		do { } while (0)
 #endif
 
+/* the scope tracer is compiled in with or without WITH_PROFILER */
+#define PROFILER_TRACE_BEGIN(name)	profiler_trace_begin(name)
+#define PROFILER_TRACE_END(name)	profiler_trace_end(name)
+
 #endif /* FREERDP_UTILS_PROFILER_H */
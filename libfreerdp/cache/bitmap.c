@@ -31,6 +31,7 @@
 
 #include <freerdp/log.h>
 #include <freerdp/cache/bitmap.h>
+#include <freerdp/cache/persistent.h>
 #include <freerdp/gdi/bitmap.h>
 
 #include "../gdi/gdi.h"
@@ -41,7 +42,8 @@
 static rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 				   UINT32 index);
 static BOOL bitmap_cache_put(rdpBitmapCache* bitmap_cache, UINT32 id,
-			     UINT32 index, rdpBitmap* bitmap);
+			     UINT32 index, rdpBitmap* bitmap, UINT64 key64);
+static void bitmap_cache_load_persistent(rdpBitmapCache* bitmapCache);
 
 static BOOL update_gdi_memblt(rdpContext* context,
 			      MEMBLT_ORDER* memblt)
@@ -135,7 +137,7 @@ static BOOL update_gdi_cache_bitmap(rdpContext* context,
 	Bitmap_Free(context, prevBitmap);
 	return bitmap_cache_put(cache->bitmap, cacheBitmap->cacheId,
 				cacheBitmap->cacheIndex,
-				bitmap);
+				bitmap, 0);
 }
 
 static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
@@ -144,6 +146,7 @@ static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
 {
 	rdpBitmap* bitmap;
 	rdpBitmap* prevBitmap;
+	UINT64 key64 = 0;
 	rdpCache* cache = context->cache;
 	rdpSettings* settings = context->settings;
 	bitmap = Bitmap_Alloc(context);
@@ -183,8 +186,12 @@ static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
 	}
 
 	Bitmap_Free(context, prevBitmap);
+
+	if (cacheBitmapV2->flags & CBR2_PERSISTENT_KEY_PRESENT)
+		key64 = ((UINT64) cacheBitmapV2->key2 << 32) | cacheBitmapV2->key1;
+
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV2->cacheId,
-				cacheBitmapV2->cacheIndex, bitmap);
+				cacheBitmapV2->cacheIndex, bitmap, key64);
 }
 
 static BOOL update_gdi_cache_bitmap_v3(rdpContext* context,
@@ -226,7 +233,7 @@ static BOOL update_gdi_cache_bitmap_v3(rdpContext* context,
 				      cacheBitmapV3->cacheIndex);
 	Bitmap_Free(context, prevBitmap);
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV3->cacheId,
-				cacheBitmapV3->cacheIndex, bitmap);
+				cacheBitmapV3->cacheIndex, bitmap, 0);
 }
 
 rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
@@ -234,6 +241,9 @@ rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 {
 	rdpBitmap* bitmap;
 
+	if (!bitmapCache->persistLoaded)
+		bitmap_cache_load_persistent(bitmapCache);
+
 	if (id > bitmapCache->maxCells)
 	{
 		WLog_ERR(TAG,  "get invalid bitmap cell id: %d", id);
@@ -255,8 +265,11 @@ rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 }
 
 BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
-		      rdpBitmap* bitmap)
+		      rdpBitmap* bitmap, UINT64 key64)
 {
+	if (!bitmapCache->persistLoaded)
+		bitmap_cache_load_persistent(bitmapCache);
+
 	if (id > bitmapCache->maxCells)
 	{
 		WLog_ERR(TAG,  "put invalid bitmap cell id: %d", id);
@@ -274,9 +287,153 @@ BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
 	}
 
 	bitmapCache->cells[id].entries[index] = bitmap;
+	bitmapCache->cells[id].keys[index] = key64;
 	return TRUE;
 }
 
+static BOOL bitmap_cache_persistent_enabled(rdpBitmapCache* bitmapCache)
+{
+	rdpSettings* settings = bitmapCache->settings;
+	return settings->BitmapCachePersistEnabled && settings->BitmapCachePersistFile;
+}
+
+/**
+ * Restores the bitmaps of the persistent cache file. This happens on first
+ * use of the cache rather than in bitmap_cache_new as the client registers
+ * its bitmap class only after the cache was created. The indices match the
+ * keys announced in the Persistent Key List PDU.
+ */
+static void bitmap_cache_load_persistent(rdpBitmapCache* bitmapCache)
+{
+	int index;
+	UINT32 counts[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	rdpBitmap* bitmap;
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent;
+	rdpContext* context = bitmapCache->context;
+	bitmapCache->persistLoaded = TRUE;
+
+	if (!bitmap_cache_persistent_enabled(bitmapCache) || !context->gdi)
+		return;
+
+	if (!(persistent = persistent_cache_new()))
+		return;
+
+	if (!persistent_cache_open(persistent, bitmapCache->settings->BitmapCachePersistFile,
+				   FALSE))
+	{
+		persistent_cache_free(persistent);
+		return;
+	}
+
+	while (persistent_cache_read_entry(persistent, &entry))
+	{
+		index = persistent_cache_assign_index(bitmapCache->settings, &entry, counts);
+
+		if ((index < 0) || (entry.cacheId >= bitmapCache->maxCells) ||
+		    ((UINT32) index >= bitmapCache->cells[entry.cacheId].number))
+			continue;
+
+		if (!(bitmap = Bitmap_Alloc(context)))
+			break;
+
+		Bitmap_SetDimensions(bitmap, entry.width, entry.height);
+		bitmap->format = context->gdi->dstFormat;
+		bitmap->length = entry.width * entry.height * GetBytesPerPixel(bitmap->format);
+		bitmap->data = (BYTE*) _aligned_malloc(bitmap->length, 16);
+
+		if (!bitmap->data ||
+		    !freerdp_image_copy(bitmap->data, bitmap->format, 0, 0, 0,
+					entry.width, entry.height, entry.data,
+					PIXEL_FORMAT_BGRA32, entry.width * 4, 0, 0, NULL,
+					FREERDP_FLIP_NONE) ||
+		    !bitmap->New(context, bitmap))
+		{
+			Bitmap_Free(context, bitmap);
+			continue;
+		}
+
+		Bitmap_Free(context, bitmapCache->cells[entry.cacheId].entries[index]);
+		bitmapCache->cells[entry.cacheId].entries[index] = bitmap;
+		bitmapCache->cells[entry.cacheId].keys[index] = entry.key64;
+	}
+
+	persistent_cache_free(persistent);
+}
+
+/**
+ * Writes all bitmaps of persistent cells the server sent with a key back
+ * to the persistent cache file.
+ */
+static void bitmap_cache_save_persistent(rdpBitmapCache* bitmapCache)
+{
+	UINT32 i, j;
+	BYTE* data = NULL;
+	UINT32 size = 0;
+	rdpBitmap* bitmap;
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent;
+	BITMAP_CACHE_V2_CELL_INFO* cellInfo = bitmapCache->settings->BitmapCacheV2CellInfo;
+
+	if (!bitmap_cache_persistent_enabled(bitmapCache) || !bitmapCache->persistLoaded)
+		return;
+
+	if (!(persistent = persistent_cache_new()))
+		return;
+
+	if (!persistent_cache_open(persistent, bitmapCache->settings->BitmapCachePersistFile,
+				   TRUE))
+	{
+		persistent_cache_free(persistent);
+		return;
+	}
+
+	for (i = 0; (i < bitmapCache->maxCells) && (i < PERSISTENT_CACHE_MAX_CELLS); i++)
+	{
+		if (!cellInfo[i].persistent)
+			continue;
+
+		for (j = 0; j < bitmapCache->cells[i].number; j++)
+		{
+			bitmap = bitmapCache->cells[i].entries[j];
+
+			if (!bitmap || !bitmap->data || !bitmapCache->cells[i].keys[j] ||
+			    (bitmap->width > 0xFFFF) || (bitmap->height > 0xFFFF))
+				continue;
+
+			if (bitmap->width * bitmap->height * 4 > size)
+			{
+				BYTE* tmp;
+				size = bitmap->width * bitmap->height * 4;
+				tmp = (BYTE*) realloc(data, size);
+
+				if (!tmp)
+					goto out;
+
+				data = tmp;
+			}
+
+			if (!freerdp_image_copy(data, PIXEL_FORMAT_BGRA32, bitmap->width * 4, 0, 0,
+						bitmap->width, bitmap->height, bitmap->data,
+						bitmap->format, 0, 0, 0, NULL, FREERDP_FLIP_NONE))
+				continue;
+
+			entry.key64 = bitmapCache->cells[i].keys[j];
+			entry.width = bitmap->width;
+			entry.height = bitmap->height;
+			entry.cacheId = i;
+			entry.data = data;
+
+			if (!persistent_cache_write_entry(persistent, &entry))
+				goto out;
+		}
+	}
+
+out:
+	free(data);
+	persistent_cache_free(persistent);
+}
+
 void bitmap_cache_register_callbacks(rdpUpdate* update)
 {
 	rdpCache* cache = update->context->cache;
@@ -318,6 +475,12 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 
 		if (!bitmapCache->cells[i].entries)
 			goto fail;
+
+		bitmapCache->cells[i].keys = (UINT64*) calloc((
+						 bitmapCache->cells[i].number + 1), sizeof(UINT64));
+
+		if (!bitmapCache->cells[i].keys)
+			goto fail;
 	}
 
 	return bitmapCache;
@@ -326,7 +489,10 @@ fail:
 	if (bitmapCache->cells)
 	{
 		for (i = 0; i < (int) bitmapCache->maxCells; i++)
+		{
 			free(bitmapCache->cells[i].entries);
+			free(bitmapCache->cells[i].keys);
+		}
 	}
 
 	free(bitmapCache);
@@ -340,6 +506,8 @@ void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 
 	if (bitmapCache)
 	{
+		bitmap_cache_save_persistent(bitmapCache);
+
 		for (i = 0; i < (int) bitmapCache->maxCells; i++)
 		{
 			for (j = 0; j < (int) bitmapCache->cells[i].number + 1; j++)
@@ -349,6 +517,7 @@ void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 			}
 
 			free(bitmapCache->cells[i].entries);
+			free(bitmapCache->cells[i].keys);
 		}
 
 		free(bitmapCache->cells);
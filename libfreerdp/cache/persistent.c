@@ -0,0 +1,372 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <freerdp/log.h>
+#include <freerdp/cache/persistent.h>
+
+#define TAG FREERDP_TAG("cache.persistent")
+
+/**
+ * File layout, all values little endian:
+ *
+ * header: magic (8 bytes), version (4 bytes), count (4 bytes)
+ * entry:  key64 (8 bytes), width (2 bytes), height (2 bytes),
+ *         cacheId (4 bytes), followed by width * height * 4 bytes of pixels
+ */
+
+#define PERSISTENT_CACHE_MAGIC		"FRDPBMC\0"
+#define PERSISTENT_CACHE_VERSION	1
+#define PERSISTENT_CACHE_HEADER_SIZE	16
+#define PERSISTENT_CACHE_ENTRY_SIZE	16
+
+struct rdp_persistent_cache
+{
+	BOOL write;
+	UINT32 count;
+	char* filename;
+
+	/* write mode */
+	FILE* fp;
+
+	/* read mode */
+	BYTE* view;
+	size_t viewSize;
+	size_t offset;
+	UINT32 index;
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMapping;
+#endif
+};
+
+static BOOL persistent_cache_map(rdpPersistentCache* persistent)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	persistent->hFile = CreateFileA(persistent->filename, GENERIC_READ, FILE_SHARE_READ,
+	                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (persistent->hFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!GetFileSizeEx(persistent->hFile, &size) || (size.QuadPart < PERSISTENT_CACHE_HEADER_SIZE))
+		return FALSE;
+
+	persistent->hMapping = CreateFileMappingA(persistent->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (!persistent->hMapping)
+		return FALSE;
+
+	persistent->view = (BYTE*) MapViewOfFile(persistent->hMapping, FILE_MAP_READ, 0, 0, 0);
+	persistent->viewSize = (size_t) size.QuadPart;
+	return persistent->view != NULL;
+#else
+	int fd;
+	struct stat st;
+	void* view;
+	fd = open(persistent->filename, O_RDONLY);
+
+	if (fd < 0)
+		return FALSE;
+
+	if ((fstat(fd, &st) != 0) || (st.st_size < PERSISTENT_CACHE_HEADER_SIZE))
+	{
+		close(fd);
+		return FALSE;
+	}
+
+	view = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (view == MAP_FAILED)
+		return FALSE;
+
+	persistent->view = (BYTE*) view;
+	persistent->viewSize = (size_t) st.st_size;
+	return TRUE;
+#endif
+}
+
+static void persistent_cache_unmap(rdpPersistentCache* persistent)
+{
+#ifdef _WIN32
+	if (persistent->view)
+		UnmapViewOfFile(persistent->view);
+
+	if (persistent->hMapping)
+		CloseHandle(persistent->hMapping);
+
+	if (persistent->hFile && (persistent->hFile != INVALID_HANDLE_VALUE))
+		CloseHandle(persistent->hFile);
+
+	persistent->hMapping = NULL;
+	persistent->hFile = NULL;
+#else
+	if (persistent->view)
+		munmap(persistent->view, persistent->viewSize);
+#endif
+	persistent->view = NULL;
+	persistent->viewSize = 0;
+}
+
+static BOOL persistent_cache_write_header(rdpPersistentCache* persistent)
+{
+	BYTE buffer[PERSISTENT_CACHE_HEADER_SIZE];
+	wStream* s = Stream_New(buffer, sizeof(buffer));
+
+	if (!s)
+		return FALSE;
+
+	Stream_Write(s, PERSISTENT_CACHE_MAGIC, 8); /* magic (8 bytes) */
+	Stream_Write_UINT32(s, PERSISTENT_CACHE_VERSION); /* version (4 bytes) */
+	Stream_Write_UINT32(s, persistent->count); /* count (4 bytes) */
+	Stream_Free(s, FALSE);
+
+	if (fseek(persistent->fp, 0, SEEK_SET) != 0)
+		return FALSE;
+
+	return fwrite(buffer, sizeof(buffer), 1, persistent->fp) == 1;
+}
+
+static BOOL persistent_cache_read_header(rdpPersistentCache* persistent)
+{
+	UINT32 version;
+	wStream* s = Stream_New(persistent->view, persistent->viewSize);
+
+	if (!s)
+		return FALSE;
+
+	if (memcmp(Stream_Pointer(s), PERSISTENT_CACHE_MAGIC, 8) != 0)
+	{
+		Stream_Free(s, FALSE);
+		return FALSE;
+	}
+
+	Stream_Seek(s, 8); /* magic (8 bytes) */
+	Stream_Read_UINT32(s, version); /* version (4 bytes) */
+	Stream_Read_UINT32(s, persistent->count); /* count (4 bytes) */
+	persistent->offset = Stream_GetPosition(s);
+	Stream_Free(s, FALSE);
+
+	if (version != PERSISTENT_CACHE_VERSION)
+	{
+		WLog_WARN(TAG, "unsupported persistent cache version %u", version);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Opens a persistent cache file. In read mode the file is mapped into
+ * memory and entries point into the mapping, in write mode the file is
+ * truncated and entries are appended until the cache is closed.
+ */
+BOOL persistent_cache_open(rdpPersistentCache* persistent, const char* filename,
+                           BOOL write)
+{
+	if (!persistent || !filename)
+		return FALSE;
+
+	persistent_cache_close(persistent);
+
+	if (!(persistent->filename = _strdup(filename)))
+		return FALSE;
+
+	persistent->write = write;
+	persistent->count = 0;
+	persistent->index = 0;
+
+	if (write)
+	{
+		if (!(persistent->fp = fopen(filename, "w+b")))
+		{
+			WLog_ERR(TAG, "failed to open %s for writing", filename);
+			goto fail;
+		}
+
+		if (!persistent_cache_write_header(persistent))
+			goto fail;
+
+		return TRUE;
+	}
+
+	if (!persistent_cache_map(persistent))
+		goto fail;
+
+	if (!persistent_cache_read_header(persistent))
+	{
+		WLog_WARN(TAG, "ignoring invalid persistent cache %s", filename);
+		goto fail;
+	}
+
+	return TRUE;
+fail:
+	persistent_cache_close(persistent);
+	return FALSE;
+}
+
+void persistent_cache_close(rdpPersistentCache* persistent)
+{
+	if (!persistent)
+		return;
+
+	if (persistent->fp)
+	{
+		if (!persistent_cache_write_header(persistent))
+			WLog_ERR(TAG, "failed to finalize %s", persistent->filename);
+
+		fclose(persistent->fp);
+		persistent->fp = NULL;
+	}
+
+	persistent_cache_unmap(persistent);
+	free(persistent->filename);
+	persistent->filename = NULL;
+}
+
+UINT32 persistent_cache_get_count(rdpPersistentCache* persistent)
+{
+	if (!persistent)
+		return 0;
+
+	return persistent->count;
+}
+
+BOOL persistent_cache_read_entry(rdpPersistentCache* persistent,
+                                 PERSISTENT_CACHE_ENTRY* entry)
+{
+	size_t size;
+	wStream* s;
+
+	if (!persistent || !entry || !persistent->view)
+		return FALSE;
+
+	if (persistent->index >= persistent->count)
+		return FALSE;
+
+	if ((persistent->viewSize - persistent->offset) < PERSISTENT_CACHE_ENTRY_SIZE)
+		return FALSE;
+
+	if (!(s = Stream_New(&persistent->view[persistent->offset], PERSISTENT_CACHE_ENTRY_SIZE)))
+		return FALSE;
+
+	Stream_Read_UINT64(s, entry->key64); /* key64 (8 bytes) */
+	Stream_Read_UINT16(s, entry->width); /* width (2 bytes) */
+	Stream_Read_UINT16(s, entry->height); /* height (2 bytes) */
+	Stream_Read_UINT32(s, entry->cacheId); /* cacheId (4 bytes) */
+	Stream_Free(s, FALSE);
+	persistent->offset += PERSISTENT_CACHE_ENTRY_SIZE;
+	size = entry->width * entry->height * 4ULL;
+
+	if ((persistent->viewSize - persistent->offset) < size)
+	{
+		WLog_WARN(TAG, "truncated persistent cache entry %u", persistent->index);
+		persistent->index = persistent->count;
+		return FALSE;
+	}
+
+	entry->data = &persistent->view[persistent->offset];
+	persistent->offset += size;
+	persistent->index++;
+	return TRUE;
+}
+
+BOOL persistent_cache_write_entry(rdpPersistentCache* persistent,
+                                  const PERSISTENT_CACHE_ENTRY* entry)
+{
+	BYTE header[PERSISTENT_CACHE_ENTRY_SIZE];
+	size_t size;
+	wStream* s;
+
+	if (!persistent || !entry || !persistent->fp)
+		return FALSE;
+
+	if (!(s = Stream_New(header, sizeof(header))))
+		return FALSE;
+
+	Stream_Write_UINT64(s, entry->key64); /* key64 (8 bytes) */
+	Stream_Write_UINT16(s, entry->width); /* width (2 bytes) */
+	Stream_Write_UINT16(s, entry->height); /* height (2 bytes) */
+	Stream_Write_UINT32(s, entry->cacheId); /* cacheId (4 bytes) */
+	Stream_Free(s, FALSE);
+	size = entry->width * entry->height * 4ULL;
+
+	if (fwrite(header, sizeof(header), 1, persistent->fp) != 1)
+		return FALSE;
+
+	if ((size > 0) && (fwrite(entry->data, size, 1, persistent->fp) != 1))
+		return FALSE;
+
+	persistent->count++;
+	return TRUE;
+}
+
+/**
+ * Assigns the bitmap cache index an entry is restored to. Entries fill the
+ * persistent cells in file order, this has to match the order of the keys
+ * sent in the Persistent Key List PDU. counts holds the number of entries
+ * already assigned per cell and has PERSISTENT_CACHE_MAX_CELLS elements.
+ *
+ * @return the cell index or -1 if the entry does not fit
+ */
+int persistent_cache_assign_index(rdpSettings* settings,
+                                  const PERSISTENT_CACHE_ENTRY* entry, UINT32* counts)
+{
+	BITMAP_CACHE_V2_CELL_INFO* cellInfo;
+
+	if ((entry->cacheId >= settings->BitmapCacheV2NumCells) ||
+	    (entry->cacheId >= PERSISTENT_CACHE_MAX_CELLS))
+		return -1;
+
+	cellInfo = &settings->BitmapCacheV2CellInfo[entry->cacheId];
+
+	if (!cellInfo->persistent || (counts[entry->cacheId] >= cellInfo->numEntries))
+		return -1;
+
+	return (int) counts[entry->cacheId]++;
+}
+
+rdpPersistentCache* persistent_cache_new(void)
+{
+	return (rdpPersistentCache*) calloc(1, sizeof(rdpPersistentCache));
+}
+
+void persistent_cache_free(rdpPersistentCache* persistent)
+{
+	if (!persistent)
+		return;
+
+	persistent_cache_close(persistent);
+	free(persistent);
+}
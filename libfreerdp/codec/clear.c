@@ -29,7 +29,9 @@
 
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/clear.h>
+#include <freerdp/primitives.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/profiler.h>
 
 #define TAG FREERDP_TAG("codec.clear")
 
@@ -63,7 +65,8 @@ static BOOL convert_color(BYTE* dst, UINT32 nDstStep, UINT32 DstFormat,
                           const BYTE* src, UINT32 nSrcStep, UINT32 SrcFormat,
                           UINT32 nDstWidth, UINT32 nDstHeight, const gdiPalette* palette)
 {
-	UINT32 x, y;
+	if ((nXDst >= nDstWidth) || (nYDst >= nDstHeight))
+		return TRUE;
 
 	if (nWidth + nXDst > nDstWidth)
 		nWidth = nDstWidth - nXDst;
@@ -71,27 +74,110 @@ static BOOL convert_color(BYTE* dst, UINT32 nDstStep, UINT32 DstFormat,
 	if (nHeight + nYDst > nDstHeight)
 		nHeight = nDstHeight - nYDst;
 
-	for (y = 0; y < nHeight; y++)
+	return freerdp_image_copy(dst, DstFormat, nDstStep, nXDst, nYDst, nWidth, nHeight,
+	                          src, SrcFormat, nSrcStep, 0, 0, palette, FREERDP_FLIP_NONE);
+}
+
+/**
+ * Writes decoded pixels in row major order into a rectangle of the
+ * destination, skipping everything outside of nDstWidth x nDstHeight.
+ * Pixels are kept in destination memory layout, runs become plain stores.
+ */
+struct _CLEAR_PIXEL_WRITER
+{
+	BYTE* data;
+	UINT32 step;
+	UINT32 bpp;
+	UINT32 x;
+	UINT32 y;
+	UINT32 width;
+	UINT32 visibleWidth;
+	UINT32 visibleHeight;
+	UINT32 cursorX;
+	UINT32 cursorY;
+	primitives_t* prims;
+};
+typedef struct _CLEAR_PIXEL_WRITER CLEAR_PIXEL_WRITER;
+
+static void clear_pixel_writer_init(CLEAR_PIXEL_WRITER* writer, BYTE* pDstData,
+                                    UINT32 DstFormat, UINT32 nDstStep,
+                                    UINT32 nXDst, UINT32 nYDst, UINT32 width,
+                                    UINT32 nDstWidth, UINT32 nDstHeight)
+{
+	writer->data = pDstData;
+	writer->step = nDstStep;
+	writer->bpp = GetBytesPerPixel(DstFormat);
+	writer->x = nXDst;
+	writer->y = nYDst;
+	writer->width = width;
+	writer->visibleWidth = (nDstWidth > nXDst) ? nDstWidth - nXDst : 0;
+	writer->visibleHeight = (nDstHeight > nYDst) ? nDstHeight - nYDst : 0;
+	writer->cursorX = 0;
+	writer->cursorY = 0;
+	writer->prims = primitives_get();
+}
+
+/* The pixel as WriteColor stores it */
+static INLINE void clear_pixel_bytes(BYTE* pixel, UINT32 format, UINT32 color)
+{
+	ZeroMemory(pixel, 4);
+	WriteColor(pixel, format, color);
+}
+
+static INLINE void clear_fill_pixels(primitives_t* prims, BYTE* pDst, UINT32 bpp,
+                                     const BYTE* pixel, UINT32 count)
+{
+	UINT32 i;
+
+	if (bpp == 4)
 	{
-		const BYTE* pSrcLine = &src[y * nSrcStep];
-		BYTE* pDstLine = &dst[(nYDst + y) * nDstStep];
+		UINT32 value;
+		CopyMemory(&value, pixel, 4);
+		prims->set_32u(value, (UINT32*) pDst, count);
+		return;
+	}
 
-		for (x = 0; x < nWidth; x++)
+	for (i = 0; i < count; i++)
+	{
+		CopyMemory(pDst, pixel, bpp);
+		pDst += bpp;
+	}
+}
+
+/* Writes count pixels, either count copies of pixel (fill) or consecutive ones */
+static void clear_pixel_writer_put(CLEAR_PIXEL_WRITER* writer, const BYTE* pixels,
+                                   UINT32 count, BOOL fill)
+{
+	while (count > 0)
+	{
+		const UINT32 x = writer->cursorX;
+		const UINT32 y = writer->cursorY;
+		const UINT32 n = MIN(count, writer->width - x);
+
+		if ((y < writer->visibleHeight) && (x < writer->visibleWidth))
 		{
-			const BYTE* pSrcPixel =
-			    &pSrcLine[x * GetBytesPerPixel(SrcFormat)];
-			BYTE* pDstPixel =
-			    &pDstLine[(nXDst + x) * GetBytesPerPixel(DstFormat)];
-			UINT32 color = ReadColor(pSrcPixel, SrcFormat);
-			color = ConvertColor(color, SrcFormat,
-			                     DstFormat, palette);
-
-			if (!WriteColor(pDstPixel, DstFormat, color))
-				return FALSE;
+			const UINT32 visible = MIN(n, writer->visibleWidth - x);
+			BYTE* pDst = &writer->data[(writer->y + y) * writer->step +
+			                           (writer->x + x) * writer->bpp];
+
+			if (fill)
+				clear_fill_pixels(writer->prims, pDst, writer->bpp, pixels, visible);
+			else
+				CopyMemory(pDst, pixels, visible * writer->bpp);
 		}
-	}
 
-	return TRUE;
+		if (!fill)
+			pixels += n * writer->bpp;
+
+		count -= n;
+		writer->cursorX += n;
+
+		if (writer->cursorX >= writer->width)
+		{
+			writer->cursorX = 0;
+			writer->cursorY++;
+		}
+	}
 }
 
 static BOOL clear_decompress_nscodec(NSC_CONTEXT* nsc, UINT32 width,
@@ -122,10 +208,7 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
         BYTE* pDstData, UINT32 DstFormat, UINT32 nDstStep,
         UINT32 nXDstRel, UINT32 nYDstRel, UINT32 nDstWidth, UINT32 nDstHeight)
 {
-	UINT32 x = 0, y = 0;
-	UINT32 i;
 	UINT32 pixelCount;
-	UINT32 nSrcStep;
 	UINT32 bitmapDataOffset;
 	UINT32 pixelIndex;
 	UINT32 numBits;
@@ -134,7 +217,9 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 	BYTE suiteIndex;
 	BYTE suiteDepth;
 	BYTE paletteCount;
-	UINT32 palette[128] = { 0 };
+	CLEAR_PIXEL_WRITER writer;
+	BYTE palette[128 * 4];
+	const UINT32 bpp = GetBytesPerPixel(DstFormat);
 
 	if (Stream_GetRemainingLength(s) < bitmapDataByteCount)
 	{
@@ -146,21 +231,28 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 	Stream_Read_UINT8(s, paletteCount);
 	bitmapDataOffset = 1 + (paletteCount * 3);
 
-	if (paletteCount > 127)
+	if ((paletteCount > 127) || (paletteCount < 1))
 	{
 		WLog_ERR(TAG, "paletteCount %lu", paletteCount);
 		return FALSE;
 	}
 
-	for (i = 0; i < paletteCount; i++)
+	if (Stream_GetRemainingLength(s) < (paletteCount * 3))
 	{
-		BYTE r, g, b;
-		Stream_Read_UINT8(s, b);
-		Stream_Read_UINT8(s, g);
-		Stream_Read_UINT8(s, r);
-		palette[i] = GetColor(DstFormat, r, g, b, 0xFF);
+		WLog_ERR(TAG, "stream short %lu [%lu expected]", Stream_GetRemainingLength(s),
+		         paletteCount * 3);
+		return FALSE;
 	}
 
+	/* The palette is sent as BGR24, expand all of it to the destination format at once */
+	if (!freerdp_image_copy(palette, DstFormat, 0, 0, 0, paletteCount, 1,
+	                        Stream_Pointer(s), PIXEL_FORMAT_BGR24, 0, 0, 0,
+	                        NULL, FREERDP_FLIP_NONE))
+		return FALSE;
+
+	Stream_Seek(s, paletteCount * 3);
+	clear_pixel_writer_init(&writer, pDstData, DstFormat, nDstStep, nXDstRel, nYDstRel,
+	                        width, nDstWidth, nDstHeight);
 	pixelIndex = 0;
 	pixelCount = width * height;
 	numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
@@ -168,7 +260,6 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 	while (bitmapDataOffset < bitmapDataByteCount)
 	{
 		UINT32 tmp;
-		UINT32 color;
 		UINT32 runLengthFactor;
 
 		if (Stream_GetRemainingLength(s) < 2)
@@ -225,14 +316,6 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 
 		suiteIndex = startIndex;
 
-		if (suiteIndex > 127)
-		{
-			WLog_ERR(TAG, "suiteIndex %lu > %lu]", suiteIndex, 127);
-			return FALSE;
-		}
-
-		color = palette[suiteIndex];
-
 		if ((pixelIndex + runLengthFactor) > pixelCount)
 		{
 			WLog_ERR(TAG, "pixelIndex %lu + runLengthFactor %lu > pixelCount %lu",
@@ -241,21 +324,7 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 			return FALSE;
 		}
 
-		for (i = 0; i < runLengthFactor; i++)
-		{
-			BYTE* pTmpData = &pDstData[(nXDstRel + x) * GetBytesPerPixel(DstFormat) +
-			                           (nYDstRel + y) * nDstStep];
-
-			if ((nXDstRel + x < nDstWidth) && (nYDstRel + y < nDstHeight))
-				WriteColor(pTmpData, DstFormat, color);
-
-			if (++x >= width)
-			{
-				y++;
-				x = 0;
-			}
-		}
-
+		clear_pixel_writer_put(&writer, &palette[suiteIndex * bpp], runLengthFactor, TRUE);
 		pixelIndex += runLengthFactor;
 
 		if ((pixelIndex + (suiteDepth + 1)) > pixelCount)
@@ -266,35 +335,11 @@ static BOOL clear_decompress_subcode_rlex(wStream* s,
 			return FALSE;
 		}
 
-		for (i = 0; i <= suiteDepth; i++)
-		{
-			BYTE* pTmpData = &pDstData[(nXDstRel + x) * GetBytesPerPixel(DstFormat) +
-			                           (nYDstRel + y) * nDstStep];
-			UINT32 color = palette[suiteIndex];
-
-			if (suiteIndex > 127)
-			{
-				WLog_ERR(TAG, "suiteIndex %lu > %lu", suiteIndex, 127);
-				return FALSE;
-			}
-
-			suiteIndex++;
-
-			if ((nXDstRel + x < nDstWidth) && (nYDstRel + y < nDstHeight))
-				WriteColor(pTmpData, DstFormat, color);
-
-			if (++x >= width)
-			{
-				y++;
-				x = 0;
-			}
-		}
-
+		/* the suite is the palette range startIndex..stopIndex */
+		clear_pixel_writer_put(&writer, &palette[suiteIndex * bpp], suiteDepth + 1, FALSE);
 		pixelIndex += (suiteDepth + 1);
 	}
 
-	nSrcStep = width * GetBytesPerPixel(DstFormat);
-
 	if (pixelIndex != pixelCount)
 	{
 		WLog_ERR(TAG, "pixelIndex %lu != pixelCount %lu", pixelIndex, pixelCount);
@@ -313,12 +358,10 @@ static BOOL clear_decompress_residual_data(CLEAR_CONTEXT* clear,
         UINT32 nDstWidth, UINT32 nDstHeight,
         const gdiPalette* palette)
 {
-	UINT32 i;
-	UINT32 nSrcStep;
 	UINT32 suboffset;
-	BYTE* dstBuffer;
 	UINT32 pixelIndex;
 	UINT32 pixelCount;
+	CLEAR_PIXEL_WRITER writer;
 
 	if (Stream_GetRemainingLength(s) < residualByteCount)
 	{
@@ -330,13 +373,15 @@ static BOOL clear_decompress_residual_data(CLEAR_CONTEXT* clear,
 	suboffset = 0;
 	pixelIndex = 0;
 	pixelCount = nWidth * nHeight;
-	dstBuffer = clear->TempBuffer;
+	/* the runs go straight to the destination, clear->format is DstFormat here */
+	clear_pixel_writer_init(&writer, pDstData, DstFormat, nDstStep, nXDst, nYDst,
+	                        nWidth, nDstWidth, nDstHeight);
 
 	while (suboffset < residualByteCount)
 	{
 		BYTE r, g, b;
 		UINT32 runLengthFactor;
-		UINT32 color;
+		BYTE pixel[4];
 
 		if (Stream_GetRemainingLength(s) < 4)
 		{
@@ -350,7 +395,7 @@ static BOOL clear_decompress_residual_data(CLEAR_CONTEXT* clear,
 		Stream_Read_UINT8(s, r);
 		Stream_Read_UINT8(s, runLengthFactor);
 		suboffset += 4;
-		color = GetColor(clear->format, r, g, b, 0xFF);
+		clear_pixel_bytes(pixel, DstFormat, GetColor(DstFormat, r, g, b, 0xFF));
 
 		if (runLengthFactor >= 0xFF)
 		{
@@ -386,27 +431,17 @@ static BOOL clear_decompress_residual_data(CLEAR_CONTEXT* clear,
 			return FALSE;
 		}
 
-		for (i = 0; i < runLengthFactor; i++)
-		{
-			WriteColor(dstBuffer, clear->format, color);
-			dstBuffer += GetBytesPerPixel(clear->format);
-		}
-
+		clear_pixel_writer_put(&writer, pixel, runLengthFactor, TRUE);
 		pixelIndex += runLengthFactor;
 	}
 
-	nSrcStep = nWidth * GetBytesPerPixel(clear->format);
-
 	if (pixelIndex != pixelCount)
 	{
 		WLog_ERR(TAG, "pixelIndex %lu != pixelCount %lu", pixelIndex, pixelCount);
 		return FALSE;
 	}
 
-	return convert_color(pDstData, nDstStep, DstFormat,
-	                     nXDst, nYDst, nWidth, nHeight,
-	                     clear->TempBuffer, nSrcStep, clear->format,
-	                     nDstWidth, nDstHeight, palette);
+	return TRUE;
 }
 
 static BOOL clear_decompress_subcodecs_data(CLEAR_CONTEXT* clear, wStream* s,
@@ -474,20 +509,6 @@ static BOOL clear_decompress_subcodecs_data(CLEAR_CONTEXT* clear, wStream* s,
 			return FALSE;
 		}
 
-		if ((width * height * GetBytesPerPixel(clear->format)) >
-		    clear->TempSize)
-		{
-			clear->TempSize = (width * height * GetBytesPerPixel(clear->format));
-			clear->TempBuffer = (BYTE*) realloc(clear->TempBuffer, clear->TempSize);
-
-			if (!clear->TempBuffer)
-			{
-				WLog_ERR(TAG, "clear->TempBuffer realloc failed for %lu bytes",
-				         clear->TempSize);
-				return FALSE;
-			}
-		}
-
 		switch (subcodecId)
 		{
 			case 0: /* Uncompressed */
@@ -544,26 +565,29 @@ static BOOL clear_decompress_subcodecs_data(CLEAR_CONTEXT* clear, wStream* s,
 	return TRUE;
 }
 
+/* VBar entries are at most 52 pixels high. The first use allocates that for
+ * the widest format, later cache updates only overwrite the pixels. */
+#define CLEAR_VBAR_ENTRY_PIXELS 52
+
 static BOOL resize_vbar_entry(CLEAR_CONTEXT* clear, CLEAR_VBAR_ENTRY* vBarEntry)
 {
 	if (vBarEntry->count > vBarEntry->size)
 	{
-		const UINT32 bpp = GetBytesPerPixel(clear->format);
-		const UINT32 oldPos = vBarEntry->size * bpp;
-		const UINT32 diffSize = (vBarEntry->count - vBarEntry->size) * bpp;
+		const UINT32 size = MAX(vBarEntry->count, CLEAR_VBAR_ENTRY_PIXELS);
+		const UINT32 oldPos = vBarEntry->size * 4;
+		const UINT32 diffSize = (size - vBarEntry->size) * 4;
 		BYTE* tmp;
-		vBarEntry->size = vBarEntry->count;
-		tmp = (BYTE*) realloc(vBarEntry->pixels,
-		                      vBarEntry->count * bpp);
+		tmp = (BYTE*) realloc(vBarEntry->pixels, size * 4);
 
 		if (!tmp)
 		{
-			WLog_ERR(TAG, "vBarEntry->pixels realloc %lu failed", vBarEntry->count * bpp);
+			WLog_ERR(TAG, "vBarEntry->pixels realloc %lu failed", size * 4);
 			return FALSE;
 		}
 
 		memset(&tmp[oldPos], 0, diffSize);
 		vBarEntry->pixels = tmp;
+		vBarEntry->size = size;
 	}
 
 	if (!vBarEntry->pixels && vBarEntry->size)
@@ -587,6 +611,9 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 	UINT32 suboffset;
 	UINT32 nXDstRel;
 	UINT32 nYDstRel;
+	BYTE pixelBkg[4];
+	const UINT32 bpp = GetBytesPerPixel(clear->format);
+	primitives_t* prims = primitives_get();
 
 	if (Stream_GetRemainingLength(s) < bandsByteCount)
 	{
@@ -629,6 +656,7 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 		Stream_Read_UINT8(s, r);
 		suboffset += 11;
 		colorBkg = GetColor(clear->format, r, g, b, 0xFF);
+		clear_pixel_bytes(pixelBkg, clear->format, colorBkg);
 
 		if (xEnd < xStart)
 		{
@@ -651,6 +679,7 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 			CLEAR_VBAR_ENTRY* vBarShortEntry;
 			BOOL vBarUpdate = FALSE;
 			const BYTE* pSrcPixel;
+			BYTE* pDstPixel8;
 
 			if (Stream_GetRemainingLength(s) < 2)
 			{
@@ -732,21 +761,13 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 				if (!resize_vbar_entry(clear, vBarShortEntry))
 					return FALSE;
 
-				for (y = 0; y < vBarShortPixelCount; y++)
-				{
-					BYTE r, g, b;
-					BYTE* dstBuffer =
-					    &vBarShortEntry->pixels[y * GetBytesPerPixel(clear->format)];
-					UINT32 color;
-					Stream_Read_UINT8(s, b);
-					Stream_Read_UINT8(s, g);
-					Stream_Read_UINT8(s, r);
-					color = GetColor(clear->format, r, g, b, 0xFF);
-
-					if (!WriteColor(dstBuffer, clear->format, color))
-						return FALSE;
-				}
+				/* cache the pixels in the output format, hits are plain copies */
+				if (!freerdp_image_copy(vBarShortEntry->pixels, clear->format, 0, 0, 0,
+				                        vBarShortPixelCount, 1, Stream_Pointer(s),
+				                        PIXEL_FORMAT_BGR24, 0, 0, 0, NULL, FREERDP_FLIP_NONE))
+					return FALSE;
 
+				Stream_Seek(s, vBarShortPixelCount * 3);
 				suboffset += (vBarShortPixelCount * 3);
 				clear->ShortVBarStorageCursor =
 				    (clear->ShortVBarStorageCursor + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
@@ -765,8 +786,6 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 
 			if (vBarUpdate)
 			{
-				UINT32 x;
-				BYTE* pSrcPixel;
 				BYTE* dstBuffer;
 
 				if (clear->VBarStorageCursor >= CLEARCODEC_VBAR_SIZE)
@@ -792,12 +811,8 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 				if ((y + count) > vBarPixelCount)
 					count = (vBarPixelCount > y) ? (vBarPixelCount - y) : 0;
 
-				while (count--)
-				{
-					WriteColor(dstBuffer, clear->format, colorBkg);
-					dstBuffer += GetBytesPerPixel(clear->format);
-				}
-
+				clear_fill_pixels(prims, dstBuffer, bpp, pixelBkg, count);
+				dstBuffer += count * bpp;
 				/*
 				 * if ((y >= vBarYOn) && (y < (vBarYOn + vBarShortPixelCount))),
 				 * use vBarShortPixels at index (y - shortVBarYOn)
@@ -808,33 +823,12 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 				if ((y + count) > vBarPixelCount)
 					count = (vBarPixelCount > y) ? (vBarPixelCount - y) : 0;
 
-				pSrcPixel = &vBarShortEntry->pixels[(y - vBarYOn) * GetBytesPerPixel(
-				                                        clear->format)];
-
-				for (x = 0; x < count; x++)
-				{
-					UINT32 color;
-					color =	ReadColor(&vBarShortEntry->pixels[x * GetBytesPerPixel(clear->format)],
-					                  clear->format);
-
-					if (!WriteColor(dstBuffer, clear->format, color))
-						return FALSE;
-
-					dstBuffer += GetBytesPerPixel(clear->format);
-				}
-
+				CopyMemory(dstBuffer, vBarShortEntry->pixels, count * bpp);
+				dstBuffer += count * bpp;
 				/* if (y >= (vBarYOn + vBarShortPixelCount)), use colorBkg */
 				y = vBarYOn + vBarShortPixelCount;
 				count = (vBarPixelCount > y) ? (vBarPixelCount - y) : 0;
-
-				while (count--)
-				{
-					if (!WriteColor(dstBuffer, clear->format, colorBkg))
-						return FALSE;
-
-					dstBuffer += GetBytesPerPixel(clear->format);
-				}
-
+				clear_fill_pixels(prims, dstBuffer, bpp, pixelBkg, count);
 				vBarEntry->count = vBarPixelCount;
 				clear->VBarStorageCursor = (clear->VBarStorageCursor + 1) %
 				                           CLEARCODEC_VBAR_SIZE;
@@ -858,18 +852,14 @@ static BOOL clear_decompress_bands_data(CLEAR_CONTEXT* clear,
 				if (count > nHeight)
 					count = nHeight;
 
+				pDstPixel8 = &pDstData[(nYDstRel * nDstStep) + ((nXDstRel + i) * bpp)];
+
+				/* the entry already is in DstFormat */
 				for (y = 0; y < count; y++)
 				{
-					BYTE* pDstPixel8 = &pDstData[((nYDstRel + y) * nDstStep) +
-					                             ((nXDstRel + i) * GetBytesPerPixel(DstFormat))];
-					UINT32 color = ReadColor(pSrcPixel, clear->format);
-					color = ConvertColor(color, clear->format,
-					                     DstFormat, NULL);
-
-					if (!WriteColor(pDstPixel8, DstFormat, color))
-						return FALSE;
-
-					pSrcPixel += GetBytesPerPixel(clear->format);
+					CopyMemory(pDstPixel8, pSrcPixel, bpp);
+					pDstPixel8 += nDstStep;
+					pSrcPixel += bpp;
 				}
 			}
 		}
@@ -1030,6 +1020,7 @@ INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
 	if (!s)
 		return -2005;
 
+	PROFILER_TRACE_BEGIN("clear_decompress");
 	Stream_SetLength(s, SrcSize);
 
 	if (Stream_GetRemainingLength(s) < 2)
@@ -1133,67 +1124,947 @@ finish:
 	rc = 0;
 fail:
 	Stream_Free(s, FALSE);
+	PROFILER_TRACE_END("clear_decompress");
 	return rc;
 }
 
-int clear_compress(CLEAR_CONTEXT* clear, BYTE* pSrcData, UINT32 SrcSize,
-                   BYTE** ppDstData, UINT32* pDstSize)
+/**
+ * ClearCodec Encoder
+ *
+ * The image is cut into strips of at most 52 rows (the maximum band height).
+ * Inside a strip, columns which differ from the strip background are grouped
+ * into segments. A segment is sent either as a band (vertical bars, reusing the
+ * vbar and short vbar caches) or as a subcodec rectangle (RLEX or uncompressed),
+ * whichever is estimated to be smaller. The lossy NSCodec subcodec is not used. All remaining pixels are
+ * sent as residual data, covered pixels just extend the current residual run.
+ *
+ * The encoder keeps the same glyph, vbar and short vbar storage as the decoder,
+ * together with hash tables to look up entries by content.
+ */
+
+#define CLEAR_GLYPH_HASH_SIZE 8192
+#define CLEAR_VBAR_HASH_SIZE 65536
+#define CLEAR_SHORT_VBAR_HASH_SIZE 32768
+#define CLEAR_COLOR_TABLE_SIZE 512
+#define CLEAR_MAX_BAND_HEIGHT 52
+#define CLEAR_MAX_GLYPH_AREA 1024
+#define CLEAR_BAND_GAP 4
+
+struct _CLEAR_COLOR_TABLE
+{
+	UINT32 count;
+	UINT32 colors[CLEAR_COLOR_TABLE_SIZE];
+	UINT32 values[CLEAR_COLOR_TABLE_SIZE];
+	BYTE used[CLEAR_COLOR_TABLE_SIZE];
+};
+typedef struct _CLEAR_COLOR_TABLE CLEAR_COLOR_TABLE;
+
+static INLINE void clear_color_table_init(CLEAR_COLOR_TABLE* table)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!");
-	return 1;
+	table->count = 0;
+	ZeroMemory(table->used, sizeof(table->used));
 }
-BOOL clear_context_reset(CLEAR_CONTEXT* clear)
+
+/* Returns the slot of the color, -1 if the table is full */
+static INLINE INT32 clear_color_table_add(CLEAR_COLOR_TABLE* table, UINT32 color)
 {
-	if (!clear)
+	UINT32 slot = (color * 2654435761U) >> 23;
+
+	while (table->used[slot])
+	{
+		if (table->colors[slot] == color)
+			return (INT32) slot;
+
+		slot = (slot + 1) & (CLEAR_COLOR_TABLE_SIZE - 1);
+	}
+
+	if (table->count >= (CLEAR_COLOR_TABLE_SIZE / 2))
+		return -1;
+
+	table->used[slot] = 1;
+	table->colors[slot] = color;
+	table->values[slot] = 0;
+	table->count++;
+	return (INT32) slot;
+}
+
+static INLINE UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261U ^ count;
+
+	for (i = 0; i < count; i++)
+		hash = (hash ^ pixels[i]) * 16777619U;
+
+	return hash;
+}
+
+static INLINE BOOL clear_write_color(wStream* s, UINT32 color)
+{
+	/* see clear_encoder_load for the layout of color */
+	if (!Stream_EnsureRemainingCapacity(s, 3))
 		return FALSE;
 
-	clear->seqNumber = 0;
-	clear->VBarStorageCursor = 0;
-	clear->ShortVBarStorageCursor = 0;
+	Stream_Write_UINT8(s, color & 0xFF);
+	Stream_Write_UINT8(s, (color >> 8) & 0xFF);
+	Stream_Write_UINT8(s, (color >> 16) & 0xFF);
 	return TRUE;
 }
-CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
+
+static INLINE UINT32 clear_run_length_size(UINT32 runLength)
 {
-	CLEAR_CONTEXT* clear;
-	clear = (CLEAR_CONTEXT*) calloc(1, sizeof(CLEAR_CONTEXT));
+	if (runLength < 0xFF)
+		return 1;
 
-	if (!clear)
-		return NULL;
+	if (runLength < 0xFFFF)
+		return 3;
 
-	clear->Compressor = Compressor;
-	clear->nsc = nsc_context_new();
+	return 7;
+}
 
-	if (!clear->nsc)
-		goto error_nsc;
+static INLINE BOOL clear_write_run_length(wStream* s, UINT32 runLength)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 7))
+		return FALSE;
 
-	if (!updateContextFormat(clear, PIXEL_FORMAT_BGRX32))
-		goto error_nsc;
+	if (runLength < 0xFF)
+	{
+		Stream_Write_UINT8(s, runLength);
+	}
+	else if (runLength < 0xFFFF)
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, runLength);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, 0xFFFF);
+		Stream_Write_UINT32(s, runLength);
+	}
 
-	clear->TempSize = 512 * 512 * 4;
-	clear->TempBuffer = (BYTE*) malloc(clear->TempSize);
+	return TRUE;
+}
 
-	if (!clear->TempBuffer)
-		goto error_nsc;
+static INT32 clear_vbar_lookup(const CLEAR_VBAR_ENTRY* storage, const UINT32* hashTable,
+                               UINT32 hashSize, UINT32 hash,
+                               const UINT32* pixels, UINT32 count)
+{
+	const CLEAR_VBAR_ENTRY* entry;
+	const UINT32 slot = hashTable[hash & (hashSize - 1)];
 
-	if (!clear_context_reset(clear))
-		goto error_nsc;
+	if (!slot)
+		return -1;
 
-	return clear;
-error_nsc:
-	clear_context_free(clear);
-	return NULL;
+	entry = &storage[slot - 1];
+
+	if (entry->count != count)
+		return -1;
+
+	if (count && memcmp(entry->pixels, pixels, count * sizeof(UINT32)) != 0)
+		return -1;
+
+	return (INT32)(slot - 1);
 }
-void clear_context_free(CLEAR_CONTEXT* clear)
+
+static BOOL clear_vbar_store(CLEAR_CONTEXT* clear, CLEAR_VBAR_ENTRY* entry,
+                             UINT32* hashTable, UINT32 hashSize, UINT32 hash,
+                             UINT32 index, const UINT32* pixels, UINT32 count)
 {
-	int i;
+	entry->count = count;
 
-	if (!clear)
-		return;
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
 
-	nsc_context_free(clear->nsc);
-	free(clear->TempBuffer);
+	if (count)
+		CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+
+	hashTable[hash & (hashSize - 1)] = index + 1;
+	return TRUE;
+}
+
+static INT32 clear_glyph_lookup(CLEAR_CONTEXT* clear, UINT32 hash,
+                                const UINT32* pixels, UINT32 count)
+{
+	const CLEAR_GLYPH_ENTRY* entry;
+	const UINT32 slot = clear->GlyphHashTable[hash & (CLEAR_GLYPH_HASH_SIZE - 1)];
+
+	if (!slot)
+		return -1;
+
+	entry = &clear->GlyphCache[slot - 1];
+
+	/* the decoder copies the cached pixels linearly, only the pixel count matters */
+	if (!entry->pixels || (entry->count != count))
+		return -1;
+
+	if (memcmp(entry->pixels, pixels, count * sizeof(UINT32)) != 0)
+		return -1;
+
+	return (INT32)(slot - 1);
+}
+
+static BOOL clear_glyph_store(CLEAR_CONTEXT* clear, UINT32 hash, UINT32 index,
+                              const UINT32* pixels, UINT32 count)
+{
+	CLEAR_GLYPH_ENTRY* entry = &clear->GlyphCache[index];
+
+	if (count > entry->size)
+	{
+		UINT32* tmp = (UINT32*) realloc(entry->pixels, count * sizeof(UINT32));
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "glyphEntry->pixels realloc %lu failed!", count * sizeof(UINT32));
+			return FALSE;
+		}
+
+		entry->pixels = tmp;
+		entry->size = count;
+	}
+
+	entry->count = count;
+	CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+	clear->GlyphHashTable[hash & (CLEAR_GLYPH_HASH_SIZE - 1)] = index + 1;
+	return TRUE;
+}
+
+static BOOL clear_encoder_load(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
+                               UINT32 SrcFormat, UINT32 nSrcStep,
+                               UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 i;
+	const BYTE* bgr;
+	UINT32* pixels;
+	const UINT32 count = nWidth * nHeight;
+
+	if ((count * 4) > clear->TempSize)
+	{
+		BYTE* tmp = (BYTE*) realloc(clear->TempBuffer, count * 4);
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "clear->TempBuffer realloc failed for %lu bytes", count * 4);
+			return FALSE;
+		}
+
+		clear->TempBuffer = tmp;
+		clear->TempSize = count * 4;
+	}
+
+	if (count > clear->CoverageSize)
+	{
+		BYTE* tmp = (BYTE*) realloc(clear->CoverageMap, count);
+
+		if (!tmp)
+			return FALSE;
+
+		clear->CoverageMap = tmp;
+		clear->CoverageSize = count;
+	}
+
+	if (!freerdp_image_copy(clear->TempBuffer, PIXEL_FORMAT_BGRX32, nWidth * 4, 0, 0,
+	                        nWidth, nHeight, pSrcData, SrcFormat, nSrcStep, 0, 0,
+	                        NULL, FREERDP_FLIP_NONE))
+		return FALSE;
+
+	/**
+	 * Each pixel becomes blue | green << 8 | red << 16 independent of the host
+	 * byte order. The alpha byte is not transmitted, it is made constant so
+	 * pixels can be compared as a whole.
+	 */
+	bgr = clear->TempBuffer;
+	pixels = (UINT32*) clear->TempBuffer;
+
+	for (i = 0; i < count; i++)
+	{
+		pixels[i] = bgr[0] | (bgr[1] << 8) | (bgr[2] << 16) | 0xFF000000;
+		bgr += 4;
+	}
+
+	ZeroMemory(clear->CoverageMap, count);
+	return TRUE;
+}
+
+static UINT32 clear_strip_background(const UINT32* pixels, UINT32 nWidth,
+                                     UINT32 yStart, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 best = 0;
+	UINT32 colorBkg = pixels[yStart * nWidth];
+	CLEAR_COLOR_TABLE table;
+	clear_color_table_init(&table);
+
+	for (y = yStart; y < yStart + height; y++)
+	{
+		const UINT32* line = &pixels[y * nWidth];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			const INT32 slot = clear_color_table_add(&table, line[x]);
+
+			if (slot < 0)
+				continue;
+
+			if (++table.values[slot] > best)
+			{
+				best = table.values[slot];
+				colorBkg = line[x];
+			}
+		}
+	}
 
-	for (i = 0; i < 4000; i++)
+	return colorBkg;
+}
+
+static INLINE void clear_load_column(const UINT32* pixels, UINT32 nWidth, UINT32 x,
+                                     UINT32 yStart, UINT32 height, UINT32* column)
+{
+	UINT32 y;
+
+	for (y = 0; y < height; y++)
+		column[y] = pixels[(yStart + y) * nWidth + x];
+}
+
+static INLINE BOOL clear_column_is_flat(const UINT32* pixels, UINT32 nWidth, UINT32 x,
+                                        UINT32 yStart, UINT32 height, UINT32 colorBkg)
+{
+	UINT32 y;
+
+	for (y = yStart; y < yStart + height; y++)
+	{
+		if (pixels[y * nWidth + x] != colorBkg)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static INLINE void clear_column_short_range(const UINT32* column, UINT32 height,
+        UINT32 colorBkg, UINT32* pYOn, UINT32* pYOff)
+{
+	UINT32 yOn = 0;
+	UINT32 yOff = height;
+
+	while ((yOn < height) && (column[yOn] == colorBkg))
+		yOn++;
+
+	if (yOn == height)
+	{
+		*pYOn = *pYOff = 0;
+		return;
+	}
+
+	while (column[yOff - 1] == colorBkg)
+		yOff--;
+
+	*pYOn = yOn;
+	*pYOff = yOff;
+}
+
+/**
+ * Encodes the vbars of a band, or only estimates the encoded size if s is NULL.
+ * The estimate does not account for vbars repeated inside the band itself.
+ */
+static BOOL clear_encode_band(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                              UINT32 nWidth, UINT32 xStart, UINT32 xEnd,
+                              UINT32 yStart, UINT32 height, UINT32 colorBkg, UINT32* pSize)
+{
+	UINT32 x;
+	UINT32 size = 11;
+	UINT32 column[CLEAR_MAX_BAND_HEIGHT];
+
+	if (s)
+	{
+		if (!Stream_EnsureRemainingCapacity(s, 8))
+			return FALSE;
+
+		Stream_Write_UINT16(s, xStart);
+		Stream_Write_UINT16(s, xEnd);
+		Stream_Write_UINT16(s, yStart);
+		Stream_Write_UINT16(s, yStart + height - 1);
+
+		if (!clear_write_color(s, colorBkg))
+			return FALSE;
+	}
+
+	for (x = xStart; x <= xEnd; x++)
+	{
+		INT32 index;
+		UINT32 yOn, yOff;
+		UINT32 hash;
+		UINT32 shortHash;
+		clear_load_column(pixels, nWidth, x, yStart, height, column);
+		hash = clear_hash_pixels(column, height);
+		index = clear_vbar_lookup(clear->VBarStorage, clear->VBarHashTable,
+		                          CLEAR_VBAR_HASH_SIZE, hash, column, height);
+
+		if (index >= 0) /* VBAR_CACHE_HIT */
+		{
+			size += 2;
+
+			if (s)
+			{
+				if (!Stream_EnsureRemainingCapacity(s, 2))
+					return FALSE;
+
+				Stream_Write_UINT16(s, 0x8000 | index);
+			}
+
+			continue;
+		}
+
+		clear_column_short_range(column, height, colorBkg, &yOn, &yOff);
+		shortHash = clear_hash_pixels(&column[yOn], yOff - yOn);
+		index = clear_vbar_lookup(clear->ShortVBarStorage, clear->ShortVBarHashTable,
+		                          CLEAR_SHORT_VBAR_HASH_SIZE, shortHash,
+		                          &column[yOn], yOff - yOn);
+
+		if (index >= 0) /* SHORT_VBAR_CACHE_HIT */
+		{
+			size += 3;
+
+			if (s)
+			{
+				if (!Stream_EnsureRemainingCapacity(s, 3))
+					return FALSE;
+
+				Stream_Write_UINT16(s, 0x4000 | index);
+				Stream_Write_UINT8(s, yOn);
+			}
+		}
+		else /* SHORT_VBAR_CACHE_MISS */
+		{
+			size += 2 + (yOff - yOn) * 3;
+
+			if (s)
+			{
+				UINT32 y;
+				const UINT32 cursor = clear->ShortVBarStorageCursor;
+
+				if (!Stream_EnsureRemainingCapacity(s, 2))
+					return FALSE;
+
+				Stream_Write_UINT16(s, (yOff << 8) | yOn);
+
+				for (y = yOn; y < yOff; y++)
+				{
+					if (!clear_write_color(s, column[y]))
+						return FALSE;
+				}
+
+				if (!clear_vbar_store(clear, &clear->ShortVBarStorage[cursor],
+				                      clear->ShortVBarHashTable, CLEAR_SHORT_VBAR_HASH_SIZE,
+				                      shortHash, cursor, &column[yOn], yOff - yOn))
+					return FALSE;
+
+				clear->ShortVBarStorageCursor = (cursor + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
+			}
+		}
+
+		/* Both short vbar variants make the decoder store the full vbar */
+		if (s)
+		{
+			const UINT32 cursor = clear->VBarStorageCursor;
+
+			if (!clear_vbar_store(clear, &clear->VBarStorage[cursor], clear->VBarHashTable,
+			                      CLEAR_VBAR_HASH_SIZE, hash, cursor, column, height))
+				return FALSE;
+
+			clear->VBarStorageCursor = (cursor + 1) % CLEARCODEC_VBAR_SIZE;
+		}
+	}
+
+	*pSize = size;
+	return TRUE;
+}
+
+static INLINE void clear_write_subcodec_header(wStream* s, UINT32 xStart, UINT32 yStart,
+        UINT32 width, UINT32 height, UINT32 bitmapDataByteCount, BYTE subcodecId)
+{
+	Stream_Write_UINT16(s, xStart);
+	Stream_Write_UINT16(s, yStart);
+	Stream_Write_UINT16(s, width);
+	Stream_Write_UINT16(s, height);
+	Stream_Write_UINT32(s, bitmapDataByteCount);
+	Stream_Write_UINT8(s, subcodecId);
+}
+
+static BOOL clear_encode_subcodec_rlex(wStream* s, const UINT32* pixels, UINT32 nWidth,
+                                       UINT32 xStart, UINT32 yStart,
+                                       UINT32 width, UINT32 height, CLEAR_COLOR_TABLE* table)
+{
+	UINT32 x, y;
+	UINT32 i = 0;
+	UINT32 numBits;
+	UINT32 maxDepth;
+	UINT32 paletteCount = 0;
+	UINT32 palette[127];
+	const UINT32 count = width * height;
+	BYTE* indices = (BYTE*) malloc(count);
+
+	if (!indices)
+		return FALSE;
+
+	/* Palette in order of appearance, neighbouring colors tend to form suites */
+	clear_color_table_init(table);
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT32* line = &pixels[(yStart + y) * nWidth + xStart];
+
+		for (x = 0; x < width; x++)
+		{
+			const INT32 slot = clear_color_table_add(table, line[x]);
+
+			if (slot < 0)
+				goto fail;
+
+			if (table->count > paletteCount)
+			{
+				if (paletteCount == 127)
+					goto fail;
+
+				table->values[slot] = paletteCount;
+				palette[paletteCount++] = line[x];
+			}
+
+			indices[i++] = (BYTE) table->values[slot];
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 1 + paletteCount * 3))
+		goto fail;
+
+	Stream_Write_UINT8(s, paletteCount);
+
+	for (i = 0; i < paletteCount; i++)
+	{
+		if (!clear_write_color(s, palette[i]))
+			goto fail;
+	}
+
+	numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
+	maxDepth = CLEAR_8BIT_MASKS[8 - numBits];
+	i = 0;
+
+	while (i < count)
+	{
+		const BYTE startIndex = indices[i];
+		UINT32 runLength = 1;
+		UINT32 suiteDepth = 0;
+
+		while ((i + runLength < count) && (indices[i + runLength] == startIndex))
+			runLength++;
+
+		/* the last pixel of the run is the first one of the suite */
+		i += runLength;
+
+		while ((suiteDepth < maxDepth) && (i < count) &&
+		       (indices[i] == startIndex + suiteDepth + 1))
+		{
+			suiteDepth++;
+			i++;
+		}
+
+		if (!Stream_EnsureRemainingCapacity(s, 1))
+			goto fail;
+
+		Stream_Write_UINT8(s, (suiteDepth << numBits) | (startIndex + suiteDepth));
+
+		if (!clear_write_run_length(s, runLength - 1))
+			goto fail;
+	}
+
+	free(indices);
+	return TRUE;
+fail:
+	free(indices);
+	return FALSE;
+}
+
+static BOOL clear_encode_subcodec_uncompressed(wStream* s, const UINT32* pixels, UINT32 nWidth,
+        UINT32 xStart, UINT32 yStart, UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+
+	if (!Stream_EnsureRemainingCapacity(s, width * height * 3))
+		return FALSE;
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT32* line = &pixels[(yStart + y) * nWidth + xStart];
+
+		for (x = 0; x < width; x++)
+			clear_write_color(s, line[x]);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Encodes the columns xStart..xEnd of a strip, using a band unless a subcodec
+ * produces less data.
+ */
+static BOOL clear_encode_segment(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 nWidth,
+                                 UINT32 xStart, UINT32 xEnd, UINT32 yStart, UINT32 height,
+                                 UINT32 colorBkg)
+{
+	UINT32 x, y;
+	UINT32 bandSize;
+	BYTE subcodecId = 0xFF;
+	UINT32 colorCount;
+	CLEAR_COLOR_TABLE table;
+	const UINT32 width = xEnd - xStart + 1;
+	wStream* s = clear->subcodecs;
+	const size_t pos = Stream_GetPosition(s);
+
+	if (!clear_encode_band(clear, NULL, pixels, nWidth, xStart, xEnd, yStart, height,
+	                       colorBkg, &bandSize))
+		return FALSE;
+
+	clear_color_table_init(&table);
+
+	for (y = yStart; (y < yStart + height) && (table.count <= 127); y++)
+	{
+		for (x = xStart; x <= xEnd; x++)
+		{
+			if (clear_color_table_add(&table, pixels[y * nWidth + x]) < 0)
+				break;
+		}
+	}
+
+	colorCount = table.count;
+
+	if (!Stream_EnsureRemainingCapacity(s, 13))
+		return FALSE;
+
+	Stream_Seek(s, 13);
+
+	if (colorCount <= 127)
+	{
+		if (!clear_encode_subcodec_rlex(s, pixels, nWidth, xStart, yStart, width, height, &table))
+			return FALSE;
+
+		subcodecId = 2;
+	}
+	else if ((width * height * 3 + 13) < bandSize)
+	{
+		if (!clear_encode_subcodec_uncompressed(s, pixels, nWidth, xStart, yStart, width, height))
+			return FALSE;
+
+		subcodecId = 0;
+	}
+
+	if ((subcodecId != 0xFF) && ((Stream_GetPosition(s) - pos) < bandSize))
+	{
+		const size_t end = Stream_GetPosition(s);
+		Stream_SetPosition(s, pos);
+		clear_write_subcodec_header(s, xStart, yStart, width, height,
+		                            (UINT32)(end - pos - 13), subcodecId);
+		Stream_SetPosition(s, end);
+	}
+	else
+	{
+		Stream_SetPosition(s, pos);
+
+		if (!clear_encode_band(clear, clear->bands, pixels, nWidth, xStart, xEnd,
+		                       yStart, height, colorBkg, &bandSize))
+			return FALSE;
+	}
+
+	for (y = yStart; y < yStart + height; y++)
+		FillMemory(&clear->CoverageMap[y * nWidth + xStart], width, 1);
+
+	return TRUE;
+}
+
+static BOOL clear_encode_strip(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 nWidth,
+                               UINT32 yStart, UINT32 height)
+{
+	UINT32 x = 0;
+	const UINT32 colorBkg = clear_strip_background(pixels, nWidth, yStart, height);
+
+	while (x < nWidth)
+	{
+		UINT32 xStart;
+		UINT32 xEnd;
+		UINT32 gap = 0;
+
+		if (clear_column_is_flat(pixels, nWidth, x, yStart, height, colorBkg))
+		{
+			x++;
+			continue;
+		}
+
+		/* a few flat columns are cheaper inside the band than a new band header */
+		xStart = xEnd = x++;
+
+		while ((x < nWidth) && (gap <= CLEAR_BAND_GAP))
+		{
+			if (clear_column_is_flat(pixels, nWidth, x, yStart, height, colorBkg))
+			{
+				gap++;
+			}
+			else
+			{
+				xEnd = x;
+				gap = 0;
+			}
+
+			x++;
+		}
+
+		x = xEnd + 1;
+
+		if (!clear_encode_segment(clear, pixels, nWidth, xStart, xEnd, yStart, height, colorBkg))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_residual(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                                  UINT32 count)
+{
+	UINT32 i;
+	UINT32 runColor = 0;
+	UINT32 runLength = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		/* covered pixels are drawn later by bands or subcodecs */
+		const UINT32 color = (clear->CoverageMap[i] && runLength) ? runColor : pixels[i];
+
+		if (runLength && (color == runColor))
+		{
+			runLength++;
+			continue;
+		}
+
+		if (runLength)
+		{
+			if (!clear_write_color(s, runColor) || !clear_write_run_length(s, runLength))
+				return FALSE;
+		}
+
+		runColor = color;
+		runLength = 1;
+	}
+
+	if (!clear_write_color(s, runColor) || !clear_write_run_length(s, runLength))
+		return FALSE;
+
+	return TRUE;
+}
+
+int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcFormat,
+                   UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight,
+                   BYTE** ppDstData, UINT32* pDstSize)
+{
+	UINT32 y;
+	UINT32 count;
+	BYTE glyphFlags = 0;
+	UINT32 glyphIndex = 0;
+	size_t compositionPos;
+	size_t residualPos;
+	UINT32 residualByteCount = 0;
+	UINT32 bandsByteCount;
+	UINT32 subcodecByteCount;
+	int rc = -1;
+	const UINT32* pixels;
+	wStream* s;
+
+	if (!clear || !clear->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return -1;
+
+	PROFILER_TRACE_BEGIN("clear_compress");
+
+	if (!clear_encoder_load(clear, pSrcData, SrcFormat, nSrcStep, nWidth, nHeight))
+		goto fail;
+
+	s = clear->buffer;
+	pixels = (const UINT32*) clear->TempBuffer;
+	count = nWidth * nHeight;
+	Stream_SetPosition(s, 0);
+
+	/* Nothing was cached since the last reset, start from the same state as the decoder */
+	if (!clear->seqNumber && !clear->VBarStorageCursor && !clear->ShortVBarStorageCursor)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		ZeroMemory(clear->VBarHashTable, CLEAR_VBAR_HASH_SIZE * sizeof(UINT32));
+		ZeroMemory(clear->ShortVBarHashTable, CLEAR_SHORT_VBAR_HASH_SIZE * sizeof(UINT32));
+	}
+
+	if (count <= CLEAR_MAX_GLYPH_AREA)
+	{
+		const UINT32 hash = clear_hash_pixels(pixels, count);
+		const INT32 index = clear_glyph_lookup(clear, hash, pixels, count);
+		glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+
+		if (index >= 0)
+		{
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_HIT;
+			glyphIndex = (UINT32) index;
+		}
+		else
+		{
+			glyphIndex = clear->GlyphCacheCursor;
+			clear->GlyphCacheCursor = (glyphIndex + 1) % CLEARCODEC_GLYPH_SIZE;
+
+			if (!clear_glyph_store(clear, hash, glyphIndex, pixels, count))
+				goto fail;
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 16))
+		goto fail;
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, clear->seqNumber);
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_INDEX)
+		Stream_Write_UINT16(s, glyphIndex);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT)
+		goto out;
+
+	compositionPos = Stream_GetPosition(s);
+	Stream_Seek(s, 12);
+	Stream_SetPosition(clear->bands, 0);
+	Stream_SetPosition(clear->subcodecs, 0);
+
+	for (y = 0; y < nHeight; y += CLEAR_MAX_BAND_HEIGHT)
+	{
+		const UINT32 height = MIN(CLEAR_MAX_BAND_HEIGHT, nHeight - y);
+
+		if (!clear_encode_strip(clear, pixels, nWidth, y, height))
+			goto fail;
+	}
+
+	residualPos = Stream_GetPosition(s);
+
+	for (y = 0; y < count; y++)
+	{
+		if (!clear->CoverageMap[y])
+		{
+			if (!clear_encode_residual(clear, s, pixels, count))
+				goto fail;
+
+			break;
+		}
+	}
+
+	residualByteCount = (UINT32)(Stream_GetPosition(s) - residualPos);
+	bandsByteCount = (UINT32) Stream_GetPosition(clear->bands);
+	subcodecByteCount = (UINT32) Stream_GetPosition(clear->subcodecs);
+
+	if (!Stream_EnsureRemainingCapacity(s, bandsByteCount + subcodecByteCount))
+		goto fail;
+
+	Stream_Write(s, Stream_Buffer(clear->bands), bandsByteCount);
+	Stream_Write(s, Stream_Buffer(clear->subcodecs), subcodecByteCount);
+	residualPos = Stream_GetPosition(s);
+	Stream_SetPosition(s, compositionPos);
+	Stream_Write_UINT32(s, residualByteCount);
+	Stream_Write_UINT32(s, bandsByteCount);
+	Stream_Write_UINT32(s, subcodecByteCount);
+	Stream_SetPosition(s, residualPos);
+out:
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32) Stream_GetPosition(s);
+	rc = 1;
+fail:
+	PROFILER_TRACE_END("clear_compress");
+	return rc;
+}
+
+BOOL clear_context_reset(CLEAR_CONTEXT* clear)
+{
+	if (!clear)
+		return FALSE;
+
+	clear->seqNumber = 0;
+	clear->VBarStorageCursor = 0;
+	clear->ShortVBarStorageCursor = 0;
+
+	if (clear->Compressor)
+	{
+		clear->GlyphCacheCursor = 0;
+		ZeroMemory(clear->GlyphHashTable, CLEAR_GLYPH_HASH_SIZE * sizeof(UINT32));
+		ZeroMemory(clear->VBarHashTable, CLEAR_VBAR_HASH_SIZE * sizeof(UINT32));
+		ZeroMemory(clear->ShortVBarHashTable, CLEAR_SHORT_VBAR_HASH_SIZE * sizeof(UINT32));
+	}
+
+	return TRUE;
+}
+CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
+{
+	CLEAR_CONTEXT* clear;
+	clear = (CLEAR_CONTEXT*) calloc(1, sizeof(CLEAR_CONTEXT));
+
+	if (!clear)
+		return NULL;
+
+	clear->Compressor = Compressor;
+	clear->nsc = nsc_context_new();
+
+	if (!clear->nsc)
+		goto error_nsc;
+
+	if (!updateContextFormat(clear, PIXEL_FORMAT_BGRX32))
+		goto error_nsc;
+
+	clear->TempSize = 512 * 512 * 4;
+	clear->TempBuffer = (BYTE*) malloc(clear->TempSize);
+
+	if (!clear->TempBuffer)
+		goto error_nsc;
+
+	if (Compressor)
+	{
+		clear->buffer = Stream_New(NULL, 64 * 1024);
+		clear->bands = Stream_New(NULL, 16 * 1024);
+		clear->subcodecs = Stream_New(NULL, 16 * 1024);
+		clear->GlyphHashTable = (UINT32*) calloc(CLEAR_GLYPH_HASH_SIZE, sizeof(UINT32));
+		clear->VBarHashTable = (UINT32*) calloc(CLEAR_VBAR_HASH_SIZE, sizeof(UINT32));
+		clear->ShortVBarHashTable = (UINT32*) calloc(CLEAR_SHORT_VBAR_HASH_SIZE, sizeof(UINT32));
+
+		if (!clear->buffer || !clear->bands || !clear->subcodecs || !clear->GlyphHashTable ||
+		    !clear->VBarHashTable || !clear->ShortVBarHashTable)
+			goto error_nsc;
+	}
+
+	if (!clear_context_reset(clear))
+		goto error_nsc;
+
+	return clear;
+error_nsc:
+	clear_context_free(clear);
+	return NULL;
+}
+void clear_context_free(CLEAR_CONTEXT* clear)
+{
+	int i;
+
+	if (!clear)
+		return;
+
+	nsc_context_free(clear->nsc);
+	free(clear->TempBuffer);
+	Stream_Free(clear->buffer, TRUE);
+	Stream_Free(clear->bands, TRUE);
+	Stream_Free(clear->subcodecs, TRUE);
+	free(clear->CoverageMap);
+	free(clear->GlyphHashTable);
+	free(clear->VBarHashTable);
+	free(clear->ShortVBarHashTable);
+
+	for (i = 0; i < CLEARCODEC_GLYPH_SIZE; i++)
 		free(clear->GlyphCache[i].pixels);
 
 	for (i = 0; i < 32768; i++)
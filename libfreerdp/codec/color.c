@@ -529,6 +529,22 @@ BOOL freerdp_image_copy(BYTE* pDstData, DWORD DstFormat,
 	{
 		UINT32 x, y;
 
+		/* Direct color formats go through the (vectorized) converters,
+		 * palette based ones need the per pixel lookup below. */
+		if ((GetBitsPerPixel(SrcFormat) >= 15) && (GetBitsPerPixel(DstFormat) >= 15))
+		{
+			primitives_t* prims = primitives_get();
+			const BYTE* srcLine = &pSrcData[nYSrc * nSrcStep * srcVMultiplier + srcVOffset];
+			BYTE* dstLine = &pDstData[nYDst * nDstStep * dstVMultiplier + dstVOffset];
+
+			if (prims->convertPixels_8u(&srcLine[xSrcOffset], SrcFormat,
+			                            (INT32) nSrcStep * srcVMultiplier,
+			                            &dstLine[xDstOffset], DstFormat,
+			                            (INT32) nDstStep * dstVMultiplier,
+			                            nWidth, nHeight) == PRIMITIVES_SUCCESS)
+				return TRUE;
+		}
+
 		for (y = 0; y < nHeight; y++)
 		{
 			const BYTE* srcLine = &pSrcData[(y + nYSrc) *
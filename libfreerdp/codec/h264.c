@@ -29,6 +29,7 @@
 #include <freerdp/primitives.h>
 #include <freerdp/codec/h264.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/profiler.h>
 
 #define TAG FREERDP_TAG("codec")
 
@@ -937,7 +938,12 @@ static int openh264_compress(H264_CONTEXT* h264, BYTE** ppDstData,
 	H264_CONTEXT_OPENH264* sys;
 	BYTE** pYUVData = h264->pYUVData[plane];
 	UINT32* iStride = h264->iStride[plane];
-	sys = &((H264_CONTEXT_OPENH264*) h264->pSystemData)[0];
+
+	if (plane >= h264->numSystemData)
+		return -1;
+
+	/* Each plane (AVC444 main and auxiliary view) has its own encoder */
+	sys = &((H264_CONTEXT_OPENH264*) h264->pSystemData)[plane];
 
 	if (!sys->pEncoder)
 		return -1;
@@ -1143,7 +1149,7 @@ static BOOL openh264_init(H264_CONTEXT* h264)
 #endif
 	static WelsTraceCallback traceCallback = (WelsTraceCallback)
 	        openh264_trace_callback;
-	h264->numSystemData = 1;
+	h264->numSystemData = h264->Compressor ? 2 : 1;
 	sysContexts = (H264_CONTEXT_OPENH264*) calloc(h264->numSystemData,
 	              sizeof(H264_CONTEXT_OPENH264));
 
@@ -1531,19 +1537,22 @@ INT32 avc420_decompress(H264_CONTEXT* h264, BYTE* pSrcData, UINT32 SrcSize,
 	if (!h264)
 		return -1001;
 
+	PROFILER_TRACE_BEGIN("avc420_decompress");
 	status = h264->subsystem->Decompress(h264, pSrcData, SrcSize, 0);
 
 	if (status == 0)
-		return 1;
-
-	if (status < 0)
-		return status;
+		status = 1;
+	else if (status > 0)
+	{
+		status = 1;
 
-	if (!avc_yuv_to_rgb(h264, regionRects, numRegionRects, nDstWidth,
-	                    nDstHeight, nDstStep, pDstData, DstFormat, FALSE))
-		return -1002;
+		if (!avc_yuv_to_rgb(h264, regionRects, numRegionRects, nDstWidth,
+		                    nDstHeight, nDstStep, pDstData, DstFormat, FALSE))
+			status = -1002;
+	}
 
-	return 1;
+	PROFILER_TRACE_END("avc420_decompress");
+	return status;
 }
 
 INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
@@ -1563,13 +1572,14 @@ INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
 	if (!h264->subsystem->Compress)
 		return -1;
 
+	PROFILER_TRACE_BEGIN("avc420_compress");
 	iStride =  h264->iStride[0];
 	pYUVData = h264->pYUVData[0];
 	nWidth = (nSrcWidth + 1) & ~1;
 	nHeight = (nSrcHeight + 1) & ~1;
 
 	if (!(pYUVData[0] = (BYTE*) malloc(nWidth * nHeight)))
-		return -1;
+		goto error_1;
 
 	iStride[0] = nWidth;
 
@@ -1595,15 +1605,244 @@ error_2:
 error_1:
 	free(pYUVData[0]);
 	pYUVData[0] = NULL;
+	PROFILER_TRACE_END("avc420_compress");
 	return status;
 }
 
+static void avc444_free_old_views(H264_CONTEXT* h264)
+{
+	UINT32 x, y;
+
+	for (x = 0; x < 2; x++)
+	{
+		for (y = 0; y < 3; y++)
+		{
+			free(h264->pOldYUVData[x][y]);
+			h264->pOldYUVData[x][y] = NULL;
+			h264->iOldYUVSize[x][y] = 0;
+		}
+	}
+}
+
+static void avc444_free_views(H264_CONTEXT* h264)
+{
+	UINT32 x, y;
+
+	for (x = 0; x < 2; x++)
+	{
+		for (y = 0; y < 3; y++)
+		{
+			free(h264->pViewYUVData[x][y]);
+			h264->pViewYUVData[x][y] = NULL;
+		}
+	}
+
+	avc444_free_old_views(h264);
+}
+
+static BOOL avc444_view_changed(H264_CONTEXT* h264, UINT32 view,
+                                const UINT32 iSize[3])
+{
+	UINT32 x;
+
+	for (x = 0; x < 3; x++)
+	{
+		if (!h264->pOldYUVData[view][x] || (h264->iOldYUVSize[view][x] != iSize[x]))
+			return TRUE;
+
+		if (memcmp(h264->pOldYUVData[view][x], h264->pYUVData[view][x], iSize[x]) != 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void avc444_keep_view(H264_CONTEXT* h264, UINT32 view,
+                             const UINT32 iSize[3])
+{
+	UINT32 x;
+
+	/**
+	 * The view just encoded is the reference for the next change detection,
+	 * the previous reference takes its place as buffer for the next frame.
+	 */
+	for (x = 0; x < 3; x++)
+	{
+		BYTE* tmp = h264->pOldYUVData[view][x];
+		h264->pOldYUVData[view][x] = h264->pViewYUVData[view][x];
+		h264->iOldYUVSize[view][x] = iSize[x];
+		h264->pViewYUVData[view][x] = tmp;
+	}
+}
+
+static BOOL avc444_ensure_yuv444(H264_CONTEXT* h264, UINT32 nWidth,
+                                 UINT32 nHeight)
+{
+	UINT32 x;
+	UINT32* piDstSize = h264->iYUV444Size;
+	UINT32* piDstStride = h264->iYUV444Stride;
+	BYTE** ppYUVDstData = h264->pYUV444Data;
+
+	if ((piDstStride[0] == nWidth) && (piDstSize[0] == nWidth * nHeight))
+		return TRUE;
+
+	/* views of another frame size are neither a reference nor reusable */
+	avc444_free_views(h264);
+
+	for (x = 0; x < 3; x++)
+	{
+		BYTE* ppYUVTmpData;
+		piDstStride[x] = nWidth;
+		piDstSize[x] = nWidth * nHeight;
+		ppYUVTmpData = realloc(ppYUVDstData[x], piDstSize[x]);
+
+		if (!ppYUVTmpData)
+			goto fail;
+
+		ppYUVDstData[x] = ppYUVTmpData;
+		memset(ppYUVDstData[x], 0, piDstSize[x]);
+	}
+
+	return TRUE;
+fail:
+
+	for (x = 0; x < 3; x++)
+	{
+		free(ppYUVDstData[x]);
+		ppYUVDstData[x] = NULL;
+		piDstSize[x] = 0;
+		piDstStride[x] = 0;
+	}
+
+	return FALSE;
+}
+
+/**
+ * The frame is converted to YUV444 and split into the main (YUV420) and
+ * auxiliary (chroma420) views, each encoded by its own encoder instance.
+ * A view is only encoded when it differs from the one encoded last, op
+ * receives the resulting LC value:
+ *   0: main view in ppDstData, auxiliary view in ppAuxDstData
+ *   1: main view in ppDstData only
+ *   2: auxiliary view in ppDstData only
+ */
 INT32 avc444_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
                       UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
                       BYTE* op, BYTE** ppDstData, UINT32* pDstSize,
                       BYTE** ppAuxDstData, UINT32* pAuxDstSize)
 {
-	return -1;
+	INT32 status = -1;
+	UINT32 x, view;
+	prim_size_t roi;
+	UINT32 nWidth, nHeight, padHeight;
+	UINT32 iSize[2][3];
+	BOOL mainChanged, auxChanged;
+	primitives_t* prims = primitives_get();
+
+	if (!h264 || !op || !ppDstData || !pDstSize || !ppAuxDstData || !pAuxDstSize)
+		return -1;
+
+	if (!h264->subsystem->Compress)
+		return -1;
+
+	*ppAuxDstData = NULL;
+	*pAuxDstSize = 0;
+	nWidth = (nSrcWidth + 1) & ~1;
+	nHeight = (nSrcHeight + 1) & ~1;
+	/* The auxiliary luma plane is padded to a multiple of 16 lines */
+	padHeight = nHeight + 16 - nHeight % 16;
+
+	if (!avc444_ensure_yuv444(h264, nWidth, nHeight))
+		return -1;
+
+	PROFILER_TRACE_BEGIN("avc444_compress");
+
+	for (view = 0; view < 2; view++)
+	{
+		iSize[view][0] = nWidth * (view ? padHeight : nHeight);
+		iSize[view][1] = (nWidth / 2) * (nHeight / 2);
+		iSize[view][2] = iSize[view][1];
+		h264->iStride[view][0] = nWidth;
+		h264->iStride[view][1] = nWidth / 2;
+		h264->iStride[view][2] = nWidth / 2;
+
+		for (x = 0; x < 3; x++)
+		{
+			/* zeroed once, the padding lines are never written */
+			if (!h264->pViewYUVData[view][x] &&
+			    !(h264->pViewYUVData[view][x] = (BYTE*) calloc(1, iSize[view][x])))
+				goto fail;
+
+			h264->pYUVData[view][x] = h264->pViewYUVData[view][x];
+		}
+	}
+
+	roi.width = nSrcWidth;
+	roi.height = nSrcHeight;
+
+	if (prims->RGBToYUV444_8u_P3AC4R(pSrcData, SrcFormat, nSrcStep,
+	                                 h264->pYUV444Data, h264->iYUV444Stride,
+	                                 &roi) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	roi.width = nWidth;
+	roi.height = nHeight;
+
+	if (prims->YUV444SplitToYUV420((const BYTE**) h264->pYUV444Data,
+	                               h264->iYUV444Stride,
+	                               h264->pYUVData[0], h264->iStride[0],
+	                               h264->pYUVData[1], h264->iStride[1],
+	                               &roi) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	mainChanged = avc444_view_changed(h264, 0, iSize[0]);
+	auxChanged = avc444_view_changed(h264, 1, iSize[1]);
+
+	if (!auxChanged)
+		*op = 1;
+	else if (!mainChanged)
+		*op = 2;
+	else
+		*op = 0;
+
+	switch (*op)
+	{
+		case 0:
+			status = h264->subsystem->Compress(h264, ppDstData, pDstSize, 0);
+
+			if (status >= 0)
+				status = h264->subsystem->Compress(h264, ppAuxDstData, pAuxDstSize, 1);
+
+			break;
+
+		case 1:
+			status = h264->subsystem->Compress(h264, ppDstData, pDstSize, 0);
+			break;
+
+		case 2:
+			status = h264->subsystem->Compress(h264, ppDstData, pDstSize, 1);
+			break;
+	}
+
+	if (status >= 0)
+	{
+		if (*op != 2)
+			avc444_keep_view(h264, 0, iSize[0]);
+
+		if (*op != 1)
+			avc444_keep_view(h264, 1, iSize[1]);
+	}
+
+fail:
+
+	for (view = 0; view < 2; view++)
+	{
+		for (x = 0; x < 3; x++)
+			h264->pYUVData[view][x] = NULL;
+	}
+
+	PROFILER_TRACE_END("avc444_compress");
+	return status;
 }
 
 static BOOL avc444_process_rect(H264_CONTEXT* h264,
@@ -1780,6 +2019,8 @@ INT32 avc444_decompress(H264_CONTEXT* h264, BYTE op,
 	    !pSrcData || !pDstData)
 		return -1001;
 
+	PROFILER_TRACE_BEGIN("avc444_decompress");
+
 	switch (op)
 	{
 		case 0: /* YUV420 in stream 1
@@ -1861,6 +2102,7 @@ INT32 avc444_decompress(H264_CONTEXT* h264, BYTE op,
 		}
 	}
 
+	PROFILER_TRACE_END("avc444_decompress");
 	return status;
 }
 
@@ -1913,6 +2155,7 @@ BOOL h264_context_reset(H264_CONTEXT* h264, UINT32 width, UINT32 height)
 
 	h264->width = width;
 	h264->height = height;
+	avc444_free_old_views(h264);
 	return TRUE;
 }
 
@@ -1947,6 +2190,7 @@ void h264_context_free(H264_CONTEXT* h264)
 	if (h264)
 	{
 		h264->subsystem->Uninit(h264);
+		avc444_free_views(h264);
 		free(h264->pYUV444Data[0]);
 		free(h264->pYUV444Data[1]);
 		free(h264->pYUV444Data[2]);
@@ -26,6 +26,7 @@
 #endif
 
 #include <freerdp/codec/interleaved.h>
+#include <freerdp/utils/profiler.h>
 #include <freerdp/log.h>
 
 #define TAG FREERDP_TAG("codec")
@@ -272,6 +273,7 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
                             UINT32 nDstWidth, UINT32 nDstHeight,
                             const gdiPalette* palette)
 {
+	BOOL rc;
 	UINT32 scanline;
 	UINT32 SrcFormat;
 	UINT32 BufferSize;
@@ -319,6 +321,8 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 	if (!interleaved->TempBuffer)
 		return FALSE;
 
+	PROFILER_TRACE_BEGIN("interleaved_decompress");
+
 	switch (bpp)
 	{
 		case 24:
@@ -338,12 +342,16 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 			break;
 
 		default:
-			return FALSE;
+			rc = FALSE;
+			goto fail;
 	}
 
-	return freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst,
-	                          nDstWidth, nDstHeight, interleaved->TempBuffer,
-	                          SrcFormat, scanline, 0, 0, palette, FREERDP_FLIP_VERTICAL);
+	rc = freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst,
+	                        nDstWidth, nDstHeight, interleaved->TempBuffer,
+	                        SrcFormat, scanline, 0, 0, palette, FREERDP_FLIP_VERTICAL);
+fail:
+	PROFILER_TRACE_END("interleaved_decompress");
+	return rc;
 }
 
 BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
@@ -384,13 +392,17 @@ BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 	if (!DstFormat)
 		return FALSE;
 
+	PROFILER_TRACE_BEGIN("interleaved_compress");
 	status = freerdp_image_copy(interleaved->TempBuffer, DstFormat, 0, 0, 0, nWidth,
 	                            nHeight,
 	                            pSrcData, SrcFormat, nSrcStep, nXSrc, nYSrc, palette, FREERDP_FLIP_NONE);
 	s = Stream_New(pDstData, maxSize);
 
 	if (!s)
-		return FALSE;
+	{
+		status = FALSE;
+		goto fail;
+	}
 
 	status = freerdp_bitmap_compress((char*) interleaved->TempBuffer, nWidth,
 	                                 nHeight,
@@ -398,6 +410,8 @@ BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 	Stream_SealLength(s);
 	*pDstSize = (UINT32) Stream_Length(s);
 	Stream_Free(s, FALSE);
+fail:
+	PROFILER_TRACE_END("interleaved_compress");
 	return status;
 }
 
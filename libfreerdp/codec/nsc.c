@@ -394,6 +394,7 @@ BOOL nsc_process_message(NSC_CONTEXT* context, UINT16 bpp,
 	if (!ret)
 		return FALSE;
 
+	PROFILER_TRACE_BEGIN("nsc_process_message");
 	/* RLE decode */
 	PROFILER_ENTER(context->priv->prof_nsc_rle_decompress_data);
 	nsc_rle_decompress_data(context);
@@ -402,11 +403,9 @@ BOOL nsc_process_message(NSC_CONTEXT* context, UINT16 bpp,
 	PROFILER_ENTER(context->priv->prof_nsc_decode);
 	context->decode(context);
 	PROFILER_EXIT(context->priv->prof_nsc_decode);
-
-	if (!freerdp_image_copy(pDstData, DstFormat, nDstStride, nXDst, nYDst,
-	                        width, height, context->BitmapData,
-	                        PIXEL_FORMAT_BGRA32, 0, 0, 0, NULL, flip))
-		return FALSE;
-
-	return TRUE;
+	ret = freerdp_image_copy(pDstData, DstFormat, nDstStride, nXDst, nYDst,
+	                         width, height, context->BitmapData,
+	                         PIXEL_FORMAT_BGRA32, 0, 0, 0, NULL, flip);
+	PROFILER_TRACE_END("nsc_process_message");
+	return ret;
 }
@@ -576,6 +576,7 @@ void nsc_message_free(NSC_CONTEXT* context, NSC_MESSAGE* message)
 BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data,
                          UINT32 width, UINT32 height, UINT32 scanline)
 {
+	BOOL ret;
 	NSC_MESSAGE s_message = { 0 };
 	NSC_MESSAGE* message = &s_message;
 	context->width = width;
@@ -584,6 +585,7 @@ BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data,
 	if (!nsc_context_initialize_encode(context))
 		return FALSE;
 
+	PROFILER_TRACE_BEGIN("nsc_compose_message");
 	/* ARGB to AYCoCg conversion, chroma subsampling and colorloss reduction */
 	PROFILER_ENTER(context->priv->prof_nsc_encode);
 	context->encode(context, data, scanline);
@@ -602,5 +604,7 @@ BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data,
 	message->AlphaPlaneByteCount = context->PlaneByteCount[3];
 	message->ColorLossLevel = context->ColorLossLevel;
 	message->ChromaSubsamplingLevel = context->ChromaSubsamplingLevel;
-	return nsc_write_message(context, s, message);
+	ret = nsc_write_message(context, s, message);
+	PROFILER_TRACE_END("nsc_compose_message");
+	return ret;
 }
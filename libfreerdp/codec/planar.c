@@ -30,6 +30,7 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
+#include <freerdp/utils/profiler.h>
 
 #define TAG FREERDP_TAG("codec")
 
@@ -88,56 +89,40 @@ static INT32 planar_skip_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
 	return (INT32)(pRLE - pSrcData);
 }
 
+/**
+ * Expands an RLE plane into a packed plane of nWidth * nHeight bytes.
+ *
+ * The first scanline holds absolute values, the following ones delta codes
+ * relative to the previous scanline. A run repeats the last code of the
+ * scanline (0 at its start), which is the same for both, so the codes are
+ * expanded first and the deltas are resolved afterwards in a single pass.
+ */
 static INT32 planar_decompress_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
-        BYTE* pDstData, INT32 nDstStep,
-        UINT32 nXDst, UINT32 nYDst,
-        UINT32 nWidth, UINT32 nHeight,
-        UINT32 nChannel, BOOL vFlip)
+        BYTE* pDstData, UINT32 nWidth, UINT32 nHeight)
 {
 	UINT32 x, y;
-	BYTE* dstp;
-	UINT32 pixel;
 	UINT32 cRawBytes;
 	UINT32 nRunLength;
-	INT32 deltaValue;
-	INT32 beg, end, inc;
 	BYTE controlByte;
-	BYTE* currentScanline;
-	BYTE* previousScanline;
+	BYTE value;
+	BYTE* dstp = pDstData;
 	const BYTE* srcp = pSrcData;
-	dstp = pDstData;
-	previousScanline = NULL;
-
-	if (vFlip)
-	{
-		beg = nHeight - 1;
-		end = -1;
-		inc = -1;
-	}
-	else
-	{
-		beg = 0;
-		end = nHeight;
-		inc = 1;
-	}
+	const BYTE* pEnd = &pSrcData[SrcSize];
+	const primitives_t* prims = primitives_get();
 
-	for (y = beg; y != end; y += inc)
+	for (y = 0; y < nHeight; y++)
 	{
-		dstp = &pDstData[((nYDst + y) * nDstStep) + (nXDst * 4) + nChannel];
-		pixel = 0;
-		currentScanline = dstp;
+		value = 0;
 
 		for (x = 0; x < nWidth;)
 		{
-			controlByte = *srcp;
-			srcp++;
-
-			if ((srcp - pSrcData) > SrcSize)
+			if (srcp >= pEnd)
 			{
 				WLog_ERR(TAG,  "error reading input buffer");
 				return -1;
 			}
 
+			controlByte = *srcp++;
 			nRunLength = PLANAR_CONTROL_BYTE_RUN_LENGTH(controlByte);
 			cRawBytes = PLANAR_CONTROL_BYTE_RAW_BYTES(controlByte);
 
@@ -152,134 +137,36 @@ static INT32 planar_decompress_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
 				cRawBytes = 0;
 			}
 
-			if (((dstp + (cRawBytes + nRunLength)) - currentScanline) > nWidth * 4)
+			if ((x + cRawBytes + nRunLength) > nWidth)
 			{
 				WLog_ERR(TAG,  "too many pixels in scanline");
 				return -1;
 			}
 
-			if (!previousScanline)
-			{
-				/* first scanline, absolute values */
-				while (cRawBytes > 0)
-				{
-					pixel = *srcp;
-					srcp++;
-					*dstp = pixel;
-					dstp += 4;
-					x++;
-					cRawBytes--;
-				}
-
-				while (nRunLength > 0)
-				{
-					*dstp = pixel;
-					dstp += 4;
-					x++;
-					nRunLength--;
-				}
-			}
-			else
+			if ((UINT32)(pEnd - srcp) < cRawBytes)
 			{
-				/* delta values relative to previous scanline */
-				while (cRawBytes > 0)
-				{
-					deltaValue = *srcp;
-					srcp++;
-
-					if (deltaValue & 1)
-					{
-						deltaValue = deltaValue >> 1;
-						deltaValue = deltaValue + 1;
-						pixel = -deltaValue;
-					}
-					else
-					{
-						deltaValue = deltaValue >> 1;
-						pixel = deltaValue;
-					}
-
-					deltaValue = previousScanline[x * 4] + pixel;
-					*dstp = deltaValue;
-					dstp += 4;
-					x++;
-					cRawBytes--;
-				}
-
-				while (nRunLength > 0)
-				{
-					deltaValue = previousScanline[x * 4] + pixel;
-					*dstp = deltaValue;
-					dstp += 4;
-					x++;
-					nRunLength--;
-				}
+				WLog_ERR(TAG,  "error reading input buffer");
+				return -1;
 			}
-		}
 
-		previousScanline = currentScanline;
-	}
-
-	return (INT32)(srcp - pSrcData);
-}
-
-static BOOL planar_decompress_planes_raw(const BYTE* pSrcData[4],
-        BYTE* pDstData, UINT32 DstFormat,
-        UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst, UINT32 nWidth, UINT32 nHeight,
-        BOOL alpha, BOOL vFlip)
-{
-	INT32 x, y;
-	INT32 beg, end, inc;
-	const BYTE* pR = pSrcData[0];
-	const BYTE* pG = pSrcData[1];
-	const BYTE* pB = pSrcData[2];
-	const BYTE* pA = pSrcData[3];
-
-	if (vFlip)
-	{
-		beg = nHeight - 1;
-		end = -1;
-		inc = -1;
-	}
-	else
-	{
-		beg = 0;
-		end = nHeight;
-		inc = 1;
-	}
-
-	if (alpha)
-	{
-		for (y = beg; y != end; y += inc)
-		{
-			BYTE* pRGB = &pDstData[((nYDst + y) * nDstStep) + (nXDst * GetBytesPerPixel(
-			                           DstFormat))];
-
-			for (x = 0; x < nWidth; x++)
+			if (cRawBytes > 0)
 			{
-				UINT32 color = GetColor(DstFormat, *pR++, *pG++, *pB++, *pA++);
-				WriteColor(pRGB, DstFormat, color);
-				pRGB += GetBytesPerPixel(DstFormat);
+				CopyMemory(dstp, srcp, cRawBytes);
+				srcp += cRawBytes;
+				dstp += cRawBytes;
+				value = dstp[-1];
 			}
-		}
-	}
-	else
-	{
-		for (y = beg; y != end; y += inc)
-		{
-			BYTE* pRGB = &pDstData[((nYDst + y) * nDstStep) + (nXDst * GetBytesPerPixel(
-			                           DstFormat))];
 
-			for (x = 0; x < nWidth; x++)
-			{
-				UINT32 color = GetColor(DstFormat, *pR++, *pG++, *pB++, 0xFF);
-				WriteColor(pRGB, DstFormat, color);
-				pRGB += GetBytesPerPixel(DstFormat);
-			}
+			FillMemory(dstp, nRunLength, value);
+			dstp += nRunLength;
+			x += cRawBytes + nRunLength;
 		}
 	}
 
-	return TRUE;
+	if (prims->planarDeltaDecode_8u(pDstData, nWidth, nHeight) != PRIMITIVES_SUCCESS)
+		return -1;
+
+	return (INT32)(srcp - pSrcData);
 }
 
 BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
@@ -293,6 +180,7 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 	BOOL rle;
 	UINT32 cll;
 	BOOL alpha;
+	BOOL rc = FALSE;
 	INT32 status;
 	const BYTE* srcp;
 	UINT32 subSize;
@@ -326,6 +214,14 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 		return FALSE;
 	}
 
+	if ((nSrcWidth > planar->maxWidth) || (nSrcHeight > planar->maxHeight))
+	{
+		if (!freerdp_bitmap_planar_context_reset(planar, MAX(nSrcWidth, planar->maxWidth),
+		        MAX(nSrcHeight, planar->maxHeight)))
+			return FALSE;
+	}
+
+	PROFILER_TRACE_BEGIN("planar_decompress");
 	FormatHeader = *srcp++;
 	cll = (FormatHeader & PLANAR_FORMAT_HEADER_CLL_MASK);
 	cs = (FormatHeader & PLANAR_FORMAT_HEADER_CS) ? TRUE : FALSE;
@@ -335,7 +231,7 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 	//WLog_INFO(TAG, "CLL: %d CS: %d RLE: %d ALPHA: %d", cll, cs, rle, alpha);
 
 	if (!cll && cs)
-		return FALSE; /* Chroma subsampling requires YCoCg */
+		goto fail; /* Chroma subsampling requires YCoCg */
 
 	subWidth = (nSrcWidth / 2) + (nSrcWidth % 2);
 	subHeight = (nSrcHeight / 2) + (nSrcHeight % 2);
@@ -383,19 +279,19 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 			planes[2] = planes[1] + rawSizes[1]; /* GreenChromaOrBluePlane */
 
 			if ((planes[2] + rawSizes[2]) > &pSrcData[SrcSize])
-				return FALSE;
+				goto fail;
 		}
 		else
 		{
 			if ((SrcSize - (srcp - pSrcData)) < (planeSize * 3))
-				return FALSE;
+				goto fail;
 
 			planes[0] = srcp; /* LumaOrRedPlane */
 			planes[1] = planes[0] + rawSizes[0]; /* OrangeChromaOrGreenPlane */
 			planes[2] = planes[1] + rawSizes[1]; /* GreenChromaOrBluePlane */
 
 			if ((planes[2] + rawSizes[2]) > &pSrcData[SrcSize])
-				return FALSE;
+				goto fail;
 		}
 	}
 	else /* RLE */
@@ -407,28 +303,28 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 			                                    rawWidths[3], rawHeights[3]); /* AlphaPlane */
 
 			if (rleSizes[3] < 0)
-				return FALSE;
+				goto fail;
 
 			planes[0] = planes[3] + rleSizes[3];
 			rleSizes[0] = planar_skip_plane_rle(planes[0], SrcSize - (planes[0] - pSrcData),
 			                                    rawWidths[0], rawHeights[0]); /* RedPlane */
 
 			if (rleSizes[0] < 0)
-				return FALSE;
+				goto fail;
 
 			planes[1] = planes[0] + rleSizes[0];
 			rleSizes[1] = planar_skip_plane_rle(planes[1], SrcSize - (planes[1] - pSrcData),
 			                                    rawWidths[1], rawHeights[1]); /* GreenPlane */
 
 			if (rleSizes[1] < 1)
-				return FALSE;
+				goto fail;
 
 			planes[2] = planes[1] + rleSizes[1];
 			rleSizes[2] = planar_skip_plane_rle(planes[2], SrcSize - (planes[2] - pSrcData),
 			                                    rawWidths[2], rawHeights[2]); /* BluePlane */
 
 			if (rleSizes[2] < 1)
-				return FALSE;
+				goto fail;
 		}
 		else
 		{
@@ -437,264 +333,126 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 			                                    rawWidths[0], rawHeights[0]); /* RedPlane */
 
 			if (rleSizes[0] < 0)
-				return FALSE;
+				goto fail;
 
 			planes[1] = planes[0] + rleSizes[0];
 			rleSizes[1] = planar_skip_plane_rle(planes[1], SrcSize - (planes[1] - pSrcData),
 			                                    rawWidths[1], rawHeights[1]); /* GreenPlane */
 
 			if (rleSizes[1] < 1)
-				return FALSE;
+				goto fail;
 
 			planes[2] = planes[1] + rleSizes[1];
 			rleSizes[2] = planar_skip_plane_rle(planes[2], SrcSize - (planes[2] - pSrcData),
 			                                    rawWidths[2], rawHeights[2]); /* BluePlane */
 
 			if (rleSizes[2] < 1)
-				return FALSE;
+				goto fail;
 		}
 	}
 
-	if (!cll) /* RGB */
+	if (rle)
 	{
-		UINT32 TempFormat;
-		BYTE* pTempData = pDstData;
-		UINT32 nTempStep = nDstStep;
-
-		if (alpha)
-			TempFormat = PIXEL_FORMAT_BGRA32;
-		else
-			TempFormat = PIXEL_FORMAT_BGRX32;
+		UINT32 i;
 
-		if ((TempFormat != DstFormat) || (nSrcWidth != nDstWidth)
-		    || (nSrcHeight != nDstHeight))
+		for (i = 0; i < 4; i++)
 		{
-			pTempData = planar->pTempData;
-		}
+			if ((i == 3) && !alpha)
+				break;
 
-		if (!rle) /* RAW */
-		{
-			if (alpha)
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nDstStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
+			status = planar_decompress_plane_rle(planes[i], rleSizes[i], planar->planes[i],
+			                                     rawWidths[i], rawHeights[i]);
 
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2] + rawSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nDstStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
-			}
+			if (status < 0)
+				goto fail;
 
-			if ((SrcSize - (srcp - pSrcData)) == 1)
-				srcp++; /* pad */
+			planes[i] = planar->planes[i];
+			srcp += rleSizes[i];
 		}
-		else /* RLE */
-		{
-			if (alpha)
-			{
-				status = planar_decompress_plane_rle(planes[3], rleSizes[3],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 3,
-				                                     vFlip); /* AlphaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* RedPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* GreenPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* BluePlane */
-
-				if (status < 0)
-					return FALSE;
+	}
+	else
+	{
+		srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
 
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2] + rleSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* RedPlane */
+		if (alpha)
+			srcp += rawSizes[3];
 
-				if (status < 0)
-					return FALSE;
+		if ((SrcSize - (srcp - pSrcData)) == 1)
+			srcp++; /* pad */
+	}
 
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* GreenPlane */
+	if (!alpha)
+		planes[3] = NULL;
 
-				if (status < 0)
-					return FALSE;
+	if (!cll) /* RGB */
+	{
+		UINT32 TempFormat;
 
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* BluePlane */
+		if (alpha)
+			TempFormat = PIXEL_FORMAT_BGRA32;
+		else
+			TempFormat = PIXEL_FORMAT_BGRX32;
 
-				if (status < 0)
-					return FALSE;
+		if ((TempFormat == DstFormat) && (nSrcWidth == nDstWidth)
+		    && (nSrcHeight == nDstHeight))
+		{
+			BYTE* pDst = &pDstData[(nYDst * nDstStep) + (nXDst * dstBytesPerPixel)];
 
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2];
-			}
+			if (prims->planarCombine_8u_P4AC4R(planes, pDst, DstFormat, nDstStep,
+			                                   nSrcWidth, nSrcHeight, alpha,
+			                                   vFlip) != PRIMITIVES_SUCCESS)
+				goto fail;
 		}
-
-		if (pTempData != pDstData)
+		else
 		{
+			if (prims->planarCombine_8u_P4AC4R(planes, planar->pTempData, TempFormat,
+			                                   planar->nTempStep, nSrcWidth, nSrcHeight,
+			                                   alpha, vFlip) != PRIMITIVES_SUCCESS)
+				goto fail;
+
 			if (!freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst, w,
-			                        h, pTempData,
-			                        TempFormat, nTempStep, nXDst, nYDst, NULL, FREERDP_FLIP_NONE))
-				return FALSE;
+			                        h, planar->pTempData,
+			                        TempFormat, planar->nTempStep, 0, 0, NULL, FREERDP_FLIP_NONE))
+				goto fail;
 		}
 	}
 	else /* YCoCg */
 	{
-		BYTE* pTempData = planar->pTempData;
-		UINT32 nTempStep = planar->nTempStep;
-		UINT32 TempFormat = PIXEL_FORMAT_RGBA32;
-
-		if (!pTempData)
-			return FALSE;
+		/* YCoCgToRGB_8u_AC4R expects Cg, Co, Y, A byte order */
+		const BYTE* pYCoCg[4] = { planes[2], planes[1], planes[0], planes[3] };
+		BYTE* pDst = &pDstData[(nYDst * nDstStep) + (nXDst * dstBytesPerPixel)];
 
 		if (cs)
 		{
 			WLog_ERR(TAG, "Chroma subsampling unimplemented");
-			return FALSE;
+			goto fail;
 		}
 
-		if (!rle) /* RAW */
-		{
-			if (alpha)
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2] + rawSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
-			}
-
-			if ((SrcSize - (srcp - pSrcData)) == 1)
-				srcp++; /* pad */
-		}
-		else /* RLE */
-		{
-			if (alpha)
-			{
-				status = planar_decompress_plane_rle(planes[3], rleSizes[3],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 3,
-				                                     vFlip); /* AlphaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* LumaPlane */
-
-				if (status < 0)
-					return FALSE;
+		if (prims->planarCombine_8u_P4AC4R(pYCoCg, planar->pTempData, PIXEL_FORMAT_RGBA32,
+		                                   planar->nTempStep, nSrcWidth, nSrcHeight, alpha,
+		                                   vFlip) != PRIMITIVES_SUCCESS)
+			goto fail;
 
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* OrangeChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* GreenChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2] + rleSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* LumaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* OrangeChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* GreenChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2];
-			}
-		}
-
-		if (prims->YCoCgToRGB_8u_AC4R(pTempData, nTempStep, pDstData, DstFormat,
-		                              nDstStep,
-		                              w, h, cll, alpha) != PRIMITIVES_SUCCESS)
-			return FALSE;
+		if (prims->YCoCgToRGB_8u_AC4R(planar->pTempData, planar->nTempStep, pDst, DstFormat,
+		                              nDstStep, w, h, cll, alpha) != PRIMITIVES_SUCCESS)
+			goto fail;
 	}
 
-	return (SrcSize == (srcp - pSrcData)) ? TRUE : FALSE;
+	rc = (SrcSize == (srcp - pSrcData)) ? TRUE : FALSE;
+fail:
+	PROFILER_TRACE_END("planar_decompress");
+	return rc;
 }
 
 static BOOL freerdp_split_color_planes(const BYTE* data, UINT32 format,
                                        UINT32 width, UINT32 height,
                                        UINT32 scanline, BYTE* planes[4])
 {
-	INT32 i, j, k;
-	k = 0;
-
-	if (scanline == 0)
-		scanline = width * GetBytesPerPixel(format);
-
-	for (i = height - 1; i >= 0; i--)
-	{
-		const BYTE* pixel = &data[scanline * i];
-
-		for (j = 0; j < width; j++)
-		{
-			const UINT32 color = ReadColor(pixel, format);
-			pixel += GetBytesPerPixel(format);
-			SplitColor(color, format, &planes[1][k], &planes[2][k],
-			           &planes[3][k], &planes[0][k], NULL);
-			k++;
-		}
-	}
-
-	return TRUE;
+	/* planes[0] holds the alpha plane, the primitive expects it last */
+	BYTE* pDst[4] = { planes[1], planes[2], planes[3], planes[0] };
+	const primitives_t* prims = primitives_get();
+	return prims->planarSplit_8u_AC4P4(data, format, scanline, pDst, width,
+	                                   height) == PRIMITIVES_SUCCESS;
 }
 
 static UINT32 freerdp_bitmap_planar_write_rle_bytes(
@@ -1006,11 +764,7 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane,
         UINT32 width, UINT32 height,
         BYTE* outPlane)
 {
-	char s2c;
-	INT32 delta;
-	UINT32 y, x;
-	BYTE* outPtr;
-	const BYTE* srcPtr, *prevLinePtr;
+	const primitives_t* prims = primitives_get();
 
 	if (!outPlane)
 	{
@@ -1021,22 +775,8 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane,
 			return NULL;
 	}
 
-	// first line is copied as is
-	CopyMemory(outPlane, inPlane, width);
-	outPtr = outPlane + width;
-	srcPtr = inPlane + width;
-	prevLinePtr = inPlane;
-
-	for (y = 1; y < height; y++)
-	{
-		for (x = 0; x < width; x++, outPtr++, srcPtr++, prevLinePtr++)
-		{
-			delta = *srcPtr - *prevLinePtr;
-			s2c = (delta >= 0) ? (char) delta : (char)(~((BYTE)(-delta)) + 1);
-			s2c = (s2c >= 0) ? (s2c << 1) : (char)(((~((BYTE) s2c) + 1) << 1) - 1);
-			*outPtr = (BYTE)s2c;
-		}
-	}
+	if (prims->planarDeltaEncode_8u(inPlane, outPlane, width, height) != PRIMITIVES_SUCCESS)
+		return NULL;
 
 	return outPlane;
 }
@@ -1077,17 +817,24 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 		FormatHeader |= PLANAR_FORMAT_HEADER_NA;
 
 	planeSize = width * height;
+	PROFILER_TRACE_BEGIN("planar_compress");
 
 	if (!freerdp_split_color_planes(data, format, width, height, scanline,
 	                                context->planes))
-		return NULL;
+	{
+		dstData = NULL;
+		goto fail;
+	}
 
 	if (context->AllowRunLengthEncoding)
 	{
 		if (!freerdp_bitmap_planar_delta_encode_planes(
 		        context->planes, width, height,
 		        context->deltaPlanes))
-			return NULL;;
+		{
+			dstData = NULL;
+			goto fail;
+		}
 
 		if (freerdp_bitmap_planar_compress_planes_rle(
 		        context->deltaPlanes, width, height,
@@ -1132,7 +879,7 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 		dstData = malloc(size);
 
 		if (!dstData)
-			return NULL;
+			goto fail;
 
 		*pDstSize = size;
 	}
@@ -1206,6 +953,8 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 
 	size = (dstp - dstData);
 	*pDstSize = size;
+fail:
+	PROFILER_TRACE_END("planar_compress");
 	return dstData;
 }
 
@@ -23,12 +23,14 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 #include <winpr/bitstream.h>
 
 #include <freerdp/primitives.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/progressive.h>
 #include <freerdp/codec/region.h>
+#include <freerdp/utils/profiler.h>
 #include <freerdp/log.h>
 
 #include "rfx_differential.h"
@@ -699,14 +701,12 @@ static void progressive_rfx_decode_block(const primitives_t* prims,
 	prims->lShiftC_16s(buffer, shift, buffer, length);
 }
 
-static int progressive_rfx_decode_component(PROGRESSIVE_CONTEXT* progressive,
-        RFX_COMPONENT_CODEC_QUANT* shift,
+static int progressive_rfx_decode_component(RFX_COMPONENT_CODEC_QUANT* shift,
         const BYTE* data, int length,
         INT16* buffer, INT16* current,
-        INT16* sign, BOOL diff)
+        INT16* sign, INT16* temp, BOOL diff)
 {
 	int status;
-	INT16* temp;
 	const primitives_t* prims = primitives_get();
 	status = rfx_rlgr_decode(RLGR1, data, length, buffer, 4096);
 
@@ -725,14 +725,12 @@ static int progressive_rfx_decode_component(PROGRESSIVE_CONTEXT* progressive,
 	progressive_rfx_decode_block(prims, &buffer[3879], 72, shift->LH3); /* LH3 */
 	progressive_rfx_decode_block(prims, &buffer[3951], 64, shift->HH3); /* HH3 */
 	progressive_rfx_decode_block(prims, &buffer[4015], 81, shift->LL3); /* LL3 */
-	temp = (INT16*) BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
 	progressive_rfx_dwt_2d_decode(buffer, temp, current, sign, diff);
-	BufferPool_Return(progressive->bufferPool, temp);
 	return 1;
 }
 
 static int progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* progressive,
-        RFX_PROGRESSIVE_TILE* tile)
+        RFX_PROGRESSIVE_TILE* tile, BYTE* pScratch, INT16* pTemp)
 {
 	BOOL diff;
 	BYTE* pBuffer;
@@ -810,21 +808,6 @@ static int progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* progressive,
 	progressive_rfx_quant_add(quantCr, quantProgCr, &shiftCr);
 	progressive_rfx_quant_lsub(&shiftCr, 1); /* -6 + 5 = -1 */
 
-	if (!tile->data)
-	{
-		tile->data = (BYTE*) _aligned_malloc(64 * 64 * 4, 16);
-	}
-
-	if (!tile->sign)
-	{
-		tile->sign = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
-	}
-
-	if (!tile->current)
-	{
-		tile->current = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
-	}
-
 	pBuffer = tile->sign;
 	pSign[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
 	pSign[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) +
@@ -838,21 +821,19 @@ static int progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* progressive,
 	                                        16])); /* Cb/G buffer */
 	pCurrent[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) +
 	                                        16])); /* Cr/B buffer */
-	pBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pBuffer = pScratch;
 	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) +
 	                                       16])); /* Y/R buffer */
 	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) +
 	                                       16])); /* Cb/G buffer */
 	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) +
 	                                       16])); /* Cr/B buffer */
-	progressive_rfx_decode_component(progressive, &shiftY, tile->yData, tile->yLen,
-	                                 pSrcDst[0], pCurrent[0], pSign[0], diff); /* Y */
-	progressive_rfx_decode_component(progressive, &shiftCb, tile->cbData,
-	                                 tile->cbLen,
-	                                 pSrcDst[1], pCurrent[1], pSign[1], diff); /* Cb */
-	progressive_rfx_decode_component(progressive, &shiftCr, tile->crData,
-	                                 tile->crLen,
-	                                 pSrcDst[2], pCurrent[2], pSign[2], diff); /* Cr */
+	progressive_rfx_decode_component(&shiftY, tile->yData, tile->yLen,
+	                                 pSrcDst[0], pCurrent[0], pSign[0], pTemp, diff); /* Y */
+	progressive_rfx_decode_component(&shiftCb, tile->cbData, tile->cbLen,
+	                                 pSrcDst[1], pCurrent[1], pSign[1], pTemp, diff); /* Cb */
+	progressive_rfx_decode_component(&shiftCr, tile->crData, tile->crLen,
+	                                 pSrcDst[2], pCurrent[2], pSign[2], pTemp, diff); /* Cr */
 
 	if (!progressive->invert)
 		prims->yCbCrToRGB_16s8u_P3AC4R((const INT16**) pSrcDst, 64 * 2,
@@ -863,7 +844,6 @@ static int progressive_decompress_tile_first(PROGRESSIVE_CONTEXT* progressive,
 		                               tile->data, PIXEL_FORMAT_BGRX32,
 		                               64 * 4, &roi_64x64);
 
-	BufferPool_Return(progressive->bufferPool, pBuffer);
 	return 1;
 }
 
@@ -1051,17 +1031,15 @@ static int progressive_rfx_upgrade_block(RFX_PROGRESSIVE_UPGRADE_STATE* state,
 	return 1;
 }
 
-static int progressive_rfx_upgrade_component(PROGRESSIVE_CONTEXT* progressive,
-        RFX_COMPONENT_CODEC_QUANT* shift,
+static int progressive_rfx_upgrade_component(RFX_COMPONENT_CODEC_QUANT* shift,
         RFX_COMPONENT_CODEC_QUANT* bitPos,
         RFX_COMPONENT_CODEC_QUANT* numBits,
         INT16* buffer,
         INT16* current, INT16* sign,
         const BYTE* srlData,
         UINT32 srlLen, const BYTE* rawData,
-        UINT32 rawLen)
+        UINT32 rawLen, INT16* temp)
 {
-	INT16* temp;
 	UINT32 aRawLen;
 	UINT32 aSrlLen;
 	wBitStream s_srl;
@@ -1123,17 +1101,15 @@ static int progressive_rfx_upgrade_component(PROGRESSIVE_CONTEXT* progressive,
 		return -1;
 	}
 
-	temp = (INT16*) BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
 	CopyMemory(buffer, current, 4096 * 2);
 	progressive_rfx_dwt_2d_decode_block(&buffer[3807], temp, 3);
 	progressive_rfx_dwt_2d_decode_block(&buffer[3007], temp, 2);
 	progressive_rfx_dwt_2d_decode_block(&buffer[0], temp, 1);
-	BufferPool_Return(progressive->bufferPool, temp);
 	return 1;
 }
 
 static int progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
-        RFX_PROGRESSIVE_TILE* tile)
+        RFX_PROGRESSIVE_TILE* tile, BYTE* pScratch, INT16* pTemp)
 {
 	int status;
 	BYTE* pBuffer;
@@ -1243,33 +1219,33 @@ static int progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
 	                                        16])); /* Cb/G buffer */
 	pCurrent[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) +
 	                                        16])); /* Cr/B buffer */
-	pBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pBuffer = pScratch;
 	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) +
 	                                       16])); /* Y/R buffer */
 	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) +
 	                                       16])); /* Cb/G buffer */
 	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) +
 	                                       16])); /* Cr/B buffer */
-	status = progressive_rfx_upgrade_component(progressive, &shiftY, quantProgY,
+	status = progressive_rfx_upgrade_component(&shiftY, quantProgY,
 	         &yNumBits,
 	         pSrcDst[0], pCurrent[0], pSign[0], tile->ySrlData, tile->ySrlLen,
-	         tile->yRawData, tile->yRawLen); /* Y */
+	         tile->yRawData, tile->yRawLen, pTemp); /* Y */
 
 	if (status < 0)
 		return -1;
 
-	status = progressive_rfx_upgrade_component(progressive, &shiftCb, quantProgCb,
+	status = progressive_rfx_upgrade_component(&shiftCb, quantProgCb,
 	         &cbNumBits,
 	         pSrcDst[1], pCurrent[1], pSign[1], tile->cbSrlData, tile->cbSrlLen,
-	         tile->cbRawData, tile->cbRawLen); /* Cb */
+	         tile->cbRawData, tile->cbRawLen, pTemp); /* Cb */
 
 	if (status < 0)
 		return -1;
 
-	status = progressive_rfx_upgrade_component(progressive, &shiftCr, quantProgCr,
+	status = progressive_rfx_upgrade_component(&shiftCr, quantProgCr,
 	         &crNumBits,
 	         pSrcDst[2], pCurrent[2], pSign[2], tile->crSrlData, tile->crSrlLen,
-	         tile->crRawData, tile->crRawLen); /* Cr */
+	         tile->crRawData, tile->crRawLen, pTemp); /* Cr */
 
 	if (status < 0)
 		return -1;
@@ -1283,10 +1259,187 @@ static int progressive_decompress_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
 		                               tile->data, PIXEL_FORMAT_BGRX32,
 		                               64 * 4, &roi_64x64);
 
-	BufferPool_Return(progressive->bufferPool, pBuffer);
 	return 1;
 }
 
+static BOOL progressive_tile_allocate(RFX_PROGRESSIVE_TILE* tile)
+{
+	if (!tile->data)
+		tile->data = (BYTE*) _aligned_malloc(64 * 64 * 4, 16);
+
+	if (!tile->sign)
+		tile->sign = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
+
+	if (!tile->current)
+		tile->current = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
+
+	return tile->data && tile->sign && tile->current;
+}
+
+/**
+ * Decodes a run of tiles using a single pair of scratch buffers: one for the
+ * reconstructed Y/Cb/Cr planes and one for the inverse DWT. Runs are decoded
+ * concurrently, so nothing shared by the context may be written here.
+ */
+static int progressive_decompress_tiles(PROGRESSIVE_CONTEXT* progressive,
+                                        RFX_PROGRESSIVE_TILE** tiles, UINT32 count)
+{
+	UINT32 index;
+	int status = 1;
+	BYTE* pScratch = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	INT16* pTemp = (INT16*) BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pScratch || !pTemp)
+		status = -1;
+
+	for (index = 0; (index < count) && (status >= 0); index++)
+	{
+		RFX_PROGRESSIVE_TILE* tile = tiles[index];
+
+		switch (tile->blockType)
+		{
+			case PROGRESSIVE_WBT_TILE_SIMPLE:
+			case PROGRESSIVE_WBT_TILE_FIRST:
+				status = progressive_decompress_tile_first(progressive, tile, pScratch, pTemp);
+				break;
+
+			case PROGRESSIVE_WBT_TILE_UPGRADE:
+				status = progressive_decompress_tile_upgrade(progressive, tile, pScratch, pTemp);
+				break;
+		}
+	}
+
+	if (pScratch)
+		BufferPool_Return(progressive->bufferPool, pScratch);
+
+	if (pTemp)
+		BufferPool_Return(progressive->bufferPool, pTemp);
+
+	return status;
+}
+
+struct _PROGRESSIVE_TILE_PROCESS_WORK_PARAM
+{
+	PROGRESSIVE_CONTEXT* progressive;
+	RFX_PROGRESSIVE_TILE** tiles;
+	UINT32 count;
+	int status;
+};
+typedef struct _PROGRESSIVE_TILE_PROCESS_WORK_PARAM PROGRESSIVE_TILE_PROCESS_WORK_PARAM;
+
+static void CALLBACK progressive_process_tiles_work_callback(
+    PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	PROGRESSIVE_TILE_PROCESS_WORK_PARAM* param = (PROGRESSIVE_TILE_PROCESS_WORK_PARAM*) context;
+	param->status = progressive_decompress_tiles(param->progressive, param->tiles,
+	                param->count);
+}
+
+/**
+ * Splits the tiles of a region into a few runs per pool thread, tiles are
+ * independent of each other so the runs can be decoded in any order.
+ */
+static int progressive_decompress_tiles_parallel(PROGRESSIVE_CONTEXT* progressive,
+        RFX_PROGRESSIVE_TILE** tiles, UINT32 count)
+{
+	UINT32 index;
+	UINT32 offset;
+	UINT32 numWorks;
+	UINT32 tilesPerWork;
+	UINT32 submitted = 0;
+	int status = 1;
+	PTP_WORK* workObjects;
+	PROGRESSIVE_TILE_PROCESS_WORK_PARAM* params;
+	numWorks = progressive->ThreadCount * 4;
+
+	if (count == 0)
+		return 1;
+
+	if (numWorks > count)
+		numWorks = count;
+
+	tilesPerWork = (count + numWorks - 1) / numWorks;
+	numWorks = (count + tilesPerWork - 1) / tilesPerWork;
+
+	if (numWorks < 2)
+		return progressive_decompress_tiles(progressive, tiles, count);
+
+	workObjects = (PTP_WORK*) calloc(numWorks, sizeof(PTP_WORK));
+	params = (PROGRESSIVE_TILE_PROCESS_WORK_PARAM*) calloc(numWorks,
+	         sizeof(PROGRESSIVE_TILE_PROCESS_WORK_PARAM));
+
+	if (!workObjects || !params)
+	{
+		free(workObjects);
+		free(params);
+		return progressive_decompress_tiles(progressive, tiles, count);
+	}
+
+	for (index = 0, offset = 0; index < numWorks; index++, offset += tilesPerWork)
+	{
+		params[index].progressive = progressive;
+		params[index].tiles = &tiles[offset];
+		params[index].count = ((count - offset) < tilesPerWork) ? (count - offset) :
+		                      tilesPerWork;
+
+		if (!(workObjects[index] = CreateThreadpoolWork(
+		                               (PTP_WORK_CALLBACK) progressive_process_tiles_work_callback,
+		                               (void*) &params[index], &progressive->ThreadPoolEnv)))
+		{
+			WLog_ERR(TAG, "CreateThreadpoolWork failed.");
+			status = -1;
+			break;
+		}
+
+		SubmitThreadpoolWork(workObjects[index]);
+		submitted = index + 1;
+	}
+
+	for (index = 0; index < submitted; index++)
+	{
+		WaitForThreadpoolWorkCallbacks(workObjects[index], FALSE);
+		CloseThreadpoolWork(workObjects[index]);
+
+		if (params[index].status < 0)
+			status = -1;
+	}
+
+	free(workObjects);
+	free(params);
+	return status;
+}
+
+/**
+ * A tile may appear more than once in a region, e.g. its first pass followed
+ * by an upgrade. The tiles parsed before such a tile are decoded serially
+ * before it is parsed again, so the passes of a tile are applied in stream
+ * order and never by two runs at once.
+ */
+static int progressive_tile_claim(PROGRESSIVE_CONTEXT* progressive,
+                                  RFX_PROGRESSIVE_TILE* tile, RFX_PROGRESSIVE_TILE** tiles,
+                                  UINT32* decoded, UINT32 count)
+{
+	UINT32 index;
+	int status = 1;
+
+	if (count >= progressive->cTiles)
+		return -1;
+
+	if (tile->pendingRegion == progressive->regionIndex)
+	{
+		status = progressive_decompress_tiles(progressive, &tiles[*decoded], count - *decoded);
+
+		for (index = *decoded; index < count; index++)
+			tiles[index]->pendingRegion = 0;
+
+		*decoded = count;
+	}
+
+	tile->pendingRegion = progressive->regionIndex;
+	tiles[count] = tile;
+	return status;
+}
+
 static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
                                      const BYTE* blocks, UINT32 blocksLen,
                                      const PROGRESSIVE_SURFACE_CONTEXT* surface)
@@ -1296,18 +1449,23 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 	UINT16 xIdx;
 	UINT16 yIdx;
 	UINT16 zIdx;
-	UINT16 index;
 	UINT32 boffset;
 	UINT16 blockType;
 	UINT32 blockLen;
+	UINT32 index;
 	UINT32 count = 0;
 	UINT32 offset = 0;
+	UINT32 decoded = 0;
 	RFX_PROGRESSIVE_TILE* tile;
 	RFX_PROGRESSIVE_TILE** tiles;
 	PROGRESSIVE_BLOCK_REGION* region;
 	region = &(progressive->region);
 	tiles = region->tiles;
 
+	/* 0 marks a tile that is not pending */
+	if (++progressive->regionIndex == 0)
+		progressive->regionIndex = 1;
+
 	while ((blocksLen - offset) >= 6)
 	{
 		boffset = 0;
@@ -1334,7 +1492,11 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 				if (zIdx >= surface->gridSize)
 					return -1;
 
-				tiles[count] = tile = &(surface->tiles[zIdx]);
+				tile = &(surface->tiles[zIdx]);
+
+				if (progressive_tile_claim(progressive, tile, tiles, &decoded, count) < 0)
+					return -1;
+
 				tile->blockType = blockType;
 				tile->blockLen = blockLen;
 				tile->quality = 0xFF; /* simple tiles use no progressive techniques */
@@ -1391,7 +1553,11 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 				if (zIdx >= surface->gridSize)
 					return -1;
 
-				tiles[count] = tile = &(surface->tiles[zIdx]);
+				tile = &(surface->tiles[zIdx]);
+
+				if (progressive_tile_claim(progressive, tile, tiles, &decoded, count) < 0)
+					return -1;
+
 				tile->blockType = blockType;
 				tile->blockLen = blockLen;
 				tile->quantIdxY = block[boffset + 0]; /* quantIdxY (1 byte) */
@@ -1447,7 +1613,11 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 				if (zIdx >= surface->gridSize)
 					return -1;
 
-				tiles[count] = tile = &(surface->tiles[zIdx]);
+				tile = &(surface->tiles[zIdx]);
+
+				if (progressive_tile_claim(progressive, tile, tiles, &decoded, count) < 0)
+					return -1;
+
 				tile->blockType = blockType;
 				tile->blockLen = blockLen;
 				tile->flags = 0;
@@ -1514,6 +1684,9 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 		if (boffset != blockLen)
 			return -1040;
 
+		if (!progressive_tile_allocate(tile))
+			return -1;
+
 		offset += blockLen;
 		count++;
 	}
@@ -1527,25 +1700,17 @@ static int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive,
 		          region->numTiles);
 	}
 
-	for (index = 0; index < region->numTiles; index++)
-	{
-		tile = tiles[index];
-
-		switch (tile->blockType)
-		{
-			case PROGRESSIVE_WBT_TILE_SIMPLE:
-			case PROGRESSIVE_WBT_TILE_FIRST:
-				status = progressive_decompress_tile_first(progressive, tile);
-				break;
+	if (progressive->UseThreads)
+		status = progressive_decompress_tiles_parallel(progressive, &tiles[decoded],
+		         count - decoded);
+	else
+		status = progressive_decompress_tiles(progressive, &tiles[decoded], count - decoded);
 
-			case PROGRESSIVE_WBT_TILE_UPGRADE:
-				status = progressive_decompress_tile_upgrade(progressive, tile);
-				break;
-		}
+	for (index = decoded; index < count; index++)
+		tiles[index]->pendingRegion = 0;
 
-		if (status < 0)
-			return -1;
-	}
+	if (status < 0)
+		return -1;
 
 	return (int) offset;
 }
@@ -1587,6 +1752,7 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 	if (!surface)
 		return -1001;
 
+	PROFILER_TRACE_BEGIN("progressive_decompress");
 	blocks = pSrcData;
 	blocksLen = SrcSize;
 	region = &(progressive->region);
@@ -1606,7 +1772,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 		boffset += 6;
 
 		if ((blocksLen - offset) < blockLen)
-			return -1003;
+		{
+			rc = -1003;
+			goto out;
+		}
 
 		switch (blockType)
 		{
@@ -1616,7 +1785,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				sync.blockLen = blockLen;
 
 				if ((blockLen - boffset) != 6)
-					return -1004;
+				{
+					rc = -1004;
+					goto out;
+				}
 
 				sync.magic = (UINT32) * ((UINT32*) &block[boffset + 0]); /* magic (4 bytes) */
 				sync.version = (UINT32) * ((UINT16*) &block[boffset +
@@ -1624,10 +1796,16 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				boffset += 6;
 
 				if (sync.magic != 0xCACCACCA)
-					return -1005;
+				{
+					rc = -1005;
+					goto out;
+				}
 
 				if (sync.version != 0x0100)
-					return -1006;
+				{
+					rc = -1006;
+					goto out;
+				}
 
 				break;
 
@@ -1636,7 +1814,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				frameBegin.blockLen = blockLen;
 
 				if ((blockLen - boffset) < 6)
-					return -1007;
+				{
+					rc = -1007;
+					goto out;
+				}
 
 				frameBegin.frameIndex = (UINT32) * ((UINT32*) &block[boffset +
 				                                    0]); /* frameIndex (4 bytes) */
@@ -1658,7 +1839,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				frameEnd.blockLen = blockLen;
 
 				if ((blockLen - boffset) != 0)
-					return -1008;
+				{
+					rc = -1008;
+					goto out;
+				}
 
 				break;
 
@@ -1667,7 +1851,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				context.blockLen = blockLen;
 
 				if ((blockLen - boffset) != 4)
-					return -1009;
+				{
+					rc = -1009;
+					goto out;
+				}
 
 				context.ctxId = block[boffset + 0]; /* ctxId (1 byte) */
 				context.tileSize = *((UINT16*) &block[boffset + 1]); /* tileSize (2 bytes) */
@@ -1675,7 +1862,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				boffset += 4;
 
 				if (context.tileSize != 64)
-					return -1010;
+				{
+					rc = -1010;
+					goto out;
+				}
 
 				WLog_DBG(TAG, "ProgressiveContext: flags: 0x%02X", context.flags);
 
@@ -1691,7 +1881,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				region->blockLen = blockLen;
 
 				if ((blockLen - boffset) < 12)
-					return -1011;
+				{
+					rc = -1011;
+					goto out;
+				}
 
 				region->tileSize = block[boffset + 0]; /* tileSize (1 byte) */
 				region->numRects = *((UINT16*) &block[boffset + 1]); /* numRects (2 bytes) */
@@ -1704,16 +1897,28 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				boffset += 12;
 
 				if (region->tileSize != 64)
-					return -1012;
+				{
+					rc = -1012;
+					goto out;
+				}
 
 				if (region->numRects < 1)
-					return -1013;
+				{
+					rc = -1013;
+					goto out;
+				}
 
 				if (region->numQuant > 7)
-					return -1014;
+				{
+					rc = -1014;
+					goto out;
+				}
 
 				if ((blockLen - boffset) < (region->numRects * 8))
-					return -1015;
+				{
+					rc = -1015;
+					goto out;
+				}
 
 				if (region->numRects > progressive->cRects)
 				{
@@ -1725,7 +1930,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				region->rects = progressive->rects;
 
 				if (!region->rects)
-					return -1016;
+				{
+					rc = -1016;
+					goto out;
+				}
 
 				for (index = 0; index < region->numRects; index++)
 				{
@@ -1738,7 +1946,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				}
 
 				if ((blockLen - boffset) < (region->numQuant * 5))
-					return -1017;
+				{
+					rc = -1017;
+					goto out;
+				}
 
 				if (region->numQuant > progressive->cQuant)
 				{
@@ -1751,7 +1962,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				region->quantVals = progressive->quantVals;
 
 				if (!region->quantVals)
-					return -1018;
+				{
+					rc = -1018;
+					goto out;
+				}
 
 				for (index = 0; index < region->numQuant; index++)
 				{
@@ -1760,14 +1974,23 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 					boffset += 5;
 
 					if (!progressive_rfx_quant_lcmp_greater_equal(quantVal, 6))
-						return -1;
+					{
+						rc = -1;
+						goto out;
+					}
 
 					if (!progressive_rfx_quant_lcmp_less_equal(quantVal, 15))
-						return -1;
+					{
+						rc = -1;
+						goto out;
+					}
 				}
 
 				if ((blockLen - boffset) < (region->numProgQuant * 16))
-					return -1019;
+				{
+					rc = -1019;
+					goto out;
+				}
 
 				if (region->numProgQuant > progressive->cProgQuant)
 				{
@@ -1780,7 +2003,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				region->quantProgVals = progressive->quantProgVals;
 
 				if (!region->quantProgVals)
-					return -1020;
+				{
+					rc = -1020;
+					goto out;
+				}
 
 				for (index = 0; index < region->numProgQuant; index++)
 				{
@@ -1796,7 +2022,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				}
 
 				if ((blockLen - boffset) < region->tileDataSize)
-					return -1021;
+				{
+					rc = -1021;
+					goto out;
+				}
 
 				if (progressive->cTiles < surface->gridSize)
 				{
@@ -1808,7 +2037,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				region->tiles = progressive->tiles;
 
 				if (!region->tiles)
-					return -1;
+				{
+					rc = -1;
+					goto out;
+				}
 
 				WLog_DBG(TAG,
 				         "ProgressiveRegion: numRects: %d numTiles: %d tileDataSize: %d flags: 0x%02X numQuant: %d numProgQuant: %d",
@@ -1853,7 +2085,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				                                   region->tileDataSize, surface);
 
 				if (status < 0)
-					return status;
+				{
+					rc = status;
+					goto out;
+				}
 
 				region->numTiles = 0;
 
@@ -1877,19 +2112,25 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 				break;
 
 			default:
-				return -1039;
-				break;
+				rc = -1039;
+				goto out;
 		}
 
 		if (boffset != blockLen)
-			return -1040;
+		{
+			rc = -1040;
+			goto out;
+		}
 
 		offset += blockLen;
 		count++;
 	}
 
 	if (offset != blocksLen)
-		return -1041;
+	{
+		rc = -1041;
+		goto out;
+	}
 
 	region = &(progressive->region);
 	region16_init(&clippingRects);
@@ -1942,75 +2183,1025 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 	}
 
 	region16_uninit(&clippingRects);
+out:
+	PROFILER_TRACE_END("progressive_decompress");
 	return rc;
 }
 
-int progressive_compress(PROGRESSIVE_CONTEXT* progressive, BYTE* pSrcData,
-                         UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize)
+/**
+ * Progressive Encoder
+ *
+ * Tiles touched by the invalid region are sent as PROGRESSIVE_WBT_TILE_FIRST
+ * blocks using the coarsest progressive quality. The unquantized DWT coefficients
+ * are kept in tile->current together with the sign map the decoder reconstructs
+ * (tile->sign), so subsequent calls can refine these tiles using
+ * PROGRESSIVE_WBT_TILE_UPGRADE blocks until full quality is reached.
+ */
+
+static const RFX_COMPONENT_CODEC_QUANT progressive_encoder_quant =
 {
-	return 1;
-}
+	6, 6, 6, 6, 7, 7, 8, 8, 8, 9 /* LL3, HL3, LH3, HH3, HL2, LH2, HH2, HL1, LH1, HH1 */
+};
 
-BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_encoder_quant_prog[] =
 {
-	if (!progressive)
-		return FALSE;
+	{
+		25,
+		{ 2, 2, 2, 3, 3, 3, 3, 4, 4, 4 },
+		{ 3, 3, 3, 4, 4, 4, 4, 5, 5, 5 },
+		{ 3, 3, 3, 4, 4, 4, 4, 5, 5, 5 }
+	},
+	{
+		50,
+		{ 1, 1, 1, 1, 1, 1, 2, 2, 2, 2 },
+		{ 1, 1, 1, 2, 2, 2, 2, 2, 2, 2 },
+		{ 1, 1, 1, 2, 2, 2, 2, 2, 2, 2 }
+	}
+};
 
-	return TRUE;
-}
+#define PROGRESSIVE_ENCODER_NUM_PROG_QUANT \
+	(sizeof(progressive_encoder_quant_prog) / sizeof(RFX_PROGRESSIVE_CODEC_QUANT))
 
-PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
+/* quality used by each pass, the last pass is always the full quality (0xFF) */
+static const BYTE progressive_encoder_pass_quality[] = { 0, 1, 0xFF };
+
+#define PROGRESSIVE_ENCODER_NUM_PASSES \
+	(sizeof(progressive_encoder_pass_quality) / sizeof(BYTE))
+
+static void progressive_component_codec_quant_write(wStream* s,
+        const RFX_COMPONENT_CODEC_QUANT* quantVal)
 {
-	PROGRESSIVE_CONTEXT* progressive;
-	progressive = (PROGRESSIVE_CONTEXT*) calloc(1, sizeof(PROGRESSIVE_CONTEXT));
+	Stream_Write_UINT8(s, quantVal->LL3 | (quantVal->HL3 << 4));
+	Stream_Write_UINT8(s, quantVal->LH3 | (quantVal->HH3 << 4));
+	Stream_Write_UINT8(s, quantVal->HL2 | (quantVal->LH2 << 4));
+	Stream_Write_UINT8(s, quantVal->HH2 | (quantVal->HL1 << 4));
+	Stream_Write_UINT8(s, quantVal->LH1 | (quantVal->HH1 << 4));
+}
 
-	if (progressive)
-	{
-		progressive->Compressor = Compressor;
-		progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
-		progressive->cRects = 64;
-		progressive->rects = (RFX_RECT*) malloc(progressive->cRects * sizeof(RFX_RECT));
+static RFX_PROGRESSIVE_CODEC_QUANT* progressive_encoder_get_quant_prog(
+    PROGRESSIVE_CONTEXT* progressive, BYTE quality)
+{
+	if (quality == 0xFF)
+		return &(progressive->quantProgValFull);
 
-		if (!progressive->rects)
-			goto cleanup;
+	return (RFX_PROGRESSIVE_CODEC_QUANT*) &(progressive_encoder_quant_prog[quality]);
+}
 
-		progressive->cTiles = 64;
-		progressive->tiles = (RFX_PROGRESSIVE_TILE**) malloc(progressive->cTiles *
-		                     sizeof(RFX_PROGRESSIVE_TILE*));
+/**
+ * Forward reduce-extrapolate DWT, inverse of progressive_rfx_idwt_x/y
+ */
 
-		if (!progressive->tiles)
-			goto cleanup;
+static void progressive_rfx_dwt_encode_line(const INT16* pX, int nXStep,
+        INT16* pL, int nLStep, INT16* pH, int nHStep,
+        int nLowCount, int nHighCount)
+{
+	int n;
+	int X0, X1, X2;
+	int value;
 
-		progressive->cQuant = 8;
-		progressive->quantVals = (RFX_COMPONENT_CODEC_QUANT*) malloc(
-		                             progressive->cQuant * sizeof(RFX_COMPONENT_CODEC_QUANT));
+	for (n = 0; n < nHighCount; n++)
+	{
+		X0 = pX[(2 * n) * nXStep];
+		X1 = pX[(2 * n + 1) * nXStep];
+		X2 = pX[(2 * n + 2) * nXStep];
+		pH[n * nHStep] = (INT16)((X1 - ((X0 + X2) / 2)) / 2);
+	}
 
-		if (!progressive->quantVals)
-			goto cleanup;
+	pL[0] = (INT16)(pX[0] + pH[0]);
 
-		progressive->cProgQuant = 8;
-		progressive->quantProgVals = (RFX_PROGRESSIVE_CODEC_QUANT*) malloc(
-		                                 progressive->cProgQuant * sizeof(RFX_PROGRESSIVE_CODEC_QUANT));
+	for (n = 1; n < nHighCount; n++)
+	{
+		X0 = pX[(2 * n) * nXStep];
+		pL[n * nLStep] = (INT16)(X0 + ((pH[(n - 1) * nHStep] + pH[n * nHStep]) / 2));
+	}
 
-		if (!progressive->quantProgVals)
-			goto cleanup;
+	X0 = pX[(2 * nHighCount) * nXStep];
 
-		ZeroMemory(&(progressive->quantProgValFull),
-		           sizeof(RFX_PROGRESSIVE_CODEC_QUANT));
-		progressive->quantProgValFull.quality = 100;
-		progressive->SurfaceContexts = HashTable_New(TRUE);
-		progressive_context_reset(progressive);
+	if (nLowCount <= (nHighCount + 1))
+	{
+		pL[nHighCount * nLStep] = (INT16)(X0 + pH[(nHighCount - 1) * nHStep]);
 	}
+	else
+	{
+		X1 = pX[(2 * nHighCount + 1) * nXStep];
+		pL[nHighCount * nLStep] = (INT16)(X0 + (pH[(nHighCount - 1) * nHStep] / 2));
+		/* the last sample is reconstructed as the average of L and its predecessor */
+		value = (2 * X1) - X0;
 
-	return progressive;
-cleanup:
-	free(progressive->rects);
-	free(progressive->tiles);
-	free(progressive->quantVals);
-	free(progressive->quantProgVals);
-	free(progressive);
-	return NULL;
-}
+		if (value > 32767)
+			value = 32767;
+		else if (value < -32768)
+			value = -32768;
+
+		pL[(nHighCount + 1) * nLStep] = (INT16) value;
+	}
+}
+
+static void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp,
+        int level)
+{
+	int i;
+	int nBandL;
+	int nBandH;
+	int nStep;
+	INT16* HL, *LH;
+	INT16* HH, *LL;
+	INT16* L, *H;
+	nBandL = progressive_rfx_get_band_l_count(level);
+	nBandH = progressive_rfx_get_band_h_count(level);
+	nStep = nBandL + nBandH;
+	L = &temp[0];
+	H = &temp[nBandL * nStep];
+	HL = &buffer[0];
+	LH = &HL[nBandH * nBandL];
+	HH = &LH[nBandL * nBandH];
+	LL = &HH[nBandH * nBandH];
+
+	/* vertical (LL -> L + H) */
+	for (i = 0; i < nStep; i++)
+		progressive_rfx_dwt_encode_line(&buffer[i], nStep, &L[i], nStep, &H[i], nStep,
+		                                nBandL, nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (i = 0; i < nBandL; i++)
+		progressive_rfx_dwt_encode_line(&L[i * nStep], 1, &LL[i * nBandL], 1,
+		                                &HL[i * nBandH], 1, nBandL, nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (i = 0; i < nBandH; i++)
+		progressive_rfx_dwt_encode_line(&H[i * nStep], 1, &LH[i * nBandL], 1,
+		                                &HH[i * nBandH], 1, nBandL, nBandH);
+}
+
+static void progressive_rfx_dwt_2d_encode(INT16* buffer, INT16* temp)
+{
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+}
+
+static void progressive_rfx_encode_block(const INT16* coeffs, INT16* buffer,
+        int length, UINT32 shift, BOOL nonLL)
+{
+	int index;
+
+	if (!nonLL)
+	{
+		/* LL3 upgrades are unsigned, truncate towards negative infinity */
+		for (index = 0; index < length; index++)
+			buffer[index] = (INT16)(coeffs[index] >> shift);
+
+		return;
+	}
+
+	/* sign-magnitude truncation, so that upgrades only add magnitude bits */
+	for (index = 0; index < length; index++)
+	{
+		if (coeffs[index] < 0)
+			buffer[index] = (INT16) - ((-coeffs[index]) >> shift);
+		else
+			buffer[index] = (INT16)(coeffs[index] >> shift);
+	}
+}
+
+static void progressive_rfx_round_block(INT16* current, int length, UINT32 shift)
+{
+	int index;
+	int value;
+	const int half = (1 << shift) >> 1;
+
+	for (index = 0; index < length; index++)
+	{
+		value = current[index];
+
+		if (value < 0)
+			value = MAX(value - half, -32768);
+		else
+			value = MIN(value + half, 32767);
+
+		current[index] = (INT16) value;
+	}
+}
+
+/**
+ * Every pass truncates the coefficients, bias them once by half of the final
+ * quantization step so that the full quality pass ends up rounded.
+ */
+
+static void progressive_rfx_round_component(const RFX_COMPONENT_CODEC_QUANT* shift,
+        INT16* current)
+{
+	progressive_rfx_round_block(&current[0], 1023, shift->HL1); /* HL1 */
+	progressive_rfx_round_block(&current[1023], 1023, shift->LH1); /* LH1 */
+	progressive_rfx_round_block(&current[2046], 961, shift->HH1); /* HH1 */
+	progressive_rfx_round_block(&current[3007], 272, shift->HL2); /* HL2 */
+	progressive_rfx_round_block(&current[3279], 272, shift->LH2); /* LH2 */
+	progressive_rfx_round_block(&current[3551], 256, shift->HH2); /* HH2 */
+	progressive_rfx_round_block(&current[3807], 72, shift->HL3); /* HL3 */
+	progressive_rfx_round_block(&current[3879], 72, shift->LH3); /* LH3 */
+	progressive_rfx_round_block(&current[3951], 64, shift->HH3); /* HH3 */
+	progressive_rfx_round_block(&current[4015], 81, shift->LL3); /* LL3 */
+}
+
+static int progressive_rfx_encode_component(const RFX_COMPONENT_CODEC_QUANT* shift,
+        const INT16* current, INT16* buffer, INT16* sign,
+        BYTE* pDstData, UINT32 DstSize)
+{
+	progressive_rfx_encode_block(&current[0], &buffer[0], 1023, shift->HL1, TRUE); /* HL1 */
+	progressive_rfx_encode_block(&current[1023], &buffer[1023], 1023, shift->LH1, TRUE); /* LH1 */
+	progressive_rfx_encode_block(&current[2046], &buffer[2046], 961, shift->HH1, TRUE); /* HH1 */
+	progressive_rfx_encode_block(&current[3007], &buffer[3007], 272, shift->HL2, TRUE); /* HL2 */
+	progressive_rfx_encode_block(&current[3279], &buffer[3279], 272, shift->LH2, TRUE); /* LH2 */
+	progressive_rfx_encode_block(&current[3551], &buffer[3551], 256, shift->HH2, TRUE); /* HH2 */
+	progressive_rfx_encode_block(&current[3807], &buffer[3807], 72, shift->HL3, TRUE); /* HL3 */
+	progressive_rfx_encode_block(&current[3879], &buffer[3879], 72, shift->LH3, TRUE); /* LH3 */
+	progressive_rfx_encode_block(&current[3951], &buffer[3951], 64, shift->HH3, TRUE); /* HH3 */
+	progressive_rfx_encode_block(&current[4015], &buffer[4015], 81, shift->LL3, FALSE); /* LL3 */
+	CopyMemory(sign, buffer, 4096 * 2);
+	rfx_differential_encode(&buffer[4015], 81); /* LL3 */
+	return rfx_rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+}
+
+static void progressive_rfx_srl_write_bits(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+        UINT32 bits, UINT32 nbits)
+{
+	wBitStream* bs = state->srl;
+
+	if (nbits)
+		BitStream_Write_Bits(bs, bits, nbits);
+}
+
+static void progressive_rfx_srl_write_zeros(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+        BOOL flush)
+{
+	int k = state->kp / 8;
+
+	/* '0' bit, run of (1 << k) zeros */
+	while ((state->nz >= (1 << k)) || (flush && (state->nz > 0)))
+	{
+		progressive_rfx_srl_write_bits(state, 0, 1);
+		state->nz -= (state->nz >= (1 << k)) ? (1 << k) : state->nz;
+		state->kp += 4;
+
+		if (state->kp > 80)
+			state->kp = 80;
+
+		k = state->kp / 8;
+	}
+
+	if (flush)
+		return;
+
+	/* '1' bit, remaining run of zeros in the next k bits */
+	progressive_rfx_srl_write_bits(state, 1, 1);
+	progressive_rfx_srl_write_bits(state, (UINT32) state->nz, k);
+	state->nz = 0;
+}
+
+static void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+                                      INT16 value, UINT32 numBits)
+{
+	UINT32 mag;
+	UINT32 max;
+	UINT32 zeros;
+
+	if (!value)
+	{
+		state->nz++;
+		return;
+	}
+
+	progressive_rfx_srl_write_zeros(state, FALSE);
+	/* sign bit */
+	progressive_rfx_srl_write_bits(state, (value < 0) ? 1 : 0, 1);
+	state->kp -= 6;
+
+	if (state->kp < 0)
+		state->kp = 0;
+
+	if (numBits == 1)
+		return;
+
+	/* unary encoding, the terminating bit is implicit for the maximum */
+	mag = (value < 0) ? -value : value;
+	max = (1 << numBits) - 1;
+
+	for (zeros = mag - 1; zeros > 0; zeros--)
+		progressive_rfx_srl_write_bits(state, 0, 1);
+
+	if (mag < max)
+		progressive_rfx_srl_write_bits(state, 1, 1);
+}
+
+static void progressive_rfx_upgrade_block_encode(RFX_PROGRESSIVE_UPGRADE_STATE*
+        state, const INT16* current, INT16* sign, UINT32 length,
+        UINT32 shift, UINT32 numBits)
+{
+	UINT32 index;
+	UINT32 mask;
+	UINT32 input;
+	INT16 value;
+	wBitStream* bs = state->raw;
+
+	if (!numBits)
+		return;
+
+	mask = ((1 << numBits) - 1);
+
+	if (!state->nonLL)
+	{
+		for (index = 0; index < length; index++)
+		{
+			input = ((UINT32)(current[index] >> shift)) & mask;
+			BitStream_Write_Bits(bs, input, numBits);
+		}
+
+		return;
+	}
+
+	for (index = 0; index < length; index++)
+	{
+		value = current[index];
+		input = (((value < 0) ? -value : value) >> shift) & mask;
+
+		if (sign[index] != 0)
+		{
+			/* sign != 0, magnitude goes to raw */
+			BitStream_Write_Bits(bs, input, numBits);
+		}
+		else
+		{
+			/* sign == 0, value goes to srl */
+			value = (INT16)((value < 0) ? -((INT32) input) : (INT32) input);
+			progressive_rfx_srl_write(state, value, numBits);
+			sign[index] = value;
+		}
+	}
+}
+
+static void progressive_rfx_upgrade_component_encode(
+    const RFX_COMPONENT_CODEC_QUANT* shift,
+    const RFX_COMPONENT_CODEC_QUANT* numBits,
+    const INT16* current, INT16* sign,
+    BYTE* srlData, UINT32* srlLen,
+    BYTE* rawData, UINT32* rawLen)
+{
+	wBitStream s_srl;
+	wBitStream s_raw;
+	RFX_PROGRESSIVE_UPGRADE_STATE state;
+	ZeroMemory(&s_srl, sizeof(wBitStream));
+	ZeroMemory(&s_raw, sizeof(wBitStream));
+	ZeroMemory(&state, sizeof(RFX_PROGRESSIVE_UPGRADE_STATE));
+	state.kp = 8;
+	state.mode = 0;
+	state.srl = &s_srl;
+	state.raw = &s_raw;
+	BitStream_Attach(state.srl, srlData, *srlLen);
+	BitStream_Attach(state.raw, rawData, *rawLen);
+	state.nonLL = TRUE;
+	progressive_rfx_upgrade_block_encode(&state, &current[0], &sign[0], 1023,
+	                                     shift->HL1, numBits->HL1); /* HL1 */
+	progressive_rfx_upgrade_block_encode(&state, &current[1023], &sign[1023], 1023,
+	                                     shift->LH1, numBits->LH1); /* LH1 */
+	progressive_rfx_upgrade_block_encode(&state, &current[2046], &sign[2046], 961,
+	                                     shift->HH1, numBits->HH1); /* HH1 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3007], &sign[3007], 272,
+	                                     shift->HL2, numBits->HL2); /* HL2 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3279], &sign[3279], 272,
+	                                     shift->LH2, numBits->LH2); /* LH2 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3551], &sign[3551], 256,
+	                                     shift->HH2, numBits->HH2); /* HH2 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3807], &sign[3807], 72,
+	                                     shift->HL3, numBits->HL3); /* HL3 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3879], &sign[3879], 72,
+	                                     shift->LH3, numBits->LH3); /* LH3 */
+	progressive_rfx_upgrade_block_encode(&state, &current[3951], &sign[3951], 64,
+	                                     shift->HH3, numBits->HH3); /* HH3 */
+	progressive_rfx_srl_write_zeros(&state, TRUE);
+	state.nonLL = FALSE;
+	progressive_rfx_upgrade_block_encode(&state, &current[4015], &sign[4015], 81,
+	                                     shift->LL3, numBits->LL3); /* LL3 */
+	BitStream_Flush(state.srl);
+	BitStream_Flush(state.raw);
+	*srlLen = (state.srl->position + 7) / 8;
+	*rawLen = (state.raw->position + 7) / 8;
+}
+
+static void progressive_encoder_tile_buffers(RFX_PROGRESSIVE_TILE* tile,
+        INT16* pSign[3], INT16* pCurrent[3])
+{
+	int index;
+
+	for (index = 0; index < 3; index++)
+	{
+		pSign[index] = (INT16*)((BYTE*)(&tile->sign[((8192 + 32) * index) + 16]));
+		pCurrent[index] = (INT16*)((BYTE*)(&tile->current[((8192 + 32) * index) + 16]));
+	}
+}
+
+static BOOL progressive_encoder_load_tile(RFX_PROGRESSIVE_TILE* tile,
+        const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+        BYTE* pTileData, INT16* pDst[3])
+{
+	UINT32 x, y;
+	const BYTE* pPixel;
+	const UINT32 nTileStep = 64 * 4;
+
+	if (!freerdp_image_copy(pTileData, PIXEL_FORMAT_BGRX32, nTileStep, 0, 0,
+	                        tile->width, tile->height, pSrcData, SrcFormat, nSrcStep,
+	                        tile->x, tile->y, NULL, FREERDP_FLIP_NONE))
+		return FALSE;
+
+	/* replicate the right-most column and the bottom-most row of partial tiles */
+	for (y = 0; y < tile->height; y++)
+	{
+		pPixel = &pTileData[(y * nTileStep) + ((tile->width - 1) * 4)];
+
+		for (x = tile->width; x < 64; x++)
+			CopyMemory(&pTileData[(y * nTileStep) + (x * 4)], pPixel, 4);
+	}
+
+	for (y = tile->height; y < 64; y++)
+		CopyMemory(&pTileData[y * nTileStep], &pTileData[(tile->height - 1) * nTileStep],
+		           nTileStep);
+
+	pPixel = pTileData;
+
+	for (y = 0; y < 64 * 64; y++)
+	{
+		pDst[0][y] = pPixel[2]; /* R */
+		pDst[1][y] = pPixel[1]; /* G */
+		pDst[2][y] = pPixel[0]; /* B */
+		pPixel += 4;
+	}
+
+	return TRUE;
+}
+
+static int progressive_compress_tile_first(PROGRESSIVE_CONTEXT* progressive,
+        RFX_PROGRESSIVE_TILE* tile, const BYTE* pSrcData, UINT32 SrcFormat,
+        UINT32 nSrcStep, wStream* s)
+{
+	int index;
+	int status = -1;
+	int length[3];
+	BYTE* pBuffer;
+	BYTE* pTemp;
+	BYTE* pDstData;
+	INT16* pSign[3];
+	INT16* pCurrent[3];
+	INT16* pQuant;
+	size_t blockPos;
+	size_t blockEnd;
+	RFX_COMPONENT_CODEC_QUANT shift;
+	RFX_COMPONENT_CODEC_QUANT* quantProg[3];
+	RFX_COMPONENT_CODEC_QUANT* bitPos[3];
+	RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal;
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+	tile->quality = progressive_encoder_pass_quality[0];
+	quantProgVal = progressive_encoder_get_quant_prog(progressive, tile->quality);
+	quantProg[0] = &(quantProgVal->yQuantValues);
+	quantProg[1] = &(quantProgVal->cbQuantValues);
+	quantProg[2] = &(quantProgVal->crQuantValues);
+	bitPos[0] = &(tile->yBitPos);
+	bitPos[1] = &(tile->cbBitPos);
+	bitPos[2] = &(tile->crBitPos);
+
+	if (!tile->sign)
+		tile->sign = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
+
+	if (!tile->current)
+		tile->current = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
+
+	if (!tile->sign || !tile->current)
+		return -1;
+
+	progressive_encoder_tile_buffers(tile, pSign, pCurrent);
+	pBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pTemp = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pBuffer || !pTemp)
+		goto fail;
+
+	if (!progressive_encoder_load_tile(tile, pSrcData, SrcFormat, nSrcStep, pTemp,
+	                                   pCurrent))
+		goto fail;
+
+	prims->RGBToYCbCr_16s16s_P3P3((const INT16**) pCurrent, 64 * sizeof(INT16),
+	                              pCurrent, 64 * sizeof(INT16), &roi_64x64);
+
+	CopyMemory(&shift, &progressive_encoder_quant, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_rfx_quant_lsub(&shift, 1); /* -6 + 5 = -1 */
+
+	for (index = 0; index < 3; index++)
+	{
+		progressive_rfx_dwt_2d_encode(pCurrent[index], (INT16*) pTemp);
+		progressive_rfx_round_component(&shift, pCurrent[index]);
+	}
+
+	CopyMemory(&(tile->yQuant), &progressive_encoder_quant, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->cbQuant), &progressive_encoder_quant, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->crQuant), &progressive_encoder_quant, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	blockPos = Stream_GetPosition(s);
+
+	if (!Stream_EnsureRemainingCapacity(s, 23))
+		goto fail;
+
+	Stream_Seek(s, 23);
+	pQuant = (INT16*)((BYTE*)(&pBuffer[16]));
+	pDstData = &pBuffer[(8192 + 32) + 16];
+
+	for (index = 0; index < 3; index++)
+	{
+		progressive_rfx_quant_add((RFX_COMPONENT_CODEC_QUANT*) &progressive_encoder_quant,
+		                          quantProg[index], bitPos[index]);
+		progressive_rfx_quant_add((RFX_COMPONENT_CODEC_QUANT*) &progressive_encoder_quant,
+		                          quantProg[index], &shift);
+		progressive_rfx_quant_lsub(&shift, 1); /* -6 + 5 = -1 */
+		length[index] = progressive_rfx_encode_component(&shift, pCurrent[index], pQuant,
+		                pSign[index], pDstData, (8192 + 32) * 2 - 16);
+
+		if ((length[index] <= 0) || (length[index] > 0xFFFF))
+			goto fail;
+
+		if (!Stream_EnsureRemainingCapacity(s, length[index]))
+			goto fail;
+
+		Stream_Write(s, pDstData, length[index]);
+	}
+
+	blockEnd = Stream_GetPosition(s);
+	Stream_SetPosition(s, blockPos);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(blockEnd - blockPos)); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0); /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0); /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0); /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx); /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx); /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0); /* flags (1 byte) */
+	Stream_Write_UINT8(s, tile->quality); /* quality (1 byte) */
+	Stream_Write_UINT16(s, (UINT16) length[0]); /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16) length[1]); /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16) length[2]); /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0); /* tailLen (2 bytes) */
+	Stream_SetPosition(s, blockEnd);
+	tile->pass = 1;
+	status = 1;
+fail:
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	BufferPool_Return(progressive->bufferPool, pTemp);
+	return status;
+}
+
+static int progressive_compress_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
+        RFX_PROGRESSIVE_TILE* tile, wStream* s)
+{
+	int index;
+	int status = -1;
+	BYTE* pSrl;
+	BYTE* pRaw;
+	INT16* pSign[3];
+	INT16* pCurrent[3];
+	UINT32 srlLen[3];
+	UINT32 rawLen[3];
+	size_t blockPos;
+	size_t blockEnd;
+	RFX_COMPONENT_CODEC_QUANT shift;
+	RFX_COMPONENT_CODEC_QUANT numBits;
+	RFX_COMPONENT_CODEC_QUANT newBitPos;
+	RFX_COMPONENT_CODEC_QUANT* quantProg[3];
+	RFX_COMPONENT_CODEC_QUANT* bitPos[3];
+	RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal;
+	tile->quality = progressive_encoder_pass_quality[tile->pass];
+	quantProgVal = progressive_encoder_get_quant_prog(progressive, tile->quality);
+	quantProg[0] = &(quantProgVal->yQuantValues);
+	quantProg[1] = &(quantProgVal->cbQuantValues);
+	quantProg[2] = &(quantProgVal->crQuantValues);
+	bitPos[0] = &(tile->yBitPos);
+	bitPos[1] = &(tile->cbBitPos);
+	bitPos[2] = &(tile->crBitPos);
+	progressive_encoder_tile_buffers(tile, pSign, pCurrent);
+	pSrl = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pRaw = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pSrl || !pRaw)
+		goto fail;
+
+	blockPos = Stream_GetPosition(s);
+
+	if (!Stream_EnsureRemainingCapacity(s, 26))
+		goto fail;
+
+	Stream_Seek(s, 26);
+
+	for (index = 0; index < 3; index++)
+	{
+		progressive_rfx_quant_add((RFX_COMPONENT_CODEC_QUANT*) &progressive_encoder_quant,
+		                          quantProg[index], &newBitPos);
+		progressive_rfx_quant_sub(bitPos[index], &newBitPos, &numBits);
+		CopyMemory(&shift, &newBitPos, sizeof(RFX_COMPONENT_CODEC_QUANT));
+		progressive_rfx_quant_lsub(&shift, 1); /* -6 + 5 = -1 */
+		srlLen[index] = (8192 + 32) * 3;
+		rawLen[index] = (8192 + 32) * 3;
+		progressive_rfx_upgrade_component_encode(&shift, &numBits, pCurrent[index],
+		        pSign[index], pSrl, &srlLen[index], pRaw, &rawLen[index]);
+
+		if ((srlLen[index] > 0xFFFF) || (rawLen[index] > 0xFFFF))
+			goto fail;
+
+		if (!Stream_EnsureRemainingCapacity(s, srlLen[index] + rawLen[index]))
+			goto fail;
+
+		Stream_Write(s, pSrl, srlLen[index]);
+		Stream_Write(s, pRaw, rawLen[index]);
+		CopyMemory(bitPos[index], &newBitPos, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	}
+
+	blockEnd = Stream_GetPosition(s);
+	Stream_SetPosition(s, blockPos);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(blockEnd - blockPos)); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0); /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0); /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0); /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx); /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx); /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, tile->quality); /* quality (1 byte) */
+
+	for (index = 0; index < 3; index++)
+	{
+		Stream_Write_UINT16(s, (UINT16) srlLen[index]); /* srlLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16) rawLen[index]); /* rawLen (2 bytes) */
+	}
+
+	Stream_SetPosition(s, blockEnd);
+	tile->pass++;
+	status = 1;
+fail:
+	BufferPool_Return(progressive->bufferPool, pSrl);
+	BufferPool_Return(progressive->bufferPool, pRaw);
+	return status;
+}
+
+static void progressive_encoder_mark_tiles(PROGRESSIVE_SURFACE_CONTEXT* surface,
+        const REGION16* invalidRegion)
+{
+	UINT32 index;
+	UINT32 nbRects;
+	UINT32 xIdx, yIdx;
+	UINT32 idxLeft, idxTop;
+	UINT32 idxRight, idxBottom;
+	const RECTANGLE_16* rects;
+	RFX_PROGRESSIVE_TILE* tile;
+
+	/* tiles which have not reached the final quality yet are upgraded */
+	for (index = 0; index < surface->gridSize; index++)
+	{
+		tile = &(surface->tiles[index]);
+		tile->blockType = 0;
+
+		if ((tile->pass > 0) && (tile->pass < PROGRESSIVE_ENCODER_NUM_PASSES))
+			tile->blockType = PROGRESSIVE_WBT_TILE_UPGRADE;
+	}
+
+	if (!invalidRegion)
+		return;
+
+	rects = region16_rects(invalidRegion, &nbRects);
+
+	for (index = 0; index < nbRects; index++)
+	{
+		if ((rects[index].left >= surface->width) || (rects[index].top >= surface->height))
+			continue;
+
+		idxLeft = rects[index].left / 64;
+		idxTop = rects[index].top / 64;
+		idxRight = (MIN(rects[index].right, surface->width) + 63) / 64;
+		idxBottom = (MIN(rects[index].bottom, surface->height) + 63) / 64;
+
+		for (yIdx = idxTop; yIdx < idxBottom; yIdx++)
+		{
+			for (xIdx = idxLeft; xIdx < idxRight; xIdx++)
+			{
+				tile = &(surface->tiles[(yIdx * surface->gridWidth) + xIdx]);
+				tile->blockType = PROGRESSIVE_WBT_TILE_FIRST;
+			}
+		}
+	}
+}
+
+static BOOL progressive_write_region(PROGRESSIVE_CONTEXT* progressive,
+                                     PROGRESSIVE_SURFACE_CONTEXT* surface, UINT32 numTiles,
+                                     const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep, wStream* s)
+{
+	BOOL rc = FALSE;
+	int status;
+	UINT32 index;
+	UINT32 numRects;
+	size_t regionPos;
+	size_t tilesPos;
+	size_t regionEnd;
+	REGION16 tilesRegion;
+	RECTANGLE_16 tileRect;
+	const RECTANGLE_16* rects;
+	RFX_PROGRESSIVE_TILE* tile;
+	region16_init(&tilesRegion);
+
+	for (index = 0; index < numTiles; index++)
+	{
+		tile = progressive->tiles[index];
+		tileRect.left = tile->x;
+		tileRect.top = tile->y;
+		tileRect.right = tile->x + tile->width;
+		tileRect.bottom = tile->y + tile->height;
+
+		if (!region16_union_rect(&tilesRegion, &tilesRegion, &tileRect))
+			goto fail;
+	}
+
+	rects = region16_rects(&tilesRegion, &numRects);
+
+	if (!Stream_EnsureRemainingCapacity(s, 18 + (numRects * 8) + 5 +
+	                                    (PROGRESSIVE_ENCODER_NUM_PROG_QUANT * 16)))
+		goto fail;
+
+	regionPos = Stream_GetPosition(s);
+	Stream_Seek(s, 18); /* written once the tiles are encoded */
+
+	for (index = 0; index < numRects; index++)
+	{
+		Stream_Write_UINT16(s, rects[index].left); /* x (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].top); /* y (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].right - rects[index].left); /* width (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].bottom - rects[index].top); /* height (2 bytes) */
+	}
+
+	progressive_component_codec_quant_write(s, &progressive_encoder_quant);
+
+	for (index = 0; index < PROGRESSIVE_ENCODER_NUM_PROG_QUANT; index++)
+	{
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive_encoder_quant_prog[index];
+		Stream_Write_UINT8(s, quantProgVal->quality);
+		progressive_component_codec_quant_write(s, &(quantProgVal->yQuantValues));
+		progressive_component_codec_quant_write(s, &(quantProgVal->cbQuantValues));
+		progressive_component_codec_quant_write(s, &(quantProgVal->crQuantValues));
+	}
+
+	tilesPos = Stream_GetPosition(s);
+
+	for (index = 0; index < numTiles; index++)
+	{
+		tile = progressive->tiles[index];
+
+		if (tile->blockType == PROGRESSIVE_WBT_TILE_FIRST)
+			status = progressive_compress_tile_first(progressive, tile, pSrcData, SrcFormat,
+			         nSrcStep, s);
+		else
+			status = progressive_compress_tile_upgrade(progressive, tile, s);
+
+		if (status < 0)
+			goto fail;
+	}
+
+	regionEnd = Stream_GetPosition(s);
+	Stream_SetPosition(s, regionPos);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(regionEnd - regionPos)); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64); /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, (UINT16) numRects); /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1); /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, PROGRESSIVE_ENCODER_NUM_PROG_QUANT); /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE); /* flags (1 byte) */
+	Stream_Write_UINT16(s, (UINT16) numTiles); /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(regionEnd - tilesPos)); /* tileDataSize (4 bytes) */
+	Stream_SetPosition(s, regionEnd);
+	rc = TRUE;
+fail:
+	region16_uninit(&tilesRegion);
+	return rc;
+}
+
+int progressive_compress(PROGRESSIVE_CONTEXT* progressive,
+                         const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+                         UINT32 nWidth, UINT32 nHeight, const REGION16* invalidRegion,
+                         BYTE** ppDstData, UINT32* pDstSize, UINT16 surfaceId)
+{
+	UINT32 index;
+	UINT32 numTiles;
+	int rc = -1;
+	wStream* s;
+	RFX_PROGRESSIVE_TILE* tile;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+
+	if (!progressive || !progressive->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	PROFILER_TRACE_BEGIN("progressive_compress");
+	*ppDstData = NULL;
+	*pDstSize = 0;
+	surface = (PROGRESSIVE_SURFACE_CONTEXT*) progressive_get_surface_data(
+	              progressive, surfaceId);
+
+	if (surface && ((surface->width != nWidth) || (surface->height != nHeight)))
+	{
+		progressive_delete_surface_context(progressive, surfaceId);
+		surface = NULL;
+	}
+
+	if (!surface)
+	{
+		if (progressive_create_surface_context(progressive, surfaceId, nWidth, nHeight) < 0)
+			goto out;
+
+		surface = (PROGRESSIVE_SURFACE_CONTEXT*) progressive_get_surface_data(
+		              progressive, surfaceId);
+	}
+
+	if (progressive->cTiles < surface->gridSize)
+	{
+		RFX_PROGRESSIVE_TILE** tiles = (RFX_PROGRESSIVE_TILE**) realloc(progressive->tiles,
+		                               surface->gridSize * sizeof(RFX_PROGRESSIVE_TILE*));
+
+		if (!tiles)
+			goto out;
+
+		progressive->tiles = tiles;
+		progressive->cTiles = surface->gridSize;
+	}
+
+	progressive_encoder_mark_tiles(surface, invalidRegion);
+	numTiles = 0;
+
+	for (index = 0; index < surface->gridSize; index++)
+	{
+		tile = &(surface->tiles[index]);
+
+		if (!tile->blockType)
+			continue;
+
+		tile->xIdx = index % surface->gridWidth;
+		tile->yIdx = index / surface->gridWidth;
+		tile->x = tile->xIdx * 64;
+		tile->y = tile->yIdx * 64;
+
+		if ((tile->x >= nWidth) || (tile->y >= nHeight))
+			continue;
+
+		tile->width = MIN(64, nWidth - tile->x);
+		tile->height = MIN(64, nHeight - tile->y);
+		progressive->tiles[numTiles++] = tile;
+	}
+
+	if (!numTiles)
+	{
+		rc = 1;
+		goto out;
+	}
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureRemainingCapacity(s, 12 + 10 + 12))
+		goto out;
+
+	if (surface->frameIndex == 0)
+	{
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_SYNC); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, 12); /* blockLen (4 bytes) */
+		Stream_Write_UINT32(s, 0xCACCACCA); /* magic (4 bytes) */
+		Stream_Write_UINT16(s, 0x0100); /* version (2 bytes) */
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_CONTEXT); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, 10); /* blockLen (4 bytes) */
+		Stream_Write_UINT8(s, 0); /* ctxId (1 byte) */
+		Stream_Write_UINT16(s, 64); /* tileSize (2 bytes) */
+		Stream_Write_UINT8(s, RFX_SUBBAND_DIFFING); /* flags (1 byte) */
+	}
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12); /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, surface->frameIndex); /* frameIndex (4 bytes) */
+	Stream_Write_UINT16(s, 1); /* regionCount (2 bytes) */
+
+	if (!progressive_write_region(progressive, surface, numTiles, pSrcData, SrcFormat,
+	                              nSrcStep, s))
+		goto out;
+
+	if (!Stream_EnsureRemainingCapacity(s, 6))
+		goto out;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_END); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 6); /* blockLen (4 bytes) */
+	surface->frameIndex++;
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32) Stream_GetPosition(s);
+	rc = 1;
+out:
+	PROFILER_TRACE_END("progressive_compress");
+	return rc;
+}
+
+BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
+{
+	if (!progressive)
+		return FALSE;
+
+	return TRUE;
+}
+
+PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
+{
+	PROGRESSIVE_CONTEXT* progressive;
+	progressive = (PROGRESSIVE_CONTEXT*) calloc(1, sizeof(PROGRESSIVE_CONTEXT));
+
+	if (progressive)
+	{
+		progressive->Compressor = Compressor;
+		progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
+		progressive->cRects = 64;
+		progressive->rects = (RFX_RECT*) malloc(progressive->cRects * sizeof(RFX_RECT));
+
+		if (!progressive->rects)
+			goto cleanup;
+
+		progressive->cTiles = 64;
+		progressive->tiles = (RFX_PROGRESSIVE_TILE**) malloc(progressive->cTiles *
+		                     sizeof(RFX_PROGRESSIVE_TILE*));
+
+		if (!progressive->tiles)
+			goto cleanup;
+
+		progressive->cQuant = 8;
+		progressive->quantVals = (RFX_COMPONENT_CODEC_QUANT*) malloc(
+		                             progressive->cQuant * sizeof(RFX_COMPONENT_CODEC_QUANT));
+
+		if (!progressive->quantVals)
+			goto cleanup;
+
+		progressive->cProgQuant = 8;
+		progressive->quantProgVals = (RFX_PROGRESSIVE_CODEC_QUANT*) malloc(
+		                                 progressive->cProgQuant * sizeof(RFX_PROGRESSIVE_CODEC_QUANT));
+
+		if (!progressive->quantProgVals)
+			goto cleanup;
+
+		if (Compressor)
+		{
+			progressive->buffer = Stream_New(NULL, 64 * 64 * 4);
+
+			if (!progressive->buffer)
+				goto cleanup;
+		}
+
+		if (!Compressor)
+		{
+			SYSTEM_INFO sysinfo;
+			GetNativeSystemInfo(&sysinfo);
+			progressive->ThreadCount = sysinfo.dwNumberOfProcessors;
+			progressive->UseThreads = TRUE;
+		}
+
+		if (progressive->UseThreads)
+		{
+			/* initialize the primitives before they are used from the pool threads */
+			primitives_get();
+
+			if (!(progressive->ThreadPool = CreateThreadpool(NULL)))
+				goto cleanup;
+
+			InitializeThreadpoolEnvironment(&progressive->ThreadPoolEnv);
+			SetThreadpoolCallbackPool(&progressive->ThreadPoolEnv, progressive->ThreadPool);
+
+			if (!SetThreadpoolThreadMinimum(progressive->ThreadPool, progressive->ThreadCount))
+				goto cleanup;
+		}
+
+		ZeroMemory(&(progressive->quantProgValFull),
+		           sizeof(RFX_PROGRESSIVE_CODEC_QUANT));
+		progressive->quantProgValFull.quality = 100;
+		progressive->SurfaceContexts = HashTable_New(TRUE);
+		progressive_context_reset(progressive);
+	}
+
+	return progressive;
+cleanup:
+
+	if (progressive->ThreadPool)
+	{
+		CloseThreadpool(progressive->ThreadPool);
+		DestroyThreadpoolEnvironment(&progressive->ThreadPoolEnv);
+	}
+
+	BufferPool_Free(progressive->bufferPool);
+	free(progressive->rects);
+	free(progressive->tiles);
+	free(progressive->quantVals);
+	free(progressive->quantProgVals);
+	Stream_Free(progressive->buffer, TRUE);
+	free(progressive);
+	return NULL;
+}
 
 void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 {
@@ -2022,11 +3213,18 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return;
 
+	if (progressive->ThreadPool)
+	{
+		CloseThreadpool(progressive->ThreadPool);
+		DestroyThreadpoolEnvironment(&progressive->ThreadPoolEnv);
+	}
+
 	BufferPool_Free(progressive->bufferPool);
 	free(progressive->rects);
 	free(progressive->tiles);
 	free(progressive->quantVals);
 	free(progressive->quantProgVals);
+	Stream_Free(progressive->buffer, TRUE);
 	count = HashTable_GetKeys(progressive->SurfaceContexts, &pKeys);
 
 	for (index = 0; index < count; index++)
@@ -52,6 +52,7 @@
 
 #include "rfx_sse2.h"
 #include "rfx_neon.h"
+#include "rfx_avx2.h"
 
 #define TAG FREERDP_TAG("codec")
 
@@ -340,6 +341,9 @@ RFX_CONTEXT* rfx_context_new(BOOL encoder)
 	context->rlgr_decode = rfx_rlgr_decode;
 	context->rlgr_encode = rfx_rlgr_encode;
 	RFX_INIT_SIMD(context);
+#if defined(WITH_AVX2)
+	rfx_init_avx2(context);
+#endif
 	context->state = RFX_STATE_SEND_HEADERS;
 	return context;
 error_threadPool_minimum:
@@ -1009,7 +1013,9 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 	RFX_MESSAGE* message = NULL;
 	wStream* s = NULL;
 	BOOL ok = TRUE;
+	BOOL rc = FALSE;
 	UINT16 expectedDataBlockType = WBT_FRAME_BEGIN;
+	PROFILER_TRACE_BEGIN("rfx_process_message");
 
 	if (!context || !data || !length)
 		goto fail;
@@ -1204,15 +1210,14 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 		}
 
 		region16_uninit(&clippingRects);
-		Stream_Free(s, FALSE);
-		rfx_message_free(context, message);
-		return TRUE;
+		rc = TRUE;
 	}
 
 fail:
 	Stream_Free(s, FALSE);
 	rfx_message_free(context, message);
-	return FALSE;
+	PROFILER_TRACE_END("rfx_process_message");
+	return rc;
 }
 
 UINT16 rfx_message_get_tile_count(RFX_MESSAGE* message)
@@ -1449,6 +1454,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects,
 	if (!(message = (RFX_MESSAGE*)calloc(1, sizeof(RFX_MESSAGE))))
 		return NULL;
 
+	PROFILER_TRACE_BEGIN("rfx_encode_message");
 	region16_init(&tilesRegion);
 	region16_init(&rectsRegion);
 
@@ -1650,6 +1656,7 @@ skip_encoding_loop:
 
 	region16_uninit(&tilesRegion);
 	region16_uninit(&rectsRegion);
+	PROFILER_TRACE_END("rfx_encode_message");
 
 	if (success)
 		return message;
@@ -0,0 +1,447 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RemoteFX Codec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+
+#include "rfx_types.h"
+#include "rfx_avx2.h"
+
+#if defined(WITH_AVX2)
+#include <immintrin.h>
+
+/* The tile buffers come from a BufferPool with 16 byte alignment, so all
+ * 256 bit accesses below are unaligned ones. The arithmetic is the same as
+ * in rfx_sse2.c, the results are bit exact. */
+
+#ifdef _MSC_VER
+#define	__attribute__(...)
+#endif
+
+#ifndef __clang__
+#define ATTRIBUTES  __gnu_inline__, __always_inline__, __artificial__
+#else
+#define ATTRIBUTES __gnu_inline__, __always_inline__
+#endif
+
+#define LOAD256(_ptr) _mm256_loadu_si256((const __m256i*) (_ptr))
+#define STORE256(_ptr, _val) _mm256_storeu_si256((__m256i*) (_ptr), (_val))
+
+/* [first, v[0], ..., v[14]] */
+static __inline __m256i __attribute__((ATTRIBUTES))
+rfx_shift_in_first_avx2(__m256i v, INT16 first)
+{
+	const __m256i carry = _mm256_inserti128_si256(_mm256_set1_epi16(first),
+	                      _mm256_castsi256_si128(v), 1);
+	return _mm256_alignr_epi8(v, carry, 14);
+}
+
+/* [v[1], ..., v[15], last] */
+static __inline __m256i __attribute__((ATTRIBUTES))
+rfx_shift_in_last_avx2(__m256i v, INT16 last)
+{
+	const __m256i carry = _mm256_permute2x128_si256(v, _mm256_set1_epi16(last), 0x21);
+	return _mm256_alignr_epi8(carry, v, 2);
+}
+
+/* [first, v[0], ..., v[6]] */
+static __inline __m128i __attribute__((ATTRIBUTES))
+rfx_shift_in_first_128(__m128i v, INT16 first)
+{
+	return _mm_insert_epi16(_mm_slli_si128(v, 2), first, 0);
+}
+
+/* [v[1], ..., v[7], last] */
+static __inline __m128i __attribute__((ATTRIBUTES))
+rfx_shift_in_last_128(__m128i v, INT16 last)
+{
+	return _mm_insert_epi16(_mm_srli_si128(v, 2), last, 7);
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_quantization_decode_block_avx2(INT16* buffer, const int buffer_size, const UINT32 factor)
+{
+	INT16* ptr;
+	INT16* buf_end = buffer + buffer_size;
+
+	if (factor == 0)
+		return;
+
+	for (ptr = buffer; ptr < buf_end; ptr += 16)
+		STORE256(ptr, _mm256_slli_epi16(LOAD256(ptr), factor));
+}
+
+static void rfx_quantization_decode_avx2(INT16* buffer, const UINT32* quantVals)
+{
+	rfx_quantization_decode_block_avx2(&buffer[0], 1024, quantVals[8] - 1); /* HL1 */
+	rfx_quantization_decode_block_avx2(&buffer[1024], 1024, quantVals[7] - 1); /* LH1 */
+	rfx_quantization_decode_block_avx2(&buffer[2048], 1024, quantVals[9] - 1); /* HH1 */
+	rfx_quantization_decode_block_avx2(&buffer[3072], 256, quantVals[5] - 1); /* HL2 */
+	rfx_quantization_decode_block_avx2(&buffer[3328], 256, quantVals[4] - 1); /* LH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3584], 256, quantVals[6] - 1); /* HH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3840], 64, quantVals[2] - 1); /* HL3 */
+	rfx_quantization_decode_block_avx2(&buffer[3904], 64, quantVals[1] - 1); /* LH3 */
+	rfx_quantization_decode_block_avx2(&buffer[3968], 64, quantVals[3] - 1); /* HH3 */
+	rfx_quantization_decode_block_avx2(&buffer[4032], 64, quantVals[0] - 1); /* LL3 */
+}
+
+/* Applies the band factor and the final >> 5 of rfx_quantization_encode in
+ * a single pass over the buffer. */
+static __inline void __attribute__((ATTRIBUTES))
+rfx_quantization_encode_block_avx2(INT16* buffer, const int buffer_size, const UINT32 factor)
+{
+	INT16* ptr;
+	INT16* buf_end = buffer + buffer_size;
+	const __m256i half5 = _mm256_set1_epi16(1 << 4);
+
+	if (factor == 0)
+	{
+		for (ptr = buffer; ptr < buf_end; ptr += 16)
+			STORE256(ptr, _mm256_srai_epi16(_mm256_add_epi16(LOAD256(ptr), half5), 5));
+	}
+	else
+	{
+		const __m256i half = _mm256_set1_epi16(1 << (factor - 1));
+
+		for (ptr = buffer; ptr < buf_end; ptr += 16)
+		{
+			__m256i a = _mm256_srai_epi16(_mm256_add_epi16(LOAD256(ptr), half), factor);
+			STORE256(ptr, _mm256_srai_epi16(_mm256_add_epi16(a, half5), 5));
+		}
+	}
+}
+
+static void rfx_quantization_encode_avx2(INT16* buffer, const UINT32* quantization_values)
+{
+	rfx_quantization_encode_block_avx2(buffer, 1024, quantization_values[8] - 6); /* HL1 */
+	rfx_quantization_encode_block_avx2(buffer + 1024, 1024, quantization_values[7] - 6); /* LH1 */
+	rfx_quantization_encode_block_avx2(buffer + 2048, 1024, quantization_values[9] - 6); /* HH1 */
+	rfx_quantization_encode_block_avx2(buffer + 3072, 256, quantization_values[5] - 6); /* HL2 */
+	rfx_quantization_encode_block_avx2(buffer + 3328, 256, quantization_values[4] - 6); /* LH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3584, 256, quantization_values[6] - 6); /* HH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3840, 64, quantization_values[2] - 6); /* HL3 */
+	rfx_quantization_encode_block_avx2(buffer + 3904, 64, quantization_values[1] - 6); /* LH3 */
+	rfx_quantization_encode_block_avx2(buffer + 3968, 64, quantization_values[3] - 6); /* HH3 */
+	rfx_quantization_encode_block_avx2(buffer + 4032, 64, quantization_values[0] - 6); /* LL3 */
+}
+
+/* Subband width 8: a row only fills half a register, use the VEX encoded
+ * 128 bit forms. */
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_horiz8_avx2(INT16* l, INT16* h, INT16* dst)
+{
+	int y;
+	const __m128i one = _mm_set1_epi16(1);
+
+	for (y = 0; y < 8; y++)
+	{
+		__m128i l_n, h_n, h_n_m, dst_n, dst_n_p, odd;
+		/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+		l_n = _mm_loadu_si128((const __m128i*) l);
+		h_n = _mm_loadu_si128((const __m128i*) h);
+		h_n_m = rfx_shift_in_first_128(h_n, h[0]);
+		dst_n = _mm_sub_epi16(l_n, _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(h_n, h_n_m), one), 1));
+		/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+		dst_n_p = rfx_shift_in_last_128(dst_n, (INT16) _mm_extract_epi16(dst_n, 7));
+		odd = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(dst_n, dst_n_p), 1),
+		                    _mm_slli_epi16(h_n, 1));
+		_mm_storeu_si128((__m128i*) dst, _mm_unpacklo_epi16(dst_n, odd));
+		_mm_storeu_si128((__m128i*) (dst + 8), _mm_unpackhi_epi16(dst_n, odd));
+		l += 8;
+		h += 8;
+		dst += 16;
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_horiz_avx2(INT16* l, INT16* h, INT16* dst, int subband_width)
+{
+	int y, n;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	for (y = 0; y < subband_width; y++)
+	{
+		/* Even coefficients, stored back into l like the SSE2 version does */
+		for (n = 0; n < subband_width; n += 16)
+		{
+			/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+			const __m256i l_n = LOAD256(&l[n]);
+			const __m256i h_n = LOAD256(&h[n]);
+			const __m256i h_n_m = rfx_shift_in_first_avx2(h_n, (n == 0) ? h[0] : h[n - 1]);
+			const __m256i tmp_n = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(h_n, h_n_m),
+			                                        one), 1);
+			STORE256(&l[n], _mm256_sub_epi16(l_n, tmp_n));
+		}
+
+		/* Odd coefficients */
+		for (n = 0; n < subband_width; n += 16)
+		{
+			/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+			const __m256i h_n = _mm256_slli_epi16(LOAD256(&h[n]), 1);
+			const __m256i dst_n = LOAD256(&l[n]);
+			const __m256i dst_n_p = rfx_shift_in_last_avx2(dst_n,
+			                        (n == subband_width - 16) ? l[n + 15] : l[n + 16]);
+			const __m256i odd = _mm256_add_epi16(_mm256_srai_epi16(_mm256_add_epi16(dst_n, dst_n_p), 1),
+			                                     h_n);
+			const __m256i lo = _mm256_unpacklo_epi16(dst_n, odd);
+			const __m256i hi = _mm256_unpackhi_epi16(dst_n, odd);
+			STORE256(&dst[2 * n], _mm256_permute2x128_si256(lo, hi, 0x20));
+			STORE256(&dst[2 * n + 16], _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+
+		l += subband_width;
+		h += subband_width;
+		dst += 2 * subband_width;
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_vert_avx2(INT16* l, INT16* h, INT16* dst, int subband_width)
+{
+	int x, n;
+	const int total_width = subband_width + subband_width;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	/* Even coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		INT16* l_ptr = &l[n * total_width];
+		INT16* h_ptr = &h[n * total_width];
+		INT16* dst_ptr = &dst[2 * n * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+			const __m256i h_n = LOAD256(&h_ptr[x]);
+			const __m256i h_n_m = (n == 0) ? h_n : LOAD256(&h_ptr[x - total_width]);
+			const __m256i tmp_n = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(h_n, h_n_m),
+			                                        one), 1);
+			STORE256(&dst_ptr[x], _mm256_sub_epi16(LOAD256(&l_ptr[x]), tmp_n));
+		}
+	}
+
+	/* Odd coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		INT16* h_ptr = &h[n * total_width];
+		INT16* dst_ptr = &dst[(2 * n + 1) * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+			const __m256i h_n = _mm256_slli_epi16(LOAD256(&h_ptr[x]), 1);
+			const __m256i dst_n_m = LOAD256(&dst_ptr[x - total_width]);
+			const __m256i dst_n_p = (n == subband_width - 1) ? dst_n_m :
+			                        LOAD256(&dst_ptr[x + total_width]);
+			const __m256i tmp_n = _mm256_srai_epi16(_mm256_add_epi16(dst_n_m, dst_n_p), 1);
+			STORE256(&dst_ptr[x], _mm256_add_epi16(tmp_n, h_n));
+		}
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_avx2(INT16* buffer, INT16* idwt, int subband_width)
+{
+	INT16* hl, *lh, *hh, *ll;
+	INT16* l_dst, *h_dst;
+	/* Inverse DWT in horizontal direction, results in 2 sub-bands in L, H order in tmp buffer idwt. */
+	/* The 4 sub-bands are stored in HL(0), LH(1), HH(2), LL(3) order. */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	l_dst = idwt;
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+	h_dst = idwt + subband_width * subband_width * 2;
+
+	if (subband_width == 8)
+	{
+		rfx_dwt_2d_decode_block_horiz8_avx2(ll, hl, l_dst);
+		rfx_dwt_2d_decode_block_horiz8_avx2(lh, hh, h_dst);
+	}
+	else
+	{
+		rfx_dwt_2d_decode_block_horiz_avx2(ll, hl, l_dst, subband_width);
+		rfx_dwt_2d_decode_block_horiz_avx2(lh, hh, h_dst, subband_width);
+	}
+
+	/* Inverse DWT in vertical direction, results are stored in original buffer. */
+	rfx_dwt_2d_decode_block_vert_avx2(l_dst, h_dst, buffer, subband_width);
+}
+
+static void rfx_dwt_2d_decode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_decode_block_avx2(&buffer[3840], dwt_buffer, 8);
+	rfx_dwt_2d_decode_block_avx2(&buffer[3072], dwt_buffer, 16);
+	rfx_dwt_2d_decode_block_avx2(&buffer[0], dwt_buffer, 32);
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_vert_avx2(INT16* src, INT16* l, INT16* h, int subband_width)
+{
+	int x, n;
+	const int total_width = subband_width << 1;
+
+	for (n = 0; n < subband_width; n++)
+	{
+		for (x = 0; x < total_width; x += 16)
+		{
+			const __m256i src_2n = LOAD256(&src[x]);
+			const __m256i src_2n_1 = LOAD256(&src[x + total_width]);
+			const __m256i src_2n_2 = (n < subband_width - 1) ? LOAD256(&src[x + 2 * total_width]) :
+			                         src_2n;
+			__m256i h_n, h_n_m, l_n;
+			/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+			h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+			h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+			STORE256(&h[x], h_n);
+			h_n_m = (n == 0) ? h_n : LOAD256(&h[x - total_width]);
+			/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+			l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+			STORE256(&l[x], _mm256_add_epi16(l_n, src_2n));
+		}
+
+		src += 2 * total_width;
+		l += total_width;
+		h += total_width;
+	}
+}
+
+/* Subband width 8: the row pair (src[2n], src[2n + 1]) fits in two 128 bit
+ * registers. */
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_horiz8_avx2(INT16* src, INT16* l, INT16* h)
+{
+	int y;
+	/* even words to the low, odd words to the high 8 bytes */
+	const __m128i deinterleave = _mm_set_epi8(15, 14, 11, 10, 7, 6, 3, 2,
+	                             13, 12, 9, 8, 5, 4, 1, 0);
+
+	for (y = 0; y < 8; y++)
+	{
+		const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) src), deinterleave);
+		const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 8)), deinterleave);
+		const __m128i src_2n = _mm_unpacklo_epi64(a, b);
+		const __m128i src_2n_1 = _mm_unpackhi_epi64(a, b);
+		const __m128i src_2n_2 = rfx_shift_in_last_128(src_2n, src[14]);
+		__m128i h_n, h_n_m, l_n;
+		/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+		h_n = _mm_srai_epi16(_mm_add_epi16(src_2n, src_2n_2), 1);
+		h_n = _mm_srai_epi16(_mm_sub_epi16(src_2n_1, h_n), 1);
+		_mm_storeu_si128((__m128i*) h, h_n);
+		h_n_m = rfx_shift_in_first_128(h_n, (INT16) _mm_extract_epi16(h_n, 0));
+		/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+		l_n = _mm_srai_epi16(_mm_add_epi16(h_n_m, h_n), 1);
+		_mm_storeu_si128((__m128i*) l, _mm_add_epi16(l_n, src_2n));
+		src += 16;
+		l += 8;
+		h += 8;
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_horiz_avx2(INT16* src, INT16* l, INT16* h, int subband_width)
+{
+	int y, n;
+	/* per 128 bit lane: even words to the low, odd words to the high 8 bytes */
+	const __m256i deinterleave = _mm256_set_epi8(
+	                                 15, 14, 11, 10, 7, 6, 3, 2, 13, 12, 9, 8, 5, 4, 1, 0,
+	                                 15, 14, 11, 10, 7, 6, 3, 2, 13, 12, 9, 8, 5, 4, 1, 0);
+
+	for (y = 0; y < subband_width; y++)
+	{
+		for (n = 0; n < subband_width; n += 16)
+		{
+			/* a, b: evens in the low lane, odds in the high lane */
+			const __m256i a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(LOAD256(&src[2 * n]),
+			                  deinterleave), 0xD8);
+			const __m256i b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(LOAD256(&src[2 * n + 16]),
+			                  deinterleave), 0xD8);
+			const __m256i src_2n = _mm256_permute2x128_si256(a, b, 0x20);
+			const __m256i src_2n_1 = _mm256_permute2x128_si256(a, b, 0x31);
+			const __m256i src_2n_2 = rfx_shift_in_last_avx2(src_2n,
+			                         (n == subband_width - 16) ? src[2 * n + 30] : src[2 * n + 32]);
+			__m256i h_n, h_n_m, l_n;
+			/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+			h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+			h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+			STORE256(&h[n], h_n);
+			h_n_m = rfx_shift_in_first_avx2(h_n, (n == 0) ? h[0] : h[n - 1]);
+			/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+			l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+			STORE256(&l[n], _mm256_add_epi16(l_n, src_2n));
+		}
+
+		src += 2 * subband_width;
+		l += subband_width;
+		h += subband_width;
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_avx2(INT16* buffer, INT16* dwt, int subband_width)
+{
+	INT16* hl, *lh, *hh, *ll;
+	INT16* l_src, *h_src;
+	/* DWT in vertical direction, results in 2 sub-bands in L, H order in tmp buffer dwt. */
+	l_src = dwt;
+	h_src = dwt + subband_width * subband_width * 2;
+	rfx_dwt_2d_encode_block_vert_avx2(buffer, l_src, h_src, subband_width);
+	/* DWT in horizontal direction, results in 4 sub-bands in HL(0), LH(1), HH(2), LL(3) order, stored in original buffer. */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+
+	if (subband_width == 8)
+	{
+		rfx_dwt_2d_encode_block_horiz8_avx2(l_src, ll, hl);
+		rfx_dwt_2d_encode_block_horiz8_avx2(h_src, lh, hh);
+	}
+	else
+	{
+		rfx_dwt_2d_encode_block_horiz_avx2(l_src, ll, hl, subband_width);
+		rfx_dwt_2d_encode_block_horiz_avx2(h_src, lh, hh, subband_width);
+	}
+}
+
+static void rfx_dwt_2d_encode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_encode_block_avx2(buffer, dwt_buffer, 32);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3072, dwt_buffer, 16);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3840, dwt_buffer, 8);
+}
+
+void rfx_init_avx2(RFX_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	IF_PROFILER(context->priv->prof_rfx_quantization_decode->name = "rfx_quantization_decode_avx2");
+	IF_PROFILER(context->priv->prof_rfx_quantization_encode->name = "rfx_quantization_encode_avx2");
+	IF_PROFILER(context->priv->prof_rfx_dwt_2d_decode->name = "rfx_dwt_2d_decode_avx2");
+	IF_PROFILER(context->priv->prof_rfx_dwt_2d_encode->name = "rfx_dwt_2d_encode_avx2");
+
+	context->quantization_decode = rfx_quantization_decode_avx2;
+	context->quantization_encode = rfx_quantization_encode_avx2;
+	context->dwt_2d_decode = rfx_dwt_2d_decode_avx2;
+	context->dwt_2d_encode = rfx_dwt_2d_encode_avx2;
+}
+
+#endif /* WITH_AVX2 */
@@ -0,0 +1,28 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RemoteFX Codec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RFX_AVX2_H
+#define __RFX_AVX2_H
+
+#include <freerdp/codec/rfx.h>
+#include <freerdp/api.h>
+
+/* Replaces the quantization and DWT routines if the CPU supports AVX2.
+ * Called after RFX_INIT_SIMD, so it overrides the SSE2 versions. */
+FREERDP_LOCAL void rfx_init_avx2(RFX_CONTEXT* context);
+
+#endif /* __RFX_AVX2_H */
@@ -22,12 +22,16 @@
 
 #include <freerdp/codec/rfx.h>
 
+/* MSB first bit writer. Bits are collected in an accumulator and stored a
+ * whole byte at a time, so the output buffer does not need to be zeroed.
+ * Bits that do not fit into the buffer are dropped. */
 struct _RFX_BITSTREAM
 {
 	BYTE* buffer;
-	int nbytes;
-	int byte_pos;
-	int bits_left;
+	UINT32 nbytes;
+	UINT32 byte_pos;
+	UINT64 accumulator;
+	UINT32 pending;
 };
 typedef struct _RFX_BITSTREAM RFX_BITSTREAM;
 
@@ -35,51 +39,31 @@ typedef struct _RFX_BITSTREAM RFX_BITSTREAM;
 	bs->buffer = (BYTE*) (_buffer); \
 	bs->nbytes = (_nbytes); \
 	bs->byte_pos = 0; \
-	bs->bits_left = 8; } while (0)
-
-#define rfx_bitstream_get_bits(bs, _nbits, _r) do { \
-	int nbits = _nbits; \
-	int b; \
-	UINT16 n = 0; \
-	while (bs->byte_pos < bs->nbytes && nbits > 0) \
-	{ \
-		b = nbits; \
-		if (b > bs->bits_left) \
-			b = bs->bits_left; \
-		if (n) \
-			n <<= b; \
-		n |= (bs->buffer[bs->byte_pos] >> (bs->bits_left - b)) & ((1 << b) - 1); \
-		bs->bits_left -= b; \
-		nbits -= b; \
-		if (bs->bits_left == 0) \
-		{ \
-			bs->bits_left = 8; \
-			bs->byte_pos++; \
-		} \
-	} \
-	_r = n; } while (0)
+	bs->accumulator = 0; \
+	bs->pending = 0; } while (0)
 
+/* _nbits must not exceed 32 */
 #define rfx_bitstream_put_bits(bs, _bits, _nbits) do { \
-	UINT16 bits = (_bits); \
-	int nbits = (_nbits); \
-	int b; \
-	while (bs->byte_pos < bs->nbytes && nbits > 0) \
+	UINT32 nbits = (_nbits); \
+	if (nbits) \
 	{ \
-		b = nbits; \
-		if (b > bs->bits_left) \
-			b = bs->bits_left; \
-		bs->buffer[bs->byte_pos] |= ((bits >> (nbits - b)) & ((1 << b) - 1)) << (bs->bits_left - b); \
-		bs->bits_left -= b; \
-		nbits -= b; \
-		if (bs->bits_left == 0) \
+		bs->accumulator = (bs->accumulator << nbits) | \
+			((UINT32) (_bits) & (0xFFFFFFFF >> (32 - nbits))); \
+		bs->pending += nbits; \
+		while (bs->pending >= 8) \
 		{ \
-			bs->bits_left = 8; \
-			bs->byte_pos++; \
+			bs->pending -= 8; \
+			if (bs->byte_pos < bs->nbytes) \
+				bs->buffer[bs->byte_pos++] = (BYTE) (bs->accumulator >> bs->pending); \
 		} \
 	} } while (0)
 
-#define rfx_bitstream_eos(_bs) ((_bs)->byte_pos >= (_bs)->nbytes)
-#define rfx_bitstream_left(_bs) ((_bs)->byte_pos >= (_bs)->nbytes ? 0 : ((_bs)->nbytes - (_bs)->byte_pos - 1) * 8 + (_bs)->bits_left)
-#define rfx_bitstream_get_processed_bytes(_bs) ((_bs)->bits_left < 8 ? (_bs)->byte_pos + 1 : (_bs)->byte_pos)
+/* Pads the last partial byte with zero bits and writes it out */
+#define rfx_bitstream_flush(bs) do { \
+	if (bs->pending && (bs->byte_pos < bs->nbytes)) \
+		bs->buffer[bs->byte_pos++] = (BYTE) (bs->accumulator << (8 - bs->pending)); \
+	bs->pending = 0; } while (0)
+
+#define rfx_bitstream_get_processed_bytes(_bs) ((_bs)->byte_pos)
 
 #endif /* __RFX_BITSTREAM_H */
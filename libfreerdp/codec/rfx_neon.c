@@ -66,6 +66,43 @@ void rfx_quantization_decode_NEON(INT16 * buffer, const UINT32 * quantVals)
 }
 
 
+/* Applies the band factor and the final >> 5 of rfx_quantization_encode in
+ * one pass, vshlq_s16 with a negative count is an arithmetic right shift. */
+static __inline void __attribute__((__gnu_inline__, __always_inline__, __artificial__))
+rfx_quantization_encode_block_NEON(INT16 * buffer, const int buffer_size, const UINT32 factor)
+{
+	int16x8_t half = vdupq_n_s16(factor ? (1 << (factor - 1)) : 0);
+	int16x8_t quantFactors = vdupq_n_s16(-((INT16) factor));
+	int16x8_t half5 = vdupq_n_s16(1 << 4);
+	int16x8_t* buf = (int16x8_t*)buffer;
+	int16x8_t* buf_end = (int16x8_t*)(buffer + buffer_size);
+
+	do
+	{
+		int16x8_t val = vld1q_s16((INT16*)buf);
+		val = vshlq_s16(vaddq_s16(val, half), quantFactors);
+		val = vshrq_n_s16(vaddq_s16(val, half5), 5);
+		vst1q_s16((INT16*)buf, val);
+		buf++;
+	}
+	while(buf < buf_end);
+}
+
+void rfx_quantization_encode_NEON(INT16 * buffer, const UINT32 * quantVals)
+{
+	rfx_quantization_encode_block_NEON(&buffer[0], 1024, quantVals[8] - 6); /* HL1 */
+	rfx_quantization_encode_block_NEON(&buffer[1024], 1024, quantVals[7] - 6); /* LH1 */
+	rfx_quantization_encode_block_NEON(&buffer[2048], 1024, quantVals[9] - 6); /* HH1 */
+	rfx_quantization_encode_block_NEON(&buffer[3072], 256, quantVals[5] - 6); /* HL2 */
+	rfx_quantization_encode_block_NEON(&buffer[3328], 256, quantVals[4] - 6); /* LH2 */
+	rfx_quantization_encode_block_NEON(&buffer[3584], 256, quantVals[6] - 6); /* HH2 */
+	rfx_quantization_encode_block_NEON(&buffer[3840], 64, quantVals[2] - 6); /* HL3 */
+	rfx_quantization_encode_block_NEON(&buffer[3904], 64, quantVals[1] - 6); /* LH3 */
+	rfx_quantization_encode_block_NEON(&buffer[3968], 64, quantVals[3] - 6); /* HH3 */
+	rfx_quantization_encode_block_NEON(&buffer[4032], 64, quantVals[0] - 6); /* LL3 */
+}
+
+
 
 static __inline void __attribute__((__gnu_inline__, __always_inline__, __artificial__))
 rfx_dwt_2d_decode_block_horiz_NEON(INT16 * l, INT16 * h, INT16 * dst, int subband_width)
@@ -254,9 +291,11 @@ void rfx_init_neon(RFX_CONTEXT * context)
 
 		IF_PROFILER(context->priv->prof_rfx_ycbcr_to_rgb->name = "rfx_decode_YCbCr_to_RGB_NEON");
 		IF_PROFILER(context->priv->prof_rfx_quantization_decode->name = "rfx_quantization_decode_NEON");
+		IF_PROFILER(context->priv->prof_rfx_quantization_encode->name = "rfx_quantization_encode_NEON");
 		IF_PROFILER(context->priv->prof_rfx_dwt_2d_decode->name = "rfx_dwt_2d_decode_NEON");
 
 		context->quantization_decode = rfx_quantization_decode_NEON;
+		context->quantization_encode = rfx_quantization_encode_NEON;
 		context->dwt_2d_decode = rfx_dwt_2d_decode_NEON;
 	}
 }
@@ -33,7 +33,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/sysinfo.h>
-#include <winpr/bitstream.h>
 #include <winpr/intrin.h>
 
 #include "rfx_bitstream.h"
@@ -96,13 +95,139 @@ static INLINE UINT32 lzcnt_s(UINT32 x)
 	return __lzcnt(x);
 }
 
+/*
+ * MSB first bit reader for the decoder. At least 49 and at most 63 bits are
+ * kept left aligned in the accumulator after a refill, which loads a whole
+ * word at a time where the input allows it. Bits past the end of the input
+ * read as zero, remaining counts the bits of real input that are left.
+ */
+struct _RFX_RLGR_READER
+{
+	const BYTE* data;
+	UINT32 size;
+	UINT32 pos;
+	UINT64 accumulator;
+	UINT32 avail;
+	UINT32 remaining;
+};
+typedef struct _RFX_RLGR_READER RFX_RLGR_READER;
+
+static INLINE void rfx_rlgr_reader_refill(RFX_RLGR_READER* r)
+{
+	if (r->avail > 48)
+		return;
+
+	if (r->pos + 8 <= r->size)
+	{
+		const BYTE* p = &r->data[r->pos];
+		const UINT32 count = (63 - r->avail) >> 3;
+		const UINT64 v = ((UINT64) p[0] << 56) | ((UINT64) p[1] << 48) |
+		                 ((UINT64) p[2] << 40) | ((UINT64) p[3] << 32) |
+		                 ((UINT64) p[4] << 24) | ((UINT64) p[5] << 16) |
+		                 ((UINT64) p[6] << 8) | ((UINT64) p[7]);
+		r->accumulator |= v >> r->avail;
+		r->pos += count;
+		r->avail += count << 3;
+		return;
+	}
+
+	while (r->avail <= 48)
+	{
+		if (r->pos < r->size)
+			r->accumulator |= ((UINT64) r->data[r->pos]) << (56 - r->avail);
+
+		r->pos++;
+		r->avail += 8;
+	}
+}
+
+static INLINE void rfx_rlgr_reader_skip(RFX_RLGR_READER* r, UINT32 nbits)
+{
+	r->accumulator <<= nbits;
+	r->avail -= nbits;
+	r->remaining -= nbits;
+}
+
+/* nbits must not exceed 32 or r->remaining */
+static INLINE UINT32 rfx_rlgr_reader_read(RFX_RLGR_READER* r, UINT32 nbits)
+{
+	UINT32 bits;
+
+	if (!nbits)
+		return 0;
+
+	rfx_rlgr_reader_refill(r);
+	bits = (UINT32) (r->accumulator >> (64 - nbits));
+	rfx_rlgr_reader_skip(r, nbits);
+	return bits;
+}
+
+static INLINE UINT32 lzcnt64_s(UINT64 x)
+{
+	const UINT32 hi = (UINT32) (x >> 32);
+
+	if (hi)
+		return lzcnt_s(hi);
+
+	return 32 + lzcnt_s((UINT32) x);
+}
+
+/*
+ * Consumes the run of leading 0 (or 1) bits and returns its length, clamped
+ * to the remaining input. The terminating bit is not consumed.
+ */
+static INLINE UINT32 rfx_rlgr_reader_count(RFX_RLGR_READER* r, BOOL ones)
+{
+	UINT32 count = 0;
+
+	for (;;)
+	{
+		UINT32 cnt;
+		UINT32 limit;
+		rfx_rlgr_reader_refill(r);
+		limit = (r->avail < r->remaining) ? r->avail : r->remaining;
+		cnt = lzcnt64_s(ones ? ~r->accumulator : r->accumulator);
+
+		if (cnt > limit)
+			cnt = limit;
+
+		rfx_rlgr_reader_skip(r, cnt);
+		count += cnt;
+
+		if ((cnt < limit) || !r->remaining)
+			return count;
+	}
+}
+
+/*
+ * Updates kp for a run of vk zero bits in RL mode, adding (1 << k) to the
+ * run length for each of them. Once kp saturates k is constant, so the rest
+ * of the run is added at once.
+ */
+static INLINE UINT32 rfx_rlgr_run_length(UINT32 vk, int* kp, int* k)
+{
+	UINT32 run = 0;
+
+	while (vk && (*kp < KPMAX))
+	{
+		run += (1 << *k);
+		*kp += UP_GR;
+
+		if (*kp > KPMAX)
+			*kp = KPMAX;
+
+		*k = *kp >> LSGR;
+		vk--;
+	}
+
+	return run + (vk << *k);
+}
+
 int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16* pDstData, UINT32 DstSize)
 {
-	int vk;
-	int run;
-	int cnt;
+	UINT32 vk;
+	UINT32 run;
 	int size;
-	int nbits;
 	int offset;
 	INT16 mag;
 	int k, kp;
@@ -113,8 +238,7 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	UINT32 val1;
 	UINT32 val2;
 	INT16* pOutput;
-	wBitStream* bs;
-	wBitStream s_bs;
+	RFX_RLGR_READER r;
 
 	g_LZCNT = IsProcessorFeaturePresentEx(PF_EX_LZCNT);
 
@@ -135,122 +259,59 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 	pOutput = pDstData;
 
-	bs = &s_bs;
-
-	BitStream_Attach(bs, pSrcData, SrcSize);
-	BitStream_Fetch(bs);
+	r.data = pSrcData;
+	r.size = SrcSize;
+	r.pos = 0;
+	r.accumulator = 0;
+	r.avail = 0;
+	r.remaining = SrcSize * 8;
 
-	while ((BitStream_GetRemainingLength(bs) > 0) && ((pOutput - pDstData) < DstSize))
+	while ((r.remaining > 0) && ((pOutput - pDstData) < DstSize))
 	{
 		if (k)
 		{
 			/* Run-Length (RL) Mode */
 
-			run = 0;
-
 			/* count number of leading 0s */
 
-			cnt = lzcnt_s(bs->accumulator);
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(bs->accumulator);
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
+			vk = rfx_rlgr_reader_count(&r, FALSE);
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.remaining < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(&r, 1);
 
-			while (vk--)
-			{
-				run += (1 << k); /* add (1 << k) to run length */
-
-				/* update k, kp params */
-
-				kp += UP_GR;
-
-				if (kp > KPMAX)
-					kp = KPMAX;
-
-				k = kp >> LSGR;
-			}
+			run = rfx_rlgr_run_length(vk, &kp, &k);
 
 			/* next k bits contain run length remainder */
 
-			if (BitStream_GetRemainingLength(bs) < k)
+			if (r.remaining < (UINT32) k)
 				break;
 
-			bs->mask = ((1 << k) - 1);
-			run += ((bs->accumulator >> (32 - k)) & bs->mask);
-			BitStream_Shift(bs, k);
+			run += rfx_rlgr_reader_read(&r, k);
 
 			/* read sign bit */
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.remaining < 1)
 				break;
 
-			sign = (bs->accumulator & 0x80000000) ? 1 : 0;
-			BitStream_Shift(bs, 1);
+			sign = rfx_rlgr_reader_read(&r, 1);
 
 			/* count number of leading 1s */
 
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
+			vk = rfx_rlgr_reader_count(&r, TRUE);
 
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.remaining < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(&r, 1);
 
 			/* next kr bits contain code remainder */
 
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (r.remaining < (UINT32) kr)
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
+			code = (UINT16) rfx_rlgr_reader_read(&r, kr);
 
 			/* add (vk << kr) to code */
 
@@ -321,44 +382,19 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* count number of leading 1s */
 
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
+			vk = rfx_rlgr_reader_count(&r, TRUE);
 
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.remaining < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(&r, 1);
 
 			/* next kr bits contain code remainder */
 
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (r.remaining < (UINT32) kr)
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
+			code = (UINT16) rfx_rlgr_reader_read(&r, kr);
 
 			/* add (vk << kr) to code */
 
@@ -435,17 +471,12 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				nIdx = 0;
 
 				if (code)
-				{
-					mag = (UINT32) code;
-					nIdx = 32 - lzcnt_s(mag);
-				}
+					nIdx = 32 - lzcnt_s(code);
 
-				if (BitStream_GetRemainingLength(bs) < nIdx)
+				if (r.remaining < nIdx)
 					break;
 
-				bs->mask = ((1 << nIdx) - 1);
-				val1 = ((bs->accumulator >> (32 - nIdx)) & bs->mask);
-				BitStream_Shift(bs, nIdx);
+				val1 = rfx_rlgr_reader_read(&r, nIdx);
 
 				val2 = code - val1;
 
@@ -534,10 +565,10 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 /* Emit a bit (0 or 1), count number of times, to the output bitstream */
 #define OutputBit(count, bit) \
 {	\
-	UINT16 _b = (bit ? 0xFFFF : 0); \
+	UINT32 _b = (bit ? 0xFFFFFFFF : 0); \
 	int _c = (count); \
-	for (; _c > 0; _c -= 16) \
-		rfx_bitstream_put_bits(bs, _b, (_c > 16 ? 16 : _c)); \
+	for (; _c > 0; _c -= 32) \
+		rfx_bitstream_put_bits(bs, _b, (_c > 32 ? 32 : _c)); \
 }
 
 /* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 : 0) and returns it */
@@ -553,13 +584,17 @@ static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
 	/* unary part of GR code */
 
 	UINT32 vk = (val) >> kr;
-	OutputBit(vk, 1);
-	OutputBit(1, 0);
 
-	/* remainder part of GR code, if needed */
-	if (kr)
+	/* the unary part, its terminating zero and the kr remainder bits
+	 * (kr <= KPMAX >> LSGR) usually fit into a single write */
+	if (vk + 1 + kr <= 32)
+	{
+		OutputBits(vk + 1 + kr, (((1U << vk) - 1) << (kr + 1)) | (val & ((1 << kr) - 1)));
+	}
+	else
 	{
-		OutputBits(kr, val & ((1 << kr) - 1));
+		OutputBit(vk, 1);
+		OutputBits(kr + 1, val & ((1 << kr) - 1));
 	}
 
 	/* update krp, only if it is not equal to 1 */
@@ -579,11 +614,9 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	int kp;
 	int krp;
 	RFX_BITSTREAM* bs;
-	int processed_size;
-
-	if (!(bs = (RFX_BITSTREAM*) calloc(1, sizeof(RFX_BITSTREAM))))
-		return 0;
+	RFX_BITSTREAM s_bs;
 
+	bs = &s_bs;
 	rfx_bitstream_attach(bs, buffer, buffer_size);
 
 	/* initialize the parameters */
@@ -599,6 +632,7 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		if (k)
 		{
 			int numZeros;
+			int zeroBits;
 			int runmax;
 			int mag;
 			int sign;
@@ -616,19 +650,16 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 
 			// emit output zeros
 			runmax = 1 << k;
+			zeroBits = 0;
 			while (numZeros >= runmax)
 			{
-				OutputBit(1, 0); /* output a zero bit */
+				zeroBits++; /* output a zero bit */
 				numZeros -= runmax;
 				UpdateParam(kp, UP_GR, k); /* update kp, k */
 				runmax = 1 << k;
 			}
 
-			/* output a 1 to terminate runs */
-			OutputBit(1, 1);
-
-			/* output the remaining run length using k bits */
-			OutputBits(k, numZeros);
+			OutputBit(zeroBits, 0);
 
 			/* note: when we reach here and the last byte being encoded is 0, we still
 			   need to output the last two bits, otherwise mstsc will crash */
@@ -637,7 +668,9 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			mag = (input < 0 ? -input : input); /* absolute value of input coefficient */
 			sign = (input < 0 ? 1 : 0);  /* sign of input coefficient */
 
-			OutputBit(1, sign); /* output the sign bit */
+			/* output a 1 to terminate runs, the remaining run length
+			 * using k bits and the sign bit */
+			OutputBits(k + 2, (((1 << k) | numZeros) << 1) | sign);
 			CodeGR(&krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
 
 			UpdateParam(kp, -DN_GR, k);
@@ -707,8 +740,6 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		}
 	}
 
-	processed_size = rfx_bitstream_get_processed_bytes(bs);
-	free(bs);
-
-	return processed_size;
+	rfx_bitstream_flush(bs);
+	return rfx_bitstream_get_processed_bytes(bs);
 }
@@ -0,0 +1,265 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/codec/mppc.h>
+#include <freerdp/codec/ncrush.h>
+#include <freerdp/codec/xcrush.h>
+
+/**
+ * Compression speed against ratio of the bulk compressors.
+ *
+ * TestFreeRDPCodec TestFreeRDPCodecBulk [file]
+ *
+ * Without a file a synthetic corpus of text, bitmap rows and noise is used.
+ * A file is taken as captured uncompressed update data and cut into packets
+ * of the size fastpath fragments have, MPPC-8K packets fit its history.
+ */
+
+#define TEST_BULK_PACKET_SIZE 16000
+#define TEST_BULK_PACKET_SIZE_8K 8000
+#define TEST_BULK_CORPUS_SIZE (2 * 1024 * 1024)
+
+typedef struct
+{
+	const char* name;
+	UINT32 level;
+	UINT32 packetSize;
+	MPPC_CONTEXT* mppcSend;
+	MPPC_CONTEXT* mppcRecv;
+	NCRUSH_CONTEXT* ncrushSend;
+	NCRUSH_CONTEXT* ncrushRecv;
+	XCRUSH_CONTEXT* xcrushSend;
+	XCRUSH_CONTEXT* xcrushRecv;
+} TEST_BULK_ENGINE;
+
+static BYTE* test_bulk_synthetic_corpus(UINT32* size)
+{
+	UINT32 offset = 0;
+	UINT32 block = 0;
+	static const char text[] =
+		"No man is an island entire of itself; every man is a piece of the continent, "
+		"a part of the main; if a clod be washed away by the sea, Europe is the less. ";
+	BYTE* data = (BYTE*) malloc(TEST_BULK_CORPUS_SIZE);
+
+	if (!data)
+		return NULL;
+
+	while (offset < TEST_BULK_CORPUS_SIZE)
+	{
+		UINT32 i;
+		const UINT32 length = MIN(4096, TEST_BULK_CORPUS_SIZE - offset);
+		BYTE* p = &data[offset];
+
+		switch (block++ % 4)
+		{
+			case 0:
+				for (i = 0; i < length; i++)
+					p[i] = (BYTE) text[(i + block) % (sizeof(text) - 1)];
+
+				break;
+
+			case 1:
+			case 2:
+				/* a gradient with a few solid runs, like a window being drawn */
+				for (i = 0; i < length; i++)
+					p[i] = ((i / 64) % 3) ? (BYTE)(i / 4 + block) : 0xFF;
+
+				break;
+
+			default:
+				winpr_RAND(p, length);
+				break;
+		}
+
+		offset += length;
+	}
+
+	*size = TEST_BULK_CORPUS_SIZE;
+	return data;
+}
+
+static BYTE* test_bulk_file_corpus(const char* filename, UINT32* size)
+{
+	FILE* fp;
+	long length;
+	BYTE* data = NULL;
+
+	if (!(fp = fopen(filename, "rb")))
+		return NULL;
+
+	if ((fseek(fp, 0, SEEK_END) != 0) || ((length = ftell(fp)) <= 0) ||
+	    (fseek(fp, 0, SEEK_SET) != 0))
+		goto out;
+
+	if (!(data = (BYTE*) malloc(length)))
+		goto out;
+
+	if (fread(data, 1, length, fp) != (size_t) length)
+	{
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	*size = (UINT32) length;
+out:
+	fclose(fp);
+	return data;
+}
+
+static int test_bulk_compress(TEST_BULK_ENGINE* engine, BYTE* pSrcData, UINT32 SrcSize,
+                              BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+{
+	if (engine->mppcSend)
+		return mppc_compress(engine->mppcSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
+
+	if (engine->ncrushSend)
+		return ncrush_compress(engine->ncrushSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
+
+	return xcrush_compress(engine->xcrushSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
+}
+
+static int test_bulk_decompress(TEST_BULK_ENGINE* engine, BYTE* pSrcData, UINT32 SrcSize,
+                                BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
+{
+	/* uncompressed packets that did not flush the history are taken as they are */
+	if (!(flags & (PACKET_COMPRESSED | PACKET_FLUSHED)))
+	{
+		*ppDstData = pSrcData;
+		*pDstSize = SrcSize;
+		return 0;
+	}
+
+	if (engine->mppcRecv)
+		return mppc_decompress(engine->mppcRecv, pSrcData, SrcSize, ppDstData, pDstSize, flags);
+
+	if (engine->ncrushRecv)
+		return ncrush_decompress(engine->ncrushRecv, pSrcData, SrcSize, ppDstData, pDstSize, flags);
+
+	return xcrush_decompress(engine->xcrushRecv, pSrcData, SrcSize, ppDstData, pDstSize, flags);
+}
+
+static BOOL test_bulk_engine(TEST_BULK_ENGINE* engine, BYTE* data, UINT32 size)
+{
+	UINT32 offset;
+	UINT64 start;
+	UINT64 compressTicks = 0;
+	UINT64 decompressTicks = 0;
+	UINT64 compressedBytes = 0;
+	BYTE* buffer = (BYTE*) malloc(TEST_BULK_PACKET_SIZE * 2);
+
+	if (!buffer)
+		return FALSE;
+
+	for (offset = 0; offset < size; offset += engine->packetSize)
+	{
+		int status;
+		UINT32 Flags = 0;
+		BYTE* pSrcData = &data[offset];
+		const UINT32 SrcSize = MIN(engine->packetSize, size - offset);
+		BYTE* pDstData = buffer;
+		UINT32 DstSize = TEST_BULK_PACKET_SIZE * 2;
+		BYTE* pPlainData = NULL;
+		UINT32 PlainSize = 0;
+		start = GetTickCount64();
+		status = test_bulk_compress(engine, pSrcData, SrcSize, &pDstData, &DstSize, &Flags);
+		compressTicks += GetTickCount64() - start;
+
+		if (status < 0)
+		{
+			printf("%s: compression failed with %d at offset %u\n", engine->name, status,
+			       (unsigned) offset);
+			goto fail;
+		}
+
+		if (!(Flags & PACKET_COMPRESSED))
+			DstSize = SrcSize;
+
+		compressedBytes += DstSize;
+		start = GetTickCount64();
+		status = test_bulk_decompress(engine, pDstData, DstSize, &pPlainData, &PlainSize,
+		                              Flags | engine->level);
+		decompressTicks += GetTickCount64() - start;
+
+		if ((status < 0) || (PlainSize != SrcSize) || (memcmp(pPlainData, pSrcData, SrcSize) != 0))
+		{
+			printf("%s: roundtrip mismatch at offset %u flags 0x%04X\n", engine->name,
+			       (unsigned) offset, (unsigned) Flags);
+			goto fail;
+		}
+	}
+
+	printf("%-8s ratio %5.3f compress %7.1f MB/s decompress %7.1f MB/s\n", engine->name,
+	       (double) compressedBytes / size,
+	       (double) size / (compressTicks ? compressTicks : 1) / 1000.0,
+	       (double) size / (decompressTicks ? decompressTicks : 1) / 1000.0);
+	free(buffer);
+	return TRUE;
+fail:
+	free(buffer);
+	return FALSE;
+}
+
+int TestFreeRDPCodecBulk(int argc, char* argv[])
+{
+	int rc = 0;
+	UINT32 i;
+	UINT32 size = 0;
+	BYTE* data;
+	TEST_BULK_ENGINE engines[4];
+	ZeroMemory(engines, sizeof(engines));
+	engines[0].name = "MPPC-8K";
+	engines[0].level = PACKET_COMPR_TYPE_8K;
+	engines[0].packetSize = TEST_BULK_PACKET_SIZE_8K;
+	engines[0].mppcSend = mppc_context_new(0, TRUE);
+	engines[0].mppcRecv = mppc_context_new(0, FALSE);
+	engines[1].name = "MPPC-64K";
+	engines[1].level = PACKET_COMPR_TYPE_64K;
+	engines[1].packetSize = TEST_BULK_PACKET_SIZE;
+	engines[1].mppcSend = mppc_context_new(1, TRUE);
+	engines[1].mppcRecv = mppc_context_new(1, FALSE);
+	engines[2].name = "NCrush";
+	engines[2].level = PACKET_COMPR_TYPE_RDP6;
+	engines[2].packetSize = TEST_BULK_PACKET_SIZE;
+	engines[2].ncrushSend = ncrush_context_new(TRUE);
+	engines[2].ncrushRecv = ncrush_context_new(FALSE);
+	engines[3].name = "XCrush";
+	engines[3].level = PACKET_COMPR_TYPE_RDP61;
+	engines[3].packetSize = TEST_BULK_PACKET_SIZE;
+	engines[3].xcrushSend = xcrush_context_new(TRUE);
+	engines[3].xcrushRecv = xcrush_context_new(FALSE);
+
+	if (argc > 1)
+		data = test_bulk_file_corpus(argv[1], &size);
+	else
+		data = test_bulk_synthetic_corpus(&size);
+
+	if (!data)
+		rc = -1;
+
+	for (i = 0; (rc == 0) && (i < 4); i++)
+	{
+		if ((!engines[i].mppcSend || !engines[i].mppcRecv) &&
+		    (!engines[i].ncrushSend || !engines[i].ncrushRecv) &&
+		    (!engines[i].xcrushSend || !engines[i].xcrushRecv))
+			rc = -1;
+		else if (!test_bulk_engine(&engines[i], data, size))
+			rc = -1;
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		mppc_context_free(engines[i].mppcSend);
+		mppc_context_free(engines[i].mppcRecv);
+		ncrush_context_free(engines[i].ncrushSend);
+		ncrush_context_free(engines[i].ncrushRecv);
+		xcrush_context_free(engines[i].xcrushSend);
+		xcrush_context_free(engines[i].xcrushRecv);
+	}
+
+	free(data);
+	return rc;
+}
@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/codec/clear.h>
 
@@ -65,8 +66,233 @@ static BOOL test_ClearDecompressExample(UINT32 nr, const BYTE* pSrcData,
 	return TRUE;
 }
 
+static void test_ClearFillImage(BYTE* data, UINT32 width, UINT32 height, UINT32 step)
+{
+	UINT32 x, y;
+	UINT32 seed = 1234;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &data[y * step + x * 4];
+			BYTE value = 0xF0;
+
+			/* text like area: repeated glyphs with a few gray levels */
+			if ((y >= 10) && (y < 22) && (x >= 10) && (x < 250))
+			{
+				const UINT32 gx = (x - 10) % 8;
+				const UINT32 gy = y - 10;
+				const UINT32 glyph = ((x - 10) / 8) % 3;
+
+				if (((gx + gy * glyph) % 5) == 0)
+					value = 0x20;
+				else if (((gx * gy + glyph) % 7) == 0)
+					value = 0x80;
+			}
+
+			pixel[0] = pixel[1] = pixel[2] = value;
+			pixel[3] = 0xFF;
+
+			/* low color noise */
+			if ((y >= 60) && (y < 100) && (x >= 20) && (x < 120))
+			{
+				seed = seed * 1103515245 + 12345;
+				pixel[0] = ((seed >> 16) % 40) * 6;
+				pixel[1] = 0x40;
+				pixel[2] = 0x10;
+			}
+
+			/* small area with many colors */
+			if ((y >= 100) && (y < 140) && (x >= 200) && (x < 220))
+			{
+				pixel[0] = (BYTE)(x * 7 + y);
+				pixel[1] = (BYTE)(y * 5);
+				pixel[2] = (BYTE)(x * 3 + y * 11);
+			}
+		}
+	}
+}
+
+static BOOL test_ClearCompareImage(const BYTE* a, const BYTE* b, UINT32 width, UINT32 height,
+                                   UINT32 step)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			const BYTE* pa = &a[y * step + x * 4];
+			const BYTE* pb = &b[y * step + x * 4];
+
+			if ((pa[0] != pb[0]) || (pa[1] != pb[1]) || (pa[2] != pb[2]))
+			{
+				fprintf(stderr, "pixel mismatch at %u,%u\n", (unsigned) x, (unsigned) y);
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_ClearRoundTrip(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder,
+                                const BYTE* pSrcData, UINT32 width, UINT32 height, UINT32 step,
+                                BYTE* pDstData, UINT32* pSize)
+{
+	BYTE* pData = NULL;
+	UINT32 size = 0;
+
+	if (clear_compress(encoder, pSrcData, PIXEL_FORMAT_BGRX32, step, width, height,
+	                   &pData, &size) < 0)
+		return FALSE;
+
+	if (clear_decompress(decoder, pData, size, width, height, pDstData, PIXEL_FORMAT_BGRX32,
+	                     step, 0, 0, width, height, NULL) < 0)
+		return FALSE;
+
+	*pSize = size;
+	return test_ClearCompareImage(pSrcData, pDstData, width, height, step);
+}
+
+static BOOL test_ClearEncodeDecode(void)
+{
+	BOOL rc = FALSE;
+	UINT32 size1, size2, size3;
+	const UINT32 width = 320;
+	const UINT32 height = 140;
+	const UINT32 step = width * 4;
+	BYTE* pSrcData = (BYTE*) calloc(height, step);
+	BYTE* pDstData = (BYTE*) calloc(height, step);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!pSrcData || !pDstData || !encoder || !decoder)
+		goto fail;
+
+	test_ClearFillImage(pSrcData, width, height, step);
+
+	if (!test_ClearRoundTrip(encoder, decoder, pSrcData, width, height, step, pDstData, &size1))
+		goto fail;
+
+	/* the same content again only hits the vbar caches */
+	ZeroMemory(pDstData, height * step);
+
+	if (!test_ClearRoundTrip(encoder, decoder, pSrcData, width, height, step, pDstData, &size2))
+		goto fail;
+
+	/* a small bitmap is a glyph, the second time only its index is sent */
+	if (!test_ClearRoundTrip(encoder, decoder, &pSrcData[10 * step + 10 * 4], 24, 12, step,
+	                         &pDstData[10 * step + 10 * 4], &size3))
+		goto fail;
+
+	if (!test_ClearRoundTrip(encoder, decoder, &pSrcData[10 * step + 10 * 4], 24, 12, step,
+	                         &pDstData[10 * step + 10 * 4], &size3))
+		goto fail;
+
+	printf("clear encode: %u bytes, again %u bytes, glyph hit %u bytes (raw %u)\n",
+	       (unsigned) size1, (unsigned) size2, (unsigned) size3, (unsigned)(width * height * 3));
+
+	if ((size1 >= width * height * 3) || (size2 >= size1) || (size3 != 4))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	free(pSrcData);
+	free(pDstData);
+	return rc;
+}
+
+/* Replays captured streams, a full frame followed by one that only hits the
+ * vbar caches, into a 32 and a 16 bpp surface */
+static BOOL test_ClearDecodeThroughput(void)
+{
+	UINT32 i, f;
+	BOOL rc = FALSE;
+	const UINT32 width = 320;
+	const UINT32 height = 140;
+	const UINT32 step = width * 4;
+	const UINT32 iterations = 200;
+	const UINT32 formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGB16 };
+	BYTE* pData = NULL;
+	BYTE* pStream[2] = { NULL, NULL };
+	UINT32 size[2] = { 0, 0 };
+	BYTE* pSrcData = (BYTE*) calloc(height, step);
+	BYTE* pDstData = (BYTE*) calloc(height, step);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!pSrcData || !pDstData || !encoder || !decoder)
+		goto fail;
+
+	test_ClearFillImage(pSrcData, width, height, step);
+
+	for (i = 0; i < 2; i++)
+	{
+		if (clear_compress(encoder, pSrcData, PIXEL_FORMAT_BGRX32, step, width, height,
+		                   &pData, &size[i]) < 0)
+			goto fail;
+
+		pStream[i] = (BYTE*) malloc(size[i]);
+
+		if (!pStream[i])
+			goto fail;
+
+		CopyMemory(pStream[i], pData, size[i]);
+	}
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+	{
+		const UINT32 dstStep = width * GetBytesPerPixel(formats[f]);
+		UINT64 start = GetTickCount64();
+		UINT64 ticks;
+
+		for (i = 0; i < iterations; i++)
+		{
+			if (!clear_context_reset(decoder))
+				goto fail;
+
+			if (clear_decompress(decoder, pStream[0], size[0], width, height, pDstData, formats[f],
+			                     dstStep, 0, 0, width, height, NULL) < 0)
+				goto fail;
+
+			if (clear_decompress(decoder, pStream[1], size[1], width, height, pDstData, formats[f],
+			                     dstStep, 0, 0, width, height, NULL) < 0)
+				goto fail;
+		}
+
+		ticks = GetTickCount64() - start;
+
+		if ((formats[f] == PIXEL_FORMAT_BGRX32) &&
+		    !test_ClearCompareImage(pSrcData, pDstData, width, height, step))
+			goto fail;
+
+		printf("clear decode %s: %u + %u bytes x %u: %u ms\n", GetColorFormatName(formats[f]),
+		       (unsigned) size[0], (unsigned) size[1], (unsigned) iterations, (unsigned) ticks);
+	}
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	free(pStream[0]);
+	free(pStream[1]);
+	free(pSrcData);
+	free(pDstData);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
+	if (!test_ClearEncodeDecode())
+		return -1;
+
+	if (!test_ClearDecodeThroughput())
+		return -1;
+
 	if (!test_ClearDecompressExample(1, TEST_CLEAR_EXAMPLE_1,
 	                                 sizeof(TEST_CLEAR_EXAMPLE_1)))
 		return -1;
@@ -0,0 +1,230 @@
+#include <winpr/crt.h>
+
+#include <freerdp/codec/h264.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/primitives.h>
+
+/**
+ * AVC444 view selection against an encoder stub that records which views
+ * (planes) it was asked to encode. No real H.264 encoder is needed.
+ */
+
+#define TEST_H264_WIDTH 64
+#define TEST_H264_HEIGHT 64
+#define TEST_H264_RANGE 8
+
+static UINT32 test_h264_planes[4];
+static UINT32 test_h264_count = 0;
+static BYTE test_h264_bitstream[] = { 0x00, 0x00, 0x00, 0x01 };
+
+static int test_h264_compress(H264_CONTEXT* h264, BYTE** ppDstData, UINT32* pDstSize,
+                              UINT32 plane)
+{
+	if (test_h264_count < 4)
+		test_h264_planes[test_h264_count++] = plane;
+
+	*ppDstData = test_h264_bitstream;
+	*pDstSize = sizeof(test_h264_bitstream);
+	return 1;
+}
+
+static BOOL test_h264_init(H264_CONTEXT* h264)
+{
+	return TRUE;
+}
+
+static void test_h264_uninit(H264_CONTEXT* h264)
+{
+}
+
+static H264_CONTEXT_SUBSYSTEM test_h264_subsystem =
+{
+	"test",
+	test_h264_init,
+	test_h264_uninit,
+	NULL,
+	test_h264_compress
+};
+
+static BOOL test_h264_frame(H264_CONTEXT* h264, BYTE* frame, BYTE expectedOp,
+                            UINT32 expectedCount, const UINT32* expectedPlanes)
+{
+	UINT32 i;
+	BYTE op = 0xFF;
+	BYTE* pDstData = NULL;
+	BYTE* pAuxDstData = NULL;
+	UINT32 DstSize = 0;
+	UINT32 AuxDstSize = 0;
+	test_h264_count = 0;
+
+	if (avc444_compress(h264, frame, PIXEL_FORMAT_BGRX32, TEST_H264_WIDTH * 4, TEST_H264_WIDTH,
+	                    TEST_H264_HEIGHT, &op, &pDstData, &DstSize, &pAuxDstData,
+	                    &AuxDstSize) < 0)
+		return FALSE;
+
+	if ((op != expectedOp) || (test_h264_count != expectedCount))
+	{
+		printf("avc444_compress: LC %u with %u views, expected LC %u with %u views\n",
+		       (unsigned) op, (unsigned) test_h264_count, (unsigned) expectedOp,
+		       (unsigned) expectedCount);
+		return FALSE;
+	}
+
+	for (i = 0; i < expectedCount; i++)
+	{
+		if (test_h264_planes[i] != expectedPlanes[i])
+			return FALSE;
+	}
+
+	/* both bitstreams only for LC 0 */
+	if ((op == 0) != (pAuxDstData != NULL))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void test_h264_fill(BYTE* frame, UINT32 color)
+{
+	UINT32 i;
+
+	for (i = 0; i < TEST_H264_WIDTH * TEST_H264_HEIGHT; i++)
+		WriteColor(&frame[i * 4], PIXEL_FORMAT_BGRX32, color);
+}
+
+/**
+ * Finds colors around base that differ from it only in luma, or only in
+ * chroma so little that the averaged chroma of the main view stays the same.
+ */
+static BOOL test_h264_find_colors(UINT32 base, UINT32* lumaColor, UINT32* chromaColor)
+{
+	BOOL rc = FALSE;
+	INT32 dr, dg, db;
+	UINT32 i, count = 0;
+	prim_size_t roi;
+	const UINT32 size = (2 * TEST_H264_RANGE + 1) * (2 * TEST_H264_RANGE + 1) *
+	                    (2 * TEST_H264_RANGE + 1) + 1;
+	BYTE* rgb = (BYTE*) calloc(size, 4);
+	UINT32* colors = (UINT32*) calloc(size, sizeof(UINT32));
+	BYTE* yuv[3];
+	UINT32 yuvStep[3] = { size, size, size };
+	BYTE r, g, b;
+	primitives_t* prims = primitives_get();
+	yuv[0] = (BYTE*) malloc(size);
+	yuv[1] = (BYTE*) malloc(size);
+	yuv[2] = (BYTE*) malloc(size);
+	*lumaColor = *chromaColor = 0;
+
+	if (!rgb || !colors || !yuv[0] || !yuv[1] || !yuv[2])
+		goto fail;
+
+	SplitColor(base, PIXEL_FORMAT_BGRX32, &r, &g, &b, NULL, NULL);
+	colors[count++] = base;
+
+	for (dr = -TEST_H264_RANGE; dr <= TEST_H264_RANGE; dr++)
+	{
+		for (dg = -TEST_H264_RANGE; dg <= TEST_H264_RANGE; dg++)
+		{
+			for (db = -TEST_H264_RANGE; db <= TEST_H264_RANGE; db++)
+				colors[count++] = GetColor(PIXEL_FORMAT_BGRX32, (BYTE)(r + dr), (BYTE)(g + dg),
+				                           (BYTE)(b + db), 0xFF);
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		WriteColor(&rgb[i * 4], PIXEL_FORMAT_BGRX32, colors[i]);
+
+	roi.width = count;
+	roi.height = 1;
+
+	if (prims->RGBToYUV444_8u_P3AC4R(rgb, PIXEL_FORMAT_BGRX32, count * 4, yuv, yuvStep,
+	                                 &roi) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	for (i = 1; i < count; i++)
+	{
+		const BOOL sameChroma = (yuv[1][i] == yuv[1][0]) && (yuv[2][i] == yuv[2][0]);
+		/* one of four pixels of the 2x2 average changed */
+		const BOOL sameAverage = ((3 * yuv[1][0] + yuv[1][i]) / 4 == yuv[1][0]) &&
+		                         ((3 * yuv[2][0] + yuv[2][i]) / 4 == yuv[2][0]);
+
+		if (!*lumaColor && sameChroma && (yuv[0][i] != yuv[0][0]))
+			*lumaColor = colors[i];
+
+		if (!*chromaColor && !sameChroma && sameAverage && (yuv[0][i] == yuv[0][0]))
+			*chromaColor = colors[i];
+	}
+
+	rc = (*lumaColor != 0) && (*chromaColor != 0);
+fail:
+	free(rgb);
+	free(colors);
+	free(yuv[0]);
+	free(yuv[1]);
+	free(yuv[2]);
+	return rc;
+}
+
+int TestFreeRDPCodecH264(int argc, char* argv[])
+{
+	int rc = -1;
+	UINT32 lumaColor, chromaColor;
+	const UINT32 base = GetColor(PIXEL_FORMAT_BGRX32, 0x80, 0x60, 0x40, 0xFF);
+	const UINT32 mainPlanes[] = { 0 };
+	const UINT32 auxPlanes[] = { 1 };
+	const UINT32 bothPlanes[] = { 0, 1 };
+	BYTE* frame = (BYTE*) malloc(TEST_H264_WIDTH * TEST_H264_HEIGHT * 4);
+	H264_CONTEXT* h264 = h264_context_new(TRUE);
+	H264_CONTEXT_SUBSYSTEM* subsystem = NULL;
+
+	if (!frame || !h264)
+		goto fail;
+
+	subsystem = h264->subsystem;
+	h264->subsystem = &test_h264_subsystem;
+
+	if (!test_h264_find_colors(base, &lumaColor, &chromaColor))
+	{
+		printf("no test colors around 0x%08X\n", (unsigned) base);
+		goto fail;
+	}
+
+	/* the first frame sends both views, an unchanged one the main view */
+	test_h264_fill(frame, base);
+
+	if (!test_h264_frame(h264, frame, 0, 2, bothPlanes) ||
+	    !test_h264_frame(h264, frame, 1, 1, mainPlanes))
+		goto fail;
+
+	/* luma only, an even line goes to the main view alone */
+	WriteColor(&frame[0], PIXEL_FORMAT_BGRX32, lumaColor);
+
+	if (!test_h264_frame(h264, frame, 1, 1, mainPlanes))
+		goto fail;
+
+	/* chroma of an odd line only lands in the auxiliary view */
+	WriteColor(&frame[TEST_H264_WIDTH * 4], PIXEL_FORMAT_BGRX32, chromaColor);
+
+	if (!test_h264_frame(h264, frame, 2, 1, auxPlanes))
+		goto fail;
+
+	/* both views changed */
+	test_h264_fill(frame, base);
+
+	if (!test_h264_frame(h264, frame, 0, 2, bothPlanes))
+		goto fail;
+
+	/* a reset forgets the views */
+	if (!h264_context_reset(h264, TEST_H264_WIDTH, TEST_H264_HEIGHT) ||
+	    !test_h264_frame(h264, frame, 0, 2, bothPlanes))
+		goto fail;
+
+	rc = 0;
+fail:
+
+	if (h264 && subsystem)
+		h264->subsystem = subsystem;
+
+	h264_context_free(h264);
+	free(frame);
+	return rc;
+}
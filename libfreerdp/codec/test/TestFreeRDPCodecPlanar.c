@@ -3,6 +3,8 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/color.h>
@@ -3121,6 +3123,101 @@ fail:
 	return rc;
 }
 
+/**
+ * Encodes and decodes a full HD frame several times and reports the
+ * throughput of both directions. The frame has flat areas, gradients and
+ * noise so that the RLE, delta and plane interleave paths are all used.
+ */
+static BOOL TestPlanarThroughput(DWORD planarFlags, UINT32 format)
+{
+	UINT32 x, y, i;
+	BOOL rc = FALSE;
+	const UINT32 width = 1920;
+	const UINT32 height = 1080;
+	const UINT32 iterations = 10;
+	const UINT32 step = width * GetBytesPerPixel(format);
+	UINT32 compressedSize = 0;
+	UINT64 encodeTicks, decodeTicks, start;
+	BYTE* compressedBitmap = NULL;
+	BYTE* bmp = malloc(step * height);
+	BYTE* decompressedBitmap = malloc(step * height);
+	BITMAP_PLANAR_CONTEXT* encoder = freerdp_bitmap_planar_context_new(planarFlags, width,
+	                                 height);
+	BITMAP_PLANAR_CONTEXT* decoder = freerdp_bitmap_planar_context_new(0, width, height);
+	printf("%s: [%s] RLE: %d Alpha: %d ", __FUNCTION__, GetColorFormatName(format),
+	       (planarFlags & PLANAR_FORMAT_HEADER_RLE) ? 1 : 0,
+	       (planarFlags & PLANAR_FORMAT_HEADER_NA) ? 0 : 1);
+	fflush(stdout);
+
+	if (!bmp || !decompressedBitmap || !encoder || !decoder)
+		goto fail;
+
+	winpr_RAND(bmp, step * height);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* line = &bmp[step * y];
+
+		/* the last third keeps the random noise */
+		for (x = 0; x < (2 * width) / 3; x++)
+		{
+			UINT32 color;
+
+			if (x < width / 3)
+				color = GetColor(format, 0x20, 0x40, 0x60, 0xFF);
+			else
+				color = GetColor(format, x & 0xFF, y & 0xFF, (x + y) & 0xFF, 0xFF);
+
+			WriteColor(line, format, color);
+			line += GetBytesPerPixel(format);
+		}
+	}
+
+	start = GetTickCount64();
+
+	for (i = 0; i < iterations; i++)
+	{
+		free(compressedBitmap);
+		compressedBitmap = freerdp_bitmap_compress_planar(encoder, bmp, format, width,
+		                   height, step, NULL, &compressedSize);
+
+		if (!compressedBitmap)
+			goto fail;
+	}
+
+	encodeTicks = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < iterations; i++)
+	{
+		if (!planar_decompress(decoder, compressedBitmap, compressedSize, width, height,
+		                       decompressedBitmap, format, step, 0, 0, width, height, TRUE))
+			goto fail;
+	}
+
+	decodeTicks = GetTickCount64() - start;
+
+	if (!CompareBitmap(decompressedBitmap, format, bmp, format, width, height))
+	{
+		printf("FAIL");
+		goto fail;
+	}
+
+	printf("size: %u encode: %u ms decode: %u ms (%u frames) SUCCESS",
+	       (unsigned) compressedSize, (unsigned) encodeTicks, (unsigned) decodeTicks,
+	       (unsigned) iterations);
+	rc = TRUE;
+fail:
+	free(bmp);
+	free(compressedBitmap);
+	free(decompressedBitmap);
+	freerdp_bitmap_planar_context_free(encoder);
+	freerdp_bitmap_planar_context_free(decoder);
+	printf("\n");
+	fflush(stdout);
+	return rc;
+}
+
 int TestFreeRDPCodecPlanar(int argc, char* argv[])
 {
 	UINT32 x;
@@ -3131,5 +3228,15 @@ int TestFreeRDPCodecPlanar(int argc, char* argv[])
 			return -1;
 	}
 
+	if (!TestPlanarThroughput(PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE,
+	                          PIXEL_FORMAT_BGRX32))
+		return -1;
+
+	if (!TestPlanarThroughput(PLANAR_FORMAT_HEADER_RLE, PIXEL_FORMAT_BGRA32))
+		return -1;
+
+	if (!TestPlanarThroughput(PLANAR_FORMAT_HEADER_NA, PIXEL_FORMAT_BGRX32))
+		return -1;
+
 	return 0;
 }
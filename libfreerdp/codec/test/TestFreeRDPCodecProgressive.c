@@ -3,6 +3,7 @@
 #include <winpr/image.h>
 #include <winpr/print.h>
 #include <winpr/wlog.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/codec/region.h>
 
@@ -919,9 +920,417 @@ static int test_progressive_ms_sample(char* ms_sample_path)
 	return 0;
 }
 
+static int test_progressive_max_error(const BYTE* pSrcData, const BYTE* pDstData,
+                                      int nStep, int nWidth, int nHeight)
+{
+	int x, y, c;
+	int error;
+	int maxError = 0;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		for (x = 0; x < nWidth; x++)
+		{
+			for (c = 0; c < 3; c++)
+			{
+				error = abs(pSrcData[(y * nStep) + (x * 4) + c] -
+				            pDstData[(y * nStep) + (x * 4) + c]);
+
+				if (error > maxError)
+					maxError = error;
+			}
+		}
+	}
+
+	return maxError;
+}
+
+static int test_progressive_encode_decode(void)
+{
+	int x, y;
+	int pass;
+	int rc = -1;
+	int error = 0;
+	UINT32 dstSize;
+	BYTE* pDstData;
+	BYTE* pSrcData = NULL;
+	BYTE* pOutData = NULL;
+	REGION16 invalidRegion;
+	RECTANGLE_16 rect;
+	PROGRESSIVE_CONTEXT* encoder;
+	PROGRESSIVE_CONTEXT* decoder;
+	const int width = 200;
+	const int height = 130;
+	const int step = width * 4;
+	encoder = progressive_context_new(TRUE);
+	decoder = progressive_context_new(FALSE);
+	pSrcData = (BYTE*) calloc(height, step);
+	pOutData = (BYTE*) calloc(height, step);
+	region16_init(&invalidRegion);
+
+	if (!encoder || !decoder || !pSrcData || !pOutData)
+		goto fail;
+
+	if (progressive_create_surface_context(decoder, 1, width, height) < 0)
+		goto fail;
+
+	/* smooth gradients with a sharp edge */
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &pSrcData[(y * step) + (x * 4)];
+			pixel[0] = (BYTE)((x + y) / 2); /* B */
+			pixel[1] = (BYTE)((x < 100) ? (y * 2) : 0xE0); /* G */
+			pixel[2] = (BYTE)(255 - x); /* R */
+			pixel[3] = 0xFF;
+		}
+	}
+
+	rect.left = 0;
+	rect.top = 0;
+	rect.right = width;
+	rect.bottom = height;
+	region16_union_rect(&invalidRegion, &invalidRegion, &rect);
+
+	/* first call sends every tile, the following ones refine them until nothing is left */
+	for (pass = 0; pass < 8; pass++)
+	{
+		if (progressive_compress(encoder, pSrcData, PIXEL_FORMAT_BGRX32, step, width, height,
+		                         (pass == 0) ? &invalidRegion : NULL, &pDstData, &dstSize, 1) < 0)
+		{
+			printf("progressive_compress failure (pass %d)\n", pass);
+			goto fail;
+		}
+
+		if (dstSize == 0)
+			break;
+
+		if (progressive_decompress(decoder, pDstData, dstSize, pOutData, PIXEL_FORMAT_BGRX32,
+		                           step, 0, 0, width, height, 1) < 0)
+		{
+			printf("progressive_decompress failure (pass %d)\n", pass);
+			goto fail;
+		}
+
+		error = test_progressive_max_error(pSrcData, pOutData, step, width, height);
+		printf("progressive encode/decode pass %d: %u bytes, max error %d\n",
+		       pass, (unsigned) dstSize, error);
+	}
+
+	if ((pass != 3) || (error > 16))
+	{
+		printf("progressive encode/decode mismatch: passes %d, max error %d\n", pass, error);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	region16_uninit(&invalidRegion);
+	progressive_context_free(encoder);
+	progressive_context_free(decoder);
+	free(pSrcData);
+	free(pOutData);
+	return rc;
+}
+
+#define TEST_PROGRESSIVE_4K_WIDTH	3840
+#define TEST_PROGRESSIVE_4K_HEIGHT	2160
+#define TEST_PROGRESSIVE_4K_PASSES	3
+
+static UINT64 test_progressive_decode_frames(PROGRESSIVE_CONTEXT* decoder, BYTE** frames,
+        const UINT32* frameSizes, BYTE* pOutData, UINT32 step)
+{
+	int pass;
+	UINT64 start = GetTickCount64();
+
+	for (pass = 0; pass < TEST_PROGRESSIVE_4K_PASSES; pass++)
+	{
+		if (progressive_decompress(decoder, frames[pass], frameSizes[pass], pOutData,
+		                           PIXEL_FORMAT_BGRX32, step, 0, 0,
+		                           TEST_PROGRESSIVE_4K_WIDTH, TEST_PROGRESSIVE_4K_HEIGHT, 1) < 0)
+			return 0;
+	}
+
+	return GetTickCount64() - start + 1;
+}
+
+/**
+ * Decodes every pass of a 4K frame once on the calling thread and once with
+ * the tiles spread over the thread pool, both have to produce the same image.
+ */
+static int test_progressive_decode_4k(void)
+{
+	int x, y;
+	int pass;
+	int rc = -1;
+	UINT32 dstSize;
+	BYTE* pDstData;
+	UINT64 serialTime;
+	UINT64 parallelTime;
+	REGION16 invalidRegion;
+	RECTANGLE_16 rect;
+	BYTE* frames[TEST_PROGRESSIVE_4K_PASSES] = { NULL };
+	UINT32 frameSizes[TEST_PROGRESSIVE_4K_PASSES] = { 0 };
+	const UINT32 width = TEST_PROGRESSIVE_4K_WIDTH;
+	const UINT32 height = TEST_PROGRESSIVE_4K_HEIGHT;
+	const UINT32 step = width * 4;
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* serial = progressive_context_new(FALSE);
+	PROGRESSIVE_CONTEXT* parallel = progressive_context_new(FALSE);
+	BYTE* pSrcData = (BYTE*) calloc(height, step);
+	BYTE* pSerialData = (BYTE*) calloc(height, step);
+	BYTE* pParallelData = (BYTE*) calloc(height, step);
+	region16_init(&invalidRegion);
+
+	if (!encoder || !serial || !parallel || !pSrcData || !pSerialData || !pParallelData)
+		goto fail;
+
+	if ((progressive_create_surface_context(serial, 1, width, height) < 0) ||
+	    (progressive_create_surface_context(parallel, 1, width, height) < 0))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &pSrcData[(y * step) + (x * 4)];
+			pixel[0] = (BYTE)((x * y) >> 6); /* B */
+			pixel[1] = (BYTE)(((x / 48) + (y / 48)) & 1 ? 0xC0 : (x >> 4)); /* G */
+			pixel[2] = (BYTE)(x + y); /* R */
+			pixel[3] = 0xFF;
+		}
+	}
+
+	rect.left = 0;
+	rect.top = 0;
+	rect.right = width;
+	rect.bottom = height;
+	region16_union_rect(&invalidRegion, &invalidRegion, &rect);
+
+	for (pass = 0; pass < TEST_PROGRESSIVE_4K_PASSES; pass++)
+	{
+		if (progressive_compress(encoder, pSrcData, PIXEL_FORMAT_BGRX32, step, width, height,
+		                         (pass == 0) ? &invalidRegion : NULL, &pDstData, &dstSize, 1) < 0)
+			goto fail;
+
+		if (!(frames[pass] = (BYTE*) malloc(dstSize)))
+			goto fail;
+
+		CopyMemory(frames[pass], pDstData, dstSize);
+		frameSizes[pass] = dstSize;
+	}
+
+	serial->UseThreads = FALSE;
+	serialTime = test_progressive_decode_frames(serial, frames, frameSizes, pSerialData, step);
+	parallelTime = test_progressive_decode_frames(parallel, frames, frameSizes, pParallelData,
+	               step);
+
+	if (!serialTime || !parallelTime)
+	{
+		printf("progressive 4K decoding failed\n");
+		goto fail;
+	}
+
+	printf("progressive 4K decoding (%d passes): serial %u ms, parallel %u ms (%u threads)\n",
+	       TEST_PROGRESSIVE_4K_PASSES, (unsigned) serialTime, (unsigned) parallelTime,
+	       (unsigned) parallel->ThreadCount);
+
+	if (memcmp(pSerialData, pParallelData, height * step) != 0)
+	{
+		printf("progressive 4K serial and parallel decoding differ\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	for (pass = 0; pass < TEST_PROGRESSIVE_4K_PASSES; pass++)
+		free(frames[pass]);
+
+	region16_uninit(&invalidRegion);
+	progressive_context_free(encoder);
+	progressive_context_free(serial);
+	progressive_context_free(parallel);
+	free(pSrcData);
+	free(pSerialData);
+	free(pParallelData);
+	return rc;
+}
+
+#define TEST_PROGRESSIVE_MERGE_WIDTH	512
+#define TEST_PROGRESSIVE_MERGE_HEIGHT	256
+
+static BOOL test_progressive_find_region(BYTE* data, UINT32 size, UINT32* offset)
+{
+	UINT32 blockLen;
+	*offset = 0;
+
+	while ((size - *offset) >= 6)
+	{
+		blockLen = *((UINT32*) &data[*offset + 2]);
+
+		if ((blockLen < 6) || (blockLen > (size - *offset)))
+			return FALSE;
+
+		if (*((UINT16*) &data[*offset]) == PROGRESSIVE_WBT_REGION)
+			return blockLen >= 18;
+
+		*offset += blockLen;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Appends the tiles of the region of second to the region of first, the
+ * result holds the first pass and the upgrade of every tile in one region.
+ */
+static BYTE* test_progressive_merge_regions(BYTE* first, UINT32 firstSize, BYTE* second,
+        UINT32 secondSize, UINT32* size)
+{
+	BYTE* data;
+	UINT32 offset1, offset2;
+	UINT32 regionLen1, regionLen2;
+	UINT32 tileDataSize2;
+	UINT16 numTiles2;
+
+	if (!test_progressive_find_region(first, firstSize, &offset1) ||
+	    !test_progressive_find_region(second, secondSize, &offset2))
+		return NULL;
+
+	regionLen1 = *((UINT32*) &first[offset1 + 2]);
+	regionLen2 = *((UINT32*) &second[offset2 + 2]);
+	numTiles2 = *((UINT16*) &second[offset2 + 12]);
+	tileDataSize2 = *((UINT32*) &second[offset2 + 14]);
+
+	if (tileDataSize2 > regionLen2)
+		return NULL;
+
+	*size = firstSize + tileDataSize2;
+
+	if (!(data = (BYTE*) malloc(*size)))
+		return NULL;
+
+	CopyMemory(data, first, offset1 + regionLen1);
+	CopyMemory(&data[offset1 + regionLen1], &second[offset2 + regionLen2 - tileDataSize2],
+	           tileDataSize2);
+	CopyMemory(&data[offset1 + regionLen1 + tileDataSize2], &first[offset1 + regionLen1],
+	           firstSize - offset1 - regionLen1);
+	*((UINT32*) &data[offset1 + 2]) += tileDataSize2; /* blockLen */
+	*((UINT16*) &data[offset1 + 12]) += numTiles2; /* numTiles */
+	*((UINT32*) &data[offset1 + 14]) += tileDataSize2; /* tileDataSize */
+	return data;
+}
+
+/**
+ * A region may carry several passes of the same tile, they have to be
+ * applied in stream order even if the tiles are decoded on the thread pool.
+ */
+static int test_progressive_decode_duplicate_tiles(void)
+{
+	int pass;
+	int rc = -1;
+	UINT32 x, y;
+	UINT32 dstSize;
+	UINT32 mergedSize = 0;
+	BYTE* pDstData;
+	BYTE* merged = NULL;
+	REGION16 invalidRegion;
+	RECTANGLE_16 rect = { 0, 0, TEST_PROGRESSIVE_MERGE_WIDTH, TEST_PROGRESSIVE_MERGE_HEIGHT };
+	BYTE* frames[2] = { NULL };
+	UINT32 frameSizes[2] = { 0 };
+	const UINT32 width = TEST_PROGRESSIVE_MERGE_WIDTH;
+	const UINT32 height = TEST_PROGRESSIVE_MERGE_HEIGHT;
+	const UINT32 step = width * 4;
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* reference = progressive_context_new(FALSE);
+	PROGRESSIVE_CONTEXT* decoder = progressive_context_new(FALSE);
+	BYTE* pSrcData = (BYTE*) calloc(height, step);
+	BYTE* pReferenceData = (BYTE*) calloc(height, step);
+	BYTE* pMergedData = (BYTE*) calloc(height, step);
+	region16_init(&invalidRegion);
+
+	if (!encoder || !reference || !decoder || !pSrcData || !pReferenceData || !pMergedData)
+		goto fail;
+
+	if ((progressive_create_surface_context(reference, 1, width, height) < 0) ||
+	    (progressive_create_surface_context(decoder, 1, width, height) < 0))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &pSrcData[(y * step) + (x * 4)];
+			pixel[0] = (BYTE)((x * y) >> 5); /* B */
+			pixel[1] = (BYTE)(((x / 24) + (y / 24)) & 1 ? 0xE0 : (y >> 1)); /* G */
+			pixel[2] = (BYTE)(x ^ y); /* R */
+			pixel[3] = 0xFF;
+		}
+	}
+
+	region16_union_rect(&invalidRegion, &invalidRegion, &rect);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		if (progressive_compress(encoder, pSrcData, PIXEL_FORMAT_BGRX32, step, width, height,
+		                         (pass == 0) ? &invalidRegion : NULL, &pDstData, &dstSize, 1) < 0)
+			goto fail;
+
+		if (!(frames[pass] = (BYTE*) malloc(dstSize)))
+			goto fail;
+
+		CopyMemory(frames[pass], pDstData, dstSize);
+		frameSizes[pass] = dstSize;
+
+		if (progressive_decompress(reference, frames[pass], frameSizes[pass], pReferenceData,
+		                           PIXEL_FORMAT_BGRX32, step, 0, 0, width, height, 1) < 0)
+			goto fail;
+	}
+
+	if (!(merged = test_progressive_merge_regions(frames[0], frameSizes[0], frames[1],
+	               frameSizes[1], &mergedSize)))
+		goto fail;
+
+	if (progressive_decompress(decoder, merged, mergedSize, pMergedData, PIXEL_FORMAT_BGRX32,
+	                           step, 0, 0, width, height, 1) < 0)
+		goto fail;
+
+	if (memcmp(pReferenceData, pMergedData, height * step) != 0)
+	{
+		printf("progressive passes of one region decoded out of order\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	free(frames[0]);
+	free(frames[1]);
+	free(merged);
+	region16_uninit(&invalidRegion);
+	progressive_context_free(encoder);
+	progressive_context_free(reference);
+	progressive_context_free(decoder);
+	free(pSrcData);
+	free(pReferenceData);
+	free(pMergedData);
+	return rc;
+}
+
 int TestFreeRDPCodecProgressive(int argc, char* argv[])
 {
 	char* ms_sample_path;
+
+	if (test_progressive_encode_decode() < 0)
+		return -1;
+
+	if (test_progressive_decode_4k() < 0)
+		return -1;
+
+	if (test_progressive_decode_duplicate_tiles() < 0)
+		return -1;
+
 	ms_sample_path = GetKnownSubPath(KNOWN_PATH_TEMP, "EGFX_PROGRESSIVE_MS_SAMPLE");
 
 	if (!ms_sample_path)
@@ -1,9 +1,18 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <winpr/crt.h>
 #include <winpr/print.h>
 
+#include <winpr/sysinfo.h>
+
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/rfx.h>
 
+#include "../rfx_rlgr.h"
+#include "../rfx_sse2.h"
+
 /**
  * The following is an annotated dump of a TS_RFX_TILESET message containing a single encoded 64x64 tile.
  *
@@ -756,7 +765,397 @@ const UINT32 TEST_RFX_XRGB_IMAGE[4096] =
 	0x00169ff8, 0x00159ef7, 0x00149df7, 0x00139cf6, 0x00129bf5, 0x00129bf5, 0x00129bf5, 0x00129bf5
 };
 
+/* RemoteFX is lossy, with the default quantization values the per channel
+ * error of the tiled test image stays at 6 */
+#define RFX_TEST_MAX_ERROR 8
+
+static BOOL TestRemoteFXThroughput(RLGR_MODE mode)
+{
+	UINT32 x, y, i;
+	BOOL rc = FALSE;
+	const UINT32 width = 1024;
+	const UINT32 height = 768;
+	const UINT32 iterations = 10;
+	const UINT32 step = width * 4;
+	UINT32 maxError = 0;
+	UINT64 encodeTicks, decodeTicks, start;
+	RFX_RECT rect = { 0, 0, width, height };
+	BYTE* image = malloc(step * height);
+	BYTE* decoded = calloc(1, step * height);
+	RFX_CONTEXT* encoder = rfx_context_new(TRUE);
+	RFX_CONTEXT* decoder = rfx_context_new(FALSE);
+	wStream* s = Stream_New(NULL, 1024);
+	printf("%s: [RLGR%d] ", __FUNCTION__, (mode == RLGR1) ? 1 : 3);
+	fflush(stdout);
+
+	if (!image || !decoded || !encoder || !decoder || !s)
+		goto fail;
+
+	/* tile the 64x64 reference image, its XRGB words are BGRX32 in memory */
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x += 64)
+			CopyMemory(&image[y * step + x * 4], &TEST_RFX_XRGB_IMAGE[(y % 64) * 64], 64 * 4);
+	}
+
+	encoder->mode = mode;
+
+	if (!rfx_context_reset(encoder, width, height))
+		goto fail;
+
+	rfx_context_set_pixel_format(encoder, PIXEL_FORMAT_BGRX32);
+	start = GetTickCount64();
+
+	/* only the first message carries the stream headers, decode that one */
+	for (i = 0; i < iterations; i++)
+	{
+		RFX_MESSAGE* message = rfx_encode_message(encoder, &rect, 1, image, width, height,
+		                       step);
+
+		if (!message)
+			goto fail;
+
+		if (i == 0)
+			rfx_write_message(encoder, s, message);
+
+		rfx_message_free(encoder, message);
+	}
+
+	encodeTicks = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < iterations; i++)
+	{
+		BOOL success;
+		REGION16 invalidRegion;
+		region16_init(&invalidRegion);
+		success = rfx_process_message(decoder, Stream_Buffer(s), Stream_GetPosition(s), 0, 0,
+		                              decoded, PIXEL_FORMAT_BGRX32, step, height, &invalidRegion);
+		region16_uninit(&invalidRegion);
+
+		if (!success)
+			goto fail;
+	}
+
+	decodeTicks = GetTickCount64() - start;
+
+	for (i = 0; i < step * height; i++)
+	{
+		const UINT32 error = abs((int) image[i] - (int) decoded[i]);
+
+		if ((i % 4 != 3) && (error > maxError))
+			maxError = error;
+	}
+
+	if (maxError > RFX_TEST_MAX_ERROR)
+	{
+		printf("FAIL (max error %u)", (unsigned) maxError);
+		goto fail;
+	}
+
+	printf("size: %u encode: %u ms decode: %u ms (%u frames) max error: %u SUCCESS",
+	       (unsigned) Stream_GetPosition(s), (unsigned) encodeTicks, (unsigned) decodeTicks,
+	       (unsigned) iterations, (unsigned) maxError);
+	rc = TRUE;
+fail:
+	free(image);
+	free(decoded);
+	Stream_Free(s, TRUE);
+	rfx_context_free(encoder);
+	rfx_context_free(decoder);
+	printf("\n");
+	fflush(stdout);
+	return rc;
+}
+
+/* Deterministic coefficients, every fourth one is drawn from the full range */
+static void test_rfx_fill(INT16* data, UINT32 count, UINT32 seed, int range)
+{
+	UINT32 i;
+
+	for (i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if (i % 4 == 0)
+			data[i] = (INT16)((int)((seed >> 8) % (2 * range)) - range);
+		else
+			data[i] = (INT16)((int)((seed >> 8) % 64) - 32);
+	}
+}
+
+static BOOL test_rfx_compare(const char* name, const INT16* expected, const INT16* actual,
+                             UINT32 count)
+{
+	UINT32 i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (expected[i] != actual[i])
+		{
+			printf("%s: coefficient %u is %d, expected %d\n", name, (unsigned) i,
+			       actual[i], expected[i]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+#if defined(WITH_SSE2) && defined(WITH_AVX2)
+#define RFX_TEST_COEFFICIENTS 4096
+
+/* The AVX2 kernels must produce the same coefficients as the SSE2 ones */
+static BOOL TestRemoteFXAVX2(void)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	const UINT32 quantVals[10] = { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 };
+	void (*quant_decode_avx2)(INT16 * buffer, const UINT32 * quantization_values);
+	void (*quant_encode_avx2)(INT16 * buffer, const UINT32 * quantization_values);
+	void (*dwt_decode_avx2)(INT16 * buffer, INT16 * dwt_buffer);
+	void (*dwt_encode_avx2)(INT16 * buffer, INT16 * dwt_buffer);
+	INT16* src = _aligned_malloc(RFX_TEST_COEFFICIENTS * sizeof(INT16), 32);
+	INT16* sse2 = _aligned_malloc(RFX_TEST_COEFFICIENTS * sizeof(INT16), 32);
+	INT16* avx2 = _aligned_malloc(RFX_TEST_COEFFICIENTS * sizeof(INT16), 32);
+	INT16* dwt = _aligned_malloc(RFX_TEST_COEFFICIENTS * sizeof(INT16), 32);
+	RFX_CONTEXT* context = rfx_context_new(FALSE);
+	printf("%s: ", __FUNCTION__);
+
+	if (!src || !sse2 || !avx2 || !dwt || !context)
+		goto fail;
+
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		printf("AVX2 not available, SKIPPED");
+		rc = TRUE;
+		goto fail;
+	}
+
+	/* rfx_context_new picked the AVX2 routines, switch the context back to SSE2 */
+	quant_decode_avx2 = context->quantization_decode;
+	quant_encode_avx2 = context->quantization_encode;
+	dwt_decode_avx2 = context->dwt_2d_decode;
+	dwt_encode_avx2 = context->dwt_2d_encode;
+	rfx_init_sse2(context);
+
+	for (i = 0; i < 4; i++)
+	{
+		/* quantization decode, the shifted coefficients stay in range */
+		test_rfx_fill(src, RFX_TEST_COEFFICIENTS, 0x1234 + i, 64);
+		CopyMemory(sse2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		CopyMemory(avx2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		context->quantization_decode(sse2, quantVals);
+		quant_decode_avx2(avx2, quantVals);
+
+		if (!test_rfx_compare("quantization_decode", sse2, avx2, RFX_TEST_COEFFICIENTS))
+			goto fail;
+
+		/* quantization encode, rounding of negative values included */
+		test_rfx_fill(src, RFX_TEST_COEFFICIENTS, 0x5678 + i, 8192);
+		CopyMemory(sse2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		CopyMemory(avx2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		context->quantization_encode(sse2, quantVals);
+		quant_encode_avx2(avx2, quantVals);
+
+		if (!test_rfx_compare("quantization_encode", sse2, avx2, RFX_TEST_COEFFICIENTS))
+			goto fail;
+
+		/* inverse DWT of dequantized coefficients */
+		test_rfx_fill(src, RFX_TEST_COEFFICIENTS, 0x9ABC + i, 1024);
+		CopyMemory(sse2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		CopyMemory(avx2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		context->dwt_2d_decode(sse2, dwt);
+		dwt_decode_avx2(avx2, dwt);
+
+		if (!test_rfx_compare("dwt_2d_decode", sse2, avx2, RFX_TEST_COEFFICIENTS))
+			goto fail;
+
+		/* forward DWT of color converted samples */
+		test_rfx_fill(src, RFX_TEST_COEFFICIENTS, 0xDEF0 + i, 4096);
+		CopyMemory(sse2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		CopyMemory(avx2, src, RFX_TEST_COEFFICIENTS * sizeof(INT16));
+		context->dwt_2d_encode(sse2, dwt);
+		dwt_encode_avx2(avx2, dwt);
+
+		if (!test_rfx_compare("dwt_2d_encode", sse2, avx2, RFX_TEST_COEFFICIENTS))
+			goto fail;
+	}
+
+	printf("SUCCESS");
+	rc = TRUE;
+fail:
+	_aligned_free(src);
+	_aligned_free(sse2);
+	_aligned_free(avx2);
+	_aligned_free(dwt);
+	rfx_context_free(context);
+	printf("\n");
+	fflush(stdout);
+	return rc;
+}
+#endif
+
+#define RFX_TEST_RLGR_VALUES 256
+#define RFX_TEST_RLGR_PREFIX 37
+#define RFX_TEST_RLGR_TRUNCATED 68
+
+/* Bitstreams written by the bit-at-a-time RLGR encoder for test_rlgr_input */
+static const BYTE TEST_RLGR1_DATA[] =
+{
+	0x5E, 0x74, 0xF4, 0x15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFC, 0x00, 0x18,
+	0x00, 0x00, 0x08, 0x18, 0x40, 0x73, 0x45, 0x00, 0x00, 0xFD, 0x0C, 0x52,
+	0xDC, 0x00, 0xB3, 0x6C, 0x20, 0x1F, 0x90, 0x14, 0x63, 0x00, 0x63, 0xFF,
+	0xFF, 0xF8, 0x00, 0x60, 0x05, 0xAB, 0x01, 0x00, 0x1D, 0x81, 0x20, 0x74,
+	0x5F, 0xFF, 0xFF, 0xFF, 0xFF, 0xC0, 0x00, 0x85, 0x05, 0x30, 0x8C, 0x00,
+	0x22, 0x95, 0x40, 0x7F, 0x62, 0x40, 0xFF, 0xFD, 0x00, 0x28, 0x80, 0x78,
+	0x01, 0x00, 0x98, 0x02, 0x7F, 0xFF, 0xE5, 0x20, 0xEE, 0x01, 0x4C, 0x01,
+	0x2E, 0xA4, 0x19, 0x2C, 0xAC, 0xED, 0x9B, 0xA2, 0x5F, 0x06, 0xC0, 0xFF,
+	0xFF, 0xFF, 0xD0, 0x01, 0x0A, 0x06, 0x00, 0x40
+};
+
+static const BYTE TEST_RLGR1_PREFIX_DATA[] =
+{
+	0x5E, 0x74, 0xF4, 0x15, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFC, 0x00, 0x18,
+	0x00, 0x00, 0x08, 0x18, 0x40, 0x73, 0x45, 0x00, 0x00, 0xFD, 0x0C, 0x52,
+	0xDC, 0x00, 0xB3, 0x6C, 0x20
+};
+
+static const BYTE TEST_RLGR3_DATA[] =
+{
+	0x5E, 0x77, 0xFB, 0x2C, 0xFF, 0xFF, 0xFE, 0x2E, 0x33, 0x01, 0x06, 0x2B,
+	0xFF, 0xF2, 0xDA, 0x00, 0x16, 0xC2, 0xCC, 0xA5, 0x60, 0x80, 0xAE, 0x62,
+	0x4A, 0x40, 0x08, 0x8C, 0x22, 0x01, 0xFF, 0xD2, 0xE0, 0xD8, 0xE1, 0x5D,
+	0x86, 0x03, 0x80, 0x84, 0x1C, 0x45, 0xFF, 0xA0, 0x42, 0xF6, 0x94, 0x28,
+	0x5D, 0xAD, 0xD8, 0x45, 0x03, 0xFF, 0xF5, 0xD0, 0xC0, 0x72, 0x02, 0x03,
+	0x20, 0x13, 0xFE, 0xA9, 0x05, 0x70, 0x73, 0x00, 0x4B, 0xA9, 0x06, 0x47,
+	0x27, 0x3B, 0x66, 0xEE, 0x03, 0x11, 0xBB, 0xFF, 0xF9, 0x00, 0x10, 0xB4,
+	0x00, 0x80
+};
+
+static const BYTE TEST_RLGR3_PREFIX_DATA[] =
+{
+	0x5E, 0x77, 0xFB, 0x2C, 0xFF, 0xFF, 0xFE, 0x2E, 0x33, 0x01, 0x06, 0x2B,
+	0xFF, 0xF2, 0xDA, 0x00, 0x16, 0xC2, 0xCC, 0xA5, 0x60, 0x80, 0xAE, 0x62,
+	0x40
+};
+
+/* Sparse coefficients with a long zero run, like a quantized tile */
+static void test_rlgr_input(INT16* data, UINT32 count)
+{
+	UINT32 i;
+	UINT32 seed = 0x2545F491;
+
+	for (i = 0; i < count; i++)
+	{
+		UINT32 r;
+		seed = seed * 1103515245 + 12345;
+		r = (seed >> 16) & 0xFF;
+
+		if ((i >= 128) && (i < 224))
+			data[i] = 0;
+		else if (r < 144)
+			data[i] = 0;
+		else if (r < 240)
+			data[i] = (INT16)((int)(r & 0x0F) - 8);
+		else
+			data[i] = (INT16)((int)((seed >> 4) & 0x7F) - 64);
+	}
+}
+
+static BOOL test_rlgr_encode(const char* name, RLGR_MODE mode, const INT16* data, UINT32 count,
+                             const BYTE* expected, int expectedSize)
+{
+	BYTE buffer[1024];
+	int size;
+	ZeroMemory(buffer, sizeof(buffer));
+	size = rfx_rlgr_encode(mode, data, count, buffer, sizeof(buffer));
+
+	if ((size != expectedSize) || (memcmp(buffer, expected, expectedSize) != 0))
+	{
+		printf("%s: encoded %d bytes, expected %d\n", name, size, expectedSize);
+		winpr_HexDump("rlgr", WLOG_ERROR, buffer, (size > 0) ? size : 0);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The RLGR reader and writer must keep producing the reference bitstreams */
+static BOOL TestRemoteFXRlgr(RLGR_MODE mode)
+{
+	UINT32 i;
+	INT16 data[RFX_TEST_RLGR_VALUES];
+	INT16 decoded[RFX_TEST_RLGR_VALUES];
+	const BYTE* expected = (mode == RLGR1) ? TEST_RLGR1_DATA : TEST_RLGR3_DATA;
+	const int expectedSize = (mode == RLGR1) ? sizeof(TEST_RLGR1_DATA) : sizeof(TEST_RLGR3_DATA);
+	printf("%s: [RLGR%d] ", __FUNCTION__, (mode == RLGR1) ? 1 : 3);
+	test_rlgr_input(data, RFX_TEST_RLGR_VALUES);
+
+	if (!test_rlgr_encode("full", mode, data, RFX_TEST_RLGR_VALUES, expected, expectedSize))
+		goto fail;
+
+	/* a stream ending on a nonzero value flushes a partial byte */
+	if (!test_rlgr_encode("prefix", mode, data, RFX_TEST_RLGR_PREFIX,
+	                      (mode == RLGR1) ? TEST_RLGR1_PREFIX_DATA : TEST_RLGR3_PREFIX_DATA,
+	                      (mode == RLGR1) ? sizeof(TEST_RLGR1_PREFIX_DATA) :
+	                      sizeof(TEST_RLGR3_PREFIX_DATA)))
+		goto fail;
+
+	/* the padding bits after the trailing zero run decode as one more value */
+	FillMemory(decoded, sizeof(decoded), 0x55);
+
+	if (rfx_rlgr_decode(mode, expected, expectedSize, decoded, RFX_TEST_RLGR_VALUES) != 1)
+		goto fail;
+
+	if (!test_rfx_compare("decode", data, decoded, RFX_TEST_RLGR_VALUES - 1))
+		goto fail;
+
+	/* a truncated stream decodes what it holds and zero fills the rest */
+	FillMemory(decoded, sizeof(decoded), 0x55);
+
+	if (rfx_rlgr_decode(mode, expected, expectedSize / 2, decoded, RFX_TEST_RLGR_VALUES) != 1)
+		goto fail;
+
+	if (!test_rfx_compare("truncated", data, decoded, RFX_TEST_RLGR_TRUNCATED))
+		goto fail;
+
+	for (i = RFX_TEST_RLGR_TRUNCATED; i < RFX_TEST_RLGR_VALUES; i++)
+	{
+		if (decoded[i] != 0)
+		{
+			printf("truncated: coefficient %u is %d, expected 0\n", (unsigned) i, decoded[i]);
+			goto fail;
+		}
+	}
+
+	printf("SUCCESS\n");
+	return TRUE;
+fail:
+	printf("FAIL\n");
+	return FALSE;
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
+	if (!TestRemoteFXThroughput(RLGR1))
+		return -1;
+
+	if (!TestRemoteFXThroughput(RLGR3))
+		return -1;
+
+	if (!TestRemoteFXRlgr(RLGR1))
+		return -1;
+
+	if (!TestRemoteFXRlgr(RLGR3))
+		return -1;
+
+#if defined(WITH_SSE2) && defined(WITH_AVX2)
+
+	if (!TestRemoteFXAVX2())
+		return -1;
+
+#endif
+
 	return 0;
 }
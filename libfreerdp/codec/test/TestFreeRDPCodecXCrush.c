@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/codec/xcrush.h>
 
@@ -133,6 +134,106 @@ int test_XCrushCompressIsland()
 	return 1;
 }
 
+static void test_XCrushFill(BYTE* data, UINT32 size, UINT32* seed)
+{
+	UINT32 i;
+
+	for (i = 0; i < size; i++)
+	{
+		*seed = *seed * 1103515245 + 12345;
+		data[i] = (BYTE)(*seed >> 16);
+	}
+}
+
+/**
+ * Frames that repeat the previous one with a few edits, sent in fastpath
+ * sized packets through the 2MB history a few times over.
+ */
+int test_XCrushThroughput()
+{
+	int status;
+	int rc = -1;
+	UINT32 i;
+	UINT32 seed = 1;
+	UINT32 offset;
+	UINT64 start;
+	UINT64 ticks = 0;
+	UINT64 compressedBytes = 0;
+	const UINT32 frameSize = 256 * 1024;
+	const UINT32 size = 6 * 1024 * 1024;
+	BYTE OutputBuffer[16384 + 2];
+	BYTE* data = (BYTE*) malloc(size);
+	XCRUSH_CONTEXT* compressor = xcrush_context_new(TRUE);
+	XCRUSH_CONTEXT* decompressor = xcrush_context_new(FALSE);
+
+	if (!data || !compressor || !decompressor)
+		goto fail;
+
+	test_XCrushFill(data, frameSize, &seed);
+
+	/* every other run of 300 bytes is a gradient */
+	for (i = 0; i < frameSize; i++)
+	{
+		if ((i / 300) % 2)
+			data[i] = (BYTE)(i / 7);
+	}
+
+	for (offset = frameSize; offset < size; offset += frameSize)
+	{
+		CopyMemory(&data[offset], &data[offset - frameSize], frameSize);
+		test_XCrushFill(&data[offset + (offset / 3) % (frameSize - 5000)], 5000, &seed);
+	}
+
+	for (offset = 0; offset < size; offset += 16000)
+	{
+		UINT32 Flags = 0;
+		UINT32 DstSize = sizeof(OutputBuffer);
+		UINT32 PlainSize = 0;
+		BYTE* pDstData = OutputBuffer;
+		BYTE* pPlainData = NULL;
+		const UINT32 SrcSize = MIN(16000, size - offset);
+		start = GetTickCount64();
+		status = xcrush_compress(compressor, &data[offset], SrcSize, &pDstData, &DstSize, &Flags);
+		ticks += GetTickCount64() - start;
+
+		if (status < 0)
+		{
+			printf("XCrushThroughput: compression failed with %d at offset %u\n", status,
+			       (unsigned) offset);
+			goto fail;
+		}
+
+		if (!(Flags & PACKET_COMPRESSED))
+		{
+			compressedBytes += SrcSize;
+			continue;
+		}
+
+		compressedBytes += DstSize;
+		status = xcrush_decompress(decompressor, pDstData, DstSize, &pPlainData, &PlainSize, Flags);
+
+		if ((status < 0) || (PlainSize != SrcSize) || (memcmp(pPlainData, &data[offset], SrcSize) != 0))
+		{
+			printf("XCrushThroughput: roundtrip mismatch at offset %u\n", (unsigned) offset);
+			goto fail;
+		}
+	}
+
+	printf("XCrushThroughput: ratio %.3f compress %.1f MB/s\n", (double) compressedBytes / size,
+	       (double) size / (ticks ? ticks : 1) / 1000.0);
+
+	/* the repeated frames are found in the history */
+	if (compressedBytes * 4 > size)
+		goto fail;
+
+	rc = 1;
+fail:
+	xcrush_context_free(compressor);
+	xcrush_context_free(decompressor);
+	free(data);
+	return rc;
+}
+
 int TestFreeRDPCodecXCrush(int argc, char* argv[])
 {
 	//if (test_XCrushCompressBells() < 0)
@@ -140,6 +241,9 @@ int TestFreeRDPCodecXCrush(int argc, char* argv[])
 	if (test_XCrushCompressIsland() < 0)
 		return -1;
 
+	if (test_XCrushThroughput() < 0)
+		return -1;
+
 	return 0;
 }
 
@@ -1,5 +1,8 @@
+#include <stdio.h>
+
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 #include <winpr/bitstream.h>
 
 #include <freerdp/freerdp.h>
@@ -198,6 +201,316 @@ int test_ZGfxCompressConsistent()
 	return 0;
 }
 
+static BOOL test_ZGfxRoundTrip(ZGFX_CONTEXT* compressor, ZGFX_CONTEXT* decompressor,
+                               const BYTE* pSrcData, UINT32 SrcSize, UINT32* pDstSize)
+{
+	BOOL rc;
+	UINT32 Flags = 0;
+	BYTE* pCompressed = NULL;
+	UINT32 CompressedSize = 0;
+	BYTE* pDstData = NULL;
+	UINT32 DstSize = 0;
+
+	if (zgfx_compress(compressor, pSrcData, SrcSize, &pCompressed, &CompressedSize, &Flags) < 0)
+		return FALSE;
+
+	if (zgfx_decompress(decompressor, pCompressed, CompressedSize, &pDstData, &DstSize, Flags) < 0)
+	{
+		free(pCompressed);
+		return FALSE;
+	}
+
+	rc = (DstSize == SrcSize) && (memcmp(pDstData, pSrcData, SrcSize) == 0);
+	*pDstSize = CompressedSize;
+	free(pCompressed);
+	free(pDstData);
+	return rc;
+}
+
+int test_ZGfxCompressRoundTrip()
+{
+	int rc = -1;
+	UINT32 i;
+	UINT32 level;
+	UINT32 seed = 42;
+	UINT32 size1, size2, size3;
+	const UINT32 SrcSize = 200000;
+	BYTE* pSrcData = (BYTE*) malloc(SrcSize);
+	ZGFX_CONTEXT* compressor = NULL;
+	ZGFX_CONTEXT* decompressor = NULL;
+
+	if (!pSrcData)
+		return -1;
+
+	/* short repeated phrases, runs and some noise */
+	for (i = 0; i < SrcSize; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if (((i / 1000) % 3 == 0) && (seed >> 28))
+			pSrcData[i] = TEST_FOX_DATA[i % (sizeof(TEST_FOX_DATA) - 1)];
+		else if ((i / 1000) % 3 == 1)
+			pSrcData[i] = (BYTE)((i / 64) & 0xFF);
+		else
+			pSrcData[i] = (BYTE)(seed >> 16);
+	}
+
+	for (level = ZGFX_COMPRESSION_LEVEL_NONE; level <= ZGFX_COMPRESSION_LEVEL_BEST; level++)
+	{
+		compressor = zgfx_context_new(TRUE);
+		decompressor = zgfx_context_new(FALSE);
+
+		if (!compressor || !decompressor)
+			goto fail;
+
+		if (!zgfx_context_set_compression_level(compressor, level))
+			goto fail;
+
+		/* multipart message, a small single segment one, then the same data again */
+		if (!test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &size1) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, TEST_FOX_DATA,
+		                        sizeof(TEST_FOX_DATA) - 1, &size2) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &size3))
+		{
+			printf("test_ZGfxCompressRoundTrip: level %u mismatch\n", (unsigned) level);
+			goto fail;
+		}
+
+		printf("level %u: %u -> %u, %u (history)\n", (unsigned) level, (unsigned) SrcSize,
+		       (unsigned) size1, (unsigned) size3);
+
+		if ((level != ZGFX_COMPRESSION_LEVEL_NONE) && ((size1 >= SrcSize / 2) || (size3 >= size1 / 10)))
+			goto fail;
+
+		zgfx_context_free(compressor);
+		zgfx_context_free(decompressor);
+		compressor = decompressor = NULL;
+	}
+
+	rc = 0;
+fail:
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	free(pSrcData);
+	return rc;
+}
+
+int test_ZGfxDecompressCorrupt()
+{
+	int rc = -1;
+	UINT32 i;
+	UINT32 DstSize;
+	BYTE* pDstData;
+	BYTE data[sizeof(TEST_FOX_DATA_MULTIPART) - 1];
+	ZGFX_CONTEXT* zgfx = zgfx_context_new(FALSE);
+
+	if (!zgfx)
+		return -1;
+
+	/* every truncation of the multipart sample must be rejected */
+	for (i = 0; i < sizeof(data); i++)
+	{
+		pDstData = NULL;
+
+		if (zgfx_decompress(zgfx, TEST_FOX_DATA_MULTIPART, i, &pDstData, &DstSize, 0) >= 0)
+		{
+			printf("test_ZGfxDecompressCorrupt: truncated to %u accepted\n", (unsigned) i);
+			free(pDstData);
+			goto fail;
+		}
+	}
+
+	/* a bit flipped into a far match must stay inside the buffers, rejected or not */
+	CopyMemory(data, TEST_FOX_DATA_MULTIPART, sizeof(data));
+	data[sizeof(data) - 2] = 0xFF;
+	pDstData = NULL;
+	zgfx_context_reset(zgfx, TRUE);
+
+	if (zgfx_decompress(zgfx, data, sizeof(data), &pDstData, &DstSize, 0) >= 0)
+		free(pDstData);
+
+	rc = 0;
+fail:
+	zgfx_context_free(zgfx);
+	return rc;
+}
+
+/**
+ * Decoder speed on a GFX stream.
+ *
+ * TestFreeRDPCodec TestFreeRDPCodecZGfx [file]
+ *
+ * A file is taken as recorded uncompressed RDPGFX PDUs and cut into messages
+ * the way the server sends them, without one a stream of surface commands
+ * with mostly repeated pixel rows is generated.
+ */
+#define TEST_ZGFX_STREAM_SIZE (4 * 1024 * 1024)
+
+static BYTE* test_ZGfxSyntheticStream(UINT32* size)
+{
+	UINT32 i;
+	UINT32 offset = 0;
+	UINT32 seed = 7;
+	BYTE* data = (BYTE*) malloc(TEST_ZGFX_STREAM_SIZE);
+
+	if (!data)
+		return NULL;
+
+	while (offset < TEST_ZGFX_STREAM_SIZE)
+	{
+		UINT32 length;
+		BYTE* p = &data[offset];
+		seed = seed * 1103515245 + 12345;
+		length = MIN(256 + ((seed >> 8) % 32768), TEST_ZGFX_STREAM_SIZE - offset);
+
+		/* a PDU header, then rows of a gradient with some changed pixels */
+		for (i = 0; i < length; i++)
+		{
+			if (i < 20)
+				p[i] = (BYTE)(i * 13 + (seed >> 24));
+			else if (((i * 7 + seed) % 29) == 0)
+				p[i] = (BYTE)((seed >> 16) + i * i);
+			else
+				p[i] = (BYTE)(((i - 20) % 1024) / 4 + ((seed >> 20) & 0x03));
+		}
+
+		offset += length;
+	}
+
+	*size = TEST_ZGFX_STREAM_SIZE;
+	return data;
+}
+
+static BYTE* test_ZGfxFileStream(const char* filename, UINT32* size)
+{
+	FILE* fp;
+	long length;
+	BYTE* data = NULL;
+
+	if (!(fp = fopen(filename, "rb")))
+		return NULL;
+
+	if ((fseek(fp, 0, SEEK_END) != 0) || ((length = ftell(fp)) <= 0) ||
+	    (fseek(fp, 0, SEEK_SET) != 0))
+		goto out;
+
+	if (!(data = (BYTE*) malloc(length)))
+		goto out;
+
+	if (fread(data, 1, length, fp) != (size_t) length)
+	{
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	*size = (UINT32) length;
+out:
+	fclose(fp);
+	return data;
+}
+
+int test_ZGfxDecompressSpeed(const char* filename)
+{
+	int rc = -1;
+	UINT32 i;
+	UINT32 size = 0;
+	UINT32 offset;
+	UINT32 count = 0;
+	UINT32 compressedSize = 0;
+	UINT64 start;
+	UINT64 ticks;
+	BYTE* data;
+	BYTE** messages = NULL;
+	UINT32* messageSizes = NULL;
+	UINT32* messageFlags = NULL;
+	const UINT32 messageSize = 65536;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (filename)
+		data = test_ZGfxFileStream(filename, &size);
+	else
+		data = test_ZGfxSyntheticStream(&size);
+
+	if (!data || !compressor || !decompressor)
+		goto fail;
+
+	/* messages are at least 256 bytes */
+	messages = (BYTE**) calloc(size / 256 + 1, sizeof(BYTE*));
+	messageSizes = (UINT32*) calloc(size / 256 + 1, sizeof(UINT32));
+	messageFlags = (UINT32*) calloc(size / 256 + 1, sizeof(UINT32));
+
+	if (!messages || !messageSizes || !messageFlags)
+		goto fail;
+
+	/* a recorded stream is cut into messages of up to 64K, both run through the encoder once */
+	for (offset = 0; offset < size; count++)
+	{
+		const UINT32 length = MIN(filename ? messageSize : 256 + (offset * 31 % 32768),
+		                          size - offset);
+
+		if (zgfx_compress(compressor, &data[offset], length, &messages[count],
+		                  &messageSizes[count], &messageFlags[count]) < 0)
+			goto fail;
+
+		compressedSize += messageSizes[count];
+		offset += length;
+	}
+
+	offset = 0;
+	start = GetTickCount64();
+
+	for (i = 0; i < count; i++)
+	{
+		BYTE* pDstData = NULL;
+		UINT32 DstSize = 0;
+		BOOL match;
+
+		if (zgfx_decompress(decompressor, messages[i], messageSizes[i], &pDstData, &DstSize,
+		                    messageFlags[i]) < 0)
+		{
+			printf("test_ZGfxDecompressSpeed: message %u failed\n", (unsigned) i);
+			goto fail;
+		}
+
+		match = (DstSize <= size - offset) && (memcmp(pDstData, &data[offset], DstSize) == 0);
+		offset += DstSize;
+		free(pDstData);
+
+		if (!match)
+		{
+			printf("test_ZGfxDecompressSpeed: message %u mismatch\n", (unsigned) i);
+			goto fail;
+		}
+	}
+
+	ticks = GetTickCount64() - start;
+
+	if (offset != size)
+		goto fail;
+
+	printf("decompress: %u messages, %u -> %u bytes, %.1f MB/s\n", (unsigned) count,
+	       (unsigned) compressedSize, (unsigned) size,
+	       (double) size / (ticks ? ticks : 1) / 1000.0);
+	rc = 0;
+fail:
+
+	if (messages)
+	{
+		for (i = 0; i < count; i++)
+			free(messages[i]);
+	}
+
+	free(messages);
+	free(messageSizes);
+	free(messageFlags);
+	free(data);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	if (test_ZGfxCompressFox() < 0)
@@ -212,6 +525,15 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressRoundTrip() < 0)
+		return -1;
+
+	if (test_ZGfxDecompressCorrupt() < 0)
+		return -1;
+
+	if (test_ZGfxDecompressSpeed((argc > 1) ? argv[1] : NULL) < 0)
+		return -1;
+
 	return 0;
 }
 
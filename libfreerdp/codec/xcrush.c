@@ -28,8 +28,67 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/xcrush.h>
 
+#if defined(WITH_SSE2) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#include <emmintrin.h>
+#define XCRUSH_SSE2
+#endif
+
 #define TAG FREERDP_TAG("codec")
 
+/**
+ * Chunk boundaries come from a gear hash, each byte shifts the hash left, so
+ * its top bits depend on the last 32 bytes. A boundary is set when the top
+ * 7 bits are clear, every 128 bytes on average.
+ */
+#define XCRUSH_CHUNK_MASK 0xFE000000
+
+static const UINT32 XCRUSH_GEAR[256] =
+{
+	0x3A85A4DC, 0xD443C47C, 0x6DC47761, 0x28F0AE6A, 0xE48A855E, 0x21871330,
+	0x2702C2FD, 0x4784CB12, 0x83A3F88E, 0xC6B6C90E, 0x6D5FE21C, 0xD50F11F9,
+	0xBDBEB6DC, 0x4FF3511A, 0x9FDF0574, 0x6B65B406, 0x888EB791, 0x6A15576E,
+	0x9096D3E9, 0x06874899, 0x6E2CE103, 0x0A9FAA6D, 0xDB998DC1, 0xC7CD18D7,
+	0x72C33FCE, 0x5D2A033E, 0x7EEBB517, 0x3D036000, 0xAE691B21, 0xD6707698,
+	0xD22FC4B9, 0x19481338, 0xFB070EFC, 0xC2E3A9A8, 0x348C36F6, 0xF1BB1BD8,
+	0xC82915CB, 0x1687E355, 0x61980FFA, 0x288E4C34, 0x7B76D269, 0x690D4669,
+	0x253A581E, 0xE923E53A, 0xC9E9FD79, 0x673C14CF, 0xB2D0963C, 0xAD9DF6B7,
+	0x59C7D362, 0x5AF17618, 0xC86DFC0C, 0xD7C82C93, 0x29CD3FA3, 0x1B67FC3D,
+	0x6EAED22B, 0x898A7303, 0xC3E007B3, 0xA739F61B, 0xD6313AFF, 0xE96E3A09,
+	0x6A661CF8, 0x33AC146B, 0x93D6B255, 0x3D92678C, 0xD3B1B3AC, 0x32DED778,
+	0x285BAD33, 0xB2262C2D, 0xA847C68F, 0x76F29A64, 0x182FD07F, 0x2438604C,
+	0x5CC22BBB, 0x75545595, 0xC5C3EED3, 0xAEBB3D51, 0xFC161649, 0xA4FCA264,
+	0x263C4DD1, 0x90CB5B06, 0xE11E2CFA, 0xB259B46B, 0x38B1D6B4, 0x30E361FB,
+	0x304C447B, 0xBF4B1B54, 0xC120D32F, 0x78CE73DD, 0xE1FBD33D, 0x47E3CDAA,
+	0xB4D3CE97, 0x3D5ACE59, 0xF7F8DC43, 0x43DD9D86, 0xCE834053, 0x12044C87,
+	0xC5F7E4BB, 0x66996F87, 0xAF16E719, 0xDEDB7662, 0x8241AFC4, 0xC9332CE7,
+	0x18EA0997, 0x3CE89B65, 0x29758713, 0x8C58AD3C, 0x78D9F340, 0x24519DF3,
+	0x71E64FA2, 0x0D813097, 0xA929819A, 0x2A8CD90C, 0x7478845C, 0xFEA779B9,
+	0x9D7C962A, 0x5B57273F, 0xECF5B89F, 0x0E1EE509, 0x964B213A, 0x8FB4C2B9,
+	0x12B73113, 0x937A2DA0, 0xE3843D70, 0x227330CE, 0x49EC8ACA, 0x906C8BE8,
+	0x47641DDA, 0xE2586CBC, 0x4EAF2468, 0x613AD882, 0xB0277F28, 0x8E4DD45A,
+	0xD6BDD066, 0xC2FA6773, 0x2342E347, 0xA94893E7, 0xEF6B4DFF, 0x9647A7EC,
+	0xED31EA58, 0x7627C61F, 0x7D191F94, 0x6A78B19E, 0xB0213210, 0x52CC05A9,
+	0x74BEABD6, 0xE751094C, 0x50B5412E, 0xAF2489A8, 0x58D563A0, 0x06D51F7E,
+	0x02B744E8, 0x69369D99, 0x48D47DC4, 0x8CDC6168, 0x0105F470, 0x7BB9C613,
+	0x497A2D75, 0xAC7617E9, 0x03F39492, 0x6029332E, 0x6F7E2680, 0x7341B4A1,
+	0xFA366D32, 0x7DA29A4A, 0xAC82ECFA, 0xED6C0EF7, 0x2564A9EF, 0x7E76C1C2,
+	0x2394451B, 0xE86FD0F9, 0x6A3C95DC, 0xBE388CE4, 0x81C24D6E, 0x58C60586,
+	0x4AFDFE9B, 0x992FF889, 0x1AEEB744, 0x3F2F4EC2, 0xBD571DF8, 0xAE8F033E,
+	0xB44F3689, 0x85DB0E95, 0x838907B8, 0x9341ACCA, 0x93C156CD, 0xFA18942E,
+	0x30ED3877, 0xD31F94A2, 0x07F25604, 0x626FF508, 0xDDA3F9B0, 0x38E6F27D,
+	0x59D5E985, 0xDDA37D8F, 0x15CC0658, 0x5A7B871A, 0x2F9D9CD4, 0x500844E5,
+	0xA6863C5D, 0xD9AEA599, 0x5004EDDB, 0x725FF5E8, 0x84570964, 0x7E757A57,
+	0x003C82EC, 0xBB7EDFBD, 0x7C235EE2, 0xB4707EA2, 0xB77941F0, 0x80D73CE6,
+	0x649D1DDC, 0x2F0BE5FB, 0xBA5CCCDD, 0x95346C68, 0xC1C5BC74, 0x8CBC93E3,
+	0x17A15F04, 0x4A48FA9C, 0x8539F109, 0x7AF0541B, 0x06DF090E, 0x3F5DB609,
+	0x8454AB11, 0x57360323, 0x1FE274D6, 0xCC1C9668, 0x2D9CED9C, 0x445F3D27,
+	0xACF06ED8, 0x03DD6E26, 0xED7719FF, 0x4F117273, 0x0B2C3B5B, 0x9D557455,
+	0x9F5DFB3F, 0x8DE6F619, 0x55163E1C, 0xEAA75E67, 0x5E1709AE, 0x9D6C405B,
+	0xF2121C70, 0x24CBAA78, 0x75CA3A34, 0xEA3099A2, 0x9DA0609F, 0x01779A59,
+	0xBB0AFE9F, 0x19D1BB35, 0xD0E1076B, 0xE4CF5983, 0x1CFE91AE, 0x3113E9D6,
+	0x4C247687, 0x730E4AB6, 0x07B3391C, 0x3007D376
+};
+
 const char* xcrush_get_level_2_compression_flags_string(UINT32 flags)
 {
 	flags &= 0xE0;
@@ -109,16 +168,17 @@ UINT32 xcrush_update_hash(BYTE* data, UINT32 size)
 
 	while (data < end)
 	{
-		seed += (data[3] ^ data[0]) + (data[1] << 8);
+		seed = (seed * 33) ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((UINT32) data[3] << 24));
 		data += 4;
 	}
 
-	return (UINT16) seed;
+	/* 0 marks an empty chunk table entry */
+	return seed ? seed : 1;
 }
 
 int xcrush_append_chunk(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32* beg, UINT32 end)
 {
-	UINT16 seed;
+	UINT32 seed;
 	UINT32 size;
 
 	if (xcrush->SignatureIndex >= xcrush->SignatureCount)
@@ -131,7 +191,7 @@ int xcrush_append_chunk(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32* beg, UINT32
 
 	if (size >= 15)
 	{
-		seed = xcrush_update_hash(&data[*beg], (UINT16) size);
+		seed = xcrush_update_hash(&data[*beg], size);
 		xcrush->Signatures[xcrush->SignatureIndex].size = size;
 		xcrush->Signatures[xcrush->SignatureIndex].seed = seed;
 		xcrush->SignatureIndex++;
@@ -143,10 +203,9 @@ int xcrush_append_chunk(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32* beg, UINT32
 
 int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32 size, UINT32* pIndex)
 {
-	UINT32 i = 0;
+	UINT32 i;
+	UINT32 hash = 0;
 	UINT32 offset = 0;
-	UINT32 rotation = 0;
-	UINT32 accumulator = 0;
 
 	*pIndex = 0;
 	xcrush->SignatureIndex = 0;
@@ -154,50 +213,17 @@ int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32 size, UINT3
 	if (size < 128)
 		return 0;
 
-	for (i = 0; i < 32; i++)
-	{
-		rotation = _rotl(accumulator, 1);
-		accumulator = data[i] ^ rotation;
-	}
+	/* boundaries lie between 32 and size - 32 bytes */
+	for (i = 0; i < 31; i++)
+		hash = (hash << 1) + XCRUSH_GEAR[data[i]];
 
-	for (i = 0; i < size - 64; i++)
+	for (; i < size - 32; i++)
 	{
-		rotation = _rotl(accumulator, 1);
-		accumulator = data[i + 32] ^ data[i] ^ rotation;
-
-		if (!(accumulator & 0x7F))
-		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
-				return 0;
-		}
-		i++;
-
-		rotation = _rotl(accumulator, 1);
-		accumulator = data[i + 32] ^ data[i] ^ rotation;
-
-		if (!(accumulator & 0x7F))
-		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
-				return 0;
-		}
-		i++;
-
-		rotation = _rotl(accumulator, 1);
-		accumulator = data[i + 32] ^ data[i] ^ rotation;
+		hash = (hash << 1) + XCRUSH_GEAR[data[i]];
 
-		if (!(accumulator & 0x7F))
+		if (!(hash & XCRUSH_CHUNK_MASK))
 		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
-				return 0;
-		}
-		i++;
-
-		rotation = _rotl(accumulator, 1);
-		accumulator = data[i + 32] ^ data[i] ^ rotation;
-
-		if (!(accumulator & 0x7F))
-		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
+			if (!xcrush_append_chunk(xcrush, data, &offset, i + 1))
 				return 0;
 		}
 	}
@@ -221,115 +247,80 @@ UINT32 xcrush_compute_signatures(XCRUSH_CONTEXT* xcrush, BYTE* data, UINT32 size
 	return 0;
 }
 
-void xcrush_clear_hash_table_range(XCRUSH_CONTEXT* xcrush, UINT32 beg, UINT32 end)
+/**
+ * Looks up the chunks with the same signature, most recent first, and
+ * records the new chunk in their bucket. The oldest entry of a full bucket
+ * is dropped. Returns the number of chunk offsets written to pChunkOffsets.
+ */
+static UINT32 xcrush_insert_chunk(XCRUSH_CONTEXT* xcrush, XCRUSH_SIGNATURE* signature,
+                                  UINT32 offset, UINT32* pChunkOffsets)
 {
-	UINT32 index;
+	UINT32 way;
+	UINT32 count = 0;
+	XCRUSH_CHUNK* bucket = xcrush->Chunks[signature->seed & (XCRUSH_CHUNK_BUCKETS - 1)];
 
-	for (index = 0; index < 65536; index++)
+	for (way = 0; way < XCRUSH_CHUNK_WAYS; way++)
 	{
-		if (xcrush->NextChunks[index] >= beg)
-		{
-			if (xcrush->NextChunks[index] <= end)
-			{
-				xcrush->NextChunks[index] = 0;
-			}
-		}
+		if (bucket[way].seed == signature->seed)
+			pChunkOffsets[count++] = bucket[way].offset;
 	}
 
-	for (index = 0; index < 65534; index++)
-	{
-		if (xcrush->Chunks[index].next >= beg )
-		{
-			if (xcrush->Chunks[index].next <= end)
-			{
-				xcrush->Chunks[index].next = 0;
-			}
-		}
-	}
+	MoveMemory(&bucket[1], &bucket[0], sizeof(XCRUSH_CHUNK) * (XCRUSH_CHUNK_WAYS - 1));
+	bucket[0].seed = signature->seed;
+	bucket[0].offset = offset;
+
+	return count;
 }
 
-int xcrush_find_next_matching_chunk(XCRUSH_CONTEXT* xcrush, XCRUSH_CHUNK* chunk, XCRUSH_CHUNK** pNextChunk)
+/**
+ * Length of the common prefix of a and b, at most limit bytes.
+ */
+static UINT32 xcrush_match_forward(const BYTE* a, const BYTE* b, UINT32 limit)
 {
-	UINT32 index;
-	XCRUSH_CHUNK* next = NULL;
-
-	if (!chunk)
-		return -4001; /* error */
+	UINT32 length = 0;
+#ifdef XCRUSH_SSE2
 
-	if (chunk->next)
+	while (length + 32 <= limit)
 	{
-		index = (chunk - xcrush->Chunks) / sizeof(XCRUSH_CHUNK);
+		const __m128i a0 = _mm_loadu_si128((const __m128i*) &a[length]);
+		const __m128i b0 = _mm_loadu_si128((const __m128i*) &b[length]);
+		const __m128i a1 = _mm_loadu_si128((const __m128i*) &a[length + 16]);
+		const __m128i b1 = _mm_loadu_si128((const __m128i*) &b[length + 16]);
+		const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a0, b0), _mm_cmpeq_epi8(a1, b1));
 
-		if (index >= 65534)
-			return -4002; /* error */
-
-		if ((index < xcrush->ChunkHead) || (chunk->next >= xcrush->ChunkHead))
-		{
-			if (chunk->next >= 65534)
-				return -4003; /* error */
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			break;
 
-			next = &xcrush->Chunks[chunk->next];
-		}
+		length += 32;
 	}
 
-	*pNextChunk = next;
-
-	return 1;
-}
-
-int xcrush_insert_chunk(XCRUSH_CONTEXT* xcrush, XCRUSH_SIGNATURE* signature, UINT32 offset, XCRUSH_CHUNK** pPrevChunk)
-{
-	UINT32 seed;
-	UINT32 index;
-
-	if (xcrush->ChunkHead >= 65530)
-	{
-		xcrush->ChunkHead = 1;
-		xcrush->ChunkTail = 1;
-	}
+#endif
 
-	if (xcrush->ChunkHead >= xcrush->ChunkTail)
+	while (length + 8 <= limit)
 	{
-		xcrush_clear_hash_table_range(xcrush, xcrush->ChunkTail, xcrush->ChunkTail + 10000);
-		xcrush->ChunkTail += 10000;
-	}
-
-	index = xcrush->ChunkHead++;
+		UINT64 va, vb;
+		CopyMemory(&va, &a[length], 8);
+		CopyMemory(&vb, &b[length], 8);
 
-	if (xcrush->ChunkHead >= 65534)
-		return -3001; /* error */
-
-	xcrush->Chunks[index].offset = offset;
-
-	seed = signature->seed;
-
-	if (seed >= 65536)
-		return -3002; /* error */
-
-	if (xcrush->NextChunks[seed])
-	{
-		if (xcrush->NextChunks[seed] >= 65534)
-			return -3003; /* error */
+		if (va != vb)
+			break;
 
-		*pPrevChunk = &xcrush->Chunks[xcrush->NextChunks[seed]];
+		length += 8;
 	}
 
-	xcrush->Chunks[index].next = xcrush->NextChunks[seed] & 0xFFFF;
-	xcrush->NextChunks[seed] = index;
+	while ((length < limit) && (a[length] == b[length]))
+		length++;
 
-	return 1;
+	return length;
 }
 
 int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset, UINT32 ChunkOffset, UINT32 HistoryOffset, UINT32 SrcSize, UINT32 MaxMatchLength, XCRUSH_MATCH_INFO* MatchInfo)
 {
-	UINT32 MatchSymbol;
-	UINT32 ChunkSymbol;
+	UINT32 ForwardLimit;
 	BYTE* ChunkBuffer;
 	BYTE* MatchBuffer;
 	BYTE* MatchStartPtr;
-	BYTE* ForwardChunkPtr;
 	BYTE* ReverseChunkPtr;
-	BYTE* ForwardMatchPtr;
 	BYTE* ReverseMatchPtr;
 	BYTE* HistoryBufferEnd;
 	UINT32 ReverseMatchLength;
@@ -364,28 +355,16 @@ int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset, UINT32
 	if (ChunkBuffer < HistoryBuffer)
 		return -2005; /* error */
 
-	ForwardMatchPtr = &HistoryBuffer[MatchOffset];
-	ForwardChunkPtr = &HistoryBuffer[ChunkOffset];
-
 	if ((&MatchBuffer[MaxMatchLength + 1] < HistoryBufferEnd)
 		&& (MatchBuffer[MaxMatchLength + 1] != ChunkBuffer[MaxMatchLength + 1]))
 	{
 		return 0;
 	}
 
-	while (1)
-	{
-		MatchSymbol = *ForwardMatchPtr++;
-		ChunkSymbol = *ForwardChunkPtr++;
-
-		if (MatchSymbol != ChunkSymbol)
-			break;
-
-		if (ForwardMatchPtr > HistoryBufferEnd)
-			break;
-			
-		ForwardMatchLength++;
-	}
+	/* the match may not run past the input, nor its source past the history */
+	ForwardLimit = MIN((UINT32) (HistoryBufferEnd - MatchBuffer),
+	                   HistoryBufferSize - ChunkOffset - 1);
+	ForwardMatchLength = xcrush_match_forward(MatchBuffer, ChunkBuffer, ForwardLimit);
 
 	ReverseMatchPtr = MatchBuffer - 1;
 	ReverseChunkPtr = ChunkBuffer - 1;
@@ -423,7 +402,8 @@ int xcrush_find_all_matches(XCRUSH_CONTEXT* xcrush, UINT32 SignatureIndex, UINT3
 	UINT32 offset = 0;
 	UINT32 ChunkIndex = 0;
 	UINT32 ChunkCount = 0;
-	XCRUSH_CHUNK* chunk = NULL;
+	UINT32 ChunkOffset = 0;
+	UINT32 ChunkOffsets[XCRUSH_CHUNK_WAYS];
 	UINT32 MatchLength = 0;
 	UINT32 MaxMatchLength = 0;
 	UINT32 PrevMatchEnd = 0;
@@ -440,23 +420,21 @@ int xcrush_find_all_matches(XCRUSH_CONTEXT* xcrush, UINT32 SignatureIndex, UINT3
 		if (!Signatures[i].size)
 			return -1001; /* error */
 
-		status = xcrush_insert_chunk(xcrush, &Signatures[i], offset, &chunk);
-
-		if (status < 0)
-			return status;
+		ChunkCount = xcrush_insert_chunk(xcrush, &Signatures[i], offset, ChunkOffsets);
 
-		if (chunk && (SrcOffset + HistoryOffset + Signatures[i].size >= PrevMatchEnd))
+		if (ChunkCount && (SrcOffset + HistoryOffset + Signatures[i].size >= PrevMatchEnd))
 		{
-			ChunkCount = 0;
 			MaxMatchLength = 0;
 			ZeroMemory(&MaxMatchInfo, sizeof(XCRUSH_MATCH_INFO));
 
-			while (chunk)
-			{				
-				if ((chunk->offset < HistoryOffset) || (chunk->offset < offset)
-					|| (chunk->offset > SrcSize + HistoryOffset))
+			for (ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+			{
+				ChunkOffset = ChunkOffsets[ChunkIndex];
+
+				if ((ChunkOffset < HistoryOffset) || (ChunkOffset < offset)
+					|| (ChunkOffset > SrcSize + HistoryOffset))
 				{
-					status = xcrush_find_match_length(xcrush, offset, chunk->offset,
+					status = xcrush_find_match_length(xcrush, offset, ChunkOffset,
 							HistoryOffset, SrcSize, MaxMatchLength, &MatchInfo);
 					
 					if (status < 0)
@@ -475,16 +453,6 @@ int xcrush_find_all_matches(XCRUSH_CONTEXT* xcrush, UINT32 SignatureIndex, UINT3
 							break;
 					}
 				}
-				
-				ChunkIndex = ChunkCount++;
-
-				if (ChunkIndex > 4)
-					break;
-				
-				status = xcrush_find_next_matching_chunk(xcrush, chunk, &chunk);
-
-				if (status < 0)
-					return status; /* error */
 			}
 
 			if (MaxMatchLength)
@@ -675,6 +643,13 @@ int xcrush_copy_bytes(BYTE* dst, BYTE* src, int num)
 {
 	int index;
 
+	if ((src + num <= dst) || (dst + num <= src))
+	{
+		CopyMemory(dst, src, num);
+		return num;
+	}
+
+	/* an overlapping match repeats its pattern */
 	for (index = 0; index < num; index++)
 	{
 		dst[index] = src[index];
@@ -970,7 +945,8 @@ int xcrush_compress(XCRUSH_CONTEXT* xcrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 	if (status < 0)
 		return status;
 
-	if (!status || (Level2ComprFlags & PACKET_FLUSHED))
+	/* a compressed packet may carry PACKET_FLUSHED for an earlier flush */
+	if (!status || !(Level2ComprFlags & PACKET_COMPRESSED))
 	{
 		if (CompressedDataSize > DstSize)
 		{
@@ -1023,9 +999,7 @@ void xcrush_context_reset(XCRUSH_CONTEXT* xcrush, BOOL flush)
 
 	xcrush->CompressionFlags = 0;
 
-	xcrush->ChunkHead = xcrush->ChunkTail = 1;
 	ZeroMemory(&(xcrush->Chunks), sizeof(xcrush->Chunks));
-	ZeroMemory(&(xcrush->NextChunks), sizeof(xcrush->NextChunks));
 
 	ZeroMemory(&(xcrush->OriginalMatches), sizeof(xcrush->OriginalMatches));
 	ZeroMemory(&(xcrush->OptimizedMatches), sizeof(xcrush->OptimizedMatches));
@@ -27,6 +27,7 @@
 
 #include <freerdp/log.h>
 #include <freerdp/codec/zgfx.h>
+#include <freerdp/utils/profiler.h>
 
 #define TAG FREERDP_TAG("codec")
 
@@ -96,17 +97,103 @@ static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] =
 	{ 0 }
 };
 
-#define zgfx_GetBits(_zgfx, _nbits) \
-	while (_zgfx->cBitsCurrent < _nbits) { \
-		_zgfx->BitsCurrent <<= 8; \
-		if (_zgfx->pbInputCurrent < _zgfx->pbInputEnd) \
-			_zgfx->BitsCurrent += *(_zgfx->pbInputCurrent)++; \
-		_zgfx->cBitsCurrent += 8; \
-	} \
-	_zgfx->cBitsRemaining -= _nbits; \
-	_zgfx->cBitsCurrent -= _nbits; \
-	_zgfx->bits = _zgfx->BitsCurrent >> _zgfx->cBitsCurrent; \
-	_zgfx->BitsCurrent &= ((1 << _zgfx->cBitsCurrent) - 1);
+/**
+ * The decoder peeks ZGFX_DECODE_BITS bits, enough for the longest token
+ * prefix and for "0" plus an 8 bit literal, and looks the token up in the
+ * DecodeTable of the context. An entry holds the bits consumed, the literal
+ * value or, with ZGFX_DECODE_MATCH set, the index into ZGFX_TOKEN_TABLE.
+ * Entries of unassigned prefixes are 0.
+ */
+#define ZGFX_DECODE_BITS	9
+#define ZGFX_DECODE_MATCH	0x8000
+#define ZGFX_DECODE_LENGTH(_entry)	(((_entry) >> 8) & 0x0F)
+
+struct _ZGFX_BIT_READER
+{
+	const BYTE* pbInput;
+	const BYTE* pbInputEnd;
+	UINT64 bits; /* cBits valid bits, most significant first */
+	UINT32 cBits;
+	UINT32 position; /* bits consumed since the start of the segment */
+};
+typedef struct _ZGFX_BIT_READER ZGFX_BIT_READER;
+
+/* Tops the reader up to at least 57 bits, past the end with zeros */
+static INLINE void zgfx_fill_bits(ZGFX_BIT_READER* br)
+{
+	if (br->pbInputEnd - br->pbInput >= 8)
+	{
+		const BYTE* p = br->pbInput;
+		const UINT64 value = ((UINT64) p[0] << 56) | ((UINT64) p[1] << 48) | ((UINT64) p[2] << 40) |
+		                     ((UINT64) p[3] << 32) | ((UINT64) p[4] << 24) | ((UINT64) p[5] << 16) |
+		                     ((UINT64) p[6] << 8) | (UINT64) p[7];
+		/* a partially taken byte is or'ed in again at the same place by the next fill */
+		const UINT32 bytes = (63 - br->cBits) >> 3;
+		br->bits |= value >> br->cBits;
+		br->pbInput += bytes;
+		br->cBits += bytes << 3;
+		return;
+	}
+
+	while (br->cBits <= 56)
+	{
+		UINT64 value = 0;
+
+		if (br->pbInput < br->pbInputEnd)
+			value = *(br->pbInput)++;
+
+		br->bits |= value << (56 - br->cBits);
+		br->cBits += 8;
+	}
+}
+
+static INLINE UINT32 zgfx_peek_bits(const ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	return nbits ? (UINT32)(br->bits >> (64 - nbits)) : 0;
+}
+
+static INLINE void zgfx_skip_bits(ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	br->bits <<= nbits;
+	br->cBits -= nbits;
+	br->position += nbits;
+}
+
+static INLINE UINT32 zgfx_read_bits(ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	const UINT32 value = zgfx_peek_bits(br, nbits);
+	zgfx_skip_bits(br, nbits);
+	return value;
+}
+
+static void zgfx_init_decode_table(ZGFX_CONTEXT* zgfx)
+{
+	UINT32 i;
+	UINT32 index;
+	UINT32 entry;
+	UINT32 shift;
+	const ZGFX_TOKEN* token;
+
+	ZeroMemory(zgfx->DecodeTable, sizeof(zgfx->DecodeTable));
+
+	for (index = 0; ZGFX_TOKEN_TABLE[index].prefixLength != 0; index++)
+	{
+		token = &ZGFX_TOKEN_TABLE[index];
+		shift = ZGFX_DECODE_BITS - token->prefixLength;
+
+		for (i = 0; i < (1U << shift); i++)
+		{
+			/* literal values always fit into the peeked bits */
+			if (token->tokenType == 0)
+				entry = ((token->prefixLength + token->valueBits) << 8) |
+				        (token->valueBase + (i >> (shift - token->valueBits)));
+			else
+				entry = ZGFX_DECODE_MATCH | (token->prefixLength << 8) | index;
+
+			zgfx->DecodeTable[(token->prefixCode << shift) | i] = (UINT16) entry;
+		}
+	}
+}
 
 void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src, UINT32 count)
 {
@@ -191,16 +278,49 @@ void zgfx_history_buffer_ring_read(ZGFX_CONTEXT* zgfx, int offset, BYTE* dst, UI
 	while ((bytesLeft -= bytes) > 0);
 }
 
+/**
+ * Copies a match to the output. Bytes of the current segment are taken from
+ * the output buffer, older ones from the history ring, which only receives
+ * the segment once it is complete. Overlapping matches repeat their pattern,
+ * the copied span doubles with every step.
+ */
+static INLINE void zgfx_copy_match(ZGFX_CONTEXT* zgfx, UINT32 distance, UINT32 count)
+{
+	const BYTE* src;
+	BYTE* dst = &(zgfx->OutputBuffer[zgfx->OutputCount]);
+
+	if (distance > zgfx->OutputCount)
+	{
+		const UINT32 bytes = MIN(count, distance - zgfx->OutputCount);
+		zgfx_history_buffer_ring_read(zgfx, distance - zgfx->OutputCount, dst, bytes);
+		dst += bytes;
+		count -= bytes;
+	}
+
+	src = dst - distance;
+
+	while (count > distance)
+	{
+		CopyMemory(dst, src, distance);
+		dst += distance;
+		count -= distance;
+		distance <<= 1;
+	}
+
+	CopyMemory(dst, src, count);
+}
+
 static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UINT32 cbSegment)
 {
-	BYTE c;
 	BYTE flags;
-	int extra;
-	int opIndex;
-	int haveBits;
-	int inPrefix;
+	UINT32 entry;
+	UINT32 extra;
 	UINT32 count;
 	UINT32 distance;
+	UINT32 cBitsTotal;
+	ZGFX_BIT_READER br;
+	const ZGFX_TOKEN* token;
+	const BYTE* pbUnencoded;
 
 	if (cbSegment < 1)
 		return -1;
@@ -214,6 +334,9 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 
 	if (!(flags & PACKET_COMPRESSED))
 	{
+		if (cbSegment > sizeof(zgfx->OutputBuffer))
+			return -1;
+
 		zgfx_history_buffer_ring_write(zgfx, pbSegment, cbSegment);
 		CopyMemory(zgfx->OutputBuffer, pbSegment, cbSegment);
 		zgfx->OutputCount = cbSegment;
@@ -221,130 +344,130 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 		return 1;
 	}
 
-	zgfx->pbInputCurrent = pbSegment;
-	zgfx->pbInputEnd = &pbSegment[cbSegment - 1];
+	if (cbSegment < 1)
+		return -1;
+
+	br.pbInput = pbSegment;
+	br.pbInputEnd = &pbSegment[cbSegment - 1];
+	br.bits = 0;
+	br.cBits = 0;
+	br.position = 0;
 
 	/* NumberOfBitsToDecode = ((NumberOfBytesToDecode - 1) * 8) - ValueOfLastByte */
-	zgfx->cBitsRemaining = 8 * (cbSegment - 1) - *zgfx->pbInputEnd;
-	zgfx->cBitsCurrent = 0;
-	zgfx->BitsCurrent = 0;
+	if (*br.pbInputEnd > 8 * (cbSegment - 1))
+		return -1;
+
+	cBitsTotal = 8 * (cbSegment - 1) - *br.pbInputEnd;
 
-	while (zgfx->cBitsRemaining)
+	while (br.position < cBitsTotal)
 	{
-		haveBits = 0;
-		inPrefix = 0;
+		zgfx_fill_bits(&br);
+		entry = zgfx->DecodeTable[zgfx_peek_bits(&br, ZGFX_DECODE_BITS)];
 
-		for (opIndex = 0; ZGFX_TOKEN_TABLE[opIndex].prefixLength != 0; opIndex++)
+		if (!ZGFX_DECODE_LENGTH(entry))
+			return -1;
+
+		zgfx_skip_bits(&br, ZGFX_DECODE_LENGTH(entry));
+
+		if (!(entry & ZGFX_DECODE_MATCH))
 		{
-			while (haveBits < ZGFX_TOKEN_TABLE[opIndex].prefixLength)
-			{
-				zgfx_GetBits(zgfx, 1);
-				inPrefix = (inPrefix << 1) + zgfx->bits;
-				haveBits++;
-			}
+			/* Literal */
 
-			if (inPrefix == ZGFX_TOKEN_TABLE[opIndex].prefixCode)
-			{
-				if (ZGFX_TOKEN_TABLE[opIndex].tokenType == 0)
-				{
-					/* Literal */
+			if (zgfx->OutputCount >= sizeof(zgfx->OutputBuffer))
+				return -1;
+
+			zgfx->OutputBuffer[zgfx->OutputCount++] = (BYTE) entry;
+			continue;
+		}
 
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					c = (BYTE) (ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits);
+		token = &ZGFX_TOKEN_TABLE[entry & 0xFF];
+		distance = token->valueBase + zgfx_read_bits(&br, token->valueBits);
 
-					zgfx->HistoryBuffer[zgfx->HistoryIndex] = c;
+		if (distance != 0)
+		{
+			/* Match */
 
-					if (++zgfx->HistoryIndex == zgfx->HistoryBufferSize)
-						zgfx->HistoryIndex = 0;
+			zgfx_fill_bits(&br);
 
-					zgfx->OutputBuffer[zgfx->OutputCount++] = c;
-				}
-				else
+			if (zgfx_read_bits(&br, 1) == 0)
+			{
+				count = 3;
+			}
+			else
+			{
+				count = 4;
+				extra = 2;
+
+				while (zgfx_read_bits(&br, 1) == 1)
 				{
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					distance = ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits;
-
-					if (distance != 0)
-					{
-						/* Match */
-
-						zgfx_GetBits(zgfx, 1);
-
-						if (zgfx->bits == 0)
-						{
-							count = 3;
-						}
-						else
-						{
-							count = 4;
-							extra = 2;
-
-							zgfx_GetBits(zgfx, 1);
-
-							while (zgfx->bits == 1)
-							{
-								count *= 2;
-								extra++;
-
-								zgfx_GetBits(zgfx, 1);
-							}
-
-							zgfx_GetBits(zgfx, extra);
-							count += zgfx->bits;
-						}
-
-						zgfx_history_buffer_ring_read(zgfx, distance, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx_history_buffer_ring_write(zgfx, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx->OutputCount += count;
-					}
-					else
-					{
-						/* Unencoded */
-
-						zgfx_GetBits(zgfx, 15);
-						count = zgfx->bits;
-
-						zgfx->cBitsRemaining -= zgfx->cBitsCurrent;
-						zgfx->cBitsCurrent = 0;
-						zgfx->BitsCurrent = 0;
-
-						CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), zgfx->pbInputCurrent, count);
-						zgfx_history_buffer_ring_write(zgfx, zgfx->pbInputCurrent, count);
-
-						zgfx->pbInputCurrent += count;
-						zgfx->cBitsRemaining -= (8 * count);
-						zgfx->OutputCount += count;
-					}
+					count *= 2;
+					extra++;
+
+					if (count > sizeof(zgfx->OutputBuffer))
+						return -1;
 				}
 
-				break;
+				count += zgfx_read_bits(&br, extra);
 			}
+
+			if ((distance > zgfx->HistoryBufferSize) ||
+			    (zgfx->OutputCount + count > sizeof(zgfx->OutputBuffer)))
+				return -1;
+
+			zgfx_copy_match(zgfx, distance, count);
+			zgfx->OutputCount += count;
+		}
+		else
+		{
+			/* Unencoded, starting at the next byte */
+
+			count = zgfx_read_bits(&br, 15);
+			pbUnencoded = &pbSegment[(br.position + 7) / 8];
+
+			if ((pbUnencoded + count > br.pbInputEnd) ||
+			    (zgfx->OutputCount + count > sizeof(zgfx->OutputBuffer)))
+				return -1;
+
+			CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), pbUnencoded, count);
+			zgfx->OutputCount += count;
+
+			br.pbInput = pbUnencoded + count;
+			br.bits = 0;
+			br.cBits = 0;
+			br.position = 8 * (UINT32)(br.pbInput - pbSegment);
 		}
 	}
 
+	if (br.position != cBitsTotal)
+		return -1;
+
+	zgfx_history_buffer_ring_write(zgfx, zgfx->OutputBuffer, zgfx->OutputCount);
 	return 1;
 }
 
 int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
 {
-	int status;
+	int status = -1;
 	BYTE descriptor;
 
 	if (SrcSize < 1)
 		return -1;
 
+	PROFILER_TRACE_BEGIN("zgfx_decompress");
 	descriptor = pSrcData[0]; /* descriptor (1 byte) */
 
 	if (descriptor == ZGFX_SEGMENTED_SINGLE)
 	{
-		status = zgfx_decompress_segment(zgfx, &pSrcData[1], SrcSize - 1);
+		if (zgfx_decompress_segment(zgfx, &pSrcData[1], SrcSize - 1) < 0)
+			goto out;
 
 		*ppDstData = (BYTE*) malloc(zgfx->OutputCount);
 		if (!*ppDstData)
-			return -1;
+			goto out;
 		*pDstSize = zgfx->OutputCount;
 
 		CopyMemory(*ppDstData, zgfx->OutputBuffer, zgfx->OutputCount);
+		status = 1;
 	}
 	else if (descriptor == ZGFX_SEGMENTED_MULTIPART)
 	{
@@ -353,52 +476,400 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 		UINT16 segmentCount;
 		UINT32 segmentOffset;
 		UINT32 uncompressedSize;
+		UINT32 totalSize = 0;
 		BYTE* pConcatenated;
 
+		if (SrcSize < 7)
+			goto out;
+
 		segmentOffset = 7;
 		segmentCount = *((UINT16*) &pSrcData[1]); /* segmentCount (2 bytes) */
 		uncompressedSize = *((UINT32*) &pSrcData[3]); /* uncompressedSize (4 bytes) */
 
 		pConcatenated = (BYTE*) malloc(uncompressedSize);
 		if (!pConcatenated)
-			return -1;
+			goto out;
 
 		*ppDstData = pConcatenated;
 		*pDstSize = uncompressedSize;
 
 		for (segmentNumber = 0; segmentNumber < segmentCount; segmentNumber++)
 		{
+			if (SrcSize - segmentOffset < 4)
+				break;
+
 			segmentSize = *((UINT32*) &pSrcData[segmentOffset]); /* segmentSize (4 bytes) */
 			segmentOffset += 4;
 
-			status = zgfx_decompress_segment(zgfx, &pSrcData[segmentOffset], segmentSize);
+			if ((segmentSize > SrcSize - segmentOffset) ||
+			    (zgfx_decompress_segment(zgfx, &pSrcData[segmentOffset], segmentSize) < 0) ||
+			    (zgfx->OutputCount > uncompressedSize - totalSize))
+				break;
+
 			segmentOffset += segmentSize;
 
 			CopyMemory(pConcatenated, zgfx->OutputBuffer, zgfx->OutputCount);
 			pConcatenated += zgfx->OutputCount;
+			totalSize += zgfx->OutputCount;
+		}
+
+		if ((segmentNumber != segmentCount) || (totalSize != uncompressedSize))
+		{
+			free(*ppDstData);
+			*ppDstData = NULL;
+			*pDstSize = 0;
+			goto out;
 		}
+
+		status = 1;
 	}
-	else
+
+out:
+	PROFILER_TRACE_END("zgfx_decompress");
+	return status;
+}
+
+/**
+ * RDP8 Compressor
+ *
+ * LZ77 over the history ring shared with the decoder. Matches are searched
+ * through hash chains of 3 byte prefixes, the chain depth and lazy matching
+ * depend on the compression level. Literal runs which do not compress are sent
+ * as unencoded blocks, segments which do not compress at all are sent raw.
+ */
+
+#define ZGFX_HASH_BITS		16
+#define ZGFX_HASH_SIZE		(1 << ZGFX_HASH_BITS)
+#define ZGFX_MIN_MATCH		3
+#define ZGFX_MAX_UNENCODED	32767
+
+struct _ZGFX_LEVEL
+{
+	UINT32 chainDepth;
+	UINT32 niceLength;
+	BOOL lazy;
+};
+typedef struct _ZGFX_LEVEL ZGFX_LEVEL;
+
+static const ZGFX_LEVEL ZGFX_LEVELS[] =
+{
+	{   0,   0, FALSE }, /* ZGFX_COMPRESSION_LEVEL_NONE */
+	{   4,  32, FALSE }, /* ZGFX_COMPRESSION_LEVEL_FAST */
+	{  32, 128, TRUE  }, /* ZGFX_COMPRESSION_LEVEL_DEFAULT */
+	{ 256, 1024, TRUE } /* ZGFX_COMPRESSION_LEVEL_BEST */
+};
+
+struct _ZGFX_BIT_WRITER
+{
+	BYTE* pbOutput;
+	UINT32 bits;
+	UINT32 cBits;
+};
+typedef struct _ZGFX_BIT_WRITER ZGFX_BIT_WRITER;
+
+static INLINE void zgfx_write_bits(ZGFX_BIT_WRITER* bw, UINT32 value, UINT32 nbits)
+{
+	bw->bits = (bw->bits << nbits) | (value & ((1 << nbits) - 1));
+	bw->cBits += nbits;
+
+	while (bw->cBits >= 8)
 	{
-		return -1;
+		bw->cBits -= 8;
+		*(bw->pbOutput)++ = (BYTE)(bw->bits >> bw->cBits);
 	}
 
-	return 1;
+	bw->bits &= ((1 << bw->cBits) - 1);
+}
+
+/* Returns the number of padding bits written */
+static INLINE UINT32 zgfx_write_align(ZGFX_BIT_WRITER* bw)
+{
+	const UINT32 pad = (8 - bw->cBits) & 7;
+
+	if (pad)
+		zgfx_write_bits(bw, 0, pad);
+
+	return pad;
+}
+
+static INLINE UINT32 zgfx_hash(const ZGFX_CONTEXT* zgfx, UINT32 index)
+{
+	const BYTE* history = zgfx->HistoryBuffer;
+	const UINT32 size = zgfx->HistoryBufferSize;
+	const UINT32 i1 = (index + 1 < size) ? index + 1 : index + 1 - size;
+	const UINT32 i2 = (index + 2 < size) ? index + 2 : index + 2 - size;
+	const UINT32 value = (history[index] << 16) | (history[i1] << 8) | history[i2];
+	return (value * 2654435761U) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_hash_insert(ZGFX_CONTEXT* zgfx, UINT32 index)
+{
+	const UINT32 hash = zgfx_hash(zgfx, index);
+	zgfx->HashChain[index] = zgfx->HashHead[hash];
+	zgfx->HashHead[hash] = index + 1;
+}
+
+static INLINE UINT32 zgfx_match_length(const ZGFX_CONTEXT* zgfx, UINT32 candidate,
+                                       UINT32 index, UINT32 maxLength)
+{
+	UINT32 length = 0;
+	const BYTE* history = zgfx->HistoryBuffer;
+	const UINT32 size = zgfx->HistoryBufferSize;
+
+	while ((length < maxLength) && (history[candidate] == history[index]))
+	{
+		length++;
+
+		if (++candidate == size)
+			candidate = 0;
+
+		if (++index == size)
+			index = 0;
+	}
+
+	return length;
+}
+
+static UINT32 zgfx_find_match(const ZGFX_CONTEXT* zgfx, UINT32 index, UINT32 maxLength,
+                              UINT32 maxDistance, UINT32* pDistance)
+{
+	const ZGFX_LEVEL* level = &ZGFX_LEVELS[zgfx->CompressionLevel];
+	const UINT32 size = zgfx->HistoryBufferSize;
+	UINT32 depth = level->chainDepth;
+	UINT32 candidate = zgfx->HashHead[zgfx_hash(zgfx, index)];
+	UINT32 prevDistance = 0;
+	UINT32 bestLength = 0;
+
+	while (candidate && depth--)
+	{
+		UINT32 length;
+		UINT32 distance;
+		candidate--;
+		distance = (index + size - candidate) % size;
+
+		/* chains only go back in time, anything else was overwritten in the ring */
+		if ((distance <= prevDistance) || (distance > maxDistance))
+			break;
+
+		prevDistance = distance;
+		length = zgfx_match_length(zgfx, candidate, index, maxLength);
+
+		if (length > bestLength)
+		{
+			bestLength = length;
+			*pDistance = distance;
+
+			if ((length >= level->niceLength) || (length == maxLength))
+				break;
+		}
+
+		candidate = zgfx->HashChain[candidate];
+	}
+
+	return bestLength;
+}
+
+static INLINE const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	const ZGFX_TOKEN* token;
+	const ZGFX_TOKEN* best = NULL;
+
+	for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+	{
+		if ((token->tokenType == 1) && (distance >= token->valueBase))
+			best = token;
+	}
+
+	return best;
+}
+
+static INLINE UINT32 zgfx_match_bits(const ZGFX_TOKEN* token, UINT32 length)
+{
+	UINT32 k = 0;
+
+	if (length == 3)
+		return token->prefixLength + token->valueBits + 1;
+
+	while ((8U << k) <= length)
+		k++;
+
+	return token->prefixLength + token->valueBits + 2 * k + 4;
+}
+
+static INLINE void zgfx_write_match(ZGFX_BIT_WRITER* bw, const ZGFX_TOKEN* token,
+                                    UINT32 distance, UINT32 length)
+{
+	UINT32 k = 0;
+	zgfx_write_bits(bw, token->prefixCode, token->prefixLength);
+	zgfx_write_bits(bw, distance - token->valueBase, token->valueBits);
+
+	if (length == 3)
+	{
+		zgfx_write_bits(bw, 0, 1);
+		return;
+	}
+
+	/* count = 4 << k, followed by 2 + k extra bits */
+	while ((8U << k) <= length)
+		k++;
+
+	zgfx_write_bits(bw, 1, 1);
+
+	if (k)
+		zgfx_write_bits(bw, (1 << k) - 1, k);
+
+	zgfx_write_bits(bw, 0, 1);
+	zgfx_write_bits(bw, length - (4U << k), 2 + k);
+}
+
+static void zgfx_write_literals(ZGFX_CONTEXT* zgfx, ZGFX_BIT_WRITER* bw,
+                                const BYTE* pSrcData, UINT32 count)
+{
+	UINT32 i;
+	UINT32 literalBits = 0;
+
+	for (i = 0; i < count; i++)
+		literalBits += zgfx->LiteralLengths[pSrcData[i]];
+
+	/* unencoded blocks cost a token, a byte count and up to 7 padding bits */
+	if (literalBits <= (count * 8) + 32)
+	{
+		for (i = 0; i < count; i++)
+			zgfx_write_bits(bw, zgfx->LiteralCodes[pSrcData[i]], zgfx->LiteralLengths[pSrcData[i]]);
+
+		return;
+	}
+
+	while (count > 0)
+	{
+		const UINT32 length = MIN(count, ZGFX_MAX_UNENCODED);
+		zgfx_write_bits(bw, 17, 5); /* distance token with a zero distance */
+		zgfx_write_bits(bw, 0, 5);
+		zgfx_write_bits(bw, length, 15);
+		zgfx_write_align(bw);
+		CopyMemory(bw->pbOutput, pSrcData, length);
+		bw->pbOutput += length;
+		pSrcData += length;
+		count -= length;
+	}
+}
+
+/**
+ * Encodes the segment data, which was already added to the history at startIndex.
+ * Returns the size of the encoded bit stream including the padding byte.
+ */
+static UINT32 zgfx_encode_segment(ZGFX_CONTEXT* zgfx, BYTE* pbOutput, const BYTE* pSrcData,
+                                  UINT32 SrcSize, UINT32 startIndex)
+{
+	UINT32 i = 0;
+	UINT32 literalStart = 0;
+	ZGFX_BIT_WRITER bw = { 0 };
+	const ZGFX_LEVEL* level = &ZGFX_LEVELS[zgfx->CompressionLevel];
+	const UINT32 size = zgfx->HistoryBufferSize;
+	/* older data was overwritten in the ring when the segment was added */
+	const UINT32 maxDistance = size - ZGFX_SEGMENTED_MAXSIZE;
+	bw.pbOutput = pbOutput;
+
+	while (i < SrcSize)
+	{
+		UINT32 length = 0;
+		UINT32 distance = 0;
+		const UINT32 index = (startIndex + i) % size;
+		const UINT32 remaining = SrcSize - i;
+
+		if (remaining >= ZGFX_MIN_MATCH)
+		{
+			length = zgfx_find_match(zgfx, index, remaining, maxDistance, &distance);
+
+			if (level->lazy && (length >= ZGFX_MIN_MATCH) && (length < level->niceLength) &&
+			    (remaining > ZGFX_MIN_MATCH))
+			{
+				UINT32 nextDistance;
+				const UINT32 nextIndex = (index + 1) % size;
+				zgfx_hash_insert(zgfx, index);
+
+				/* a longer match at the next byte is worth a literal */
+				if (zgfx_find_match(zgfx, nextIndex, remaining - 1, maxDistance,
+				                    &nextDistance) > length)
+				{
+					i++;
+					continue;
+				}
+			}
+			else
+			{
+				zgfx_hash_insert(zgfx, index);
+			}
+		}
+
+		if (length >= ZGFX_MIN_MATCH)
+		{
+			UINT32 j;
+			UINT32 literalBits = 0;
+			const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+			const UINT32 matchBits = zgfx_match_bits(token, length);
+
+			for (j = 0; (j < length) && (literalBits <= matchBits); j++)
+				literalBits += zgfx->LiteralLengths[pSrcData[i + j]];
+
+			if (literalBits > matchBits)
+			{
+				zgfx_write_literals(zgfx, &bw, &pSrcData[literalStart], i - literalStart);
+				zgfx_write_match(&bw, token, distance, length);
+
+				for (j = 1; j < length; j++)
+				{
+					if (remaining - j >= ZGFX_MIN_MATCH)
+						zgfx_hash_insert(zgfx, (index + j) % size);
+				}
+
+				i += length;
+				literalStart = i;
+				continue;
+			}
+		}
+
+		i++;
+	}
+
+	zgfx_write_literals(zgfx, &bw, &pSrcData[literalStart], i - literalStart);
+	/* the last byte holds the number of unused bits in the previous one */
+	*(bw.pbOutput) = (BYTE) zgfx_write_align(&bw);
+	bw.pbOutput++;
+	return (UINT32)(bw.pbOutput - pbOutput);
 }
 
 static int zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData, UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
-	
-	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
+	UINT32 DstSize;
+	const UINT32 startIndex = zgfx->HistoryIndex;
+
+	/* Worst case: every byte as a 9 bit literal, plus the header and padding bytes */
+	if (!Stream_EnsureRemainingCapacity(s, SrcSize + (SrcSize / 8) + 3))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return -1;
 	}
+
 	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags)); /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+
+	if ((zgfx->CompressionLevel != ZGFX_COMPRESSION_LEVEL_NONE) && (SrcSize > 0))
+	{
+		DstSize = zgfx_encode_segment(zgfx, Stream_Pointer(s) + 1, pSrcData, SrcSize,
+		                              startIndex);
 
+		if (DstSize < SrcSize)
+		{
+			Stream_Write_UINT8(s, ZGFX_PACKET_COMPR_TYPE_RDP8 | PACKET_COMPRESSED); /* header (1 byte) */
+			Stream_Seek(s, DstSize);
+			(*pFlags) |= PACKET_COMPRESSED;
+			return 1;
+		}
+	}
+
+	Stream_Write_UINT8(s, ZGFX_PACKET_COMPR_TYPE_RDP8); /* header (1 byte) */
+	Stream_Write(s, pSrcData, SrcSize);
 	return 1;
 }
 
@@ -491,11 +962,13 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 	int status;
 	wStream* s = Stream_New(NULL, SrcSize);
 
+	PROFILER_TRACE_BEGIN("zgfx_compress");
 	status = zgfx_compress_to_stream(zgfx, s, pSrcData, SrcSize, pFlags);
 	(*ppDstData) = Stream_Buffer(s);
 	(*pDstSize) = Stream_GetPosition(s);
 
 	Stream_Free(s, FALSE);
+	PROFILER_TRACE_END("zgfx_compress");
 	return status;
 }
 
@@ -503,6 +976,40 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+
+	if (zgfx->Compressor)
+		ZeroMemory(zgfx->HashHead, ZGFX_HASH_SIZE * sizeof(UINT32));
+}
+
+BOOL zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx, UINT32 level)
+{
+	if (!zgfx || (level > ZGFX_COMPRESSION_LEVEL_BEST))
+		return FALSE;
+
+	zgfx->CompressionLevel = level;
+	return TRUE;
+}
+
+static void zgfx_init_literal_codes(ZGFX_CONTEXT* zgfx)
+{
+	int i;
+	const ZGFX_TOKEN* token;
+
+	/* "0" followed by the 8 bit value, unless a shorter code exists */
+	for (i = 0; i < 256; i++)
+	{
+		zgfx->LiteralCodes[i] = (UINT16) i;
+		zgfx->LiteralLengths[i] = 9;
+	}
+
+	for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+	{
+		if ((token->tokenType == 0) && (token->valueBits == 0))
+		{
+			zgfx->LiteralCodes[token->valueBase] = (UINT16) token->prefixCode;
+			zgfx->LiteralLengths[token->valueBase] = (BYTE) token->prefixLength;
+		}
+	}
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -516,6 +1023,22 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 		zgfx->Compressor = Compressor;
 
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+		zgfx_init_decode_table(zgfx);
+
+		if (Compressor)
+		{
+			zgfx->CompressionLevel = ZGFX_COMPRESSION_LEVEL_DEFAULT;
+			zgfx->HashHead = (UINT32*) calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+			zgfx->HashChain = (UINT32*) calloc(zgfx->HistoryBufferSize, sizeof(UINT32));
+
+			if (!zgfx->HashHead || !zgfx->HashChain)
+			{
+				zgfx_context_free(zgfx);
+				return NULL;
+			}
+
+			zgfx_init_literal_codes(zgfx);
+		}
 
 		zgfx_context_reset(zgfx, FALSE);
 	}
@@ -525,6 +1048,10 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->HashHead);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
-
@@ -840,6 +840,9 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_HiDefRemoteApp:
 			return settings->HiDefRemoteApp;
 
+		case FreeRDP_CompressionPipelined:
+			return settings->CompressionPipelined;
+
 		case FreeRDP_IPv6Enabled:
 			return settings->IPv6Enabled;
 
@@ -1273,6 +1276,10 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->HiDefRemoteApp = param;
 			break;
 
+		case FreeRDP_CompressionPipelined:
+			settings->CompressionPipelined = param;
+			break;
+
 		case FreeRDP_IPv6Enabled:
 			settings->IPv6Enabled = param;
 			break;
@@ -2491,6 +2498,9 @@ char* freerdp_get_param_string(rdpSettings* settings, int id)
 		case FreeRDP_RemoteApplicationCmdLine:
 			return settings->RemoteApplicationCmdLine;
 
+		case FreeRDP_BitmapCachePersistFile:
+			return settings->BitmapCachePersistFile;
+
 		case FreeRDP_ImeFileName:
 			return settings->ImeFileName;
 
@@ -2704,6 +2714,10 @@ int freerdp_set_param_string(rdpSettings* settings, int id, const char* param)
 			tmp = &settings->RemoteApplicationCmdLine;
 			break;
 
+		case FreeRDP_BitmapCachePersistFile:
+			tmp = &settings->BitmapCachePersistFile;
+			break;
+
 		case FreeRDP_ImeFileName:
 			tmp = &settings->ImeFileName;
 			break;
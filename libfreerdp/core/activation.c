@@ -21,6 +21,8 @@
 #include "config.h"
 #endif
 
+#include <freerdp/cache/persistent.h>
+
 #include "activation.h"
 
 /*
@@ -172,39 +174,178 @@ BOOL rdp_send_client_control_pdu(rdpRdp* rdp, UINT16 action)
 	return rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_CONTROL, rdp->mcs->userId);
 }
 
-void rdp_write_persistent_list_entry(wStream* s, UINT32 key1, UINT32 key2)
+static void rdp_write_persistent_list_entry(wStream* s, UINT64 key64)
 {
-	Stream_Write_UINT32(s, key1); /* key1 (4 bytes) */
-	Stream_Write_UINT32(s, key2); /* key2 (4 bytes) */
+	Stream_Write_UINT32(s, key64 & 0xFFFFFFFF); /* key1 (4 bytes) */
+	Stream_Write_UINT32(s, key64 >> 32); /* key2 (4 bytes) */
 }
 
-void rdp_write_client_persistent_key_list_pdu(wStream* s, rdpSettings* settings)
+static void rdp_write_client_persistent_key_list_pdu(wStream* s,
+        const UINT32* numEntries, const UINT32* totalEntries, BYTE bitMask,
+        const UINT64* keys, UINT32 count)
 {
-	Stream_Write_UINT16(s, 0); /* numEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache4 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache4 (2 bytes) */
-	Stream_Write_UINT8(s, PERSIST_FIRST_PDU | PERSIST_LAST_PDU); /* bBitMask (1 byte) */
+	UINT32 index;
+
+	for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		Stream_Write_UINT16(s, numEntries[index]); /* numEntriesCacheX (2 bytes) */
+
+	for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		Stream_Write_UINT16(s, totalEntries[index]); /* totalEntriesCacheX (2 bytes) */
+
+	Stream_Write_UINT8(s, bitMask); /* bBitMask (1 byte) */
 	Stream_Write_UINT8(s, 0); /* pad1 (1 byte) */
 	Stream_Write_UINT16(s, 0); /* pad3 (2 bytes) */
 
 	/* entries */
+	for (index = 0; index < count; index++)
+		rdp_write_persistent_list_entry(s, keys[index]);
+}
+
+/**
+ * Collects the keys of the persistent bitmap cache file, grouped by cell
+ * in the order the bitmap cache restores them (see bitmap_cache_new).
+ */
+static UINT32 rdp_load_persistent_keys(rdpSettings* settings, UINT64** ppKeys,
+                                       UINT32* totalEntries)
+{
+	UINT32 i, cell;
+	UINT32 count = 0;
+	UINT32 offsets[PERSISTENT_CACHE_MAX_CELLS];
+	UINT32 counts[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	UINT64* keys = NULL;
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpPersistentCache* persistent;
+	*ppKeys = NULL;
+
+	if (!settings->BitmapCachePersistFile)
+		return 0;
+
+	if (!(persistent = persistent_cache_new()))
+		return 0;
+
+	if (!persistent_cache_open(persistent, settings->BitmapCachePersistFile, FALSE))
+		goto out;
+
+	/* first pass counts the entries per cell */
+	while (persistent_cache_read_entry(persistent, &entry))
+	{
+		if (persistent_cache_assign_index(settings, &entry, totalEntries) >= 0)
+			count++;
+	}
+
+	if ((count == 0) || (count > PERSIST_MAX_KEYS) ||
+	    !(keys = (UINT64*) calloc(count, sizeof(UINT64))))
+	{
+		count = 0;
+		goto out;
+	}
+
+	for (cell = 0, i = 0; cell < PERSISTENT_CACHE_MAX_CELLS; cell++)
+	{
+		offsets[cell] = i;
+		i += totalEntries[cell];
+	}
+
+	if (!persistent_cache_open(persistent, settings->BitmapCachePersistFile, FALSE))
+	{
+		free(keys);
+		keys = NULL;
+		count = 0;
+		goto out;
+	}
+
+	while (persistent_cache_read_entry(persistent, &entry))
+	{
+		int index = persistent_cache_assign_index(settings, &entry, counts);
+
+		if (index >= 0)
+			keys[offsets[entry.cacheId] + index] = entry.key64;
+	}
+
+	*ppKeys = keys;
+out:
+
+	if (count == 0)
+		ZeroMemory(totalEntries, sizeof(UINT32) * PERSISTENT_CACHE_MAX_CELLS);
+
+	persistent_cache_free(persistent);
+	return count;
 }
 
+/**
+ * Splits the keys of a Persistent Key List starting at offset into the next
+ * PDU of at most PERSIST_MAX_PDU_KEYS entries. The keys are grouped by cell,
+ * totalEntries holds the number of keys per cell.
+ *
+ * @return the number of keys in the PDU
+ */
+UINT32 rdp_split_persistent_key_list(const UINT32* totalEntries, UINT32 count,
+                                     UINT32 offset, UINT32* numEntries, BYTE* bitMask)
+{
+	UINT32 cell;
+	UINT32 cellStart = 0;
+	UINT32 pduCount = MIN(count - offset, PERSIST_MAX_PDU_KEYS);
+
+	for (cell = 0; cell < PERSISTENT_CACHE_MAX_CELLS; cell++)
+	{
+		UINT32 cellEnd = cellStart + totalEntries[cell];
+		UINT32 begin = MAX(cellStart, offset);
+		UINT32 end = MIN(cellEnd, offset + pduCount);
+		numEntries[cell] = (end > begin) ? (end - begin) : 0;
+		cellStart = cellEnd;
+	}
+
+	*bitMask = (offset == 0) ? PERSIST_FIRST_PDU : 0;
+
+	if ((offset + pduCount) >= count)
+		*bitMask |= PERSIST_LAST_PDU;
+
+	return pduCount;
+}
+
+/**
+ * Sends the keys of the persistent bitmap cache, split in multiple PDUs
+ * of at most PERSIST_MAX_PDU_KEYS entries as required by [MS-RDPBCGR]
+ * 2.2.1.17.1.
+ */
 BOOL rdp_send_client_persistent_key_list_pdu(rdpRdp* rdp)
 {
 	wStream* s;
+	BYTE bitMask;
+	UINT32 count;
+	UINT32 offset = 0;
+	UINT64* keys = NULL;
+	UINT32 numEntries[PERSISTENT_CACHE_MAX_CELLS];
+	UINT32 totalEntries[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	count = rdp_load_persistent_keys(rdp->settings, &keys, totalEntries);
+
+	do
+	{
+		UINT32 pduCount = rdp_split_persistent_key_list(totalEntries, count, offset,
+		                  numEntries, &bitMask);
 
-	s = rdp_data_pdu_init(rdp);
-	rdp_write_client_persistent_key_list_pdu(s, rdp->settings);
+		if (!(s = rdp_data_pdu_init(rdp)))
+		{
+			free(keys);
+			return FALSE;
+		}
+
+		rdp_write_client_persistent_key_list_pdu(s, numEntries, totalEntries, bitMask,
+		        &keys[offset], pduCount);
 
-	return rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST, rdp->mcs->userId);
+		if (!rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST,
+		                       rdp->mcs->userId))
+		{
+			free(keys);
+			return FALSE;
+		}
+
+		offset += pduCount;
+	}
+	while (offset < count);
+
+	free(keys);
+	return TRUE;
 }
 
 BOOL rdp_recv_client_font_list_pdu(wStream* s)
@@ -35,6 +35,9 @@
 #define PERSIST_FIRST_PDU		0x01
 #define PERSIST_LAST_PDU		0x02
 
+#define PERSIST_MAX_PDU_KEYS		169
+#define PERSIST_MAX_KEYS		262144
+
 #define FONTLIST_FIRST			0x0001
 #define FONTLIST_LAST			0x0002
 
@@ -51,6 +54,8 @@ FREERDP_LOCAL BOOL rdp_recv_server_control_pdu(rdpRdp* rdp, wStream* s);
 FREERDP_LOCAL BOOL rdp_send_server_control_cooperate_pdu(rdpRdp* rdp);
 FREERDP_LOCAL BOOL rdp_send_server_control_granted_pdu(rdpRdp* rdp);
 FREERDP_LOCAL BOOL rdp_send_client_control_pdu(rdpRdp* rdp, UINT16 action);
+FREERDP_LOCAL UINT32 rdp_split_persistent_key_list(const UINT32* totalEntries,
+        UINT32 count, UINT32 offset, UINT32* numEntries, BYTE* bitMask);
 FREERDP_LOCAL BOOL rdp_send_client_persistent_key_list_pdu(rdpRdp* rdp);
 FREERDP_LOCAL BOOL rdp_recv_client_font_list_pdu(wStream* s);
 FREERDP_LOCAL BOOL rdp_send_client_font_list_pdu(rdpRdp* rdp, UINT16 flags);
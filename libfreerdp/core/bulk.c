@@ -21,6 +21,8 @@
 #include "config.h"
 #endif
 
+#include <freerdp/utils/profiler.h>
+
 #include "bulk.h"
 
 #define TAG "com.freerdp.core"
@@ -120,6 +122,8 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 
 	if (flags & BULK_COMPRESSION_FLAGS_MASK)
 	{
+		PROFILER_TRACE_BEGIN("bulk_decompress");
+
 		switch (type)
 		{
 			case PACKET_COMPR_TYPE_8K:
@@ -144,6 +148,8 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 				status = -1;
 				break;
 		}
+
+		PROFILER_TRACE_END("bulk_decompress");
 	}
 	else
 	{
@@ -175,7 +181,32 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 	return status;
 }
 
-int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+/**
+ * Largest input a single packet of the current compression type takes.
+ * MPPC and NCrush keep their history in 8K/64K windows, XCrush refuses
+ * anything above 16K. NCrush slides its window by 32K, MPPC starts over at
+ * the front, so for those half of the window is left for the history.
+ */
+static UINT32 bulk_compression_max_input(rdpBulk* bulk)
+{
+	switch (bulk_compression_level(bulk))
+	{
+		case PACKET_COMPR_TYPE_8K:
+			return 8192 - 4;
+
+		case PACKET_COMPR_TYPE_64K:
+			return 32768;
+
+		case PACKET_COMPR_TYPE_RDP6:
+			return 32768 - 16;
+
+		default:
+			return 16384;
+	}
+}
+
+static int bulk_compress_bounded(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, UINT32 MaxSize,
+                                 BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
 {
 	int status = -1;
 	rdpMetrics* metrics;
@@ -183,22 +214,25 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 	UINT32 UncompressedBytes;
 	double CompressionRatio;
 	metrics = bulk->context->metrics;
+	*pFlags = 0;
 
-	if ((SrcSize <= 50) || (SrcSize >= 16384))
+	if ((SrcSize <= 50) || (SrcSize > bulk_compression_max_input(bulk)))
 	{
 		*ppDstData = pSrcData;
 		*pDstSize = SrcSize;
 		return 0;
 	}
 
+	PROFILER_TRACE_BEGIN("bulk_compress");
 	*ppDstData = bulk->OutputBuffer;
 	*pDstSize = sizeof(bulk->OutputBuffer);
-	bulk_compression_level(bulk);
 	bulk_compression_max_size(bulk);
 
 	if ((bulk->CompressionLevel == PACKET_COMPR_TYPE_8K) ||
 			(bulk->CompressionLevel == PACKET_COMPR_TYPE_64K))
 	{
+		/* MPPC falls back to a flushed uncompressed packet when the output exceeds MaxSize */
+		*pDstSize = MIN(MaxSize, sizeof(bulk->OutputBuffer));
 		mppc_set_compression_level(bulk->mppcSend, bulk->CompressionLevel);
 		status = mppc_compress(bulk->mppcSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
 	}
@@ -215,6 +249,8 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 		status = -1;
 	}
 
+	PROFILER_TRACE_END("bulk_compress");
+
 	if (status >= 0)
 	{
 		CompressedBytes = *pDstSize;
@@ -240,6 +276,119 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 	return status;
 }
 
+int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+{
+	return bulk_compress_bounded(bulk, pSrcData, SrcSize, sizeof(bulk->OutputBuffer), ppDstData,
+	                             pDstSize, pFlags);
+}
+
+static void bulk_compress_flush(rdpBulk* bulk)
+{
+	switch (bulk->CompressionLevel)
+	{
+		case PACKET_COMPR_TYPE_8K:
+		case PACKET_COMPR_TYPE_64K:
+			mppc_context_reset(bulk->mppcSend, TRUE);
+			break;
+
+		case PACKET_COMPR_TYPE_RDP6:
+			ncrush_context_reset(bulk->ncrushSend, TRUE);
+			break;
+
+		default:
+			xcrush_context_reset(bulk->xcrushSend, TRUE);
+			break;
+	}
+}
+
+/**
+ * Compresses the next fragment of a large update. The input taken is sized
+ * with the recent compression ratio so that the output just fits into
+ * MaxSize. If it does not, the history is flushed and only MaxSize bytes
+ * are sent uncompressed, the flush is announced with the next packet.
+ */
+static void bulk_compress_fragment(rdpBulk* bulk, BULK_FRAGMENT* fragment)
+{
+	int status;
+	UINT32 ratio;
+	UINT32 SrcSize;
+	const UINT32 MaxSize = fragment->MaxSize;
+	SrcSize = (UINT32)(((UINT64) MaxSize * 7 * 256) / (8 * bulk->SendRatio));
+	SrcSize = MIN(MAX(SrcSize, MaxSize), bulk_compression_max_input(bulk));
+	SrcSize = MIN(SrcSize, fragment->SrcSize);
+	status = bulk_compress_bounded(bulk, fragment->pSrcData, SrcSize, MaxSize, &fragment->pDstData,
+	                               &fragment->DstSize, &fragment->Flags);
+
+	/* the history holds data the peer never sees, both sides start over */
+	if ((status < 0) || ((fragment->Flags & PACKET_COMPRESSED) && (fragment->DstSize > MaxSize)))
+	{
+		bulk_compress_flush(bulk);
+		fragment->Flags = 0;
+	}
+
+	if (!(fragment->Flags & PACKET_COMPRESSED))
+	{
+		fragment->pDstData = fragment->pSrcData;
+		fragment->DstSize = fragment->Consumed = MIN(SrcSize, MaxSize);
+	}
+	else
+		fragment->Consumed = SrcSize;
+
+	/* output bytes per 256 input bytes, averaged over the last few fragments */
+	ratio = (fragment->Flags & PACKET_COMPRESSED) ?
+	        (fragment->DstSize * 256) / fragment->Consumed : 256;
+	bulk->SendRatio = (bulk->SendRatio * 3 + MAX(ratio, 16)) / 4;
+	fragment->Status = status;
+}
+
+static void CALLBACK bulk_compress_fragment_work_callback(PTP_CALLBACK_INSTANCE instance,
+        void* context, PTP_WORK work)
+{
+	rdpBulk* bulk = (rdpBulk*) context;
+	bulk_compress_fragment(bulk, &bulk->Fragment);
+}
+
+/**
+ * Starts compressing the next fragment. With CompressionPipelined this runs
+ * on the thread pool, so the caller can encrypt and write the previous
+ * fragment meanwhile. The output buffer is reused, the previous fragment
+ * must have been copied before.
+ */
+void bulk_compress_fragment_begin(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, UINT32 MaxSize)
+{
+	BULK_FRAGMENT* fragment = &bulk->Fragment;
+	fragment->pSrcData = pSrcData;
+	fragment->SrcSize = SrcSize;
+	fragment->MaxSize = MaxSize;
+
+	if (bulk->context->settings->CompressionPipelined)
+	{
+		if (!bulk->FragmentWork)
+			bulk->FragmentWork = CreateThreadpoolWork(bulk_compress_fragment_work_callback,
+			                     (void*) bulk, NULL);
+
+		if (bulk->FragmentWork)
+		{
+			bulk->FragmentPending = TRUE;
+			SubmitThreadpoolWork(bulk->FragmentWork);
+			return;
+		}
+	}
+
+	bulk_compress_fragment(bulk, fragment);
+}
+
+BULK_FRAGMENT* bulk_compress_fragment_end(rdpBulk* bulk)
+{
+	if (bulk->FragmentPending)
+	{
+		WaitForThreadpoolWorkCallbacks(bulk->FragmentWork, FALSE);
+		bulk->FragmentPending = FALSE;
+	}
+
+	return &bulk->Fragment;
+}
+
 void bulk_reset(rdpBulk* bulk)
 {
 	mppc_context_reset(bulk->mppcSend, FALSE);
@@ -265,6 +414,7 @@ rdpBulk* bulk_new(rdpContext* context)
 		bulk->xcrushRecv = xcrush_context_new(FALSE);
 		bulk->xcrushSend = xcrush_context_new(TRUE);
 		bulk->CompressionLevel = context->settings->CompressionLevel;
+		bulk->SendRatio = 128;
 	}
 
 	return bulk;
@@ -275,6 +425,12 @@ void bulk_free(rdpBulk* bulk)
 	if (!bulk)
 		return;
 
+	if (bulk->FragmentWork)
+	{
+		WaitForThreadpoolWorkCallbacks(bulk->FragmentWork, FALSE);
+		CloseThreadpoolWork(bulk->FragmentWork);
+	}
+
 	mppc_context_free(bulk->mppcSend);
 	mppc_context_free(bulk->mppcRecv);
 	ncrush_context_free(bulk->ncrushRecv);
@@ -24,11 +24,30 @@ typedef struct rdp_bulk rdpBulk;
 
 #include "rdp.h"
 
+#include <winpr/pool.h>
+
 #include <freerdp/api.h>
 #include <freerdp/codec/mppc.h>
 #include <freerdp/codec/ncrush.h>
 #include <freerdp/codec/xcrush.h>
 
+/**
+ * One fastpath fragment: up to SrcSize input bytes compressed into at most
+ * MaxSize output bytes. Consumed tells how much of the input went into it.
+ */
+struct _BULK_FRAGMENT
+{
+	BYTE* pSrcData;
+	UINT32 SrcSize;
+	UINT32 MaxSize;
+	BYTE* pDstData;
+	UINT32 DstSize;
+	UINT32 Flags;
+	UINT32 Consumed;
+	int Status;
+};
+typedef struct _BULK_FRAGMENT BULK_FRAGMENT;
+
 struct rdp_bulk
 {
 	rdpContext* context;
@@ -40,6 +59,10 @@ struct rdp_bulk
 	NCRUSH_CONTEXT* ncrushSend;
 	XCRUSH_CONTEXT* xcrushRecv;
 	XCRUSH_CONTEXT* xcrushSend;
+	UINT32 SendRatio;
+	PTP_WORK FragmentWork;
+	BOOL FragmentPending;
+	BULK_FRAGMENT Fragment;
 	BYTE OutputBuffer[65536];
 };
 
@@ -54,6 +77,10 @@ FREERDP_LOCAL int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize,
 FREERDP_LOCAL int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize,
                                 BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags);
 
+FREERDP_LOCAL void bulk_compress_fragment_begin(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize,
+        UINT32 MaxSize);
+FREERDP_LOCAL BULK_FRAGMENT* bulk_compress_fragment_end(rdpBulk* bulk);
+
 FREERDP_LOCAL void bulk_reset(rdpBulk* bulk);
 
 FREERDP_LOCAL rdpBulk* bulk_new(rdpContext* context);
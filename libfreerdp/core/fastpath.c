@@ -568,6 +568,7 @@ int fastpath_recv_updates(rdpFastPath* fastpath, wStream* s)
 	}
 
 	IFCALL(update->EndPaint, update->context);
+	metrics_paint(update->context->metrics);
 
 	return 0;
 }
@@ -737,6 +738,9 @@ int fastpath_recv_inputs(rdpFastPath* fastpath, wStream* s)
 		Stream_Read_UINT8(s, fastpath->numberEvents); /* eventHeader (1 byte) */
 	}
 
+	if (fastpath->numberEvents > 0)
+		metrics_input_event(fastpath->rdp->context->metrics);
+
 	for (i = 0; i < fastpath->numberEvents; i++)
 	{
 		if (!fastpath_recv_input_event(fastpath, s))
@@ -901,6 +905,7 @@ BOOL fastpath_send_multiple_input_pdu(rdpFastPath* fastpath, wStream* s, int iNu
 	if (transport_write(fastpath->rdp->transport, s) < 0)
 		return FALSE;
 
+	metrics_channel_sent(rdp->context->metrics, MCS_GLOBAL_CHANNEL_ID, length);
 	return TRUE;
 }
 
@@ -927,6 +932,7 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 	UINT16 maxLength;
 	UINT32 totalLength;
 	BOOL status = TRUE;
+	BOOL compress = FALSE;
 	wStream* fs = NULL;
 	rdpSettings* settings;
 	rdpRdp* rdp = fastpath->rdp;
@@ -934,6 +940,7 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 	UINT32 fpUpdatePduHeaderSize;
 	UINT32 fpUpdateHeaderSize;
 	UINT32 CompressionMaxSize;
+	size_t fragmentLength;
 	FASTPATH_UPDATE_PDU_HEADER fpUpdatePduHeader = { 0 };
 	FASTPATH_UPDATE_HEADER fpUpdateHeader = { 0 };
 
@@ -947,6 +954,7 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		CompressionMaxSize = bulk_compression_max_size(rdp->bulk);
 		maxLength = (maxLength < CompressionMaxSize) ? maxLength : CompressionMaxSize;
 		maxLength -= 20;
+		compress = TRUE;
 	}
 
 	totalLength = Stream_GetPosition(s);
@@ -975,13 +983,19 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			rdp->sec_flags |= SEC_SECURE_CHECKSUM;
 	}
 
+	/**
+	 * Compressed fragments take as much input as fits into maxLength after
+	 * compression, the next one is compressed while the current one is
+	 * encrypted and written.
+	 */
+	if (compress)
+		bulk_compress_fragment_begin(rdp->bulk, Stream_Pointer(s), totalLength, maxLength);
+
 	for (fragment = 0; (totalLength > 0) || (fragment == 0); fragment++)
 	{
-		BYTE* pSrcData;
 		UINT32 SrcSize;
 		UINT32 DstSize = 0;
 		BYTE* pDstData = NULL;
-		UINT32 compressionFlags = 0;
 		BYTE pad = 0;
 		BYTE* pSignature = NULL;
 
@@ -991,34 +1005,29 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		fpUpdateHeader.compression = 0;
 		fpUpdateHeader.compressionFlags = 0;
 		fpUpdateHeader.updateCode = updateCode;
-		fpUpdateHeader.size = (totalLength > maxLength) ? maxLength : totalLength;
 
-		pSrcData = pDstData = Stream_Pointer(s);
-		SrcSize = DstSize = fpUpdateHeader.size;
+		pDstData = Stream_Pointer(s);
+		SrcSize = DstSize = (totalLength > maxLength) ? maxLength : totalLength;
 
 		if (rdp->sec_flags & SEC_ENCRYPT)
 			fpUpdatePduHeader.secFlags |= FASTPATH_OUTPUT_ENCRYPTED;
 		if (rdp->sec_flags & SEC_SECURE_CHECKSUM)
 			fpUpdatePduHeader.secFlags |= FASTPATH_OUTPUT_SECURE_CHECKSUM;
 
-		if (settings->CompressionEnabled && !skipCompression)
+		if (compress)
 		{
-			if (bulk_compress(rdp->bulk, pSrcData, SrcSize, &pDstData, &DstSize, &compressionFlags) >= 0)
+			BULK_FRAGMENT* bulkFragment = bulk_compress_fragment_end(rdp->bulk);
+			pDstData = bulkFragment->pDstData;
+			DstSize = bulkFragment->DstSize;
+			SrcSize = bulkFragment->Consumed;
+
+			if (bulkFragment->Flags)
 			{
-				if (compressionFlags)
-				{
-					fpUpdateHeader.compressionFlags = compressionFlags;
-					fpUpdateHeader.compression = FASTPATH_OUTPUT_COMPRESSION_USED;
-				}
+				fpUpdateHeader.compressionFlags = bulkFragment->Flags;
+				fpUpdateHeader.compression = FASTPATH_OUTPUT_COMPRESSION_USED;
 			}
 		}
 
-		if (!fpUpdateHeader.compression)
-		{
-			pDstData = Stream_Pointer(s);
-			DstSize = fpUpdateHeader.size;
-		}
-
 		fpUpdateHeader.size = DstSize;
 		totalLength -= SrcSize;
 
@@ -1059,6 +1068,10 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		if (pad)
 			Stream_Zero(fs, pad);
 
+		/* the fragment is copied, the compression buffer can take the next one */
+		if (compress && (totalLength > 0))
+			bulk_compress_fragment_begin(rdp->bulk, Stream_Pointer(s) + SrcSize, totalLength, maxLength);
+
 		if (rdp->sec_flags & SEC_ENCRYPT)
 		{
 			UINT32 dataSize = fpUpdateHeaderSize + DstSize + pad;
@@ -1067,7 +1080,11 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			if (rdp->settings->EncryptionMethods == ENCRYPTION_METHOD_FIPS)
 			{
 				if (!security_hmac_signature(data, dataSize - pad, pSignature, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
+
 				security_fips_encrypt(data, dataSize, rdp);
 			}
 			else
@@ -1078,11 +1095,15 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 					status = security_mac_signature(rdp, data, dataSize, pSignature);
 
 				if (!status || !security_encrypt(data, dataSize, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
 			}
 		}
 
 		Stream_SealLength(fs);
+		fragmentLength = Stream_Length(fs);
 
 		if (transport_write(rdp->transport, fs) < 0)
 		{
@@ -1090,9 +1111,15 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			break;
 		}
 
+		metrics_channel_sent(rdp->context->metrics, MCS_GLOBAL_CHANNEL_ID, fragmentLength);
+
 		Stream_Seek(s, SrcSize);
 	}
 
+	/* a fragment still being compressed when the write failed */
+	if (compress)
+		bulk_compress_fragment_end(rdp->bulk);
+
 	rdp->sec_flags = 0;
 
 	return status;
@@ -581,6 +581,9 @@ BOOL input_recv(rdpInput* input, wStream* s)
 	if (Stream_GetRemainingLength(s) < (size_t)(6 * numberEvents))
 		return FALSE;
 
+	if ((numberEvents > 0) && input->context)
+		metrics_input_event(input->context->metrics);
+
 	for (i = 0; i < numberEvents; i++)
 	{
 		if (!input_recv_event(input, s))
@@ -649,6 +652,9 @@ BOOL freerdp_input_send_keyboard_event(rdpInput* input, UINT16 flags, UINT16 cod
 	if (!input)
 		return FALSE;
 
+	if (input->context)
+		metrics_input_event(input->context->metrics);
+
 	return IFCALLRESULT(TRUE, input->KeyboardEvent, input, flags, code);
 }
 
@@ -665,6 +671,9 @@ BOOL freerdp_input_send_unicode_keyboard_event(rdpInput* input, UINT16 flags, UI
 	if (!input)
 		return FALSE;
 
+	if (input->context)
+		metrics_input_event(input->context->metrics);
+
 	return IFCALLRESULT(TRUE, input->UnicodeKeyboardEvent, input, flags, code);
 }
 
@@ -673,6 +682,9 @@ BOOL freerdp_input_send_mouse_event(rdpInput* input, UINT16 flags, UINT16 x, UIN
 	if (!input)
 		return FALSE;
 
+	if (input->context)
+		metrics_input_event(input->context->metrics);
+
 	return IFCALLRESULT(TRUE, input->MouseEvent, input, flags, x, y);
 }
 
@@ -681,6 +693,9 @@ BOOL freerdp_input_send_extended_mouse_event(rdpInput* input, UINT16 flags, UINT
 	if (!input)
 		return FALSE;
 
+	if (input->context)
+		metrics_input_event(input->context->metrics);
+
 	return IFCALLRESULT(TRUE, input->ExtendedMouseEvent, input, flags, x, y);
 }
 
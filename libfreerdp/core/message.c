@@ -32,11 +32,239 @@
 
 #include <winpr/crt.h>
 #include <winpr/stream.h>
+#include <winpr/interlocked.h>
 #include <winpr/collections.h>
 
 #define TAG FREERDP_TAG("core.message")
 #define WITH_STREAM_POOL	1
 
+/* Update Arena */
+
+#define UPDATE_ARENA_CHUNK_SIZE		(64 * 1024)
+#define UPDATE_ARENA_MAX_BLOCK		(UPDATE_ARENA_CHUNK_SIZE / 4)
+#define UPDATE_ARENA_FREE_CHUNKS	16
+#define UPDATE_ARENA_ALIGN(_size)	(((_size) + 15) & ~((size_t) 15))
+
+typedef struct rdp_update_arena_chunk rdpUpdateArenaChunk;
+
+struct rdp_update_arena_chunk
+{
+	rdpUpdateArena* arena;
+	LONG volatile refs;
+	size_t offset;
+	rdpUpdateArenaChunk* next;
+};
+
+/* Every block is preceded by the chunk it was taken from, NULL for blocks
+ * too large for a chunk which are allocated on their own. */
+struct rdp_update_arena_block
+{
+	rdpUpdateArenaChunk* chunk;
+	size_t size;
+};
+
+struct rdp_update_arena
+{
+	LONG volatile refs;
+	BOOL closed;
+	CRITICAL_SECTION lock;
+	rdpUpdateArenaChunk* current;
+	rdpUpdateArenaChunk* free;
+	UINT32 freeCount;
+};
+
+#define UPDATE_ARENA_HEADER_SIZE \
+	UPDATE_ARENA_ALIGN(sizeof(rdpUpdateArenaChunk))
+#define UPDATE_ARENA_BLOCK_SIZE \
+	UPDATE_ARENA_ALIGN(sizeof(struct rdp_update_arena_block))
+
+static void update_arena_release(rdpUpdateArena* arena)
+{
+	if (InterlockedDecrement(&arena->refs) == 0)
+	{
+		DeleteCriticalSection(&arena->lock);
+		free(arena);
+	}
+}
+
+/**
+ * Drops a reference to a chunk, the chunk is kept for reuse once the last
+ * block allocated from it was released.
+ */
+static void update_arena_chunk_release(rdpUpdateArenaChunk* chunk)
+{
+	BOOL recycled = FALSE;
+	rdpUpdateArena* arena = chunk->arena;
+
+	if (InterlockedDecrement(&chunk->refs) != 0)
+		return;
+
+	EnterCriticalSection(&arena->lock);
+
+	if (!arena->closed && (arena->freeCount < UPDATE_ARENA_FREE_CHUNKS))
+	{
+		chunk->next = arena->free;
+		arena->free = chunk;
+		arena->freeCount++;
+		recycled = TRUE;
+	}
+
+	LeaveCriticalSection(&arena->lock);
+
+	if (!recycled)
+	{
+		free(chunk);
+		update_arena_release(arena);
+	}
+}
+
+static rdpUpdateArenaChunk* update_arena_chunk_new(rdpUpdateArena* arena)
+{
+	rdpUpdateArenaChunk* chunk = arena->free;
+
+	if (chunk)
+	{
+		arena->free = chunk->next;
+		arena->freeCount--;
+	}
+	else
+	{
+		if (!(chunk = (rdpUpdateArenaChunk*) malloc(UPDATE_ARENA_CHUNK_SIZE)))
+			return NULL;
+
+		chunk->arena = arena;
+		InterlockedIncrement(&arena->refs);
+	}
+
+	/* The arena holds a reference on its current chunk */
+	chunk->refs = 1;
+	chunk->offset = UPDATE_ARENA_HEADER_SIZE;
+	chunk->next = NULL;
+	return chunk;
+}
+
+void* update_arena_alloc(rdpUpdateArena* arena, size_t size)
+{
+	rdpUpdateArenaChunk* chunk;
+	rdpUpdateArenaChunk* retired = NULL;
+	struct rdp_update_arena_block* block;
+	size = UPDATE_ARENA_BLOCK_SIZE + UPDATE_ARENA_ALIGN(size);
+
+	if (size > UPDATE_ARENA_MAX_BLOCK)
+	{
+		if (!(block = (struct rdp_update_arena_block*) malloc(size)))
+			return NULL;
+
+		block->chunk = NULL;
+		block->size = size;
+		return ((BYTE*) block) + UPDATE_ARENA_BLOCK_SIZE;
+	}
+
+	EnterCriticalSection(&arena->lock);
+	chunk = arena->current;
+
+	if (!chunk || ((chunk->offset + size) > UPDATE_ARENA_CHUNK_SIZE))
+	{
+		if (!(chunk = update_arena_chunk_new(arena)))
+		{
+			LeaveCriticalSection(&arena->lock);
+			return NULL;
+		}
+
+		retired = arena->current;
+		arena->current = chunk;
+	}
+
+	block = (struct rdp_update_arena_block*)(((BYTE*) chunk) + chunk->offset);
+	chunk->offset += size;
+	InterlockedIncrement(&chunk->refs);
+	LeaveCriticalSection(&arena->lock);
+
+	if (retired)
+		update_arena_chunk_release(retired);
+
+	block->chunk = chunk;
+	block->size = size;
+	return ((BYTE*) block) + UPDATE_ARENA_BLOCK_SIZE;
+}
+
+void update_arena_free(void* ptr)
+{
+	struct rdp_update_arena_block* block;
+
+	if (!ptr)
+		return;
+
+	block = (struct rdp_update_arena_block*)(((BYTE*) ptr) - UPDATE_ARENA_BLOCK_SIZE);
+
+	if (block->chunk)
+		update_arena_chunk_release(block->chunk);
+	else
+		free(block);
+}
+
+rdpUpdateArena* update_arena_new(void)
+{
+	rdpUpdateArena* arena = (rdpUpdateArena*) calloc(1, sizeof(rdpUpdateArena));
+
+	if (!arena)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&arena->lock, 4000))
+	{
+		free(arena);
+		return NULL;
+	}
+
+	arena->refs = 1;
+	return arena;
+}
+
+/**
+ * Messages still queued keep their chunks (and the arena) alive until
+ * they are freed.
+ */
+void update_arena_free_all(rdpUpdateArena* arena)
+{
+	rdpUpdateArenaChunk* chunk;
+	rdpUpdateArenaChunk* current;
+
+	if (!arena)
+		return;
+
+	EnterCriticalSection(&arena->lock);
+	arena->closed = TRUE;
+	current = arena->current;
+	arena->current = NULL;
+	chunk = arena->free;
+	arena->free = NULL;
+	arena->freeCount = 0;
+	LeaveCriticalSection(&arena->lock);
+
+	while (chunk)
+	{
+		rdpUpdateArenaChunk* next = chunk->next;
+		free(chunk);
+		update_arena_release(arena);
+		chunk = next;
+	}
+
+	if (current)
+		update_arena_chunk_release(current);
+
+	update_arena_release(arena);
+}
+
+static void* update_message_alloc(rdpContext* context, size_t size)
+{
+	return update_arena_alloc(context->update->proxy->arena, size);
+}
+
+static void update_message_free(void* ptr)
+{
+	update_arena_free(ptr);
+}
+
 /* Update */
 
 static BOOL update_message_BeginPaint(rdpContext* context)
@@ -58,7 +286,7 @@ static BOOL update_message_SetBounds(rdpContext* context,
 
 	if (bounds)
 	{
-		wParam = (rdpBounds*) malloc(sizeof(rdpBounds));
+		wParam = (rdpBounds*) update_message_alloc(context, sizeof(rdpBounds));
 		if (!wParam)
 			return FALSE;
 		CopyMemory(wParam, bounds, sizeof(rdpBounds));
@@ -86,17 +314,17 @@ static BOOL update_message_BitmapUpdate(rdpContext* context,
 	UINT32 index;
 	BITMAP_UPDATE* wParam;
 
-	wParam = (BITMAP_UPDATE*) malloc(sizeof(BITMAP_UPDATE));
+	wParam = (BITMAP_UPDATE*) update_message_alloc(context, sizeof(BITMAP_UPDATE));
 	if (!wParam)
 		return FALSE;
 
 	wParam->number = bitmap->number;
 	wParam->count = wParam->number;
 
-	wParam->rectangles = (BITMAP_DATA*) malloc(sizeof(BITMAP_DATA) * wParam->number);
+	wParam->rectangles = (BITMAP_DATA*) update_message_alloc(context, sizeof(BITMAP_DATA) * wParam->number);
 	if (!wParam->rectangles)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(wParam->rectangles, bitmap->rectangles, sizeof(BITMAP_DATA) * wParam->number);
@@ -106,14 +334,14 @@ static BOOL update_message_BitmapUpdate(rdpContext* context,
 #ifdef WITH_STREAM_POOL
 		StreamPool_AddRef(context->rdp->transport->ReceivePool, bitmap->rectangles[index].bitmapDataStream);
 #else
-		wParam->rectangles[index].bitmapDataStream = (BYTE*) malloc(wParam->rectangles[index].bitmapLength);
+		wParam->rectangles[index].bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->rectangles[index].bitmapLength);
 		if (!wParam->rectangles[index].bitmapDataStream)
 		{
 			while(index)
-				free(wParam->rectangles[--index].bitmapDataStream);
+				update_message_free(wParam->rectangles[--index].bitmapDataStream);
 
-			free(wParam->rectangles);
-			free(wParam);
+			update_message_free(wParam->rectangles);
+			update_message_free(wParam);
 			return FALSE;
 		}
 		CopyMemory(wParam->rectangles[index].bitmapDataStream, bitmap->rectangles[index].bitmapDataStream,
@@ -130,7 +358,7 @@ static BOOL update_message_Palette(rdpContext* context,
 {
 	PALETTE_UPDATE* wParam;
 
-	wParam = (PALETTE_UPDATE*) malloc(sizeof(PALETTE_UPDATE));
+	wParam = (PALETTE_UPDATE*) update_message_alloc(context, sizeof(PALETTE_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, palette, sizeof(PALETTE_UPDATE));
@@ -144,7 +372,7 @@ static BOOL update_message_PlaySound(rdpContext* context,
 {
 	PLAY_SOUND_UPDATE* wParam;
 
-	wParam = (PLAY_SOUND_UPDATE*) malloc(sizeof(PLAY_SOUND_UPDATE));
+	wParam = (PLAY_SOUND_UPDATE*) update_message_alloc(context, sizeof(PLAY_SOUND_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, playSound, sizeof(PLAY_SOUND_UPDATE));
@@ -164,7 +392,7 @@ static BOOL update_message_RefreshRect(rdpContext* context, BYTE count,
 {
 	RECTANGLE_16* lParam;
 
-	lParam = (RECTANGLE_16*) malloc(sizeof(RECTANGLE_16) * count);
+	lParam = (RECTANGLE_16*) update_message_alloc(context, sizeof(RECTANGLE_16) * count);
 	if (!lParam)
 		return FALSE;
 	CopyMemory(lParam, areas, sizeof(RECTANGLE_16) * count);
@@ -180,7 +408,7 @@ static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow,
 
 	if (area)
 	{
-		lParam = (RECTANGLE_16*) malloc(sizeof(RECTANGLE_16));
+		lParam = (RECTANGLE_16*) update_message_alloc(context, sizeof(RECTANGLE_16));
 		if (!lParam)
 			return FALSE;
 		CopyMemory(lParam, area, sizeof(RECTANGLE_16));
@@ -210,7 +438,7 @@ static BOOL update_message_SurfaceBits(rdpContext* context,
 {
 	SURFACE_BITS_COMMAND* wParam;
 
-	wParam = (SURFACE_BITS_COMMAND*) malloc(sizeof(SURFACE_BITS_COMMAND));
+	wParam = (SURFACE_BITS_COMMAND*) update_message_alloc(context, sizeof(SURFACE_BITS_COMMAND));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, surfaceBitsCommand, sizeof(SURFACE_BITS_COMMAND));
@@ -218,10 +446,10 @@ static BOOL update_message_SurfaceBits(rdpContext* context,
 #ifdef WITH_STREAM_POOL
 	StreamPool_AddRef(context->rdp->transport->ReceivePool, surfaceBitsCommand->bitmapData);
 #else
-	wParam->bitmapData = (BYTE*) malloc(wParam->bitmapDataLength);
+	wParam->bitmapData = (BYTE*) update_message_alloc(context, wParam->bitmapDataLength);
 	if (!wParam->bitmapData)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(wParam->bitmapData, surfaceBitsCommand->bitmapData, wParam->bitmapDataLength);
@@ -236,7 +464,7 @@ static BOOL update_message_SurfaceFrameMarker(rdpContext* context,
 {
 	SURFACE_FRAME_MARKER* wParam;
 
-	wParam = (SURFACE_FRAME_MARKER*) malloc(sizeof(SURFACE_FRAME_MARKER));
+	wParam = (SURFACE_FRAME_MARKER*) update_message_alloc(context, sizeof(SURFACE_FRAME_MARKER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, surfaceFrameMarker, sizeof(SURFACE_FRAME_MARKER));
@@ -257,7 +485,7 @@ static BOOL update_message_DstBlt(rdpContext* context, const DSTBLT_ORDER* dstBl
 {
 	DSTBLT_ORDER* wParam;
 
-	wParam = (DSTBLT_ORDER*) malloc(sizeof(DSTBLT_ORDER));
+	wParam = (DSTBLT_ORDER*) update_message_alloc(context, sizeof(DSTBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, dstBlt, sizeof(DSTBLT_ORDER));
@@ -270,7 +498,7 @@ static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 {
 	PATBLT_ORDER* wParam;
 
-	wParam = (PATBLT_ORDER*) malloc(sizeof(PATBLT_ORDER));
+	wParam = (PATBLT_ORDER*) update_message_alloc(context, sizeof(PATBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, patBlt, sizeof(PATBLT_ORDER));
@@ -286,7 +514,7 @@ static BOOL update_message_ScrBlt(rdpContext* context,
 {
 	SCRBLT_ORDER* wParam;
 
-	wParam = (SCRBLT_ORDER*) malloc(sizeof(SCRBLT_ORDER));
+	wParam = (SCRBLT_ORDER*) update_message_alloc(context, sizeof(SCRBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, scrBlt, sizeof(SCRBLT_ORDER));
@@ -301,7 +529,7 @@ static BOOL update_message_OpaqueRect(
 {
 	OPAQUE_RECT_ORDER* wParam;
 
-	wParam = (OPAQUE_RECT_ORDER*) malloc(sizeof(OPAQUE_RECT_ORDER));
+	wParam = (OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(OPAQUE_RECT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
@@ -316,7 +544,7 @@ static BOOL update_message_DrawNineGrid(
 {
 	DRAW_NINE_GRID_ORDER* wParam;
 
-	wParam = (DRAW_NINE_GRID_ORDER*) malloc(sizeof(DRAW_NINE_GRID_ORDER));
+	wParam = (DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(DRAW_NINE_GRID_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawNineGrid, sizeof(DRAW_NINE_GRID_ORDER));
@@ -330,7 +558,7 @@ static BOOL update_message_MultiDstBlt(rdpContext* context,
 {
 	MULTI_DSTBLT_ORDER* wParam;
 
-	wParam = (MULTI_DSTBLT_ORDER*) malloc(sizeof(MULTI_DSTBLT_ORDER));
+	wParam = (MULTI_DSTBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_DSTBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
@@ -344,7 +572,7 @@ static BOOL update_message_MultiPatBlt(rdpContext* context,
 {
 	MULTI_PATBLT_ORDER* wParam;
 
-	wParam = (MULTI_PATBLT_ORDER*) malloc(sizeof(MULTI_PATBLT_ORDER));
+	wParam = (MULTI_PATBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_PATBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
@@ -360,7 +588,7 @@ static BOOL update_message_MultiScrBlt(rdpContext* context,
 {
 	MULTI_SCRBLT_ORDER* wParam;
 
-	wParam = (MULTI_SCRBLT_ORDER*) malloc(sizeof(MULTI_SCRBLT_ORDER));
+	wParam = (MULTI_SCRBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_SCRBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
@@ -375,7 +603,7 @@ static BOOL update_message_MultiOpaqueRect(
 {
 	MULTI_OPAQUE_RECT_ORDER* wParam;
 
-	wParam = (MULTI_OPAQUE_RECT_ORDER*) malloc(sizeof(MULTI_OPAQUE_RECT_ORDER));
+	wParam = (MULTI_OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(MULTI_OPAQUE_RECT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, multiOpaqueRect, sizeof(MULTI_OPAQUE_RECT_ORDER));
@@ -389,7 +617,7 @@ static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
 {
 	MULTI_DRAW_NINE_GRID_ORDER* wParam;
 
-	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) malloc(sizeof(MULTI_DRAW_NINE_GRID_ORDER));
+	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, multiDrawNineGrid, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
@@ -405,7 +633,7 @@ static BOOL update_message_LineTo(rdpContext* context,
 {
 	LINE_TO_ORDER* wParam;
 
-	wParam = (LINE_TO_ORDER*) malloc(sizeof(LINE_TO_ORDER));
+	wParam = (LINE_TO_ORDER*) update_message_alloc(context, sizeof(LINE_TO_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, lineTo, sizeof(LINE_TO_ORDER));
@@ -419,15 +647,15 @@ static BOOL update_message_Polyline(rdpContext* context,
 {
 	POLYLINE_ORDER* wParam;
 
-	wParam = (POLYLINE_ORDER*) malloc(sizeof(POLYLINE_ORDER));
+	wParam = (POLYLINE_ORDER*) update_message_alloc(context, sizeof(POLYLINE_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, polyline, sizeof(POLYLINE_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numDeltaEntries);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(wParam->points, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
@@ -440,7 +668,7 @@ static BOOL update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
 {
 	MEMBLT_ORDER* wParam;
 
-	wParam = (MEMBLT_ORDER*) malloc(sizeof(MEMBLT_ORDER));
+	wParam = (MEMBLT_ORDER*) update_message_alloc(context, sizeof(MEMBLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, memBlt, sizeof(MEMBLT_ORDER));
@@ -453,7 +681,7 @@ static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 {
 	MEM3BLT_ORDER* wParam;
 
-	wParam = (MEM3BLT_ORDER*) malloc(sizeof(MEM3BLT_ORDER));
+	wParam = (MEM3BLT_ORDER*) update_message_alloc(context, sizeof(MEM3BLT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, mem3Blt, sizeof(MEM3BLT_ORDER));
@@ -469,7 +697,7 @@ static BOOL update_message_SaveBitmap(rdpContext* context,
 {
 	SAVE_BITMAP_ORDER* wParam;
 
-	wParam = (SAVE_BITMAP_ORDER*) malloc(sizeof(SAVE_BITMAP_ORDER));
+	wParam = (SAVE_BITMAP_ORDER*) update_message_alloc(context, sizeof(SAVE_BITMAP_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
@@ -483,7 +711,7 @@ static BOOL update_message_GlyphIndex(rdpContext* context,
 {
 	GLYPH_INDEX_ORDER* wParam;
 
-	wParam = (GLYPH_INDEX_ORDER*) malloc(sizeof(GLYPH_INDEX_ORDER));
+	wParam = (GLYPH_INDEX_ORDER*) update_message_alloc(context, sizeof(GLYPH_INDEX_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
@@ -499,7 +727,7 @@ static BOOL update_message_FastIndex(rdpContext* context,
 {
 	FAST_INDEX_ORDER* wParam;
 
-	wParam = (FAST_INDEX_ORDER*) malloc(sizeof(FAST_INDEX_ORDER));
+	wParam = (FAST_INDEX_ORDER*) update_message_alloc(context, sizeof(FAST_INDEX_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, fastIndex, sizeof(FAST_INDEX_ORDER));
@@ -513,17 +741,17 @@ static BOOL update_message_FastGlyph(rdpContext* context,
 {
 	FAST_GLYPH_ORDER* wParam;
 
-	wParam = (FAST_GLYPH_ORDER*) malloc(sizeof(FAST_GLYPH_ORDER));
+	wParam = (FAST_GLYPH_ORDER*) update_message_alloc(context, sizeof(FAST_GLYPH_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, fastGlyph, sizeof(FAST_GLYPH_ORDER));
 
 	if (wParam->cbData > 1)
 	{
-		wParam->glyphData.aj = (BYTE*) malloc(fastGlyph->glyphData.cb);
+		wParam->glyphData.aj = (BYTE*) update_message_alloc(context, fastGlyph->glyphData.cb);
 		if (!wParam->glyphData.aj)
 		{
-			free(wParam);
+			update_message_free(wParam);
 			return FALSE;
 		}
 		CopyMemory(wParam->glyphData.aj, fastGlyph->glyphData.aj, fastGlyph->glyphData.cb);
@@ -542,18 +770,18 @@ static BOOL update_message_PolygonSC(rdpContext* context,
 {
 	POLYGON_SC_ORDER* wParam;
 
-	wParam = (POLYGON_SC_ORDER*) malloc(sizeof(POLYGON_SC_ORDER));
+	wParam = (POLYGON_SC_ORDER*) update_message_alloc(context, sizeof(POLYGON_SC_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, polygonSC, sizeof(POLYGON_SC_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
-	CopyMemory(wParam->points, polygonSC, sizeof(DELTA_POINT) * wParam->numPoints);
+	CopyMemory(wParam->points, polygonSC->points, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	return MessageQueue_Post(context->update->queue, (void*) context,
 			MakeMessageId(PrimaryUpdate, PolygonSC), (void*) wParam, NULL);
@@ -563,18 +791,18 @@ static BOOL update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* poly
 {
 	POLYGON_CB_ORDER* wParam;
 
-	wParam = (POLYGON_CB_ORDER*) malloc(sizeof(POLYGON_CB_ORDER));
+	wParam = (POLYGON_CB_ORDER*) update_message_alloc(context, sizeof(POLYGON_CB_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, polygonCB, sizeof(POLYGON_CB_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
-	CopyMemory(wParam->points, polygonCB, sizeof(DELTA_POINT) * wParam->numPoints);
+	CopyMemory(wParam->points, polygonCB->points, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
 
@@ -587,7 +815,7 @@ static BOOL update_message_EllipseSC(rdpContext* context,
 {
 	ELLIPSE_SC_ORDER* wParam;
 
-	wParam = (ELLIPSE_SC_ORDER*) malloc(sizeof(ELLIPSE_SC_ORDER));
+	wParam = (ELLIPSE_SC_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_SC_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
@@ -601,7 +829,7 @@ static BOOL update_message_EllipseCB(rdpContext* context,
 {
 	ELLIPSE_CB_ORDER* wParam;
 
-	wParam = (ELLIPSE_CB_ORDER*) malloc(sizeof(ELLIPSE_CB_ORDER));
+	wParam = (ELLIPSE_CB_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_CB_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
@@ -619,18 +847,18 @@ static BOOL update_message_CacheBitmap(rdpContext* context,
 {
 	CACHE_BITMAP_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_ORDER*) malloc(sizeof(CACHE_BITMAP_ORDER));
+	wParam = (CACHE_BITMAP_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheBitmapOrder, sizeof(CACHE_BITMAP_ORDER));
 
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 	if (!wParam->bitmapDataStream)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
-	CopyMemory(wParam->bitmapDataStream, cacheBitmapOrder, wParam->bitmapLength);
+	CopyMemory(wParam->bitmapDataStream, cacheBitmapOrder->bitmapDataStream, wParam->bitmapLength);
 
 	return MessageQueue_Post(context->update->queue, (void*) context,
 			MakeMessageId(SecondaryUpdate, CacheBitmap), (void*) wParam, NULL);
@@ -640,15 +868,15 @@ static BOOL update_message_CacheBitmapV2(rdpContext* context, CACHE_BITMAP_V2_OR
 {
 	CACHE_BITMAP_V2_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_V2_ORDER*) malloc(sizeof(CACHE_BITMAP_V2_ORDER));
+	wParam = (CACHE_BITMAP_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V2_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheBitmapV2Order, sizeof(CACHE_BITMAP_V2_ORDER));
 
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 	if (!wParam->bitmapDataStream)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(wParam->bitmapDataStream, cacheBitmapV2Order->bitmapDataStream, wParam->bitmapLength);
@@ -661,15 +889,15 @@ static BOOL update_message_CacheBitmapV3(rdpContext* context, CACHE_BITMAP_V3_OR
 {
 	CACHE_BITMAP_V3_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_V3_ORDER*) malloc(sizeof(CACHE_BITMAP_V3_ORDER));
+	wParam = (CACHE_BITMAP_V3_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V3_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheBitmapV3Order, sizeof(CACHE_BITMAP_V3_ORDER));
 
-	wParam->bitmapData.data = (BYTE*) malloc(wParam->bitmapData.length);
+	wParam->bitmapData.data = (BYTE*) update_message_alloc(context, wParam->bitmapData.length);
 	if (!wParam->bitmapData.data)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(wParam->bitmapData.data, cacheBitmapV3Order->bitmapData.data, wParam->bitmapData.length);
@@ -684,7 +912,7 @@ static BOOL update_message_CacheColorTable(
 {
 	CACHE_COLOR_TABLE_ORDER* wParam;
 
-	wParam = (CACHE_COLOR_TABLE_ORDER*) malloc(sizeof(CACHE_COLOR_TABLE_ORDER));
+	wParam = (CACHE_COLOR_TABLE_ORDER*) update_message_alloc(context, sizeof(CACHE_COLOR_TABLE_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheColorTableOrder, sizeof(CACHE_COLOR_TABLE_ORDER));
@@ -699,7 +927,7 @@ static BOOL update_message_CacheGlyph(
 {
 	CACHE_GLYPH_ORDER* wParam;
 
-	wParam = (CACHE_GLYPH_ORDER*) malloc(sizeof(CACHE_GLYPH_ORDER));
+	wParam = (CACHE_GLYPH_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheGlyphOrder, sizeof(CACHE_GLYPH_ORDER));
@@ -714,7 +942,7 @@ static BOOL update_message_CacheGlyphV2(
 {
 	CACHE_GLYPH_V2_ORDER* wParam;
 
-	wParam = (CACHE_GLYPH_V2_ORDER*) malloc(sizeof(CACHE_GLYPH_V2_ORDER));
+	wParam = (CACHE_GLYPH_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_V2_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheGlyphV2Order, sizeof(CACHE_GLYPH_V2_ORDER));
@@ -729,7 +957,7 @@ static BOOL update_message_CacheBrush(
 {
 	CACHE_BRUSH_ORDER* wParam;
 
-	wParam = (CACHE_BRUSH_ORDER*) malloc(sizeof(CACHE_BRUSH_ORDER));
+	wParam = (CACHE_BRUSH_ORDER*) update_message_alloc(context, sizeof(CACHE_BRUSH_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, cacheBrushOrder, sizeof(CACHE_BRUSH_ORDER));
@@ -746,20 +974,20 @@ static BOOL update_message_CreateOffscreenBitmap(
 {
 	CREATE_OFFSCREEN_BITMAP_ORDER* wParam;
 
-	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) malloc(sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
+	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, createOffscreenBitmap, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 
 	wParam->deleteList.cIndices = createOffscreenBitmap->deleteList.cIndices;
 	wParam->deleteList.sIndices = wParam->deleteList.cIndices;
-	wParam->deleteList.indices = (UINT16*) malloc(sizeof(UINT16) * wParam->deleteList.cIndices);
+	wParam->deleteList.indices = (UINT16*) update_message_alloc(context, sizeof(UINT16) * wParam->deleteList.cIndices);
 	if (!wParam->deleteList.indices)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
-	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices, wParam->deleteList.cIndices);
+	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices, sizeof(UINT16) * wParam->deleteList.cIndices);
 
 	return MessageQueue_Post(context->update->queue, (void*) context,
 			MakeMessageId(AltSecUpdate, CreateOffscreenBitmap), (void*) wParam, NULL);
@@ -771,7 +999,7 @@ static BOOL update_message_SwitchSurface(
 {
 	SWITCH_SURFACE_ORDER* wParam;
 
-	wParam = (SWITCH_SURFACE_ORDER*) malloc(sizeof(SWITCH_SURFACE_ORDER));
+	wParam = (SWITCH_SURFACE_ORDER*) update_message_alloc(context, sizeof(SWITCH_SURFACE_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, switchSurface, sizeof(SWITCH_SURFACE_ORDER));
@@ -786,7 +1014,7 @@ static BOOL update_message_CreateNineGridBitmap(
 {
 	CREATE_NINE_GRID_BITMAP_ORDER* wParam;
 
-	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) malloc(sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
+	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
@@ -801,7 +1029,7 @@ static BOOL update_message_FrameMarker(
 {
 	FRAME_MARKER_ORDER* wParam;
 
-	wParam = (FRAME_MARKER_ORDER*) malloc(sizeof(FRAME_MARKER_ORDER));
+	wParam = (FRAME_MARKER_ORDER*) update_message_alloc(context, sizeof(FRAME_MARKER_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, frameMarker, sizeof(FRAME_MARKER_ORDER));
@@ -816,7 +1044,7 @@ static BOOL update_message_StreamBitmapFirst(
 {
 	STREAM_BITMAP_FIRST_ORDER* wParam;
 
-	wParam = (STREAM_BITMAP_FIRST_ORDER*) malloc(sizeof(STREAM_BITMAP_FIRST_ORDER));
+	wParam = (STREAM_BITMAP_FIRST_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_FIRST_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, streamBitmapFirst, sizeof(STREAM_BITMAP_FIRST_ORDER));
@@ -833,7 +1061,7 @@ static BOOL update_message_StreamBitmapNext(
 {
 	STREAM_BITMAP_NEXT_ORDER* wParam;
 
-	wParam = (STREAM_BITMAP_NEXT_ORDER*) malloc(sizeof(STREAM_BITMAP_NEXT_ORDER));
+	wParam = (STREAM_BITMAP_NEXT_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_NEXT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, streamBitmapNext, sizeof(STREAM_BITMAP_NEXT_ORDER));
@@ -850,7 +1078,7 @@ static BOOL update_message_DrawGdiPlusFirst(
 {
 	DRAW_GDIPLUS_FIRST_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusFirst, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
@@ -867,7 +1095,7 @@ static BOOL update_message_DrawGdiPlusNext(
 {
 	DRAW_GDIPLUS_NEXT_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusNext, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
@@ -884,7 +1112,7 @@ static BOOL update_message_DrawGdiPlusEnd(
 {
 	DRAW_GDIPLUS_END_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_END_ORDER));
+	wParam = (DRAW_GDIPLUS_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_END_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusEnd, sizeof(DRAW_GDIPLUS_END_ORDER));
@@ -901,7 +1129,7 @@ static BOOL update_message_DrawGdiPlusCacheFirst(
 {
 	DRAW_GDIPLUS_CACHE_FIRST_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
@@ -918,7 +1146,7 @@ static BOOL update_message_DrawGdiPlusCacheNext(
 {
 	DRAW_GDIPLUS_CACHE_NEXT_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
@@ -935,7 +1163,7 @@ static BOOL update_message_DrawGdiPlusCacheEnd(
 {
 	DRAW_GDIPLUS_CACHE_END_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
@@ -953,15 +1181,15 @@ static BOOL update_message_WindowCreate(rdpContext* context, WINDOW_ORDER_INFO*
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_STATE_ORDER*) malloc(sizeof(WINDOW_STATE_ORDER));
+	lParam = (WINDOW_STATE_ORDER*) update_message_alloc(context, sizeof(WINDOW_STATE_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
@@ -975,15 +1203,15 @@ static BOOL	update_message_WindowUpdate(rdpContext* context, WINDOW_ORDER_INFO*
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_STATE_ORDER*) malloc(sizeof(WINDOW_STATE_ORDER));
+	lParam = (WINDOW_STATE_ORDER*) update_message_alloc(context, sizeof(WINDOW_STATE_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
@@ -997,24 +1225,36 @@ static BOOL update_message_WindowIcon(rdpContext* context, WINDOW_ORDER_INFO* or
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_ICON_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_ICON_ORDER*) calloc(1, sizeof(WINDOW_ICON_ORDER));
+	lParam = (WINDOW_ICON_ORDER*) update_message_alloc(context, sizeof(WINDOW_ICON_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
+		return FALSE;
+	}
+
+	/* the parser reuses its icon buffers, the message gets its own copy */
+	lParam->iconInfo = (ICON_INFO*) update_message_alloc(context, sizeof(ICON_INFO));
+	if (!lParam->iconInfo)
+	{
+		update_message_free(lParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
-	CopyMemory(lParam, windowIcon, sizeof(WINDOW_ICON_ORDER));
+	CopyMemory(lParam->iconInfo, windowIcon->iconInfo, sizeof(ICON_INFO));
+	lParam->iconInfo->bitsColor = NULL;
+	lParam->iconInfo->bitsMask = NULL;
+	lParam->iconInfo->colorTable = NULL;
 
 	WLog_VRB(TAG,  "update_message_WindowIcon");
 
 	if (windowIcon->iconInfo->cbBitsColor > 0)
 	{
-		lParam->iconInfo->bitsColor = (BYTE*) malloc(windowIcon->iconInfo->cbBitsColor);
+		lParam->iconInfo->bitsColor = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbBitsColor);
 		if (!lParam->iconInfo->bitsColor)
 			goto out_fail;
 		CopyMemory(lParam->iconInfo->bitsColor, windowIcon->iconInfo->bitsColor, windowIcon->iconInfo->cbBitsColor);
@@ -1022,7 +1262,7 @@ static BOOL update_message_WindowIcon(rdpContext* context, WINDOW_ORDER_INFO* or
 
 	if (windowIcon->iconInfo->cbBitsMask > 0)
 	{
-		lParam->iconInfo->bitsMask = (BYTE*) malloc(windowIcon->iconInfo->cbBitsMask);
+		lParam->iconInfo->bitsMask = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbBitsMask);
 		if (!lParam->iconInfo->bitsMask)
 			goto out_fail;
 		CopyMemory(lParam->iconInfo->bitsMask, windowIcon->iconInfo->bitsMask, windowIcon->iconInfo->cbBitsMask);
@@ -1030,7 +1270,7 @@ static BOOL update_message_WindowIcon(rdpContext* context, WINDOW_ORDER_INFO* or
 
 	if (windowIcon->iconInfo->cbColorTable > 0)
 	{
-		lParam->iconInfo->colorTable = (BYTE*) malloc(windowIcon->iconInfo->cbColorTable);
+		lParam->iconInfo->colorTable = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbColorTable);
 		if (!lParam->iconInfo->colorTable)
 			goto out_fail;
 		CopyMemory(lParam->iconInfo->colorTable, windowIcon->iconInfo->colorTable, windowIcon->iconInfo->cbColorTable);
@@ -1040,11 +1280,12 @@ static BOOL update_message_WindowIcon(rdpContext* context, WINDOW_ORDER_INFO* or
 			MakeMessageId(WindowUpdate, WindowIcon), (void*) wParam, (void*) lParam);
 
 out_fail:
-	free(lParam->iconInfo->bitsColor);
-	free(lParam->iconInfo->bitsMask);
-	free(lParam->iconInfo->colorTable);
-	free(lParam);
-	free(wParam);
+	update_message_free(lParam->iconInfo->bitsColor);
+	update_message_free(lParam->iconInfo->bitsMask);
+	update_message_free(lParam->iconInfo->colorTable);
+	update_message_free(lParam->iconInfo);
+	update_message_free(lParam);
+	update_message_free(wParam);
 	return FALSE;
 
 }
@@ -1054,15 +1295,15 @@ static BOOL update_message_WindowCachedIcon(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_CACHED_ICON_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_CACHED_ICON_ORDER*) malloc(sizeof(WINDOW_CACHED_ICON_ORDER));
+	lParam = (WINDOW_CACHED_ICON_ORDER*) update_message_alloc(context, sizeof(WINDOW_CACHED_ICON_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, windowCachedIcon, sizeof(WINDOW_CACHED_ICON_ORDER));
@@ -1075,7 +1316,7 @@ static BOOL update_message_WindowDelete(rdpContext* context, WINDOW_ORDER_INFO*
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
@@ -1089,15 +1330,15 @@ static BOOL update_message_NotifyIconCreate(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (NOTIFY_ICON_STATE_ORDER*) malloc(sizeof(NOTIFY_ICON_STATE_ORDER));
+	lParam = (NOTIFY_ICON_STATE_ORDER*) update_message_alloc(context, sizeof(NOTIFY_ICON_STATE_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
@@ -1111,15 +1352,15 @@ static BOOL update_message_NotifyIconUpdate(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (NOTIFY_ICON_STATE_ORDER*) malloc(sizeof(NOTIFY_ICON_STATE_ORDER));
+	lParam = (NOTIFY_ICON_STATE_ORDER*) update_message_alloc(context, sizeof(NOTIFY_ICON_STATE_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
@@ -1132,7 +1373,7 @@ static BOOL update_message_NotifyIconDelete(rdpContext* context, WINDOW_ORDER_IN
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
@@ -1146,15 +1387,15 @@ static BOOL update_message_MonitoredDesktop(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	MONITORED_DESKTOP_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (MONITORED_DESKTOP_ORDER*) malloc(sizeof(MONITORED_DESKTOP_ORDER));
+	lParam = (MONITORED_DESKTOP_ORDER*) update_message_alloc(context, sizeof(MONITORED_DESKTOP_ORDER));
 	if (!lParam)
 	{
-		free(wParam);
+		update_message_free(wParam);
 		return FALSE;
 	}
 	CopyMemory(lParam, monitoredDesktop, sizeof(MONITORED_DESKTOP_ORDER));
@@ -1163,8 +1404,14 @@ static BOOL update_message_MonitoredDesktop(rdpContext* context, WINDOW_ORDER_IN
 
 	if (lParam->numWindowIds)
 	{
-		lParam->windowIds = (UINT32*) malloc(sizeof(UINT32) * lParam->numWindowIds);
-		CopyMemory(lParam->windowIds, monitoredDesktop->windowIds, lParam->numWindowIds);
+		lParam->windowIds = (UINT32*) update_message_alloc(context, sizeof(UINT32) * lParam->numWindowIds);
+		if (!lParam->windowIds)
+		{
+			update_message_free(lParam);
+			update_message_free(wParam);
+			return FALSE;
+		}
+		CopyMemory(lParam->windowIds, monitoredDesktop->windowIds, sizeof(UINT32) * lParam->numWindowIds);
 	}
 
 	return MessageQueue_Post(context->update->queue, (void*) context,
@@ -1175,7 +1422,7 @@ static BOOL update_message_NonMonitoredDesktop(rdpContext* context, WINDOW_ORDER
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
@@ -1191,7 +1438,7 @@ static BOOL update_message_PointerPosition(rdpContext* context,
 {
 	POINTER_POSITION_UPDATE* wParam;
 
-	wParam = (POINTER_POSITION_UPDATE*) malloc(sizeof(POINTER_POSITION_UPDATE));
+	wParam = (POINTER_POSITION_UPDATE*) update_message_alloc(context, sizeof(POINTER_POSITION_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, pointerPosition, sizeof(POINTER_POSITION_UPDATE));
@@ -1205,7 +1452,7 @@ static BOOL update_message_PointerSystem(rdpContext* context,
 {
 	POINTER_SYSTEM_UPDATE* wParam;
 
-	wParam = (POINTER_SYSTEM_UPDATE*) malloc(sizeof(POINTER_SYSTEM_UPDATE));
+	wParam = (POINTER_SYSTEM_UPDATE*) update_message_alloc(context, sizeof(POINTER_SYSTEM_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, pointerSystem, sizeof(POINTER_SYSTEM_UPDATE));
@@ -1219,7 +1466,7 @@ static BOOL update_message_PointerColor(rdpContext* context,
 {
 	POINTER_COLOR_UPDATE* wParam;
 
-	wParam = (POINTER_COLOR_UPDATE*) malloc(sizeof(POINTER_COLOR_UPDATE));
+	wParam = (POINTER_COLOR_UPDATE*) update_message_alloc(context, sizeof(POINTER_COLOR_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, pointerColor, sizeof(POINTER_COLOR_UPDATE));
@@ -1228,7 +1475,7 @@ static BOOL update_message_PointerColor(rdpContext* context,
 
 	if (wParam->lengthAndMask)
 	{
-		wParam->andMaskData = (BYTE*) malloc(wParam->lengthAndMask);
+		wParam->andMaskData = (BYTE*) update_message_alloc(context, wParam->lengthAndMask);
 		if (!wParam->andMaskData)
 			goto out_fail;
 		CopyMemory(wParam->andMaskData, pointerColor->andMaskData, wParam->lengthAndMask);
@@ -1236,7 +1483,7 @@ static BOOL update_message_PointerColor(rdpContext* context,
 
 	if (wParam->lengthXorMask)
 	{
-		wParam->xorMaskData = (BYTE*) malloc(wParam->lengthXorMask);
+		wParam->xorMaskData = (BYTE*) update_message_alloc(context, wParam->lengthXorMask);
 		if (!wParam->xorMaskData)
 			goto out_fail;
 		CopyMemory(wParam->xorMaskData, pointerColor->xorMaskData, wParam->lengthXorMask);
@@ -1246,9 +1493,9 @@ static BOOL update_message_PointerColor(rdpContext* context,
 			MakeMessageId(PointerUpdate, PointerColor), (void*) wParam, NULL);
 
 out_fail:
-	free(wParam->andMaskData);
-	free(wParam->xorMaskData);
-	free(wParam);
+	update_message_free(wParam->andMaskData);
+	update_message_free(wParam->xorMaskData);
+	update_message_free(wParam);
 	return FALSE;
 }
 
@@ -1257,7 +1504,7 @@ static BOOL update_message_PointerNew(rdpContext* context,
 {
 	POINTER_NEW_UPDATE* wParam;
 
-	wParam = (POINTER_NEW_UPDATE*) malloc(sizeof(POINTER_NEW_UPDATE));
+	wParam = (POINTER_NEW_UPDATE*) update_message_alloc(context, sizeof(POINTER_NEW_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, pointerNew, sizeof(POINTER_NEW_UPDATE));
@@ -1266,7 +1513,7 @@ static BOOL update_message_PointerNew(rdpContext* context,
 
 	if (wParam->colorPtrAttr.lengthAndMask)
 	{
-		wParam->colorPtrAttr.andMaskData = (BYTE*) malloc(wParam->colorPtrAttr.lengthAndMask);
+		wParam->colorPtrAttr.andMaskData = (BYTE*) update_message_alloc(context, wParam->colorPtrAttr.lengthAndMask);
 		if (!wParam->colorPtrAttr.andMaskData)
 			goto out_fail;
 		CopyMemory(wParam->colorPtrAttr.andMaskData, pointerNew->colorPtrAttr.andMaskData, wParam->colorPtrAttr.lengthAndMask);
@@ -1274,7 +1521,7 @@ static BOOL update_message_PointerNew(rdpContext* context,
 
 	if (wParam->colorPtrAttr.lengthXorMask)
 	{
-		wParam->colorPtrAttr.xorMaskData = (BYTE*) malloc(wParam->colorPtrAttr.lengthXorMask);
+		wParam->colorPtrAttr.xorMaskData = (BYTE*) update_message_alloc(context, wParam->colorPtrAttr.lengthXorMask);
 		if (!wParam->colorPtrAttr.xorMaskData)
 			goto out_fail;
 		CopyMemory(wParam->colorPtrAttr.xorMaskData, pointerNew->colorPtrAttr.xorMaskData, wParam->colorPtrAttr.lengthXorMask);
@@ -1284,9 +1531,9 @@ static BOOL update_message_PointerNew(rdpContext* context,
 			MakeMessageId(PointerUpdate, PointerNew), (void*) wParam, NULL);
 
 out_fail:
-	free(wParam->colorPtrAttr.andMaskData);
-	free(wParam->colorPtrAttr.xorMaskData);
-	free(wParam);
+	update_message_free(wParam->colorPtrAttr.andMaskData);
+	update_message_free(wParam->colorPtrAttr.xorMaskData);
+	update_message_free(wParam);
 	return FALSE;
 }
 
@@ -1295,7 +1542,7 @@ static BOOL update_message_PointerCached(rdpContext* context,
 {
 	POINTER_CACHED_UPDATE* wParam;
 
-	wParam = (POINTER_CACHED_UPDATE*) malloc(sizeof(POINTER_CACHED_UPDATE));
+	wParam = (POINTER_CACHED_UPDATE*) update_message_alloc(context, sizeof(POINTER_CACHED_UPDATE));
 	if (!wParam)
 		return FALSE;
 	CopyMemory(wParam, pointerCached, sizeof(POINTER_CACHED_UPDATE));
@@ -1318,7 +1565,7 @@ static int update_message_free_update_class(wMessage* msg, int type)
 			break;
 
 		case Update_SetBounds:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case Update_Synchronize:
@@ -1338,29 +1585,29 @@ static int update_message_free_update_class(wMessage* msg, int type)
 					rdpContext* context = (rdpContext*) msg->context;
 					StreamPool_Release(context->rdp->transport->ReceivePool, wParam->rectangles[index].bitmapDataStream);
 #else
-					free(wParam->rectangles[index].bitmapDataStream);
+					update_message_free(wParam->rectangles[index].bitmapDataStream);
 #endif
 				}
 
-				free(wParam->rectangles);
-				free(wParam);
+				update_message_free(wParam->rectangles);
+				update_message_free(wParam);
 			}
 			break;
 
 		case Update_Palette:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case Update_PlaySound:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case Update_RefreshRect:
-			free(msg->lParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case Update_SuppressOutput:
-			free(msg->lParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case Update_SurfaceCommand:
@@ -1376,16 +1623,17 @@ static int update_message_free_update_class(wMessage* msg, int type)
 				rdpContext* context = (rdpContext*) msg->context;
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
 				StreamPool_Release(context->rdp->transport->ReceivePool, wParam->bitmapData);
+				update_message_free(wParam);
 #else
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
-				free(wParam->bitmapData);
-				free(wParam);
+				update_message_free(wParam->bitmapData);
+				update_message_free(wParam);
 #endif
 			}
 			break;
 
 		case Update_SurfaceFrameMarker:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case Update_SurfaceFrameAcknowledge:
@@ -1484,83 +1732,83 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case PrimaryUpdate_DstBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_PatBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_ScrBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_OpaqueRect:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_DrawNineGrid:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDstBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiPatBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiScrBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiOpaqueRect:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDrawNineGrid:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_LineTo:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Polyline:
 			{
 				POLYLINE_ORDER* wParam = (POLYLINE_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_message_free(wParam->points);
+				update_message_free(wParam);
 			}
 			break;
 
 		case PrimaryUpdate_MemBlt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Mem3Blt:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_SaveBitmap:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_GlyphIndex:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastIndex:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastGlyph:
 			{
 				FAST_GLYPH_ORDER* wParam = (FAST_GLYPH_ORDER*) msg->wParam;
-				free(wParam->glyphData.aj);
-				free(wParam);
+				update_message_free(wParam->glyphData.aj);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -1568,8 +1816,8 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 			{
 				POLYGON_SC_ORDER* wParam = (POLYGON_SC_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_message_free(wParam->points);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -1577,17 +1825,17 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 			{
 				POLYGON_CB_ORDER* wParam = (POLYGON_CB_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_message_free(wParam->points);
+				update_message_free(wParam);
 			}
 			break;
 
 		case PrimaryUpdate_EllipseSC:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_EllipseCB:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		default:
@@ -1711,8 +1959,8 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_ORDER* wParam = (CACHE_BITMAP_ORDER*) msg->wParam;
 
-				free(wParam->bitmapDataStream);
-				free(wParam);
+				update_message_free(wParam->bitmapDataStream);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -1720,8 +1968,8 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_V2_ORDER* wParam = (CACHE_BITMAP_V2_ORDER*) msg->wParam;
 
-				free(wParam->bitmapDataStream);
-				free(wParam);
+				update_message_free(wParam->bitmapDataStream);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -1729,36 +1977,36 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_V3_ORDER* wParam = (CACHE_BITMAP_V3_ORDER*) msg->wParam;
 
-				free(wParam->bitmapData.data);
-				free(wParam);
+				update_message_free(wParam->bitmapData.data);
+				update_message_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheColorTable:
 			{
 				CACHE_COLOR_TABLE_ORDER* wParam = (CACHE_COLOR_TABLE_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyph:
 			{
 				CACHE_GLYPH_ORDER* wParam = (CACHE_GLYPH_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyphV2:
 			{
 				CACHE_GLYPH_V2_ORDER* wParam = (CACHE_GLYPH_V2_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheBrush:
 			{
 				CACHE_BRUSH_ORDER* wParam = (CACHE_BRUSH_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -1823,53 +2071,53 @@ static int update_message_free_altsec_update_class(wMessage* msg, int type)
 			{
 				CREATE_OFFSCREEN_BITMAP_ORDER* wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) msg->wParam;
 
-				free(wParam->deleteList.indices);
-				free(wParam);
+				update_message_free(wParam->deleteList.indices);
+				update_message_free(wParam);
 			}
 			break;
 
 		case AltSecUpdate_SwitchSurface:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_CreateNineGridBitmap:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_FrameMarker:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapFirst:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapNext:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusFirst:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusNext:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusEnd:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheFirst:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheNext:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheEnd:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		default:
@@ -1950,13 +2198,13 @@ static int update_message_free_window_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case WindowUpdate_WindowCreate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_message_free(msg->wParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowUpdate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_message_free(msg->wParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowIcon:
@@ -1964,62 +2212,51 @@ static int update_message_free_window_update_class(wMessage* msg, int type)
 				WINDOW_ORDER_INFO* orderInfo = (WINDOW_ORDER_INFO*) msg->wParam;
 				WINDOW_ICON_ORDER* windowIcon = (WINDOW_ICON_ORDER*) msg->lParam;
 
-				if (windowIcon->iconInfo->cbBitsColor > 0)
-				{
-					free(windowIcon->iconInfo->bitsColor);
-				}
-
-				if (windowIcon->iconInfo->cbBitsMask > 0)
-				{
-					free(windowIcon->iconInfo->bitsMask);
-				}
-
-				if (windowIcon->iconInfo->cbColorTable > 0)
-				{
-					free(windowIcon->iconInfo->colorTable);
-				}
-
-				free(orderInfo);
-				free(windowIcon);
+				update_message_free(windowIcon->iconInfo->bitsColor);
+				update_message_free(windowIcon->iconInfo->bitsMask);
+				update_message_free(windowIcon->iconInfo->colorTable);
+				update_message_free(windowIcon->iconInfo);
+				update_message_free(orderInfo);
+				update_message_free(windowIcon);
 			}
 			break;
 
 		case WindowUpdate_WindowCachedIcon:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_message_free(msg->wParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowDelete:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case WindowUpdate_NotifyIconCreate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_message_free(msg->wParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case WindowUpdate_NotifyIconUpdate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_message_free(msg->wParam);
+			update_message_free(msg->lParam);
 			break;
 
 		case WindowUpdate_NotifyIconDelete:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case WindowUpdate_MonitoredDesktop:
 			{
 				MONITORED_DESKTOP_ORDER* lParam = (MONITORED_DESKTOP_ORDER*) msg->lParam;
 
-				free(msg->wParam);
+				update_message_free(msg->wParam);
 
-				free(lParam->windowIds);
-				free(lParam);
+				update_message_free(lParam->windowIds);
+				update_message_free(lParam);
 			}
 			break;
 
 		case WindowUpdate_NonMonitoredDesktop:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		default:
@@ -2105,16 +2342,16 @@ int update_message_free_pointer_update_class(wMessage* msg, int type)
 		case PointerUpdate_PointerPosition:
 		case PointerUpdate_PointerSystem:
 		case PointerUpdate_PointerCached:
-			free(msg->wParam);
+			update_message_free(msg->wParam);
 			break;
 
 		case PointerUpdate_PointerColor:
 			{
 				POINTER_COLOR_UPDATE* wParam = (POINTER_COLOR_UPDATE*) msg->wParam;
 
-				free(wParam->andMaskData);
-				free(wParam->xorMaskData);
-				free(wParam);
+				update_message_free(wParam->andMaskData);
+				update_message_free(wParam->xorMaskData);
+				update_message_free(wParam);
 			}
 			break;
 
@@ -2122,9 +2359,9 @@ int update_message_free_pointer_update_class(wMessage* msg, int type)
 			{
 				POINTER_NEW_UPDATE* wParam = (POINTER_NEW_UPDATE*) msg->wParam;
 
-				free(wParam->colorPtrAttr.andMaskData);
-				free(wParam->colorPtrAttr.xorMaskData);
-				free(wParam);
+				update_message_free(wParam->colorPtrAttr.andMaskData);
+				update_message_free(wParam->colorPtrAttr.xorMaskData);
+				update_message_free(wParam);
 			}
 			break;
 		default:
@@ -2530,10 +2767,20 @@ rdpUpdateProxy *update_message_proxy_new(rdpUpdate *update)
 		return NULL;
 
 	message->update = update;
+
+	if (!(message->arena = update_arena_new()))
+	{
+		free(message);
+		return NULL;
+	}
+
+	update->proxy = message;
 	update_message_register_interface(message, update);
 	if (!(message->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) update_message_proxy_thread, update, 0, NULL)))
 	{
 		WLog_ERR(TAG, "Failed to create proxy thread");
+		update->proxy = NULL;
+		update_arena_free_all(message->arena);
 		free(message);
 		return NULL;
 	}
@@ -2548,6 +2795,7 @@ void update_message_proxy_free(rdpUpdateProxy* message)
 		if (MessageQueue_PostQuit(message->update->queue, 0))
 			WaitForSingleObject(message->thread, INFINITE);
 		CloseHandle(message->thread);
+		update_arena_free_all(message->arena);
 		free(message);
 	}
 }
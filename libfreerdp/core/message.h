@@ -28,6 +28,14 @@
  * Update Message Queue
  */
 
+/**
+ * Messages posted to the update thread are copied into chunks of an
+ * arena. A chunk is reused once every message allocated from it was
+ * released, so a steady stream of orders does not hit malloc at all.
+ */
+
+typedef struct rdp_update_arena rdpUpdateArena;
+
 /* Update Proxy Interface */
 
 struct rdp_update_proxy
@@ -124,8 +132,14 @@ struct rdp_update_proxy
 	pPointerCached PointerCached;
 
 	HANDLE thread;
+	rdpUpdateArena* arena;
 };
 
+FREERDP_LOCAL rdpUpdateArena* update_arena_new(void);
+FREERDP_LOCAL void update_arena_free_all(rdpUpdateArena* arena);
+FREERDP_LOCAL void* update_arena_alloc(rdpUpdateArena* arena, size_t size);
+FREERDP_LOCAL void update_arena_free(void* ptr);
+
 FREERDP_LOCAL int update_message_queue_process_message(rdpUpdate* update,
         wMessage* message);
 FREERDP_LOCAL int update_message_queue_free_message(wMessage* message);
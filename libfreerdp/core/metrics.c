@@ -21,8 +21,89 @@
 #include "config.h"
 #endif
 
+#include <stdarg.h>
+
+#include <winpr/crt.h>
+#include <winpr/interlocked.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 #include "rdp.h"
 
+static const char* METRICS_CODEC_NAMES[METRICS_CODEC_COUNT] =
+{
+	"interleaved",
+	"planar",
+	"nscodec",
+	"remotefx",
+	"clearcodec",
+	"alphacodec",
+	"progressive",
+	"avc420",
+	"avc444"
+};
+
+static void metrics_add(volatile LONGLONG* value, LONGLONG addend)
+{
+	LONGLONG current;
+
+	do
+	{
+		current = *value;
+	}
+	while (InterlockedCompareExchange64(value, current + addend, current) != current);
+}
+
+static void metrics_set(volatile LONGLONG* value, LONGLONG newValue)
+{
+	LONGLONG current;
+
+	do
+	{
+		current = *value;
+	}
+	while (InterlockedCompareExchange64(value, newValue, current) != current);
+}
+
+static void metrics_histogram_add(rdpMetricsHistogram* histogram, UINT64 usec)
+{
+	UINT32 bucket = 0;
+
+	while ((bucket < METRICS_HISTOGRAM_BUCKETS - 1) &&
+	       (usec > ((UINT64) METRICS_HISTOGRAM_BASE << bucket)))
+		bucket++;
+
+	metrics_add(&histogram->Buckets[bucket], 1);
+	metrics_add(&histogram->Sum, (LONGLONG) usec);
+	metrics_add(&histogram->Count, 1);
+}
+
+static rdpMetricsChannel* metrics_channel(rdpMetrics* metrics, UINT16 channelId)
+{
+	UINT32 index = METRICS_MAX_CHANNELS - 1;
+
+	if ((channelId >= MCS_GLOBAL_CHANNEL_ID) &&
+	    (channelId - MCS_GLOBAL_CHANNEL_ID < METRICS_MAX_CHANNELS - 1))
+		index = channelId - MCS_GLOBAL_CHANNEL_ID;
+
+	return &metrics->Channels[index];
+}
+
+static int metrics_codec_index(UINT32 codecId)
+{
+	int index;
+
+	for (index = 0; index < METRICS_CODEC_COUNT; index++)
+	{
+		if (codecId == (1UL << index))
+			return index;
+	}
+
+	return -1;
+}
+
 double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32 CompressedBytes)
 {
 	double CompressionRatio = 0.0;
@@ -38,6 +119,400 @@ double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32
 	return CompressionRatio;
 }
 
+/**
+ * Monotonic time in microseconds, only differences are meaningful.
+ */
+UINT64 metrics_get_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (!QueryPerformanceFrequency(&frequency) || !QueryPerformanceCounter(&counter))
+		return GetTickCount64() * 1000;
+
+	return (UINT64)((counter.QuadPart / frequency.QuadPart) * 1000000 +
+	                ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#else
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return GetTickCount64() * 1000;
+
+	return ((UINT64) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void metrics_channel_sent(rdpMetrics* metrics, UINT16 channelId, UINT32 bytes)
+{
+	rdpMetricsChannel* channel;
+
+	if (!metrics)
+		return;
+
+	channel = metrics_channel(metrics, channelId);
+	metrics_add(&channel->BytesSent, bytes);
+	metrics_add(&channel->PdusSent, 1);
+}
+
+void metrics_channel_received(rdpMetrics* metrics, UINT16 channelId, UINT32 bytes)
+{
+	rdpMetricsChannel* channel;
+
+	if (!metrics)
+		return;
+
+	channel = metrics_channel(metrics, channelId);
+	metrics_add(&channel->BytesReceived, bytes);
+	metrics_add(&channel->PdusReceived, 1);
+}
+
+void metrics_codec_time(rdpMetrics* metrics, UINT32 codecId, BOOL encode, UINT64 usec)
+{
+	rdpMetricsHistogram* histogram = metrics_get_codec_histogram(metrics, codecId, encode);
+
+	if (histogram)
+		metrics_histogram_add(histogram, usec);
+}
+
+void metrics_frame_begin(rdpMetrics* metrics, UINT32 frameId)
+{
+	const UINT32 index = frameId % METRICS_PENDING_FRAMES;
+
+	if (!metrics)
+		return;
+
+	/* the slot is claimed by zeroing the start, a late ack of the old id finds no match */
+	metrics_set(&metrics->FrameStart[index], 0);
+	InterlockedExchange(&metrics->FrameIds[index], (LONG) frameId);
+	metrics_set(&metrics->FrameStart[index], (LONGLONG) metrics_get_time());
+}
+
+void metrics_frame_acknowledge(rdpMetrics* metrics, UINT32 frameId)
+{
+	LONGLONG start;
+	const UINT32 index = frameId % METRICS_PENDING_FRAMES;
+
+	if (!metrics)
+		return;
+
+	if ((UINT32) metrics->FrameIds[index] != frameId)
+		return;
+
+	start = metrics->FrameStart[index];
+
+	/* only the first acknowledge of a frame counts */
+	if ((start == 0) ||
+	    (InterlockedCompareExchange64(&metrics->FrameStart[index], 0, start) != start))
+		return;
+
+	metrics_histogram_add(&metrics->FrameLatency, metrics_get_time() - (UINT64) start);
+}
+
+/**
+ * Input to paint latency is measured from the oldest input event not yet
+ * followed by a paint.
+ */
+void metrics_input_event(rdpMetrics* metrics)
+{
+	if (!metrics || metrics->InputPending)
+		return;
+
+	InterlockedCompareExchange64(&metrics->InputPending, (LONGLONG) metrics_get_time(), 0);
+}
+
+void metrics_paint(rdpMetrics* metrics)
+{
+	LONGLONG start;
+
+	if (!metrics)
+		return;
+
+	start = metrics->InputPending;
+
+	if ((start == 0) ||
+	    (InterlockedCompareExchange64(&metrics->InputPending, 0, start) != start))
+		return;
+
+	metrics_histogram_add(&metrics->InputLatency, metrics_get_time() - (UINT64) start);
+}
+
+void metrics_transport_blocked(rdpMetrics* metrics, UINT64 usec)
+{
+	if (!metrics)
+		return;
+
+	metrics_histogram_add(&metrics->TransportWriteBlocked, usec);
+}
+
+BOOL metrics_get_channel(rdpMetrics* metrics, UINT16 channelId, rdpMetricsChannel* channel)
+{
+	rdpMetricsChannel* source;
+
+	if (!metrics || !channel)
+		return FALSE;
+
+	source = metrics_channel(metrics, channelId);
+	channel->BytesSent = source->BytesSent;
+	channel->BytesReceived = source->BytesReceived;
+	channel->PdusSent = source->PdusSent;
+	channel->PdusReceived = source->PdusReceived;
+	return TRUE;
+}
+
+rdpMetricsHistogram* metrics_get_codec_histogram(rdpMetrics* metrics, UINT32 codecId,
+        BOOL encode)
+{
+	const int index = metrics_codec_index(codecId);
+
+	if (!metrics || (index < 0))
+		return NULL;
+
+	return encode ? &metrics->EncodeTime[index] : &metrics->DecodeTime[index];
+}
+
+/**
+ * Upper bound in microseconds of the bucket holding the given quantile.
+ */
+UINT64 metrics_histogram_quantile(const rdpMetricsHistogram* histogram, double quantile)
+{
+	UINT32 bucket;
+	LONGLONG count = 0;
+	LONGLONG rank;
+
+	if (!histogram || (histogram->Count <= 0))
+		return 0;
+
+	rank = (LONGLONG)(quantile * histogram->Count + 0.5);
+
+	if (rank < 1)
+		rank = 1;
+
+	for (bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS - 1; bucket++)
+	{
+		count += histogram->Buckets[bucket];
+
+		if (count >= rank)
+			break;
+	}
+
+	return (UINT64) METRICS_HISTOGRAM_BASE << bucket;
+}
+
+const char* metrics_codec_name(UINT32 codecId)
+{
+	const int index = metrics_codec_index(codecId);
+
+	if (index < 0)
+		return "unknown";
+
+	return METRICS_CODEC_NAMES[index];
+}
+
+struct _METRICS_BUFFER
+{
+	char* data;
+	size_t length;
+	size_t size;
+	BOOL failed;
+};
+typedef struct _METRICS_BUFFER METRICS_BUFFER;
+
+static void metrics_print(METRICS_BUFFER* buffer, const char* fmt, ...)
+{
+	int length;
+	va_list args;
+
+	if (buffer->failed)
+		return;
+
+	while (1)
+	{
+		va_start(args, fmt);
+		length = vsnprintf(&buffer->data[buffer->length], buffer->size - buffer->length, fmt, args);
+		va_end(args);
+
+		if (length < 0)
+		{
+			buffer->failed = TRUE;
+			return;
+		}
+
+		if ((size_t) length < buffer->size - buffer->length)
+			break;
+
+		{
+			const size_t size = buffer->size * 2 + length;
+			char* data = (char*) realloc(buffer->data, size);
+
+			if (!data)
+			{
+				buffer->failed = TRUE;
+				return;
+			}
+
+			buffer->data = data;
+			buffer->size = size;
+		}
+	}
+
+	buffer->length += length;
+}
+
+static void metrics_print_histogram(METRICS_BUFFER* buffer, const char* name,
+                                    const char* labels, const rdpMetricsHistogram* histogram)
+{
+	UINT32 bucket;
+	LONGLONG count = 0;
+	const char* separator = *labels ? "," : "";
+
+	for (bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS - 1; bucket++)
+	{
+		count += histogram->Buckets[bucket];
+		metrics_print(buffer, "%s_bucket{%s%sle=\"%g\"} %lld\n", name, labels, separator,
+		              (double)((UINT64) METRICS_HISTOGRAM_BASE << bucket) / 1000000.0,
+		              (long long) count);
+	}
+
+	count += histogram->Buckets[bucket];
+	metrics_print(buffer, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", name, labels, separator,
+	              (long long) count);
+	metrics_print(buffer, "%s_sum{%s} %g\n", name, labels, (double) histogram->Sum / 1000000.0);
+	metrics_print(buffer, "%s_count{%s} %lld\n", name, labels, (long long) histogram->Count);
+}
+
+static void metrics_channel_name(rdpMetrics* metrics, UINT32 index, char* name, size_t size)
+{
+	UINT32 i;
+	const UINT32 channelId = MCS_GLOBAL_CHANNEL_ID + index;
+	rdpMcs* mcs = (metrics->context && metrics->context->rdp) ? metrics->context->rdp->mcs : NULL;
+
+	if (index == METRICS_MAX_CHANNELS - 1)
+	{
+		sprintf_s(name, size, "other");
+		return;
+	}
+
+	if (channelId == MCS_GLOBAL_CHANNEL_ID)
+	{
+		sprintf_s(name, size, "io");
+		return;
+	}
+
+	if (mcs)
+	{
+		if (channelId == mcs->messageChannelId)
+		{
+			sprintf_s(name, size, "message");
+			return;
+		}
+
+		for (i = 0; i < mcs->channelCount; i++)
+		{
+			if (mcs->channels[i].ChannelId == (int) channelId)
+			{
+				sprintf_s(name, size, "%.8s", mcs->channels[i].Name);
+				return;
+			}
+		}
+	}
+
+	sprintf_s(name, size, "%u", (unsigned) channelId);
+}
+
+/**
+ * Formats all metrics in the Prometheus text exposition format. labels, if
+ * not NULL, is a comma separated list like session="1" added to every sample.
+ * The returned string has to be freed by the caller.
+ */
+char* metrics_dump_prometheus(rdpMetrics* metrics, const char* labels)
+{
+	UINT32 index;
+	UINT32 family;
+	char extra[512];
+	const char* separator;
+	METRICS_BUFFER buffer = { NULL, 0, 4096, FALSE };
+
+	if (!metrics)
+		return NULL;
+
+	if (!(buffer.data = (char*) malloc(buffer.size)))
+		return NULL;
+
+	buffer.data[0] = '\0';
+
+	if (!labels)
+		labels = "";
+
+	separator = *labels ? "," : "";
+
+	for (family = 0; family < 2; family++)
+	{
+		const char* name = (family == 0) ? "freerdp_bytes_total" : "freerdp_pdus_total";
+		metrics_print(&buffer, "# TYPE %s counter\n", name);
+
+		for (index = 0; index < METRICS_MAX_CHANNELS; index++)
+		{
+			char channelName[16];
+			const rdpMetricsChannel* channel = &metrics->Channels[index];
+
+			if (!channel->PdusSent && !channel->PdusReceived)
+				continue;
+
+			metrics_channel_name(metrics, index, channelName, sizeof(channelName));
+			metrics_print(&buffer, "%s{%s%schannel=\"%s\",direction=\"sent\"} %lld\n", name,
+			              labels, separator, channelName,
+			              (long long)((family == 0) ? channel->BytesSent : channel->PdusSent));
+			metrics_print(&buffer, "%s{%s%schannel=\"%s\",direction=\"received\"} %lld\n", name,
+			              labels, separator, channelName,
+			              (long long)((family == 0) ? channel->BytesReceived : channel->PdusReceived));
+		}
+	}
+
+	metrics_print(&buffer, "# TYPE freerdp_bulk_bytes_total counter\n");
+	metrics_print(&buffer, "freerdp_bulk_bytes_total{%s%sstate=\"uncompressed\"} %llu\n",
+	              labels, separator, (unsigned long long) metrics->TotalUncompressedBytes);
+	metrics_print(&buffer, "freerdp_bulk_bytes_total{%s%sstate=\"compressed\"} %llu\n",
+	              labels, separator, (unsigned long long) metrics->TotalCompressedBytes);
+
+	for (family = 0; family < 2; family++)
+	{
+		const char* name = (family == 0) ? "freerdp_codec_encode_seconds" :
+		                   "freerdp_codec_decode_seconds";
+		const rdpMetricsHistogram* histograms = (family == 0) ? metrics->EncodeTime :
+		                                        metrics->DecodeTime;
+		metrics_print(&buffer, "# TYPE %s histogram\n", name);
+
+		for (index = 0; index < METRICS_CODEC_COUNT; index++)
+		{
+			if (!histograms[index].Count)
+				continue;
+
+			sprintf_s(extra, sizeof(extra), "%s%scodec=\"%s\"", labels, separator,
+			          METRICS_CODEC_NAMES[index]);
+			metrics_print_histogram(&buffer, name, extra, &histograms[index]);
+		}
+	}
+
+	metrics_print(&buffer, "# TYPE freerdp_frame_latency_seconds histogram\n");
+	metrics_print_histogram(&buffer, "freerdp_frame_latency_seconds", labels,
+	                        &metrics->FrameLatency);
+	metrics_print(&buffer, "# TYPE freerdp_input_latency_seconds histogram\n");
+	metrics_print_histogram(&buffer, "freerdp_input_latency_seconds", labels,
+	                        &metrics->InputLatency);
+	metrics_print(&buffer, "# TYPE freerdp_transport_write_blocked_seconds histogram\n");
+	metrics_print_histogram(&buffer, "freerdp_transport_write_blocked_seconds", labels,
+	                        &metrics->TransportWriteBlocked);
+
+	if (buffer.failed)
+	{
+		free(buffer.data);
+		return NULL;
+	}
+
+	return buffer.data;
+}
+
 rdpMetrics* metrics_new(rdpContext* context)
 {
 	rdpMetrics* metrics;
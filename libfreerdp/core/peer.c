@@ -372,6 +372,8 @@ static int peer_recv_tpkt_pdu(freerdp_peer* client, wStream* s)
 	if (freerdp_shall_disconnect(rdp->instance))
 		return 0;
 
+	metrics_channel_received(client->context->metrics, channelId, length);
+
 	if (rdp->settings->UseRdpSecurityLayer)
 	{
 		if (!rdp_read_security_header(s, &securityFlags))
@@ -450,6 +452,8 @@ static int peer_recv_fastpath_pdu(freerdp_peer* client, wStream* s)
 		return -1;
 	}
 
+	metrics_channel_received(client->context->metrics, MCS_GLOBAL_CHANNEL_ID, length);
+
 	if (fastpath->encryptionFlags & FASTPATH_OUTPUT_ENCRYPTED)
 	{
 		if (!rdp_decrypt(rdp, s, length,
@@ -538,6 +538,7 @@ BOOL rdp_send(rdpRdp* rdp, wStream* s, UINT16 channel_id)
 	if (transport_write(rdp->transport, s) < 0)
 		return FALSE;
 
+	metrics_channel_sent(rdp->context->metrics, channel_id, length);
 	return TRUE;
 }
 
@@ -567,6 +568,7 @@ BOOL rdp_send_pdu(rdpRdp* rdp, wStream* s, UINT16 type, UINT16 channel_id)
 	if (transport_write(rdp->transport, s) < 0)
 		return FALSE;
 
+	metrics_channel_sent(rdp->context->metrics, MCS_GLOBAL_CHANNEL_ID, length);
 	return TRUE;
 }
 
@@ -595,6 +597,7 @@ BOOL rdp_send_data_pdu(rdpRdp* rdp, wStream* s, BYTE type, UINT16 channel_id)
 	if (transport_write(rdp->transport, s) < 0)
 		return FALSE;
 
+	metrics_channel_sent(rdp->context->metrics, MCS_GLOBAL_CHANNEL_ID, length);
 	return TRUE;
 }
 
@@ -623,6 +626,7 @@ BOOL rdp_send_message_channel_pdu(rdpRdp* rdp, wStream* s, UINT16 sec_flags)
 	if (transport_write(rdp->transport, s) < 0)
 		return FALSE;
 
+	metrics_channel_sent(rdp->context->metrics, rdp->mcs->messageChannelId, length);
 	return TRUE;
 }
 
@@ -1121,6 +1125,8 @@ static int rdp_recv_tpkt_pdu(rdpRdp* rdp, wStream* s)
 
 	if (freerdp_shall_disconnect(rdp->instance))
 		return 0;
+
+	metrics_channel_received(rdp->context->metrics, channelId, length);
  
 	if (rdp->autodetect->bandwidthMeasureStarted)
 	{
@@ -1246,6 +1252,8 @@ static int rdp_recv_fastpath_pdu(rdpRdp* rdp, wStream* s)
 		return -1;
 	}
 
+	metrics_channel_received(rdp->context->metrics, MCS_GLOBAL_CHANNEL_ID, length);
+
 	if (rdp->autodetect->bandwidthMeasureStarted)
 	{
 		rdp->autodetect->bandwidthMeasureByteCount += length;
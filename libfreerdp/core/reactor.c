@@ -0,0 +1,687 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Server Event Loop (Reactor)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
+#include <freerdp/log.h>
+#include <freerdp/reactor.h>
+
+#include "rdp.h"
+
+#define TAG FREERDP_TAG("core.reactor")
+
+#define REACTOR_MAX_THREADS	64
+#define REACTOR_MAX_HANDLES	32
+#define REACTOR_MAX_EVENTS	64
+#define REACTOR_HANDSHAKE_TIMEOUT	30000
+
+enum REACTOR_ENTRY_TYPE
+{
+	REACTOR_ENTRY_LISTENER,
+	REACTOR_ENTRY_PEER
+};
+
+typedef struct rdp_reactor_entry rdpReactorEntry;
+typedef struct rdp_reactor_thread rdpReactorThread;
+
+struct rdp_reactor_entry
+{
+	int type;
+	freerdp_listener* listener;
+	freerdp_peer* peer;
+	pReactorPeerCheck check;
+	pReactorPeerClosed closed;
+	void* context;
+
+	rdpReactor* reactor;
+	HANDLE handshake;
+	BOOL failed;
+
+	DWORD round;
+	DWORD transportCount;
+	HANDLE transport[REACTOR_MAX_HANDLES];
+	DWORD extraCount;
+	HANDLE extra[REACTOR_MAX_HANDLES];
+
+	rdpReactorEntry* prev;
+	rdpReactorEntry* next;
+};
+
+struct rdp_reactor_thread
+{
+	rdpReactor* reactor;
+	HANDLE thread;
+	HANDLE wakeEvent;
+	wWaitSet* waitSet;
+	wHashTable* table;
+	DWORD round;
+	BOOL volatile stop;
+	LONG volatile load;
+
+	CRITICAL_SECTION lock;
+	rdpReactorEntry* pending;
+	rdpReactorEntry* entries;
+};
+
+struct rdp_reactor
+{
+	DWORD count;
+	rdpReactorThread* threads;
+	LONG volatile peers;
+
+	HANDLE stopEvent;
+	HANDLE idleEvent;
+	CRITICAL_SECTION lock;
+	DWORD handshakes;
+};
+
+static BOOL reactor_register_handles(rdpReactorThread* thread, rdpReactorEntry* entry,
+                                     const HANDLE* handles, DWORD count)
+{
+	DWORD index;
+
+	for (index = 0; index < count; index++)
+	{
+		/* the table maps a handle to a single entry, shared handles are not supported */
+		if (HashTable_Contains(thread->table, handles[index]))
+		{
+			WLog_ERR(TAG, "handle %p is already registered by another entry", handles[index]);
+			goto fail;
+		}
+
+		if (!WaitSet_Add(thread->waitSet, handles[index]))
+			goto fail;
+
+		if (HashTable_Add(thread->table, handles[index], entry) < 0)
+		{
+			WaitSet_Remove(thread->waitSet, handles[index]);
+			goto fail;
+		}
+	}
+
+	return TRUE;
+fail:
+
+	while (index--)
+	{
+		HashTable_Remove(thread->table, handles[index]);
+		WaitSet_Remove(thread->waitSet, handles[index]);
+	}
+
+	return FALSE;
+}
+
+static void reactor_unregister_handles(rdpReactorThread* thread, const HANDLE* handles,
+                                       DWORD count)
+{
+	DWORD index;
+
+	for (index = 0; index < count; index++)
+	{
+		HashTable_Remove(thread->table, handles[index]);
+		WaitSet_Remove(thread->waitSet, handles[index]);
+	}
+}
+
+static DWORD reactor_entry_get_handles(rdpReactorEntry* entry, HANDLE* handles)
+{
+	if (entry->type == REACTOR_ENTRY_LISTENER)
+		return entry->listener->GetEventHandles(entry->listener, handles, REACTOR_MAX_HANDLES);
+
+	return entry->peer->GetEventHandles(entry->peer, handles, REACTOR_MAX_HANDLES);
+}
+
+static BOOL reactor_entry_register(rdpReactorThread* thread, rdpReactorEntry* entry)
+{
+	entry->transportCount = reactor_entry_get_handles(entry, entry->transport);
+
+	if (entry->transportCount == 0)
+	{
+		WLog_ERR(TAG, "failed to get event handles");
+		return FALSE;
+	}
+
+	if (!reactor_register_handles(thread, entry, entry->transport, entry->transportCount))
+		return FALSE;
+
+	if (!reactor_register_handles(thread, entry, entry->extra, entry->extraCount))
+	{
+		reactor_unregister_handles(thread, entry->transport, entry->transportCount);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * The transport handles of a peer change while the connection is set up
+ * (TLS, gateway), they are compared after every service call and only
+ * registered again if they differ.
+ */
+static BOOL reactor_entry_refresh(rdpReactorThread* thread, rdpReactorEntry* entry)
+{
+	DWORD count;
+	HANDLE handles[REACTOR_MAX_HANDLES];
+	count = reactor_entry_get_handles(entry, handles);
+
+	if (count == 0)
+		return FALSE;
+
+	if ((count == entry->transportCount) &&
+	    (memcmp(handles, entry->transport, count * sizeof(HANDLE)) == 0))
+		return TRUE;
+
+	reactor_unregister_handles(thread, entry->transport, entry->transportCount);
+	CopyMemory(entry->transport, handles, count * sizeof(HANDLE));
+	entry->transportCount = count;
+
+	if (!reactor_register_handles(thread, entry, entry->transport, entry->transportCount))
+	{
+		entry->transportCount = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL reactor_entry_service(rdpReactorThread* thread, rdpReactorEntry* entry)
+{
+	if (entry->type == REACTOR_ENTRY_LISTENER)
+	{
+		if (!entry->listener->CheckFileDescriptor(entry->listener))
+		{
+			WLog_ERR(TAG, "Failed to check FreeRDP file descriptor");
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	if (!entry->peer->CheckFileDescriptor(entry->peer))
+		return FALSE;
+
+	if (entry->check && !entry->check(entry->peer, entry->context))
+		return FALSE;
+
+	return reactor_entry_refresh(thread, entry);
+}
+
+static void reactor_entry_close(rdpReactorThread* thread, rdpReactorEntry* entry, BOOL linked)
+{
+	reactor_unregister_handles(thread, entry->transport, entry->transportCount);
+	reactor_unregister_handles(thread, entry->extra, entry->extraCount);
+
+	if (linked)
+	{
+		if (entry->prev)
+			entry->prev->next = entry->next;
+		else
+			thread->entries = entry->next;
+
+		if (entry->next)
+			entry->next->prev = entry->prev;
+	}
+
+	if (entry->type == REACTOR_ENTRY_PEER)
+	{
+		InterlockedDecrement(&thread->load);
+		InterlockedDecrement(&thread->reactor->peers);
+
+		if (entry->closed)
+			entry->closed(entry->peer, entry->context);
+		else
+		{
+			entry->peer->Disconnect(entry->peer);
+			freerdp_peer_context_free(entry->peer);
+			freerdp_peer_free(entry->peer);
+		}
+	}
+
+	free(entry);
+}
+
+/**
+ * Moves the entries queued by other threads into the wait set, only the
+ * loop thread itself touches its wait set.
+ */
+static void reactor_thread_drain(rdpReactorThread* thread)
+{
+	rdpReactorEntry* entry;
+	rdpReactorEntry* next;
+	EnterCriticalSection(&thread->lock);
+	entry = thread->pending;
+	thread->pending = NULL;
+	LeaveCriticalSection(&thread->lock);
+
+	for (; entry; entry = next)
+	{
+		next = entry->next;
+
+		/* the handshake thread exits right after posting its peer */
+		if (entry->handshake)
+		{
+			WaitForSingleObject(entry->handshake, INFINITE);
+			CloseHandle(entry->handshake);
+			entry->handshake = NULL;
+		}
+
+		if (entry->failed || !reactor_entry_register(thread, entry))
+		{
+			reactor_entry_close(thread, entry, FALSE);
+			continue;
+		}
+
+		entry->round = thread->round;
+		entry->prev = NULL;
+		entry->next = thread->entries;
+
+		if (thread->entries)
+			thread->entries->prev = entry;
+
+		thread->entries = entry;
+	}
+}
+
+static DWORD WINAPI reactor_thread_main(LPVOID arg)
+{
+	DWORD index;
+	DWORD count;
+	DWORD nReady;
+	DWORD status;
+	rdpReactorEntry* entry;
+	rdpReactorThread* thread = (rdpReactorThread*) arg;
+	HANDLE signaled[REACTOR_MAX_EVENTS];
+	rdpReactorEntry* ready[REACTOR_MAX_EVENTS];
+
+	while (!thread->stop)
+	{
+		status = WaitSet_Wait(thread->waitSet, INFINITE, signaled, REACTOR_MAX_EVENTS, &count);
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitSet_Wait failed with %08X", GetLastError());
+
+			/* the handles that were reported are still serviced */
+			if (count == 0)
+				break;
+		}
+		else if (status != WAIT_OBJECT_0)
+			continue;
+
+		/* Several handles of one entry may be signaled, service it only once */
+		thread->round++;
+		nReady = 0;
+
+		for (index = 0; index < count; index++)
+		{
+			if (signaled[index] == thread->wakeEvent)
+			{
+				ResetEvent(thread->wakeEvent);
+				reactor_thread_drain(thread);
+				continue;
+			}
+
+			entry = (rdpReactorEntry*) HashTable_GetItemValue(thread->table, signaled[index]);
+
+			if (!entry || (entry->round == thread->round))
+				continue;
+
+			entry->round = thread->round;
+			ready[nReady++] = entry;
+		}
+
+		for (index = 0; index < nReady; index++)
+		{
+			if (!reactor_entry_service(thread, ready[index]))
+				reactor_entry_close(thread, ready[index], TRUE);
+		}
+	}
+
+	reactor_thread_drain(thread);
+
+	while (thread->entries)
+		reactor_entry_close(thread, thread->entries, TRUE);
+
+	ExitThread(0);
+	return 0;
+}
+
+static rdpReactorThread* reactor_select_thread(rdpReactor* reactor)
+{
+	DWORD index;
+	rdpReactorThread* thread = &reactor->threads[0];
+
+	for (index = 1; index < reactor->count; index++)
+	{
+		if (reactor->threads[index].load < thread->load)
+			thread = &reactor->threads[index];
+	}
+
+	return thread;
+}
+
+static void reactor_thread_post(rdpReactorThread* thread, rdpReactorEntry* entry)
+{
+	EnterCriticalSection(&thread->lock);
+	entry->next = thread->pending;
+	thread->pending = entry;
+	LeaveCriticalSection(&thread->lock);
+	SetEvent(thread->wakeEvent);
+}
+
+static BOOL reactor_peer_activated(freerdp_peer* peer)
+{
+	rdpRdp* rdp = peer->context->rdp;
+	return rdp->state >= CONNECTION_STATE_ACTIVE;
+}
+
+/**
+ * Runs the connection sequence of a peer up to its activation. TLS and NLA
+ * block while they wait for the client, a peer is therefore only moved to
+ * a loop thread once it is active. A peer that fails, takes too long or is
+ * still connecting when the reactor is freed is posted as failed and closed
+ * by the loop thread.
+ */
+static DWORD WINAPI reactor_handshake_main(LPVOID arg)
+{
+	DWORD count;
+	DWORD status;
+	UINT64 now;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	rdpReactorEntry* entry = (rdpReactorEntry*) arg;
+	rdpReactorThread* thread;
+	rdpReactor* reactor = entry->reactor;
+	freerdp_peer* peer = entry->peer;
+	const UINT64 end = GetTickCount64() + REACTOR_HANDSHAKE_TIMEOUT;
+	entry->failed = TRUE;
+
+	while ((now = GetTickCount64()) < end)
+	{
+		handles[0] = reactor->stopEvent;
+		count = peer->GetEventHandles(peer, &handles[1],
+		                              MAXIMUM_WAIT_OBJECTS - 1 - entry->extraCount);
+
+		if (count == 0)
+		{
+			WLog_ERR(TAG, "failed to get event handles");
+			break;
+		}
+
+		count++;
+		CopyMemory(&handles[count], entry->extra, entry->extraCount * sizeof(HANDLE));
+		count += entry->extraCount;
+		status = WaitForMultipleObjects(count, handles, FALSE, (DWORD)(end - now));
+
+		if (status == WAIT_TIMEOUT)
+			continue;
+
+		if ((status == WAIT_OBJECT_0) || (status == WAIT_FAILED))
+			break;
+
+		if (!peer->CheckFileDescriptor(peer))
+			break;
+
+		if (entry->check && !entry->check(peer, entry->context))
+			break;
+
+		if (reactor_peer_activated(peer))
+		{
+			entry->failed = FALSE;
+			break;
+		}
+	}
+
+	if (entry->failed && (now >= end))
+		WLog_WARN(TAG, "peer %s did not activate in time", peer->hostname);
+
+	thread = reactor_select_thread(reactor);
+	InterlockedIncrement(&thread->load);
+	reactor_thread_post(thread, entry);
+	EnterCriticalSection(&reactor->lock);
+
+	if (--reactor->handshakes == 0)
+		SetEvent(reactor->idleEvent);
+
+	LeaveCriticalSection(&reactor->lock);
+	return 0;
+}
+
+/**
+ * Listeners are served by the first loop thread, PeerAccepted is invoked
+ * from that thread and may hand the new peer to freerdp_reactor_add_peer.
+ * The listener has to stay valid until the reactor is freed.
+ */
+BOOL freerdp_reactor_add_listener(rdpReactor* reactor, freerdp_listener* listener)
+{
+	rdpReactorEntry* entry;
+
+	if (!reactor || !listener)
+		return FALSE;
+
+	if (!(entry = (rdpReactorEntry*) calloc(1, sizeof(rdpReactorEntry))))
+		return FALSE;
+
+	entry->type = REACTOR_ENTRY_LISTENER;
+	entry->listener = listener;
+	reactor_thread_post(&reactor->threads[0], entry);
+	return TRUE;
+}
+
+/**
+ * Hands a peer to the reactor. The connection sequence runs on a thread of
+ * its own, once the peer is active it moves to the least loaded loop
+ * thread. The transport handles of the peer are watched by the reactor,
+ * handles are additional handles serviced by the check callback, e.g. the
+ * virtual channel manager event or waitable timers (which must have been
+ * armed once). They must not be shared with other peers. If no close
+ * callback is given the peer is disconnected and freed when it is closed.
+ */
+BOOL freerdp_reactor_add_peer(rdpReactor* reactor, freerdp_peer* peer,
+                              const HANDLE* handles, DWORD count, pReactorPeerCheck check,
+                              pReactorPeerClosed closed, void* context)
+{
+	rdpReactorEntry* entry;
+
+	if (!reactor || !peer || !peer->context || (count > REACTOR_MAX_HANDLES) ||
+	    (count && !handles))
+		return FALSE;
+
+	if (!(entry = (rdpReactorEntry*) calloc(1, sizeof(rdpReactorEntry))))
+		return FALSE;
+
+	entry->type = REACTOR_ENTRY_PEER;
+	entry->peer = peer;
+	entry->check = check;
+	entry->closed = closed;
+	entry->context = context;
+	entry->reactor = reactor;
+	entry->extraCount = count;
+
+	if (count)
+		CopyMemory(entry->extra, handles, count * sizeof(HANDLE));
+
+	EnterCriticalSection(&reactor->lock);
+	entry->handshake = CreateThread(NULL, 0, reactor_handshake_main, entry, CREATE_SUSPENDED,
+	                                NULL);
+
+	if (entry->handshake && (reactor->handshakes++ == 0))
+		ResetEvent(reactor->idleEvent);
+
+	LeaveCriticalSection(&reactor->lock);
+
+	if (!entry->handshake)
+	{
+		free(entry);
+		return FALSE;
+	}
+
+	InterlockedIncrement(&reactor->peers);
+	ResumeThread(entry->handshake);
+	return TRUE;
+}
+
+DWORD freerdp_reactor_get_peer_count(rdpReactor* reactor)
+{
+	if (!reactor)
+		return 0;
+
+	return (DWORD) reactor->peers;
+}
+
+static void reactor_thread_uninit(rdpReactorThread* thread)
+{
+	if (thread->thread)
+	{
+		thread->stop = TRUE;
+		SetEvent(thread->wakeEvent);
+		WaitForSingleObject(thread->thread, INFINITE);
+		CloseHandle(thread->thread);
+	}
+
+	if (thread->waitSet)
+	{
+		if (thread->wakeEvent)
+			WaitSet_Remove(thread->waitSet, thread->wakeEvent);
+
+		WaitSet_Free(thread->waitSet);
+	}
+
+	if (thread->wakeEvent)
+		CloseHandle(thread->wakeEvent);
+
+	HashTable_Free(thread->table);
+	DeleteCriticalSection(&thread->lock);
+}
+
+static BOOL reactor_thread_init(rdpReactor* reactor, rdpReactorThread* thread)
+{
+	thread->reactor = reactor;
+
+	if (!InitializeCriticalSectionAndSpinCount(&thread->lock, 4000))
+		return FALSE;
+
+	if (!(thread->table = HashTable_New(FALSE)))
+		return FALSE;
+
+	if (!(thread->waitSet = WaitSet_New()))
+		return FALSE;
+
+	if (!(thread->wakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!WaitSet_Add(thread->waitSet, thread->wakeEvent))
+		return FALSE;
+
+	if (!(thread->thread = CreateThread(NULL, 0, reactor_thread_main, thread, 0, NULL)))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * Creates a reactor with the given number of loop threads, 0 selects one
+ * thread per processor.
+ */
+rdpReactor* freerdp_reactor_new(DWORD threads)
+{
+	DWORD index;
+	SYSTEM_INFO info;
+	rdpReactor* reactor;
+
+	if (threads == 0)
+	{
+		GetSystemInfo(&info);
+		threads = info.dwNumberOfProcessors;
+	}
+
+	if (threads < 1)
+		threads = 1;
+
+	if (threads > REACTOR_MAX_THREADS)
+		threads = REACTOR_MAX_THREADS;
+
+	if (!(reactor = (rdpReactor*) calloc(1, sizeof(rdpReactor))))
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&reactor->lock, 4000))
+	{
+		free(reactor);
+		return NULL;
+	}
+
+	if (!(reactor->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+	    !(reactor->idleEvent = CreateEvent(NULL, TRUE, TRUE, NULL)) ||
+	    !(reactor->threads = (rdpReactorThread*) calloc(threads, sizeof(rdpReactorThread))))
+	{
+		freerdp_reactor_free(reactor);
+		return NULL;
+	}
+
+	for (index = 0; index < threads; index++)
+	{
+		reactor->count++;
+
+		if (!reactor_thread_init(reactor, &reactor->threads[index]))
+		{
+			WLog_ERR(TAG, "failed to start reactor thread %u", index);
+			freerdp_reactor_free(reactor);
+			return NULL;
+		}
+	}
+
+	return reactor;
+}
+
+/**
+ * Stops all loop threads, peers still registered or connecting are closed
+ * from their loop thread before it exits.
+ */
+void freerdp_reactor_free(rdpReactor* reactor)
+{
+	DWORD index;
+
+	if (!reactor)
+		return;
+
+	if (reactor->stopEvent && reactor->idleEvent)
+	{
+		SetEvent(reactor->stopEvent);
+		WaitForSingleObject(reactor->idleEvent, INFINITE);
+	}
+
+	for (index = 0; index < reactor->count; index++)
+		reactor_thread_uninit(&reactor->threads[index]);
+
+	if (reactor->stopEvent)
+		CloseHandle(reactor->stopEvent);
+
+	if (reactor->idleEvent)
+		CloseHandle(reactor->idleEvent);
+
+	DeleteCriticalSection(&reactor->lock);
+	free(reactor->threads);
+	free(reactor);
+}
@@ -676,6 +676,7 @@ rdpSettings* freerdp_settings_clone(rdpSettings* settings)
 		CHECKED_STRDUP(RemoteApplicationFile); /* 2116 */
 		CHECKED_STRDUP(RemoteApplicationGuid); /* 2117 */
 		CHECKED_STRDUP(RemoteApplicationCmdLine); /* 2118 */
+		CHECKED_STRDUP(BitmapCachePersistFile); /* 2503 */
 		CHECKED_STRDUP(ImeFileName); /* 2628 */
 		CHECKED_STRDUP(DrivesToRedirect); /* 4290 */
 		/**
@@ -1074,6 +1075,7 @@ void freerdp_settings_free(rdpSettings* settings)
 	free(settings->RemoteApplicationFile);
 	free(settings->RemoteApplicationGuid);
 	free(settings->RemoteApplicationCmdLine);
+	free(settings->BitmapCachePersistFile);
 	free(settings->ImeFileName);
 	free(settings->DrivesToRedirect);
 	free(settings->WindowTitle);
@@ -0,0 +1,174 @@
+#include <winpr/crt.h>
+#include <winpr/thread.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codecs.h>
+#include <freerdp/metrics.h>
+
+#define TEST_METRICS_THREADS 4
+#define TEST_METRICS_ITERATIONS 10000
+
+static DWORD WINAPI test_metrics_thread(LPVOID arg)
+{
+	UINT32 i;
+	rdpMetrics* metrics = (rdpMetrics*) arg;
+
+	for (i = 0; i < TEST_METRICS_ITERATIONS; i++)
+	{
+		metrics_channel_sent(metrics, 1004, 10);
+		metrics_codec_time(metrics, FREERDP_CODEC_REMOTEFX, TRUE, i % 1000);
+	}
+
+	return 0;
+}
+
+static BOOL test_metrics_concurrent(rdpMetrics* metrics)
+{
+	UINT32 i;
+	rdpMetricsChannel channel;
+	rdpMetricsHistogram* histogram;
+	HANDLE threads[TEST_METRICS_THREADS];
+
+	for (i = 0; i < TEST_METRICS_THREADS; i++)
+	{
+		if (!(threads[i] = CreateThread(NULL, 0, test_metrics_thread, metrics, 0, NULL)))
+			return FALSE;
+	}
+
+	for (i = 0; i < TEST_METRICS_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	if (!metrics_get_channel(metrics, 1004, &channel))
+		return FALSE;
+
+	if ((channel.PdusSent != TEST_METRICS_THREADS * TEST_METRICS_ITERATIONS) ||
+	    (channel.BytesSent != TEST_METRICS_THREADS * TEST_METRICS_ITERATIONS * 10))
+	{
+		printf("lost channel updates: %lld pdus %lld bytes\n", (long long) channel.PdusSent,
+		       (long long) channel.BytesSent);
+		return FALSE;
+	}
+
+	histogram = metrics_get_codec_histogram(metrics, FREERDP_CODEC_REMOTEFX, TRUE);
+
+	if (!histogram || (histogram->Count != TEST_METRICS_THREADS * TEST_METRICS_ITERATIONS))
+		return FALSE;
+
+	/* half of the samples are below 500us, the 100us buckets double up to 800us */
+	if (metrics_histogram_quantile(histogram, 0.5) != 800)
+	{
+		printf("unexpected median %u\n", (unsigned) metrics_histogram_quantile(histogram, 0.5));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_metrics_latency(rdpMetrics* metrics)
+{
+	/* unknown and repeated acknowledges are ignored */
+	metrics_frame_begin(metrics, 7);
+	metrics_frame_acknowledge(metrics, 8);
+	metrics_frame_acknowledge(metrics, 7);
+	metrics_frame_acknowledge(metrics, 7);
+
+	if (metrics->FrameLatency.Count != 1)
+		return FALSE;
+
+	/* a slot reused by a newer frame drops the old one */
+	metrics_frame_begin(metrics, 1);
+	metrics_frame_begin(metrics, 1 + METRICS_PENDING_FRAMES);
+	metrics_frame_acknowledge(metrics, 1);
+
+	if (metrics->FrameLatency.Count != 1)
+		return FALSE;
+
+	/* input to paint counts from the first input, a paint without input is no sample */
+	metrics_paint(metrics);
+	metrics_input_event(metrics);
+	metrics_input_event(metrics);
+	metrics_paint(metrics);
+	metrics_paint(metrics);
+
+	if (metrics->InputLatency.Count != 1)
+		return FALSE;
+
+	metrics_transport_blocked(metrics, 2500000);
+
+	if (metrics->TransportWriteBlocked.Buckets[METRICS_HISTOGRAM_BUCKETS - 1] != 1)
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL test_metrics_dump(rdpMetrics* metrics)
+{
+	BOOL rc = FALSE;
+	char* dump;
+	const char* expected[] =
+	{
+		"freerdp_bytes_total{session=\"1\",channel=\"io\",direction=\"received\"} 120\n",
+		"freerdp_pdus_total{session=\"1\",channel=\"1004\",direction=\"sent\"} 40000\n",
+		"freerdp_bytes_total{session=\"1\",channel=\"other\",direction=\"sent\"} 5\n",
+		"freerdp_codec_encode_seconds_count{session=\"1\",codec=\"remotefx\"} 40000\n",
+		"freerdp_codec_decode_seconds_bucket{session=\"1\",codec=\"clearcodec\",le=\"0.0001\"} 1\n",
+		"freerdp_transport_write_blocked_seconds_bucket{session=\"1\",le=\"+Inf\"} 1\n",
+		"freerdp_frame_latency_seconds_count{session=\"1\"} 1\n"
+	};
+	UINT32 i;
+	metrics_channel_received(metrics, 1003, 120);
+	metrics_channel_sent(metrics, 2000, 5);
+	metrics_codec_time(metrics, FREERDP_CODEC_CLEARCODEC, FALSE, 50);
+	/* not a single codec flag */
+	metrics_codec_time(metrics, FREERDP_CODEC_REMOTEFX | FREERDP_CODEC_NSCODEC, FALSE, 50);
+
+	if (!(dump = metrics_dump_prometheus(metrics, "session=\"1\"")))
+		return FALSE;
+
+	for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+	{
+		if (!strstr(dump, expected[i]))
+		{
+			printf("missing in dump: %s", expected[i]);
+			goto fail;
+		}
+	}
+
+	if (strstr(dump, "nscodec"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		printf("%s", dump);
+
+	free(dump);
+	return rc;
+}
+
+int TestMetrics(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpMetrics* metrics = metrics_new(NULL);
+
+	if (!metrics)
+		return -1;
+
+	if (!test_metrics_concurrent(metrics))
+		goto fail;
+
+	if (!test_metrics_latency(metrics))
+		goto fail;
+
+	if (!test_metrics_dump(metrics))
+		goto fail;
+
+	rc = 0;
+fail:
+	metrics_free(metrics);
+	return rc;
+}
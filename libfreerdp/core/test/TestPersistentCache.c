@@ -0,0 +1,305 @@
+#include <winpr/crt.h>
+#include <winpr/path.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/cache/persistent.h>
+
+#include "activation.h"
+
+#define TEST_PERSIST_WIDTH 8
+#define TEST_PERSIST_HEIGHT 4
+#define TEST_PERSIST_SIZE (TEST_PERSIST_WIDTH * TEST_PERSIST_HEIGHT * 4)
+
+static const UINT32 test_persist_cells[] = { 0, 0, 2, 5 };
+
+static BOOL test_persist_write_file(const char* filename, const BYTE* data, size_t size)
+{
+	BOOL rc;
+	FILE* fp = fopen(filename, "wb");
+
+	if (!fp)
+		return FALSE;
+
+	rc = fwrite(data, size, 1, fp) == 1;
+	fclose(fp);
+	return rc;
+}
+
+static BYTE* test_persist_read_file(const char* filename, size_t* size)
+{
+	BYTE* data = NULL;
+	long length;
+	FILE* fp = fopen(filename, "rb");
+
+	if (!fp)
+		return NULL;
+
+	if ((fseek(fp, 0, SEEK_END) == 0) && ((length = ftell(fp)) > 0) &&
+	    (fseek(fp, 0, SEEK_SET) == 0) && (data = (BYTE*) malloc(length)))
+	{
+		if (fread(data, length, 1, fp) == 1)
+			*size = (size_t) length;
+		else
+		{
+			free(data);
+			data = NULL;
+		}
+	}
+
+	fclose(fp);
+	return data;
+}
+
+static BOOL test_persist_create(rdpPersistentCache* persistent, const char* filename)
+{
+	UINT32 i;
+	BYTE pixels[TEST_PERSIST_SIZE];
+	PERSISTENT_CACHE_ENTRY entry;
+
+	if (!persistent_cache_open(persistent, filename, TRUE))
+		return FALSE;
+
+	for (i = 0; i < ARRAYSIZE(test_persist_cells); i++)
+	{
+		memset(pixels, (int)(i + 1), sizeof(pixels));
+		entry.key64 = 0x1122334455667700ULL | i;
+		entry.width = TEST_PERSIST_WIDTH;
+		entry.height = TEST_PERSIST_HEIGHT;
+		entry.cacheId = test_persist_cells[i];
+		entry.data = pixels;
+
+		if (!persistent_cache_write_entry(persistent, &entry))
+			return FALSE;
+	}
+
+	persistent_cache_close(persistent);
+	return TRUE;
+}
+
+/* The entries read back in file order, cell indices are assigned per cell */
+static BOOL test_persist_read(rdpPersistentCache* persistent, const char* filename,
+                              rdpSettings* settings)
+{
+	UINT32 i = 0;
+	BYTE pixels[TEST_PERSIST_SIZE];
+	PERSISTENT_CACHE_ENTRY entry;
+	UINT32 counts[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	const int expected[] = { 0, 1, 0, -1 };
+
+	if (!persistent_cache_open(persistent, filename, FALSE) ||
+	    (persistent_cache_get_count(persistent) != ARRAYSIZE(test_persist_cells)))
+		return FALSE;
+
+	while (persistent_cache_read_entry(persistent, &entry))
+	{
+		if (i >= ARRAYSIZE(test_persist_cells))
+			return FALSE;
+
+		memset(pixels, (int)(i + 1), sizeof(pixels));
+
+		if ((entry.key64 != (0x1122334455667700ULL | i)) ||
+		    (entry.width != TEST_PERSIST_WIDTH) || (entry.height != TEST_PERSIST_HEIGHT) ||
+		    (entry.cacheId != test_persist_cells[i]) ||
+		    (memcmp(entry.data, pixels, sizeof(pixels)) != 0))
+		{
+			printf("persistent cache entry %u differs\n", (unsigned) i);
+			return FALSE;
+		}
+
+		/* cell 5 is beyond the key list even if the settings have more cells */
+		if (persistent_cache_assign_index(settings, &entry, counts) != expected[i])
+		{
+			printf("persistent cache entry %u: wrong cell index\n", (unsigned) i);
+			return FALSE;
+		}
+
+		i++;
+	}
+
+	persistent_cache_close(persistent);
+	return i == ARRAYSIZE(test_persist_cells);
+}
+
+/* A truncated file hands out the complete entries only */
+static BOOL test_persist_truncated(rdpPersistentCache* persistent, const char* filename,
+                                   const BYTE* data, size_t size)
+{
+	UINT32 count = 0;
+	PERSISTENT_CACHE_ENTRY entry;
+	/* header, two entries and half of the third one */
+	const size_t length = 16 + 2 * (16 + TEST_PERSIST_SIZE) + 16 + TEST_PERSIST_SIZE / 2;
+
+	if ((length >= size) || !test_persist_write_file(filename, data, length))
+		return FALSE;
+
+	if (!persistent_cache_open(persistent, filename, FALSE))
+		return FALSE;
+
+	while (persistent_cache_read_entry(persistent, &entry))
+		count++;
+
+	/* reading stops at the broken entry */
+	if ((count != 2) || persistent_cache_read_entry(persistent, &entry))
+		return FALSE;
+
+	persistent_cache_close(persistent);
+
+	/* only a part of the header */
+	if (!test_persist_write_file(filename, data, 10))
+		return FALSE;
+
+	return !persistent_cache_open(persistent, filename, FALSE);
+}
+
+/* Files with a bad magic or version are rejected, a bad count is ignored */
+static BOOL test_persist_corrupt(rdpPersistentCache* persistent, const char* filename,
+                                 BYTE* data, size_t size)
+{
+	UINT32 count = 0;
+	PERSISTENT_CACHE_ENTRY entry;
+	data[0] ^= 0xFF;
+
+	if (!test_persist_write_file(filename, data, size) ||
+	    persistent_cache_open(persistent, filename, FALSE))
+		return FALSE;
+
+	data[0] ^= 0xFF;
+	data[8] = 0x42; /* version */
+
+	if (!test_persist_write_file(filename, data, size) ||
+	    persistent_cache_open(persistent, filename, FALSE))
+		return FALSE;
+
+	data[8] = 1;
+	data[12] = 0xFF; /* count */
+	data[13] = 0xFF;
+
+	if (!test_persist_write_file(filename, data, size) ||
+	    !persistent_cache_open(persistent, filename, FALSE))
+		return FALSE;
+
+	while (persistent_cache_read_entry(persistent, &entry))
+		count++;
+
+	persistent_cache_close(persistent);
+	return count == ARRAYSIZE(test_persist_cells);
+}
+
+static BOOL test_persist_file(rdpSettings* settings)
+{
+	BOOL rc = FALSE;
+	BYTE* data = NULL;
+	size_t size = 0;
+	char* filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestPersistentCache.bin");
+	rdpPersistentCache* persistent = persistent_cache_new();
+
+	if (!filename || !persistent)
+		goto fail;
+
+	if (!test_persist_create(persistent, filename) ||
+	    !test_persist_read(persistent, filename, settings))
+		goto fail;
+
+	if (!(data = test_persist_read_file(filename, &size)))
+		goto fail;
+
+	if (!test_persist_truncated(persistent, filename, data, size))
+	{
+		printf("truncated persistent cache not handled\n");
+		goto fail;
+	}
+
+	if (!test_persist_corrupt(persistent, filename, data, size))
+	{
+		printf("corrupt persistent cache not handled\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	persistent_cache_free(persistent);
+
+	if (filename)
+		DeleteFileA(filename);
+
+	free(filename);
+	free(data);
+	return rc;
+}
+
+/* Keys are split in PDUs of PERSIST_MAX_PDU_KEYS, counted per cell */
+static BOOL test_persist_split(void)
+{
+	UINT32 i, cell;
+	BYTE bitMask;
+	UINT32 offset = 0;
+	UINT32 numEntries[PERSISTENT_CACHE_MAX_CELLS];
+	const UINT32 totalEntries[PERSISTENT_CACHE_MAX_CELLS] = { 100, 0, 200, 50, 0 };
+	const UINT32 expected[3][PERSISTENT_CACHE_MAX_CELLS] =
+	{
+		{ 100, 0, 69, 0, 0 },
+		{ 0, 0, 131, 38, 0 },
+		{ 0, 0, 0, 12, 0 }
+	};
+	const BYTE expectedMask[3] = { PERSIST_FIRST_PDU, 0, PERSIST_LAST_PDU };
+
+	for (i = 0; i < 3; i++)
+	{
+		UINT32 sum = 0;
+		UINT32 pduCount = rdp_split_persistent_key_list(totalEntries, 350, offset,
+		                  numEntries, &bitMask);
+
+		for (cell = 0; cell < PERSISTENT_CACHE_MAX_CELLS; cell++)
+		{
+			if (numEntries[cell] != expected[i][cell])
+			{
+				printf("key list PDU %u cell %u: %u keys, expected %u\n", (unsigned) i,
+				       (unsigned) cell, (unsigned) numEntries[cell], (unsigned) expected[i][cell]);
+				return FALSE;
+			}
+
+			sum += numEntries[cell];
+		}
+
+		if ((sum != pduCount) || (bitMask != expectedMask[i]))
+			return FALSE;
+
+		offset += pduCount;
+	}
+
+	if (offset != 350)
+		return FALSE;
+
+	/* without keys a single empty PDU is both the first and the last one */
+	if ((rdp_split_persistent_key_list(totalEntries, 0, 0, numEntries, &bitMask) != 0) ||
+	    (bitMask != (PERSIST_FIRST_PDU | PERSIST_LAST_PDU)))
+		return FALSE;
+
+	return TRUE;
+}
+
+int TestPersistentCache(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpSettings* settings = freerdp_settings_new(0);
+
+	if (!settings)
+		return -1;
+
+	settings->BitmapCacheV2NumCells = 6;
+	settings->BitmapCacheV2CellInfo[0].persistent = TRUE;
+	settings->BitmapCacheV2CellInfo[2].persistent = TRUE;
+	settings->BitmapCacheV2CellInfo[5].numEntries = 16;
+	settings->BitmapCacheV2CellInfo[5].persistent = TRUE;
+
+	if (!test_persist_file(settings))
+		goto fail;
+
+	if (!test_persist_split())
+		goto fail;
+
+	rc = 0;
+fail:
+	freerdp_settings_free(settings);
+	return rc;
+}
@@ -0,0 +1,193 @@
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/reactor.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#endif
+
+#define TEST_REACTOR_PEERS	64
+
+static LONG volatile accepted = 0;
+static LONG volatile closed = 0;
+static rdpReactor* reactor = NULL;
+
+#ifndef _WIN32
+
+static void test_peer_closed(freerdp_peer* client, void* arg)
+{
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+	InterlockedIncrement(&closed);
+}
+
+static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
+{
+	if (!freerdp_peer_context_new(client))
+		return FALSE;
+
+	if (!freerdp_reactor_add_peer(reactor, client, NULL, 0, NULL, test_peer_closed, NULL))
+	{
+		freerdp_peer_context_free(client);
+		return FALSE;
+	}
+
+	InterlockedIncrement(&accepted);
+	return TRUE;
+}
+
+static BOOL test_wait_for(LONG volatile* value, LONG expected)
+{
+	UINT64 end = GetTickCount64() + 10000;
+
+	while (*value != expected)
+	{
+		if (GetTickCount64() > end)
+			return FALSE;
+
+		Sleep(5);
+	}
+
+	return TRUE;
+}
+
+static int test_connect(const char* path)
+{
+	int fd;
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Peers are closed when they hang up or, still connecting, when the reactor is freed */
+static BOOL test_reactor_peers(BOOL hangUp)
+{
+	int i;
+	BOOL rc = FALSE;
+	int fds[TEST_REACTOR_PEERS];
+	char* path = GetKnownSubPath(KNOWN_PATH_TEMP, "TestReactor.sock");
+	freerdp_listener* listener = freerdp_listener_new();
+
+	accepted = closed = 0;
+
+	for (i = 0; i < TEST_REACTOR_PEERS; i++)
+		fds[i] = -1;
+
+	if (!path || !listener)
+		goto fail;
+
+	listener->PeerAccepted = test_peer_accepted;
+
+	if (!(reactor = freerdp_reactor_new(2)))
+		goto fail;
+
+	if (!listener->OpenLocal(listener, path) || !freerdp_reactor_add_listener(reactor, listener))
+		goto fail;
+
+	for (i = 0; i < TEST_REACTOR_PEERS; i++)
+	{
+		if ((fds[i] = test_connect(path)) < 0)
+		{
+			printf("failed to connect peer %d\n", i);
+			goto fail;
+		}
+	}
+
+	if (!test_wait_for(&accepted, TEST_REACTOR_PEERS))
+	{
+		printf("accepted %d of %d peers\n", accepted, TEST_REACTOR_PEERS);
+		goto fail;
+	}
+
+	if (freerdp_reactor_get_peer_count(reactor) != TEST_REACTOR_PEERS)
+	{
+		printf("reactor serves %u peers\n", freerdp_reactor_get_peer_count(reactor));
+		goto fail;
+	}
+
+	if (!hangUp)
+	{
+		freerdp_reactor_free(reactor);
+		reactor = NULL;
+
+		if (closed != TEST_REACTOR_PEERS)
+		{
+			printf("freeing the reactor closed %d of %d peers\n", closed, TEST_REACTOR_PEERS);
+			goto fail;
+		}
+
+		rc = TRUE;
+		goto fail;
+	}
+
+	/* Hanging up has to close every peer from its loop thread */
+	for (i = 0; i < TEST_REACTOR_PEERS; i++)
+	{
+		close(fds[i]);
+		fds[i] = -1;
+	}
+
+	if (!test_wait_for(&closed, TEST_REACTOR_PEERS))
+	{
+		printf("closed %d of %d peers\n", closed, TEST_REACTOR_PEERS);
+		goto fail;
+	}
+
+	if (freerdp_reactor_get_peer_count(reactor) != 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < TEST_REACTOR_PEERS; i++)
+	{
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
+	freerdp_reactor_free(reactor);
+	reactor = NULL;
+
+	if (listener)
+	{
+		listener->Close(listener);
+		freerdp_listener_free(listener);
+	}
+
+	free(path);
+	return rc;
+}
+
+#endif
+
+int TestReactor(int argc, char* argv[])
+{
+#ifndef _WIN32
+
+	if (!test_reactor_peers(TRUE))
+		return -1;
+
+	if (!test_reactor_peers(FALSE))
+		return -1;
+
+#endif
+	return 0;
+}
@@ -0,0 +1,184 @@
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+
+#include "message.h"
+
+#define TEST_ARENA_BLOCK 1024
+#define TEST_ARENA_MAX_BLOCKS 256
+#define TEST_ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Fills the current chunk, returns the number of blocks it took */
+static size_t test_arena_fill_chunk(rdpUpdateArena* arena, BYTE** blocks, size_t max)
+{
+	size_t count = 1;
+	size_t stride;
+
+	if (max < 3)
+		return 0;
+
+	if (!(blocks[0] = update_arena_alloc(arena, TEST_ARENA_BLOCK)) ||
+	    !(blocks[1] = update_arena_alloc(arena, TEST_ARENA_BLOCK)))
+		return 0;
+
+	stride = (size_t)(blocks[1] - blocks[0]);
+
+	if (stride < TEST_ARENA_BLOCK)
+		return 0;
+
+	/* blocks of one chunk follow each other, a gap starts the next chunk */
+	while (count < max)
+	{
+		if (count > 1)
+		{
+			if (!(blocks[count] = update_arena_alloc(arena, TEST_ARENA_BLOCK)))
+				return 0;
+		}
+
+		if (blocks[count] != (blocks[count - 1] + stride))
+			return count;
+
+		count++;
+	}
+
+	return 0;
+}
+
+/* A chunk is reused once every block allocated from it was released */
+static BOOL test_arena_reuse(rdpUpdateArena* arena)
+{
+	size_t i;
+	size_t first;
+	size_t second = 0;
+	size_t count;
+	BYTE* blocks1[TEST_ARENA_MAX_BLOCKS];
+	BYTE* blocks2[TEST_ARENA_MAX_BLOCKS];
+	BYTE* chunk1;
+	BYTE* heap = NULL;
+	BOOL rc = FALSE;
+
+	if ((first = test_arena_fill_chunk(arena, blocks1, ARRAYSIZE(blocks1))) == 0)
+		return FALSE;
+
+	chunk1 = blocks1[0];
+
+	for (i = 0; i < first; i++)
+		memset(blocks1[i], (int) i, TEST_ARENA_BLOCK);
+
+	/* the last allocation opened the second chunk, keep it */
+	blocks2[0] = blocks1[first];
+
+	for (i = 0; i < first; i++)
+	{
+		if ((blocks1[i][0] != (BYTE) i) || (blocks1[i][TEST_ARENA_BLOCK - 1] != (BYTE) i))
+		{
+			printf("arena block %u was overwritten\n", (unsigned) i);
+			goto fail;
+		}
+
+		update_arena_free(blocks1[i]);
+	}
+
+	/* a chunk handed back to the heap would be taken by this allocation */
+	if (!(heap = malloc(TEST_ARENA_CHUNK_SIZE)))
+		goto fail;
+
+	/* the third chunk is the first one again */
+	for (second = 1; second < ARRAYSIZE(blocks2); second++)
+	{
+		if (!(blocks2[second] = update_arena_alloc(arena, TEST_ARENA_BLOCK)))
+			goto fail;
+
+		if (blocks2[second] == chunk1)
+			break;
+	}
+
+	if ((second == ARRAYSIZE(blocks2)) || (second != first))
+	{
+		printf("released arena chunk was not reused\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	count = (second < ARRAYSIZE(blocks2)) ? second + 1 : second;
+
+	for (i = 0; i < count; i++)
+		update_arena_free(blocks2[i]);
+
+	free(heap);
+	return rc;
+}
+
+/* Payloads too large for a chunk are allocated on their own */
+static BOOL test_arena_large(rdpUpdateArena* arena)
+{
+	const size_t size = 256 * 1024;
+	BYTE* small = update_arena_alloc(arena, 16);
+	BYTE* large = update_arena_alloc(arena, size);
+	BYTE* next = update_arena_alloc(arena, 16);
+	BOOL rc = small && large && next;
+
+	if (rc)
+	{
+		memset(large, 0xAB, size);
+		/* the chunk is not advanced by the large block */
+		rc = (next > small) && ((size_t)(next - small) < size);
+	}
+
+	update_arena_free(small);
+	update_arena_free(large);
+	update_arena_free(next);
+	return rc;
+}
+
+/* Blocks still queued keep the arena alive after the proxy freed it */
+static BOOL test_arena_outlive(void)
+{
+	BYTE* block;
+	BYTE* large;
+	rdpUpdateArena* arena = update_arena_new();
+
+	if (!arena)
+		return FALSE;
+
+	block = update_arena_alloc(arena, 64);
+	large = update_arena_alloc(arena, 128 * 1024);
+	update_arena_free_all(arena);
+
+	if (!block || !large)
+	{
+		update_arena_free(block);
+		update_arena_free(large);
+		return FALSE;
+	}
+
+	memset(block, 0x5A, 64);
+	memset(large, 0x5A, 128 * 1024);
+	update_arena_free(block);
+	update_arena_free(large);
+	return TRUE;
+}
+
+int TestUpdateArena(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpUpdateArena* arena = update_arena_new();
+
+	if (!arena)
+		return -1;
+
+	if (!test_arena_reuse(arena))
+		goto fail;
+
+	if (!test_arena_large(arena))
+		goto fail;
+
+	if (!test_arena_outlive())
+		goto fail;
+
+	rc = 0;
+fail:
+	update_arena_free_all(arena);
+	return rc;
+}
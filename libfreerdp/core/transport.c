@@ -31,6 +31,7 @@
 
 #include <freerdp/log.h>
 #include <freerdp/error.h>
+#include <freerdp/utils/profiler.h>
 #include <freerdp/utils/ringbuffer.h>
 
 #include <openssl/bio.h>
@@ -541,6 +542,7 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 		return status;
 	}
 
+	PROFILER_TRACE_BEGIN("transport_read_pdu");
 	/* update position value for further checks */
 	position = Stream_GetPosition(s);
 	header = Stream_Buffer(s);
@@ -563,7 +565,7 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 					/* check for header bytes already was readed in previous calls */
 					if (position < 3
 					    && (status = transport_read_layer_bytes(transport, s, 3 - position)) != 1)
-						return status;
+						goto out;
 
 					pduLength = header[2];
 					pduLength += 3;
@@ -573,7 +575,7 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 					/* check for header bytes already was readed in previous calls */
 					if (position < 4
 					    && (status = transport_read_layer_bytes(transport, s, 4 - position)) != 1)
-						return status;
+						goto out;
 
 					pduLength = (header[2] << 8) | header[3];
 					pduLength += 4;
@@ -581,7 +583,8 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 				else
 				{
 					WLog_ERR(TAG, "Error reading TSRequest!");
-					return -1;
+					status = -1;
+					goto out;
 				}
 			}
 			else
@@ -599,7 +602,7 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 			/* check for header bytes already was readed in previous calls */
 			if (position < 4
 			    && (status = transport_read_layer_bytes(transport, s, 4 - position)) != 1)
-				return status;
+				goto out;
 
 			pduLength = (header[2] << 8) | header[3];
 
@@ -607,7 +610,8 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 			if (pduLength < 7 || pduLength > 0xFFFF)
 			{
 				WLog_ERR(TAG, "tpkt - invalid pduLength: %d", pduLength);
-				return -1;
+				status = -1;
+				goto out;
 			}
 		}
 		else
@@ -618,7 +622,7 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 				/* check for header bytes already was readed in previous calls */
 				if (position < 3
 				    && (status = transport_read_layer_bytes(transport, s, 3 - position)) != 1)
-					return status;
+					goto out;
 
 				pduLength = ((header[1] & 0x7F) << 8) | header[2];
 			}
@@ -633,16 +637,22 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 			if (pduLength < 3 || pduLength > 0x8000)
 			{
 				WLog_ERR(TAG, "fast path - invalid pduLength: %d", pduLength);
-				return -1;
+				status = -1;
+				goto out;
 			}
 		}
 	}
 
 	if (!Stream_EnsureCapacity(s, Stream_GetPosition(s) + pduLength))
-		return -1;
+	{
+		status = -1;
+		goto out;
+	}
 
 	status = transport_read_layer_bytes(transport, s,
 	                                    pduLength - Stream_GetPosition(s));
+out:
+	PROFILER_TRACE_END("transport_read_pdu");
 
 	if (status != 1)
 		return status;
@@ -661,6 +671,7 @@ int transport_write(rdpTransport* transport, wStream* s)
 	int length;
 	int status = -1;
 	int writtenlength = 0;
+	UINT64 blockedSince = 0;
 
 	if (!transport)
 		return -1;
@@ -705,6 +716,9 @@ int transport_write(rdpTransport* transport, wStream* s)
 				goto out_cleanup;
 			}
 
+			if (!blockedSince)
+				blockedSince = metrics_get_time();
+
 			if (BIO_wait_write(transport->frontBio, 100) < 0)
 			{
 				WLog_ERR_BIO(TAG, "BIO_wait_write", transport->frontBio);
@@ -719,6 +733,9 @@ int transport_write(rdpTransport* transport, wStream* s)
 		{
 			while (BIO_write_blocked(transport->frontBio))
 			{
+				if (!blockedSince)
+					blockedSince = metrics_get_time();
+
 				if (BIO_wait_write(transport->frontBio, 100) < 0)
 				{
 					WLog_ERR(TAG, "error when selecting for write");
@@ -742,6 +759,10 @@ int transport_write(rdpTransport* transport, wStream* s)
 	transport->written += writtenlength;
 out_cleanup:
 
+	/* the time spent waiting for the socket to take more data */
+	if (blockedSince && transport->context)
+		metrics_transport_blocked(transport->context->metrics, metrics_get_time() - blockedSince);
+
 	if (status < 0)
 	{
 		/* A write error indicates that the peer has dropped the connection */
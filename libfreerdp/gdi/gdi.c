@@ -945,6 +945,7 @@ static BOOL gdi_surface_bits(rdpContext* context,
                              const SURFACE_BITS_COMMAND* cmd)
 {
 	DWORD format;
+	UINT64 start;
 	rdpGdi* gdi;
 
 	if (!context || !cmd)
@@ -960,6 +961,8 @@ static BOOL gdi_surface_bits(rdpContext* context,
 	switch (cmd->codecID)
 	{
 		case RDP_CODEC_ID_REMOTEFX:
+			start = metrics_get_time();
+
 			if (!rfx_process_message(context->codecs->rfx, cmd->bitmapData,
 			                         cmd->bitmapDataLength,
 			                         cmd->destLeft, cmd->destTop,
@@ -970,10 +973,13 @@ static BOOL gdi_surface_bits(rdpContext* context,
 				return FALSE;
 			}
 
+			metrics_codec_time(context->metrics, FREERDP_CODEC_REMOTEFX, FALSE,
+			                   metrics_get_time() - start);
 			break;
 
 		case RDP_CODEC_ID_NSCODEC:
 			format = gdi->dstFormat;
+			start = metrics_get_time();
 
 			if (!nsc_process_message(context->codecs->nsc, cmd->bpp, cmd->width,
 			                         cmd->height, cmd->bitmapData,
@@ -982,6 +988,8 @@ static BOOL gdi_surface_bits(rdpContext* context,
 			                         cmd->width, cmd->height, FREERDP_FLIP_VERTICAL))
 				return FALSE;
 
+			metrics_codec_time(context->metrics, FREERDP_CODEC_NSCODEC, FALSE,
+			                   metrics_get_time() - start);
 			break;
 
 		case RDP_CODEC_ID_NONE:
@@ -26,6 +26,7 @@
 #include <freerdp/log.h>
 #include <freerdp/gdi/gfx.h>
 #include <freerdp/gdi/region.h>
+#include <freerdp/utils/profiler.h>
 
 #define TAG FREERDP_TAG("gdi")
 
@@ -131,6 +132,7 @@ static UINT gdi_OutputUpdate(rdpGdi* gdi, gdiGfxSurface* surface)
 
 		gdi_InvalidateRegion(gdi->primary->hdc, nXDst, nYDst, width, height);
 		update->EndPaint(gdi->context);
+		metrics_paint(gdi->context->metrics);
 	}
 
 	region16_clear(&(surface->invalidRegion));
@@ -576,6 +578,36 @@ static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi,
 	return status;
 }
 
+static UINT32 gdi_SurfaceCommand_CodecFlag(UINT32 codecId)
+{
+	switch (codecId)
+	{
+		case RDPGFX_CODECID_CAVIDEO:
+			return FREERDP_CODEC_REMOTEFX;
+
+		case RDPGFX_CODECID_CLEARCODEC:
+			return FREERDP_CODEC_CLEARCODEC;
+
+		case RDPGFX_CODECID_PLANAR:
+			return FREERDP_CODEC_PLANAR;
+
+		case RDPGFX_CODECID_AVC420:
+			return FREERDP_CODEC_AVC420;
+
+		case RDPGFX_CODECID_AVC444:
+			return FREERDP_CODEC_AVC444;
+
+		case RDPGFX_CODECID_ALPHA:
+			return FREERDP_CODEC_ALPHACODEC;
+
+		case RDPGFX_CODECID_CAPROGRESSIVE:
+			return FREERDP_CODEC_PROGRESSIVE;
+
+		default:
+			return 0;
+	}
+}
+
 /**
  * Function description
  *
@@ -585,6 +617,7 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context,
                                const RDPGFX_SURFACE_COMMAND* cmd)
 {
 	UINT status = CHANNEL_RC_OK;
+	UINT64 start;
 	rdpGdi* gdi = (rdpGdi*) context->custom;
 
 	if (!context || !cmd)
@@ -597,6 +630,8 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context,
 	           cmd->surfaceId, cmd->codecId, cmd->contextId,
 	           GetColorFormatName(cmd->format), cmd->left, cmd->top, cmd->right,
 	           cmd->bottom, cmd->width, cmd->height, cmd->length, cmd->data, cmd->extra);
+	PROFILER_TRACE_BEGIN("gdi_SurfaceCommand");
+	start = metrics_get_time();
 
 	switch (cmd->codecId)
 	{
@@ -641,6 +676,9 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context,
 			break;
 	}
 
+	metrics_codec_time(gdi->context->metrics, gdi_SurfaceCommand_CodecFlag(cmd->codecId), FALSE,
+	                   metrics_get_time() - start);
+	PROFILER_TRACE_END("gdi_SurfaceCommand");
 	return status;
 }
 
@@ -857,6 +895,17 @@ static UINT gdi_SurfaceToSurface(RdpgfxClientContext* context,
 	return status;
 }
 
+static void gdi_free_cache_entry(void* pData)
+{
+	gdiGfxCacheEntry* cacheEntry = (gdiGfxCacheEntry*) pData;
+
+	if (cacheEntry)
+	{
+		free(cacheEntry->data);
+		free(cacheEntry);
+	}
+}
+
 /**
  * Function description
  *
@@ -892,9 +941,11 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 		return ERROR_INTERNAL_ERROR;
 	}
 
+	cacheEntry->cacheKey = surfaceToCache->cacheKey;
 	freerdp_image_copy(cacheEntry->data, cacheEntry->format, cacheEntry->scanline,
 	                   0, 0, cacheEntry->width, cacheEntry->height, surface->data,
 	                   surface->format, surface->scanline, rect->left, rect->top, NULL, FREERDP_FLIP_NONE);
+	gdi_free_cache_entry(context->GetCacheSlotData(context, surfaceToCache->cacheSlot));
 	context->SetCacheSlotData(context, surfaceToCache->cacheSlot,
 	                          (void*) cacheEntry);
 	return CHANNEL_RC_OK;
@@ -965,17 +1016,93 @@ static UINT gdi_CacheImportReply(RdpgfxClientContext* context,
 static UINT gdi_EvictCacheEntry(RdpgfxClientContext* context,
                                 const RDPGFX_EVICT_CACHE_ENTRY_PDU* evictCacheEntry)
 {
+	gdi_free_cache_entry(context->GetCacheSlotData(context,
+	                     evictCacheEntry->cacheSlot));
+	context->SetCacheSlotData(context, evictCacheEntry->cacheSlot, NULL);
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Restores a cache slot from the persistent cache after the server
+ * accepted it in the cache import reply.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_ImportCacheEntry(RdpgfxClientContext* context, UINT16 cacheSlot,
+                                 const PERSISTENT_CACHE_ENTRY* importCacheEntry)
+{
+	UINT error;
 	gdiGfxCacheEntry* cacheEntry;
-	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context,
-	             evictCacheEntry->cacheSlot);
+	cacheEntry = (gdiGfxCacheEntry*) calloc(1, sizeof(gdiGfxCacheEntry));
 
-	if (cacheEntry)
+	if (!cacheEntry)
+		return CHANNEL_RC_NO_MEMORY;
+
+	cacheEntry->cacheKey = importCacheEntry->key64;
+	cacheEntry->width = importCacheEntry->width;
+	cacheEntry->height = importCacheEntry->height;
+	cacheEntry->format = PIXEL_FORMAT_BGRA32;
+	cacheEntry->scanline = gfx_align_scanline(cacheEntry->width * 4, 16);
+	cacheEntry->data = (BYTE*) calloc(1, cacheEntry->scanline * cacheEntry->height);
+
+	if (!cacheEntry->data)
 	{
-		free(cacheEntry->data);
 		free(cacheEntry);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!freerdp_image_copy(cacheEntry->data, cacheEntry->format, cacheEntry->scanline,
+	                        0, 0, cacheEntry->width, cacheEntry->height, importCacheEntry->data,
+	                        PIXEL_FORMAT_BGRA32, importCacheEntry->width * 4, 0, 0, NULL,
+	                        FREERDP_FLIP_NONE))
+	{
+		gdi_free_cache_entry(cacheEntry);
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	gdi_free_cache_entry(context->GetCacheSlotData(context, cacheSlot));
+	error = context->SetCacheSlotData(context, cacheSlot, (void*) cacheEntry);
+
+	if (error)
+		gdi_free_cache_entry(cacheEntry);
+
+	return error;
+}
+
+/**
+ * Copies a cache slot for the persistent cache. The pixel data is
+ * allocated here and released by the caller with free().
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_ExportCacheEntry(RdpgfxClientContext* context, UINT16 cacheSlot,
+                                 PERSISTENT_CACHE_ENTRY* exportCacheEntry)
+{
+	gdiGfxCacheEntry* cacheEntry;
+	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context, cacheSlot);
+
+	if (!cacheEntry || (cacheEntry->width > 0xFFFF) || (cacheEntry->height > 0xFFFF))
+		return ERROR_NOT_FOUND;
+
+	exportCacheEntry->key64 = cacheEntry->cacheKey;
+	exportCacheEntry->width = (UINT16) cacheEntry->width;
+	exportCacheEntry->height = (UINT16) cacheEntry->height;
+	exportCacheEntry->cacheId = 0;
+	exportCacheEntry->data = (BYTE*) malloc(cacheEntry->width * cacheEntry->height * 4ULL);
+
+	if (!exportCacheEntry->data)
+		return CHANNEL_RC_NO_MEMORY;
+
+	if (!freerdp_image_copy(exportCacheEntry->data, PIXEL_FORMAT_BGRA32,
+	                        cacheEntry->width * 4, 0, 0, cacheEntry->width, cacheEntry->height,
+	                        cacheEntry->data, cacheEntry->format, cacheEntry->scanline, 0, 0,
+	                        NULL, FREERDP_FLIP_NONE))
+	{
+		free(exportCacheEntry->data);
+		exportCacheEntry->data = NULL;
+		return ERROR_INTERNAL_ERROR;
 	}
 
-	context->SetCacheSlotData(context, evictCacheEntry->cacheSlot, NULL);
 	return CHANNEL_RC_OK;
 }
 
@@ -1032,6 +1159,8 @@ void gdi_graphics_pipeline_init(rdpGdi* gdi, RdpgfxClientContext* gfx)
 	gfx->MapSurfaceToOutput = gdi_MapSurfaceToOutput;
 	gfx->MapSurfaceToWindow = gdi_MapSurfaceToWindow;
 	gfx->UpdateSurfaces = gdi_UpdateSurfaces;
+	gfx->ImportCacheEntry = gdi_ImportCacheEntry;
+	gfx->ExportCacheEntry = gdi_ExportCacheEntry;
 }
 
 void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx)
@@ -149,6 +149,8 @@ static BOOL gdi_Bitmap_Decompress(rdpContext* context, rdpBitmap* bitmap,
 
 	if (compressed)
 	{
+		const UINT64 start = metrics_get_time();
+
 		if (bpp < 32)
 		{
 			if (!interleaved_decompress(context->codecs->interleaved,
@@ -168,6 +170,10 @@ static BOOL gdi_Bitmap_Decompress(rdpContext* context, rdpBitmap* bitmap,
 			                       DstWidth, DstHeight, TRUE))
 				return FALSE;
 		}
+
+		metrics_codec_time(context->metrics,
+		                   (bpp < 32) ? FREERDP_CODEC_INTERLEAVED : FREERDP_CODEC_PLANAR, FALSE,
+		                   metrics_get_time() - start);
 	}
 	else
 	{
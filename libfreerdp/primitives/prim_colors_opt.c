@@ -554,6 +554,16 @@ static pstatus_t neon_yCbCrToRGB_16s16s_P3P3(
  */
 
 /* ------------------------------------------------------------------------- */
+#if defined(WITH_SSE2)
+void primitives_init_colors_sse2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->RGBToRGB_16s8u_P3AC4R  = sse2_RGBToRGB_16s8u_P3AC4R;
+	prims->yCbCrToRGB_16s16s_P3P3 = sse2_yCbCrToRGB_16s16s_P3P3;
+	prims->RGBToYCbCr_16s16s_P3P3 = sse2_RGBToYCbCr_16s16s_P3P3;
+}
+#endif /* WITH_SSE2 */
+
 void primitives_init_colors_opt(primitives_t* prims)
 {
 	generic = primitives_get_generic();
@@ -561,12 +571,14 @@ void primitives_init_colors_opt(primitives_t* prims)
 #if defined(WITH_SSE2)
 
 	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
-	{
-		prims->RGBToRGB_16s8u_P3AC4R  = sse2_RGBToRGB_16s8u_P3AC4R;
-		prims->yCbCrToRGB_16s16s_P3P3 = sse2_yCbCrToRGB_16s16s_P3P3;
-		prims->RGBToYCbCr_16s16s_P3P3 = sse2_RGBToYCbCr_16s16s_P3P3;
-	}
+		primitives_init_colors_sse2(prims);
+
+#if defined(WITH_AVX2)
 
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		primitives_init_colors_avx2(prims);
+
+#endif
 #elif defined(WITH_NEON)
 
 	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
@@ -0,0 +1,57 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Pixel format conversion.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+#include "prim_convert.h"
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Converts a rectangle between two direct color formats. Palette based
+ * formats are not supported, the caller has to handle those.
+ * Steps may be negative to walk the image bottom up.
+ */
+static pstatus_t general_convertPixels_8u(
+    const BYTE* pSrc, UINT32 SrcFormat, INT32 srcStep,
+    BYTE* pDst, UINT32 DstFormat, INT32 dstStep,
+    UINT32 width, UINT32 height)
+{
+	UINT32 y;
+
+	if ((GetBitsPerPixel(SrcFormat) < 15) || (GetBitsPerPixel(DstFormat) < 15))
+		return -1;
+
+	for (y = 0; y < height; y++)
+	{
+		convert_row_scalar(pSrc, SrcFormat, pDst, DstFormat, width);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert(
+    primitives_t* prims)
+{
+	prims->convertPixels_8u = general_convertPixels_8u;
+}
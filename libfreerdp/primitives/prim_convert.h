@@ -0,0 +1,41 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Pixel format conversion, shared scalar helpers.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef __PRIM_CONVERT_H_INCLUDED__
+#define __PRIM_CONVERT_H_INCLUDED__
+
+#include <freerdp/types.h>
+#include <freerdp/codec/color.h>
+
+/**
+ * Converts count pixels one at a time. This is the reference the vectorized
+ * row converters have to match bit for bit, and it handles their tails.
+ */
+static INLINE void convert_row_scalar(const BYTE* pSrc, UINT32 SrcFormat,
+                                      BYTE* pDst, UINT32 DstFormat, UINT32 count)
+{
+	UINT32 x;
+	const UINT32 srcByte = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstByte = GetBytesPerPixel(DstFormat);
+
+	for (x = 0; x < count; x++)
+	{
+		const UINT32 color = ReadColor(pSrc, SrcFormat);
+		WriteColor(pDst, DstFormat, ConvertColor(color, SrcFormat, DstFormat, NULL));
+		pSrc += srcByte;
+		pDst += dstByte;
+	}
+}
+
+#endif /* !__PRIM_CONVERT_H_INCLUDED__ */
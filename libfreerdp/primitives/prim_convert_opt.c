@@ -0,0 +1,423 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized pixel format conversion.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif /* WITH_SSE2 */
+
+#include "prim_internal.h"
+#include "prim_convert.h"
+
+static primitives_t* generic = NULL;
+
+#ifdef WITH_SSE2
+typedef struct _CONVERT_ENTRY CONVERT_ENTRY;
+typedef void (*convert_row_fkt)(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                const CONVERT_ENTRY* entry);
+
+/**
+ * One entry of the dispatch table. All converters move pixels through a
+ * 32bpp layout, shuffle and fill describe how four of those pixels map to
+ * the destination bytes. The 16bpp converters additionally need the shift
+ * counts and masks of the middle and high channel.
+ */
+struct _CONVERT_ENTRY
+{
+	UINT32 SrcFormat;
+	UINT32 DstFormat;
+	convert_row_fkt fkt;
+	BYTE shuffle[16];
+	BYTE fill[16];
+	UINT32 shift[2];
+	UINT32 mask[2];
+	BOOL alpha;
+};
+
+/* The formats the dispatch table is keyed on */
+static const UINT32 convert_formats[] =
+{
+	PIXEL_FORMAT_ARGB32,
+	PIXEL_FORMAT_XRGB32,
+	PIXEL_FORMAT_ABGR32,
+	PIXEL_FORMAT_XBGR32,
+	PIXEL_FORMAT_BGRA32,
+	PIXEL_FORMAT_BGRX32,
+	PIXEL_FORMAT_RGBA32,
+	PIXEL_FORMAT_RGBX32,
+	PIXEL_FORMAT_RGB24,
+	PIXEL_FORMAT_BGR24,
+	PIXEL_FORMAT_RGB16,
+	PIXEL_FORMAT_BGR16,
+	PIXEL_FORMAT_ARGB15,
+	PIXEL_FORMAT_ABGR15,
+	PIXEL_FORMAT_RGB15,
+	PIXEL_FORMAT_BGR15
+};
+
+#define CONVERT_FORMAT_COUNT (sizeof(convert_formats) / sizeof(convert_formats[0]))
+
+static CONVERT_ENTRY convert_table[CONVERT_FORMAT_COUNT][CONVERT_FORMAT_COUNT];
+
+/* ------------------------------------------------------------------------- */
+static INT32 convert_format_index(UINT32 format)
+{
+	UINT32 i;
+
+	for (i = 0; i < CONVERT_FORMAT_COUNT; i++)
+	{
+		if (convert_formats[i] == format)
+			return (INT32) i;
+	}
+
+	return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Byte positions of red, green, blue and alpha within a 24 or 32bpp pixel,
+ * -1 for channels not stored. Taken from WriteColor so the table can not
+ * drift from the scalar path.
+ */
+static void convert_get_layout(UINT32 format, INT32 pos[4])
+{
+	UINT32 i, c;
+	BYTE pixel[4] = { 0 };
+	WriteColor(pixel, format, GetColor(format, 1, 2, 3, 4));
+
+	for (c = 0; c < 4; c++)
+	{
+		pos[c] = -1;
+
+		for (i = 0; i < GetBytesPerPixel(format); i++)
+		{
+			if (pixel[i] == c + 1)
+				pos[c] = (INT32) i;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+static void convert_build_shuffle(UINT32 SrcFormat, UINT32 srcByte,
+                                  UINT32 DstFormat, UINT32 dstByte,
+                                  BYTE shuffle[16], BYTE fill[16])
+{
+	UINT32 x, c;
+	INT32 src[4], dst[4];
+	convert_get_layout(SrcFormat, src);
+	convert_get_layout(DstFormat, dst);
+
+	/* SplitColor reports opaque for formats without alpha */
+	if (!ColorHasAlpha(SrcFormat))
+		src[3] = -1;
+
+	memset(shuffle, 0x80, 16);
+	memset(fill, 0, 16);
+
+	for (x = 0; x < 4; x++)
+	{
+		for (c = 0; c < 4; c++)
+		{
+			UINT32 k;
+
+			if (dst[c] < 0)
+				continue;
+
+			k = x * dstByte + dst[c];
+
+			if (src[c] >= 0)
+				shuffle[k] = (BYTE)(x * srcByte + src[c]);
+			else
+				fill[k] = 0xFF;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The 16bpp converters keep the low, middle and high channel in byte 0, 1
+ * and 2 of a 32bpp pixel. For the RGB formats that is BGRA order.
+ */
+static UINT32 convert_16bpp_layout(UINT32 format)
+{
+	if (FREERDP_PIXEL_FORMAT_TYPE(format) == FREERDP_PIXEL_FORMAT_TYPE_ARGB)
+		return PIXEL_FORMAT_BGRA32;
+
+	return PIXEL_FORMAT_RGBA32;
+}
+
+/* ------------------------------------------------------------------------- */
+static void ssse3_convert_row_32_32(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                    const CONVERT_ENTRY* entry)
+{
+	UINT32 x;
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) entry->shuffle);
+	const __m128i fill = _mm_loadu_si128((const __m128i*) entry->fill);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		__m128i p0 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4]);
+		__m128i p1 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 16]);
+		p0 = _mm_or_si128(_mm_shuffle_epi8(p0, shuffle), fill);
+		p1 = _mm_or_si128(_mm_shuffle_epi8(p1, shuffle), fill);
+		_mm_storeu_si128((__m128i*) &pDst[x * 4], p0);
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 16], p1);
+	}
+
+	convert_row_scalar(&pSrc[x * 4], entry->SrcFormat, &pDst[x * 4], entry->DstFormat,
+	                   width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static void ssse3_convert_row_24_32(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                    const CONVERT_ENTRY* entry)
+{
+	UINT32 x;
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) entry->shuffle);
+	const __m128i fill = _mm_loadu_si128((const __m128i*) entry->fill);
+
+	/* each load consumes 12 of the 16 bytes, keep it inside the row */
+	for (x = 0; x + 6 <= width; x += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*) &pSrc[x * 3]);
+		p = _mm_or_si128(_mm_shuffle_epi8(p, shuffle), fill);
+		_mm_storeu_si128((__m128i*) &pDst[x * 4], p);
+	}
+
+	convert_row_scalar(&pSrc[x * 3], entry->SrcFormat, &pDst[x * 4], entry->DstFormat,
+	                   width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static void ssse3_convert_row_32_24(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                    const CONVERT_ENTRY* entry)
+{
+	UINT32 x;
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) entry->shuffle);
+
+	for (x = 0; x + 4 <= width; x += 4)
+	{
+		const __m128i p = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &pSrc[x * 4]),
+		                                   shuffle);
+		const UINT32 tail = (UINT32) _mm_cvtsi128_si32(_mm_srli_si128(p, 8));
+		_mm_storel_epi64((__m128i*) &pDst[x * 3], p);
+		CopyMemory(&pDst[x * 3 + 8], &tail, 4);
+	}
+
+	convert_row_scalar(&pSrc[x * 4], entry->SrcFormat, &pDst[x * 3], entry->DstFormat,
+	                   width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static void ssse3_convert_row_16_32(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                    const CONVERT_ENTRY* entry)
+{
+	UINT32 x;
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) entry->shuffle);
+	const __m128i fill = _mm_loadu_si128((const __m128i*) entry->fill);
+	const __m128i midShift = _mm_cvtsi32_si128((int) entry->shift[0]);
+	const __m128i hiShift = _mm_cvtsi32_si128((int) entry->shift[1]);
+	const __m128i midMask = _mm_set1_epi16((short) entry->mask[0]);
+	const __m128i hiMask = _mm_set1_epi16((short) entry->mask[1]);
+	const __m128i loMask = _mm_set1_epi16(0x1F);
+	const __m128i byteMask = _mm_set1_epi16(0xFF);
+	const __m128i opaque = _mm_set1_epi16(0xFF00);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		__m128i lo, mid, hi, a;
+		const __m128i v = _mm_loadu_si128((const __m128i*) &pSrc[x * 2]);
+		/* channel << 3 (<< 2 for the 6 bit green) as SplitColor does */
+		lo = _mm_slli_epi16(_mm_and_si128(v, loMask), 3);
+		mid = _mm_and_si128(_mm_srl_epi16(v, midShift), midMask);
+		hi = _mm_and_si128(_mm_srl_epi16(v, hiShift), hiMask);
+		a = entry->alpha ? _mm_slli_epi16(_mm_and_si128(_mm_srai_epi16(v, 15), byteMask), 8) :
+		    opaque;
+		lo = _mm_or_si128(lo, _mm_slli_epi16(mid, 8));
+		hi = _mm_or_si128(hi, a);
+		_mm_storeu_si128((__m128i*) &pDst[x * 4],
+		                 _mm_or_si128(_mm_shuffle_epi8(_mm_unpacklo_epi16(lo, hi), shuffle), fill));
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 16],
+		                 _mm_or_si128(_mm_shuffle_epi8(_mm_unpackhi_epi16(lo, hi), shuffle), fill));
+	}
+
+	convert_row_scalar(&pSrc[x * 2], entry->SrcFormat, &pDst[x * 4], entry->DstFormat,
+	                   width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static INLINE __m128i ssse3_pack_16(__m128i p, __m128i shuffle,
+                                    __m128i midShift, __m128i hiShift,
+                                    __m128i midMask, __m128i hiMask, __m128i loMask)
+{
+	__m128i v;
+	p = _mm_shuffle_epi8(p, shuffle);
+	v = _mm_and_si128(_mm_srli_epi32(p, 3), loMask);
+	v = _mm_or_si128(v, _mm_and_si128(_mm_srl_epi32(p, midShift), midMask));
+	v = _mm_or_si128(v, _mm_and_si128(_mm_srl_epi32(p, hiShift), hiMask));
+	/* sign extend so the saturating pack keeps the value */
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static void ssse3_convert_row_32_16(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                    const CONVERT_ENTRY* entry)
+{
+	UINT32 x;
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) entry->shuffle);
+	const __m128i midShift = _mm_cvtsi32_si128((int) entry->shift[0]);
+	const __m128i hiShift = _mm_cvtsi32_si128((int) entry->shift[1]);
+	const __m128i midMask = _mm_set1_epi32((int) entry->mask[0]);
+	const __m128i hiMask = _mm_set1_epi32((int) entry->mask[1]);
+	const __m128i loMask = _mm_set1_epi32(0x1F);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		const __m128i p0 = ssse3_pack_16(_mm_loadu_si128((const __m128i*) &pSrc[x * 4]),
+		                                 shuffle, midShift, hiShift, midMask, hiMask, loMask);
+		const __m128i p1 = ssse3_pack_16(_mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 16]),
+		                                 shuffle, midShift, hiShift, midMask, hiMask, loMask);
+		_mm_storeu_si128((__m128i*) &pDst[x * 2], _mm_packs_epi32(p0, p1));
+	}
+
+	convert_row_scalar(&pSrc[x * 4], entry->SrcFormat, &pDst[x * 2], entry->DstFormat,
+	                   width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static void convert_init_entry(CONVERT_ENTRY* entry, UINT32 SrcFormat, UINT32 DstFormat)
+{
+	const UINT32 srcBpp = GetBitsPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBitsPerPixel(DstFormat);
+	const BOOL src565 = (srcBpp == 16) && !ColorHasAlpha(SrcFormat);
+	const BOOL dst565 = (dstBpp == 16) && !ColorHasAlpha(DstFormat);
+	ZeroMemory(entry, sizeof(CONVERT_ENTRY));
+	entry->SrcFormat = SrcFormat;
+	entry->DstFormat = DstFormat;
+
+	if ((srcBpp == 32) && (dstBpp == 32))
+	{
+		entry->fkt = ssse3_convert_row_32_32;
+		convert_build_shuffle(SrcFormat, 4, DstFormat, 4, entry->shuffle, entry->fill);
+	}
+	else if ((srcBpp == 24) && (dstBpp == 32))
+	{
+		entry->fkt = ssse3_convert_row_24_32;
+		convert_build_shuffle(SrcFormat, 3, DstFormat, 4, entry->shuffle, entry->fill);
+	}
+	else if ((srcBpp == 32) && (dstBpp == 24))
+	{
+		entry->fkt = ssse3_convert_row_32_24;
+		convert_build_shuffle(SrcFormat, 4, DstFormat, 3, entry->shuffle, entry->fill);
+	}
+	else if ((srcBpp <= 16) && (dstBpp == 32))
+	{
+		entry->fkt = ssse3_convert_row_16_32;
+		entry->shift[0] = src565 ? 3 : 2;
+		entry->shift[1] = src565 ? 8 : 7;
+		entry->mask[0] = src565 ? 0xFC : 0xF8;
+		entry->mask[1] = 0xF8;
+		entry->alpha = ColorHasAlpha(SrcFormat);
+		convert_build_shuffle(convert_16bpp_layout(SrcFormat), 4, DstFormat, 4,
+		                      entry->shuffle, entry->fill);
+	}
+	else if ((srcBpp == 32) && ((dst565) || (dstBpp == 15)))
+	{
+		/* the 1 bit alpha formats would need the alpha byte as well */
+		entry->fkt = ssse3_convert_row_32_16;
+		entry->shift[0] = dst565 ? 5 : 6;
+		entry->shift[1] = dst565 ? 8 : 9;
+		entry->mask[0] = dst565 ? 0x07E0 : 0x03E0;
+		entry->mask[1] = dst565 ? 0xF800 : 0x7C00;
+		convert_build_shuffle(SrcFormat, 4, convert_16bpp_layout(DstFormat), 4,
+		                      entry->shuffle, entry->fill);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+static const CONVERT_ENTRY* convert_lookup(UINT32 SrcFormat, UINT32 DstFormat)
+{
+	const INT32 src = convert_format_index(SrcFormat);
+	const INT32 dst = convert_format_index(DstFormat);
+
+	if ((src < 0) || (dst < 0))
+		return NULL;
+
+	if (!convert_table[src][dst].fkt)
+		return NULL;
+
+	return &convert_table[src][dst];
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t ssse3_convertPixels_8u(
+    const BYTE* pSrc, UINT32 SrcFormat, INT32 srcStep,
+    BYTE* pDst, UINT32 DstFormat, INT32 dstStep,
+    UINT32 width, UINT32 height)
+{
+	UINT32 y;
+	const CONVERT_ENTRY* entry = convert_lookup(SrcFormat, DstFormat);
+
+	if (!entry)
+		return generic->convertPixels_8u(pSrc, SrcFormat, srcStep, pDst, DstFormat, dstStep,
+		                                 width, height);
+
+	for (y = 0; y < height; y++)
+	{
+		entry->fkt(pSrc, pDst, width, entry);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static void convert_init_table(void)
+{
+	UINT32 src, dst;
+
+	for (src = 0; src < CONVERT_FORMAT_COUNT; src++)
+	{
+		for (dst = 0; dst < CONVERT_FORMAT_COUNT; dst++)
+			convert_init_entry(&convert_table[src][dst], convert_formats[src],
+			                   convert_formats[dst]);
+	}
+}
+#endif /* WITH_SSE2 */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert_opt(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	primitives_init_convert(prims);
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresentEx(PF_EX_SSSE3)
+	    && IsProcessorFeaturePresent(PF_SSE3_INSTRUCTIONS_AVAILABLE))
+	{
+		convert_init_table();
+		prims->convertPixels_8u = ssse3_convertPixels_8u;
+	}
+
+#endif
+}
@@ -120,6 +120,8 @@ FREERDP_LOCAL void primitives_init_alphaComp(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_colors(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YCoCg(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_planar(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_convert(primitives_t* prims);
 
 FREERDP_LOCAL void primitives_init_copy_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_set_opt(primitives_t* prims);
@@ -131,5 +133,16 @@ FREERDP_LOCAL void primitives_init_alphaComp_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_colors_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YCoCg_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV_opt(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_planar_opt(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_convert_opt(primitives_t* prims);
+
+#if defined(WITH_SSE2)
+FREERDP_LOCAL void primitives_init_colors_sse2(primitives_t* prims);
+#endif
+
+#if defined(WITH_AVX2)
+FREERDP_LOCAL void primitives_init_colors_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_planar_avx2(primitives_t* prims);
+#endif
 
 #endif /* !__PRIM_INTERNAL_H_INCLUDED__ */
@@ -0,0 +1,144 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Planar codec plane operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+/* ----------------------------------------------------------------------------
+ * Splits a 32bpp image into R, G, B and A planes. The planar codec stores
+ * the scanlines bottom-up, so the last row of pSrc becomes the first one of
+ * each plane.
+ */
+static pstatus_t general_planarSplit_8u_AC4P4(
+    const BYTE* pSrc, UINT32 SrcFormat, UINT32 srcStep,
+    BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 k = 0;
+	const UINT32 bpp = GetBytesPerPixel(SrcFormat);
+
+	if (srcStep == 0)
+		srcStep = width * bpp;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pixel = &pSrc[srcStep * (height - y - 1)];
+
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 color = ReadColor(pixel, SrcFormat);
+			pixel += bpp;
+			SplitColor(color, SrcFormat, &pDst[0][k], &pDst[1][k],
+			           &pDst[2][k], &pDst[3][k], NULL);
+			k++;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------------
+ * Interleaves R, G, B and (optionally) A planes into pDst. Without alpha the
+ * pixels are written opaque. With vFlip the first plane row is written to
+ * the last scanline.
+ */
+static pstatus_t general_planarCombine_8u_P4AC4R(
+    const BYTE* pSrc[4],
+    BYTE* pDst, UINT32 DstFormat, UINT32 dstStep,
+    UINT32 width, UINT32 height, BOOL alpha, BOOL vFlip)
+{
+	UINT32 x, y;
+	const BYTE* pR = pSrc[0];
+	const BYTE* pG = pSrc[1];
+	const BYTE* pB = pSrc[2];
+	const BYTE* pA = pSrc[3];
+	const UINT32 bpp = GetBytesPerPixel(DstFormat);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* pRGB = &pDst[dstStep * (vFlip ? (height - y - 1) : y)];
+
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 color = GetColor(DstFormat, *pR++, *pG++, *pB++,
+			                              alpha ? *pA++ : 0xFF);
+			WriteColor(pRGB, DstFormat, color);
+			pRGB += bpp;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------------
+ * Replaces every row but the first by its difference to the previous row,
+ * stored as 2 * |delta| (-1 for negative deltas) in the low 8 bits.
+ */
+static pstatus_t general_planarDeltaEncode_8u(
+    const BYTE* pSrc, BYTE* pDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 index;
+	const UINT32 size = width * height;
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	CopyMemory(pDst, pSrc, width);
+
+	for (index = width; index < size; index++)
+	{
+		const INT8 delta = (INT8)(pSrc[index] - pSrc[index - width]);
+		pDst[index] = (BYTE)((delta >= 0) ? (delta << 1) : (((-delta) << 1) - 1));
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------------
+ * Reverts general_planarDeltaEncode_8u in place, row by row.
+ */
+static pstatus_t general_planarDeltaDecode_8u(
+    BYTE* pSrcDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 index;
+	const UINT32 size = width * height;
+
+	for (index = width; index < size; index++)
+	{
+		const BYTE code = pSrcDst[index];
+		const INT32 delta = (code & 1) ? -((code >> 1) + 1) : (code >> 1);
+		pSrcDst[index] = (BYTE)(pSrcDst[index - width] + delta);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_planar(
+    primitives_t* prims)
+{
+	prims->planarSplit_8u_AC4P4 = general_planarSplit_8u_AC4P4;
+	prims->planarCombine_8u_P4AC4R = general_planarCombine_8u_P4AC4R;
+	prims->planarDeltaEncode_8u = general_planarDeltaEncode_8u;
+	prims->planarDeltaDecode_8u = general_planarDeltaDecode_8u;
+}
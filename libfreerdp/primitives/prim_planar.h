@@ -0,0 +1,103 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Planar codec plane operations, shared scalar helpers.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef __PRIM_PLANAR_H_INCLUDED__
+#define __PRIM_PLANAR_H_INCLUDED__
+
+#include <freerdp/types.h>
+#include <freerdp/codec/color.h>
+
+/**
+ * The vectorized split and combine only handle 32bpp formats with 8 bit
+ * channels. Returns the byte offsets of red and blue within a pixel.
+ */
+static INLINE BOOL planar_get_rb_offsets(UINT32 format, UINT32* red, UINT32* blue, BOOL* hasAlpha)
+{
+	switch (format)
+	{
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			*blue = 0;
+			*red = 2;
+			break;
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			*red = 0;
+			*blue = 2;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	*hasAlpha = ColorHasAlpha(format);
+	return TRUE;
+}
+
+static INLINE void planar_split_row_scalar(const BYTE* pSrc, BYTE* pDst[4], UINT32 offset,
+                                    UINT32 count, UINT32 red, UINT32 blue, BOOL hasAlpha)
+{
+	UINT32 x;
+
+	for (x = 0; x < count; x++)
+	{
+		pDst[0][offset + x] = pSrc[red];
+		pDst[1][offset + x] = pSrc[1];
+		pDst[2][offset + x] = pSrc[blue];
+		pDst[3][offset + x] = hasAlpha ? pSrc[3] : 0xFF;
+		pSrc += 4;
+	}
+}
+
+static INLINE void planar_combine_row_scalar(const BYTE* pSrc[4], UINT32 offset, BYTE* pDst,
+                                      UINT32 count, UINT32 red, UINT32 blue, BOOL alpha)
+{
+	UINT32 x;
+
+	for (x = 0; x < count; x++)
+	{
+		pDst[red] = pSrc[0][offset + x];
+		pDst[1] = pSrc[1][offset + x];
+		pDst[blue] = pSrc[2][offset + x];
+		pDst[3] = alpha ? pSrc[3][offset + x] : 0xFF;
+		pDst += 4;
+	}
+}
+
+static INLINE void planar_delta_encode_scalar(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                       UINT32 count)
+{
+	UINT32 x;
+
+	for (x = 0; x < count; x++)
+	{
+		const INT8 delta = (INT8)(pSrc[x] - pPrev[x]);
+		pDst[x] = (BYTE)((delta >= 0) ? (delta << 1) : (((-delta) << 1) - 1));
+	}
+}
+
+static INLINE void planar_delta_decode_scalar(BYTE* pSrcDst, const BYTE* pPrev, UINT32 count)
+{
+	UINT32 x;
+
+	for (x = 0; x < count; x++)
+	{
+		const BYTE code = pSrcDst[x];
+		const INT32 delta = (code & 1) ? -((code >> 1) + 1) : (code >> 1);
+		pSrcDst[x] = (BYTE)(pPrev[x] + delta);
+	}
+}
+
+#endif /* !__PRIM_PLANAR_H_INCLUDED__ */
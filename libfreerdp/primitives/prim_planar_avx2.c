@@ -0,0 +1,213 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * AVX2 planar codec plane operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+#include "prim_planar.h"
+
+#if defined(WITH_AVX2)
+#include <immintrin.h>
+
+static primitives_t* generic = NULL;
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_planarSplit_8u_AC4P4(
+    const BYTE* pSrc, UINT32 SrcFormat, UINT32 srcStep,
+    BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+	const __m256i opaque = _mm256_set1_epi8((char) 0xFF);
+	/* per 128 bit lane: B0G0R0A0 ... -> B0B1B2B3 G0G1G2G3 R0R1R2R3 A0A1A2A3 */
+	const __m256i deinterleave = _mm256_set_epi8(
+	                                 15, 11, 7, 3, 14, 10, 6, 2, 13, 9, 5, 1, 12, 8, 4, 0,
+	                                 15, 11, 7, 3, 14, 10, 6, 2, 13, 9, 5, 1, 12, 8, 4, 0);
+	/* the unpacks below leave the 4 pixel groups in lane order 0 2 4 6 1 3 5 7 */
+	const __m256i order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+
+	if (!planar_get_rb_offsets(SrcFormat, &red, &blue, &hasAlpha))
+		return generic->planarSplit_8u_AC4P4(pSrc, SrcFormat, srcStep, pDst, width, height);
+
+	if (srcStep == 0)
+		srcStep = width * 4;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pRow = &pSrc[srcStep * (height - y - 1)];
+
+		for (x = 0; x + 32 <= width; x += 32)
+		{
+			__m256i s0, s1, s2, s3, t0, t1, t2, t3, c0, c2;
+			s0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) &pRow[x * 4]),
+			                         deinterleave);
+			s1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) &pRow[x * 4 + 32]),
+			                         deinterleave);
+			s2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) &pRow[x * 4 + 64]),
+			                         deinterleave);
+			s3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) &pRow[x * 4 + 96]),
+			                         deinterleave);
+			t0 = _mm256_unpacklo_epi32(s0, s1);
+			t1 = _mm256_unpackhi_epi32(s0, s1);
+			t2 = _mm256_unpacklo_epi32(s2, s3);
+			t3 = _mm256_unpackhi_epi32(s2, s3);
+			c0 = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t2), order);
+			c2 = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t1, t3), order);
+			_mm256_storeu_si256((__m256i*) &pDst[0][k + x], (red == 0) ? c0 : c2);
+			_mm256_storeu_si256((__m256i*) &pDst[1][k + x],
+			                    _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t0, t2), order));
+			_mm256_storeu_si256((__m256i*) &pDst[2][k + x], (blue == 0) ? c0 : c2);
+			_mm256_storeu_si256((__m256i*) &pDst[3][k + x], hasAlpha ?
+			                    _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t1, t3), order) :
+			                    opaque);
+		}
+
+		planar_split_row_scalar(&pRow[x * 4], pDst, k + x, width - x, red, blue, hasAlpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_planarCombine_8u_P4AC4R(
+    const BYTE* pSrc[4],
+    BYTE* pDst, UINT32 DstFormat, UINT32 dstStep,
+    UINT32 width, UINT32 height, BOOL alpha, BOOL vFlip)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+	const __m256i opaque = _mm256_set1_epi8((char) 0xFF);
+
+	if (!planar_get_rb_offsets(DstFormat, &red, &blue, &hasAlpha))
+		return generic->planarCombine_8u_P4AC4R(pSrc, pDst, DstFormat, dstStep, width,
+		                                        height, alpha, vFlip);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* pRow = &pDst[dstStep * (vFlip ? (height - y - 1) : y)];
+
+		for (x = 0; x + 32 <= width; x += 32)
+		{
+			__m256i r, g, b, a, c0, c2, c0g, c2a, p0, p1;
+			/* move bytes 8-15 into the low half of the second lane so the
+			 * in-lane unpacks produce the pixels in order */
+			r = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*) &pSrc[0][k + x]), 0xD8);
+			g = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*) &pSrc[1][k + x]), 0xD8);
+			b = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*) &pSrc[2][k + x]), 0xD8);
+			a = alpha ? _mm256_permute4x64_epi64(
+			        _mm256_loadu_si256((const __m256i*) &pSrc[3][k + x]), 0xD8) : opaque;
+			c0 = (red == 0) ? r : b;
+			c2 = (red == 0) ? b : r;
+			c0g = _mm256_unpacklo_epi8(c0, g);
+			c2a = _mm256_unpacklo_epi8(c2, a);
+			p0 = _mm256_unpacklo_epi16(c0g, c2a);
+			p1 = _mm256_unpackhi_epi16(c0g, c2a);
+			_mm256_storeu_si256((__m256i*) &pRow[x * 4], _mm256_permute2x128_si256(p0, p1, 0x20));
+			_mm256_storeu_si256((__m256i*) &pRow[x * 4 + 32], _mm256_permute2x128_si256(p0, p1, 0x31));
+			c0g = _mm256_unpackhi_epi8(c0, g);
+			c2a = _mm256_unpackhi_epi8(c2, a);
+			p0 = _mm256_unpacklo_epi16(c0g, c2a);
+			p1 = _mm256_unpackhi_epi16(c0g, c2a);
+			_mm256_storeu_si256((__m256i*) &pRow[x * 4 + 64], _mm256_permute2x128_si256(p0, p1, 0x20));
+			_mm256_storeu_si256((__m256i*) &pRow[x * 4 + 96], _mm256_permute2x128_si256(p0, p1, 0x31));
+		}
+
+		planar_combine_row_scalar(pSrc, k + x, &pRow[x * 4], width - x, red, blue, alpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_planarDeltaEncode_8u(
+    const BYTE* pSrc, BYTE* pDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 index;
+	const UINT32 size = width * height;
+	const __m256i zero = _mm256_setzero_si256();
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	CopyMemory(pDst, pSrc, width);
+
+	for (index = width; index + 32 <= size; index += 32)
+	{
+		const __m256i cur = _mm256_loadu_si256((const __m256i*) &pSrc[index]);
+		const __m256i prev = _mm256_loadu_si256((const __m256i*) &pSrc[index - width]);
+		const __m256i delta = _mm256_sub_epi8(cur, prev);
+		const __m256i sign = _mm256_cmpgt_epi8(zero, delta);
+		_mm256_storeu_si256((__m256i*) &pDst[index],
+		                    _mm256_xor_si256(_mm256_add_epi8(delta, delta), sign));
+	}
+
+	planar_delta_encode_scalar(&pSrc[index], &pSrc[index - width], &pDst[index], size - index);
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_planarDeltaDecode_8u(
+    BYTE* pSrcDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i low7 = _mm256_set1_epi8(0x7F);
+
+	for (y = 1; y < height; y++)
+	{
+		BYTE* pRow = &pSrcDst[y * width];
+		const BYTE* pPrev = pRow - width;
+
+		for (x = 0; x + 32 <= width; x += 32)
+		{
+			const __m256i code = _mm256_loadu_si256((const __m256i*) &pRow[x]);
+			const __m256i prev = _mm256_loadu_si256((const __m256i*) &pPrev[x]);
+			const __m256i half = _mm256_and_si256(_mm256_srli_epi16(code, 1), low7);
+			const __m256i sign = _mm256_sub_epi8(zero, _mm256_and_si256(code, one));
+			_mm256_storeu_si256((__m256i*) &pRow[x],
+			                    _mm256_add_epi8(prev, _mm256_xor_si256(half, sign)));
+		}
+
+		planar_delta_decode_scalar(&pRow[x], &pPrev[x], width - x);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_planar_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->planarSplit_8u_AC4P4 = avx2_planarSplit_8u_AC4P4;
+	prims->planarCombine_8u_P4AC4R = avx2_planarCombine_8u_P4AC4R;
+	prims->planarDeltaEncode_8u = avx2_planarDeltaEncode_8u;
+	prims->planarDeltaDecode_8u = avx2_planarDeltaDecode_8u;
+}
+
+#endif /* WITH_AVX2 */
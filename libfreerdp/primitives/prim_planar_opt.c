@@ -0,0 +1,359 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized planar codec plane operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#elif defined(WITH_NEON)
+#include <arm_neon.h>
+#endif /* WITH_SSE2 else WITH_NEON */
+
+#include "prim_internal.h"
+#include "prim_planar.h"
+
+static primitives_t* generic = NULL;
+
+#ifdef WITH_SSE2
+/* ------------------------------------------------------------------------- */
+static pstatus_t ssse3_planarSplit_8u_AC4P4(
+    const BYTE* pSrc, UINT32 SrcFormat, UINT32 srcStep,
+    BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+	const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+	/* B0G0R0A0 B1G1R1A1 ... -> B0B1B2B3 G0G1G2G3 R0R1R2R3 A0A1A2A3 */
+	const __m128i deinterleave = _mm_set_epi8(15, 11, 7, 3, 14, 10, 6, 2,
+	                             13, 9, 5, 1, 12, 8, 4, 0);
+
+	if (!planar_get_rb_offsets(SrcFormat, &red, &blue, &hasAlpha))
+		return generic->planarSplit_8u_AC4P4(pSrc, SrcFormat, srcStep, pDst, width, height);
+
+	if (srcStep == 0)
+		srcStep = width * 4;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pRow = &pSrc[srcStep * (height - y - 1)];
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			__m128i s0, s1, s2, s3, t0, t1, t2, t3, c0, c2;
+			s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &pRow[x * 4]), deinterleave);
+			s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &pRow[x * 4 + 16]), deinterleave);
+			s2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &pRow[x * 4 + 32]), deinterleave);
+			s3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &pRow[x * 4 + 48]), deinterleave);
+			t0 = _mm_unpacklo_epi32(s0, s1);
+			t1 = _mm_unpackhi_epi32(s0, s1);
+			t2 = _mm_unpacklo_epi32(s2, s3);
+			t3 = _mm_unpackhi_epi32(s2, s3);
+			c0 = _mm_unpacklo_epi64(t0, t2);
+			c2 = _mm_unpacklo_epi64(t1, t3);
+			_mm_storeu_si128((__m128i*) &pDst[0][k + x], (red == 0) ? c0 : c2);
+			_mm_storeu_si128((__m128i*) &pDst[1][k + x], _mm_unpackhi_epi64(t0, t2));
+			_mm_storeu_si128((__m128i*) &pDst[2][k + x], (blue == 0) ? c0 : c2);
+			_mm_storeu_si128((__m128i*) &pDst[3][k + x],
+			                 hasAlpha ? _mm_unpackhi_epi64(t1, t3) : opaque);
+		}
+
+		planar_split_row_scalar(&pRow[x * 4], pDst, k + x, width - x, red, blue, hasAlpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_planarCombine_8u_P4AC4R(
+    const BYTE* pSrc[4],
+    BYTE* pDst, UINT32 DstFormat, UINT32 dstStep,
+    UINT32 width, UINT32 height, BOOL alpha, BOOL vFlip)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+	const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+	if (!planar_get_rb_offsets(DstFormat, &red, &blue, &hasAlpha))
+		return generic->planarCombine_8u_P4AC4R(pSrc, pDst, DstFormat, dstStep, width,
+		                                        height, alpha, vFlip);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* pRow = &pDst[dstStep * (vFlip ? (height - y - 1) : y)];
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			__m128i r, g, b, a, c0, c2, c0g, c2a;
+			r = _mm_loadu_si128((const __m128i*) &pSrc[0][k + x]);
+			g = _mm_loadu_si128((const __m128i*) &pSrc[1][k + x]);
+			b = _mm_loadu_si128((const __m128i*) &pSrc[2][k + x]);
+			a = alpha ? _mm_loadu_si128((const __m128i*) &pSrc[3][k + x]) : opaque;
+			c0 = (red == 0) ? r : b;
+			c2 = (red == 0) ? b : r;
+			c0g = _mm_unpacklo_epi8(c0, g);
+			c2a = _mm_unpacklo_epi8(c2, a);
+			_mm_storeu_si128((__m128i*) &pRow[x * 4], _mm_unpacklo_epi16(c0g, c2a));
+			_mm_storeu_si128((__m128i*) &pRow[x * 4 + 16], _mm_unpackhi_epi16(c0g, c2a));
+			c0g = _mm_unpackhi_epi8(c0, g);
+			c2a = _mm_unpackhi_epi8(c2, a);
+			_mm_storeu_si128((__m128i*) &pRow[x * 4 + 32], _mm_unpacklo_epi16(c0g, c2a));
+			_mm_storeu_si128((__m128i*) &pRow[x * 4 + 48], _mm_unpackhi_epi16(c0g, c2a));
+		}
+
+		planar_combine_row_scalar(pSrc, k + x, &pRow[x * 4], width - x, red, blue, alpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_planarDeltaEncode_8u(
+    const BYTE* pSrc, BYTE* pDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 index;
+	const UINT32 size = width * height;
+	const __m128i zero = _mm_setzero_si128();
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	CopyMemory(pDst, pSrc, width);
+
+	/* every byte only depends on the source, the rows can be processed as one run */
+	for (index = width; index + 16 <= size; index += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*) &pSrc[index]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*) &pSrc[index - width]);
+		const __m128i delta = _mm_sub_epi8(cur, prev);
+		const __m128i sign = _mm_cmpgt_epi8(zero, delta);
+		_mm_storeu_si128((__m128i*) &pDst[index],
+		                 _mm_xor_si128(_mm_add_epi8(delta, delta), sign));
+	}
+
+	planar_delta_encode_scalar(&pSrc[index], &pSrc[index - width], &pDst[index], size - index);
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_planarDeltaDecode_8u(
+    BYTE* pSrcDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i low7 = _mm_set1_epi8(0x7F);
+
+	for (y = 1; y < height; y++)
+	{
+		BYTE* pRow = &pSrcDst[y * width];
+		const BYTE* pPrev = pRow - width;
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			const __m128i code = _mm_loadu_si128((const __m128i*) &pRow[x]);
+			const __m128i prev = _mm_loadu_si128((const __m128i*) &pPrev[x]);
+			const __m128i half = _mm_and_si128(_mm_srli_epi16(code, 1), low7);
+			const __m128i sign = _mm_sub_epi8(zero, _mm_and_si128(code, one));
+			_mm_storeu_si128((__m128i*) &pRow[x],
+			                 _mm_add_epi8(prev, _mm_xor_si128(half, sign)));
+		}
+
+		planar_delta_decode_scalar(&pRow[x], &pPrev[x], width - x);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_SSE2 */
+
+#ifdef WITH_NEON
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_planarSplit_8u_AC4P4(
+    const BYTE* pSrc, UINT32 SrcFormat, UINT32 srcStep,
+    BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+	const uint8x16_t opaque = vdupq_n_u8(0xFF);
+
+	if (!planar_get_rb_offsets(SrcFormat, &red, &blue, &hasAlpha))
+		return generic->planarSplit_8u_AC4P4(pSrc, SrcFormat, srcStep, pDst, width, height);
+
+	if (srcStep == 0)
+		srcStep = width * 4;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pRow = &pSrc[srcStep * (height - y - 1)];
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			const uint8x16x4_t px = vld4q_u8(&pRow[x * 4]);
+			vst1q_u8(&pDst[0][k + x], px.val[red]);
+			vst1q_u8(&pDst[1][k + x], px.val[1]);
+			vst1q_u8(&pDst[2][k + x], px.val[blue]);
+			vst1q_u8(&pDst[3][k + x], hasAlpha ? px.val[3] : opaque);
+		}
+
+		planar_split_row_scalar(&pRow[x * 4], pDst, k + x, width - x, red, blue, hasAlpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_planarCombine_8u_P4AC4R(
+    const BYTE* pSrc[4],
+    BYTE* pDst, UINT32 DstFormat, UINT32 dstStep,
+    UINT32 width, UINT32 height, BOOL alpha, BOOL vFlip)
+{
+	UINT32 x, y;
+	UINT32 red, blue;
+	BOOL hasAlpha;
+	UINT32 k = 0;
+
+	if (!planar_get_rb_offsets(DstFormat, &red, &blue, &hasAlpha))
+		return generic->planarCombine_8u_P4AC4R(pSrc, pDst, DstFormat, dstStep, width,
+		                                        height, alpha, vFlip);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* pRow = &pDst[dstStep * (vFlip ? (height - y - 1) : y)];
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			uint8x16x4_t px;
+			px.val[red] = vld1q_u8(&pSrc[0][k + x]);
+			px.val[1] = vld1q_u8(&pSrc[1][k + x]);
+			px.val[blue] = vld1q_u8(&pSrc[2][k + x]);
+			px.val[3] = alpha ? vld1q_u8(&pSrc[3][k + x]) : vdupq_n_u8(0xFF);
+			vst4q_u8(&pRow[x * 4], px);
+		}
+
+		planar_combine_row_scalar(pSrc, k + x, &pRow[x * 4], width - x, red, blue, alpha);
+		k += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_planarDeltaEncode_8u(
+    const BYTE* pSrc, BYTE* pDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 index;
+	const UINT32 size = width * height;
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	CopyMemory(pDst, pSrc, width);
+
+	for (index = width; index + 16 <= size; index += 16)
+	{
+		const uint8x16_t delta = vsubq_u8(vld1q_u8(&pSrc[index]), vld1q_u8(&pSrc[index - width]));
+		const uint8x16_t sign = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(delta), 7));
+		vst1q_u8(&pDst[index], veorq_u8(vshlq_n_u8(delta, 1), sign));
+	}
+
+	planar_delta_encode_scalar(&pSrc[index], &pSrc[index - width], &pDst[index], size - index);
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_planarDeltaDecode_8u(
+    BYTE* pSrcDst,
+    UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	const uint8x16_t one = vdupq_n_u8(1);
+
+	for (y = 1; y < height; y++)
+	{
+		BYTE* pRow = &pSrcDst[y * width];
+		const BYTE* pPrev = pRow - width;
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			const uint8x16_t code = vld1q_u8(&pRow[x]);
+			const uint8x16_t sign = vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(
+			                            vandq_u8(code, one))));
+			const uint8x16_t delta = veorq_u8(vshrq_n_u8(code, 1), sign);
+			vst1q_u8(&pRow[x], vaddq_u8(vld1q_u8(&pPrev[x]), delta));
+		}
+
+		planar_delta_decode_scalar(&pRow[x], &pPrev[x], width - x);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_NEON */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_planar_opt(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	primitives_init_planar(prims);
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->planarCombine_8u_P4AC4R = sse2_planarCombine_8u_P4AC4R;
+		prims->planarDeltaEncode_8u = sse2_planarDeltaEncode_8u;
+		prims->planarDeltaDecode_8u = sse2_planarDeltaDecode_8u;
+	}
+
+	if (IsProcessorFeaturePresentEx(PF_EX_SSSE3)
+	    && IsProcessorFeaturePresent(PF_SSE3_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->planarSplit_8u_AC4P4 = ssse3_planarSplit_8u_AC4P4;
+	}
+
+#if defined(WITH_AVX2)
+
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		primitives_init_planar_avx2(prims);
+
+#endif
+#elif defined(WITH_NEON)
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->planarSplit_8u_AC4P4 = neon_planarSplit_8u_AC4P4;
+		prims->planarCombine_8u_P4AC4R = neon_planarCombine_8u_P4AC4R;
+		prims->planarDeltaEncode_8u = neon_planarDeltaEncode_8u;
+		prims->planarDeltaDecode_8u = neon_planarDeltaDecode_8u;
+	}
+
+#endif
+}
@@ -45,6 +45,8 @@ static void primitives_init_generic(void)
 	primitives_init_colors(&pPrimitivesGeneric);
 	primitives_init_YCoCg(&pPrimitivesGeneric);
 	primitives_init_YUV(&pPrimitivesGeneric);
+	primitives_init_planar(&pPrimitivesGeneric);
+	primitives_init_convert(&pPrimitivesGeneric);
 	pPrimitivesGenericInitialized = TRUE;
 }
 
@@ -61,6 +63,8 @@ static void primitives_init(void)
 	primitives_init_colors_opt(&pPrimitives);
 	primitives_init_YCoCg_opt(&pPrimitives);
 	primitives_init_YUV_opt(&pPrimitives);
+	primitives_init_planar_opt(&pPrimitives);
+	primitives_init_convert_opt(&pPrimitives);
 	pPrimitivesInitialized = TRUE;
 }
 
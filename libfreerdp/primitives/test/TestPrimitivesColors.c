@@ -18,6 +18,7 @@
 
 #include <winpr/sysinfo.h>
 #include "prim_test.h"
+#include "../prim_internal.h"
 
 static const int RGB_TRIAL_ITERATIONS = 1000;
 static const int YCBCR_TRIAL_ITERATIONS = 1000;
@@ -214,6 +215,89 @@ static int test_yCbCrToRGB_16s16s_P3P3_speed(void)
 	return TRUE;
 }
 
+#if defined(WITH_SSE2) && defined(WITH_AVX2)
+/* ------------------------------------------------------------------------- */
+/* The AVX2 color conversions must match the SSE2 ones bit for bit, both
+ * differ from the generic code in the rounding of the last bit. */
+static BOOL test_colors_avx2_func(void)
+{
+	const UINT32 widths[] = { 8, 16, 33, 64 };
+	INT16 ALIGN(src[3][4096]);
+	INT16 ALIGN(dst1[3][4096]);
+	INT16 ALIGN(dst2[3][4096]);
+	const INT16* in[3];
+	INT16* out1[3];
+	INT16* out2[3];
+	primitives_t sse2;
+	primitives_t avx2;
+	size_t i, w;
+
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return TRUE;
+
+	sse2 = *generic;
+	primitives_init_colors_sse2(&sse2);
+	avx2 = sse2;
+	primitives_init_colors_avx2(&avx2);
+
+	for (i = 0; i < 3; i++)
+	{
+		in[i] = src[i];
+		out1[i] = dst1[i];
+		out2[i] = dst2[i];
+	}
+
+	for (w = 0; w < ARRAYSIZE(widths); w++)
+	{
+		prim_size_t roi = { widths[w], 64 };
+		winpr_RAND((BYTE*)src, sizeof(src));
+
+		/* signed 11.5 fixed radix, not only multiples of 32 */
+		for (i = 0; i < 4096; ++i)
+		{
+			src[0][i] = (INT16)((src[0][i] & 0x1FFF) - 0x1000);
+			src[1][i] = (INT16)((src[1][i] & 0x1FFF) - 0x1000);
+			src[2][i] = (INT16)((src[2][i] & 0x1FFF) - 0x1000);
+		}
+
+		memset(dst1, 0, sizeof(dst1));
+		memset(dst2, 0, sizeof(dst2));
+
+		if ((sse2.yCbCrToRGB_16s16s_P3P3(in, 64 * 2, out1, 64 * 2, &roi) != PRIMITIVES_SUCCESS) ||
+		    (avx2.yCbCrToRGB_16s16s_P3P3(in, 64 * 2, out2, 64 * 2, &roi) != PRIMITIVES_SUCCESS))
+			return FALSE;
+
+		if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+		{
+			printf("yCbCrToRGB-AVX2 FAIL: width %u differs from SSE2\n", widths[w]);
+			return FALSE;
+		}
+
+		/* 8 bit samples converted in place, as the RemoteFX encoder does */
+		for (i = 0; i < 4096; ++i)
+		{
+			dst1[0][i] = dst2[0][i] = src[0][i] & 0x00FF;
+			dst1[1][i] = dst2[1][i] = src[1][i] & 0x00FF;
+			dst1[2][i] = dst2[2][i] = src[2][i] & 0x00FF;
+		}
+
+		if ((sse2.RGBToYCbCr_16s16s_P3P3((const INT16**) out1, 64 * 2, out1, 64 * 2,
+		                                 &roi) != PRIMITIVES_SUCCESS) ||
+		    (avx2.RGBToYCbCr_16s16s_P3P3((const INT16**) out2, 64 * 2, out2, 64 * 2,
+		                                 &roi) != PRIMITIVES_SUCCESS))
+			return FALSE;
+
+		if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+		{
+			printf("RGBToYCbCr-AVX2 FAIL: width %u differs from SSE2\n", widths[w]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+#endif
+
 int TestPrimitivesColors(int argc, char* argv[])
 {
 	prim_test_setup(FALSE);
@@ -230,6 +314,13 @@ int TestPrimitivesColors(int argc, char* argv[])
 	if (!test_yCbCrToRGB_16s16s_P3P3_func())
 		return 1;
 
+#if defined(WITH_SSE2) && defined(WITH_AVX2)
+
+	if (!test_colors_avx2_func())
+		return 1;
+
+#endif
+
 	if (g_TestPrimitivesPerformance)
 	{
 		if (!test_yCbCrToRGB_16s16s_P3P3_speed())
@@ -0,0 +1,238 @@
+/* test_convert.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include <freerdp/codec/color.h>
+#include "prim_test.h"
+
+/* odd sizes exercise the scalar tails of the vectorized versions */
+static const UINT32 test_widths[] = { 1, 5, 6, 7, 8, 16, 33, 97 };
+static const UINT32 test_height = 5;
+static const UINT32 test_formats[] =
+{
+	PIXEL_FORMAT_ARGB32,
+	PIXEL_FORMAT_XRGB32,
+	PIXEL_FORMAT_ABGR32,
+	PIXEL_FORMAT_XBGR32,
+	PIXEL_FORMAT_BGRA32,
+	PIXEL_FORMAT_BGRX32,
+	PIXEL_FORMAT_RGBA32,
+	PIXEL_FORMAT_RGBX32,
+	PIXEL_FORMAT_RGB24,
+	PIXEL_FORMAT_BGR24,
+	PIXEL_FORMAT_RGB16,
+	PIXEL_FORMAT_BGR16,
+	PIXEL_FORMAT_ARGB15,
+	PIXEL_FORMAT_ABGR15,
+	PIXEL_FORMAT_RGB15,
+	PIXEL_FORMAT_BGR15
+};
+
+#define TEST_FORMAT_COUNT (sizeof(test_formats) / sizeof(test_formats[0]))
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_convert_func(void)
+{
+	UINT32 s, d, w, i;
+	BOOL rc = FALSE;
+	const UINT32 size = 97 * 4 * 5;
+	BYTE* src = malloc(size);
+	BYTE* d1 = malloc(size);
+	BYTE* d2 = malloc(size);
+
+	if (!src || !d1 || !d2)
+		goto fail;
+
+	winpr_RAND(src, size);
+
+	for (s = 0; s < TEST_FORMAT_COUNT; s++)
+	{
+		for (d = 0; d < TEST_FORMAT_COUNT; d++)
+		{
+			const UINT32 SrcFormat = test_formats[s];
+			const UINT32 DstFormat = test_formats[d];
+
+			for (w = 0; w < sizeof(test_widths) / sizeof(test_widths[0]); w++)
+			{
+				for (i = 0; i < 2; i++)
+				{
+					const UINT32 width = test_widths[w];
+					const INT32 srcStep = (INT32)(width * GetBytesPerPixel(SrcFormat));
+					const INT32 dstStep = (INT32)(width * GetBytesPerPixel(DstFormat));
+					/* the second pass walks the destination bottom up */
+					const BOOL vFlip = (i == 1) ? TRUE : FALSE;
+					const UINT32 dstOffset = vFlip ? (test_height - 1) * dstStep : 0;
+					memset(d1, 0xA5, size);
+					memset(d2, 0xA5, size);
+
+					if (generic->convertPixels_8u(src, SrcFormat, srcStep, &d1[dstOffset], DstFormat,
+					                              vFlip ? -dstStep : dstStep, width,
+					                              test_height) != PRIMITIVES_SUCCESS)
+						goto fail;
+
+					if (optimized->convertPixels_8u(src, SrcFormat, srcStep, &d2[dstOffset], DstFormat,
+					                                vFlip ? -dstStep : dstStep, width,
+					                                test_height) != PRIMITIVES_SUCCESS)
+						goto fail;
+
+					if (memcmp(d1, d2, size) != 0)
+					{
+						printf("convertPixels_8u mismatch: %s -> %s width %u vFlip %d\n",
+						       GetColorFormatName(SrcFormat), GetColorFormatName(DstFormat),
+						       (unsigned) width, vFlip);
+						goto fail;
+					}
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(d1);
+	free(d2);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_convert_image_copy(void)
+{
+	UINT32 x, y, i;
+	BOOL rc = FALSE;
+	const UINT32 width = 37;
+	const UINT32 height = 11;
+	const UINT32 srcStep = 40 * 2;
+	const UINT32 dstStep = 45 * 4;
+	BYTE* src = malloc(srcStep * height);
+	BYTE* dst = malloc(dstStep * (height + 3));
+
+	if (!src || !dst)
+		goto fail;
+
+	winpr_RAND(src, srcStep * height);
+
+	for (i = 0; i < 2; i++)
+	{
+		const UINT32 flags = (i == 1) ? FREERDP_FLIP_VERTICAL : FREERDP_FLIP_NONE;
+		memset(dst, 0, dstStep * (height + 3));
+
+		if (!freerdp_image_copy(dst, PIXEL_FORMAT_BGRA32, dstStep, 5, 3, width - 2, height,
+		                        src, PIXEL_FORMAT_RGB16, srcStep, 2, 0, NULL, flags))
+			goto fail;
+
+		for (y = 0; y < height; y++)
+		{
+			const UINT32 srcY = (flags & FREERDP_FLIP_VERTICAL) ? height - y - 1 : y;
+
+			for (x = 0; x < width - 2; x++)
+			{
+				const UINT32 color = ReadColor(&src[srcY * srcStep + (x + 2) * 2],
+				                               PIXEL_FORMAT_RGB16);
+				const UINT32 expect = ConvertColor(color, PIXEL_FORMAT_RGB16,
+				                                   PIXEL_FORMAT_BGRA32, NULL);
+
+				if (ReadColor(&dst[(y + 3) * dstStep + (x + 5) * 4], PIXEL_FORMAT_BGRA32) != expect)
+				{
+					printf("freerdp_image_copy mismatch at %u,%u flags %u\n",
+					       (unsigned) x, (unsigned) y, (unsigned) flags);
+					goto fail;
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Times every pair of the format matrix and reports pixels per microsecond */
+static BOOL test_convert_speed(void)
+{
+	UINT32 s, d, i;
+	BOOL rc = FALSE;
+	const UINT32 width = 1024;
+	const UINT32 height = 768;
+	const UINT32 iterations = 10;
+	BYTE* src = malloc(width * height * 4);
+	BYTE* dst = malloc(width * height * 4);
+
+	if (!src || !dst)
+		goto fail;
+
+	winpr_RAND(src, width * height * 4);
+
+	for (s = 0; s < TEST_FORMAT_COUNT; s++)
+	{
+		for (d = 0; d < TEST_FORMAT_COUNT; d++)
+		{
+			const UINT32 SrcFormat = test_formats[s];
+			const UINT32 DstFormat = test_formats[d];
+			const INT32 srcStep = (INT32)(width * GetBytesPerPixel(SrcFormat));
+			const INT32 dstStep = (INT32)(width * GetBytesPerPixel(DstFormat));
+			UINT64 start, genericTicks, optimizedTicks;
+			start = GetTickCount64();
+
+			for (i = 0; i < iterations; i++)
+				generic->convertPixels_8u(src, SrcFormat, srcStep, dst, DstFormat, dstStep,
+				                          width, height);
+
+			genericTicks = GetTickCount64() - start;
+			start = GetTickCount64();
+
+			for (i = 0; i < iterations; i++)
+				optimized->convertPixels_8u(src, SrcFormat, srcStep, dst, DstFormat, dstStep,
+				                            width, height);
+
+			optimizedTicks = GetTickCount64() - start;
+			printf("%-20s -> %-20s generic %6.1f optimized %6.1f pixel/us\n",
+			       GetColorFormatName(SrcFormat), GetColorFormatName(DstFormat),
+			       (double)(width * height * iterations) / (genericTicks ? genericTicks : 1) / 1000.0,
+			       (double)(width * height * iterations) / (optimizedTicks ? optimizedTicks : 1) / 1000.0);
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+int TestPrimitivesConvert(int argc, char* argv[])
+{
+	/* TestPrimitives TestPrimitivesConvert benchmark */
+	prim_test_setup((argc > 1) && (strcmp(argv[1], "benchmark") == 0));
+
+	if (!test_convert_func())
+		return 1;
+
+	if (!test_convert_image_copy())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_convert_speed())
+			return 1;
+	}
+
+	return 0;
+}
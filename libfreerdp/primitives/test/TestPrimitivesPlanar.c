@@ -0,0 +1,256 @@
+/* test_planar.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include <freerdp/codec/color.h>
+#include "prim_test.h"
+
+/* odd sizes exercise the scalar tails of the vectorized versions */
+static const UINT32 test_widths[] = { 1, 7, 16, 33, 64, 97, 130 };
+static const UINT32 test_height = 5;
+static const UINT32 test_formats[] =
+{
+	PIXEL_FORMAT_BGRX32,
+	PIXEL_FORMAT_BGRA32,
+	PIXEL_FORMAT_RGBA32,
+	PIXEL_FORMAT_RGBX32
+};
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_planar_split_func(void)
+{
+	UINT32 w, f, i;
+	BOOL rc = FALSE;
+	const UINT32 size = 130 * 5;
+	BYTE* src = malloc(size * 4);
+	BYTE* d1 = malloc(size * 4);
+	BYTE* d2 = malloc(size * 4);
+
+	if (!src || !d1 || !d2)
+		goto fail;
+
+	winpr_RAND(src, size * 4);
+
+	for (f = 0; f < sizeof(test_formats) / sizeof(test_formats[0]); f++)
+	{
+		for (w = 0; w < sizeof(test_widths) / sizeof(test_widths[0]); w++)
+		{
+			const UINT32 width = test_widths[w];
+			BYTE* p1[4];
+			BYTE* p2[4];
+
+			for (i = 0; i < 4; i++)
+			{
+				p1[i] = &d1[i * size];
+				p2[i] = &d2[i * size];
+			}
+
+			memset(d1, 0, size * 4);
+			memset(d2, 0, size * 4);
+
+			if (generic->planarSplit_8u_AC4P4(src, test_formats[f], 0, p1, width,
+			                                  test_height) != PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (optimized->planarSplit_8u_AC4P4(src, test_formats[f], 0, p2, width,
+			                                    test_height) != PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (memcmp(d1, d2, size * 4) != 0)
+			{
+				printf("planarSplit_8u_AC4P4 mismatch: format %s width %u\n",
+				       GetColorFormatName(test_formats[f]), (unsigned) width);
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(d1);
+	free(d2);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_planar_combine_func(void)
+{
+	UINT32 w, f, i;
+	BOOL rc = FALSE;
+	const UINT32 size = 130 * 5;
+	BYTE* src = malloc(size * 4);
+	BYTE* d1 = malloc(size * 4);
+	BYTE* d2 = malloc(size * 4);
+
+	if (!src || !d1 || !d2)
+		goto fail;
+
+	winpr_RAND(src, size * 4);
+
+	for (f = 0; f < sizeof(test_formats) / sizeof(test_formats[0]); f++)
+	{
+		for (w = 0; w < sizeof(test_widths) / sizeof(test_widths[0]); w++)
+		{
+			for (i = 0; i < 4; i++)
+			{
+				const UINT32 width = test_widths[w];
+				const BOOL alpha = (i & 1) ? TRUE : FALSE;
+				const BOOL vFlip = (i & 2) ? TRUE : FALSE;
+				const BYTE* planes[4] =
+				{
+					&src[0 * size], &src[1 * size], &src[2 * size],
+					alpha ? &src[3 * size] : NULL
+				};
+				memset(d1, 0, size * 4);
+				memset(d2, 0, size * 4);
+
+				if (generic->planarCombine_8u_P4AC4R(planes, d1, test_formats[f], width * 4,
+				                                     width, test_height, alpha,
+				                                     vFlip) != PRIMITIVES_SUCCESS)
+					goto fail;
+
+				if (optimized->planarCombine_8u_P4AC4R(planes, d2, test_formats[f], width * 4,
+				                                       width, test_height, alpha,
+				                                       vFlip) != PRIMITIVES_SUCCESS)
+					goto fail;
+
+				if (memcmp(d1, d2, size * 4) != 0)
+				{
+					printf("planarCombine_8u_P4AC4R mismatch: format %s width %u alpha %d vFlip %d\n",
+					       GetColorFormatName(test_formats[f]), (unsigned) width, alpha, vFlip);
+					goto fail;
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(d1);
+	free(d2);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_planar_delta_func(void)
+{
+	UINT32 w;
+	BYTE ALIGN(src[130 * 5]);
+	BYTE ALIGN(d1[130 * 5]);
+	BYTE ALIGN(d2[130 * 5]);
+
+	winpr_RAND(src, sizeof(src));
+
+	for (w = 0; w < sizeof(test_widths) / sizeof(test_widths[0]); w++)
+	{
+		const UINT32 width = test_widths[w];
+		const UINT32 size = width * test_height;
+
+		if (generic->planarDeltaEncode_8u(src, d1, width, test_height) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		if (optimized->planarDeltaEncode_8u(src, d2, width, test_height) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		if (memcmp(d1, d2, size) != 0)
+		{
+			printf("planarDeltaEncode_8u mismatch: width %u\n", (unsigned) width);
+			return FALSE;
+		}
+
+		if (generic->planarDeltaDecode_8u(d1, width, test_height) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		if (optimized->planarDeltaDecode_8u(d2, width, test_height) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		if ((memcmp(d1, src, size) != 0) || (memcmp(d2, src, size) != 0))
+		{
+			printf("planarDeltaDecode_8u mismatch: width %u\n", (unsigned) width);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_planar_speed(void)
+{
+	BYTE ALIGN(src[MAX_TEST_SIZE * 4]);
+	BYTE ALIGN(dst[MAX_TEST_SIZE * 4]);
+	const BYTE* planes[4] =
+	{
+		&src[0], &src[MAX_TEST_SIZE], &src[MAX_TEST_SIZE * 2], &src[MAX_TEST_SIZE * 3]
+	};
+	BYTE* dstPlanes[4] =
+	{
+		&dst[0], &dst[MAX_TEST_SIZE], &dst[MAX_TEST_SIZE * 2], &dst[MAX_TEST_SIZE * 3]
+	};
+	winpr_RAND(src, sizeof(src));
+
+	if (!speed_test("planarSplit_8u_AC4P4", "BGRA32", g_Iterations,
+	                (speed_test_fkt)generic->planarSplit_8u_AC4P4,
+	                (speed_test_fkt)optimized->planarSplit_8u_AC4P4,
+	                src, PIXEL_FORMAT_BGRA32, 0, dstPlanes, 64, MAX_TEST_SIZE / 64))
+		return FALSE;
+
+	if (!speed_test("planarCombine_8u_P4AC4R", "BGRA32", g_Iterations,
+	                (speed_test_fkt)generic->planarCombine_8u_P4AC4R,
+	                (speed_test_fkt)optimized->planarCombine_8u_P4AC4R,
+	                planes, dst, PIXEL_FORMAT_BGRA32, 64 * 4, 64, MAX_TEST_SIZE / 64,
+	                TRUE, FALSE))
+		return FALSE;
+
+	if (!speed_test("planarDeltaEncode_8u", "", g_Iterations,
+	                (speed_test_fkt)generic->planarDeltaEncode_8u,
+	                (speed_test_fkt)optimized->planarDeltaEncode_8u,
+	                src, dst, 64, MAX_TEST_SIZE / 64))
+		return FALSE;
+
+	if (!speed_test("planarDeltaDecode_8u", "", g_Iterations,
+	                (speed_test_fkt)generic->planarDeltaDecode_8u,
+	                (speed_test_fkt)optimized->planarDeltaDecode_8u,
+	                dst, 64, MAX_TEST_SIZE / 64))
+		return FALSE;
+
+	return TRUE;
+}
+
+int TestPrimitivesPlanar(int argc, char* argv[])
+{
+	prim_test_setup(FALSE);
+
+	if (!test_planar_split_func())
+		return 1;
+
+	if (!test_planar_combine_func())
+		return 1;
+
+	if (!test_planar_delta_func())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_planar_speed())
+			return 1;
+	}
+
+	return 0;
+}
@@ -24,11 +24,299 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/environment.h>
+#include <winpr/interlocked.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 #include <freerdp/utils/profiler.h>
 #include <freerdp/log.h>
 
 #define TAG FREERDP_TAG("utils")
 
+struct _PROFILER_TRACE_EVENT
+{
+	const char* name;
+	UINT64 start;
+	UINT64 duration;
+};
+typedef struct _PROFILER_TRACE_EVENT PROFILER_TRACE_EVENT;
+
+/**
+ * Each thread records into its own buffer, only the dump takes the lock.
+ * Buffers outlive their threads so that a dump still covers them. The
+ * owner publishes count with an interlocked store once an event is
+ * complete, the dump reads it the same way.
+ */
+struct _PROFILER_TRACE_BUFFER
+{
+	DWORD threadId;
+	LONG volatile count;
+	UINT32 depth;
+	const char* scopeName[PROFILER_TRACE_DEPTH];
+	UINT64 scopeStart[PROFILER_TRACE_DEPTH];
+	PROFILER_TRACE_EVENT events[PROFILER_TRACE_EVENTS];
+	struct _PROFILER_TRACE_BUFFER* next;
+};
+typedef struct _PROFILER_TRACE_BUFFER PROFILER_TRACE_BUFFER;
+
+static INIT_ONCE profilerTraceOnce = INIT_ONCE_STATIC_INIT;
+static volatile LONG profilerTraceState = -1;
+static DWORD profilerTraceTls = TLS_OUT_OF_INDEXES;
+static CRITICAL_SECTION profilerTraceLock;
+static PROFILER_TRACE_BUFFER* profilerTraceBuffers = NULL;
+static UINT64 profilerTraceEpoch = 0;
+static char* profilerTraceFile = NULL;
+
+/* monotonic time in nanoseconds */
+static UINT64 profiler_trace_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (!QueryPerformanceFrequency(&frequency) || !QueryPerformanceCounter(&counter))
+		return GetTickCount64() * 1000000;
+
+	return (UINT64)((counter.QuadPart / frequency.QuadPart) * 1000000000 +
+	                ((counter.QuadPart % frequency.QuadPart) * 1000000000) / frequency.QuadPart);
+#else
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return GetTickCount64() * 1000000;
+
+	return ((UINT64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void profiler_trace_atexit(void)
+{
+	if (!profiler_trace_write(profilerTraceFile))
+		WLog_ERR(TAG, "failed to write profiler trace to %s", profilerTraceFile);
+}
+
+static BOOL CALLBACK profiler_trace_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	LONG state = 0;
+	DWORD length;
+	profilerTraceEpoch = profiler_trace_time();
+	InitializeCriticalSectionAndSpinCount(&profilerTraceLock, 4000);
+	profilerTraceTls = TlsAlloc();
+	length = GetEnvironmentVariableA("FREERDP_PROFILER_TRACE", NULL, 0);
+
+	if ((length > 1) && (profilerTraceTls != TLS_OUT_OF_INDEXES))
+	{
+		profilerTraceFile = (char*) malloc(length);
+
+		if (profilerTraceFile &&
+		    (GetEnvironmentVariableA("FREERDP_PROFILER_TRACE", profilerTraceFile, length) == length - 1))
+		{
+			atexit(profiler_trace_atexit);
+			state = 1;
+		}
+	}
+
+	InterlockedExchange(&profilerTraceState, state);
+	return TRUE;
+}
+
+BOOL profiler_trace_enabled(void)
+{
+	if (profilerTraceState < 0)
+		InitOnceExecuteOnce(&profilerTraceOnce, profiler_trace_init, NULL, NULL);
+
+	return (profilerTraceState > 0) ? TRUE : FALSE;
+}
+
+void profiler_trace_enable(BOOL enable)
+{
+	profiler_trace_enabled();
+
+	if (profilerTraceTls == TLS_OUT_OF_INDEXES)
+		return;
+
+	InterlockedExchange(&profilerTraceState, enable ? 1 : 0);
+}
+
+static PROFILER_TRACE_BUFFER* profiler_trace_buffer(void)
+{
+	PROFILER_TRACE_BUFFER* buffer = (PROFILER_TRACE_BUFFER*) TlsGetValue(profilerTraceTls);
+
+	if (buffer)
+		return buffer;
+
+	buffer = (PROFILER_TRACE_BUFFER*) calloc(1, sizeof(PROFILER_TRACE_BUFFER));
+
+	if (!buffer)
+		return NULL;
+
+	buffer->threadId = GetCurrentThreadId();
+
+	if (!TlsSetValue(profilerTraceTls, buffer))
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	EnterCriticalSection(&profilerTraceLock);
+	buffer->next = profilerTraceBuffers;
+	profilerTraceBuffers = buffer;
+	LeaveCriticalSection(&profilerTraceLock);
+	return buffer;
+}
+
+static BOOL profiler_trace_match(const char* scope, const char* name)
+{
+	if (scope == name)
+		return TRUE;
+
+	return (strcmp(scope, name) == 0) ? TRUE : FALSE;
+}
+
+void profiler_trace_begin(const char* name)
+{
+	PROFILER_TRACE_BUFFER* buffer;
+
+	if (!profiler_trace_enabled())
+		return;
+
+	if (!(buffer = profiler_trace_buffer()))
+		return;
+
+	/* scopes nested deeper than the stack are counted but not recorded */
+	if (buffer->depth < PROFILER_TRACE_DEPTH)
+	{
+		buffer->scopeName[buffer->depth] = name;
+		buffer->scopeStart[buffer->depth] = profiler_trace_time();
+	}
+
+	buffer->depth++;
+}
+
+void profiler_trace_end(const char* name)
+{
+	UINT32 depth;
+	UINT32 count;
+	PROFILER_TRACE_EVENT* event;
+	PROFILER_TRACE_BUFFER* buffer;
+
+	/* a scope begun before tracing was disabled is still closed */
+	if ((profilerTraceState < 0) || (profilerTraceTls == TLS_OUT_OF_INDEXES))
+		return;
+
+	buffer = (PROFILER_TRACE_BUFFER*) TlsGetValue(profilerTraceTls);
+
+	if (!buffer || (buffer->depth == 0))
+		return;
+
+	if (buffer->depth > PROFILER_TRACE_DEPTH)
+	{
+		buffer->depth--;
+		return;
+	}
+
+	/* an end without a begin (tracing was off) is ignored */
+	depth = buffer->depth - 1;
+
+	if (!profiler_trace_match(buffer->scopeName[depth], name))
+		return;
+
+	count = (UINT32) buffer->count;
+	event = &buffer->events[count % PROFILER_TRACE_EVENTS];
+	event->name = name;
+	event->start = buffer->scopeStart[depth];
+	event->duration = profiler_trace_time() - event->start;
+	buffer->depth = depth;
+	InterlockedExchange(&buffer->count, (LONG)(count + 1));
+}
+
+void profiler_trace_reset(void)
+{
+	PROFILER_TRACE_BUFFER* buffer;
+
+	if (profilerTraceState < 0)
+		return;
+
+	EnterCriticalSection(&profilerTraceLock);
+
+	for (buffer = profilerTraceBuffers; buffer; buffer = buffer->next)
+		InterlockedExchange(&buffer->count, 0);
+
+	LeaveCriticalSection(&profilerTraceLock);
+}
+
+/**
+ * Writes the recorded scopes in the Chrome trace event format, the file
+ * can be loaded in chrome://tracing or the Perfetto UI.
+ */
+BOOL profiler_trace_write(const char* filename)
+{
+	FILE* fp;
+	BOOL first = TRUE;
+	BOOL rc = TRUE;
+	PROFILER_TRACE_BUFFER* buffer;
+	const DWORD pid = GetCurrentProcessId();
+
+	if (!filename)
+		return FALSE;
+
+	profiler_trace_enabled();
+	fp = fopen(filename, "w");
+
+	if (!fp)
+		return FALSE;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	EnterCriticalSection(&profilerTraceLock);
+
+	for (buffer = profilerTraceBuffers; buffer; buffer = buffer->next)
+	{
+		UINT32 index;
+		UINT64 start;
+		PROFILER_TRACE_EVENT event;
+		const UINT32 count = (UINT32) InterlockedCompareExchange(&buffer->count, 0, 0);
+		/* the slot after the newest event is the next one its thread writes */
+		const UINT32 first_index = (count >= PROFILER_TRACE_EVENTS) ?
+		                           count - PROFILER_TRACE_EVENTS + 1 : 0;
+
+		for (index = first_index; index < count; index++)
+		{
+			event = buffer->events[index % PROFILER_TRACE_EVENTS];
+
+			/* skip an event its thread overwrote while it was copied */
+			if (((UINT32) InterlockedCompareExchange(&buffer->count, 0, 0) - index) >=
+			    PROFILER_TRACE_EVENTS)
+				continue;
+
+			/* timestamps are microseconds since the profiler was initialized */
+			start = (event.start > profilerTraceEpoch) ? event.start - profilerTraceEpoch : 0;
+
+			if (fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"freerdp\",\"ph\":\"X\","
+			            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu}",
+			            first ? "" : ",", event.name, start / 1000.0, event.duration / 1000.0,
+			            (unsigned long) pid, (unsigned long) buffer->threadId) < 0)
+				rc = FALSE;
+
+			first = FALSE;
+		}
+	}
+
+	LeaveCriticalSection(&profilerTraceLock);
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0)
+		rc = FALSE;
+
+	return rc;
+}
+
 PROFILER* profiler_create(char* name)
 {
 	PROFILER* profiler;
@@ -49,19 +337,27 @@ PROFILER* profiler_create(char* name)
 }
 
 void profiler_free(PROFILER* profiler)
-{	
+{
+	if (!profiler)
+		return;
+
 	stopwatch_free(profiler->stopwatch);
-	
 	free(profiler);
 }
 
 void profiler_enter(PROFILER* profiler)
 {
+	if (!profiler)
+		return;
+
 	stopwatch_start(profiler->stopwatch);
 }
 
 void profiler_exit(PROFILER* profiler)
 {
+	if (!profiler)
+		return;
+
 	stopwatch_stop(profiler->stopwatch);
 }
 
@@ -0,0 +1,179 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+#include <winpr/thread.h>
+
+#include <freerdp/utils/profiler.h>
+
+#define TEST_PROFILER_THREADS 4
+
+static char* test_profiler_read(const char* filename)
+{
+	FILE* fp;
+	long length;
+	char* data = NULL;
+
+	if (!(fp = fopen(filename, "rb")))
+		return NULL;
+
+	if ((fseek(fp, 0, SEEK_END) != 0) || ((length = ftell(fp)) < 0) ||
+	    (fseek(fp, 0, SEEK_SET) != 0))
+		goto out;
+
+	if (!(data = (char*) calloc(1, length + 1)))
+		goto out;
+
+	if (fread(data, 1, length, fp) != (size_t) length)
+	{
+		free(data);
+		data = NULL;
+	}
+
+out:
+	fclose(fp);
+	return data;
+}
+
+static UINT32 test_profiler_count(const char* data, const char* pattern)
+{
+	UINT32 count = 0;
+
+	while ((data = strstr(data, pattern)))
+	{
+		data += strlen(pattern);
+		count++;
+	}
+
+	return count;
+}
+
+static DWORD WINAPI test_profiler_thread(LPVOID arg)
+{
+	UINT32 i;
+
+	for (i = 0; i < 100; i++)
+	{
+		PROFILER_TRACE_BEGIN("test_thread");
+		PROFILER_TRACE_END("test_thread");
+	}
+
+	return 0;
+}
+
+static BOOL test_profiler_trace(const char* filename)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	char* data = NULL;
+	HANDLE threads[TEST_PROFILER_THREADS];
+	/* nothing is recorded while tracing is off */
+	profiler_trace_enable(FALSE);
+	PROFILER_TRACE_BEGIN("test_disabled");
+	PROFILER_TRACE_END("test_disabled");
+	profiler_trace_enable(TRUE);
+
+	if (!profiler_trace_enabled())
+		return FALSE;
+
+	PROFILER_TRACE_BEGIN("test_outer");
+	PROFILER_TRACE_BEGIN("test_inner");
+	PROFILER_TRACE_END("test_inner");
+	/* recursive scopes are recorded on every level */
+	PROFILER_TRACE_BEGIN("test_nested");
+	PROFILER_TRACE_BEGIN("test_nested");
+	PROFILER_TRACE_END("test_nested");
+	PROFILER_TRACE_END("test_nested");
+	/* an end without begin is ignored */
+	PROFILER_TRACE_END("test_unknown");
+	PROFILER_TRACE_END("test_outer");
+
+	for (i = 0; i < TEST_PROFILER_THREADS; i++)
+	{
+		if (!(threads[i] = CreateThread(NULL, 0, test_profiler_thread, NULL, 0, NULL)))
+			return FALSE;
+	}
+
+	for (i = 0; i < TEST_PROFILER_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	if (!profiler_trace_write(filename) || !(data = test_profiler_read(filename)))
+		goto fail;
+
+	if (strncmp(data, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39) != 0)
+		goto fail;
+
+	if ((test_profiler_count(data, "\"name\":\"test_outer\"") != 1) ||
+	    (test_profiler_count(data, "\"name\":\"test_inner\"") != 1) ||
+	    (test_profiler_count(data, "\"name\":\"test_nested\"") != 2) ||
+	    (test_profiler_count(data, "\"name\":\"test_thread\"") != TEST_PROFILER_THREADS * 100) ||
+	    strstr(data, "test_disabled") || strstr(data, "test_unknown"))
+	{
+		printf("unexpected trace: %s\n", data);
+		goto fail;
+	}
+
+	if (test_profiler_count(data, "\"ph\":\"X\"") != 4 + TEST_PROFILER_THREADS * 100)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(data);
+	return rc;
+}
+
+static BOOL test_profiler_wrap(const char* filename)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	char* data = NULL;
+	profiler_trace_reset();
+
+	/* only the latest events of a thread are kept */
+	for (i = 0; i < PROFILER_TRACE_EVENTS + 100; i++)
+	{
+		PROFILER_TRACE_BEGIN("test_wrap");
+		PROFILER_TRACE_END("test_wrap");
+	}
+
+	if (!profiler_trace_write(filename) || !(data = test_profiler_read(filename)))
+		goto fail;
+
+	/* the oldest slot is the next one written, it is left out of the dump */
+	if (test_profiler_count(data, "\"name\":\"test_wrap\"") != PROFILER_TRACE_EVENTS - 1)
+		goto fail;
+
+	if (strstr(data, "test_outer"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(data);
+	return rc;
+}
+
+int TestProfiler(int argc, char* argv[])
+{
+	int rc = -1;
+	char* filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestProfiler.json");
+
+	if (!filename)
+		return -1;
+
+	if (!test_profiler_trace(filename))
+		goto fail;
+
+	if (!test_profiler_wrap(filename))
+		goto fail;
+
+	rc = 0;
+fail:
+	profiler_trace_enable(FALSE);
+	DeleteFileA(filename);
+	free(filename);
+	return rc;
+}
@@ -37,6 +37,7 @@
 
 #include <freerdp/constants.h>
 #include <freerdp/server/rdpsnd.h>
+#include <freerdp/reactor.h>
 
 #include "sf_audin.h"
 #include "sf_rdpsnd.h"
@@ -53,6 +54,8 @@
 
 static char* test_pcap_file = NULL;
 static BOOL test_dump_rfx_realtime = TRUE;
+static rdpReactor* test_reactor = NULL;
+static BOOL test_dump_metrics = FALSE;
 
 BOOL test_peer_context_new(freerdp_peer* client, testPeerContext* context)
 {
@@ -747,19 +750,10 @@ static BOOL tf_peer_suppress_output(rdpContext* context, BYTE allow,
 	return TRUE;
 }
 
-static void* test_peer_mainloop(void* arg)
+static BOOL test_peer_setup(freerdp_peer* client)
 {
-	HANDLE handles[32];
-	DWORD count;
-	DWORD status;
-	testPeerContext* context;
-	freerdp_peer* client = (freerdp_peer*) arg;
-
 	if (!test_peer_init(client))
-	{
-		freerdp_peer_free(client);
-		return NULL;
-	}
+		return FALSE;
 
 	/* Initialize the real server settings here */
 	client->settings->CertificateFile = _strdup("server.crt");
@@ -770,8 +764,8 @@ static void* test_peer_mainloop(void* arg)
 	    || !client->settings->RdpKeyFile)
 	{
 		WLog_ERR(TAG, "Memory allocation failed (strdup)");
-		freerdp_peer_free(client);
-		return NULL;
+		freerdp_peer_context_free(client);
+		return FALSE;
 	}
 
 	client->settings->RdpSecurity = TRUE;
@@ -796,9 +790,32 @@ static void* test_peer_mainloop(void* arg)
 	client->update->SuppressOutput = tf_peer_suppress_output;
 	client->settings->MultifragMaxRequestSize = 0xFFFFFF; /* FIXME */
 	client->Initialize(client);
-	context = (testPeerContext*) client->context;
 	WLog_INFO(TAG, "We've got a client %s",
 	          client->local ? "(local)" : client->hostname);
+	return TRUE;
+}
+
+/* Prints the session metrics in Prometheus text format, --metrics */
+static void test_peer_print_metrics(freerdp_peer* client)
+{
+	char* dump;
+
+	if (!test_dump_metrics)
+		return;
+
+	if ((dump = metrics_dump_prometheus(client->context->metrics, NULL)))
+		printf("%s", dump);
+
+	free(dump);
+}
+
+static void* test_peer_mainloop(void* arg)
+{
+	HANDLE handles[32];
+	DWORD count;
+	DWORD status;
+	freerdp_peer* client = (freerdp_peer*) arg;
+	testPeerContext* context = (testPeerContext*) client->context;
 
 	while (1)
 	{
@@ -832,19 +849,57 @@ static void* test_peer_mainloop(void* arg)
 
 	WLog_INFO(TAG, "Client %s disconnected.",
 	          client->local ? "(local)" : client->hostname);
+	test_peer_print_metrics(client);
 	client->Disconnect(client);
 	freerdp_peer_context_free(client);
 	freerdp_peer_free(client);
 	return NULL;
 }
 
+static BOOL test_peer_check_channels(freerdp_peer* client, void* arg)
+{
+	testPeerContext* context = (testPeerContext*) client->context;
+	return WTSVirtualChannelManagerCheckFileDescriptor(context->vcm);
+}
+
+static void test_peer_closed(freerdp_peer* client, void* arg)
+{
+	WLog_INFO(TAG, "Client %s disconnected.",
+	          client->local ? "(local)" : client->hostname);
+	test_peer_print_metrics(client);
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+}
+
 static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
 {
 	HANDLE hThread;
+	HANDLE hChannels;
+
+	if (!test_peer_setup(client))
+		return FALSE;
+
+	if (test_reactor)
+	{
+		hChannels = WTSVirtualChannelManagerGetEventHandle(((testPeerContext*) client->context)->vcm);
+
+		if (!freerdp_reactor_add_peer(test_reactor, client, &hChannels, 1,
+		                              test_peer_check_channels, test_peer_closed, NULL))
+		{
+			freerdp_peer_context_free(client);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
 
 	if (!(hThread = CreateThread(NULL, 0,
 	                             (LPTHREAD_START_ROUTINE) test_peer_mainloop, (void*) client, 0, NULL)))
+	{
+		freerdp_peer_context_free(client);
 		return FALSE;
+	}
 
 	CloseHandle(hThread);
 	return TRUE;
@@ -892,6 +947,8 @@ int main(int argc, char* argv[])
 	char name[MAX_PATH];
 	int port = 3389, i;
 	BOOL localOnly = FALSE;
+	BOOL useReactor = FALSE;
+	DWORD reactorThreads = 0;
 
 	for (i = 1; i < argc; i++)
 	{
@@ -899,6 +956,15 @@ int main(int argc, char* argv[])
 
 		if (strncmp(arg, "--fast", 7) == 0)
 			test_dump_rfx_realtime = FALSE;
+		else if (strcmp(arg, "--metrics") == 0)
+			test_dump_metrics = TRUE;
+		else if (strncmp(arg, "--reactor", 9) == 0)
+		{
+			/* Serve all peers from a few event loop threads, --reactor=<threads> */
+			StrSep(&arg, "=");
+			reactorThreads = arg ? strtoul(arg, NULL, 10) : 0;
+			useReactor = TRUE;
+		}
 		else if (strncmp(arg, "--port=", 7) == 0)
 		{
 			StrSep(&arg, "=");
@@ -925,8 +991,15 @@ int main(int argc, char* argv[])
 
 	instance->PeerAccepted = test_peer_accepted;
 
+	if (useReactor && !(test_reactor = freerdp_reactor_new(reactorThreads)))
+	{
+		freerdp_listener_free(instance);
+		return -1;
+	}
+
 	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
 	{
+		freerdp_reactor_free(test_reactor);
 		freerdp_listener_free(instance);
 		return -1;
 	}
@@ -937,6 +1010,7 @@ int main(int argc, char* argv[])
 
 	if (!file)
 	{
+		freerdp_reactor_free(test_reactor);
 		freerdp_listener_free(instance);
 		WSACleanup();
 		return -1;
@@ -950,6 +1024,7 @@ int main(int argc, char* argv[])
 	}
 
 	free(file);
+	freerdp_reactor_free(test_reactor);
 	freerdp_listener_free(instance);
 	WSACleanup();
 	return 0;
@@ -39,6 +39,7 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/region.h>
+#include <freerdp/utils/profiler.h>
 
 #include "x11_shadow.h"
 
@@ -535,6 +536,21 @@ static int x11_shadow_handle_xevent(x11ShadowSubsystem* subsystem,
 		x11_shadow_query_cursor(subsystem, TRUE);
 	}
 
+#endif
+#ifdef WITH_XDAMAGE
+	else if (subsystem->use_xdamage &&
+	         (xevent->type == subsystem->xdamage_notify_event))
+	{
+		RECTANGLE_16 rect;
+		XDamageNotifyEvent* notify = (XDamageNotifyEvent*) xevent;
+		rect.left = notify->area.x;
+		rect.top = notify->area.y;
+		rect.right = notify->area.x + notify->area.width;
+		rect.bottom = notify->area.y + notify->area.height;
+		region16_union_rect(&(subsystem->damageRegion), &(subsystem->damageRegion),
+		                    &rect);
+	}
+
 #endif
 	else
 	{
@@ -543,26 +559,49 @@ static int x11_shadow_handle_xevent(x11ShadowSubsystem* subsystem,
 	return 1;
 }
 
-static void x11_shadow_validate_region(x11ShadowSubsystem* subsystem, int x,
-                                       int y,
-                                       int width, int height)
+static void x11_shadow_invalidate_screen(x11ShadowSubsystem* subsystem)
 {
-	XRectangle region;
+#ifdef WITH_XDAMAGE
+	RECTANGLE_16 rect;
 
-	if (!subsystem->use_xfixes || !subsystem->use_xdamage)
+	if (!subsystem->use_xdamage)
 		return;
 
-	region.x = x;
-	region.y = y;
-	region.width = width;
-	region.height = height;
-#ifdef WITH_XFIXES
-	XLockDisplay(subsystem->display);
-	XFixesSetRegion(subsystem->display, subsystem->xdamage_region, &region, 1);
-	XDamageSubtract(subsystem->display, subsystem->xdamage,
-	                subsystem->xdamage_region, None);
-	XUnlockDisplay(subsystem->display);
+	rect.left = 0;
+	rect.top = 0;
+	rect.right = subsystem->width;
+	rect.bottom = subsystem->height;
+	region16_union_rect(&(subsystem->damageRegion), &(subsystem->damageRegion),
+	                    &rect);
+#endif
+}
+
+/**
+ * Moves the damage accumulated so far into grabRegion, in surface
+ * coordinates. Without XDamage the whole surface has to be grabbed.
+ */
+static void x11_shadow_validate_region(x11ShadowSubsystem* subsystem,
+                                       REGION16* grabRegion,
+                                       rdpShadowSurface* surface)
+{
+	RECTANGLE_16 surfaceRect;
+	surfaceRect.left = 0;
+	surfaceRect.top = 0;
+	surfaceRect.right = surface->width;
+	surfaceRect.bottom = surface->height;
+#ifdef WITH_XDAMAGE
+
+	if (subsystem->use_xdamage)
+	{
+		/* Repair everything, later drawing is reported by new notify events */
+		XDamageSubtract(subsystem->display, subsystem->xdamage, None, None);
+		shadow_capture_damage_region(&(subsystem->damageRegion), surface, grabRegion);
+		region16_clear(&(subsystem->damageRegion));
+		return;
+	}
+
 #endif
+	region16_union_rect(grabRegion, grabRegion, &surfaceRect);
 }
 
 static int x11_shadow_blend_cursor(x11ShadowSubsystem* subsystem)
@@ -694,6 +733,7 @@ static BOOL x11_shadow_check_resize(x11ShadowSubsystem* subsystem)
 		virtualScreen->right = subsystem->width;
 		virtualScreen->bottom = subsystem->height;
 		virtualScreen->flags = 1;
+		x11_shadow_invalidate_screen(subsystem);
 		return TRUE;
 	}
 
@@ -720,29 +760,50 @@ static int x11_shadow_error_handler_for_capture(Display* display,
 static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 {
 	int count;
-	int status;
-	int x, y;
-	int width, height;
+	UINT32 index;
+	UINT32 numRects;
 	XImage* image;
-	rdpShadowScreen* screen;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	REGION16 grabRegion;
+	const RECTANGLE_16* rects;
 	server = subsystem->server;
 	surface = server->surface;
-	screen = server->screen;
-	count = ArrayList_Count(server->clients);
-
-	if (count < 1)
-		return 1;
-
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
 	surfaceRect.right = surface->width;
 	surfaceRect.bottom = surface->height;
 	XLockDisplay(subsystem->display);
+
+	/* Collect all pending damage before deciding what to grab */
+	while (XPending(subsystem->display))
+	{
+		XEvent xevent;
+		XNextEvent(subsystem->display, &xevent);
+		x11_shadow_handle_xevent(subsystem, &xevent);
+	}
+
+	count = ArrayList_Count(server->clients);
+
+	if (count < 1)
+	{
+		XUnlockDisplay(subsystem->display);
+		return 1;
+	}
+
+	region16_init(&grabRegion);
+	x11_shadow_validate_region(subsystem, &grabRegion, surface);
+	rects = region16_rects(&grabRegion, &numRects);
+
+	if (numRects < 1)
+	{
+		XUnlockDisplay(subsystem->display);
+		region16_uninit(&grabRegion);
+		return 1;
+	}
+
+	PROFILER_TRACE_BEGIN("x11_shadow_screen_grab");
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
 	 * changed outside. We will resize to correct resolution at next frame
@@ -752,52 +813,61 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	if (subsystem->use_xshm)
 	{
 		image = subsystem->fb_image;
-		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
-		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) & (image->data[surface->width * 4]), image->bytes_per_line,
-		                                &invalidRect);
+
+		for (index = 0; index < numRects; index++)
+		{
+			XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
+			          subsystem->xshm_gc,
+			          surface->x + rects[index].left, surface->y + rects[index].top,
+			          rects[index].right - rects[index].left,
+			          rects[index].bottom - rects[index].top,
+			          rects[index].left, rects[index].top);
+		}
+
+		XSync(subsystem->display, False);
+
+		for (index = 0; index < numRects; index++)
+		{
+			shadow_capture_compare_rect(surface, &rects[index],
+			                            (BYTE*) &image->data[(rects[index].top * image->bytes_per_line) +
+			                                    (rects[index].left * 4)], image->bytes_per_line);
+		}
 	}
 	else
 	{
-		image = XGetImage(subsystem->display, subsystem->root_window,
-		                  surface->x, surface->y, surface->width, surface->height, AllPlanes, ZPixmap);
-
-		if (!image)
+		for (index = 0; index < numRects; index++)
 		{
-			/*
-			 * BadMatch error happened. The size may have been changed again.
-			 * Give up this frame and we will resize again in next frame
-			 */
-			goto fail_capture;
-		}
+			image = XGetImage(subsystem->display, subsystem->root_window,
+			                  surface->x + rects[index].left, surface->y + rects[index].top,
+			                  rects[index].right - rects[index].left,
+			                  rects[index].bottom - rects[index].top, AllPlanes, ZPixmap);
+
+			if (!image)
+			{
+				/*
+				 * BadMatch error happened. The size may have been changed again.
+				 * Give up this frame and we will resize again in next frame
+				 */
+				goto fail_capture;
+			}
 
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) image->data, image->bytes_per_line, &invalidRect);
+			shadow_capture_compare_rect(surface, &rects[index], (BYTE*) image->data,
+			                            image->bytes_per_line);
+			XDestroyImage(image);
+		}
 	}
 
 	/* Restore the default error handler */
 	XSetErrorHandler(NULL);
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-	                    &invalidRect);
+	region16_uninit(&grabRegion);
+	PROFILER_TRACE_END("x11_shadow_screen_grab");
 	region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion),
 	                        &surfaceRect);
 
 	if (!region16_is_empty(&(surface->invalidRegion)))
 	{
-		extents = region16_extents(&(surface->invalidRegion));
-		x = extents->left;
-		y = extents->top;
-		width = extents->right - extents->left;
-		height = extents->bottom - extents->top;
-		freerdp_image_copy(surface->data, surface->format,
-		                   surface->scanline, x, y, width, height,
-		                   (BYTE*) image->data, PIXEL_FORMAT_BGRX32,
-		                   image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE);
 		//x11_shadow_blend_cursor(subsystem);
 		count = ArrayList_Count(server->clients);
 		shadow_subsystem_frame_update((rdpShadowSubsystem*)subsystem);
@@ -816,14 +886,15 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		region16_clear(&(surface->invalidRegion));
 	}
 
-	if (!subsystem->use_xshm)
-		XDestroyImage(image);
-
 	return 1;
 fail_capture:
 	XSetErrorHandler(NULL);
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
+	region16_uninit(&grabRegion);
+	PROFILER_TRACE_END("x11_shadow_screen_grab");
+	/* Everything may have moved, grab the whole screen again after the resize */
+	x11_shadow_invalidate_screen(subsystem);
 	return 0;
 }
 
@@ -974,7 +1045,7 @@ static int x11_shadow_xinerama_init(x11ShadowSubsystem* subsystem)
 	                            &xinerama_error))
 		return -1;
 
-	if (!XDamageQueryVersion(subsystem->display, &major, &minor))
+	if (!XineramaQueryVersion(subsystem->display, &major, &minor))
 		return -1;
 
 	if (!XineramaIsActive(subsystem->display))
@@ -1019,6 +1090,9 @@ static int x11_shadow_xdamage_init(x11ShadowSubsystem* subsystem)
 		return -1;
 
 #endif
+	/* The first grab has to cover the whole screen */
+	region16_init(&(subsystem->damageRegion));
+	x11_shadow_invalidate_screen(subsystem);
 	return 1;
 #else
 	return -1;
@@ -1126,7 +1200,7 @@ int x11_shadow_enum_monitors(MONITOR_DEF* monitors, int maxMonitors)
 		XineramaScreenInfo* screens;
 
 		if (XineramaQueryExtension(display, &xinerama_event, &xinerama_error) &&
-		    XDamageQueryVersion(display, &major, &minor) && XineramaIsActive(display))
+		    XineramaQueryVersion(display, &major, &minor) && XineramaIsActive(display))
 		{
 			screens = XineramaQueryScreens(display, &numMonitors);
 
@@ -1308,6 +1382,30 @@ static int x11_shadow_subsystem_uninit(x11ShadowSubsystem* subsystem)
 	if (!subsystem)
 		return -1;
 
+#ifdef WITH_XDAMAGE
+
+	if (subsystem->use_xdamage)
+	{
+		if (subsystem->xdamage)
+		{
+			XDamageDestroy(subsystem->display, subsystem->xdamage);
+			subsystem->xdamage = None;
+		}
+
+#ifdef WITH_XFIXES
+
+		if (subsystem->xdamage_region)
+		{
+			XFixesDestroyRegion(subsystem->display, subsystem->xdamage_region);
+			subsystem->xdamage_region = None;
+		}
+
+#endif
+		region16_uninit(&(subsystem->damageRegion));
+	}
+
+#endif
+
 	if (subsystem->display)
 	{
 		XCloseDisplay(subsystem->display);
@@ -1385,7 +1483,7 @@ static x11ShadowSubsystem* x11_shadow_subsystem_new(void)
 	subsystem->composite = FALSE;
 	subsystem->use_xshm = FALSE; /* temporarily disabled */
 	subsystem->use_xfixes = TRUE;
-	subsystem->use_xdamage = FALSE;
+	subsystem->use_xdamage = TRUE;
 	subsystem->use_xinerama = TRUE;
 	return subsystem;
 }
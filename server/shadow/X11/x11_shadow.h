@@ -90,11 +90,13 @@ struct x11_shadow_subsystem
 	int cursorMaxHeight;
 	rdpShadowClient* lastMouseClient;
 
-#ifdef WITH_XDAMAGE
 	GC xshm_gc;
+
+#ifdef WITH_XDAMAGE
 	Damage xdamage;
 	int xdamage_notify_event;
 	XserverRegion xdamage_region;
+	REGION16 damageRegion;
 #endif
 
 #ifdef WITH_XFIXES
@@ -22,8 +22,18 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
+
+#if defined(WITH_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(WITH_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <freerdp/log.h>
+#include <freerdp/utils/profiler.h>
 
 #include "shadow_surface.h"
 
@@ -80,58 +90,160 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect)
+typedef BOOL (*pfnShadowCaptureRowEqual)(const BYTE* p1, const BYTE* p2,
+        UINT32 length);
+
+static BOOL shadow_capture_row_equal_generic(const BYTE* p1, const BYTE* p2,
+        UINT32 length)
 {
-	BOOL equal;
-	BOOL allEqual;
-	int tw, th;
-	int tx, ty, k;
-	int nrow, ncol;
-	int l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
+	return (memcmp(p1, p2, length) == 0);
+}
+
+#if defined(WITH_SSE2)
+static BOOL shadow_capture_row_equal_sse2(const BYTE* p1, const BYTE* p2,
+        UINT32 length)
+{
+	/* 64 bytes per iteration, bail out on the first differing block */
+	while (length >= 64)
+	{
+		__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &p1[0]),
+		                           _mm_loadu_si128((const __m128i*) &p2[0]));
+		__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &p1[16]),
+		                           _mm_loadu_si128((const __m128i*) &p2[16]));
+		__m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &p1[32]),
+		                           _mm_loadu_si128((const __m128i*) &p2[32]));
+		__m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &p1[48]),
+		                           _mm_loadu_si128((const __m128i*) &p2[48]));
+		a = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+
+		if (_mm_movemask_epi8(a) != 0xFFFF)
+			return FALSE;
+
+		p1 += 64;
+		p2 += 64;
+		length -= 64;
+	}
+
+	while (length >= 16)
+	{
+		__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p1),
+		                           _mm_loadu_si128((const __m128i*) p2));
+
+		if (_mm_movemask_epi8(a) != 0xFFFF)
+			return FALSE;
+
+		p1 += 16;
+		p2 += 16;
+		length -= 16;
+	}
+
+	return (memcmp(p1, p2, length) == 0);
+}
 #endif
 
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
+#if defined(WITH_NEON)
+static BOOL shadow_capture_row_equal_neon(const BYTE* p1, const BYTE* p2,
+        UINT32 length)
+{
+	while (length >= 64)
+	{
+		uint8x16_t a = vceqq_u8(vld1q_u8(&p1[0]), vld1q_u8(&p2[0]));
+		uint8x16_t b = vceqq_u8(vld1q_u8(&p1[16]), vld1q_u8(&p2[16]));
+		uint8x16_t c = vceqq_u8(vld1q_u8(&p1[32]), vld1q_u8(&p2[32]));
+		uint8x16_t d = vceqq_u8(vld1q_u8(&p1[48]), vld1q_u8(&p2[48]));
+		uint8x8_t e;
+		a = vandq_u8(vandq_u8(a, b), vandq_u8(c, d));
+		e = vand_u8(vget_low_u8(a), vget_high_u8(a));
+
+		if (vget_lane_u64(vreinterpret_u64_u8(e), 0) != ~0ULL)
+			return FALSE;
+
+		p1 += 64;
+		p2 += 64;
+		length -= 64;
+	}
+
+	return (memcmp(p1, p2, length) == 0);
+}
+#endif
+
+static pfnShadowCaptureRowEqual pShadowCaptureRowEqual = NULL;
+
+static pfnShadowCaptureRowEqual shadow_capture_row_equal_get(void)
+{
+	if (pShadowCaptureRowEqual)
+		return pShadowCaptureRowEqual;
+
+	pShadowCaptureRowEqual = shadow_capture_row_equal_generic;
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		pShadowCaptureRowEqual = shadow_capture_row_equal_sse2;
+
+#if defined(WITH_AVX2)
+
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		pShadowCaptureRowEqual = shadow_capture_row_equal_avx2;
+
 #endif
+#elif defined(WITH_NEON)
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		pShadowCaptureRowEqual = shadow_capture_row_equal_neon;
+
+#endif
+	return pShadowCaptureRowEqual;
+}
 
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
+/**
+ * Compares two frames on a grid of SHADOW_CAPTURE_TILE_SIZE tiles.
+ * region receives the changed tiles, adjacent tiles of a tile row are
+ * merged into one rectangle.
+ *
+ * @return 1 if something changed, 0 if both frames are equal, -1 on failure
+ */
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth,
+                           UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
+                           REGION16* region)
+{
+	UINT32 k;
+	UINT32 tw, th;
+	UINT32 tx, ty;
+	UINT32 nrow, ncol;
+	BOOL equal;
+	int status = -1;
+	RECTANGLE_16 rect;
+	const BYTE* p1;
+	const BYTE* p2;
+	pfnShadowCaptureRowEqual rowEqual = shadow_capture_row_equal_get();
 
-	l = ncol + 1;
-	r = -1;
+	if (!pData1 || !pData2 || !region)
+		return -1;
 
-	t = nrow + 1;
-	b = -1;
+	PROFILER_TRACE_BEGIN("shadow_capture_compare");
+	region16_clear(region);
+	nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
 
 	for (ty = 0; ty < nrow; ty++)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
-
-		if (!th)
-			th = 16;
+		th = MIN(SHADOW_CAPTURE_TILE_SIZE, nHeight - ty * SHADOW_CAPTURE_TILE_SIZE);
+		rect.top = ty * SHADOW_CAPTURE_TILE_SIZE;
+		rect.bottom = rect.top + th;
+		rect.left = rect.right = 0;
 
 		for (tx = 0; tx < ncol; tx++)
 		{
 			equal = TRUE;
-
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
-
-			if (!tw)
-				tw = 16;
-
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+			tw = MIN(SHADOW_CAPTURE_TILE_SIZE, nWidth - tx * SHADOW_CAPTURE_TILE_SIZE);
+			p1 = &pData1[(ty * SHADOW_CAPTURE_TILE_SIZE * nStep1) +
+			             (tx * SHADOW_CAPTURE_TILE_SIZE * 4)];
+			p2 = &pData2[(ty * SHADOW_CAPTURE_TILE_SIZE * nStep2) +
+			             (tx * SHADOW_CAPTURE_TILE_SIZE * 4)];
 
 			for (k = 0; k < th; k++)
 			{
-				if (memcmp(p1, p2, tw * 4) != 0)
+				if (!rowEqual(p1, p2, tw * 4))
 				{
 					equal = FALSE;
 					break;
@@ -141,81 +253,124 @@ int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BY
 				p2 += nStep2;
 			}
 
-			if (!equal)
-			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
-
-				if (l > tx)
-					l = tx;
+			if (equal)
+				continue;
 
-				if (r < tx)
-					r = tx;
+			/* extend the current run of changed tiles or start a new one */
+			if (rect.right == tx * SHADOW_CAPTURE_TILE_SIZE && rect.right > rect.left)
+			{
+				rect.right += tw;
+				continue;
 			}
-		}
 
-		if (!rows[ty])
-		{
-			allEqual = FALSE;
-
-			if (t > ty)
-				t = ty;
+			if ((rect.right > rect.left) && !region16_union_rect(region, region, &rect))
+				goto fail;
 
-			if (b < ty)
-				b = ty;
+			rect.left = tx * SHADOW_CAPTURE_TILE_SIZE;
+			rect.right = rect.left + tw;
 		}
-	}
-
-	if (allEqual)
-		return 0;
 
-	rect->left = l * 16;
-	rect->top = t * 16;
-	rect->right = (r + 1) * 16;
-	rect->bottom = (b + 1) * 16;
-
-	if (rect->right > nWidth)
-		rect->right = nWidth;
+		if ((rect.right > rect.left) && !region16_union_rect(region, region, &rect))
+			goto fail;
+	}
 
-	if (rect->bottom > nHeight)
-		rect->bottom = nHeight;
+	status = region16_is_empty(region) ? 0 : 1;
+fail:
+	PROFILER_TRACE_END("shadow_capture_compare");
+	return status;
+}
 
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	char *col_str = calloc(ncol + 1, sizeof(char));
-	if (!col_str)
+/**
+ * Adds damage reported in screen coordinates to grabRegion, moved into the
+ * coordinates of the surface and clipped to it.
+ */
+BOOL shadow_capture_damage_region(const REGION16* damage, const rdpShadowSurface* surface,
+                                  REGION16* grabRegion)
+{
+	UINT32 index;
+	UINT32 numRects;
+	RECTANGLE_16 rect;
+	RECTANGLE_16 surfaceRect;
+	const RECTANGLE_16* rects;
+
+	if (!damage || !surface || !grabRegion)
+		return FALSE;
+
+	surfaceRect.left = 0;
+	surfaceRect.top = 0;
+	surfaceRect.right = surface->width;
+	surfaceRect.bottom = surface->height;
+	rects = region16_rects(damage, &numRects);
+
+	for (index = 0; index < numRects; index++)
 	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
-	}
+		if ((rects[index].right <= surface->x) || (rects[index].bottom <= surface->y))
+			continue;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "-");
-	WLog_INFO(TAG, "%s", col_str);
+		rect.left = (rects[index].left > surface->x) ? rects[index].left - surface->x : 0;
+		rect.top = (rects[index].top > surface->y) ? rects[index].top - surface->y : 0;
+		rect.right = rects[index].right - surface->x;
+		rect.bottom = rects[index].bottom - surface->y;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "%c", cols[tx] ? 'O' : 'X');
-	WLog_INFO(TAG, "%s", col_str);
+		if (!region16_union_rect(grabRegion, grabRegion, &rect))
+			return FALSE;
+	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "-");
-	WLog_INFO(TAG, "%s", col_str);
+	return region16_intersect_rect(grabRegion, grabRegion, &surfaceRect);
+}
 
-	for (ty = 0; ty < nrow; ty++)
+/**
+ * Compares rect of the surface with the same area of a new frame starting at
+ * pSrcData, copies the changed tiles into the surface and adds them to its
+ * invalid region.
+ *
+ * @return 1 if something changed, 0 if the area is unchanged, -1 on failure
+ */
+int shadow_capture_compare_rect(rdpShadowSurface* surface, const RECTANGLE_16* rect,
+                                const BYTE* pSrcData, UINT32 nSrcStep)
+{
+	int status;
+	UINT32 index;
+	UINT32 numRects;
+	REGION16 invalidRegion;
+	RECTANGLE_16 invalidRect;
+	const RECTANGLE_16* rects;
+	BYTE* pDstData;
+
+	if (!surface || !rect || !pSrcData)
+		return -1;
+
+	pDstData = &surface->data[(rect->top * surface->scanline) + (rect->left * 4)];
+	region16_init(&invalidRegion);
+	status = shadow_capture_compare(pDstData, surface->scanline, rect->right - rect->left,
+	                                rect->bottom - rect->top, (BYTE*) pSrcData, nSrcStep,
+	                                &invalidRegion);
+	rects = region16_rects(&invalidRegion, &numRects);
+
+	for (index = 0; (status > 0) && (index < numRects); index++)
 	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf(&col_str[tx], "%c", cols[tx] ? 'O' : 'X');
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+		invalidRect = rects[index];
+
+		if (!freerdp_image_copy(pDstData, surface->format, surface->scanline,
+		                        invalidRect.left, invalidRect.top,
+		                        invalidRect.right - invalidRect.left,
+		                        invalidRect.bottom - invalidRect.top,
+		                        pSrcData, PIXEL_FORMAT_BGRX32, nSrcStep,
+		                        invalidRect.left, invalidRect.top, NULL, FREERDP_FLIP_NONE))
+			status = -1;
+
+		invalidRect.left += rect->left;
+		invalidRect.top += rect->top;
+		invalidRect.right += rect->left;
+		invalidRect.bottom += rect->top;
+
+		if (!region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+		                         &invalidRect))
+			status = -1;
 	}
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d",
-			l, t, r, b, ncol, nrow);
-	free(col_str);
-#endif
-
-	return 1;
+	region16_uninit(&invalidRegion);
+	return status;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
@@ -24,6 +24,8 @@
 #include <winpr/crt.h>
 #include <winpr/synch.h>
 
+#define SHADOW_CAPTURE_TILE_SIZE	64
+
 struct rdp_shadow_capture
 {
 	rdpShadowServer* server;
@@ -41,6 +43,11 @@ extern "C" {
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server);
 void shadow_capture_free(rdpShadowCapture* capture);
 
+#if defined(WITH_AVX2)
+FREERDP_LOCAL BOOL shadow_capture_row_equal_avx2(const BYTE* p1, const BYTE* p2,
+        UINT32 length);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
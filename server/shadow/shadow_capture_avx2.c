@@ -0,0 +1,63 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Frame Comparison - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include "shadow_capture.h"
+
+#if defined(WITH_AVX2)
+#include <immintrin.h>
+
+BOOL shadow_capture_row_equal_avx2(const BYTE* p1, const BYTE* p2, UINT32 length)
+{
+	/* 64 bytes per iteration, bail out on the first differing block */
+	while (length >= 64)
+	{
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) &p1[0]),
+		                              _mm256_loadu_si256((const __m256i*) &p2[0]));
+		__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) &p1[32]),
+		                              _mm256_loadu_si256((const __m256i*) &p2[32]));
+
+		if (_mm256_movemask_epi8(_mm256_and_si256(a, b)) != -1)
+			return FALSE;
+
+		p1 += 64;
+		p2 += 64;
+		length -= 64;
+	}
+
+	if (length >= 32)
+	{
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p1),
+		                              _mm256_loadu_si256((const __m256i*) p2));
+
+		if (_mm256_movemask_epi8(a) != -1)
+			return FALSE;
+
+		p1 += 32;
+		p2 += 32;
+		length -= 32;
+	}
+
+	return (memcmp(p1, p2, length) == 0);
+}
+
+#endif
@@ -29,15 +29,19 @@
 #include <winpr/interlocked.h>
 
 #include <freerdp/log.h>
+#include <freerdp/utils/profiler.h>
 
 #include "shadow.h"
 
 #define TAG CLIENT_TAG("shadow")
 
+#define SHADOW_CLEAR_TILE_SIZE 512
+
 struct _SHADOW_GFX_STATUS
 {
 	BOOL gfxOpened;
 	BOOL gfxSurfaceCreated;
+	BOOL gfxRefinePending;
 };
 typedef struct _SHADOW_GFX_STATUS SHADOW_GFX_STATUS;
 
@@ -142,10 +146,13 @@ static BOOL shadow_client_context_new(freerdp_peer* peer,
 	settings->SurfaceFrameMarkerEnabled = TRUE;
 	settings->SupportGraphicsPipeline = TRUE;
 	settings->GfxH264 = FALSE;
+	settings->GfxAVC444 = FALSE;
+	settings->GfxProgressive = !server->gfxClearCodec;
 	settings->DrawAllowSkipAlpha = TRUE;
 	settings->DrawAllowColorSubsampling = TRUE;
 	settings->DrawAllowDynamicColorFidelity = TRUE;
 	settings->CompressionLevel = PACKET_COMPR_TYPE_RDP6;
+	settings->CompressionPipelined = server->compressionPipeline;
 
 	if (!(settings->CertificateFile = _strdup(server->CertificateFile)))
 		goto fail_cert_file;
@@ -588,6 +595,7 @@ static INLINE void shadow_client_common_frame_acknowledge(
 	 * a latest acknowledged frame id.
 	 */
 	client->encoder->lastAckframeId = frameId;
+	metrics_frame_acknowledge(client->context.metrics, frameId);
 }
 
 static BOOL shadow_client_surface_frame_acknowledge(rdpShadowClient* client,
@@ -638,6 +646,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				flags = pdu.capsSet->flags;
 				settings->GfxSmallCache = (flags & RDPGFX_CAPS_FLAG_SMALL_CACHE);
 				settings->GfxH264 = !(flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+				settings->GfxAVC444 = settings->GfxH264;
 			}
 
 			return context->CapsConfirm(context, &pdu);
@@ -655,6 +664,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				flags = pdu.capsSet->flags;
 				settings->GfxSmallCache = (flags & RDPGFX_CAPS_FLAG_SMALL_CACHE);
 				settings->GfxH264 = !(flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+				settings->GfxAVC444 = settings->GfxH264;
 			}
 
 			return context->CapsConfirm(context, &pdu);
@@ -671,6 +681,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				settings->GfxThinClient = (flags & RDPGFX_CAPS_FLAG_THINCLIENT);
 				settings->GfxSmallCache = (flags & RDPGFX_CAPS_FLAG_SMALL_CACHE);
 				settings->GfxH264 = (flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED);
+				settings->GfxAVC444 = FALSE;
 			}
 
 			return context->CapsConfirm(context, &pdu);
@@ -702,7 +713,8 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
  * @return TRUE on success
  */
 static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight,
+        const REGION16* invalidRegion, SHADOW_GFX_STATUS* pStatus)
 {
 	UINT error = CHANNEL_RC_OK;
 	rdpUpdate* update;
@@ -714,16 +726,15 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	RDPGFX_START_FRAME_PDU cmdstart;
 	RDPGFX_END_FRAME_PDU cmdend;
 	SYSTEMTIME sTime;
+	UINT64 start;
 	context = (rdpContext*) client;
 	update = context->update;
 	settings = context->settings;
 	server = client->server;
 	encoder = client->encoder;
-	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
 	GetSystemTime(&sTime);
 	cmdstart.timestamp = sTime.wHour << 22 | sTime.wMinute << 16 |
 	                     sTime.wSecond << 10 | sTime.wMilliseconds;
-	cmdend.frameId = cmdstart.frameId;
 	cmd.surfaceId = 0;
 	cmd.contextId = 0;
 	cmd.format = PIXEL_FORMAT_BGRX32;
@@ -734,7 +745,60 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 
-	if (settings->GfxH264)
+	if (settings->GfxH264 && settings->GfxAVC444)
+	{
+		RDPGFX_AVC444_BITMAP_STREAM avc444;
+		RECTANGLE_16 regionRect;
+		RDPGFX_H264_QUANT_QUALITY quantQualityVal;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC444) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC444");
+			return FALSE;
+		}
+
+		/* The auxiliary view is only sent when the chroma detail changed */
+		start = metrics_get_time();
+
+		if (avc444_compress(encoder->h264, pSrcData, cmd.format, nSrcStep,
+		                    nWidth, nHeight, &avc444.LC,
+		                    &avc444.bitstream[0].data, &avc444.bitstream[0].length,
+		                    &avc444.bitstream[1].data, &avc444.bitstream[1].length) < 0)
+		{
+			WLog_ERR(TAG, "avc444_compress failed");
+			return FALSE;
+		}
+
+		metrics_codec_time(context->metrics, FREERDP_CODEC_AVC444, TRUE,
+		                   metrics_get_time() - start);
+
+		cmd.codecId = RDPGFX_CODECID_AVC444;
+		cmd.extra = (void*)&avc444;
+		regionRect.left = cmd.left;
+		regionRect.top = cmd.top;
+		regionRect.right = cmd.right;
+		regionRect.bottom = cmd.bottom;
+		quantQualityVal.qp = encoder->h264->QP;
+		quantQualityVal.r = 0;
+		quantQualityVal.p = 0;
+		quantQualityVal.qualityVal = 100 - quantQualityVal.qp;
+		avc444.bitstream[0].meta.numRegionRects = 1;
+		avc444.bitstream[0].meta.regionRects = &regionRect;
+		avc444.bitstream[0].meta.quantQualityVals = &quantQualityVal;
+		avc444.bitstream[1].meta = avc444.bitstream[0].meta;
+		avc444.cbAvc420EncodedBitstream1 = 0; /* computed by the channel */
+		cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+		cmdend.frameId = cmdstart.frameId;
+		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+		          &cmdstart, &cmdend);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %u", error);
+			return FALSE;
+		}
+	}
+	else if (settings->GfxH264)
 	{
 		RDPGFX_AVC420_BITMAP_STREAM avc420;
 		RECTANGLE_16 regionRect;
@@ -746,8 +810,11 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 			return FALSE;
 		}
 
+		start = metrics_get_time();
 		avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep,
 		                nWidth, nHeight, &avc420.data, &avc420.length);
+		metrics_codec_time(context->metrics, FREERDP_CODEC_AVC420, TRUE,
+		                   metrics_get_time() - start);
 		cmd.codecId = RDPGFX_CODECID_AVC420;
 		cmd.extra = (void*)&avc420;
 		regionRect.left = cmd.left;
@@ -761,6 +828,51 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 		avc420.meta.numRegionRects = 1;
 		avc420.meta.regionRects = &regionRect;
 		avc420.meta.quantQualityVals = &quantQualityVal;
+		cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+		cmdend.frameId = cmdstart.frameId;
+		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+		          &cmdstart, &cmdend);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %u", error);
+			return FALSE;
+		}
+	}
+	else if (settings->GfxProgressive)
+	{
+		int rc;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
+			return FALSE;
+		}
+
+		/* tiles of the invalid region are sent first, pending tiles are upgraded */
+		start = metrics_get_time();
+		rc = progressive_compress(encoder->progressive, pSrcData, cmd.format, nSrcStep,
+		                          nWidth, nHeight, invalidRegion, &cmd.data, &cmd.length,
+		                          cmd.surfaceId);
+
+		if (rc < 0)
+		{
+			WLog_ERR(TAG, "progressive_compress failed");
+			return FALSE;
+		}
+
+		metrics_codec_time(context->metrics, FREERDP_CODEC_PROGRESSIVE, TRUE,
+		                   metrics_get_time() - start);
+
+		pStatus->gfxRefinePending = (cmd.length > 0);
+
+		if (!cmd.length)
+			return TRUE;
+
+		cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+		cmd.extra = NULL;
+		cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+		cmdend.frameId = cmdstart.frameId;
 		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
 		          &cmdstart, &cmdend);
 
@@ -770,6 +882,96 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 			return FALSE;
 		}
 	}
+	else if (server->gfxClearCodec)
+	{
+		UINT32 x, y;
+		UINT32 index;
+		UINT32 numRects = 0;
+		RECTANGLE_16 surfaceRect;
+		REGION16 clippedRegion;
+		const RECTANGLE_16* rects;
+
+		if (!invalidRegion)
+			return TRUE;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_CLEARCODEC) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_CLEARCODEC");
+			return FALSE;
+		}
+
+		surfaceRect.left = nXSrc;
+		surfaceRect.top = nYSrc;
+		surfaceRect.right = nXSrc + nWidth;
+		surfaceRect.bottom = nYSrc + nHeight;
+		region16_init(&clippedRegion);
+
+		if (!region16_intersect_rect(&clippedRegion, invalidRegion, &surfaceRect))
+		{
+			region16_uninit(&clippedRegion);
+			return FALSE;
+		}
+
+		rects = region16_rects(&clippedRegion, &numRects);
+
+		if (numRects < 1)
+		{
+			region16_uninit(&clippedRegion);
+			return TRUE;
+		}
+
+		cmd.codecId = RDPGFX_CODECID_CLEARCODEC;
+		cmd.extra = NULL;
+		cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+		cmdend.frameId = cmdstart.frameId;
+		IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, &cmdstart);
+
+		/* Rects are split so the residual layer fits the decoder temporary buffer */
+		for (index = 0; (index < numRects) && !error; index++)
+		{
+			for (y = rects[index].top; (y < rects[index].bottom) && !error;
+			     y += SHADOW_CLEAR_TILE_SIZE)
+			{
+				for (x = rects[index].left; (x < rects[index].right) && !error;
+				     x += SHADOW_CLEAR_TILE_SIZE)
+				{
+					cmd.left = x;
+					cmd.top = y;
+					cmd.right = MIN(x + SHADOW_CLEAR_TILE_SIZE, rects[index].right);
+					cmd.bottom = MIN(y + SHADOW_CLEAR_TILE_SIZE, rects[index].bottom);
+					cmd.width = cmd.right - cmd.left;
+					cmd.height = cmd.bottom - cmd.top;
+					start = metrics_get_time();
+
+					if (clear_compress(encoder->clear,
+					                   &pSrcData[(y - nYSrc) * nSrcStep + (x - nXSrc) * 4],
+					                   cmd.format, nSrcStep, cmd.width, cmd.height,
+					                   &cmd.data, &cmd.length) < 0)
+					{
+						WLog_ERR(TAG, "clear_compress failed");
+						region16_uninit(&clippedRegion);
+						return FALSE;
+					}
+
+					metrics_codec_time(context->metrics, FREERDP_CODEC_CLEARCODEC, TRUE,
+					                   metrics_get_time() - start);
+
+					IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
+				}
+			}
+		}
+
+		region16_uninit(&clippedRegion);
+
+		if (!error)
+			IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, &cmdend);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceCommand failed with error %u", error);
+			return FALSE;
+		}
+	}
 
 	return TRUE;
 }
@@ -794,12 +996,17 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowEncoder* encoder;
+	rdpShadowSharedEncoder* shared;
+	int eventId;
+	UINT64 start;
 	SURFACE_BITS_COMMAND cmd;
 	context = (rdpContext*) client;
 	update = context->update;
 	settings = context->settings;
 	server = client->server;
 	encoder = client->encoder;
+	shared = server->sharedEncoder;
+	eventId = client->subsystem->updateEvent->eventid;
 
 	if (encoder->frameAck)
 		frameId = shadow_encoder_create_frame_id(encoder);
@@ -821,15 +1028,26 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 		rect.y = nYSrc;
 		rect.width = nWidth;
 		rect.height = nHeight;
+		start = metrics_get_time();
+
+		if (shared)
+			messages = shadow_shared_encoder_rfx(shared, encoder, eventId, &rect, pSrcData,
+			                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep,
+			                                     settings->MultifragMaxRequestSize, &numMessages);
+		else
+			messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
+			                               settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
+			                               settings->MultifragMaxRequestSize);
 
-		if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
-		                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
-		                                     settings->MultifragMaxRequestSize)))
+		if (!messages)
 		{
 			WLog_ERR(TAG, "rfx_encode_messages failed");
 			return FALSE;
 		}
 
+		metrics_codec_time(context->metrics, FREERDP_CODEC_REMOTEFX, TRUE,
+		                   metrics_get_time() - start);
+
 		cmd.codecID = settings->RemoteFxCodecId;
 		cmd.destLeft = 0;
 		cmd.destTop = 0;
@@ -849,7 +1067,7 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 
 			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
 			{
-				while (i < numMessages)
+				while (!shared && (i < numMessages))
 				{
 					rfx_message_free(encoder->rfx, &messages[i++]);
 				}
@@ -859,7 +1077,9 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 				break;
 			}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
+			if (!shared)
+				rfx_message_free(encoder->rfx, &messages[i]);
+
 			cmd.bitmapDataLength = Stream_GetPosition(s);
 			cmd.bitmapData = Stream_Buffer(s);
 			first = (i == 0) ? TRUE : FALSE;
@@ -878,8 +1098,11 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 			}
 		}
 
-		free(messageRects);
-		free(messages);
+		if (!shared)
+		{
+			free(messageRects);
+			free(messages);
+		}
 	}
 	else if (settings->NSCodec)
 	{
@@ -892,7 +1115,23 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 		s = encoder->bs;
 		Stream_SetPosition(s, 0);
 		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+		start = metrics_get_time();
+
+		if (shared)
+		{
+			if (!(s = shadow_shared_encoder_nsc(shared, encoder, eventId, pSrcData, nWidth,
+			                                    nHeight, nSrcStep)))
+			{
+				WLog_ERR(TAG, "Failed to get shared NSCodec frame");
+				return FALSE;
+			}
+		}
+		else
+			nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+
+		metrics_codec_time(context->metrics, FREERDP_CODEC_NSCODEC, TRUE,
+		                   metrics_get_time() - start);
+
 		cmd.bpp = 32;
 		cmd.codecID = settings->NSCodecId;
 		cmd.destLeft = nXSrc;
@@ -943,6 +1182,7 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 	UINT32 maxUpdateSize;
 	UINT32 totalBitmapSize;
 	UINT32 updateSizeEstimate;
+	UINT64 start;
 	BITMAP_DATA* bitmapData;
 	BITMAP_UPDATE bitmapUpdate;
 	rdpShadowServer* server;
@@ -996,6 +1236,7 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 		return FALSE;
 
 	bitmapUpdate.rectangles = bitmapData;
+	start = metrics_get_time();
 
 	if ((nWidth % 4) != 0)
 	{
@@ -1067,6 +1308,9 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 		}
 	}
 
+	metrics_codec_time(context->metrics,
+	                   (settings->ColorDepth < 32) ? FREERDP_CODEC_INTERLEAVED : FREERDP_CODEC_PLANAR,
+	                   TRUE, metrics_get_time() - start);
 	bitmapUpdate.count = bitmapUpdate.number = k;
 	updateSizeEstimate = totalBitmapSize + (k * bitmapUpdate.count) + 16;
 
@@ -1163,6 +1407,7 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 	int index;
 	UINT32 numRects = 0;
 	const RECTANGLE_16* rects;
+	PROFILER_TRACE_BEGIN("shadow_client_send_surface_update");
 	context = (rdpContext*) client;
 	settings = context->settings;
 	server = client->server;
@@ -1220,10 +1465,10 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 	//	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
 
 	if (settings->SupportGraphicsPipeline &&
-	    settings->GfxH264 &&
+	    (settings->GfxH264 || settings->GfxProgressive || server->gfxClearCodec) &&
 	    pStatus->gfxOpened)
 	{
-		/* GFX/h264 always full screen encoded */
+		/* GFX/h264 and progressive always full screen encoded */
 		nWidth = settings->DesktopWidth;
 		nHeight = settings->DesktopHeight;
 
@@ -1237,11 +1482,48 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 			if (!(ret = shadow_client_rdpgfx_new_surface(client)))
 				goto out;
 
+			/* The new surface starts without any progressive tile state */
+			if (encoder->progressive)
+				progressive_delete_surface_context(encoder->progressive, 0);
+
+			/* The client resets its ClearCodec state on ResetGraphics */
+			if (encoder->clear)
+				clear_context_reset(encoder->clear);
+
+			/* Both AVC444 views have to be sent again for the new surface */
+			if (encoder->h264)
+				h264_context_reset(encoder->h264, encoder->h264->width,
+				                   encoder->h264->height);
+
 			pStatus->gfxSurfaceCreated = TRUE;
 		}
 
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
-		                                     nHeight);
+		/* The invalid region is relative to the shared sub rect */
+		if (server->shareSubRect)
+		{
+			REGION16 subRectRegion;
+			RECTANGLE_16 subRectRect;
+			region16_init(&subRectRegion);
+			rects = region16_rects(&invalidRegion, &numRects);
+
+			for (index = 0; index < numRects; index++)
+			{
+				subRectRect.left = rects[index].left - server->subRect.left;
+				subRectRect.top = rects[index].top - server->subRect.top;
+				subRectRect.right = rects[index].right - server->subRect.left;
+				subRectRect.bottom = rects[index].bottom - server->subRect.top;
+				region16_union_rect(&subRectRegion, &subRectRegion, &subRectRect);
+			}
+
+			ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
+			                                     nHeight, &subRectRegion, pStatus);
+			region16_uninit(&subRectRegion);
+		}
+		else
+		{
+			ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
+			                                     nHeight, &invalidRegion, pStatus);
+		}
 	}
 	else if (settings->RemoteFxCodec || settings->NSCodec)
 	{
@@ -1254,11 +1536,43 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 		                                       nWidth, nHeight);
 	}
 
+	/* the pending input, if any, is visible with this update */
+	if (ret)
+		metrics_paint(client->context.metrics);
+
 out:
 	region16_uninit(&invalidRegion);
+	PROFILER_TRACE_END("shadow_client_send_surface_update");
 	return ret;
 }
 
+/**
+ * Function description
+ * Upgrade progressive tiles which did not reach the final quality yet.
+ * Only the coefficients kept by the encoder are used, the surface is not read.
+ *
+ * @return TRUE on success (or nothing need to be updated)
+ */
+static BOOL shadow_client_send_surface_refine(rdpShadowClient* client,
+        SHADOW_GFX_STATUS* pStatus)
+{
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowServer* server = client->server;
+	rdpShadowSurface* surface = client->inLobby ? server->lobby : server->surface;
+
+	if (!settings->SupportGraphicsPipeline || settings->GfxH264 ||
+	    !settings->GfxProgressive || !pStatus->gfxSurfaceCreated)
+	{
+		pStatus->gfxRefinePending = FALSE;
+		return TRUE;
+	}
+
+	return shadow_client_send_surface_gfx(client, surface->data, surface->scanline, 0, 0,
+	                                      settings->DesktopWidth, settings->DesktopHeight,
+	                                      NULL, pStatus);
+}
+
 /**
  * Function description
  * Notify client for resize. The new desktop width/height
@@ -1291,6 +1605,7 @@ static BOOL shadow_client_send_resize(rdpShadowClient* client,
 			return FALSE;
 
 		pStatus->gfxSurfaceCreated = FALSE;
+		pStatus->gfxRefinePending = FALSE;
 	}
 
 	/* Send Resize */
@@ -1445,6 +1760,79 @@ static int shadow_client_subsystem_process_message(rdpShadowClient* client,
 	return 1;
 }
 
+#define SHADOW_METRICS_INTERVAL 5000
+
+/**
+ * Writes the client metrics to <metricsDir>/freerdp-shadow-<pid>-<tid>.prom,
+ * the file is replaced atomically so a collector never sees a partial dump.
+ * With remove set the file of a leaving client is deleted instead.
+ */
+static BOOL shadow_client_write_metrics(rdpShadowClient* client, BOOL remove)
+{
+	FILE* fp;
+	BOOL rc = FALSE;
+	char* dump = NULL;
+	char* path = NULL;
+	char* tmpPath = NULL;
+	char name[64];
+	char labels[96];
+	rdpContext* context = (rdpContext*) client;
+	const char* metricsDir = client->server->metricsDir;
+
+	if (!metricsDir)
+		return TRUE;
+
+	sprintf_s(name, sizeof(name), "freerdp-shadow-%lu-%lu.prom",
+	          (unsigned long) GetCurrentProcessId(), (unsigned long) GetCurrentThreadId());
+
+	if (!(path = GetCombinedPath(metricsDir, name)))
+		return FALSE;
+
+	if (remove)
+	{
+		DeleteFileA(path);
+		free(path);
+		return TRUE;
+	}
+
+	sprintf_s(labels, sizeof(labels), "client=\"%s\"",
+	          context->peer->local ? "local" : context->peer->hostname);
+
+	if (!(dump = metrics_dump_prometheus(context->metrics, labels)))
+		goto out;
+
+	if (!(tmpPath = (char*) malloc(strlen(path) + 5)))
+		goto out;
+
+	sprintf_s(tmpPath, strlen(path) + 5, "%s.tmp", path);
+
+	if (!(fp = fopen(tmpPath, "w")))
+	{
+		WLog_ERR(TAG, "Failed to open metrics file %s", tmpPath);
+		goto out;
+	}
+
+	rc = (fwrite(dump, 1, strlen(dump), fp) == strlen(dump));
+	rc = (fclose(fp) == 0) && rc;
+#ifdef _WIN32
+	rc = rc && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	rc = rc && (rename(tmpPath, path) == 0);
+#endif
+
+	if (!rc)
+	{
+		WLog_ERR(TAG, "Failed to write metrics file %s", path);
+		DeleteFileA(tmpPath);
+	}
+
+out:
+	free(dump);
+	free(tmpPath);
+	free(path);
+	return rc;
+}
+
 static void* shadow_client_thread(rdpShadowClient* client)
 {
 	DWORD status;
@@ -1464,11 +1852,13 @@ static void* shadow_client_thread(rdpShadowClient* client)
 	rdpShadowScreen* screen;
 	rdpShadowEncoder* encoder;
 	rdpShadowSubsystem* subsystem;
+	UINT64 metricsTime = 0;
 	wMessageQueue* MsgQueue = client->MsgQueue;
 	/* This should only be visited in client thread */
 	SHADOW_GFX_STATUS gfxstatus;
 	gfxstatus.gfxOpened = FALSE;
 	gfxstatus.gfxSurfaceCreated = FALSE;
+	gfxstatus.gfxRefinePending = FALSE;
 	server = client->server;
 	screen = server->screen;
 	encoder = client->encoder;
@@ -1497,6 +1887,8 @@ static void* shadow_client_thread(rdpShadowClient* client)
 
 	UpdateEvent = shadow_multiclient_getevent(UpdateSubscriber);
 	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(client->vcm);
+	/* the loop below waits on the same handles until the peer disconnects */
+	WaitSet_EnableThreadCache(TRUE);
 
 	while (1)
 	{
@@ -1515,7 +1907,29 @@ static void* shadow_client_thread(rdpShadowClient* client)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		/* Progressive tiles are refined while the screen does not change */
+		status = WaitForMultipleObjects(nCount, events, FALSE,
+		                                gfxstatus.gfxRefinePending ? (1000 / encoder->fps) : INFINITE);
+
+		if (server->metricsDir && (GetTickCount64() - metricsTime >= SHADOW_METRICS_INTERVAL))
+		{
+			shadow_client_write_metrics(client, FALSE);
+			metricsTime = GetTickCount64();
+		}
+
+		if (status == WAIT_TIMEOUT)
+		{
+			if (client->activated && !client->suppressOutput)
+			{
+				if (!shadow_client_send_surface_refine(client, &gfxstatus))
+				{
+					WLog_ERR(TAG, "Failed to send surface refinement");
+					break;
+				}
+			}
+			else
+				gfxstatus.gfxRefinePending = FALSE;
+		}
 
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
@@ -1705,6 +2119,7 @@ static void* shadow_client_thread(rdpShadowClient* client)
 	}
 
 	shadow_client_channels_free(client);
+	shadow_client_write_metrics(client, TRUE);
 
 	if (UpdateSubscriber)
 	{
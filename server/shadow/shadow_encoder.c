@@ -69,6 +69,7 @@ UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
 		encoder->fps = 1;
 
 	frameId = ++encoder->frameId;
+	metrics_frame_begin(encoder->client->context.metrics, frameId);
 	return frameId;
 }
 
@@ -235,13 +236,52 @@ static int shadow_encoder_init_h264(rdpShadowEncoder* encoder)
 	encoder->h264->BitRate = encoder->server->h264BitRate;
 	encoder->h264->FrameRate = encoder->server->h264FrameRate;
 	encoder->h264->QP = encoder->server->h264QP;
-	encoder->codecs |= FREERDP_CODEC_AVC420;
+	/* the same context encodes AVC420 and both AVC444 views */
+	encoder->codecs |= FREERDP_CODEC_AVC420 | FREERDP_CODEC_AVC444;
 	return 1;
 fail:
 	h264_context_free(encoder->h264);
 	return -1;
 }
 
+static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
+{
+	if (!encoder->progressive)
+		encoder->progressive = progressive_context_new(TRUE);
+
+	if (!encoder->progressive)
+		goto fail;
+
+	if (!progressive_context_reset(encoder->progressive))
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+fail:
+	progressive_context_free(encoder->progressive);
+	encoder->progressive = NULL;
+	return -1;
+}
+
+static int shadow_encoder_init_clear(rdpShadowEncoder* encoder)
+{
+	if (!encoder->clear)
+		encoder->clear = clear_context_new(TRUE);
+
+	if (!encoder->clear)
+		goto fail;
+
+	if (!clear_context_reset(encoder->clear))
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_CLEARCODEC;
+	return 1;
+fail:
+	clear_context_free(encoder->clear);
+	encoder->clear = NULL;
+	return -1;
+}
+
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
 	encoder->width = encoder->server->screen->width;
@@ -316,7 +356,31 @@ static int shadow_encoder_uninit_h264(rdpShadowEncoder* encoder)
 		encoder->h264 = NULL;
 	}
 
-	encoder->codecs &= ~FREERDP_CODEC_AVC420;
+	encoder->codecs &= ~(FREERDP_CODEC_AVC420 | FREERDP_CODEC_AVC444);
+	return 1;
+}
+
+static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
+{
+	if (encoder->progressive)
+	{
+		progressive_context_free(encoder->progressive);
+		encoder->progressive = NULL;
+	}
+
+	encoder->codecs &= ~FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+}
+
+static int shadow_encoder_uninit_clear(rdpShadowEncoder* encoder)
+{
+	if (encoder->clear)
+	{
+		clear_context_free(encoder->clear);
+		encoder->clear = NULL;
+	}
+
+	encoder->codecs &= ~FREERDP_CODEC_CLEARCODEC;
 	return 1;
 }
 
@@ -355,6 +419,16 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 		shadow_encoder_uninit_h264(encoder);
 	}
 
+	if (encoder->codecs & FREERDP_CODEC_PROGRESSIVE)
+	{
+		shadow_encoder_uninit_progressive(encoder);
+	}
+
+	if (encoder->codecs & FREERDP_CODEC_CLEARCODEC)
+	{
+		shadow_encoder_uninit_clear(encoder);
+	}
+
 	return 1;
 }
 
@@ -427,7 +501,7 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
-	if ((codecs & FREERDP_CODEC_AVC420)
+	if ((codecs & (FREERDP_CODEC_AVC420 | FREERDP_CODEC_AVC444))
 	    && !(encoder->codecs & FREERDP_CODEC_AVC420))
 	{
 		status = shadow_encoder_init_h264(encoder);
@@ -436,6 +510,24 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_PROGRESSIVE)
+	    && !(encoder->codecs & FREERDP_CODEC_PROGRESSIVE))
+	{
+		status = shadow_encoder_init_progressive(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
+	if ((codecs & FREERDP_CODEC_CLEARCODEC)
+	    && !(encoder->codecs & FREERDP_CODEC_CLEARCODEC))
+	{
+		status = shadow_encoder_init_clear(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
 	return 1;
 }
 
@@ -470,3 +562,228 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 	shadow_encoder_uninit(encoder);
 	free(encoder);
 }
+
+static void shadow_shared_encoder_clear(rdpShadowSharedEncoder* shared)
+{
+	int i, j;
+
+	for (i = 0; i < ArrayList_Count(shared->frames); i++)
+	{
+		rdpShadowSharedFrame* frame = (rdpShadowSharedFrame*) ArrayList_GetItem(shared->frames, i);
+
+		if (frame->messages)
+		{
+			free(frame->messages[0].rects);
+
+			for (j = 0; j < frame->numMessages; j++)
+				rfx_message_free(shared->rfx, &frame->messages[j]);
+
+			free(frame->messages);
+		}
+
+		Stream_Free(frame->s, TRUE);
+		free(frame);
+	}
+
+	ArrayList_Clear(shared->frames);
+}
+
+/**
+ * Looks up the encoding of the current frame for the given key. All entries
+ * of the previous frame are dropped when a new multiclient event is seen,
+ * nobody uses them anymore as every client consumed the previous event.
+ * Must be called with the shared encoder lock held.
+ */
+static rdpShadowSharedFrame* shadow_shared_encoder_find(rdpShadowSharedEncoder* shared,
+        int eventId, UINT32 codec, const BYTE* pSrcData, const RECTANGLE_16* rect,
+        const UINT32 params[4])
+{
+	int i;
+	rdpShadowSharedFrame* frame;
+
+	if (shared->eventId != eventId)
+	{
+		shadow_shared_encoder_clear(shared);
+		shared->eventId = eventId;
+	}
+
+	for (i = 0; i < ArrayList_Count(shared->frames); i++)
+	{
+		frame = (rdpShadowSharedFrame*) ArrayList_GetItem(shared->frames, i);
+
+		if ((frame->codec == codec) && (frame->pSrcData == pSrcData) &&
+		    (memcmp(&frame->rect, rect, sizeof(RECTANGLE_16)) == 0) &&
+		    (memcmp(frame->params, params, sizeof(frame->params)) == 0))
+			return frame;
+	}
+
+	frame = (rdpShadowSharedFrame*) calloc(1, sizeof(rdpShadowSharedFrame));
+
+	if (!frame)
+		return NULL;
+
+	frame->codec = codec;
+	frame->pSrcData = pSrcData;
+	frame->rect = *rect;
+	CopyMemory(frame->params, params, sizeof(frame->params));
+
+	if (ArrayList_Add(shared->frames, frame) < 0)
+	{
+		free(frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+/**
+ * Returns the RemoteFX messages of the current frame, encoding them only
+ * for the first client asking. The messages are owned by the shared
+ * encoder and must not be freed by the caller.
+ */
+RFX_MESSAGE* shadow_shared_encoder_rfx(rdpShadowSharedEncoder* shared,
+                                       rdpShadowEncoder* encoder, int eventId,
+                                       const RFX_RECT* rect, BYTE* pSrcData,
+                                       int width, int height, int nSrcStep,
+                                       UINT32 maxDataSize, int* numMessages)
+{
+	RFX_MESSAGE* messages = NULL;
+	RECTANGLE_16 key;
+	UINT32 params[4];
+	rdpShadowSharedFrame* frame;
+	key.left = rect->x;
+	key.top = rect->y;
+	key.right = rect->x + rect->width;
+	key.bottom = rect->y + rect->height;
+	params[0] = width;
+	params[1] = height;
+	params[2] = maxDataSize;
+	params[3] = encoder->rfx->mode;
+	EnterCriticalSection(&(shared->lock));
+	frame = shadow_shared_encoder_find(shared, eventId, FREERDP_CODEC_REMOTEFX,
+	                                   pSrcData, &key, params);
+
+	if (frame && !frame->messages)
+	{
+		if (((shared->rfx->width != width) || (shared->rfx->height != height)) &&
+		    !rfx_context_reset(shared->rfx, width, height))
+			goto out;
+
+		shared->rfx->mode = encoder->rfx->mode;
+		frame->messages = rfx_encode_messages(shared->rfx, rect, 1, pSrcData,
+		                                      width, height, nSrcStep,
+		                                      &frame->numMessages, maxDataSize);
+	}
+
+	if (frame && frame->messages)
+	{
+		messages = frame->messages;
+		*numMessages = frame->numMessages;
+	}
+
+out:
+	LeaveCriticalSection(&(shared->lock));
+	return messages;
+}
+
+/**
+ * Returns the NSCodec bitmap data of the current frame, composing it only
+ * for the first client asking with the same quality settings.
+ */
+wStream* shadow_shared_encoder_nsc(rdpShadowSharedEncoder* shared,
+                                   rdpShadowEncoder* encoder, int eventId,
+                                   BYTE* pSrcData, int nWidth, int nHeight,
+                                   int nSrcStep)
+{
+	wStream* s = NULL;
+	RECTANGLE_16 key;
+	UINT32 params[4];
+	rdpShadowSharedFrame* frame;
+	key.left = 0;
+	key.top = 0;
+	key.right = nWidth;
+	key.bottom = nHeight;
+	params[0] = nSrcStep;
+	params[1] = encoder->nsc->ColorLossLevel;
+	params[2] = encoder->nsc->ChromaSubsamplingLevel;
+	params[3] = encoder->nsc->DynamicColorFidelity;
+	EnterCriticalSection(&(shared->lock));
+	frame = shadow_shared_encoder_find(shared, eventId, FREERDP_CODEC_NSCODEC,
+	                                   pSrcData, &key, params);
+
+	if (frame && !frame->s)
+	{
+		if (!(frame->s = Stream_New(NULL, 4096)))
+			goto out;
+
+		shared->nsc->ColorLossLevel = encoder->nsc->ColorLossLevel;
+		shared->nsc->ChromaSubsamplingLevel = encoder->nsc->ChromaSubsamplingLevel;
+		shared->nsc->DynamicColorFidelity = encoder->nsc->DynamicColorFidelity;
+
+		if (!nsc_compose_message(shared->nsc, frame->s, pSrcData, nWidth, nHeight,
+		                         nSrcStep))
+		{
+			Stream_Free(frame->s, TRUE);
+			frame->s = NULL;
+			goto out;
+		}
+	}
+
+	if (frame)
+		s = frame->s;
+
+out:
+	LeaveCriticalSection(&(shared->lock));
+	return s;
+}
+
+rdpShadowSharedEncoder* shadow_shared_encoder_new(rdpShadowServer* server)
+{
+	rdpShadowSharedEncoder* shared;
+	shared = (rdpShadowSharedEncoder*) calloc(1, sizeof(rdpShadowSharedEncoder));
+
+	if (!shared)
+		return NULL;
+
+	shared->eventId = -1;
+
+	if (!InitializeCriticalSectionAndSpinCount(&(shared->lock), 4000))
+	{
+		free(shared);
+		return NULL;
+	}
+
+	if (!(shared->frames = ArrayList_New(FALSE)))
+		goto fail;
+
+	if (!(shared->rfx = rfx_context_new(TRUE)))
+		goto fail;
+
+	rfx_context_set_pixel_format(shared->rfx, PIXEL_FORMAT_BGRX32);
+
+	if (!(shared->nsc = nsc_context_new()))
+		goto fail;
+
+	nsc_context_set_pixel_format(shared->nsc, PIXEL_FORMAT_BGRX32);
+	return shared;
+fail:
+	shadow_shared_encoder_free(shared);
+	return NULL;
+}
+
+void shadow_shared_encoder_free(rdpShadowSharedEncoder* shared)
+{
+	if (!shared)
+		return;
+
+	if (shared->frames)
+	{
+		shadow_shared_encoder_clear(shared);
+		ArrayList_Free(shared->frames);
+	}
+
+	rfx_context_free(shared->rfx);
+	nsc_context_free(shared->nsc);
+	DeleteCriticalSection(&(shared->lock));
+	free(shared);
+}
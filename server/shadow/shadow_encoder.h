@@ -50,6 +50,8 @@ struct rdp_shadow_encoder
 	BITMAP_PLANAR_CONTEXT* planar;
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
+	PROGRESSIVE_CONTEXT* progressive;
+	CLEAR_CONTEXT* clear;
 
 	int fps;
 	int maxFps;
@@ -58,6 +60,34 @@ struct rdp_shadow_encoder
 	UINT32 lastAckframeId;
 };
 
+/**
+ * Encodings shared by all clients watching the same frame. Entries are keyed
+ * by codec, source, rectangle and quality parameters and are only valid for
+ * the multiclient event (frame) they were created for.
+ */
+struct rdp_shadow_shared_frame
+{
+	UINT32 codec;
+	const BYTE* pSrcData;
+	RECTANGLE_16 rect;
+	UINT32 params[4];
+
+	RFX_MESSAGE* messages;
+	int numMessages;
+	wStream* s;
+};
+typedef struct rdp_shadow_shared_frame rdpShadowSharedFrame;
+
+struct rdp_shadow_shared_encoder
+{
+	int eventId;
+	wArrayList* frames;
+	CRITICAL_SECTION lock;
+
+	RFX_CONTEXT* rfx;
+	NSC_CONTEXT* nsc;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -69,6 +99,18 @@ UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
 rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 void shadow_encoder_free(rdpShadowEncoder* encoder);
 
+rdpShadowSharedEncoder* shadow_shared_encoder_new(rdpShadowServer* server);
+void shadow_shared_encoder_free(rdpShadowSharedEncoder* shared);
+RFX_MESSAGE* shadow_shared_encoder_rfx(rdpShadowSharedEncoder* shared,
+                                       rdpShadowEncoder* encoder, int eventId,
+                                       const RFX_RECT* rect, BYTE* pSrcData,
+                                       int width, int height, int nSrcStep,
+                                       UINT32 maxDataSize, int* numMessages);
+wStream* shadow_shared_encoder_nsc(rdpShadowSharedEncoder* shared,
+                                   rdpShadowEncoder* encoder, int eventId,
+                                   BYTE* pSrcData, int nWidth, int nHeight,
+                                   int nSrcStep);
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,7 +40,7 @@ struct rdp_shadow_multiclient_event
 	int consuming;
 	int waiting;
 
-	/* For debug */
+	/* Identifies the published frame, e.g. for the shared encoder cache */
 	int eventid;
 };
 
@@ -55,7 +55,11 @@ static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 	{ "sec-tls", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "tls protocol security" },
 	{ "sec-nla", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "nla protocol security" },
 	{ "sec-ext", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "nla extended protocol security" },
+	{ "gfx-clear", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Use ClearCodec instead of progressive for the graphics pipeline" },
+	{ "shared-encoder", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Encode RemoteFX/NSCodec surface bits once per frame for all clients" },
+	{ "compression-pipeline", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Compress the next fastpath fragment while the previous one is written" },
 	{ "sam-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "NTLM SAM file for NLA authentication" },
+	{ "metrics-dir", COMMAND_LINE_VALUE_REQUIRED, "<dir>", NULL, NULL, -1, NULL, "Write per client metrics in Prometheus text format to <dir>" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "Print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
 	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
@@ -312,10 +316,30 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			settings->ExtSecurity = arg->Value ? TRUE : FALSE;
 		}
+		CommandLineSwitchCase(arg, "gfx-clear")
+		{
+			server->gfxClearCodec = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "shared-encoder")
+		{
+			server->shareEncoder = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "compression-pipeline")
+		{
+			server->compressionPipeline = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "sam-file")
 		{
 			freerdp_set_param_string(settings, FreeRDP_NtlmSamFile, arg->Value);
 		}
+		CommandLineSwitchCase(arg, "metrics-dir")
+		{
+			free(server->metricsDir);
+			server->metricsDir = _strdup(arg->Value);
+
+			if (!server->metricsDir)
+				return -1;
+		}
 		CommandLineSwitchDefault(arg)
 		{
 
@@ -460,6 +484,14 @@ int shadow_server_start(rdpShadowServer* server)
 	if (!server->capture)
 		return -1;
 
+	if (server->shareEncoder)
+	{
+		server->sharedEncoder = shadow_shared_encoder_new(server);
+
+		if (!server->sharedEncoder)
+			return -1;
+	}
+
 	if (!server->ipcSocket)
 		status = server->listener->Open(server->listener, NULL, (UINT16) server->port);
 	else
@@ -501,6 +533,8 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->capture = NULL;
 	}
 
+	shadow_shared_encoder_free(server->sharedEncoder);
+	server->sharedEncoder = NULL;
 	return 0;
 }
 
@@ -792,6 +826,8 @@ void shadow_server_free(rdpShadowServer* server)
 
 	free(server->ipcSocket);
 	server->ipcSocket = NULL;
+	free(server->metricsDir);
+	server->metricsDir = NULL;
 
 	freerdp_settings_free(server->settings);
 	server->settings = NULL;
@@ -0,0 +1,146 @@
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/server/shadow.h>
+
+static BOOL test_compare_frames(BYTE* pData1, BYTE* pData2, UINT32 nWidth,
+                                UINT32 nHeight, UINT32 nStep, REGION16* region,
+                                int expected)
+{
+	int status = shadow_capture_compare(pData1, nStep, nWidth, nHeight, pData2,
+	                                    nStep, region);
+
+	if (status != expected)
+	{
+		printf("shadow_capture_compare: expected %d, got %d\n", expected, status);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_shadow_capture_compare(void)
+{
+	BOOL rc = FALSE;
+	UINT32 numRects;
+	const RECTANGLE_16* rects;
+	REGION16 region;
+	const UINT32 nWidth = 1000;
+	const UINT32 nHeight = 500;
+	const UINT32 nStep = nWidth * 4;
+	BYTE* pData1 = calloc(nHeight, nStep);
+	BYTE* pData2 = calloc(nHeight, nStep);
+	region16_init(&region);
+
+	if (!pData1 || !pData2)
+		goto fail;
+
+	if (!test_compare_frames(pData1, pData2, nWidth, nHeight, nStep, &region, 0))
+		goto fail;
+
+	/* A change in opposite corners must not produce a bounding box */
+	pData2[0] = 1;
+	pData2[(nHeight - 1) * nStep + (nWidth - 1) * 4] = 1;
+
+	if (!test_compare_frames(pData1, pData2, nWidth, nHeight, nStep, &region, 1))
+		goto fail;
+
+	rects = region16_rects(&region, &numRects);
+
+	if ((numRects != 2) ||
+	    (rects[0].left != 0) || (rects[0].top != 0) ||
+	    (rects[0].right != 64) || (rects[0].bottom != 64) ||
+	    (rects[1].left != 960) || (rects[1].top != 448) ||
+	    (rects[1].right != nWidth) || (rects[1].bottom != nHeight))
+	{
+		printf("unexpected region for corner changes (%u rects)\n", numRects);
+		goto fail;
+	}
+
+	/* Adjacent changed tiles of a tile row are merged */
+	memset(pData2, 0, nHeight * nStep);
+	pData2[100 * nStep + 70 * 4] = 1;
+	pData2[100 * nStep + 130 * 4] = 1;
+
+	if (!test_compare_frames(pData1, pData2, nWidth, nHeight, nStep, &region, 1))
+		goto fail;
+
+	rects = region16_rects(&region, &numRects);
+
+	if ((numRects != 1) ||
+	    (rects[0].left != 64) || (rects[0].top != 64) ||
+	    (rects[0].right != 192) || (rects[0].bottom != 128))
+	{
+		printf("unexpected region for adjacent changes (%u rects)\n", numRects);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	region16_uninit(&region);
+	free(pData1);
+	free(pData2);
+	return rc;
+}
+
+static BOOL test_shadow_capture_compare_speed(UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	UINT64 start, idle, busy;
+	REGION16 region;
+	const UINT32 iterations = 10;
+	const UINT32 nStep = nWidth * 4;
+	BYTE* pData1 = calloc(nHeight, nStep);
+	BYTE* pData2 = calloc(nHeight, nStep);
+	region16_init(&region);
+
+	if (!pData1 || !pData2)
+		goto fail;
+
+	/* Identical frames are the worst case, every row has to be compared */
+	start = GetTickCount64();
+
+	for (x = 0; x < iterations; x++)
+	{
+		if (!test_compare_frames(pData1, pData2, nWidth, nHeight, nStep, &region, 0))
+			goto fail;
+	}
+
+	idle = GetTickCount64() - start;
+	/* A blinking cursor and a clock in opposite corners */
+	pData2[10 * nStep + 10 * 4] = 0xFF;
+	pData2[(nHeight - 10) * nStep + (nWidth - 10) * 4] = 0xFF;
+	start = GetTickCount64();
+
+	for (x = 0; x < iterations; x++)
+	{
+		if (!test_compare_frames(pData1, pData2, nWidth, nHeight, nStep, &region, 1))
+			goto fail;
+	}
+
+	busy = GetTickCount64() - start;
+	printf("shadow_capture_compare %ux%u: %.2f ms/frame unchanged, "
+	       "%.2f ms/frame two corners changed\n", nWidth, nHeight,
+	       (double) idle / iterations, (double) busy / iterations);
+	rc = TRUE;
+fail:
+	region16_uninit(&region);
+	free(pData1);
+	free(pData2);
+	return rc;
+}
+
+int TestShadowCapture(int argc, char* argv[])
+{
+	if (!test_shadow_capture_compare())
+		return -1;
+
+	if (!test_shadow_capture_compare_speed(1920, 1080))
+		return -1;
+
+	if (!test_shadow_capture_compare_speed(3840, 2160))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <winpr/crt.h>
+
+#include <freerdp/server/shadow.h>
+
+#define TEST_DAMAGE_X 100
+#define TEST_DAMAGE_Y 50
+#define TEST_DAMAGE_WIDTH 256
+#define TEST_DAMAGE_HEIGHT 128
+
+static BOOL test_damage_rects(const REGION16* region, const RECTANGLE_16* expected,
+                              UINT32 count)
+{
+	UINT32 i;
+	UINT32 numRects;
+	const RECTANGLE_16* rects = region16_rects(region, &numRects);
+
+	if (numRects != count)
+	{
+		printf("expected %u rectangles, got %u\n", (unsigned) count, (unsigned) numRects);
+		return FALSE;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if ((rects[i].left != expected[i].left) || (rects[i].top != expected[i].top) ||
+		    (rects[i].right != expected[i].right) || (rects[i].bottom != expected[i].bottom))
+		{
+			printf("rectangle %u: %u,%u-%u,%u expected %u,%u-%u,%u\n", (unsigned) i,
+			       rects[i].left, rects[i].top, rects[i].right, rects[i].bottom,
+			       expected[i].left, expected[i].top, expected[i].right, expected[i].bottom);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Damage in screen coordinates is moved to the surface and clipped to it */
+static BOOL test_shadow_damage_region(rdpShadowSurface* surface)
+{
+	BOOL rc = FALSE;
+	REGION16 damage;
+	REGION16 grabRegion;
+	const RECTANGLE_16 left = { 0, 0, TEST_DAMAGE_X, 40 };
+	const RECTANGLE_16 corner = { 90, 40, 120, 60 };
+	const RECTANGLE_16 outside = { 300, 150, 400, 200 };
+	const RECTANGLE_16 expected[] =
+	{
+		{ 0, 0, 20, 10 },
+		{ 200, 100, TEST_DAMAGE_WIDTH, TEST_DAMAGE_HEIGHT }
+	};
+	region16_init(&damage);
+	region16_init(&grabRegion);
+
+	/* nothing damaged, nothing to grab */
+	if (!shadow_capture_damage_region(&damage, surface, &grabRegion) ||
+	    !region16_is_empty(&grabRegion))
+		goto fail;
+
+	if (!region16_union_rect(&damage, &damage, &left) ||
+	    !region16_union_rect(&damage, &damage, &corner) ||
+	    !region16_union_rect(&damage, &damage, &outside))
+		goto fail;
+
+	if (!shadow_capture_damage_region(&damage, surface, &grabRegion))
+		goto fail;
+
+	rc = test_damage_rects(&grabRegion, expected, 2);
+fail:
+	region16_uninit(&damage);
+	region16_uninit(&grabRegion);
+	return rc;
+}
+
+/* Only the damaged rectangle is compared, changed tiles become invalid */
+static BOOL test_shadow_damage_compare(rdpShadowSurface* surface)
+{
+	BOOL rc = FALSE;
+	const UINT32 nStep = TEST_DAMAGE_WIDTH * 4;
+	const RECTANGLE_16 rect = { 64, 0, 128, 64 };
+	const RECTANGLE_16 expected[] = { { 64, 0, 128, 64 } };
+	BYTE* frame = calloc(TEST_DAMAGE_HEIGHT, nStep);
+	const BYTE* pSrcData = &frame[rect.top * nStep + rect.left * 4];
+
+	if (!frame)
+		return FALSE;
+
+	if (shadow_capture_compare_rect(surface, &rect, pSrcData, nStep) != 0)
+		goto fail;
+
+	/* a change outside of the damaged rectangle is not looked at */
+	frame[(100 * nStep) + (10 * 4)] = 0xFF;
+
+	if ((shadow_capture_compare_rect(surface, &rect, pSrcData, nStep) != 0) ||
+	    !region16_is_empty(&(surface->invalidRegion)))
+		goto fail;
+
+	frame[(10 * nStep) + (70 * 4)] = 0xFF;
+
+	if (shadow_capture_compare_rect(surface, &rect, pSrcData, nStep) != 1)
+		goto fail;
+
+	if (!test_damage_rects(&(surface->invalidRegion), expected, 1))
+		goto fail;
+
+	/* the surface holds the new pixels, the same frame is no change */
+	if ((surface->data[(10 * surface->scanline) + (70 * 4)] != 0xFF) ||
+	    (surface->data[(100 * surface->scanline) + (10 * 4)] != 0))
+		goto fail;
+
+	region16_clear(&(surface->invalidRegion));
+
+	if ((shadow_capture_compare_rect(surface, &rect, pSrcData, nStep) != 0) ||
+	    !region16_is_empty(&(surface->invalidRegion)))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(frame);
+	return rc;
+}
+
+int TestShadowDamage(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpShadowSurface surface;
+	ZeroMemory(&surface, sizeof(surface));
+	surface.x = TEST_DAMAGE_X;
+	surface.y = TEST_DAMAGE_Y;
+	surface.width = TEST_DAMAGE_WIDTH;
+	surface.height = TEST_DAMAGE_HEIGHT;
+	surface.scanline = TEST_DAMAGE_WIDTH * 4;
+	surface.format = PIXEL_FORMAT_BGRX32;
+	surface.data = calloc(TEST_DAMAGE_HEIGHT, surface.scanline);
+	region16_init(&(surface.invalidRegion));
+
+	if (!surface.data)
+		return -1;
+
+	if (!test_shadow_damage_region(&surface))
+		goto fail;
+
+	if (!test_shadow_damage_compare(&surface))
+		goto fail;
+
+	rc = 0;
+fail:
+	region16_uninit(&(surface.invalidRegion));
+	free(surface.data);
+	return rc;
+}
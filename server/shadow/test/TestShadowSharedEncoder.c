@@ -0,0 +1,195 @@
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+
+#include <freerdp/server/shadow.h>
+
+#include "shadow_encoder.h"
+
+#define TEST_SHARED_WIDTH 128
+#define TEST_SHARED_HEIGHT 64
+#define TEST_SHARED_MAX_DATA_SIZE 0x3FFFFF
+
+static BOOL test_shared_client_init(rdpShadowEncoder* encoder)
+{
+	if (!(encoder->rfx = rfx_context_new(TRUE)) || !(encoder->nsc = nsc_context_new()))
+		return FALSE;
+
+	encoder->rfx->mode = RLGR3;
+	rfx_context_set_pixel_format(encoder->rfx, PIXEL_FORMAT_BGRX32);
+
+	if (!rfx_context_reset(encoder->rfx, TEST_SHARED_WIDTH, TEST_SHARED_HEIGHT))
+		return FALSE;
+
+	nsc_context_set_pixel_format(encoder->nsc, PIXEL_FORMAT_BGRX32);
+	encoder->nsc->ColorLossLevel = 3;
+	encoder->nsc->ChromaSubsamplingLevel = 1;
+	return TRUE;
+}
+
+static void test_shared_client_uninit(rdpShadowEncoder* encoder)
+{
+	rfx_context_free(encoder->rfx);
+	nsc_context_free(encoder->nsc);
+}
+
+static wStream* test_shared_write_rfx(RFX_CONTEXT* rfx, RFX_MESSAGE* messages, int numMessages)
+{
+	int i;
+	wStream* s = Stream_New(NULL, 1024);
+
+	for (i = 0; s && (i < numMessages); i++)
+	{
+		if (!rfx_write_message(rfx, s, &messages[i]))
+		{
+			Stream_Free(s, TRUE);
+			return NULL;
+		}
+	}
+
+	return s;
+}
+
+/* A second client of the same frame gets the messages of the first one */
+static BOOL test_shared_encoder_rfx(rdpShadowSharedEncoder* shared, rdpShadowEncoder* client1,
+                                    rdpShadowEncoder* client2, BYTE* data)
+{
+	int i;
+	BOOL rc = FALSE;
+	int numMessages1 = 0, numMessages2 = 0, numMessages3 = 0, numPrivate = 0;
+	RFX_MESSAGE* messages1;
+	RFX_MESSAGE* messages2;
+	RFX_MESSAGE* messages3;
+	RFX_MESSAGE* privateMessages = NULL;
+	RFX_CONTEXT* reference = NULL;
+	wStream* s1 = NULL;
+	wStream* s2 = NULL;
+	const int nSrcStep = TEST_SHARED_WIDTH * 4;
+	RFX_RECT rect = { 0, 0, TEST_SHARED_WIDTH, TEST_SHARED_HEIGHT };
+	RFX_RECT half = { 0, 0, TEST_SHARED_WIDTH / 2, TEST_SHARED_HEIGHT };
+	messages1 = shadow_shared_encoder_rfx(shared, client1, 1, &rect, data, TEST_SHARED_WIDTH,
+	                                      TEST_SHARED_HEIGHT, nSrcStep,
+	                                      TEST_SHARED_MAX_DATA_SIZE, &numMessages1);
+	messages2 = shadow_shared_encoder_rfx(shared, client2, 1, &rect, data, TEST_SHARED_WIDTH,
+	                                      TEST_SHARED_HEIGHT, nSrcStep,
+	                                      TEST_SHARED_MAX_DATA_SIZE, &numMessages2);
+
+	if (!messages1 || (messages1 != messages2) || (numMessages1 != numMessages2))
+	{
+		printf("RemoteFX frame encoded twice\n");
+		return FALSE;
+	}
+
+	/* another rectangle of the same frame is a separate encoding */
+	messages3 = shadow_shared_encoder_rfx(shared, client2, 1, &half, data, TEST_SHARED_WIDTH,
+	                                      TEST_SHARED_HEIGHT, nSrcStep,
+	                                      TEST_SHARED_MAX_DATA_SIZE, &numMessages3);
+
+	if (!messages3 || (messages3 == messages1) || (ArrayList_Count(shared->frames) != 2))
+		return FALSE;
+
+	/* written by a client, the shared encoding equals one of its own */
+	if (!(reference = rfx_context_new(TRUE)))
+		goto fail;
+
+	reference->mode = RLGR3;
+	rfx_context_set_pixel_format(reference, PIXEL_FORMAT_BGRX32);
+
+	if (!rfx_context_reset(reference, TEST_SHARED_WIDTH, TEST_SHARED_HEIGHT))
+		goto fail;
+
+	privateMessages = rfx_encode_messages(reference, &rect, 1, data, TEST_SHARED_WIDTH,
+	                                      TEST_SHARED_HEIGHT, nSrcStep, &numPrivate,
+	                                      TEST_SHARED_MAX_DATA_SIZE);
+
+	if (!privateMessages || (numPrivate != numMessages1))
+		goto fail;
+
+	s1 = test_shared_write_rfx(client1->rfx, messages1, numMessages1);
+	s2 = test_shared_write_rfx(reference, privateMessages, numPrivate);
+
+	if (!s1 || !s2 || (Stream_GetPosition(s1) != Stream_GetPosition(s2)) ||
+	    (memcmp(Stream_Buffer(s1), Stream_Buffer(s2), Stream_GetPosition(s1)) != 0))
+	{
+		printf("shared RemoteFX encoding differs from a private one\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (privateMessages)
+	{
+		free(privateMessages[0].rects);
+
+		for (i = 0; i < numPrivate; i++)
+			rfx_message_free(reference, &privateMessages[i]);
+
+		free(privateMessages);
+	}
+
+	Stream_Free(s1, TRUE);
+	Stream_Free(s2, TRUE);
+	rfx_context_free(reference);
+	return rc;
+}
+
+/* NSCodec encodings are shared between clients with the same quality settings */
+static BOOL test_shared_encoder_nsc(rdpShadowSharedEncoder* shared, rdpShadowEncoder* client1,
+                                    rdpShadowEncoder* client2, BYTE* data)
+{
+	wStream* s1;
+	wStream* s2;
+	wStream* s3;
+	const int nSrcStep = TEST_SHARED_WIDTH * 4;
+	s1 = shadow_shared_encoder_nsc(shared, client1, 2, data, TEST_SHARED_WIDTH,
+	                               TEST_SHARED_HEIGHT, nSrcStep);
+	s2 = shadow_shared_encoder_nsc(shared, client2, 2, data, TEST_SHARED_WIDTH,
+	                               TEST_SHARED_HEIGHT, nSrcStep);
+
+	/* the new frame dropped the RemoteFX encodings of the previous one */
+	if (!s1 || (s1 != s2) || (ArrayList_Count(shared->frames) != 1))
+		return FALSE;
+
+	client2->nsc->ColorLossLevel = 5;
+	s3 = shadow_shared_encoder_nsc(shared, client2, 2, data, TEST_SHARED_WIDTH,
+	                               TEST_SHARED_HEIGHT, nSrcStep);
+	client2->nsc->ColorLossLevel = 3;
+
+	if (!s3 || (s3 == s1) || (ArrayList_Count(shared->frames) != 2))
+		return FALSE;
+
+	return TRUE;
+}
+
+int TestShadowSharedEncoder(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpShadowEncoder client1;
+	rdpShadowEncoder client2;
+	rdpShadowSharedEncoder* shared = shadow_shared_encoder_new(NULL);
+	BYTE* data = malloc(TEST_SHARED_WIDTH * TEST_SHARED_HEIGHT * 4);
+	ZeroMemory(&client1, sizeof(client1));
+	ZeroMemory(&client2, sizeof(client2));
+
+	if (!test_shared_client_init(&client1) || !test_shared_client_init(&client2))
+		goto fail;
+
+	if (!shared || !data)
+		goto fail;
+
+	winpr_RAND(data, TEST_SHARED_WIDTH * TEST_SHARED_HEIGHT * 4);
+
+	if (!test_shared_encoder_rfx(shared, &client1, &client2, data))
+		goto fail;
+
+	if (!test_shared_encoder_nsc(shared, &client1, &client2, data))
+		goto fail;
+
+	rc = 0;
+fail:
+	test_shared_client_uninit(&client1);
+	test_shared_client_uninit(&client2);
+	shadow_shared_encoder_free(shared);
+	free(data);
+	return rc;
+}
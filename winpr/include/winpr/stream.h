@@ -41,6 +41,7 @@ struct _wStream
 
 	DWORD count;
 	wStreamPool* pool;
+	struct _wStream* next;
 };
 typedef struct _wStream wStream;
 
@@ -325,17 +326,43 @@ static INLINE BOOL Stream_SafeSeek(wStream* s, size_t size) {
 
 /* StreamPool */
 
+/**
+ * Pooled streams are kept in power of two size classes, from
+ * 4 KiB (class 0) up to 16 MiB. Larger streams are not cached.
+ */
+#define STREAM_POOL_CLASSES	13
+
+struct _wStreamPoolClass
+{
+	wStream* volatile head;
+	LONG volatile count;
+	CRITICAL_SECTION lock;
+};
+typedef struct _wStreamPoolClass wStreamPoolClass;
+
+struct _wStreamPoolStatistics
+{
+	UINT64 hits;
+	UINT64 misses;
+	UINT64 discards;
+	UINT32 available;
+	UINT32 used;
+};
+typedef struct _wStreamPoolStatistics wStreamPoolStatistics;
+
 struct _wStreamPool
 {
-	int aSize;
-	int aCapacity;
-	wStream** aArray;
+	LONG volatile aSize;
+	LONG volatile uSize;
+	wStreamPoolClass classes[STREAM_POOL_CLASSES];
 
-	int uSize;
-	int uCapacity;
-	wStream** uArray;
+	LONGLONG volatile hits;
+	LONGLONG volatile misses;
+	LONGLONG volatile discards;
 
 	CRITICAL_SECTION lock;
+	LONG volatile refs;
+	LONG volatile closed;
 	BOOL synchronized;
 	size_t defaultSize;
 };
@@ -351,6 +378,7 @@ WINPR_API void StreamPool_AddRef(wStreamPool* pool, BYTE* ptr);
 WINPR_API void StreamPool_Release(wStreamPool* pool, BYTE* ptr);
 
 WINPR_API void StreamPool_Clear(wStreamPool* pool);
+WINPR_API void StreamPool_GetStatistics(wStreamPool* pool, wStreamPoolStatistics* stats);
 
 WINPR_API wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize);
 WINPR_API void StreamPool_Free(wStreamPool* pool);
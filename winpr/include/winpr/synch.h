@@ -381,6 +381,31 @@ WINPR_API int SetEventFileDescriptor(HANDLE hEvent, int FileDescriptor, ULONG mo
 
 WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
+/**
+ * Wait sets keep a set of handles registered with the kernel (epoll on
+ * Linux) between waits, so waiting on many handles does not have to set
+ * up every handle again for each call.
+ */
+
+typedef struct winpr_wait_set wWaitSet;
+
+WINPR_API wWaitSet* WaitSet_New(void);
+WINPR_API void WaitSet_Free(wWaitSet* waitSet);
+
+WINPR_API BOOL WaitSet_Add(wWaitSet* waitSet, HANDLE hHandle);
+WINPR_API BOOL WaitSet_Remove(wWaitSet* waitSet, HANDLE hHandle);
+WINPR_API DWORD WaitSet_Count(wWaitSet* waitSet);
+
+WINPR_API DWORD WaitSet_Wait(wWaitSet* waitSet, DWORD dwMilliseconds,
+		HANDLE* lpSignaled, DWORD nMaxSignaled, DWORD* lpnSignaled);
+
+/**
+ * Lets WaitForMultipleObjects on the calling thread keep a handle set it
+ * waits on repeatedly registered in a wait set. Returns FALSE if the cache
+ * is not available on this platform.
+ */
+WINPR_API BOOL WaitSet_EnableThreadCache(BOOL bEnable);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,8 @@
 
 #ifndef _WIN32
 
+#include <winpr/interlocked.h>
+
 #include <assert.h>
 #include <pthread.h>
 
@@ -43,6 +45,22 @@
 
 #include "../handle/handle.h"
 
+static LONG volatile handle_serial = 0;
+
+ULONG winpr_Handle_NextSerial(void)
+{
+	ULONG serial;
+
+	/* 0 marks handles without a serial */
+	do
+	{
+		serial = (ULONG) InterlockedIncrement(&handle_serial);
+	}
+	while (serial == 0);
+
+	return serial;
+}
+
 BOOL CloseHandle(HANDLE hObject)
 {
 	ULONG Type;
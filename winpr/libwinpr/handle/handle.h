@@ -43,6 +43,7 @@
 #define WINPR_HANDLE_DEF() \
 	ULONG Type; \
 	ULONG Mode; \
+	ULONG Serial; \
 	HANDLE_OPS *ops
 
 typedef BOOL (*pcIsHandled)(HANDLE handle);
@@ -110,6 +111,13 @@ struct winpr_handle
 };
 typedef struct winpr_handle WINPR_HANDLE;
 
+/**
+ * Every handle gets a serial number when it is created (and whenever its
+ * file descriptor is replaced), so wait sets can tell a recycled handle
+ * from the one they registered.
+ */
+ULONG winpr_Handle_NextSerial(void);
+
 static INLINE void WINPR_HANDLE_SET_TYPE_AND_MODE(void* _handle,
 						 ULONG _type, ULONG _mode)
 {
@@ -117,6 +125,7 @@ static INLINE void WINPR_HANDLE_SET_TYPE_AND_MODE(void* _handle,
 
 	hdl->Type = _type;
 	hdl->Mode = _mode;
+	hdl->Serial = winpr_Handle_NextSerial();
 }
 
 static INLINE BOOL winpr_Handle_GetInfo(HANDLE handle, ULONG* pType, WINPR_HANDLE** pObject)
@@ -0,0 +1,340 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Thread Pool API (Timer and I/O Dispatcher)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+
+#include "pool.h"
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
+
+#ifdef WINPR_POOL_EPOLL
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifdef WINPR_THREAD_POOL
+
+/**
+ * A single dispatcher thread per pool waits for the next timer to expire
+ * and, on Linux, for thread pool I/O handles to become readable. It never
+ * runs callbacks itself, everything is handed over to the pool workers.
+ */
+
+static void threadpool_free_io_garbage(PTP_POOL pool)
+{
+	PTP_IO next;
+
+	while (pool->IoGarbage)
+	{
+		next = pool->IoGarbage->Next;
+		free(pool->IoGarbage);
+		pool->IoGarbage = next;
+	}
+}
+
+#ifdef WINPR_POOL_EPOLL
+
+static void* threadpool_dispatcher_func(void* arg)
+{
+	int index;
+	int status;
+	UINT64 value;
+	PTP_IO io;
+	void* ptr;
+	BOOL terminate = FALSE;
+	PTP_POOL pool = (PTP_POOL) arg;
+	struct epoll_event events[64];
+
+	while (!terminate)
+	{
+		status = epoll_wait(pool->EpollFd, events, ARRAYSIZE(events), -1);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed with %d", errno);
+			break;
+		}
+
+		/**
+		 * Closed I/O objects are only freed here after the batch has been
+		 * processed, so a stale event never refers to freed memory.
+		 */
+		EnterCriticalSection(&pool->DispatchLock);
+		terminate = pool->DispatchTerminate;
+
+		for (index = 0; !terminate && (index < status); index++)
+		{
+			ptr = events[index].data.ptr;
+
+			if (ptr == &pool->WakeFd)
+			{
+				if (read(pool->WakeFd, &value, sizeof(value)) < 0)
+					WLog_DBG(TAG, "spurious dispatcher wake up");
+			}
+			else if (ptr == &pool->TimerFd)
+			{
+				if (read(pool->TimerFd, &value, sizeof(value)) < 0)
+					WLog_DBG(TAG, "spurious timer expiration");
+
+				threadpool_dispatcher_arm_timer(pool, threadpool_timer_expire(pool));
+			}
+			else
+			{
+				io = (PTP_IO) ptr;
+
+				if (!io->Closed && !threadpool_submit(pool, &io->Work))
+					WLog_ERR(TAG, "failed to submit I/O callback");
+			}
+		}
+
+		threadpool_free_io_garbage(pool);
+		LeaveCriticalSection(&pool->DispatchLock);
+	}
+
+	ExitThread(0);
+	return NULL;
+}
+
+static BOOL threadpool_dispatcher_add(PTP_POOL pool, int fd, void* ptr)
+{
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = ptr;
+	return epoll_ctl(pool->EpollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void threadpool_dispatcher_close(PTP_POOL pool)
+{
+	if (pool->EpollFd >= 0)
+		close(pool->EpollFd);
+
+	if (pool->TimerFd >= 0)
+		close(pool->TimerFd);
+
+	if (pool->WakeFd >= 0)
+		close(pool->WakeFd);
+
+	pool->EpollFd = pool->TimerFd = pool->WakeFd = -1;
+}
+
+static BOOL threadpool_dispatcher_open(PTP_POOL pool)
+{
+	pool->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	pool->TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	pool->WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if ((pool->EpollFd < 0) || (pool->TimerFd < 0) || (pool->WakeFd < 0))
+		goto fail;
+
+	if (!threadpool_dispatcher_add(pool, pool->TimerFd, &pool->TimerFd) ||
+	    !threadpool_dispatcher_add(pool, pool->WakeFd, &pool->WakeFd))
+		goto fail;
+
+	return TRUE;
+fail:
+	WLog_ERR(TAG, "failed to create dispatcher descriptors (errno %d)", errno);
+	threadpool_dispatcher_close(pool);
+	return FALSE;
+}
+
+VOID threadpool_dispatcher_wake(PTP_POOL pool)
+{
+	UINT64 value = 1;
+
+	if (write(pool->WakeFd, &value, sizeof(value)) < 0)
+		WLog_DBG(TAG, "dispatcher wake up already pending");
+}
+
+VOID threadpool_dispatcher_arm_timer(PTP_POOL pool, DWORD dwMilliseconds)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	if (dwMilliseconds != INFINITE)
+	{
+		its.it_value.tv_sec = dwMilliseconds / 1000;
+		its.it_value.tv_nsec = (dwMilliseconds % 1000) * 1000000;
+
+		/* a zero it_value would disarm the timer */
+		if (dwMilliseconds == 0)
+			its.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(pool->TimerFd, 0, &its, NULL) != 0)
+		WLog_ERR(TAG, "timerfd_settime failed with %d", errno);
+}
+
+/**
+ * I/O objects are registered one-shot: once the handle becomes readable
+ * the callback is queued and StartThreadpoolIo has to be called again
+ * before the next notification.
+ */
+BOOL threadpool_dispatcher_arm_io(PTP_POOL pool, PTP_IO io, BOOL enable)
+{
+	struct epoll_event event = { 0 };
+	event.events = enable ? (EPOLLIN | EPOLLONESHOT) : 0;
+	event.data.ptr = io;
+
+	if (epoll_ctl(pool->EpollFd, io->Registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+	              io->fd, &event) != 0)
+	{
+		WLog_ERR(TAG, "failed to register I/O handle (errno %d)", errno);
+		return FALSE;
+	}
+
+	io->Registered = TRUE;
+	return TRUE;
+}
+
+VOID threadpool_dispatcher_remove_io(PTP_POOL pool, PTP_IO io)
+{
+	if (!io->Registered)
+		return;
+
+	if (epoll_ctl(pool->EpollFd, EPOLL_CTL_DEL, io->fd, NULL) != 0)
+		WLog_WARN(TAG, "failed to unregister I/O handle (errno %d)", errno);
+
+	io->Registered = FALSE;
+}
+
+#else
+
+static void* threadpool_dispatcher_func(void* arg)
+{
+	DWORD timeout = INFINITE;
+	PTP_POOL pool = (PTP_POOL) arg;
+
+	while (1)
+	{
+		WaitForSingleObject(pool->WakeEvent, timeout);
+		EnterCriticalSection(&pool->DispatchLock);
+
+		if (pool->DispatchTerminate)
+		{
+			LeaveCriticalSection(&pool->DispatchLock);
+			break;
+		}
+
+		ResetEvent(pool->WakeEvent);
+		timeout = threadpool_timer_expire(pool);
+		threadpool_free_io_garbage(pool);
+		LeaveCriticalSection(&pool->DispatchLock);
+	}
+
+	ExitThread(0);
+	return NULL;
+}
+
+static void threadpool_dispatcher_close(PTP_POOL pool)
+{
+	if (pool->WakeEvent)
+		CloseHandle(pool->WakeEvent);
+
+	pool->WakeEvent = NULL;
+}
+
+static BOOL threadpool_dispatcher_open(PTP_POOL pool)
+{
+	return (pool->WakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) != NULL;
+}
+
+VOID threadpool_dispatcher_wake(PTP_POOL pool)
+{
+	SetEvent(pool->WakeEvent);
+}
+
+VOID threadpool_dispatcher_arm_timer(PTP_POOL pool, DWORD dwMilliseconds)
+{
+	/* the dispatcher recomputes its timeout from the timer heap */
+	SetEvent(pool->WakeEvent);
+}
+
+BOOL threadpool_dispatcher_arm_io(PTP_POOL pool, PTP_IO io, BOOL enable)
+{
+	WLog_ERR(TAG, "thread pool I/O is not supported on this platform");
+	return FALSE;
+}
+
+VOID threadpool_dispatcher_remove_io(PTP_POOL pool, PTP_IO io)
+{
+}
+
+#endif
+
+BOOL threadpool_dispatcher_start(PTP_POOL pool)
+{
+	BOOL rc = TRUE;
+	EnterCriticalSection(&pool->DispatchLock);
+
+	if (pool->Dispatcher)
+		goto out;
+
+	rc = FALSE;
+	pool->DispatchTerminate = FALSE;
+
+	if (!threadpool_dispatcher_open(pool))
+		goto out;
+
+	if (!(pool->Dispatcher = CreateThread(NULL, 0,
+	                                      (LPTHREAD_START_ROUTINE) threadpool_dispatcher_func,
+	                                      (void*) pool, 0, NULL)))
+	{
+		threadpool_dispatcher_close(pool);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	LeaveCriticalSection(&pool->DispatchLock);
+	return rc;
+}
+
+VOID threadpool_dispatcher_stop(PTP_POOL pool)
+{
+	EnterCriticalSection(&pool->DispatchLock);
+
+	if (!pool->Dispatcher)
+	{
+		LeaveCriticalSection(&pool->DispatchLock);
+		return;
+	}
+
+	pool->DispatchTerminate = TRUE;
+	threadpool_dispatcher_wake(pool);
+	LeaveCriticalSection(&pool->DispatchLock);
+	WaitForSingleObject(pool->Dispatcher, INFINITE);
+	CloseHandle(pool->Dispatcher);
+	pool->Dispatcher = NULL;
+	threadpool_dispatcher_close(pool);
+	threadpool_free_io_garbage(pool);
+	free(pool->TimerHeap);
+	pool->TimerHeap = NULL;
+	pool->TimerCount = 0;
+	pool->TimerCapacity = 0;
+}
+
+#endif /* WINPR_THREAD_POOL defined */
@@ -24,31 +24,117 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 
+#include "pool.h"
+#include "../handle/handle.h"
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
+
 #ifdef WINPR_THREAD_POOL
 
+/**
+ * There are no I/O completion ports outside of Windows, thread pool I/O
+ * is readiness based instead: after StartThreadpoolIo the callback is run
+ * once the handle becomes readable, with a NULL Overlapped and zero bytes
+ * transferred. The callback performs the (non-blocking) read itself.
+ */
+
+static VOID CALLBACK threadpool_io_callback(PTP_CALLBACK_INSTANCE instance, PVOID context,
+        PTP_WORK work)
+{
+	PTP_IO io = (PTP_IO) context;
+	io->IoCallback(instance, io->CallbackParameter, NULL, NO_ERROR, 0, io);
+}
+
 PTP_IO winpr_CreateThreadpoolIo(HANDLE fl, PTP_WIN32_IO_CALLBACK pfnio, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
 {
-	return NULL;
+	int fd;
+	PTP_IO io;
+	PTP_POOL pool;
+
+	if (!pfnio)
+		return NULL;
+
+	if ((fd = winpr_Handle_getFd(fl)) < 0)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	if (!(pool = (pcbe && pcbe->Pool) ? pcbe->Pool : GetDefaultThreadpool()))
+		return NULL;
+
+	if (!threadpool_dispatcher_start(pool))
+		return NULL;
+
+	if (!(io = (PTP_IO) calloc(1, sizeof(TP_IO))))
+		return NULL;
+
+	io->IoCallback = pfnio;
+	io->CallbackParameter = pv;
+	io->CallbackEnvironment = pcbe;
+	io->Pool = pool;
+	io->Handle = fl;
+	io->fd = fd;
+	io->Work.WorkCallback = threadpool_io_callback;
+	io->Work.CallbackParameter = io;
+	io->Work.CallbackEnvironment = pcbe;
+	return io;
 }
 
 VOID winpr_CloseThreadpoolIo(PTP_IO pio)
 {
+	PTP_POOL pool;
+
+	if (!pio)
+		return;
+
+	pool = pio->Pool;
+	EnterCriticalSection(&pool->DispatchLock);
+	pio->Closed = TRUE;
+	threadpool_dispatcher_remove_io(pool, pio);
+	LeaveCriticalSection(&pool->DispatchLock);
+	threadpool_wait(pool, &pio->Work);
 
+	/* the dispatcher may still hold an event for it, let it free the object */
+	EnterCriticalSection(&pool->DispatchLock);
+	pio->Next = pool->IoGarbage;
+	pool->IoGarbage = pio;
+	LeaveCriticalSection(&pool->DispatchLock);
+	threadpool_dispatcher_wake(pool);
 }
 
 VOID winpr_StartThreadpoolIo(PTP_IO pio)
 {
+	if (!pio)
+		return;
 
+	EnterCriticalSection(&pio->Pool->DispatchLock);
+
+	if (!pio->Closed)
+		threadpool_dispatcher_arm_io(pio->Pool, pio, TRUE);
+
+	LeaveCriticalSection(&pio->Pool->DispatchLock);
 }
 
 VOID winpr_CancelThreadpoolIo(PTP_IO pio)
 {
+	if (!pio)
+		return;
+
+	EnterCriticalSection(&pio->Pool->DispatchLock);
+
+	if (!pio->Closed && pio->Registered)
+		threadpool_dispatcher_arm_io(pio->Pool, pio, FALSE);
 
+	LeaveCriticalSection(&pio->Pool->DispatchLock);
 }
 
 VOID winpr_WaitForThreadpoolIoCallbacks(PTP_IO pio, BOOL fCancelPendingCallbacks)
 {
+	if (!pio)
+		return;
 
+	threadpool_wait(pio->Pool, &pio->Work);
 }
 
 #endif
@@ -17,6 +17,10 @@
  * limitations under the License.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -24,8 +28,17 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+#include <winpr/environment.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "pool.h"
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
 
 #ifdef WINPR_THREAD_POOL
 
@@ -54,110 +67,642 @@ static TP_POOL DEFAULT_POOL =
 {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
-	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
+	0,    /* LONG WorkerCount */
 };
 
-static void* thread_pool_work_func(void* arg)
+static LONGLONG threadpool_load(LONGLONG volatile* value)
 {
-	DWORD status;
-	PTP_POOL pool;
-	PTP_WORK work;
-	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+	return InterlockedCompareExchange64(value, 0, 0);
+}
 
-	pool = (PTP_POOL) arg;
+/* Bottom is only ever written by the owning worker */
+static void threadpool_store(LONGLONG volatile* value, LONGLONG newValue)
+{
+	InterlockedCompareExchange64(value, newValue, *value);
+}
 
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+static void threadpool_push_list(PTP_CALLBACK_INSTANCE volatile* head,
+                                 PTP_CALLBACK_INSTANCE first, PTP_CALLBACK_INSTANCE last)
+{
+	PTP_CALLBACK_INSTANCE top;
 
-	while (1)
+	do
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		top = *head;
+		last->Next = top;
+	}
+	while (InterlockedCompareExchangePointer((PVOID volatile*) head, first, top) != top);
+}
 
-		if (status == WAIT_OBJECT_0)
-			break;
+static PTP_CALLBACK_INSTANCE threadpool_flush_list(PTP_CALLBACK_INSTANCE volatile* head)
+{
+	PTP_CALLBACK_INSTANCE top;
 
-		if (status != (WAIT_OBJECT_0 + 1))
+	do
+	{
+		top = *head;
+	}
+	while (top && (InterlockedCompareExchangePointer((PVOID volatile*) head, NULL, top) != top));
+
+	return top;
+}
+
+static PTP_CALLBACK_INSTANCE threadpool_acquire_instance(PTP_POOL pool)
+{
+	PTP_CALLBACK_INSTANCE top = NULL;
+
+	/**
+	 * Pushes are lock-free, popping is serialized by FreeLock: with a single
+	 * popper a node can not be removed and pushed again between reading
+	 * top->Next and the exchange, so the pop is ABA safe. A contended
+	 * pop simply falls back to malloc.
+	 */
+	if (InterlockedCompareExchange(&pool->FreeLock, 1, 0) == 0)
+	{
+		do
+		{
+			top = pool->FreeList;
+		}
+		while (top && (InterlockedCompareExchangePointer((PVOID volatile*) &pool->FreeList,
+		               top->Next, top) != top));
+
+		InterlockedExchange(&pool->FreeLock, 0);
+	}
+
+	if (top)
+	{
+		InterlockedDecrement(&pool->FreeCount);
+		return top;
+	}
+
+	return (PTP_CALLBACK_INSTANCE) malloc(sizeof(TP_CALLBACK_INSTANCE));
+}
+
+static void threadpool_release_instance(PTP_POOL pool, PTP_CALLBACK_INSTANCE instance)
+{
+	if (InterlockedIncrement(&pool->FreeCount) > TP_FREE_MAX)
+	{
+		InterlockedDecrement(&pool->FreeCount);
+		free(instance);
+		return;
+	}
+
+	threadpool_push_list(&pool->FreeList, instance, instance);
+}
+
+static void threadpool_free_list(PTP_CALLBACK_INSTANCE list)
+{
+	PTP_CALLBACK_INSTANCE next;
+
+	while (list)
+	{
+		next = list->Next;
+		free(list);
+		list = next;
+	}
+}
+
+static BOOL threadpool_deque_push(PTP_WORKER worker, PTP_CALLBACK_INSTANCE instance)
+{
+	LONGLONG bottom = worker->Bottom;
+	LONGLONG top = threadpool_load(&worker->Top);
+
+	if ((bottom - top) >= TP_DEQUE_SIZE)
+		return FALSE;
+
+	worker->Deque[bottom & TP_DEQUE_MASK] = instance;
+	worker->DequeWork[bottom & TP_DEQUE_MASK] = instance->Work;
+	threadpool_store(&worker->Bottom, bottom + 1);
+	return TRUE;
+}
+
+static PTP_CALLBACK_INSTANCE threadpool_deque_pop(PTP_WORKER worker)
+{
+	LONGLONG top;
+	LONGLONG bottom = worker->Bottom - 1;
+	PTP_CALLBACK_INSTANCE instance;
+
+	threadpool_store(&worker->Bottom, bottom);
+	top = threadpool_load(&worker->Top);
+
+	if (top > bottom)
+	{
+		threadpool_store(&worker->Bottom, bottom + 1);
+		return NULL;
+	}
+
+	instance = worker->Deque[bottom & TP_DEQUE_MASK];
+
+	if (top == bottom)
+	{
+		/* last item, race against thieves */
+		if (InterlockedCompareExchange64(&worker->Top, top + 1, top) != top)
+			instance = NULL;
+
+		threadpool_store(&worker->Bottom, bottom + 1);
+	}
+
+	return instance;
+}
+
+/**
+ * Steals the oldest item of worker. With work set only an instance of that
+ * work is taken, a stale DequeWork entry makes the exchange fail.
+ */
+static PTP_CALLBACK_INSTANCE threadpool_deque_steal(PTP_WORKER worker, PTP_WORK work)
+{
+	LONGLONG top = threadpool_load(&worker->Top);
+	LONGLONG bottom = threadpool_load(&worker->Bottom);
+	PTP_CALLBACK_INSTANCE instance;
+
+	if (top >= bottom)
+		return NULL;
+
+	if (work && (worker->DequeWork[top & TP_DEQUE_MASK] != work))
+		return NULL;
+
+	instance = worker->Deque[top & TP_DEQUE_MASK];
+
+	if (InterlockedCompareExchange64(&worker->Top, top + 1, top) != top)
+		return NULL;
+
+	return instance;
+}
+
+/**
+ * Wakes up one sleeping worker, if any. The sleeper is claimed by
+ * decrementing Sleepers before the semaphore is released.
+ */
+static BOOL threadpool_claim_sleeper(PTP_POOL pool)
+{
+	LONG sleepers;
+
+	while ((sleepers = InterlockedCompareExchange(&pool->Sleepers, 0, 0)) > 0)
+	{
+		if (InterlockedCompareExchange(&pool->Sleepers, sleepers - 1, sleepers) == sleepers)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void threadpool_wake(PTP_POOL pool)
+{
+	if (threadpool_claim_sleeper(pool))
+		ReleaseSemaphore(pool->WakeSemaphore, 1, NULL);
+}
+
+/**
+ * Takes all work queued in the inbox of victim, returns the oldest item
+ * and moves the rest to the deque of worker where other workers can
+ * steal it from.
+ */
+static PTP_CALLBACK_INSTANCE threadpool_take_inbox(PTP_WORKER worker, PTP_WORKER victim)
+{
+	BOOL moved = FALSE;
+	PTP_CALLBACK_INSTANCE next;
+	PTP_CALLBACK_INSTANCE first;
+	PTP_CALLBACK_INSTANCE last;
+	PTP_CALLBACK_INSTANCE list = threadpool_flush_list(&victim->Inbox);
+	PTP_CALLBACK_INSTANCE fifo = NULL;
+
+	if (!list)
+		return NULL;
+
+	/* the inbox is a LIFO stack, restore submission order */
+	last = list;
+
+	while (list)
+	{
+		next = list->Next;
+		list->Next = fifo;
+		fifo = list;
+		list = next;
+	}
+
+	first = fifo;
+	fifo = fifo->Next;
+
+	while (fifo)
+	{
+		/* once pushed the item may be stolen and recycled right away */
+		next = fifo->Next;
+
+		if (!threadpool_deque_push(worker, fifo))
+		{
+			threadpool_push_list(&worker->Inbox, fifo, last);
 			break;
+		}
+
+		moved = TRUE;
+		fifo = next;
+	}
+
+	if (moved)
+		threadpool_wake(worker->Pool);
+
+	return first;
+}
+
+static PTP_CALLBACK_INSTANCE threadpool_worker_next(PTP_WORKER worker)
+{
+	LONG index;
+	LONG count;
+	PTP_WORKER victim;
+	PTP_POOL pool = worker->Pool;
+	PTP_CALLBACK_INSTANCE instance;
+
+	if ((instance = threadpool_deque_pop(worker)))
+		return instance;
+
+	if ((instance = threadpool_take_inbox(worker, worker)))
+		return instance;
+
+	count = pool->WorkerCount;
+
+	for (index = 1; index < count; index++)
+	{
+		victim = pool->Workers[(worker->Index + index) % count];
+
+		if ((instance = threadpool_deque_steal(victim, NULL)))
+			return instance;
+
+		if ((instance = threadpool_take_inbox(worker, victim)))
+			return instance;
+	}
+
+	return NULL;
+}
+
+/**
+ * Wakes the threads waiting for work. work is only compared, it may
+ * already be closed.
+ */
+static void threadpool_signal_waiters(PTP_POOL pool, PTP_WORK work)
+{
+	PTP_WAIT_BLOCK block;
+	EnterCriticalSection(&pool->WaitLock);
+
+	for (block = pool->WaitList; block; block = block->Next)
+	{
+		if (block->Work == work)
+			SetEvent(block->Event);
+	}
+
+	LeaveCriticalSection(&pool->WaitLock);
+}
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE) Queue_Dequeue(pool->PendingQueue);
+static void threadpool_run(PTP_POOL pool, PTP_CALLBACK_INSTANCE instance)
+{
+	PTP_WORK work = instance->Work;
+	work->WorkCallback(instance, work->CallbackParameter, work);
+	threadpool_release_instance(pool, instance);
 
-		if (callbackInstance)
+	/* work may be closed as soon as Pending drops to zero, do not touch it anymore */
+	if (InterlockedDecrement(&work->Pending) == 0)
+	{
+		if (InterlockedCompareExchange(&pool->Waiters, 0, 0) > 0)
+			threadpool_signal_waiters(pool, work);
+	}
+}
+
+static void threadpool_set_affinity(PTP_WORKER worker)
+{
+	SYSTEM_INFO info;
+	DWORD cpu;
+	GetSystemInfo(&info);
+
+	if (info.dwNumberOfProcessors < 1)
+		return;
+
+	cpu = worker->Index % info.dwNumberOfProcessors;
+#if defined(__linux__)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+			WLog_WARN(TAG, "failed to bind pool worker %u to cpu %u", worker->Index, cpu);
+	}
+#elif defined(_WIN32)
+
+	if (!SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << cpu))
+		WLog_WARN(TAG, "failed to bind pool worker %u to cpu %u", worker->Index, cpu);
+
+#endif
+}
+
+static void* thread_pool_work_func(void* arg)
+{
+	PTP_WORKER worker = (PTP_WORKER) arg;
+	PTP_POOL pool = worker->Pool;
+	PTP_CALLBACK_INSTANCE instance;
+
+	if (pool->Affinity)
+		threadpool_set_affinity(worker);
+
+	while (!InterlockedCompareExchange(&pool->Terminate, 0, 0))
+	{
+		if ((instance = threadpool_worker_next(worker)))
+		{
+			threadpool_run(pool, instance);
+			continue;
+		}
+
+		/**
+		 * Announce that we are going to sleep before looking for work a
+		 * last time, a submitter either sees us as sleeper or we see its work.
+		 */
+		InterlockedIncrement(&pool->Sleepers);
+
+		if ((instance = threadpool_worker_next(worker)))
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			/* someone already claimed us, consume the pending wake up */
+			if (!threadpool_claim_sleeper(pool))
+				WaitForSingleObject(pool->WakeSemaphore, INFINITE);
+
+			threadpool_run(pool, instance);
+			continue;
 		}
+
+		WaitForSingleObject(pool->WakeSemaphore, INFINITE);
 	}
 
 	ExitThread(0);
 	return NULL;
 }
 
-static void threads_close(void *thread)
+static BOOL threadpool_add_worker(PTP_POOL pool)
 {
-	WaitForSingleObject(thread, INFINITE);
-	CloseHandle(thread);
+	PTP_WORKER worker;
+	LONG index = pool->WorkerCount;
+
+	if (index >= TP_WORKER_MAX)
+		return FALSE;
+
+	if (!(worker = (PTP_WORKER) calloc(1, sizeof(TP_WORKER))))
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = (DWORD) index;
+
+	if (!(worker->Thread = CreateThread(NULL, 0,
+	                                    (LPTHREAD_START_ROUTINE) thread_pool_work_func,
+	                                    (void*) worker, 0, NULL)))
+	{
+		free(worker);
+		return FALSE;
+	}
+
+	/* publish the worker only once it runs, submitters pick inboxes by index */
+	pool->Workers[index] = worker;
+	InterlockedIncrement(&pool->WorkerCount);
+	return TRUE;
+}
+
+static void threadpool_close_workers(PTP_POOL pool)
+{
+	LONG index;
+	PTP_WORKER worker;
+	PTP_CALLBACK_INSTANCE instance;
+
+	InterlockedExchange(&pool->Terminate, 1);
+
+	if (pool->WorkerCount > 0)
+		ReleaseSemaphore(pool->WakeSemaphore, pool->WorkerCount, NULL);
+
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		worker = pool->Workers[index];
+		WaitForSingleObject(worker->Thread, INFINITE);
+		CloseHandle(worker->Thread);
+	}
+
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		worker = pool->Workers[index];
+
+		while ((instance = threadpool_deque_pop(worker)))
+			free(instance);
+
+		threadpool_free_list(worker->Inbox);
+		free(worker);
+		pool->Workers[index] = NULL;
+	}
+
+	pool->WorkerCount = 0;
+	threadpool_free_list(pool->FreeList);
+	pool->FreeList = NULL;
+	pool->FreeCount = 0;
+}
+
+static void threadpool_free_wait_blocks(PTP_POOL pool)
+{
+	PTP_WAIT_BLOCK next;
+
+	while (pool->WaitFree)
+	{
+		next = pool->WaitFree->Next;
+		CloseHandle(pool->WaitFree->Event);
+		free(pool->WaitFree);
+		pool->WaitFree = next;
+	}
+}
+
+static BOOL threadpool_affinity_enabled(void)
+{
+	char buffer[16];
+	DWORD length = GetEnvironmentVariableA("WINPR_THREADPOOL_AFFINITY", buffer, sizeof(buffer));
+
+	if ((length == 0) || (length >= sizeof(buffer)))
+		return FALSE;
+
+	return strcmp(buffer, "0") != 0;
 }
 
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
-	int index;
-	HANDLE thread;
+	DWORD index;
+	DWORD count;
+	SYSTEM_INFO info;
 
-	if (pool->Threads)
+	if (pool->WakeSemaphore)
 		return TRUE;
 
 	pool->Minimum = 0;
 	pool->Maximum = 500;
+	pool->Terminate = 0;
+	pool->Affinity = threadpool_affinity_enabled();
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail_queue_new;
+	if (!(pool->WakeSemaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL)))
+		goto fail_wake_semaphore;
 
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail_countdown_event;
+	if (!InitializeCriticalSectionAndSpinCount(&pool->WaitLock, 4000))
+		goto fail_wait_lock;
 
-	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
-		goto fail_terminate_event;
+	if (!InitializeCriticalSectionAndSpinCount(&pool->DispatchLock, 4000))
+		goto fail_dispatch_lock;
 
-	if (!(pool->Threads = ArrayList_New(TRUE)))
-		goto fail_thread_array;
+	/* one worker per processor */
+	GetSystemInfo(&info);
+	count = info.dwNumberOfProcessors;
 
-	pool->Threads->object.fnObjectFree = threads_close;
+	if (count < 2)
+		count = 2;
 
-	for (index = 0; index < 4; index++)
-	{
-		if (!(thread = CreateThread(NULL, 0,
-					(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-					(void*) pool, 0, NULL)))
-		{
-			goto fail_create_threads;
-		}
+	if (count > TP_WORKER_MAX)
+		count = TP_WORKER_MAX;
 
-		if (ArrayList_Add(pool->Threads, thread) < 0)
+	for (index = 0; index < count; index++)
+	{
+		if (!threadpool_add_worker(pool))
 			goto fail_create_threads;
 	}
 
 	return TRUE;
 
 fail_create_threads:
-	SetEvent(pool->TerminateEvent);
-	ArrayList_Free(pool->Threads);
-	pool->Threads = NULL;
-fail_thread_array:
-	CloseHandle(pool->TerminateEvent);
-	pool->TerminateEvent = NULL;
-fail_terminate_event:
-	CountdownEvent_Free(pool->WorkComplete);
-	pool->WorkComplete = NULL;
-fail_countdown_event:
-	Queue_Free(pool->PendingQueue);
-	pool->WorkComplete = NULL;
-fail_queue_new:
+	threadpool_close_workers(pool);
+	DeleteCriticalSection(&pool->DispatchLock);
+fail_dispatch_lock:
+	DeleteCriticalSection(&pool->WaitLock);
+fail_wait_lock:
+	CloseHandle(pool->WakeSemaphore);
+	pool->WakeSemaphore = NULL;
+fail_wake_semaphore:
+
+	return FALSE;
+}
+
+BOOL threadpool_submit(PTP_POOL pool, PTP_WORK work)
+{
+	ULONG index;
+	PTP_CALLBACK_INSTANCE instance;
+
+	if (!(instance = threadpool_acquire_instance(pool)))
+		return FALSE;
+
+	instance->Work = work;
+	InterlockedIncrement(&work->Pending);
+	index = ((ULONG) InterlockedIncrement(&pool->NextWorker)) % pool->WorkerCount;
+	threadpool_push_list(&pool->Workers[index]->Inbox, instance, instance);
+	threadpool_wake(pool);
+	return TRUE;
+}
+
+static PTP_WAIT_BLOCK threadpool_wait_register(PTP_POOL pool, PTP_WORK work)
+{
+	PTP_WAIT_BLOCK block;
+	EnterCriticalSection(&pool->WaitLock);
+
+	if ((block = pool->WaitFree))
+		pool->WaitFree = block->Next;
+
+	LeaveCriticalSection(&pool->WaitLock);
+
+	if (!block)
+	{
+		if (!(block = (PTP_WAIT_BLOCK) calloc(1, sizeof(TP_WAIT_BLOCK))))
+			return NULL;
+
+		if (!(block->Event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		{
+			free(block);
+			return NULL;
+		}
+	}
+
+	ResetEvent(block->Event);
+	block->Work = work;
+	EnterCriticalSection(&pool->WaitLock);
+	block->Next = pool->WaitList;
+	pool->WaitList = block;
+	LeaveCriticalSection(&pool->WaitLock);
+	/* completions check Waiters after Pending, the caller checks Pending after this */
+	InterlockedIncrement(&pool->Waiters);
+	return block;
+}
+
+static void threadpool_wait_unregister(PTP_POOL pool, PTP_WAIT_BLOCK block)
+{
+	PTP_WAIT_BLOCK* link;
+	InterlockedDecrement(&pool->Waiters);
+	EnterCriticalSection(&pool->WaitLock);
+
+	for (link = &pool->WaitList; *link; link = &(*link)->Next)
+	{
+		if (*link == block)
+		{
+			*link = block->Next;
+			break;
+		}
+	}
+
+	block->Work = NULL;
+	block->Next = pool->WaitFree;
+	pool->WaitFree = block;
+	LeaveCriticalSection(&pool->WaitLock);
+}
+
+/**
+ * Waits until all submitted callbacks of work have completed, running
+ * queued callbacks of the same work in the meantime. The waiter blocks on
+ * its own event which is only set when the last callback of work returns.
+ */
+VOID threadpool_wait(PTP_POOL pool, PTP_WORK work)
+{
+	PTP_WAIT_BLOCK block = NULL;
+
+	while (InterlockedCompareExchange(&work->Pending, 0, 0) > 0)
+	{
+		if (threadpool_help(pool, work))
+			continue;
+
+		if (!block)
+		{
+			/* register before checking Pending again, a completion now wakes us */
+			if (!(block = threadpool_wait_register(pool, work)))
+			{
+				WLog_ERR(TAG, "failed to wait for work completion");
+				return;
+			}
+
+			continue;
+		}
+
+		if (WaitForSingleObject(block->Event, INFINITE) != WAIT_OBJECT_0)
+		{
+			WLog_ERR(TAG, "error waiting on work completion");
+			break;
+		}
+
+		ResetEvent(block->Event);
+	}
+
+	if (block)
+		threadpool_wait_unregister(pool, block);
+}
+
+/**
+ * Runs one queued callback of work on the calling thread. Threads waiting
+ * for their work to complete help out instead of blocking, callbacks of
+ * other work objects are left to the workers since the waiter may hold
+ * locks they need.
+ */
+BOOL threadpool_help(PTP_POOL pool, PTP_WORK work)
+{
+	LONG index;
+	PTP_CALLBACK_INSTANCE instance;
+
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		if ((instance = threadpool_deque_steal(pool->Workers[index], work)))
+		{
+			threadpool_run(pool, instance);
+			return TRUE;
+		}
+	}
 
 	return FALSE;
 }
@@ -204,19 +749,16 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
-
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
-	CloseHandle(ptpp->TerminateEvent);
+	threadpool_dispatcher_stop(ptpp);
+	threadpool_close_workers(ptpp);
+	threadpool_free_wait_blocks(ptpp);
+	DeleteCriticalSection(&ptpp->DispatchLock);
+	DeleteCriticalSection(&ptpp->WaitLock);
+	CloseHandle(ptpp->WakeSemaphore);
 
 	if (ptpp == &DEFAULT_POOL)
 	{
-		ptpp->Threads = NULL;
-		ptpp->PendingQueue = NULL;
-		ptpp->WorkComplete = NULL;
-		ptpp->TerminateEvent = NULL;
+		ptpp->WakeSemaphore = NULL;
 	}
 	else
 	{
@@ -226,7 +768,6 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -234,16 +775,9 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 #endif
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < ptpp->Minimum)
+	while (((DWORD) ptpp->WorkerCount < ptpp->Minimum) && (ptpp->WorkerCount < TP_WORKER_MAX))
 	{
-		if (!(thread = CreateThread(NULL, 0,
-				(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-				(void*) ptpp, 0, NULL)))
-		{
-			return FALSE;
-		}
-
-		if (ArrayList_Add(ptpp->Threads, thread) < 0)
+		if (!threadpool_add_worker(ptpp))
 			return FALSE;
 	}
 
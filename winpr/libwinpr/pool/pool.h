@@ -25,19 +25,86 @@
 #include <winpr/thread.h>
 #include <winpr/collections.h>
 
+#if defined(HAVE_EPOLL_H) && defined(HAVE_TIMERFD_H) && defined(HAVE_EVENTFD_H)
+#define WINPR_POOL_EPOLL	1
+#endif
+
+#define TP_WORKER_MAX		64
+#define TP_DEQUE_SIZE		1024
+#define TP_DEQUE_MASK		(TP_DEQUE_SIZE - 1)
+#define TP_FREE_MAX		4096
+
 struct _TP_CALLBACK_INSTANCE
 {
 	PTP_WORK Work;
+	PTP_CALLBACK_INSTANCE Next;
+};
+
+/**
+ * A thread blocked in threadpool_wait. Completions only compare the work
+ * pointer, a work may be closed as soon as its wait returned.
+ */
+struct _TP_WAIT_BLOCK
+{
+	PTP_WORK Work;
+	HANDLE Event;
+	struct _TP_WAIT_BLOCK* Next;
 };
+typedef struct _TP_WAIT_BLOCK TP_WAIT_BLOCK, *PTP_WAIT_BLOCK;
+
+/**
+ * Each worker owns a Chase-Lev deque it pops from the bottom while idle
+ * workers steal from the top. Work submitted from outside the pool is
+ * pushed onto a lock-free inbox which the owner (or a thief) drains.
+ */
+struct _TP_WORKER
+{
+	PTP_POOL Pool;
+	DWORD Index;
+	HANDLE Thread;
+	PTP_CALLBACK_INSTANCE volatile Inbox;
+	LONGLONG volatile Top;
+	LONGLONG volatile Bottom;
+	PTP_CALLBACK_INSTANCE Deque[TP_DEQUE_SIZE];
+	/* work of each queued instance, thieves check it without touching the instance */
+	PTP_WORK DequeWork[TP_DEQUE_SIZE];
+};
+typedef struct _TP_WORKER TP_WORKER, *PTP_WORKER;
 
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
-	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	LONG volatile WorkerCount;
+	PTP_WORKER Workers[TP_WORKER_MAX];
+	LONG volatile NextWorker;
+	LONG volatile Sleepers;
+	LONG volatile Waiters;
+	LONG volatile Terminate;
+	BOOL Affinity;
+	HANDLE WakeSemaphore;
+	CRITICAL_SECTION WaitLock;
+	PTP_WAIT_BLOCK WaitList;
+	PTP_WAIT_BLOCK WaitFree;
+	PTP_CALLBACK_INSTANCE volatile FreeList;
+	LONG volatile FreeCount;
+	LONG volatile FreeLock;
+
+	/* timer and I/O dispatcher, started with the first timer or I/O object */
+	CRITICAL_SECTION DispatchLock;
+	HANDLE Dispatcher;
+	BOOL DispatchTerminate;
+	PTP_TIMER* TimerHeap;
+	DWORD TimerCount;
+	DWORD TimerCapacity;
+	PTP_IO IoGarbage;
+#ifdef WINPR_POOL_EPOLL
+	int EpollFd;
+	int TimerFd;
+	int WakeFd;
+#else
+	HANDLE WakeEvent;
+#endif
 };
 
 struct _TP_WORK
@@ -45,11 +112,19 @@ struct _TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	LONG volatile Pending;
 };
 
 struct _TP_TIMER
 {
-	void* dummy;
+	PVOID CallbackParameter;
+	PTP_TIMER_CALLBACK TimerCallback;
+	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	PTP_POOL Pool;
+	TP_WORK Work;
+	ULONGLONG DueTime;
+	DWORD Period;
+	DWORD HeapIndex;
 };
 
 struct _TP_WAIT
@@ -59,7 +134,16 @@ struct _TP_WAIT
 
 struct _TP_IO
 {
-	void* dummy;
+	PVOID CallbackParameter;
+	PTP_WIN32_IO_CALLBACK IoCallback;
+	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	PTP_POOL Pool;
+	TP_WORK Work;
+	HANDLE Handle;
+	int fd;
+	BOOL Registered;
+	BOOL Closed;
+	PTP_IO Next;
 };
 
 struct _TP_CLEANUP_GROUP
@@ -69,5 +153,18 @@ struct _TP_CLEANUP_GROUP
 
 PTP_POOL GetDefaultThreadpool();
 
+BOOL threadpool_submit(PTP_POOL pool, PTP_WORK work);
+BOOL threadpool_help(PTP_POOL pool, PTP_WORK work);
+VOID threadpool_wait(PTP_POOL pool, PTP_WORK work);
+
+BOOL threadpool_dispatcher_start(PTP_POOL pool);
+VOID threadpool_dispatcher_stop(PTP_POOL pool);
+VOID threadpool_dispatcher_wake(PTP_POOL pool);
+VOID threadpool_dispatcher_arm_timer(PTP_POOL pool, DWORD dwMilliseconds);
+BOOL threadpool_dispatcher_arm_io(PTP_POOL pool, PTP_IO io, BOOL enable);
+VOID threadpool_dispatcher_remove_io(PTP_POOL pool, PTP_IO io);
+
+DWORD threadpool_timer_expire(PTP_POOL pool);
+
 #endif /* WINPR_POOL_PRIVATE_H */
 
@@ -1,9 +1,98 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/pipe.h>
+#include <winpr/file.h>
+#include <winpr/synch.h>
+
+struct test_io
+{
+	HANDLE pipe;
+	HANDLE event;
+	DWORD received;
+};
+
+static void CALLBACK test_IoCallback(PTP_CALLBACK_INSTANCE instance, PVOID context,
+                                     PVOID overlapped, ULONG result, ULONG_PTR transferred, PTP_IO io)
+{
+	BYTE buffer[16];
+	DWORD read = 0;
+	struct test_io* test = (struct test_io*) context;
+
+	if (!ReadFile(test->pipe, buffer, sizeof(buffer), &read, NULL))
+		return;
+
+	test->received += read;
+	SetEvent(test->event);
+}
 
 int TestPoolIO(int argc, char* argv[])
 {
+#if defined(_WIN32)
+	/* thread pool I/O expects overlapped handles on Windows */
 	return 0;
-}
+#else
+	int rc = -1;
+	int index;
+	DWORD written;
+	HANDLE writePipe = NULL;
+	PTP_IO io = NULL;
+	struct test_io test = { 0 };
+
+	if (!(test.event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return -1;
+
+	if (!CreatePipe(&test.pipe, &writePipe, NULL, 0))
+	{
+		printf("CreatePipe failure\n");
+		goto fail;
+	}
+
+	if (!(io = CreateThreadpoolIo(test.pipe, test_IoCallback, &test, NULL)))
+	{
+		printf("CreateThreadpoolIo failure\n");
+		goto fail;
+	}
 
+	for (index = 0; index < 3; index++)
+	{
+		ResetEvent(test.event);
+		StartThreadpoolIo(io);
+
+		if (!WriteFile(writePipe, "ping", 4, &written, NULL))
+		{
+			printf("WriteFile failure\n");
+			goto fail;
+		}
+
+		if (WaitForSingleObject(test.event, 5000) != WAIT_OBJECT_0)
+		{
+			printf("I/O callback %d did not run\n", index);
+			goto fail;
+		}
+
+		WaitForThreadpoolIoCallbacks(io, FALSE);
+	}
+
+	if (test.received != 12)
+	{
+		printf("expected 12 bytes, received %u\n", (unsigned) test.received);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	if (io)
+		CloseThreadpoolIo(io);
+
+	if (writePipe)
+		CloseHandle(writePipe);
+
+	if (test.pipe)
+		CloseHandle(test.pipe);
+
+	CloseHandle(test.event);
+	return rc;
+#endif
+}
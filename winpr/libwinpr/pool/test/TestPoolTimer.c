@@ -1,9 +1,158 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#define TEST_TIMER_COUNT	200
+
+struct test_timer
+{
+	LONG count;
+	LONG limit;
+	HANDLE event;
+};
+
+static void CALLBACK test_TimerCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_TIMER timer)
+{
+	struct test_timer* test = (struct test_timer*) context;
+
+	if (InterlockedIncrement(&test->count) == test->limit)
+		SetEvent(test->event);
+}
+
+static void test_relative_due_time(FILETIME* ft, DWORD ms)
+{
+	LONGLONG due = -((LONGLONG) ms * 10000);
+	ft->dwLowDateTime = (DWORD) (due & 0xFFFFFFFF);
+	ft->dwHighDateTime = (DWORD) (due >> 32);
+}
+
+static BOOL test_periodic_timer(PTP_CALLBACK_ENVIRON environment)
+{
+	BOOL rc = FALSE;
+	FILETIME due;
+	UINT64 start;
+	UINT64 elapsed;
+	PTP_TIMER timer;
+	struct test_timer test = { 0, 10, NULL };
+
+	if (!(test.event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!(timer = CreateThreadpoolTimer(test_TimerCallback, &test, environment)))
+	{
+		printf("CreateThreadpoolTimer failure\n");
+		goto fail;
+	}
+
+	test_relative_due_time(&due, 10);
+	start = GetTickCount64();
+	SetThreadpoolTimer(timer, &due, 10, 0);
+
+	if (!IsThreadpoolTimerSet(timer))
+	{
+		printf("periodic timer is not set\n");
+		goto fail;
+	}
+
+	if (WaitForSingleObject(test.event, 5000) != WAIT_OBJECT_0)
+	{
+		printf("periodic timer fired %d times only\n", (int) test.count);
+		goto fail;
+	}
+
+	elapsed = GetTickCount64() - start;
+	SetThreadpoolTimer(timer, NULL, 0, 0);
+	WaitForThreadpoolTimerCallbacks(timer, FALSE);
+
+	if (IsThreadpoolTimerSet(timer))
+	{
+		printf("cancelled timer is still set\n");
+		goto fail;
+	}
+
+	if (elapsed < 90)
+	{
+		printf("periodic timer fired too early (%u ms)\n", (unsigned) elapsed);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	CloseThreadpoolTimer(timer);
+	CloseHandle(test.event);
+	return rc;
+}
+
+/* Many one-shot timers are served by the pool, not by one thread each */
+static BOOL test_many_timers(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	BOOL rc = FALSE;
+	FILETIME due;
+	PTP_TIMER timers[TEST_TIMER_COUNT] = { 0 };
+	struct test_timer test = { 0, TEST_TIMER_COUNT, NULL };
+
+	if (!(test.event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	for (index = 0; index < TEST_TIMER_COUNT; index++)
+	{
+		if (!(timers[index] = CreateThreadpoolTimer(test_TimerCallback, &test, environment)))
+		{
+			printf("CreateThreadpoolTimer failure\n");
+			goto fail;
+		}
+
+		test_relative_due_time(&due, 1 + (index % 50));
+		SetThreadpoolTimer(timers[index], &due, 0, 0);
+	}
+
+	if (WaitForSingleObject(test.event, 5000) != WAIT_OBJECT_0)
+	{
+		printf("%d of %d timers fired\n", (int) test.count, TEST_TIMER_COUNT);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < TEST_TIMER_COUNT; index++)
+	{
+		if (timers[index])
+			CloseThreadpoolTimer(timers[index]);
+	}
+
+	CloseHandle(test.event);
+	return rc;
+}
 
 int TestPoolTimer(int argc, char* argv[])
 {
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+
+	if (!test_periodic_timer(NULL))
+		return -1;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return -1;
+	}
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (!test_periodic_timer(&environment))
+		return -1;
+
+	if (!test_many_timers(&environment))
+		return -1;
+
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
 	return 0;
 }
-
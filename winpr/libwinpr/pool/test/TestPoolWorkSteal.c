@@ -0,0 +1,124 @@
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#define TEST_WORK_ITEMS	100000
+
+static LONG count = 0;
+
+static void CALLBACK test_WorkStealCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	InterlockedIncrement((LONG*) context);
+}
+
+static BOOL test_submit_tiny_work(PTP_CALLBACK_ENVIRON environment, const char* name)
+{
+	int index;
+	UINT64 start;
+	UINT64 elapsed;
+	PTP_WORK work;
+	count = 0;
+
+	if (!(work = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_WorkStealCallback, &count,
+	                                  environment)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		return FALSE;
+	}
+
+	start = GetTickCount64();
+
+	for (index = 0; index < TEST_WORK_ITEMS; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+	elapsed = GetTickCount64() - start;
+	CloseThreadpoolWork(work);
+
+	if (count != TEST_WORK_ITEMS)
+	{
+		printf("%s: expected %d callbacks, got %d\n", name, TEST_WORK_ITEMS, (int) count);
+		return FALSE;
+	}
+
+	printf("%s: %d work items in %u ms\n", name, TEST_WORK_ITEMS, (unsigned) elapsed);
+	return TRUE;
+}
+
+/* Several work objects in flight, each waited for individually */
+static BOOL test_wait_per_work(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	int submit;
+	BOOL rc = TRUE;
+	LONG counts[16] = { 0 };
+	PTP_WORK works[16] = { 0 };
+
+	for (index = 0; index < 16; index++)
+	{
+		if (!(works[index] = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_WorkStealCallback,
+		                     &counts[index], environment)))
+		{
+			printf("CreateThreadpoolWork failure\n");
+			rc = FALSE;
+			goto out;
+		}
+	}
+
+	for (submit = 0; submit < 1000; submit++)
+	{
+		for (index = 0; index < 16; index++)
+			SubmitThreadpoolWork(works[index]);
+	}
+
+	for (index = 0; index < 16; index++)
+	{
+		WaitForThreadpoolWorkCallbacks(works[index], FALSE);
+
+		if (counts[index] != 1000)
+		{
+			printf("work %d: expected 1000 callbacks, got %d\n", index, (int) counts[index]);
+			rc = FALSE;
+		}
+	}
+
+out:
+
+	for (index = 0; index < 16; index++)
+	{
+		if (works[index])
+			CloseThreadpoolWork(works[index]);
+	}
+
+	return rc;
+}
+
+int TestPoolWorkSteal(int argc, char* argv[])
+{
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+
+	if (!test_submit_tiny_work(NULL, "Global Thread Pool"))
+		return -1;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return -1;
+	}
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (!test_submit_tiny_work(&environment, "Private Thread Pool"))
+		return -1;
+
+	if (!test_wait_per_work(&environment))
+		return -1;
+
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
+	return 0;
+}
@@ -23,32 +23,284 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+
+#include "pool.h"
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
 
 #ifdef WINPR_THREAD_POOL
 
+/**
+ * Timers are kept in a binary min-heap ordered by due time, protected by
+ * the pool DispatchLock. The dispatcher thread only has to look at the
+ * root to know when to wake up, expired timers are submitted to the pool
+ * workers like any other work.
+ */
+
+static BOOL threadpool_timer_less(PTP_TIMER a, PTP_TIMER b)
+{
+	return a->DueTime < b->DueTime;
+}
+
+static void threadpool_timer_heap_set(PTP_POOL pool, DWORD index, PTP_TIMER timer)
+{
+	pool->TimerHeap[index] = timer;
+	timer->HeapIndex = index + 1;
+}
+
+static void threadpool_timer_sift_up(PTP_POOL pool, DWORD index)
+{
+	DWORD parent;
+	PTP_TIMER timer = pool->TimerHeap[index];
+
+	while (index > 0)
+	{
+		parent = (index - 1) / 2;
+
+		if (!threadpool_timer_less(timer, pool->TimerHeap[parent]))
+			break;
+
+		threadpool_timer_heap_set(pool, index, pool->TimerHeap[parent]);
+		index = parent;
+	}
+
+	threadpool_timer_heap_set(pool, index, timer);
+}
+
+static void threadpool_timer_sift_down(PTP_POOL pool, DWORD index)
+{
+	DWORD child;
+	PTP_TIMER timer = pool->TimerHeap[index];
+
+	while ((child = 2 * index + 1) < pool->TimerCount)
+	{
+		if ((child + 1 < pool->TimerCount) &&
+		    threadpool_timer_less(pool->TimerHeap[child + 1], pool->TimerHeap[child]))
+			child++;
+
+		if (!threadpool_timer_less(pool->TimerHeap[child], timer))
+			break;
+
+		threadpool_timer_heap_set(pool, index, pool->TimerHeap[child]);
+		index = child;
+	}
+
+	threadpool_timer_heap_set(pool, index, timer);
+}
+
+static BOOL threadpool_timer_insert(PTP_POOL pool, PTP_TIMER timer)
+{
+	if (pool->TimerCount >= pool->TimerCapacity)
+	{
+		PTP_TIMER* heap;
+		DWORD capacity = pool->TimerCapacity ? pool->TimerCapacity * 2 : 64;
+
+		if (!(heap = (PTP_TIMER*) realloc(pool->TimerHeap, capacity * sizeof(PTP_TIMER))))
+			return FALSE;
+
+		pool->TimerHeap = heap;
+		pool->TimerCapacity = capacity;
+	}
+
+	pool->TimerHeap[pool->TimerCount++] = timer;
+	threadpool_timer_sift_up(pool, pool->TimerCount - 1);
+	return TRUE;
+}
+
+static void threadpool_timer_remove(PTP_POOL pool, PTP_TIMER timer)
+{
+	DWORD index;
+
+	if (!timer->HeapIndex)
+		return;
+
+	index = timer->HeapIndex - 1;
+	timer->HeapIndex = 0;
+	pool->TimerCount--;
+
+	if (index == pool->TimerCount)
+		return;
+
+	threadpool_timer_heap_set(pool, index, pool->TimerHeap[pool->TimerCount]);
+	threadpool_timer_sift_down(pool, index);
+	threadpool_timer_sift_up(pool, index);
+}
+
+static DWORD threadpool_timer_next(PTP_POOL pool, ULONGLONG now)
+{
+	ULONGLONG due;
+
+	if (pool->TimerCount == 0)
+		return INFINITE;
+
+	due = pool->TimerHeap[0]->DueTime;
+
+	if (due <= now)
+		return 0;
+
+	if ((due - now) >= INFINITE)
+		return INFINITE - 1;
+
+	return (DWORD) (due - now);
+}
+
+/**
+ * Submits all expired timers, called by the dispatcher with the
+ * DispatchLock held.
+ *
+ * @return the number of milliseconds until the next timer is due
+ */
+DWORD threadpool_timer_expire(PTP_POOL pool)
+{
+	PTP_TIMER timer;
+	ULONGLONG now = GetTickCount64();
+
+	while ((pool->TimerCount > 0) && (pool->TimerHeap[0]->DueTime <= now))
+	{
+		timer = pool->TimerHeap[0];
+		threadpool_timer_remove(pool, timer);
+
+		if (!threadpool_submit(pool, &timer->Work))
+			WLog_ERR(TAG, "failed to submit timer callback");
+
+		if (!timer->Period)
+		{
+			timer->DueTime = 0;
+			continue;
+		}
+
+		/* skip periods we missed instead of firing them back to back */
+		timer->DueTime += timer->Period;
+
+		if (timer->DueTime <= now)
+			timer->DueTime = now + timer->Period - ((now - timer->DueTime) % timer->Period);
+
+		if (!threadpool_timer_insert(pool, timer))
+			timer->DueTime = 0;
+	}
+
+	return threadpool_timer_next(pool, now);
+}
+
+static VOID CALLBACK threadpool_timer_callback(PTP_CALLBACK_INSTANCE instance, PVOID context,
+        PTP_WORK work)
+{
+	PTP_TIMER timer = (PTP_TIMER) context;
+	timer->TimerCallback(instance, timer->CallbackParameter, timer);
+}
+
 PTP_TIMER winpr_CreateThreadpoolTimer(PTP_TIMER_CALLBACK pfnti, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
 {
-	return NULL;
+	PTP_POOL pool;
+	PTP_TIMER timer;
+
+	if (!pfnti)
+		return NULL;
+
+	if (!(pool = (pcbe && pcbe->Pool) ? pcbe->Pool : GetDefaultThreadpool()))
+		return NULL;
+
+	if (!threadpool_dispatcher_start(pool))
+		return NULL;
+
+	if (!(timer = (PTP_TIMER) calloc(1, sizeof(TP_TIMER))))
+		return NULL;
+
+	timer->TimerCallback = pfnti;
+	timer->CallbackParameter = pv;
+	timer->CallbackEnvironment = pcbe;
+	timer->Pool = pool;
+	timer->Work.WorkCallback = threadpool_timer_callback;
+	timer->Work.CallbackParameter = timer;
+	timer->Work.CallbackEnvironment = pcbe;
+	return timer;
 }
 
 VOID winpr_CloseThreadpoolTimer(PTP_TIMER pti)
 {
+	if (!pti)
+		return;
 
+	EnterCriticalSection(&pti->Pool->DispatchLock);
+	threadpool_timer_remove(pti->Pool, pti);
+	pti->DueTime = 0;
+	LeaveCriticalSection(&pti->Pool->DispatchLock);
+	threadpool_wait(pti->Pool, &pti->Work);
+	free(pti);
 }
 
 BOOL winpr_IsThreadpoolTimerSet(PTP_TIMER pti)
 {
-	return FALSE;
+	BOOL set;
+
+	if (!pti)
+		return FALSE;
+
+	EnterCriticalSection(&pti->Pool->DispatchLock);
+	set = pti->HeapIndex != 0;
+	LeaveCriticalSection(&pti->Pool->DispatchLock);
+	return set;
 }
 
+/**
+ * pftDueTime is either relative (negative, in 100 nanosecond intervals) or
+ * an absolute FILETIME, NULL cancels the timer. msWindowLength is ignored,
+ * the dispatcher already batches all timers expiring at the same time.
+ */
 VOID winpr_SetThreadpoolTimer(PTP_TIMER pti, PFILETIME pftDueTime, DWORD msPeriod, DWORD msWindowLength)
 {
+	PTP_POOL pool;
+	LONGLONG due;
+	ULONGLONG now;
+
+	if (!pti)
+		return;
+
+	pool = pti->Pool;
+	EnterCriticalSection(&pool->DispatchLock);
+	threadpool_timer_remove(pool, pti);
+	pti->DueTime = 0;
+	pti->Period = msPeriod;
 
+	if (pftDueTime)
+	{
+		now = GetTickCount64();
+		due = (LONGLONG) (((ULONGLONG) pftDueTime->dwHighDateTime << 32) | pftDueTime->dwLowDateTime);
+
+		if (due < 0)
+		{
+			pti->DueTime = now + ((-due) / 10000);
+		}
+		else
+		{
+			FILETIME ft;
+			LONGLONG current;
+			GetSystemTimeAsFileTime(&ft);
+			current = (LONGLONG) (((ULONGLONG) ft.dwHighDateTime << 32) | ft.dwLowDateTime);
+			pti->DueTime = now + ((due > current) ? ((due - current) / 10000) : 0);
+		}
+
+		if (!threadpool_timer_insert(pool, pti))
+		{
+			WLog_ERR(TAG, "failed to queue timer");
+			pti->DueTime = 0;
+		}
+		else if (pti->HeapIndex == 1)
+		{
+			threadpool_dispatcher_arm_timer(pool, threadpool_timer_next(pool, now));
+		}
+	}
+
+	LeaveCriticalSection(&pool->DispatchLock);
 }
 
 VOID winpr_WaitForThreadpoolTimerCallbacks(PTP_TIMER pti, BOOL fCancelPendingCallbacks)
 {
+	if (!pti)
+		return;
 
+	threadpool_wait(pti->Pool, &pti->Work);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -86,6 +86,7 @@ PTP_WORK winpr_CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLB
 		work->CallbackEnvironment = pcbe;
 		work->WorkCallback = pfnwk;
 		work->CallbackParameter = pv;
+		work->Pending = 0;
 	}
 
 	return work;
@@ -106,8 +107,6 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
-	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSubmitThreadpoolWork)
@@ -116,15 +115,9 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 		return;
 	}
 #endif
-	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE) malloc(sizeof(TP_CALLBACK_INSTANCE));
 
-	if (callbackInstance)
-	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
-	}
+	if (!threadpool_submit(pwk->CallbackEnvironment->Pool, pwk))
+		WLog_ERR(TAG, "failed to submit work");
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
@@ -140,8 +133,6 @@ BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_C
 
 VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 {
-	HANDLE event;
-	PTP_POOL pool;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pWaitForThreadpoolWorkCallbacks)
@@ -150,11 +141,7 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 		return;
 	}
 #endif
-	pool = pwk->CallbackEnvironment->Pool;
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
-
-	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
-		WLog_ERR(TAG, "error waiting on work completion");
+	threadpool_wait(pwk->CallbackEnvironment->Pool, pwk);
 }
 
 #endif /* WINPR_THREAD_POOL defined */
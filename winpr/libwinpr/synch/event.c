@@ -369,6 +369,7 @@ int SetEventFileDescriptor(HANDLE hEvent, int FileDescriptor, ULONG mode)
 	event->bAttached = TRUE;
 	event->Mode = mode;
 	event->pipe_fd[0] = FileDescriptor;
+	event->Serial = winpr_Handle_NextSerial();
 	return 0;
 #else
 	return -1;
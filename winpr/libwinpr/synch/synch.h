@@ -144,4 +144,7 @@ struct winpr_timer_queue_timer
 
 #endif
 
+DWORD WaitSet_WaitEx(wWaitSet* waitSet, DWORD dwMilliseconds, HANDLE* lpSignaled,
+		DWORD nMaxSignaled, DWORD* lpnSignaled, BOOL bCleanup);
+
 #endif /* WINPR_SYNCH_PRIVATE_H */
@@ -0,0 +1,206 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#define TEST_WAIT_SET_HANDLES	500
+#define TEST_WAIT_HANDLES	32
+
+static BOOL test_wait_set(void)
+{
+	int index;
+	BOOL rc = FALSE;
+	DWORD status;
+	DWORD count = 0;
+	HANDLE signaled[16];
+	HANDLE events[TEST_WAIT_SET_HANDLES] = { 0 };
+	wWaitSet* waitSet;
+
+	if (!(waitSet = WaitSet_New()))
+	{
+		printf("WaitSet_New failure\n");
+		return FALSE;
+	}
+
+	for (index = 0; index < TEST_WAIT_SET_HANDLES; index++)
+	{
+		if (!(events[index] = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+		    !WaitSet_Add(waitSet, events[index]))
+		{
+			printf("failed to add event %d\n", index);
+			goto fail;
+		}
+	}
+
+	if (WaitSet_Wait(waitSet, 0, signaled, 16, &count) != WAIT_TIMEOUT)
+	{
+		printf("WaitSet_Wait did not time out\n");
+		goto fail;
+	}
+
+	SetEvent(events[3]);
+	SetEvent(events[250]);
+	SetEvent(events[499]);
+	status = WaitSet_Wait(waitSet, INFINITE, signaled, 16, &count);
+
+	if ((status != WAIT_OBJECT_0) || (count != 3))
+	{
+		printf("WaitSet_Wait returned 0x%08X with %u handles\n", status, count);
+		goto fail;
+	}
+
+	/* removed handles are not reported anymore */
+	if (!WaitSet_Remove(waitSet, events[250]) || (WaitSet_Count(waitSet) != TEST_WAIT_SET_HANDLES - 1))
+	{
+		printf("WaitSet_Remove failure\n");
+		goto fail;
+	}
+
+	ResetEvent(events[3]);
+	ResetEvent(events[499]);
+	status = WaitSet_Wait(waitSet, 0, signaled, 16, &count);
+
+	if (status != WAIT_TIMEOUT)
+	{
+		printf("removed handle is still reported\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	WaitSet_Free(waitSet);
+
+	for (index = 0; index < TEST_WAIT_SET_HANDLES; index++)
+	{
+		if (events[index])
+			CloseHandle(events[index]);
+	}
+
+	return rc;
+}
+
+static BOOL test_wait_multiple(DWORD count, HANDLE* events, DWORD expected)
+{
+	int iteration;
+	DWORD status;
+
+	/* with the thread cache repeated waits go through the cached wait set */
+	for (iteration = 0; iteration < 4; iteration++)
+	{
+		status = WaitForMultipleObjects(count, events, FALSE, 0);
+
+		if (status != expected)
+		{
+			printf("WaitForMultipleObjects iteration %d: expected 0x%08X, got 0x%08X\n",
+			       iteration, expected, status);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_wait_multiple_cached(void)
+{
+	int index;
+	BOOL rc = FALSE;
+	HANDLE events[TEST_WAIT_HANDLES] = { 0 };
+
+	for (index = 0; index < TEST_WAIT_HANDLES; index++)
+	{
+		if (!(events[index] = CreateEvent(NULL, TRUE, FALSE, NULL)))
+			goto fail;
+	}
+
+	if (!test_wait_multiple(TEST_WAIT_HANDLES, events, WAIT_TIMEOUT))
+		goto fail;
+
+	SetEvent(events[20]);
+	SetEvent(events[7]);
+
+	if (!test_wait_multiple(TEST_WAIT_HANDLES, events, WAIT_OBJECT_0 + 7))
+		goto fail;
+
+	ResetEvent(events[7]);
+
+	if (!test_wait_multiple(TEST_WAIT_HANDLES, events, WAIT_OBJECT_0 + 20))
+		goto fail;
+
+	/* a recreated handle must not be mistaken for the cached one */
+	ResetEvent(events[20]);
+	CloseHandle(events[5]);
+
+	if (!(events[5] = CreateEvent(NULL, TRUE, TRUE, NULL)))
+		goto fail;
+
+	if (!test_wait_multiple(TEST_WAIT_HANDLES, events, WAIT_OBJECT_0 + 5))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < TEST_WAIT_HANDLES; index++)
+	{
+		if (events[index])
+			CloseHandle(events[index]);
+	}
+
+	return rc;
+}
+
+/* a set the wait set cannot hold keeps working through poll() */
+static BOOL test_wait_multiple_duplicate(void)
+{
+	BOOL rc = FALSE;
+	HANDLE events[3] = { 0 };
+
+	if (!(events[0] = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+	    !(events[2] = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail;
+
+	events[1] = events[0];
+	SetEvent(events[2]);
+
+	if (!test_wait_multiple(3, events, WAIT_OBJECT_0 + 2))
+		goto fail;
+
+	SetEvent(events[0]);
+
+	if (!test_wait_multiple(3, events, WAIT_OBJECT_0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (events[0])
+		CloseHandle(events[0]);
+
+	if (events[2])
+		CloseHandle(events[2]);
+
+	return rc;
+}
+
+int TestSynchWaitSet(int argc, char* argv[])
+{
+	if (!test_wait_set())
+		return -1;
+
+	/* without opting in WaitForMultipleObjects polls */
+	if (!test_wait_multiple_cached())
+		return -1;
+
+	if (!WaitSet_EnableThreadCache(TRUE))
+	{
+		printf("WaitSet_EnableThreadCache not supported\n");
+		return 0;
+	}
+
+	if (!test_wait_multiple_cached())
+		return -1;
+
+	if (!test_wait_multiple_duplicate())
+		return -1;
+
+	WaitSet_EnableThreadCache(FALSE);
+	return 0;
+}
@@ -314,6 +314,204 @@ DWORD WaitForSingleObjectEx(HANDLE hHandle, DWORD dwMilliseconds, BOOL bAlertabl
 	return WAIT_FAILED;
 }
 
+#ifdef HAVE_EPOLL_H
+
+/**
+ * WaitForMultipleObjects is usually called in a loop with the same
+ * handles. On threads that opted in with WaitSet_EnableThreadCache, a
+ * handle set waited on twice in a row is registered in a per-thread wait
+ * set and reused until the handles change, replacing the poll() setup per
+ * call with a single epoll_wait. A set that cannot be registered keeps
+ * using poll() until the handles change.
+ */
+
+struct wait_cache
+{
+	BOOL enabled;
+	BOOL failed;
+	DWORD count;
+	BOOL hits;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	ULONG serials[MAXIMUM_WAIT_OBJECTS];
+	int fds[MAXIMUM_WAIT_OBJECTS];
+	wWaitSet* waitSet;
+};
+
+static pthread_once_t wait_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t wait_cache_key;
+
+static void wait_cache_free(void* arg)
+{
+	struct wait_cache* cache = (struct wait_cache*) arg;
+
+	if (cache)
+		WaitSet_Free(cache->waitSet);
+
+	free(cache);
+}
+
+static void wait_cache_init(void)
+{
+	if (pthread_key_create(&wait_cache_key, wait_cache_free) != 0)
+		WLog_ERR(TAG, "failed to create wait cache key");
+}
+
+static struct wait_cache* wait_cache_get(BOOL create)
+{
+	struct wait_cache* cache;
+	pthread_once(&wait_cache_once, wait_cache_init);
+	cache = (struct wait_cache*) pthread_getspecific(wait_cache_key);
+
+	if (cache || !create)
+		return cache;
+
+	if (!(cache = (struct wait_cache*) calloc(1, sizeof(struct wait_cache))))
+		return NULL;
+
+	if (pthread_setspecific(wait_cache_key, cache) != 0)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void wait_cache_reset(struct wait_cache* cache)
+{
+	WaitSet_Free(cache->waitSet);
+	cache->waitSet = NULL;
+	cache->failed = FALSE;
+	cache->hits = FALSE;
+	cache->count = 0;
+}
+
+BOOL WaitSet_EnableThreadCache(BOOL bEnable)
+{
+	struct wait_cache* cache = wait_cache_get(bEnable);
+
+	if (!cache)
+		return !bEnable;
+
+	wait_cache_reset(cache);
+	cache->enabled = bEnable;
+	return TRUE;
+}
+
+/**
+ * @return TRUE if the wait was handled by the cached set, status is set
+ */
+static BOOL wait_cache_wait(DWORD nCount, const HANDLE* lpHandles, DWORD dwMilliseconds,
+                            DWORD* status)
+{
+	int fd;
+	DWORD index;
+	DWORD signaled;
+	DWORD lowest;
+	BOOL match;
+	ULONG Type;
+	WINPR_HANDLE* Object;
+	HANDLE ready[MAXIMUM_WAIT_OBJECTS];
+	struct wait_cache* cache = wait_cache_get(FALSE);
+
+	if (!cache || !cache->enabled)
+		return FALSE;
+
+	match = (cache->count == nCount);
+
+	for (index = 0; index < nCount; index++)
+	{
+		if (!winpr_Handle_GetInfo(lpHandles[index], &Type, &Object) ||
+		    !Object->Serial || ((fd = winpr_Handle_getFd(Object)) < 0))
+		{
+			wait_cache_reset(cache);
+			return FALSE;
+		}
+
+		if (match && ((cache->handles[index] != lpHandles[index]) ||
+		              (cache->serials[index] != Object->Serial) || (cache->fds[index] != fd)))
+			match = FALSE;
+
+		cache->handles[index] = lpHandles[index];
+		cache->serials[index] = Object->Serial;
+		cache->fds[index] = fd;
+	}
+
+	if (!match)
+	{
+		WaitSet_Free(cache->waitSet);
+		cache->waitSet = NULL;
+		cache->failed = FALSE;
+		cache->hits = FALSE;
+		cache->count = nCount;
+		return FALSE;
+	}
+
+	if (cache->failed)
+		return FALSE;
+
+	if (!cache->waitSet)
+	{
+		/* the first repetition still polls, the set is built on the second */
+		if (!cache->hits)
+		{
+			cache->hits = TRUE;
+			return FALSE;
+		}
+
+		if (!(cache->waitSet = WaitSet_New()))
+			return FALSE;
+
+		for (index = 0; index < nCount; index++)
+		{
+			if (!WaitSet_Add(cache->waitSet, lpHandles[index]))
+			{
+				/* e.g. the same handle twice, keep using poll() for this set */
+				WaitSet_Free(cache->waitSet);
+				cache->waitSet = NULL;
+				cache->failed = TRUE;
+				return FALSE;
+			}
+		}
+	}
+
+	*status = WaitSet_WaitEx(cache->waitSet, dwMilliseconds, ready, nCount, &signaled, FALSE);
+
+	if (*status != WAIT_OBJECT_0)
+		return TRUE;
+
+	/* like on Windows the handle with the lowest index wins */
+	lowest = nCount;
+
+	while (signaled--)
+	{
+		for (index = 0; index < lowest; index++)
+		{
+			if (lpHandles[index] == ready[signaled])
+			{
+				lowest = index;
+				break;
+			}
+		}
+	}
+
+	if (lowest >= nCount)
+	{
+		*status = WAIT_FAILED;
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return TRUE;
+	}
+
+	*status = winpr_Handle_cleanup(lpHandles[lowest]);
+
+	if (*status == WAIT_OBJECT_0)
+		*status = WAIT_OBJECT_0 + lowest;
+
+	return TRUE;
+}
+
+#endif
+
 DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE *lpHandles, BOOL bWaitAll, DWORD dwMilliseconds)
 {
 	struct timespec starttime;
@@ -344,6 +542,13 @@ DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE *lpHandles, BOOL bWaitAl
 		return WAIT_FAILED;
 	}
 
+#ifdef HAVE_EPOLL_H
+
+	if (!bWaitAll && wait_cache_wait(nCount, lpHandles, dwMilliseconds, &signalled))
+		return signalled;
+
+#endif
+
 	if (bWaitAll)
 	{
 		signalled_idx = alloca(nCount * sizeof(BOOL));
@@ -0,0 +1,301 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Synchronization Functions (Wait Sets)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include "synch.h"
+
+#include "../log.h"
+#define TAG WINPR_TAG("sync.waitset")
+
+#if !defined(_WIN32) && defined(HAVE_EPOLL_H)
+#define WINPR_WAIT_SET_EPOLL	1
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
+#define WAIT_SET_MAX_EVENTS	256
+
+struct winpr_wait_set
+{
+	DWORD count;
+	DWORD capacity;
+	HANDLE* handles;
+	int* fds;
+#ifdef WINPR_WAIT_SET_EPOLL
+	int epfd;
+#endif
+};
+
+wWaitSet* WaitSet_New(void)
+{
+	wWaitSet* waitSet = (wWaitSet*) calloc(1, sizeof(wWaitSet));
+
+	if (!waitSet)
+		return NULL;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+	waitSet->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (waitSet->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1 failed with %d", errno);
+		free(waitSet);
+		return NULL;
+	}
+
+#endif
+	return waitSet;
+}
+
+void WaitSet_Free(wWaitSet* waitSet)
+{
+	if (!waitSet)
+		return;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+	close(waitSet->epfd);
+#endif
+	free(waitSet->handles);
+	free(waitSet->fds);
+	free(waitSet);
+}
+
+static BOOL WaitSet_Grow(wWaitSet* waitSet)
+{
+	int* fds;
+	HANDLE* handles;
+	DWORD capacity = waitSet->capacity ? waitSet->capacity * 2 : 32;
+
+	if (!(handles = (HANDLE*) realloc(waitSet->handles, capacity * sizeof(HANDLE))))
+		return FALSE;
+
+	waitSet->handles = handles;
+
+	if (!(fds = (int*) realloc(waitSet->fds, capacity * sizeof(int))))
+		return FALSE;
+
+	waitSet->fds = fds;
+	waitSet->capacity = capacity;
+	return TRUE;
+}
+
+BOOL WaitSet_Add(wWaitSet* waitSet, HANDLE hHandle)
+{
+	int fd = -1;
+#ifdef WINPR_WAIT_SET_EPOLL
+	ULONG Type;
+	WINPR_HANDLE* Object;
+	struct epoll_event event = { 0 };
+#endif
+
+	if (!waitSet)
+		return FALSE;
+
+	if ((waitSet->count >= waitSet->capacity) && !WaitSet_Grow(waitSet))
+		return FALSE;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (!winpr_Handle_GetInfo(hHandle, &Type, &Object) || ((fd = winpr_Handle_getFd(Object)) < 0))
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if (Object->Mode & WINPR_FD_READ)
+		event.events |= EPOLLIN;
+
+	if (Object->Mode & WINPR_FD_WRITE)
+		event.events |= EPOLLOUT;
+
+	event.data.ptr = hHandle;
+
+	if (epoll_ctl(waitSet->epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+	{
+		WLog_ERR(TAG, "failed to add handle to wait set (errno %d)", errno);
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+#else
+
+	if (waitSet->count >= MAXIMUM_WAIT_OBJECTS)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+
+#endif
+	waitSet->handles[waitSet->count] = hHandle;
+	waitSet->fds[waitSet->count] = fd;
+	waitSet->count++;
+	return TRUE;
+}
+
+/**
+ * Removes a handle from the wait set, this has to happen before the
+ * handle is closed.
+ */
+BOOL WaitSet_Remove(wWaitSet* waitSet, HANDLE hHandle)
+{
+	DWORD index;
+
+	if (!waitSet)
+		return FALSE;
+
+	for (index = 0; index < waitSet->count; index++)
+	{
+		if (waitSet->handles[index] != hHandle)
+			continue;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+		if ((epoll_ctl(waitSet->epfd, EPOLL_CTL_DEL, waitSet->fds[index], NULL) != 0) &&
+		    (errno != EBADF) && (errno != ENOENT))
+			WLog_WARN(TAG, "failed to remove handle from wait set (errno %d)", errno);
+
+#endif
+		waitSet->count--;
+		waitSet->handles[index] = waitSet->handles[waitSet->count];
+		waitSet->fds[index] = waitSet->fds[waitSet->count];
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+DWORD WaitSet_Count(wWaitSet* waitSet)
+{
+	return waitSet ? waitSet->count : 0;
+}
+
+DWORD WaitSet_WaitEx(wWaitSet* waitSet, DWORD dwMilliseconds, HANDLE* lpSignaled,
+                     DWORD nMaxSignaled, DWORD* lpnSignaled, BOOL bCleanup)
+{
+	DWORD rc;
+	DWORD index;
+#ifdef WINPR_WAIT_SET_EPOLL
+	int status;
+	int timeout;
+	struct epoll_event* events;
+#endif
+
+	if (!waitSet || !lpSignaled || !lpnSignaled || !nMaxSignaled)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	*lpnSignaled = 0;
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (nMaxSignaled > WAIT_SET_MAX_EVENTS)
+		nMaxSignaled = WAIT_SET_MAX_EVENTS;
+
+	events = alloca(nMaxSignaled * sizeof(struct epoll_event));
+
+	/* a negative timeout is infinite for epoll */
+	if (dwMilliseconds == INFINITE)
+		timeout = -1;
+	else if (dwMilliseconds > INT_MAX)
+		timeout = INT_MAX;
+	else
+		timeout = (int) dwMilliseconds;
+
+	do
+	{
+		status = epoll_wait(waitSet->epfd, events, (int) nMaxSignaled, timeout);
+	}
+	while ((status < 0) && (errno == EINTR));
+
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "epoll_wait failed with %d", errno);
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return WAIT_FAILED;
+	}
+
+	if (status == 0)
+		return WAIT_TIMEOUT;
+
+	rc = WAIT_OBJECT_0;
+
+	/* a failed cleanup must not lose the other handles epoll reported */
+	for (index = 0; index < (DWORD) status; index++)
+	{
+		lpSignaled[index] = (HANDLE) events[index].data.ptr;
+
+		if (bCleanup && (winpr_Handle_cleanup(lpSignaled[index]) != WAIT_OBJECT_0))
+		{
+			WLog_ERR(TAG, "failed to clean up signaled handle %p", lpSignaled[index]);
+			rc = WAIT_FAILED;
+		}
+	}
+
+	*lpnSignaled = (DWORD) status;
+	return rc;
+#else
+
+	if (!waitSet->count)
+	{
+		Sleep(dwMilliseconds);
+		return WAIT_TIMEOUT;
+	}
+
+	rc = WaitForMultipleObjects(waitSet->count, waitSet->handles, FALSE, dwMilliseconds);
+
+	if ((rc < WAIT_OBJECT_0) || (rc >= WAIT_OBJECT_0 + waitSet->count))
+		return rc;
+
+	index = rc - WAIT_OBJECT_0;
+	lpSignaled[0] = waitSet->handles[index];
+	*lpnSignaled = 1;
+	return WAIT_OBJECT_0;
+#endif
+}
+
+/**
+ * Waits until at least one handle of the set is signaled. Up to
+ * nMaxSignaled signaled handles are returned in lpSignaled, their count
+ * in lpnSignaled. If resetting one of them fails the call returns
+ * WAIT_FAILED but still reports all signaled handles.
+ *
+ * @return WAIT_OBJECT_0, WAIT_TIMEOUT or WAIT_FAILED
+ */
+DWORD WaitSet_Wait(wWaitSet* waitSet, DWORD dwMilliseconds, HANDLE* lpSignaled,
+                   DWORD nMaxSignaled, DWORD* lpnSignaled)
+{
+	return WaitSet_WaitEx(waitSet, dwMilliseconds, lpSignaled, nMaxSignaled, lpnSignaled, TRUE);
+}
+
+#ifndef WINPR_WAIT_SET_EPOLL
+
+/* WaitForMultipleObjects keeps no wait sets without epoll */
+BOOL WaitSet_EnableThreadCache(BOOL bEnable)
+{
+	return !bEnable;
+}
+
+#endif
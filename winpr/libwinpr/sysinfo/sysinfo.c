@@ -466,9 +466,21 @@ ULONGLONG winpr_GetTickCount64(void)
 /* If x86 */
 #ifdef _M_IX86_AMD64
 
-#if defined(__GNUC__) && defined(__AVX__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__)
+/* xgetbv is encoded by hand so that assemblers without AVX support work too */
 #define xgetbv(_func_, _lo_, _hi_) \
-	__asm__ __volatile__ ("xgetbv" : "=a" (_lo_), "=d" (_hi_) : "c" (_func_))
+	__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (_lo_), "=d" (_hi_) : "c" (_func_))
+#elif defined(_MSC_VER)
+#define xgetbv(_func_, _lo_, _hi_) \
+	do { \
+		unsigned __int64 _bv_ = _xgetbv(_func_); \
+		_lo_ = (int)(_bv_ & 0xFFFFFFFF); \
+		_hi_ = (int)(_bv_ >> 32); \
+	} while (0)
 #endif
 
 #define D_BIT_MMX       (1<<23)
@@ -491,6 +503,7 @@ ULONGLONG winpr_GetTickCount64(void)
 #define E_BIT_XMM       (1<<1)
 #define E_BIT_YMM       (1<<2)
 #define E_BITS_AVX      (E_BIT_XMM|E_BIT_YMM)
+#define B7_BIT_AVX2     (1<<5)
 
 static void cpuid(
 	unsigned info,
@@ -516,11 +529,12 @@ static void cpuid(
 		"xchg %%rbx, %%rsi;"
 #endif
 	: "=a"(*eax), "=S"(*ebx), "=c"(*ecx), "=d"(*edx)
-			: "0"(info)
+			: "0"(info), "2"(0)
 		);
 #elif defined(_MSC_VER)
 	int a[4];
-	__cpuid(a, info);
+	/* sub-leaf 0, leaf 7 reports the extended features in ebx */
+	__cpuidex(a, info, 0);
 	*eax = a[0];
 	*ebx = a[1];
 	*ecx = a[2];
@@ -821,6 +835,31 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 				ret = TRUE;
 
 			break;
+
+		case PF_EX_AVX2:
+			{
+				unsigned a7, b7, c7, d7;
+				int e, f;
+
+				if ((c & C_BITS_AVX) != C_BITS_AVX)
+					break;
+
+				xgetbv(0, e, f);
+
+				if ((e & E_BITS_AVX) != E_BITS_AVX)
+					break;
+
+				cpuid(0, &a7, &b7, &c7, &d7);
+
+				if (a7 < 7)
+					break;
+
+				cpuid(7, &a7, &b7, &c7, &d7);
+
+				if (b7 & B7_BIT_AVX2)
+					ret = TRUE;
+			}
+			break;
 #if defined(__GNUC__) && defined(__AVX__)
 
 		case PF_EX_AVX:
@@ -22,121 +22,306 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
+#include "../stream.h"
+
 /**
- * Methods
+ * Streams handed out by the pool are found again from any address inside
+ * their buffer (StreamPool_Find). Buffers are registered in a process wide
+ * radix map of 4 KiB pages, a lookup reads a single page entry without
+ * taking a lock.
+ *
+ * Pooled buffers are never smaller than a page, so a page is shared by at
+ * most two of them: the buffer covering the start of the page (lower) and
+ * a buffer starting inside the page (upper). The page entry keeps the
+ * offsets where lower ends and upper starts, a lookup never reads a stream
+ * the address does not belong to.
  */
 
-void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+#define STREAM_POOL_MIN_SHIFT		12
+#define STREAM_POOL_CLASS_SIZE(_i)	(((size_t) 1) << (STREAM_POOL_MIN_SHIFT + (_i)))
+#define STREAM_POOL_CLASS_BYTES		(4 * 1024 * 1024)
+#define STREAM_POOL_CLASS_MIN_COUNT	4
+
+#define STREAM_POOL_PAGE_SHIFT		STREAM_POOL_MIN_SHIFT
+#define STREAM_POOL_PAGE_SIZE		(((ULONG_PTR) 1) << STREAM_POOL_PAGE_SHIFT)
+#define STREAM_POOL_LEAF_BITS		10
+#define STREAM_POOL_NODE_BITS		14
+#define STREAM_POOL_NODE_LEVELS		3
+
+struct _wStreamPoolPage
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->uCapacity * 2;
-			new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->uCapacity = new_cap;
-			pool->uArray = new_arr;
-		}
+	wStream* volatile lower;
+	wStream* volatile upper;
+	LONG volatile end;
+	LONG volatile start;
+};
+typedef struct _wStreamPoolPage wStreamPoolPage;
+
+struct _wStreamPoolLeaf
+{
+	wStreamPoolPage pages[1 << STREAM_POOL_LEAF_BITS];
+};
+typedef struct _wStreamPoolLeaf wStreamPoolLeaf;
+
+/* Nodes are allocated on first use and live as long as the process */
+static PVOID volatile StreamPool_Map[1 << STREAM_POOL_NODE_BITS];
+
+static PVOID StreamPool_MapChild(PVOID volatile* slot, size_t size, BOOL create)
+{
+	PVOID child = *slot;
+	PVOID other;
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
+	if (child || !create)
+		return child;
+
+	if (!(child = calloc(1, size)))
+		return NULL;
+
+	other = InterlockedCompareExchangePointer(slot, child, NULL);
+
+	if (other)
+	{
+		free(child);
+		child = other;
 	}
-	else if (count < 0)
+
+	return child;
+}
+
+static wStreamPoolPage* StreamPool_MapPage(ULONG_PTR address, BOOL create)
+{
+	int level;
+	UINT64 page = ((UINT64) address) >> STREAM_POOL_PAGE_SHIFT;
+	const UINT64 mask = (1 << STREAM_POOL_NODE_BITS) - 1;
+	PVOID volatile* node = StreamPool_Map;
+	wStreamPoolLeaf* leaf;
+
+	for (level = STREAM_POOL_NODE_LEVELS - 1; level > 0; level--)
 	{
-		if (pool->uSize - index + count > 0)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-					(pool->uSize - index + count) * sizeof(wStream*));
-		}
+		node = (PVOID volatile*) StreamPool_MapChild(
+		           &node[(page >> (STREAM_POOL_LEAF_BITS + level * STREAM_POOL_NODE_BITS)) & mask],
+		           sizeof(PVOID) << STREAM_POOL_NODE_BITS, create);
+
+		if (!node)
+			return NULL;
+	}
+
+	leaf = (wStreamPoolLeaf*) StreamPool_MapChild(&node[(page >> STREAM_POOL_LEAF_BITS) & mask],
+	        sizeof(wStreamPoolLeaf), create);
+
+	if (!leaf)
+		return NULL;
 
-		pool->uSize += count;
+	return &leaf->pages[page & ((1 << STREAM_POOL_LEAF_BITS) - 1)];
+}
+
+static void StreamPool_Count(LONGLONG volatile* counter)
+{
+	LONGLONG value;
+
+	do
+	{
+		value = *counter;
 	}
+	while (InterlockedCompareExchange64(counter, value + 1, value) != value);
 }
 
 /**
- * Adds a used stream to the pool.
+ * Returns the smallest size class holding size bytes, -1 if the size
+ * exceeds the largest class.
  */
+static int StreamPool_ClassForSize(size_t size)
+{
+	int index;
+
+	for (index = 0; index < STREAM_POOL_CLASSES; index++)
+	{
+		if (STREAM_POOL_CLASS_SIZE(index) >= size)
+			return index;
+	}
 
-void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+	return -1;
+}
+
+/**
+ * Returns the largest size class a buffer of the given capacity can serve,
+ * -1 if the stream should not be cached.
+ */
+static int StreamPool_ClassForCapacity(size_t capacity)
 {
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	int index;
+
+	if ((capacity < STREAM_POOL_CLASS_SIZE(0)) ||
+	    (capacity >= STREAM_POOL_CLASS_SIZE(STREAM_POOL_CLASSES)))
+		return -1;
+
+	for (index = STREAM_POOL_CLASSES - 1; index > 0; index--)
 	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->uCapacity * 2;
-		new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			return;
-		pool->uCapacity = new_cap;
-		pool->uArray = new_arr;
+		if (STREAM_POOL_CLASS_SIZE(index) <= capacity)
+			break;
 	}
 
-	pool->uArray[(pool->uSize)++] = s;
+	return index;
+}
+
+static LONG StreamPool_ClassLimit(int index)
+{
+	size_t count = STREAM_POOL_CLASS_BYTES / STREAM_POOL_CLASS_SIZE(index);
+
+	if (count < STREAM_POOL_CLASS_MIN_COUNT)
+		count = STREAM_POOL_CLASS_MIN_COUNT;
+
+	return (LONG) count;
 }
 
 /**
- * Removes a used stream from the pool.
+ * Returned streams are pushed without a lock, only taking streams from a
+ * class is serialized. With a single consumer a stream cannot be taken and
+ * pushed again while another consumer still holds it as the list head.
  */
+static void StreamPool_Push(wStreamPoolClass* sizeClass, wStream* s)
+{
+	wStream* head;
 
-void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+	do
+	{
+		head = sizeClass->head;
+		s->next = head;
+	}
+	while (InterlockedCompareExchangePointer((PVOID volatile*) &sizeClass->head, s,
+	        head) != head);
+
+	InterlockedIncrement(&sizeClass->count);
+}
+
+static wStream* StreamPool_Pop(wStreamPoolClass* sizeClass)
 {
-	int index;
-	BOOL found = FALSE;
+	wStream* s;
 
-	for (index = 0; index < pool->uSize; index++)
+	EnterCriticalSection(&sizeClass->lock);
+
+	do
 	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
+		s = sizeClass->head;
+
+		if (!s)
 			break;
-		}
 	}
+	while (InterlockedCompareExchangePointer((PVOID volatile*) &sizeClass->head, s->next,
+	        s) != s);
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
+	LeaveCriticalSection(&sizeClass->lock);
+
+	if (s)
+	{
+		InterlockedDecrement(&sizeClass->count);
+		s->next = NULL;
+	}
+
+	return s;
 }
 
-void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
+static void StreamPool_MapStore(wStream* volatile* slot, wStream* s)
 {
-	if (count > 0)
+	wStream* old;
+
+	do
 	{
-		if (pool->aSize + count > pool->aCapacity)
+		old = *slot;
+	}
+	while (InterlockedCompareExchangePointer((PVOID volatile*) slot, s, old) != old);
+}
+
+/**
+ * Registers the buffer of a stream for StreamPool_Find. The offsets of a
+ * page are published before the stream, and reset after it was removed.
+ */
+BOOL StreamPool_Track(wStream* s)
+{
+	ULONG_PTR first = (ULONG_PTR) s->buffer;
+	ULONG_PTR last = first + s->capacity - 1;
+	ULONG_PTR address;
+	wStreamPoolPage* page;
+
+	for (address = first & ~(STREAM_POOL_PAGE_SIZE - 1); address <= last;
+	     address += STREAM_POOL_PAGE_SIZE)
+	{
+		if (!(page = StreamPool_MapPage(address, TRUE)))
 		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->aCapacity * 2;
-			new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->aCapacity = new_cap;
-			pool->aArray = new_arr;
+			StreamPool_Untrack(s);
+			return FALSE;
 		}
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
+		if (address < first)
+		{
+			InterlockedExchange(&page->start, (LONG)(first - address));
+			StreamPool_MapStore(&page->upper, s);
+		}
+		else
+		{
+			InterlockedExchange(&page->end, (last - address < STREAM_POOL_PAGE_SIZE - 1) ?
+			                    (LONG)(last - address + 1) : 0);
+			StreamPool_MapStore(&page->lower, s);
+		}
 	}
-	else if (count < 0)
+
+	return TRUE;
+}
+
+void StreamPool_Untrack(wStream* s)
+{
+	ULONG_PTR first = (ULONG_PTR) s->buffer;
+	ULONG_PTR last = first + s->capacity - 1;
+	ULONG_PTR address;
+	wStreamPoolPage* page;
+
+	for (address = first & ~(STREAM_POOL_PAGE_SIZE - 1); address <= last;
+	     address += STREAM_POOL_PAGE_SIZE)
 	{
-		if (pool->aSize - index + count > 0)
+		if (!(page = StreamPool_MapPage(address, FALSE)))
+			continue;
+
+		if (address < first)
 		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-					(pool->aSize - index + count) * sizeof(wStream*));
+			if (InterlockedCompareExchangePointer((PVOID volatile*) &page->upper, NULL, s) == s)
+				InterlockedExchange(&page->start, 0);
+		}
+		else
+		{
+			if (InterlockedCompareExchangePointer((PVOID volatile*) &page->lower, NULL, s) == s)
+				InterlockedExchange(&page->end, 0);
 		}
-
-		pool->aSize += count;
 	}
 }
 
+/**
+ * Every stream created by the pool holds a reference on it, the pool is
+ * only freed once StreamPool_Free was called and the last stream is gone.
+ */
+static void StreamPool_Ref(wStreamPool* pool)
+{
+	InterlockedIncrement(&pool->refs);
+}
+
+void StreamPool_Unref(wStreamPool* pool)
+{
+	int index;
+
+	if (InterlockedDecrement(&pool->refs) != 0)
+		return;
+
+	for (index = 0; index < STREAM_POOL_CLASSES; index++)
+		DeleteCriticalSection(&pool->classes[index].lock);
+
+	DeleteCriticalSection(&pool->lock);
+
+	free(pool);
+}
+
 /**
  * Gets a stream from the pool.
  */
@@ -144,51 +329,44 @@ void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
 	int index;
-	int foundIndex;
 	wStream* s = NULL;
 
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
-
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
+	index = StreamPool_ClassForSize(size);
 
-	for (index = 0; index < pool->aSize; index++)
+	if (index >= 0)
 	{
-		s = pool->aArray[index];
-
-		if (Stream_Capacity(s) >= size)
-		{
-			foundIndex = index;
-			break;
-		}
+		size = STREAM_POOL_CLASS_SIZE(index);
+		s = StreamPool_Pop(&pool->classes[index]);
 	}
 
-	if (foundIndex < 0)
+	if (s)
 	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
+		InterlockedDecrement(&pool->aSize);
+		StreamPool_Count(&pool->hits);
 	}
 	else
 	{
-		Stream_SetPosition(s, 0);
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
-	}
+		StreamPool_Count(&pool->misses);
 
-	if (s)
-	{
+		if (!(s = Stream_New(NULL, size)))
+			return NULL;
+
+		if (!StreamPool_Track(s))
+		{
+			Stream_Free(s, TRUE);
+			return NULL;
+		}
+
+		StreamPool_Ref(pool);
 		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
 	}
 
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
-
+	Stream_SetPosition(s, 0);
+	s->count = 1;
+	InterlockedIncrement(&pool->uSize);
 	return s;
 }
 
@@ -198,40 +376,30 @@ out_fail:
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	int index = StreamPool_ClassForCapacity(Stream_Capacity(s));
 
-	if ((pool->aSize + 1) >= pool->aCapacity)
+	/* Freeing the stream may drop the last reference on a closed pool */
+	StreamPool_Ref(pool);
+	InterlockedDecrement(&pool->uSize);
+	s->count = 0;
+
+	if ((index < 0) || pool->closed ||
+	    (pool->classes[index].count >= StreamPool_ClassLimit(index)))
 	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->aCapacity * 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
+		StreamPool_Count(&pool->discards);
+		Stream_Free(s, TRUE);
 	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
+	else
 	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->aCapacity / 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
+		InterlockedIncrement(&pool->aSize);
+		StreamPool_Push(&pool->classes[index], s);
 
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
+		/* StreamPool_Free may have cleared the classes before the push */
+		if (pool->closed)
+			StreamPool_Clear(pool);
+	}
 
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
+	StreamPool_Unref(pool);
 }
 
 /**
@@ -259,11 +427,7 @@ void StreamPool_Unlock(wStreamPool* pool)
 void Stream_AddRef(wStream* s)
 {
 	if (s->pool)
-	{
-		StreamPool_Lock(s->pool);
-		s->count++;
-		StreamPool_Unlock(s->pool);
-	}
+		InterlockedIncrement((LONG volatile*) &s->count);
 }
 
 /**
@@ -272,15 +436,9 @@ void Stream_AddRef(wStream* s)
 
 void Stream_Release(wStream* s)
 {
-	DWORD count;
-
 	if (s->pool)
 	{
-		StreamPool_Lock(s->pool);
-		count = --(s->count);
-		StreamPool_Unlock(s->pool);
-
-		if (count == 0)
+		if (InterlockedDecrement((LONG volatile*) &s->count) == 0)
 			StreamPool_Return(s->pool, s);
 	}
 }
@@ -291,26 +449,33 @@ void Stream_Release(wStream* s)
 
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
-	int index;
-	wStream* s = NULL;
-	BOOL found = FALSE;
+	LONG offset;
+	LONG start;
+	LONG end;
+	wStream* s;
+	wStreamPoolPage* page = StreamPool_MapPage((ULONG_PTR) ptr, FALSE);
 
-	EnterCriticalSection(&pool->lock);
+	if (!page)
+		return NULL;
 
-	for (index = 0; index < pool->uSize; index++)
-	{
-		s = pool->uArray[index];
+	offset = (LONG)(((ULONG_PTR) ptr) & (STREAM_POOL_PAGE_SIZE - 1));
+	start = page->start;
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
-		{
-			found = TRUE;
-			break;
-		}
+	if (start && (offset >= start))
+	{
+		s = page->upper;
+	}
+	else
+	{
+		end = page->end;
+		s = (end && (offset >= end)) ? NULL : page->lower;
 	}
 
-	LeaveCriticalSection(&pool->lock);
+	/* Cached streams are not handed out by address */
+	if (!s || (s->pool != pool) || (s->count <= 0))
+		return NULL;
 
-	return (found) ? s : NULL;
+	return s;
 }
 
 /**
@@ -347,17 +512,35 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	int index;
+	wStream* s;
 
-	while (pool->aSize > 0)
+	for (index = 0; index < STREAM_POOL_CLASSES; index++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
+		while ((s = StreamPool_Pop(&pool->classes[index])))
+		{
+			InterlockedDecrement(&pool->aSize);
+			Stream_Free(s, TRUE);
+		}
 	}
+}
+
+/**
+ * Gets the number of streams served from the cache (hits), the number of
+ * streams that had to be allocated (misses) and the number of returned
+ * streams that were freed instead of cached (discards).
+ */
 
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
+void StreamPool_GetStatistics(wStreamPool* pool, wStreamPoolStatistics* stats)
+{
+	if (!pool || !stats)
+		return;
+
+	stats->hits = (UINT64) InterlockedCompareExchange64(&pool->hits, 0, 0);
+	stats->misses = (UINT64) InterlockedCompareExchange64(&pool->misses, 0, 0);
+	stats->discards = (UINT64) InterlockedCompareExchange64(&pool->discards, 0, 0);
+	stats->available = (UINT32) pool->aSize;
+	stats->used = (UINT32) pool->uSize;
 }
 
 /**
@@ -366,35 +549,20 @@ void StreamPool_Clear(wStreamPool* pool)
 
 wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 {
+	int index;
 	wStreamPool* pool = NULL;
 
 	pool = (wStreamPool*) calloc(1, sizeof(wStreamPool));
 
 	if (pool)
 	{
+		/* The pool is always thread safe, synchronized is kept for compatibility */
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
+		pool->refs = 1;
 
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**) calloc(pool->aCapacity, sizeof(wStream*));
-
-		if (!pool->aArray)
-		{
-			free(pool);
-			return NULL;
-		}
-
-		pool->uSize = 0;
-		pool->uCapacity = 32;
-		pool->uArray = (wStream**) calloc(pool->uCapacity, sizeof(wStream*));
-
-		if (!pool->uArray)
-		{
-			free(pool->aArray);
-			free(pool);
-			return NULL;
-		}
+		for (index = 0; index < STREAM_POOL_CLASSES; index++)
+			InitializeCriticalSectionAndSpinCount(&pool->classes[index].lock, 4000);
 
 		InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
 	}
@@ -402,17 +570,17 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 	return pool;
 }
 
+/**
+ * Streams that are still taken keep the pool alive, it is freed when the
+ * last of them is released.
+ */
+
 void StreamPool_Free(wStreamPool* pool)
 {
 	if (pool)
 	{
+		InterlockedExchange(&pool->closed, TRUE);
 		StreamPool_Clear(pool);
-
-		DeleteCriticalSection(&pool->lock);
-
-		free(pool->aArray);
-		free(pool->uArray);
-
-		free(pool);
+		StreamPool_Unref(pool);
 	}
 }
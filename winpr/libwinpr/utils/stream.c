@@ -25,6 +25,8 @@
 #include <winpr/crt.h>
 #include <winpr/stream.h>
 
+#include "stream.h"
+
 BOOL Stream_EnsureCapacity(wStream* s, size_t size)
 {
 	if (s->capacity < size)
@@ -46,15 +48,25 @@ BOOL Stream_EnsureCapacity(wStream* s, size_t size)
 
 		position = Stream_GetPosition(s);
 
+		if (s->pool)
+			StreamPool_Untrack(s);
+
 		new_buf = (BYTE*) realloc(s->buffer, new_capacity);
 		if (!new_buf)
+		{
+			if (s->pool)
+				StreamPool_Track(s);
 			return FALSE;
+		}
 		s->buffer = new_buf;
 		s->capacity = new_capacity;
 		s->length = new_capacity;
 		ZeroMemory(&s->buffer[old_capacity], s->capacity - old_capacity);
 
 		Stream_SetPosition(s, position);
+
+		if (s->pool && !StreamPool_Track(s))
+			return FALSE;
 	}
 	return TRUE;
 }
@@ -95,6 +107,7 @@ wStream* Stream_New(BYTE* buffer, size_t size)
 	s->length = size;
 
 	s->pool = NULL;
+	s->next = NULL;
 	s->count = 0;
 
 	return s;
@@ -104,9 +117,17 @@ void Stream_Free(wStream* s, BOOL bFreeBuffer)
 {
 	if (s)
 	{
+		wStreamPool* pool = s->pool;
+
+		if (pool)
+			StreamPool_Untrack(s);
+
 		if (bFreeBuffer)
 			free(s->buffer);
 
 		free(s);
+
+		if (pool)
+			StreamPool_Unref(pool);
 	}
 }
@@ -0,0 +1,32 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Stream Utils
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WINPR_UTILS_STREAM_PRIVATE_H
+#define WINPR_UTILS_STREAM_PRIVATE_H
+
+#include <winpr/stream.h>
+
+/**
+ * The stream pool maps buffer addresses back to its streams, the mapping
+ * has to be updated whenever the buffer of a pooled stream is replaced.
+ * A freed pooled stream drops its reference on the pool.
+ */
+BOOL StreamPool_Track(wStream* s);
+void StreamPool_Untrack(wStream* s);
+void StreamPool_Unref(wStreamPool* pool);
+
+#endif /* WINPR_UTILS_STREAM_PRIVATE_H */
@@ -5,6 +5,167 @@
 
 #define BUFFER_SIZE 16384
 
+static BOOL TestStreamPoolClasses(void)
+{
+	BOOL rc = FALSE;
+	wStream* s[3] = { 0 };
+	wStreamPoolStatistics stats;
+	wStreamPool* pool = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!pool)
+		return FALSE;
+
+	/* Requests are rounded up to their size class and served from it */
+	if (!(s[0] = StreamPool_Take(pool, 5000)) || (Stream_Capacity(s[0]) != 8192))
+		goto fail;
+
+	Stream_Release(s[0]);
+
+	if ((s[1] = StreamPool_Take(pool, 6000)) != s[0])
+		goto fail;
+
+	s[0] = NULL;
+
+	/* Other classes do not share streams */
+	if (!(s[2] = StreamPool_Take(pool, 100000)) || (s[2] == s[1]))
+		goto fail;
+
+	/* Any address inside a buffer maps back to its stream, also after growing */
+	if (StreamPool_Find(pool, Stream_Buffer(s[2]) + 99999) != s[2])
+		goto fail;
+
+	if (!Stream_EnsureCapacity(s[2], 1024 * 1024))
+		goto fail;
+
+	if (StreamPool_Find(pool, Stream_Buffer(s[2]) + 1000000) != s[2])
+		goto fail;
+
+	StreamPool_GetStatistics(pool, &stats);
+
+	if ((stats.hits != 1) || (stats.misses != 2) || (stats.used != 2) || (stats.available != 0))
+	{
+		printf("StreamPool: unexpected statistics hits: %d misses: %d\n",
+		       (int) stats.hits, (int) stats.misses);
+		goto fail;
+	}
+
+	Stream_Release(s[1]);
+	Stream_Release(s[2]);
+	s[1] = s[2] = NULL;
+	StreamPool_GetStatistics(pool, &stats);
+
+	if ((stats.used != 0) || (stats.available != 2))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (s[0])
+		Stream_Release(s[0]);
+
+	if (s[1])
+		Stream_Release(s[1]);
+
+	if (s[2])
+		Stream_Release(s[2]);
+
+	StreamPool_Free(pool);
+	return rc;
+}
+
+/* Buffers sharing a page are told apart by their address */
+static BOOL TestStreamPoolFind(void)
+{
+	int index;
+	BOOL rc = FALSE;
+	BYTE other[64];
+	wStream* s[32] = { 0 };
+	wStreamPool* pool = StreamPool_New(TRUE, BUFFER_SIZE);
+	wStreamPool* pool2 = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!pool || !pool2)
+		goto fail;
+
+	for (index = 0; index < 32; index++)
+	{
+		if (!(s[index] = StreamPool_Take(pool, 4096)))
+			goto fail;
+	}
+
+	for (index = 0; index < 32; index++)
+	{
+		BYTE* buffer = Stream_Buffer(s[index]);
+
+		if ((StreamPool_Find(pool, buffer) != s[index]) ||
+		    (StreamPool_Find(pool, buffer + 2048) != s[index]) ||
+		    (StreamPool_Find(pool, buffer + Stream_Capacity(s[index]) - 1) != s[index]))
+			goto fail;
+
+		/* Streams are only found in their own pool */
+		if (StreamPool_Find(pool2, buffer) != NULL)
+			goto fail;
+	}
+
+	if (StreamPool_Find(pool, other) != NULL)
+		goto fail;
+
+	/* Cached streams are not found */
+	Stream_Release(s[0]);
+
+	if (StreamPool_Find(pool, Stream_Buffer(s[0])) != NULL)
+	{
+		s[0] = NULL;
+		goto fail;
+	}
+
+	s[0] = NULL;
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < 32; index++)
+	{
+		if (s[index])
+			Stream_Release(s[index]);
+	}
+
+	StreamPool_Free(pool);
+	StreamPool_Free(pool2);
+	return rc;
+}
+
+/* Streams still taken when the pool is freed keep working */
+static BOOL TestStreamPoolOutlive(void)
+{
+	wStream* s[3] = { 0 };
+	wStreamPool* pool = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!pool)
+		return FALSE;
+
+	s[0] = StreamPool_Take(pool, 0);
+	s[1] = StreamPool_Take(pool, 0);
+	s[2] = StreamPool_Take(pool, 0);
+	StreamPool_Free(pool);
+
+	if (!s[0] || !s[1] || !s[2])
+	{
+		Stream_Free(s[0], TRUE);
+		Stream_Free(s[1], TRUE);
+		Stream_Free(s[2], TRUE);
+		return FALSE;
+	}
+
+	if (!Stream_EnsureCapacity(s[0], 1024 * 1024))
+		return FALSE;
+
+	Stream_Release(s[0]);
+	Stream_AddRef(s[1]);
+	Stream_Release(s[1]);
+	Stream_Release(s[1]);
+	Stream_Free(s[2], TRUE);
+	return TRUE;
+}
+
 int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
@@ -96,6 +257,15 @@ int TestStreamPool(int argc, char* argv[])
 
 	StreamPool_Free(pool);
 
+	if (!TestStreamPoolClasses())
+		return -1;
+
+	if (!TestStreamPoolFind())
+		return -1;
+
+	if (!TestStreamPoolOutlive())
+		return -1;
+
 	return 0;
 }
 